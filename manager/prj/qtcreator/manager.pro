@@ -46,6 +46,9 @@ CONFIG(release, debug|release) {
 
 #DEFINES += QCUSTOMPLOT_USE_OPENGL
 
+#the measurement partitions are attached to the main database, one per month
+DEFINES += SQLITE_MAX_ATTACHED=125
+
 win32-msvc* {
     QMAKE_LFLAGS_RELEASE += /MAP
     QMAKE_CFLAGS_RELEASE += /Zi
@@ -99,6 +102,7 @@ HEADERS += \
     ../../../common/src/QTcpSocketAdapter.h \
     ../../../common/src/Queue.h \
     ../../../common/src/Result.h \
+    ../../src/AlarmEvaluator.h \
     ../../src/AlarmsModel.h \
     ../../src/AlarmsWidget.h \
     ../../src/BaseStationsWidget.h \
@@ -113,11 +117,13 @@ HEADERS += \
     ../../src/ExportDataDialog.h \
     ../../src/ExportLogsDialog.h \
     ../../src/ExportPicDialog.h \
+    ../../src/HashIndex.h \
     ../../src/HtmlItemDelegate.h \
     ../../src/Logger.h \
     ../../src/LogsModel.h \
     ../../src/LogsWidget.h \
     ../../src/Manager.h \
+    ../../src/MeasurementChunk.h \
     ../../src/MeasurementDetailsDialog.h \
     ../../src/MeasurementsDelegate.h \
     ../../src/MeasurementsModel.h \
@@ -125,6 +131,8 @@ HEADERS += \
     ../../src/PermissionsCheck.h \
     ../../src/PlotToolTip.h \
     ../../src/PlotWidget.h \
+    ../../src/QueryWorker.h \
+    ../../src/ReadConnectionPool.h \
     ../../src/ReportsModel.h \
     ../../src/ReportsWidget.h \
     ../../src/SensorDetailsDialog.h \
@@ -160,6 +168,7 @@ HEADERS += \
 
 SOURCES += \
     ../../../common/src/Crypt.cpp \
+    ../../src/AlarmEvaluator.cpp \
     ../../src/AlarmsModel.cpp \
     ../../src/AlarmsWidget.cpp \
     ../../src/BaseStationsWidget.cpp \
@@ -179,6 +188,7 @@ SOURCES += \
     ../../src/LogsModel.cpp \
     ../../src/LogsWidget.cpp \
     ../../src/Manager.cpp \
+    ../../src/MeasurementChunk.cpp \
     ../../src/MeasurementDetailsDialog.cpp \
     ../../src/MeasurementsDelegate.cpp \
     ../../src/MeasurementsModel.cpp \
@@ -186,6 +196,8 @@ SOURCES += \
     ../../src/PermissionsCheck.cpp \
     ../../src/PlotToolTip.cpp \
     ../../src/PlotWidget.cpp \
+    ../../src/QueryWorker.cpp \
+    ../../src/ReadConnectionPool.cpp \
     ../../src/ReportsModel.cpp \
     ../../src/ReportsWidget.cpp \
     ../../src/SensorDetailsDialog.cpp \
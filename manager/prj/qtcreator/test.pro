@@ -9,6 +9,7 @@ CONFIG += c++2a
 # depend on your compiler). Please consult the documentation of the
 # deprecated API in order to know how to port your code away from it.
 DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += SQLITE_MAX_ATTACHED=125
 
 INCLUDEPATH += ../../src
 INCLUDEPATH += ../../src/tests
@@ -44,9 +45,34 @@ SOURCES += \
     ../../src/Smtp/mimeattachment.cpp \
     ../../src/Smtp/emailaddress.cpp \
     ../../src/Logger.cpp \
+    ../../src/MeasurementChunk.cpp \
+    ../../src/AlarmEvaluator.cpp \
+    ../../src/QueryWorker.cpp \
+    ../../src/ReadConnectionPool.cpp \
+    ../../src/tests/benchAlarmBackfill.cpp \
+    ../../src/tests/benchAlarmBacklog.cpp \
+    ../../src/tests/benchAlarmEvaluation.cpp \
+    ../../src/tests/benchAlarmLatency.cpp \
+    ../../src/tests/benchIdleProcess.cpp \
+    ../../src/tests/benchIngest.cpp \
+    ../../src/tests/benchMeasurementChunks.cpp \
+    ../../src/tests/benchPagination.cpp \
+    ../../src/tests/benchRecentMeasurements.cpp \
+    ../../src/tests/benchRetention.cpp \
+    ../../src/tests/benchRollups.cpp \
+    ../../src/tests/benchSave.cpp \
+    ../../src/tests/benchSensorLookup.cpp \
+    ../../src/tests/benchSnapshot.cpp \
+    ../../src/tests/benchStatementCache.cpp \
+    ../../src/tests/benchStreaming.cpp \
+    ../../src/tests/benchTimeWindows.cpp \
+    ../../src/tests/testAlarms.cpp \
+    ../../src/tests/testCommsSchedule.cpp \
     ../../src/tests/testCsvSettings.cpp \
+    ../../src/tests/testDeadlines.cpp \
     ../../src/tests/testGeneralSettings.cpp \
     ../../src/tests/testMain.cpp \
+    ../../src/tests/testMeasurements.cpp \
     ../../src/tests/testSensorBasicOperations.cpp \
     ../../src/tests/testSensorSettings.cpp \
     ../../src/tests/testSensorTimeConfigs.cpp \
@@ -77,5 +103,10 @@ HEADERS += \
     ../../src/Smtp/mimeattachment.h \
     ../../src/Smtp/emailaddress.h \
     ../../src/Smtp/SmtpMime \
+    ../../src/HashIndex.h \
     ../../src/Logger.h \
+    ../../src/MeasurementChunk.h \
+    ../../src/AlarmEvaluator.h \
+    ../../src/QueryWorker.h \
+    ../../src/ReadConnectionPool.h \
     ../../src/tests/testUtils.h
@@ -0,0 +1,272 @@
+#include "AlarmEvaluator.h"
+#include <algorithm>
+#include "Utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define ALARMS_USE_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace alarms
+{
+
+static constexpr size_t k_chunkSize = 256; //the compare results are kept on the stack for this many measurements
+static constexpr float k_hysteresis = 0.4f / 100.f; //+- 0.4%
+
+//////////////////////////////////////////////////////////////////////////
+
+bool isWatched(DB::AlarmDescriptor const& descriptor, DB::SensorId sensorId)
+{
+    return !descriptor.filterSensors || descriptor.sensors.find(sensorId) != descriptor.sensors.end();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Plan compile(DB::AlarmDescriptor const& descriptor, DB::SensorSettings const& settings)
+{
+    Plan plan;
+    if (descriptor.lowTemperatureWatch)
+    {
+        plan.lowTemperatureSoft = descriptor.lowTemperatureSoft;
+        plan.lowTemperatureHard = descriptor.lowTemperatureHard;
+    }
+    if (descriptor.highTemperatureWatch)
+    {
+        plan.highTemperatureSoft = descriptor.highTemperatureSoft;
+        plan.highTemperatureHard = descriptor.highTemperatureHard;
+    }
+    if (descriptor.lowHumidityWatch)
+    {
+        plan.lowHumiditySoft = descriptor.lowHumiditySoft;
+        plan.lowHumidityHard = descriptor.lowHumidityHard;
+    }
+    if (descriptor.highHumidityWatch)
+    {
+        plan.highHumiditySoft = descriptor.highHumiditySoft;
+        plan.highHumidityHard = descriptor.highHumidityHard;
+    }
+    if (descriptor.lowVccWatch)
+    {
+        plan.lowBatteryLevel = settings.alertBatteryLevel - k_hysteresis;
+        plan.highBatteryLevel = settings.alertBatteryLevel + k_hysteresis;
+    }
+    if (descriptor.lowSignalWatch)
+    {
+        plan.lowSignalLevel = settings.alertSignalStrengthLevel - k_hysteresis;
+        plan.highSignalLevel = settings.alertSignalStrengthLevel + k_hysteresis;
+    }
+    return plan;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Plan compile(DB::AlarmDescriptor const& descriptor, DB::SensorSettings const& settings, DB::Sensor const& sensor)
+{
+    if (!isWatched(descriptor, sensor.id))
+        return Plan();
+
+    Plan plan = compile(descriptor, settings);
+    if (descriptor.sensorBlackoutWatch && sensor.blackout)
+        plan.sensorTriggers |= DB::AlarmTrigger::SensorBlackout;
+    return plan;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementBlock::add(DB::MeasurementDescriptor const& md)
+{
+    temperatures.push_back(md.temperature);
+    humidities.push_back(md.humidity);
+    batteryLevels.push_back(utils::getBatteryLevel(md.vcc));
+    signalLevels.push_back(utils::getSignalLevel(std::min(md.signalStrength.b2s, md.signalStrength.s2b)));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementBlock::clear()
+{
+    temperatures.clear();
+    humidities.clear();
+    batteryLevels.clear();
+    signalLevels.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t mask(bool value)
+{
+    return 0u - uint32_t(value);
+}
+
+//The triggers of the thresholds, and for the ones with hysteresis the triggers under their high level
+static void compare(Plan const& plan, MeasurementBlock const& block, size_t start, size_t count, uint32_t* triggers, uint32_t* hysteresisTriggers)
+{
+    float const* temperatures = block.temperatures.data() + start;
+    float const* humidities = block.humidities.data() + start;
+    float const* batteryLevels = block.batteryLevels.data() + start;
+    float const* signalLevels = block.signalLevels.data() + start;
+
+    size_t i = 0;
+
+#ifdef ALARMS_USE_SSE2
+    const __m128 lowTemperatureSoft = _mm_set1_ps(plan.lowTemperatureSoft);
+    const __m128 lowTemperatureHard = _mm_set1_ps(plan.lowTemperatureHard);
+    const __m128 highTemperatureSoft = _mm_set1_ps(plan.highTemperatureSoft);
+    const __m128 highTemperatureHard = _mm_set1_ps(plan.highTemperatureHard);
+    const __m128 lowHumiditySoft = _mm_set1_ps(plan.lowHumiditySoft);
+    const __m128 lowHumidityHard = _mm_set1_ps(plan.lowHumidityHard);
+    const __m128 highHumiditySoft = _mm_set1_ps(plan.highHumiditySoft);
+    const __m128 highHumidityHard = _mm_set1_ps(plan.highHumidityHard);
+    const __m128 lowBatteryLevel = _mm_set1_ps(plan.lowBatteryLevel);
+    const __m128 highBatteryLevel = _mm_set1_ps(plan.highBatteryLevel);
+    const __m128 lowSignalLevel = _mm_set1_ps(plan.lowSignalLevel);
+    const __m128 highSignalLevel = _mm_set1_ps(plan.highSignalLevel);
+
+    //the compares give all bits set where true, the bit of the trigger is kept from them. NaN compares false
+    auto bits = [](__m128 comparison, uint32_t trigger)
+    {
+        return _mm_and_si128(_mm_castps_si128(comparison), _mm_set1_epi32(int32_t(trigger)));
+    };
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 temperature = _mm_loadu_ps(temperatures + i);
+        __m128 humidity = _mm_loadu_ps(humidities + i);
+        __m128 batteryLevel = _mm_loadu_ps(batteryLevels + i);
+        __m128 signalLevel = _mm_loadu_ps(signalLevels + i);
+
+        __m128i t = bits(_mm_cmple_ps(temperature, lowTemperatureSoft), DB::AlarmTrigger::MeasurementLowTemperatureSoft);
+        t = _mm_or_si128(t, bits(_mm_cmple_ps(temperature, lowTemperatureHard), DB::AlarmTrigger::MeasurementLowTemperatureHard));
+        t = _mm_or_si128(t, bits(_mm_cmpge_ps(temperature, highTemperatureSoft), DB::AlarmTrigger::MeasurementHighTemperatureSoft));
+        t = _mm_or_si128(t, bits(_mm_cmpge_ps(temperature, highTemperatureHard), DB::AlarmTrigger::MeasurementHighTemperatureHard));
+        t = _mm_or_si128(t, bits(_mm_cmple_ps(humidity, lowHumiditySoft), DB::AlarmTrigger::MeasurementLowHumiditySoft));
+        t = _mm_or_si128(t, bits(_mm_cmple_ps(humidity, lowHumidityHard), DB::AlarmTrigger::MeasurementLowHumidityHard));
+        t = _mm_or_si128(t, bits(_mm_cmpge_ps(humidity, highHumiditySoft), DB::AlarmTrigger::MeasurementHighHumiditySoft));
+        t = _mm_or_si128(t, bits(_mm_cmpge_ps(humidity, highHumidityHard), DB::AlarmTrigger::MeasurementHighHumidityHard));
+        t = _mm_or_si128(t, bits(_mm_cmple_ps(batteryLevel, lowBatteryLevel), DB::AlarmTrigger::MeasurementLowVcc));
+        t = _mm_or_si128(t, bits(_mm_cmple_ps(signalLevel, lowSignalLevel), DB::AlarmTrigger::MeasurementLowSignal));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(triggers + i), t);
+
+        __m128i h = bits(_mm_cmple_ps(batteryLevel, highBatteryLevel), DB::AlarmTrigger::MeasurementLowVcc);
+        h = _mm_or_si128(h, bits(_mm_cmple_ps(signalLevel, highSignalLevel), DB::AlarmTrigger::MeasurementLowSignal));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(hysteresisTriggers + i), h);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        float temperature = temperatures[i];
+        float humidity = humidities[i];
+        triggers[i] = (mask(temperature <= plan.lowTemperatureSoft) & DB::AlarmTrigger::MeasurementLowTemperatureSoft) |
+                      (mask(temperature <= plan.lowTemperatureHard) & DB::AlarmTrigger::MeasurementLowTemperatureHard) |
+                      (mask(temperature >= plan.highTemperatureSoft) & DB::AlarmTrigger::MeasurementHighTemperatureSoft) |
+                      (mask(temperature >= plan.highTemperatureHard) & DB::AlarmTrigger::MeasurementHighTemperatureHard) |
+                      (mask(humidity <= plan.lowHumiditySoft) & DB::AlarmTrigger::MeasurementLowHumiditySoft) |
+                      (mask(humidity <= plan.lowHumidityHard) & DB::AlarmTrigger::MeasurementLowHumidityHard) |
+                      (mask(humidity >= plan.highHumiditySoft) & DB::AlarmTrigger::MeasurementHighHumiditySoft) |
+                      (mask(humidity >= plan.highHumidityHard) & DB::AlarmTrigger::MeasurementHighHumidityHard) |
+                      (mask(batteryLevels[i] <= plan.lowBatteryLevel) & DB::AlarmTrigger::MeasurementLowVcc) |
+                      (mask(signalLevels[i] <= plan.lowSignalLevel) & DB::AlarmTrigger::MeasurementLowSignal);
+        hysteresisTriggers[i] = (mask(batteryLevels[i] <= plan.highBatteryLevel) & DB::AlarmTrigger::MeasurementLowVcc) |
+                                (mask(signalLevels[i] <= plan.highSignalLevel) & DB::AlarmTrigger::MeasurementLowSignal);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+uint32_t evaluate(Plan const& plan, MeasurementBlock const& block, uint32_t oldTriggers, DB::AlarmTriggers* triggers)
+{
+    uint32_t thresholdTriggers[k_chunkSize];
+    uint32_t hysteresisTriggers[k_chunkSize];
+
+    //local, the compiler can't tell the triggers written don't alias the plan
+    const uint32_t sensorTriggers = plan.sensorTriggers;
+
+    uint32_t previous = oldTriggers;
+    for (size_t start = 0; start < block.size(); start += k_chunkSize)
+    {
+        size_t count = std::min(k_chunkSize, block.size() - start);
+        compare(plan, block, start, count, thresholdTriggers, hysteresisTriggers);
+
+        //each measurement depends on the previous one only through the hysteresis
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t current = thresholdTriggers[i] | (previous & hysteresisTriggers[i]) | sensorTriggers;
+            uint32_t diff = previous ^ current;
+            DB::AlarmTriggers& t = triggers[start + i];
+            t.current = current;
+            t.added = diff & current;
+            t.removed = diff & previous;
+            previous = current;
+        }
+    }
+    return previous;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void SensorAlarmIndex::add(DB::Alarm const& alarm, size_t alarmSlot, Plan const& plan, DB::Sensor const& sensor, size_t sensorSlot)
+{
+    auto it = alarm.triggersPerSensor.find(sensor.id);
+    uint32_t triggers = it != alarm.triggersPerSensor.end() ? it->second : 0;
+    m_triggers[alarmSlot][sensorSlot] = triggers;
+
+    DB::AlarmDescriptor const& ad = alarm.descriptor;
+    bool watched = isWatched(ad, sensor.id);
+    bool watchesSensors = ad.lowTemperatureWatch || ad.highTemperatureWatch || ad.lowHumidityWatch || ad.highHumidityWatch ||
+                          ad.lowVccWatch || ad.lowSignalWatch || ad.sensorBlackoutWatch;
+
+    //an alarm that stopped applying still has to clear its triggers, it's dropped at the next rebuild after that
+    if ((!watched || !watchesSensors) && triggers == 0)
+        return;
+
+    SensorAlarm sa;
+    sa.alarmSlot = alarmSlot;
+    sa.watched = watched;
+    if (watched)
+    {
+        sa.plan = plan;
+        sa.blackoutTriggers = ad.sensorBlackoutWatch ? DB::AlarmTrigger::SensorBlackout : 0;
+    }
+    m_sensorAlarms[sensorSlot].push_back(sa);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void SensorAlarmIndex::rebuild(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings)
+{
+    m_sensorAlarms.assign(sensors.size(), std::vector<SensorAlarm>());
+    m_triggers.assign(alarms.size(), std::vector<uint32_t>(sensors.size(), 0));
+    for (size_t a = 0; a < alarms.size(); a++)
+    {
+        Plan plan = compile(alarms[a].descriptor, settings);
+        for (size_t s = 0; s < sensors.size(); s++)
+            add(alarms[a], a, plan, sensors[s], s);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void SensorAlarmIndex::addAlarm(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings)
+{
+    size_t a = alarms.size() - 1;
+    m_triggers.emplace_back(sensors.size(), 0);
+    Plan plan = compile(alarms[a].descriptor, settings);
+    for (size_t s = 0; s < sensors.size(); s++)
+        add(alarms[a], a, plan, sensors[s], s);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void SensorAlarmIndex::addSensor(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings)
+{
+    size_t s = sensors.size() - 1;
+    m_sensorAlarms.emplace_back();
+    for (size_t a = 0; a < alarms.size(); a++)
+    {
+        m_triggers[a].push_back(0);
+        add(alarms[a], a, compile(alarms[a].descriptor, settings), sensors[s], s);
+    }
+}
+
+}
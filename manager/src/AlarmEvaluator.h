@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include "DB.h"
+
+//Evaluates the measurement triggers of an alarm for a block of measurements of a sensor at a time.
+//The alarm is compiled for the sensor into thresholds, the watches that are off (or a sensor the alarm doesn't watch)
+//compare against NaN which never triggers. The measurements are kept as arrays, so the thresholds are compared
+//4 measurements at a time where SSE2 is available.
+//The alarms that apply to each sensor are kept compiled in a SensorAlarmIndex, so a sensor only looks at its own alarms.
+namespace alarms
+{
+    static constexpr float k_never = std::numeric_limits<float>::quiet_NaN();
+
+    struct Plan
+    {
+        float lowTemperatureSoft = k_never;
+        float lowTemperatureHard = k_never;
+        float highTemperatureSoft = k_never;
+        float highTemperatureHard = k_never;
+        float lowHumiditySoft = k_never;
+        float lowHumidityHard = k_never;
+        float highHumiditySoft = k_never;
+        float highHumidityHard = k_never;
+
+        //the low vcc and signal triggers have a hysteresis: they trigger under the low level and stay triggered under the high one
+        float lowBatteryLevel = k_never;
+        float highBatteryLevel = k_never;
+        float lowSignalLevel = k_never;
+        float highSignalLevel = k_never;
+
+        uint32_t sensorTriggers = 0; //not from the measurements, the blackout
+    };
+
+    bool isWatched(DB::AlarmDescriptor const& descriptor, DB::SensorId sensorId);
+    //the plan for a sensor the alarm watches, without the blackout
+    Plan compile(DB::AlarmDescriptor const& descriptor, DB::SensorSettings const& settings);
+    Plan compile(DB::AlarmDescriptor const& descriptor, DB::SensorSettings const& settings, DB::Sensor const& sensor);
+
+    //The measurements of a sensor, in index order
+    struct MeasurementBlock
+    {
+        void add(DB::MeasurementDescriptor const& md);
+        void clear();
+        size_t size() const { return temperatures.size(); }
+
+        std::vector<float> temperatures;
+        std::vector<float> humidities;
+        std::vector<float> batteryLevels;
+        std::vector<float> signalLevels;
+    };
+
+    //Writes the triggers of each measurement of the block (block.size() of them), starting from the alarm's current triggers for the sensor.
+    //Returns the triggers after the last measurement.
+    uint32_t evaluate(Plan const& plan, MeasurementBlock const& block, uint32_t oldTriggers, DB::AlarmTriggers* triggers);
+
+    //An alarm that applies to a sensor: it watches the sensor for something, or it's still triggered for it
+    struct SensorAlarm
+    {
+        size_t alarmSlot = 0; //the index of the alarm
+        bool watched = false;
+        Plan plan; //without the blackout, it comes and goes with the sensor
+        uint32_t blackoutTriggers = 0; //added to the plan while the sensor is in blackout
+    };
+
+    //The alarms that apply to each sensor, in alarm order, and the triggers of each alarm for each sensor.
+    //Sensors and alarms are in slots, their indexes in the db, so it's rebuilt when they are removed or the alarms change.
+    //The triggers are the ones of the alarms' triggersPerSensor, which are kept for the snapshots and the saving.
+    class SensorAlarmIndex
+    {
+    public:
+        void rebuild(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings);
+        //the new alarm or sensor is the last one
+        void addAlarm(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings);
+        void addSensor(std::vector<DB::Alarm> const& alarms, std::vector<DB::Sensor> const& sensors, DB::SensorSettings const& settings);
+
+        std::vector<SensorAlarm> const& getSensorAlarms(size_t sensorSlot) const { return m_sensorAlarms[sensorSlot]; }
+        uint32_t getTriggers(size_t alarmSlot, size_t sensorSlot) const { return m_triggers[alarmSlot][sensorSlot]; }
+        void setTriggers(size_t alarmSlot, size_t sensorSlot, uint32_t triggers) { m_triggers[alarmSlot][sensorSlot] = triggers; }
+
+    private:
+        void add(DB::Alarm const& alarm, size_t alarmSlot, Plan const& plan, DB::Sensor const& sensor, size_t sensorSlot);
+
+        std::vector<std::vector<SensorAlarm>> m_sensorAlarms; //by sensor slot
+        std::vector<std::vector<uint32_t>> m_triggers; //by alarm slot, then sensor slot
+    };
+}
@@ -93,12 +93,13 @@ QVariant AlarmsModel::data(QModelIndex const& index, int role) const
         return QVariant();
     }
 
-    if (static_cast<size_t>(index.row()) >= m_db.getAlarmCount())
+    std::shared_ptr<const DB::Snapshot> snapshot = m_db.getSnapshot();
+    if (static_cast<size_t>(index.row()) >= snapshot->alarms.size())
     {
         return QVariant();
     }
 
-    DB::Alarm alarm = m_db.getAlarm(static_cast<size_t>(index.row()));
+    DB::Alarm const& alarm = *snapshot->alarms[static_cast<size_t>(index.row())];
     DB::AlarmDescriptor const& descriptor = alarm.descriptor;
 
     Column column = static_cast<Column>(index.column());
@@ -3,12 +3,27 @@
 #include "PermissionsCheck.h"
 #include "DB.h"
 
+#include <QInputDialog>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QSettings>
 #include "HTMLItemDelegate.h"
 
 //////////////////////////////////////////////////////////////////////////
 
+//the watches and thresholds the measurement triggers come from
+static bool changesMeasurementTriggers(DB::AlarmDescriptor const& a, DB::AlarmDescriptor const& b)
+{
+    return a.filterSensors != b.filterSensors || a.sensors != b.sensors ||
+            a.lowTemperatureWatch != b.lowTemperatureWatch || a.lowTemperatureSoft != b.lowTemperatureSoft || a.lowTemperatureHard != b.lowTemperatureHard ||
+            a.highTemperatureWatch != b.highTemperatureWatch || a.highTemperatureSoft != b.highTemperatureSoft || a.highTemperatureHard != b.highTemperatureHard ||
+            a.lowHumidityWatch != b.lowHumidityWatch || a.lowHumiditySoft != b.lowHumiditySoft || a.lowHumidityHard != b.lowHumidityHard ||
+            a.highHumidityWatch != b.highHumidityWatch || a.highHumiditySoft != b.highHumiditySoft || a.highHumidityHard != b.highHumidityHard ||
+            a.lowVccWatch != b.lowVccWatch || a.lowSignalWatch != b.lowSignalWatch;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 AlarmsWidget::AlarmsWidget(QWidget *parent)
     : QWidget(parent)
 {
@@ -74,6 +89,8 @@ void AlarmsWidget::init(DB& db)
 
 void AlarmsWidget::shutdown()
 {
+    m_backfillWorker.cancel();
+    m_backfillProgress.reset();
     setEnabled(false);
     m_ui.list->setModel(nullptr);
 //    m_ui.list->setItemDelegate(nullptr);
@@ -104,6 +121,7 @@ void AlarmsWidget::configureAlarm(QModelIndex const& index)
     }
 
     DB::Alarm alarm = m_db->getAlarm(indexRow);
+    DB::AlarmDescriptor oldDescriptor = alarm.descriptor;
 
     ConfigureAlarmDialog dialog(*m_db, this);
     dialog.setAlarm(alarm);
@@ -122,6 +140,30 @@ void AlarmsWidget::configureAlarm(QModelIndex const& index)
                 continue;
             }
             m_model->refresh();
+
+            //the stored measurements keep the triggers of the old thresholds until they are re-evaluated
+            if (changesMeasurementTriggers(oldDescriptor, alarm.descriptor))
+            {
+                //the recent ones are the ones looked at, all of them can take a long while
+                static const std::pair<const char*, IClock::duration> periods[] =
+                {
+                    { "The last day", std::chrono::hours(24) },
+                    { "The last week", std::chrono::hours(24 * 7) },
+                    { "The last month", std::chrono::hours(24 * 31) },
+                    { "The last year", std::chrono::hours(24 * 366) },
+                    { "All of them", IClock::duration::zero() },
+                };
+                QStringList items;
+                for (auto const& period: periods)
+                    items << period.first;
+
+                bool ok = false;
+                QString item = QInputDialog::getItem(this, "Alarm changed", "Re-evaluate the alarm triggers of the stored measurements with the new thresholds?\n"
+                                                     "It runs in the background and can take a while. Measurements to re-evaluate:", items, 1, false, &ok);
+                int index = items.indexOf(item);
+                if (ok && index >= 0)
+                    backfillAlarmTriggers(periods[index].second);
+            }
         }
         break;
     } while (true);
@@ -129,6 +171,47 @@ void AlarmsWidget::configureAlarm(QModelIndex const& index)
 
 //////////////////////////////////////////////////////////////////////////
 
+void AlarmsWidget::backfillAlarmTriggers(IClock::duration period)
+{
+    //a new one restarts from the beginning, with all the changes so far
+    m_backfillWorker.cancel();
+
+    m_backfillProgress.reset(new QProgressDialog("Re-evaluating the alarm triggers...", "Cancel", 0, 1000, this));
+    m_backfillProgress->setMinimumDuration(1000);
+    m_backfillProgress->setValue(0);
+    //what was written so far stays, the dialog goes away when the worker returns
+    connect(m_backfillProgress.get(), &QProgressDialog::canceled, this, [this] { m_backfillWorker.cancel(); });
+
+    DB* db = m_db;
+    QProgressDialog* dialog = m_backfillProgress.get();
+    m_backfillWorker.run<bool>([this, db, dialog, period](DB::QueryToken const& token)
+    {
+        IClock::time_point now = IClock::rtNow();
+        DB::Range<IClock::time_point> range = { period == IClock::duration::zero() ? IClock::time_point(IClock::duration::zero()) : now - period, now };
+        Result<size_t> result = db->backfillAlarmTriggers(range, [this, dialog](size_t done, size_t total)
+        {
+            int value = total > 0 ? int(done * 1000 / total) : 1000;
+            QMetaObject::invokeMethod(this, [this, dialog, value]
+            {
+                if (m_backfillProgress.get() == dialog)
+                    m_backfillProgress->setValue(value);
+            }, Qt::QueuedConnection);
+        }, &token);
+
+        QString error = result == success ? QString() : QString(result.error().what().c_str());
+        QMetaObject::invokeMethod(this, [this, dialog, error]
+        {
+            if (m_backfillProgress.get() == dialog)
+                m_backfillProgress.reset();
+            if (!error.isEmpty())
+                QMessageBox::critical(this, "Error", QString("Cannot re-evaluate the alarm triggers: %1").arg(error));
+        }, Qt::QueuedConnection);
+        return result == success;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void AlarmsWidget::addAlarm()
 {
 	if (!hasPermissionOrCanLoginAsAdmin(*m_db, DB::UserDescriptor::PermissionAddRemoveAlarms, this))
@@ -4,11 +4,14 @@
 #include "ui_AlarmsWidget.h"
 #include "DB.h"
 #include "AlarmsModel.h"
+#include "QueryWorker.h"
 
 #include "SensorsModel.h"
 #include "SensorsDelegate.h"
 #include <QSortFilterProxyModel>
 
+class QProgressDialog;
+
 class AlarmsWidget : public QWidget
 {
     Q_OBJECT
@@ -27,11 +30,16 @@ private slots:
     void configureAlarm(QModelIndex const& index);
 
 private:
+    //re-evaluates the triggers of the measurements stored in the last period (all of them if zero) on the worker, after the thresholds changed
+    void backfillAlarmTriggers(IClock::duration period);
 
     Ui::AlarmsWidget m_ui;
     std::unique_ptr<AlarmsModel> m_model;
     DB* m_db = nullptr;
     std::vector<QMetaObject::Connection> m_uiConnections;
     bool m_sectionSaveScheduled = false;
+
+    QueryWorker m_backfillWorker;
+    std::unique_ptr<QProgressDialog> m_backfillProgress;
 };
 
@@ -418,6 +418,17 @@ void Comms::processRevertedRadioStateToNormal(InitializedBaseStation& cbs)
 
 void Comms::processSensorReq(InitializedBaseStation& cbs, SensorRequest const& request)
 {
+    {
+        Clock::time_point now = Clock::now();
+        CommsRound& round = m_commsRounds[request.address];
+        if (round.requestCount == 0 || now - round.startTP > std::chrono::minutes(1)) //lost the end of the last round
+        {
+            round.startTP = now;
+            round.requestCount = 0;
+        }
+        round.requestCount++;
+    }
+
     if (request.version == data::sensor::v1::k_version)
 	{
 		switch (static_cast<data::sensor::v1::Type>(request.type))
@@ -452,6 +463,24 @@ void Comms::processSensorReq(InitializedBaseStation& cbs, SensorRequest const& r
 }
 
 
+std::optional<Comms::Clock::duration> Comms::finishCommsRound(Radio::Address address)
+{
+    auto it = m_commsRounds.find(address);
+    if (it == m_commsRounds.end())
+        return std::nullopt;
+
+    CommsRound round = it->second;
+    m_commsRounds.erase(it);
+
+    //we only see when the requests arrive, so a single request tells nothing
+    if (round.requestCount < 2)
+        return std::nullopt;
+
+    return (Clock::now() - round.startTP) / (round.requestCount - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 static void fillConfig(data::sensor::v1::Config_Response& config, DB::SensorSettings const& sensorSettings, DB::Sensor const& sensor, DB::SensorOutputDetails const& sensorOutputDetails, DB::Sensor::Calibration const& reportedCalibration)
 {
     IClock::time_point now = IClock::rtNow();
@@ -462,13 +491,14 @@ static void fillConfig(data::sensor::v1::Config_Response& config, DB::SensorSett
     config.measurement_period =
             chrono::seconds(std::chrono::duration_cast<std::chrono::seconds>(sensorOutputDetails.measurementPeriod).count());
 
+    //rounded, the comms slots have half a second of guard on each side
     config.next_comms_delay =
-            chrono::seconds(std::chrono::duration_cast<std::chrono::seconds>(sensorOutputDetails.nextCommsTimePoint - now).count());
+            chrono::seconds(std::chrono::round<std::chrono::seconds>(sensorOutputDetails.nextCommsTimePoint - now).count());
 
     config.comms_period =
             chrono::seconds(std::chrono::duration_cast<std::chrono::seconds>(sensorOutputDetails.commsPeriod).count());
 
-    config.last_confirmed_measurement_index = sensor.lastConfirmedMeasurementIndex;
+    config.last_confirmed_measurement_index = sensorOutputDetails.lastConfirmedMeasurementIndex;
     config.calibration.temperature_bias = static_cast<int16_t>((sensor.calibration.temperatureBias) * 100.f);
     config.calibration.humidity_bias = static_cast<int16_t>((sensor.calibration.humidityBias) * 100.f);
     config.power = sensorSettings.radioPower;
@@ -480,8 +510,9 @@ static void fillConfig(data::sensor::v1::Config_Response& config, DB::SensorSett
 
 void Comms::processSensorReq_MeasurementBatch(InitializedBaseStation& cbs, SensorRequest const& request, data::sensor::v1::Measurement_Batch_Request const& measurementBatch)
 {
-    std::optional<DB::Sensor> sensor = cbs.db.findSensorByAddress(request.address);
-    if (!sensor.has_value())
+    std::shared_ptr<const DB::Snapshot> snapshot = cbs.db.getSnapshot();
+    DB::Sensor const* sensor = snapshot->findSensorByAddress(request.address);
+    if (!sensor)
     {
         std::cerr << "Invalid sensor address: " << request.address << std::endl;
         return;
@@ -551,8 +582,9 @@ DB::SensorInputDetails Comms::createSensorInputDetails(DB::Sensor const& sensor,
 
 void Comms::processSensorReq_ConfigRequest(InitializedBaseStation& cbs, SensorRequest const& request, data::sensor::v1::Config_Request const& configRequest)
 {
-    std::optional<DB::Sensor> sensor = cbs.db.findSensorByAddress(request.address);
-    if (!sensor.has_value())
+    std::shared_ptr<const DB::Snapshot> snapshot = cbs.db.getSnapshot();
+    DB::Sensor const* sensor = snapshot->findSensorByAddress(request.address);
+    if (!sensor)
     {
         std::cerr << "Invalid sensor address: " << request.address << std::endl;
         sendEmptySensorResponse(cbs, request);
@@ -560,9 +592,16 @@ void Comms::processSensorReq_ConfigRequest(InitializedBaseStation& cbs, SensorRe
     }
 
     DB::SensorInputDetails details = createSensorInputDetails(*sensor, configRequest);
+    if (std::optional<Clock::duration> airtime = finishCommsRound(request.address))
+    {
+        details.hasRequestAirtime = true;
+        details.requestAirtime = *airtime;
+    }
     cbs.db.setSensorInputDetails(details);
 
 	DB::SensorSettings sensorSettings = cbs.db.getSensorSettings();
+    //The sensor deletes the measurements it's told are confirmed, so only the committed ones are. The ones it just sent
+    //are not waited for, the disk would delay the response: they are confirmed in a later round and resent until then
     DB::SensorOutputDetails outputDetails = cbs.db.computeSensorOutputDetails(sensor->id);
     DB::Sensor::Calibration reportedCalibration{ static_cast<float>(configRequest.calibration.temperature_bias) / 100.f,
                 static_cast<float>(configRequest.calibration.humidity_bias) / 100.f};
@@ -579,8 +618,9 @@ void Comms::processSensorReq_ConfigRequest(InitializedBaseStation& cbs, SensorRe
 
 void Comms::processSensorReq_FirstConfigRequest(InitializedBaseStation& cbs, SensorRequest const& request, data::sensor::v1::First_Config_Request const& firstConfigRequest)
 {
-    std::optional<DB::Sensor> sensor = cbs.db.findSensorByAddress(request.address);
-    if (!sensor.has_value())
+    std::shared_ptr<const DB::Snapshot> snapshot = cbs.db.getSnapshot();
+    DB::Sensor const* sensor = snapshot->findSensorByAddress(request.address);
+    if (!sensor)
     {
         std::cerr << "Invalid sensor address: " << request.address << std::endl;
         sendEmptySensorResponse(cbs, request);
@@ -594,6 +634,8 @@ void Comms::processSensorReq_FirstConfigRequest(InitializedBaseStation& cbs, Sen
         response.first_measurement_index = outputDetails.nextRealTimeMeasurementIndex; //since this sensor just booted, it cannot have measurements older than now
     }
 
+    finishCommsRound(request.address);
+
     DB::SensorInputDetails details = createSensorInputDetails(*sensor, firstConfigRequest);
 	details.hasDeviceInfo = true;
     details.deviceInfo.sensorType = firstConfigRequest.descriptor.sensor_type;
@@ -639,8 +681,9 @@ void Comms::processSensorReq_PairRequest(InitializedBaseStation& cbs, SensorRequ
     }
 
     DB::SensorId id = result.payload();
-    std::optional<DB::Sensor> sensor = cbs.db.findSensorById(id);
-    if (!sensor.has_value())
+    std::shared_ptr<const DB::Snapshot> snapshot = cbs.db.getSnapshot();
+    DB::Sensor const* sensor = snapshot->findSensorById(id);
+    if (!sensor)
     {
         assert(false);
         sendEmptySensorResponse(cbs, request);
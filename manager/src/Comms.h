@@ -2,6 +2,7 @@
 
 #include <array>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <QUdpSocket>
 #include <QTcpSocket>
@@ -111,6 +112,15 @@ private:
 
     DB::SensorInputDetails createSensorInputDetails(DB::Sensor const& sensor, data::sensor::v1::Config_Request const& configRequest) const;
 
+    //a comms round is all the requests a sensor sends until its config request. Used to measure the airtime
+    struct CommsRound
+    {
+        Clock::time_point startTP = Clock::time_point(Clock::duration::zero());
+        uint32_t requestCount = 0;
+    };
+    std::unordered_map<Radio::Address, CommsRound> m_commsRounds;
+    std::optional<Clock::duration> finishCommsRound(Radio::Address address);
+
     void sendPing(InitializedBaseStation& cbs);
     void processPong(InitializedBaseStation& cbs);
     void processSensorReq(InitializedBaseStation& cbs);
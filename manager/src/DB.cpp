@@ -4,8 +4,11 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <unordered_set>
 #include <QDateTime>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QByteArray>
 
 #include "Utils.h"
@@ -13,6 +16,8 @@
 #include "Logger.h"
 #include "sqlite3.h"
 #include "Emailer.h"
+#include "MeasurementChunk.h"
+#include "AlarmEvaluator.h"
 
 #ifdef _MSC_VER
 //not #if defined(_WIN32) || defined(_WIN64) because we have strncasecmp in mingw
@@ -23,7 +28,28 @@
 
 extern Logger s_logger;
 
-const IClock::duration COMMS_DURATION = std::chrono::seconds(10);
+const IClock::duration COMMS_DURATION = std::chrono::seconds(10); //the longest comms slot a sensor gets
+const IClock::duration COMMS_SLOT_GUARD = std::chrono::milliseconds(500); //covers the rounding of the comms delay to whole seconds
+const IClock::duration COMMS_PERIOD_QUANTUM = std::chrono::minutes(1);
+const IClock::duration DEFAULT_REQUEST_AIRTIME = std::chrono::milliseconds(500); //used until it's measured for a sensor
+const uint32_t MEASUREMENTS_PER_BATCH = 12; //data::sensor::v1::Measurement_Batch_Request::MAX_COUNT
+const int64_t HOURLY_ROLLUP_PERIOD = 3600; //seconds
+const int64_t DAILY_ROLLUP_PERIOD = 24 * 3600; //seconds, UTC days
+const size_t READ_CONNECTION_COUNT = 4; //queries running at the same time, more wait for a free connection
+const size_t MAX_MEASUREMENT_CHUNK_SIZE = 1024; //measurements
+const size_t COLD_COMPRESSION_BATCH = 2048; //measurements per transaction, each row deleted updates all the sort indexes
+const IClock::duration COLD_COMPRESSION_TIME_BUDGET = std::chrono::milliseconds(50); //per process call, the rest are compressed on the next ones
+const IClock::duration COLD_COMPRESSION_PERIOD = std::chrono::hours(1);
+const std::chrono::milliseconds INGEST_PUSH_WAIT = std::chrono::milliseconds(10); //the push lock is released between the waits for a full queue
+const IClock::duration RETENTION_PERIOD = std::chrono::hours(1);
+const IClock::duration RETENTION_TIME_BUDGET = std::chrono::milliseconds(50); //per process call, so the ingest doesn't wait long for the write mutex
+const int64_t RETENTION_SLICE_PERIOD = 4 * 3600; //seconds per transaction, decimating a day of 50 sensors took twice the budget
+const IClock::duration ROLLUP_BACKFILL_TIME_BUDGET = std::chrono::milliseconds(50); //per process call, a day of measurements per transaction
+const IClock::duration ROLLUP_BACKFILL_PAUSE = std::chrono::milliseconds(50); //between the budgeted slices, so the main thread is free half the time
+const int64_t MAX_INCREMENTAL_VACUUM_PAGES = 4096; //per transaction
+const size_t ALARM_TRIGGERS_BLOCK_SIZE = 256; //measurements of a sensor read and evaluated at once
+const size_t ALARM_TRIGGERS_WRITE_BATCH = 65536; //measurements whose triggers are written in a transaction
+const size_t ALARM_BACKFILL_READ_BLOCK = 4096; //measurements of a sensor read, evaluated and written at once when re-evaluating the triggers
 
 Q_DECLARE_METATYPE(DB::Measurement)
 
@@ -51,6 +77,7 @@ DB::DB(std::shared_ptr<IClock> clock)
 	qRegisterMetaType<std::optional<Measurement>>("std::optional<Measurement>");
 	qRegisterMetaType<AlarmTriggers>("AlarmTriggers");
 
+	m_sensorAlarmIndex.reset(new alarms::SensorAlarmIndex);
 	m_emailer.reset(new Emailer(*this));
 }
 
@@ -63,8 +90,38 @@ DB::~DB()
 
 //////////////////////////////////////////////////////////////////////////
 
+static const char* getQuerySortExpression(DB::Filter::SortBy sortBy);
+
+//The indexes of the sort columns that don't have one for the lookups already (id, idx and timePoint do), in the
+//(sort key, id) order the cursors page through. The time point is in them so a time filter is checked in the index.
+//Built from the sort expressions, sqlite only uses an expression index for the exact same expression.
+//Every file gets them, the partitions being written included, as the newest rows are the ones sorted the most.
+//A statement per index.
+static std::vector<std::string> getMeasurementSortIndexesSql(std::string const& schema)
+{
+	std::vector<std::string> statements;
+	for (auto const& index: { std::make_pair("SensorId", DB::Filter::SortBy::SensorId),
+	                          std::make_pair("ReceivedTimePoint", DB::Filter::SortBy::ReceivedTimestamp),
+	                          std::make_pair("Temperature", DB::Filter::SortBy::Temperature),
+	                          std::make_pair("Humidity", DB::Filter::SortBy::Humidity),
+	                          std::make_pair("Vcc", DB::Filter::SortBy::Battery),
+	                          std::make_pair("SignalStrength", DB::Filter::SortBy::Signal),
+	                          std::make_pair("AlarmTriggers", DB::Filter::SortBy::Alarms) })
+	{
+		statements.push_back(std::string("CREATE INDEX IF NOT EXISTS ") + schema + "measurementsSort" + index.first + " ON Measurements(" + getQuerySortExpression(index.second) + ", id, timePoint);");
+	}
+	return statements;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 Result<void> DB::create(sqlite3& db)
 {
+	//so the pages freed by the retention policies can be returned. It only changes with a VACUUM once there are tables
+	//(the logger's), the file is still small here
+	if (sqlite3_exec(&db, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot set the auto vacuum mode: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
     sqlite3_exec(&db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
     utils::epilogue epi([&db] { sqlite3_exec(&db, "END TRANSACTION;", nullptr, nullptr, nullptr); });
 
@@ -220,3566 +277,8566 @@ Result<void> DB::create(sqlite3& db)
 		Error error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 		return error;
 	}
-	if (sqlite3_exec(&db, "CREATE INDEX measurementsSensorId ON Measurements(sensorId);", nullptr, nullptr, nullptr))
+	if (sqlite3_exec(&db, "CREATE INDEX measurementsSensorIdIdx ON Measurements(sensorId, idx);", nullptr, nullptr, nullptr))
 	{
 		Error error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 		return error;
 	}
+	for (std::string const& sql: getMeasurementSortIndexesSql(""))
+	{
+		if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+		{
+			Error error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+			return error;
+		}
+	}
 
-	return success;
+	Result<void> result = createMeasurementPartitions(db);
+	if (result != success)
+		return result;
+
+	result = createMeasurementChunks(db);
+	if (result != success)
+		return result;
+
+	result = createRetentionPolicies(db);
+	if (result != success)
+		return result;
+
+	return createMeasurementRollups(db, false);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::load(sqlite3& db)
+//One select per measurements table, as a compound select
+static std::string unionSelects(std::vector<std::string> const& tables, std::function<std::string(std::string const&)> const& select)
 {
-	IClock::time_point start = m_clock->now();
+	std::string sql;
+	for (std::string const& table: tables)
+	{
+		if (!sql.empty())
+			sql += " UNION ALL ";
+		sql += select(table);
+	}
+	return sql;
+}
 
-    Data data;
 
-    {
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, "REPLACE INTO BaseStations (id, name, mac, lastCommsTimePoint) "
-                                    "VALUES (?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+//////////////////////////////////////////////////////////////////////////
 
-		m_saveBaseStationsStmt.reset(stmt, &sqlite3_finalize);
-    }
-	{
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, "INSERT INTO SensorTimeConfigs (baselineMeasurementTimePoint, baselineMeasurementIndex, measurementPeriod, commsPeriod) "
-                                    "VALUES (?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+static const char* getRollupTable(int64_t period)
+{
+	return period == DAILY_ROLLUP_PERIOD ? "MeasurementRollupsDaily" : "MeasurementRollupsHourly";
+}
 
-		m_saveSensorTimeConfigsStmt.reset(stmt, &sqlite3_finalize);
-	}
-	{
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(&db, "REPLACE INTO SensorSettings (id, radioPower, retries, alertBatteryLevel, alertSignalStrengthLevel) "
-                               "VALUES (0, ?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+//////////////////////////////////////////////////////////////////////////
 
-		m_saveSensorSettingsStmt.reset(stmt, &sqlite3_finalize);
-	}
-	{
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(&db, "REPLACE INTO Sensors (id, name, address, sensorType, hardwareVersion, softwareVersion, "
-						                       "temperatureBias, humidityBias, serialNumber, state, shouldSleep, sleepStateTimePoint, statsCommsBlackouts, statsCommsFailures, "
-						                       "statsUnknownReboots, statsPowerOnReboots, statsResetReboots, statsBrownoutReboots, statsWatchdogReboots, statsCommsRetries, statsAsleep, statsAwake, statsCommsRounds, statsMeasurementRounds, "
-											   "lastCommsTimePoint, lastConfirmedMeasurementIndex, lastAlarmProcessesMeasurementIndex, "
-						                       "firstStoredMeasurementIndex, storedMeasurementCount, estimatedStoredMeasurementCount, lastSignalStrengthB2S, averageSignalStrengthB2S, averageSignalStrengthS2B, "
-						                       "isRTMeasurementValid, rtMeasurementTemperature, rtMeasurementHumidity, rtMeasurementVcc) "
-                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25, ?26, ?27, ?28, ?29, ?30, ?31, ?32, ?33, ?34, ?35, ?36, ?37);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+//the columns of a rollup table, aggregated from the Measurements grouped by sensorId and timePoint / period
+static std::string getRollupColumnsSql(int64_t period)
+{
+	return "sensorId, timePoint - timePoint % " + std::to_string(period) + ", COUNT(*), "
+	       "MIN(temperature), MAX(temperature), SUM(temperature), MIN(humidity), MAX(humidity), SUM(humidity), MIN(vcc), MAX(vcc), SUM(vcc), "
+	       "MIN(MIN(signalStrengthS2B, signalStrengthB2S)), MAX(MIN(signalStrengthS2B, signalStrengthB2S)), SUM(MIN(signalStrengthS2B, signalStrengthB2S)), "
+	       "BIT_OR(alarmTriggersCurrent), COUNT(*)";
+}
 
-		m_saveSensorsStmt.reset(stmt, &sqlite3_finalize);
-	}
-	{
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(&db, "REPLACE INTO Alarms (id, name, filterSensors, sensors, lowTemperatureWatch, lowTemperatureSoft, lowTemperatureHard, highTemperatureWatch, highTemperatureSoft, highTemperatureHard, "
-						                       "lowHumidityWatch, lowHumiditySoft, lowHumidityHard, highHumidityWatch, highHumiditySoft, highHumidityHard, "
-						                       "lowVccWatch, lowSignalWatch, sensorBlackoutWatch, baseStationDisconnectedWatch, sendEmailAction, resendPeriod, triggersPerSensor, triggersPerBaseStation, "
-											   "lastTriggeredTimePoint) "
-                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+//////////////////////////////////////////////////////////////////////////
 
-		m_saveAlarmsStmt.reset(stmt, &sqlite3_finalize);
-	}
+//Replaces the rollups of the whole days in [begin, end) with the ones of the measurements in the sources. The counts of
+//the measurements removed by the retention policies are lost, count is keptCount for them from now on
+static std::string getRebuildMeasurementRollupsSql(std::vector<std::string> const& sources, int64_t begin, int64_t end)
+{
+	std::string where = " WHERE timePoint >= " + std::to_string(begin) + " AND timePoint < " + std::to_string(end);
+	std::string hourly = getRollupTable(HOURLY_ROLLUP_PERIOD);
+	std::string daily = getRollupTable(DAILY_ROLLUP_PERIOD);
+	return "DELETE FROM " + hourly + where + "; DELETE FROM " + daily + where + ";"
+	       "INSERT INTO " + hourly + " SELECT " + getRollupColumnsSql(HOURLY_ROLLUP_PERIOD) + " FROM (" + unionSelects(sources, [&where](std::string const& table)
 	{
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(&db, "REPLACE INTO Reports (id, name, period, customPeriod, filterSensors, sensors, lastTriggeredTimePoint) "
-                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		return "SELECT * FROM " + table + where;
+	}) + ") GROUP BY sensorId, timePoint / " + std::to_string(HOURLY_ROLLUP_PERIOD) + ";"
+	       "INSERT INTO " + daily + " SELECT sensorId, timePoint - timePoint % " + std::to_string(DAILY_ROLLUP_PERIOD) + ", SUM(count), "
+	       "MIN(minTemperature), MAX(maxTemperature), SUM(sumTemperature), MIN(minHumidity), MAX(maxHumidity), SUM(sumHumidity), "
+	       "MIN(minVcc), MAX(maxVcc), SUM(sumVcc), MIN(minSignalStrength), MAX(maxSignalStrength), SUM(sumSignalStrength), "
+	       "BIT_OR(alarmTriggers), SUM(keptCount) FROM " + hourly + where + " GROUP BY sensorId;";
+}
 
-		m_saveReportsStmt.reset(stmt, &sqlite3_finalize);
-    }
-    {
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, "INSERT OR IGNORE INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
-                                    "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13);", -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+//////////////////////////////////////////////////////////////////////////
 
-		m_addMeasurementsStmt.reset(stmt, &sqlite3_finalize);
-    }
+//sqlite has no bitwise or aggregate
+static void bitOrStep(sqlite3_context* context, int, sqlite3_value** values)
+{
+	int64_t* result = reinterpret_cast<int64_t*>(sqlite3_aggregate_context(context, sizeof(int64_t)));
+	if (result)
+		*result |= sqlite3_value_int64(values[0]);
+}
+static void bitOrFinal(sqlite3_context* context)
+{
+	int64_t* result = reinterpret_cast<int64_t*>(sqlite3_aggregate_context(context, 0));
+	sqlite3_result_int64(context, result ? *result : 0);
+}
 
+//////////////////////////////////////////////////////////////////////////
 
+static void addToMeasurementAggregate(DB::MeasurementAggregate& a, DB::Measurement const& m)
+{
+	DB::MeasurementDescriptor const& md = m.descriptor;
+	int16_t signalStrength = std::min(md.signalStrength.s2b, md.signalStrength.b2s);
+	if (a.count == 0)
 	{
-		const char* sql = "SELECT dateTimeFormat, showCriticalLogsPopup FROM GeneralSettings;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load general settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-		
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+		a.sensorId = md.sensorId;
+		a.temperature = { md.temperature, md.temperature };
+		a.humidity = { md.humidity, md.humidity };
+		a.vcc = { md.vcc, md.vcc };
+		a.signalStrength = { signalStrength, signalStrength };
+	}
+	a.count++;
+	a.temperature.min = std::min(a.temperature.min, md.temperature);
+	a.temperature.max = std::max(a.temperature.max, md.temperature);
+	a.temperatureSum += md.temperature;
+	a.humidity.min = std::min(a.humidity.min, md.humidity);
+	a.humidity.max = std::max(a.humidity.max, md.humidity);
+	a.humiditySum += md.humidity;
+	a.vcc.min = std::min(a.vcc.min, md.vcc);
+	a.vcc.max = std::max(a.vcc.max, md.vcc);
+	a.vccSum += md.vcc;
+	a.signalStrength.min = std::min(a.signalStrength.min, signalStrength);
+	a.signalStrength.max = std::max(a.signalStrength.max, signalStrength);
+	a.signalStrengthSum += signalStrength;
+	a.alarmTriggers |= m.alarmTriggers.current;
+}
 
-		if (sqlite3_step(stmt) != SQLITE_ROW)
-			return Error(QString("Cannot load general settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-        
-		data.generalSettings.dateTimeFormat = DateTimeFormat(sqlite3_column_int64(stmt, 0));
-		data.generalSettings.showCriticalLogsPopup = sqlite3_column_int(stmt, 1) ? true : false;
+//////////////////////////////////////////////////////////////////////////
+
+static void mergeMeasurementAggregate(DB::MeasurementAggregate& a, DB::MeasurementAggregate const& b)
+{
+	if (b.count == 0)
+		return;
+	if (a.count == 0)
+	{
+		a = b;
+		return;
 	}
+	a.timePoint = std::min(a.timePoint, b.timePoint);
+	a.count += b.count;
+	a.temperature.min = std::min(a.temperature.min, b.temperature.min);
+	a.temperature.max = std::max(a.temperature.max, b.temperature.max);
+	a.temperatureSum += b.temperatureSum;
+	a.humidity.min = std::min(a.humidity.min, b.humidity.min);
+	a.humidity.max = std::max(a.humidity.max, b.humidity.max);
+	a.humiditySum += b.humiditySum;
+	a.vcc.min = std::min(a.vcc.min, b.vcc.min);
+	a.vcc.max = std::max(a.vcc.max, b.vcc.max);
+	a.vccSum += b.vccSum;
+	a.signalStrength.min = std::min(a.signalStrength.min, b.signalStrength.min);
+	a.signalStrength.max = std::max(a.signalStrength.max, b.signalStrength.max);
+	a.signalStrengthSum += b.signalStrengthSum;
+	a.alarmTriggers |= b.alarmTriggers;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//in the order of the rollup table columns
+static void bindMeasurementAggregate(sqlite3_stmt* stmt, DB::MeasurementAggregate const& a)
+{
+	int index = 1;
+	sqlite3_bind_int64(stmt, index++, a.sensorId);
+	sqlite3_bind_int64(stmt, index++, IClock::to_time_t(a.timePoint));
+	sqlite3_bind_int64(stmt, index++, int64_t(a.count));
+	sqlite3_bind_double(stmt, index++, a.temperature.min);
+	sqlite3_bind_double(stmt, index++, a.temperature.max);
+	sqlite3_bind_double(stmt, index++, a.temperatureSum);
+	sqlite3_bind_double(stmt, index++, a.humidity.min);
+	sqlite3_bind_double(stmt, index++, a.humidity.max);
+	sqlite3_bind_double(stmt, index++, a.humiditySum);
+	sqlite3_bind_double(stmt, index++, a.vcc.min);
+	sqlite3_bind_double(stmt, index++, a.vcc.max);
+	sqlite3_bind_double(stmt, index++, a.vccSum);
+	sqlite3_bind_int64(stmt, index++, a.signalStrength.min);
+	sqlite3_bind_int64(stmt, index++, a.signalStrength.max);
+	sqlite3_bind_int64(stmt, index++, a.signalStrengthSum);
+	sqlite3_bind_int64(stmt, index++, a.alarmTriggers);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static DB::MeasurementAggregate unpackMeasurementAggregate(sqlite3_stmt* stmt)
+{
+	DB::MeasurementAggregate a;
+	int index = 0;
+	a.sensorId = DB::SensorId(sqlite3_column_int64(stmt, index++));
+	a.timePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
+	a.count = size_t(sqlite3_column_int64(stmt, index++));
+	a.temperature.min = float(sqlite3_column_double(stmt, index++));
+	a.temperature.max = float(sqlite3_column_double(stmt, index++));
+	a.temperatureSum = sqlite3_column_double(stmt, index++);
+	a.humidity.min = float(sqlite3_column_double(stmt, index++));
+	a.humidity.max = float(sqlite3_column_double(stmt, index++));
+	a.humiditySum = sqlite3_column_double(stmt, index++);
+	a.vcc.min = float(sqlite3_column_double(stmt, index++));
+	a.vcc.max = float(sqlite3_column_double(stmt, index++));
+	a.vccSum = sqlite3_column_double(stmt, index++);
+	a.signalStrength.min = int16_t(sqlite3_column_int64(stmt, index++));
+	a.signalStrength.max = int16_t(sqlite3_column_int64(stmt, index++));
+	a.signalStrengthSum = sqlite3_column_int64(stmt, index++);
+	a.alarmTriggers = uint32_t(sqlite3_column_int64(stmt, index++));
+	return a;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//Splits a filter in parts served by the rollups of a period, longest first, and what's left at the ends of
+//the time range is served by the measurements (period 0). The rollups have no values so only the sensor and
+//time filters can be used with them.
+static void planRollupQuery(DB::Filter const& filter, int64_t period, std::vector<std::pair<int64_t, DB::Filter>>& parts)
+{
+	if (period == 0 || filter.useTemperatureFilter || filter.useHumidityFilter || filter.useVccFilter || filter.useSignalStrengthFilter)
 	{
-		//id INTEGER PRIMARY KEY, dateTimeFormatOverride INTEGER, unitsFormat INTEGER, "
-		//	"exportId BOOLEAN, exportIndex BOOLEAN, exportSensorName BOOLEAN, exportSensorSN BOOLEAN, exportTimePoint BOOLEAN, exportReceivedTimePoint BOOLEAN, "
-		//	"exportTemperature BOOLEAN, exportHumidity BOOLEAN, exportBattery BOOLEAN, exportSignal BOOLEAN, "
-		//	"decimalPlaces INTEGER
-		const char* sql = "SELECT dateTimeFormatOverride, unitsFormat, exportId, exportIndex, exportSensorName, exportSensorSN, exportTimePoint, exportReceivedTimePoint, "
-			"exportTemperature, exportHumidity, exportBattery, exportSignal, "
-            "decimalPlaces, separator FROM CsvSettings;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load csv settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		parts.emplace_back(0, filter);
+		return;
+	}
+	if (!filter.useTimePointFilter)
+	{
+		parts.emplace_back(period, filter);
+		return;
+	}
 
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	int64_t nextPeriod = period == DAILY_ROLLUP_PERIOD ? HOURLY_ROLLUP_PERIOD : 0;
 
-		if (sqlite3_step(stmt) != SQLITE_ROW)
-			return Error(QString("Cannot load csv settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	//the time filter is inclusive
+	int64_t begin = IClock::to_time_t(filter.timePointFilter.min);
+	int64_t end = IClock::to_time_t(filter.timePointFilter.max) + 1;
+	int64_t firstBucket = (begin + period - 1) / period * period;
+	int64_t endBucket = end / period * period;
+	if (firstBucket >= endBucket)
+	{
+		planRollupQuery(filter, nextPeriod, parts);
+		return;
+	}
 
-        int v = int(sqlite3_column_int64(stmt, 0));
-		if (v >= 0)
-            data.csvSettings.dateTimeFormatOverride = DateTimeFormat(v);
+	DB::Filter whole = filter;
+	whole.timePointFilter.min = IClock::from_time_t(firstBucket);
+	whole.timePointFilter.max = IClock::from_time_t(endBucket - 1);
+	parts.emplace_back(period, whole);
 
-        data.csvSettings.unitsFormat = CsvSettings::UnitsFormat(sqlite3_column_int(stmt, 1));
-		data.csvSettings.exportId = sqlite3_column_int(stmt, 2) ? true : false;
-		data.csvSettings.exportIndex = sqlite3_column_int(stmt, 3) ? true : false;
-		data.csvSettings.exportSensorName = sqlite3_column_int(stmt, 4) ? true : false;
-		data.csvSettings.exportSensorSN = sqlite3_column_int(stmt, 5) ? true : false;
-		data.csvSettings.exportTimePoint = sqlite3_column_int(stmt, 6) ? true : false;
-		data.csvSettings.exportReceivedTimePoint = sqlite3_column_int(stmt, 7) ? true : false;
-		data.csvSettings.exportTemperature = sqlite3_column_int(stmt, 8) ? true : false;
-		data.csvSettings.exportHumidity = sqlite3_column_int(stmt, 9) ? true : false;
-		data.csvSettings.exportBattery = sqlite3_column_int(stmt, 10) ? true : false;
-		data.csvSettings.exportSignal = sqlite3_column_int(stmt, 11) ? true : false;
-        data.csvSettings.decimalPlaces = uint32_t(sqlite3_column_int(stmt, 12));
-        data.csvSettings.separator = (const char*)sqlite3_column_text(stmt, 13);
-    }
+	if (begin < firstBucket)
 	{
-		//id INTEGER PRIMARY KEY, host STRING, port INTEGER, connection INTEGER, username STRING, password STRING, sender STRING, recipients STRING
-		const char* sql = "SELECT host, port, connection, username, password, sender, recipients FROM EmailSettings;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load email settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-		
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+		DB::Filter head = filter;
+		head.timePointFilter.max = IClock::from_time_t(firstBucket - 1);
+		planRollupQuery(head, nextPeriod, parts);
+	}
+	if (endBucket < end)
+	{
+		DB::Filter tail = filter;
+		tail.timePointFilter.min = IClock::from_time_t(endBucket);
+		planRollupQuery(tail, nextPeriod, parts);
+	}
+}
 
-		if (sqlite3_step(stmt) != SQLITE_ROW)
-			return Error(QString("Cannot load email settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-		
-		data.emailSettings.host = (char const*)sqlite3_column_text(stmt, 0);
-        data.emailSettings.port = uint16_t(sqlite3_column_int(stmt, 1));
-		data.emailSettings.connection = (EmailSettings::Connection)sqlite3_column_int(stmt, 2);
-		data.emailSettings.username = (char const*)sqlite3_column_text(stmt, 3);
-		data.emailSettings.password = (char const*)sqlite3_column_text(stmt, 4);
-		data.emailSettings.sender = (char const*)sqlite3_column_text(stmt, 5);
-		QString recipients = (char const*)sqlite3_column_text(stmt, 6);
+//While the rollups are backfilled they are complete only from rolledUp on, the time before it is served by the measurements
+static void planRollupQuery(DB::Filter const& filter, int64_t period, int64_t rolledUp, std::vector<std::pair<int64_t, DB::Filter>>& parts)
+{
+	if (rolledUp == std::numeric_limits<int64_t>::min() || period == 0 || (filter.useTimePointFilter && IClock::to_time_t(filter.timePointFilter.min) >= rolledUp))
+	{
+		planRollupQuery(filter, period, parts);
+		return;
+	}
 
-		QStringList l = recipients.split(QChar(';'), QString::SkipEmptyParts);
-		for (QString str : l)
-			data.emailSettings.recipients.push_back(str.trimmed().toUtf8().data());
+	DB::Filter head = filter;
+	head.useTimePointFilter = true;
+	if (!filter.useTimePointFilter)
+		head.timePointFilter.min = IClock::from_time_t(0);
+	head.timePointFilter.max = IClock::from_time_t(rolledUp - 1);
+	if (filter.useTimePointFilter && IClock::to_time_t(filter.timePointFilter.max) < rolledUp)
+	{
+		parts.emplace_back(0, filter);
+		return;
 	}
+	parts.emplace_back(0, head);
+
+	DB::Filter tail = filter;
+	tail.useTimePointFilter = true;
+	tail.timePointFilter.min = IClock::from_time_t(rolledUp);
+	if (filter.useTimePointFilter)
+		planRollupQuery(tail, period, parts);
+	else
 	{
-		//FtpSettings (id INTEGER PRIMARY KEY, host STRING, port INTEGER, username STRING, password STRING, folder STRING, uploadBackups BOOLEAN, uploadPeriod INTEGER);";
-		const char* sql = "SELECT host, port, username, password, folder, uploadBackups, uploadPeriod FROM FtpSettings;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load ftp settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		//whole days to the end
+		tail.timePointFilter.max = IClock::time_point::max();
+		parts.emplace_back(period, tail);
+	}
+}
 
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+//////////////////////////////////////////////////////////////////////////
 
-		if (sqlite3_step(stmt) != SQLITE_ROW)
-			return Error(QString("Cannot load ftp settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+Result<void> DB::createMeasurementRollups(sqlite3& db, bool backfill, std::vector<std::string> const& measurementTables)
+{
+	if (sqlite3_create_function(&db, "BIT_OR", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, nullptr, &bitOrStep, &bitOrFinal) != SQLITE_OK)
+		return Error(QString("Cannot create the BIT_OR function: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	if (sqlite3_exec(&db, "CREATE TABLE IF NOT EXISTS MeasurementRollupsBackfill (timePoint INTEGER);", nullptr, nullptr, nullptr))
+		return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		data.ftpSettings.host = (char const*)sqlite3_column_text(stmt, 0);
-        data.ftpSettings.port = uint16_t(sqlite3_column_int(stmt, 1));
-		data.ftpSettings.username = (char const*)sqlite3_column_text(stmt, 2);
-		data.ftpSettings.password = (char const*)sqlite3_column_text(stmt, 3);
-		data.ftpSettings.folder = (char const*)sqlite3_column_text(stmt, 4);
-		data.ftpSettings.uploadBackups = sqlite3_column_int(stmt, 5) ? true : false;
-		data.ftpSettings.uploadBackupsPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 6));
-	}
+	for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
 	{
-		//Users (id INTEGER PRIMARY KEY, name STRING, passwordHash STRING, permissions INTEGER, type INTEGER, lastLogin DATETIME);";
-		const char* sql = "SELECT id, name, passwordHash, permissions, type, lastLogin FROM Users;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load user settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		std::string table = getRollupTable(period);
+		bool exists = false;
+		bool hasKeptCount = false;
+		{
+			sqlite3_stmt* stmt;
+			if (sqlite3_prepare_v2(&db, "SELECT COUNT(*), (SELECT COUNT(*) FROM pragma_table_info(?1) WHERE name = 'keptCount') FROM sqlite_master WHERE type = 'table' AND name = ?1;", -1, &stmt, nullptr) != SQLITE_OK)
+				return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+			utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+			sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+			if (sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				exists = sqlite3_column_int64(stmt, 0) > 0;
+				hasKeptCount = sqlite3_column_int64(stmt, 1) > 0;
+			}
+		}
+		if (exists)
+		{
+			if (!hasKeptCount)
+			{
+				//rollups from before the kept counts. The count of a bucket can be more than what the retention policies
+				//left of it, so the stored measurements are counted once. The days are summed from the hours
+				IClock::time_point start = IClock::rtNow();
+				std::string sql = "ALTER TABLE " + table + " ADD COLUMN keptCount INTEGER;";
+				if (period == HOURLY_ROLLUP_PERIOD)
+					sql += "CREATE TEMP TABLE KeptCounts (sensorId INTEGER, timePoint DATETIME, count INTEGER, PRIMARY KEY (sensorId, timePoint)) WITHOUT ROWID;"
+					       "INSERT INTO temp.KeptCounts SELECT sensorId, timePoint - timePoint % " + std::to_string(period) + ", COUNT(*) FROM (" + unionSelects(measurementTables, [](std::string const& measurementTable)
+					{
+						return "SELECT sensorId, timePoint FROM " + measurementTable;
+					}) + ") GROUP BY sensorId, timePoint / " + std::to_string(period) + ";"
+					       "UPDATE " + table + " SET keptCount = IFNULL((SELECT count FROM temp.KeptCounts k WHERE k.sensorId = " + table + ".sensorId AND k.timePoint = " + table + ".timePoint), 0);"
+					       "DROP TABLE temp.KeptCounts;";
+				else
+					sql += "UPDATE " + table + " SET keptCount = IFNULL((SELECT SUM(keptCount) FROM " + getRollupTable(HOURLY_ROLLUP_PERIOD) + " h WHERE h.sensorId = " + table + ".sensorId "
+					       "AND h.timePoint >= " + table + ".timePoint AND h.timePoint < " + table + ".timePoint + " + std::to_string(period) + "), 0);";
+				if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+					return Error(QString("Error counting the measurements of %1: %2").arg(table.c_str()).arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		while (sqlite3_step(stmt) == SQLITE_ROW)
+				s_logger.logInfo(QString("Counted the measurements of %1 in %2s").arg(table.c_str()).arg(std::chrono::duration<float>(IClock::rtNow() - start).count()));
+			}
+			continue;
+		}
+
+		//keptCount is how many of the measurements are still stored, count how many there were before the retention policies
+		std::string sql = "CREATE TABLE " + table + " (sensorId INTEGER, timePoint DATETIME, count INTEGER, "
+		                  "minTemperature REAL, maxTemperature REAL, sumTemperature REAL, minHumidity REAL, maxHumidity REAL, sumHumidity REAL, "
+		                  "minVcc REAL, maxVcc REAL, sumVcc REAL, minSignalStrength INTEGER, maxSignalStrength INTEGER, sumSignalStrength INTEGER, "
+		                  "alarmTriggers INTEGER, keptCount INTEGER, PRIMARY KEY (sensorId, timePoint)) WITHOUT ROWID;";
+		if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+			return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
+		sql = "CREATE INDEX " + table + "TimePoint ON " + table + "(timePoint);";
+		if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+			return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
+		if (backfill && period == HOURLY_ROLLUP_PERIOD)
 		{
-			User user;
-            user.id = UserId(sqlite3_column_int64(stmt, 0));
-			user.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
-			user.descriptor.passwordHash = (char const*)sqlite3_column_text(stmt, 2);
-            user.descriptor.permissions = uint32_t(sqlite3_column_int64(stmt, 3));
-			user.descriptor.type = (UserDescriptor::Type)sqlite3_column_int(stmt, 4);
-			user.lastLogin = IClock::from_time_t(sqlite3_column_int64(stmt, 5));
-			data.users.push_back(std::move(user));
+			//the existing measurements are rolled up by process, from the end of the day of the newest one
+			std::string day = std::to_string(DAILY_ROLLUP_PERIOD);
+			sql = "INSERT INTO MeasurementRollupsBackfill SELECT t - t % " + day + " + " + day + " FROM (SELECT MAX(t) AS t FROM (" + unionSelects(measurementTables, [](std::string const& measurementTable)
+			{
+				return "SELECT MAX(timePoint) AS t FROM " + measurementTable;
+			}) + ")) WHERE t IS NOT NULL;";
+			if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+				return Error(QString("Error scheduling the backfill of %1: %2").arg(table.c_str()).arg(sqlite3_errmsg(&db)).toUtf8().data());
 		}
 	}
-	{
-		//const char* sql = "CREATE TABLE BaseStations (id INTEGER PRIMARY KEY, name STRING, mac STRING);";
-		const char* sql = "SELECT id, name, mac, lastCommsTimePoint "
-                          "FROM BaseStations;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	return success;
+}
 
-        while (sqlite3_step(stmt) == SQLITE_ROW)
-        {
-            BaseStation bs;
-            bs.id = BaseStationId(sqlite3_column_int64(stmt, 0));
-		    bs.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
-			std::string macStr = (char const*)sqlite3_column_text(stmt, 2);
-			int m0, m1, m2, m3, m4, m5;
-            if (sscanf(macStr.c_str(), "%X:%X:%X:%X:%X:%X", &m0, &m1, &m2, &m3, &m4, &m5) != 6)
-                return Error(QString("Bad base station mac: %1").arg(macStr.c_str()).toUtf8().data());
+//////////////////////////////////////////////////////////////////////////
 
-            bs.descriptor.mac = { static_cast<uint8_t>(m0 & 0xFF), static_cast<uint8_t>(m1 & 0xFF), static_cast<uint8_t>(m2 & 0xFF), static_cast<uint8_t>(m3 & 0xFF), static_cast<uint8_t>(m4 & 0xFF), static_cast<uint8_t>(m5 & 0xFF) };
-			bs.lastCommsTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 3));
-            data.baseStations.push_back(std::move(bs));
-        }
-	}
+Result<void> DB::createMeasurementPartitions(sqlite3& db)
+{
+	//databases from before the partitions get the table when loaded
+	const char* sql = "CREATE TABLE IF NOT EXISTS MeasurementPartitions (name STRING PRIMARY KEY, beginTimePoint DATETIME, endTimePoint DATETIME, sealed BOOLEAN, backedUp BOOLEAN, commitId INTEGER);"
+	                  "CREATE TABLE IF NOT EXISTS RemovedMeasurementPartitions (name STRING PRIMARY KEY, beginTimePoint DATETIME, endTimePoint DATETIME);";
+	if (sqlite3_exec(&db, sql, nullptr, nullptr, nullptr))
+		return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::createMeasurementChunks(sqlite3& db)
+{
+	//databases from before the chunks get the table when loaded
+	const char* sql = "CREATE TABLE IF NOT EXISTS MeasurementChunks (id INTEGER PRIMARY KEY, sensorId INTEGER, firstIdx INTEGER, lastIdx INTEGER, beginTimePoint DATETIME, endTimePoint DATETIME, "
+	                  "minId INTEGER, maxId INTEGER, count INTEGER, data BLOB);"
+	                  "CREATE INDEX IF NOT EXISTS measurementChunksSensorIdIdx ON MeasurementChunks(sensorId, lastIdx);"
+	                  "CREATE INDEX IF NOT EXISTS measurementChunksTimePoint ON MeasurementChunks(endTimePoint);"
+	                  "CREATE INDEX IF NOT EXISTS measurementChunksId ON MeasurementChunks(maxId);";
+	if (sqlite3_exec(&db, sql, nullptr, nullptr, nullptr))
+		return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
+	return chunk::registerModule(db);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::createRetentionPolicies(sqlite3& db)
+{
+	//databases from before the retention policies get the table when loaded. The durations are in seconds
+	const char* sql = "CREATE TABLE IF NOT EXISTS RetentionPolicies (position INTEGER PRIMARY KEY, name STRING, filterSensors BOOLEAN, sensors STRING, "
+	                  "keepRaw INTEGER, downsampling INTEGER, decimationPeriod INTEGER, keepDownsampled INTEGER);";
+	if (sqlite3_exec(&db, sql, nullptr, nullptr, nullptr))
+		return Error(QString("Error executing SQLite3 statement: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//the partition files are next to the main one: sense.db, sense_measurements_20200101.db, ...
+static std::string getMeasurementPartitionFilename(std::string const& mainFilename, std::string const& name)
+{
+	QFileInfo info(mainFilename.c_str());
+	return (info.path() + "/" + info.completeBaseName() + "_" + name.c_str() + ".db").toUtf8().data();
+}
 
+//////////////////////////////////////////////////////////////////////////
+
+//the UTC week, month or year around the time point
+static std::pair<IClock::time_point, IClock::time_point> computeMeasurementPartitionPeriod(IClock::time_point timePoint, DB::PartitionSettings::Period period)
+{
+	QDate date = QDateTime::fromSecsSinceEpoch(IClock::to_time_t(timePoint), Qt::UTC).date();
+	QDate begin;
+	QDate end;
+	switch (period)
 	{
-		const char* sql = "SELECT baselineMeasurementTimePoint, baselineMeasurementIndex, measurementPeriod, commsPeriod "
-                          "FROM SensorTimeConfigs;";
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load sensors configs: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	case DB::PartitionSettings::Period::Week:
+		begin = date.addDays(1 - date.dayOfWeek());
+		end = begin.addDays(7);
+		break;
+	case DB::PartitionSettings::Period::Year:
+		begin = QDate(date.year(), 1, 1);
+		end = begin.addYears(1);
+		break;
+	default:
+		begin = QDate(date.year(), date.month(), 1);
+		end = begin.addMonths(1);
+		break;
+	}
+	return { IClock::from_time_t(QDateTime(begin, QTime(0, 0), Qt::UTC).toSecsSinceEpoch()),
+	         IClock::from_time_t(QDateTime(end, QTime(0, 0), Qt::UTC).toSecsSinceEpoch()) };
+}
 
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+//////////////////////////////////////////////////////////////////////////
 
-		while (sqlite3_step(stmt) == SQLITE_ROW)
-		{
-            SensorTimeConfig sc;
-			sc.baselineMeasurementTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 0));
-            sc.baselineMeasurementIndex = uint32_t(sqlite3_column_int64(stmt, 1));
-			sc.descriptor.measurementPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 2));
-			sc.descriptor.commsPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 3));
-			data.sensorTimeConfigs.push_back(std::move(sc));
-		}
+static bool isWalJournal(sqlite3& db)
+{
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(&db, "PRAGMA main.journal_mode;", -1, &stmt, nullptr) != SQLITE_OK)
+		return false;
+	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+	return sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0) && sqlite3_stricmp((char const*)sqlite3_column_text(stmt, 0), "wal") == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static std::string getAddMeasurementSql(std::string const& table)
+{
+	return "INSERT OR IGNORE INTO " + table + " (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved, id) "
+	       "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14);";
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//Creates the file if needed, with the same Measurements table as the main file. The ids are given by the ingest thread
+//so they are unique across all the files.
+static Result<void> createMeasurementPartitionFile(std::string const& filename, bool wal)
+{
+	sqlite3* sqlite = nullptr;
+	if (sqlite3_open_v2(filename.c_str(), &sqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+	{
+		QString msg = QString("Cannot create the partition file '%1': %2").arg(filename.c_str()).arg(sqlite3_errmsg(sqlite));
+		sqlite3_close(sqlite);
+		return Error(msg.toUtf8().data());
 	}
+	utils::epilogue epi([sqlite] { sqlite3_close(sqlite); });
+
+	//before the first table, so the pages freed by the retention policies can be returned. No effect on existing files
+	if (sqlite3_exec(sqlite, "PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot create the partition file '%1': %2").arg(filename.c_str()).arg(sqlite3_errmsg(sqlite)).toUtf8().data());
+
+	std::string sql = "CREATE TABLE IF NOT EXISTS Measurements (id INTEGER PRIMARY KEY, timePoint DATETIME, receivedTimePoint DATETIME, idx INTEGER, sensorId INTEGER, temperature REAL, humidity REAL, vcc REAL, signalStrengthS2B INTEGER, signalStrengthB2S INTEGER, "
+	                  "sensorErrors INTEGER, alarmTriggersCurrent INTEGER, alarmTriggersAdded INTEGER, alarmTriggersRemoved INTEGER, UNIQUE(idx, sensorId));"
+	                  "CREATE INDEX IF NOT EXISTS measurementsIdx ON Measurements(idx);"
+	                  "CREATE INDEX IF NOT EXISTS measurementsTimePoint ON Measurements(timePoint);"
+	                  "CREATE INDEX IF NOT EXISTS measurementsSensorIdIdx ON Measurements(sensorId, idx);";
+	for (std::string const& index: getMeasurementSortIndexesSql(""))
+		sql += index;
+	//the id of the last write transaction, matching the commitId of its MeasurementPartitions row if it committed in both files
+	sql += "CREATE TABLE IF NOT EXISTS PartitionCommit (id INTEGER);"
+	       "INSERT INTO PartitionCommit SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM PartitionCommit);";
+	if (sqlite3_exec(sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+		return Error(QString("Cannot create the partition file '%1': %2").arg(filename.c_str()).arg(sqlite3_errmsg(sqlite)).toUtf8().data());
+
+	//the readers don't wait for the ingest thread, same as for the main file
+	if (wal && sqlite3_exec(sqlite, "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot set the journal mode of the partition file '%1': %2").arg(filename.c_str()).arg(sqlite3_errmsg(sqlite)).toUtf8().data());
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::load(sqlite3& db)
+{
+	IClock::time_point start = m_clock->now();
 
 	{
-		const char* sql = "SELECT radioPower, retries, alertBatteryLevel, alertSignalStrengthLevel "
-			              "FROM SensorSettings;";
+		//databases from before the (sensorId, idx) index get it here, it replaces the sensorId one
+		if (sqlite3_exec(&db, "CREATE INDEX IF NOT EXISTS measurementsSensorIdIdx ON Measurements(sensorId, idx);"
+		                      "DROP INDEX IF EXISTS measurementsSensorId;", nullptr, nullptr, nullptr))
+			return Error(QString("Cannot create the measurements index: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	}
+	{
+		Result<void> result = createMeasurementPartitions(db);
+		if (result != success)
+			return result;
+	}
+	{
+		Result<void> result = createMeasurementChunks(db);
+		if (result != success)
+			return result;
+
 		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load sensors configs: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		if (sqlite3_prepare_v2(&db, "SELECT MIN(beginTimePoint), MAX(endTimePoint) FROM MeasurementChunks;", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the measurement chunks: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
 		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-		if (sqlite3_step(stmt) != SQLITE_ROW)
-            return Error(QString("Cannot load sensor config: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-
-        SensorSettings ss;
-		ss.radioPower = (int8_t)sqlite3_column_int64(stmt, 0);
-		ss.retries = (uint8_t)std::clamp<int64_t>(sqlite3_column_int64(stmt, 1), 1, 10);
-		ss.alertBatteryLevel = std::clamp((float)sqlite3_column_double(stmt, 2), 0.f, 1.f);
-		ss.alertSignalStrengthLevel = std::clamp((float)sqlite3_column_double(stmt, 3), 0.f, 1.f);
-		data.sensorSettings = ss;
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		m_chunksRange = std::nullopt;
+		if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+			m_chunksRange = Range<IClock::time_point>{ IClock::from_time_t(sqlite3_column_int64(stmt, 0)), IClock::from_time_t(sqlite3_column_int64(stmt, 1)) };
 	}
-
+	std::vector<RetentionPolicy> retentionPolicies;
 	{
-		const char* sql = "SELECT id, name, address, sensorType, hardwareVersion, softwareVersion, "
-			 			        "temperatureBias, humidityBias, serialNumber, state, shouldSleep, sleepStateTimePoint, statsCommsBlackouts, statsCommsFailures, "
-			 			        "statsUnknownReboots, statsPowerOnReboots, statsResetReboots, statsBrownoutReboots, statsWatchdogReboots, statsCommsRetries, statsAsleep, statsAwake, statsCommsRounds, statsMeasurementRounds, "
-							    "lastCommsTimePoint, lastConfirmedMeasurementIndex, lastAlarmProcessesMeasurementIndex, "
-			 			        "firstStoredMeasurementIndex, storedMeasurementCount, estimatedStoredMeasurementCount, lastSignalStrengthB2S, averageSignalStrengthB2S, averageSignalStrengthS2B, "
-			 			        "isRTMeasurementValid, rtMeasurementTemperature, rtMeasurementHumidity, rtMeasurementVcc "
-                          "FROM Sensors;";
+		Result<void> result = createRetentionPolicies(db);
+		if (result != success)
+			return result;
+
 		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load sensors: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		if (sqlite3_prepare_v2(&db, "SELECT name, filterSensors, sensors, keepRaw, downsampling, decimationPeriod, keepDownsampled FROM RetentionPolicies ORDER BY position;", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the retention policies: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
 		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
 		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			Sensor s;
-			int index = 0;
-            s.id = SensorId(sqlite3_column_int64(stmt, index++));
-			s.descriptor.name = (char const*)sqlite3_column_text(stmt, index++);
-            s.address = SensorAddress(sqlite3_column_int64(stmt, index++));
-			s.deviceInfo.sensorType = (uint8_t)sqlite3_column_int64(stmt, index++);
-			s.deviceInfo.hardwareVersion = (uint8_t)sqlite3_column_int64(stmt, index++);
-			s.deviceInfo.softwareVersion = (uint8_t)sqlite3_column_int64(stmt, index++);
-			s.calibration.temperatureBias = (float)sqlite3_column_double(stmt, index++);
-			s.calibration.humidityBias = (float)sqlite3_column_double(stmt, index++);
-			s.serialNumber = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.state = (Sensor::State)sqlite3_column_int64(stmt, index++);
-			s.shouldSleep = sqlite3_column_int64(stmt, index++) ? true : false;
-			s.sleepStateTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
-			s.stats.commsBlackouts = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.commsFailures = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.unknownReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.powerOnReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.resetReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.brownoutReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.watchdogReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.commsRetries = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.asleep = std::chrono::milliseconds(sqlite3_column_int64(stmt, index++));
-			s.stats.awake = std::chrono::milliseconds(sqlite3_column_int64(stmt, index++));
-			s.stats.commsRounds = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.stats.measurementRounds = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.lastCommsTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
-			s.lastConfirmedMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.lastAlarmProcessesMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.firstStoredMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.storedMeasurementCount = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.estimatedStoredMeasurementCount = (uint32_t)sqlite3_column_int64(stmt, index++);
-			s.lastSignalStrengthB2S = (int16_t)sqlite3_column_int64(stmt, index++);
-			s.averageSignalStrength.b2s = (int16_t)sqlite3_column_int64(stmt, index++);
-			s.averageSignalStrength.s2b = (int16_t)sqlite3_column_int64(stmt, index++);
-			s.isRTMeasurementValid = sqlite3_column_int64(stmt, index++) ? true : false;
-			s.rtMeasurementTemperature = (float)sqlite3_column_double(stmt, index++);
-			s.rtMeasurementHumidity = (float)sqlite3_column_double(stmt, index++);
-			s.rtMeasurementVcc = (float)sqlite3_column_double(stmt, index++);
-            Q_ASSERT(index == 37);
-            s.addedTimePoint = m_clock->now();
-            data.sensors.push_back(std::move(s));
+			RetentionPolicy policy;
+			policy.name = (char const*)sqlite3_column_text(stmt, 0);
+			policy.filterSensors = sqlite3_column_int64(stmt, 1) ? true : false;
+			QString sensors = (char const*)sqlite3_column_text(stmt, 2);
+			QStringList l = sensors.split(QChar(';'), QString::SkipEmptyParts);
+			for (QString str : l)
+				policy.sensors.insert(SensorId(atoll(str.trimmed().toUtf8().data())));
+			policy.keepRaw = std::chrono::seconds(sqlite3_column_int64(stmt, 3));
+			policy.downsampling = (RetentionPolicy::Downsampling)sqlite3_column_int64(stmt, 4);
+			policy.decimationPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 5));
+			policy.keepDownsampled = std::chrono::seconds(sqlite3_column_int64(stmt, 6));
+			retentionPolicies.push_back(std::move(policy));
 		}
 	}
-
+	std::map<std::string, int64_t> partitionCommitIds;
 	{
-		const char* sql = "SELECT id, name, filterSensors, sensors, lowTemperatureWatch, lowTemperatureSoft, lowTemperatureHard, highTemperatureWatch, highTemperatureSoft, highTemperatureHard, "
-			 			            "lowHumidityWatch, lowHumiditySoft, lowHumidityHard, highHumidityWatch, highHumiditySoft, highHumidityHard, "
-							        "lowVccWatch, lowSignalWatch, sensorBlackoutWatch, baseStationDisconnectedWatch, sendEmailAction, resendPeriod, triggersPerSensor, triggersPerBaseStation, "
-				                    "lastTriggeredTimePoint "
-                          "FROM Alarms;";
+		//attached before anything reads the measurements
+		const char* sql = "SELECT name, beginTimePoint, endTimePoint, sealed, backedUp, IFNULL(commitId, 0) FROM MeasurementPartitions ORDER BY rowid;";
 		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load alarms: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the measurement partitions: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
 		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
+		const char* mainFilename = sqlite3_db_filename(&db, "main");
+		bool wal = isWalJournal(db);
+
+		std::vector<MeasurementPartition> partitions;
+		std::map<IClock::time_point, size_t> partitionsByBegin;
+		m_lastPartitionCommitId = 0;
 		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			Alarm a;
-			int index = 0;
-            a.id = AlarmId(sqlite3_column_int64(stmt, index++));
-			a.descriptor.name = (char const*)sqlite3_column_text(stmt, index++);
-            a.descriptor.filterSensors = sqlite3_column_int64(stmt, index++) ? true : false;
+			MeasurementPartition partition;
+			partition.name = (char const*)sqlite3_column_text(stmt, 0);
+			partition.filename = getMeasurementPartitionFilename(mainFilename ? mainFilename : "", partition.name);
+			partition.begin = IClock::from_time_t(sqlite3_column_int64(stmt, 1));
+			partition.end = IClock::from_time_t(sqlite3_column_int64(stmt, 2));
+			partition.sealed = sqlite3_column_int64(stmt, 3) ? true : false;
+			partition.backedUp = sqlite3_column_int64(stmt, 4) ? true : false;
+			partitionCommitIds[partition.name] = sqlite3_column_int64(stmt, 5);
+			m_lastPartitionCommitId = std::max(m_lastPartitionCommitId, int64_t(sqlite3_column_int64(stmt, 5)));
+			if (!QFileInfo::exists(partition.filename.c_str()))
 			{
-				QString sensors = (char const*)sqlite3_column_text(stmt, index++);
-				QStringList l = sensors.split(QChar(';'), QString::SkipEmptyParts);
-				for (QString str : l)
-                    a.descriptor.sensors.insert(SensorId(atoll(str.trimmed().toUtf8().data())));
+				s_logger.logCritical(QString("The measurement partition file '%1' is missing, starting it empty").arg(partition.filename.c_str()));
+				Result<void> result = createMeasurementPartitionFile(partition.filename, wal);
+				if (result != success)
+					return result;
 			}
-            a.descriptor.lowTemperatureWatch = sqlite3_column_int64(stmt, index++) ? true : false;
-            a.descriptor.lowTemperatureSoft = (float)sqlite3_column_double(stmt, index++);
-            a.descriptor.lowTemperatureHard = (float)sqlite3_column_double(stmt, index++);
-            std::tie(a.descriptor.lowTemperatureHard, a.descriptor.lowTemperatureSoft) = std::minmax(a.descriptor.lowTemperatureSoft, a.descriptor.lowTemperatureHard);
-			a.descriptor.highTemperatureWatch = sqlite3_column_int64(stmt, index++) ? true : false;
-			a.descriptor.highTemperatureSoft = (float)sqlite3_column_double(stmt, index++);
-			a.descriptor.highTemperatureHard = (float)sqlite3_column_double(stmt, index++);
-			std::tie(a.descriptor.highTemperatureSoft, a.descriptor.highTemperatureHard) = std::minmax(a.descriptor.highTemperatureSoft, a.descriptor.highTemperatureHard);
-			a.descriptor.lowHumidityWatch = sqlite3_column_int64(stmt, index++) ? true : false;
-			a.descriptor.lowHumiditySoft = (float)sqlite3_column_double(stmt, index++);
-			a.descriptor.lowHumidityHard = (float)sqlite3_column_double(stmt, index++);
-			std::tie(a.descriptor.lowHumidityHard, a.descriptor.lowHumiditySoft) = std::minmax(a.descriptor.lowHumiditySoft, a.descriptor.lowHumidityHard);
-			a.descriptor.highHumidityWatch = sqlite3_column_int64(stmt, index++) ? true : false;
-			a.descriptor.highHumiditySoft = (float)sqlite3_column_double(stmt, index++);
-			a.descriptor.highHumidityHard = (float)sqlite3_column_double(stmt, index++);
-			std::tie(a.descriptor.highHumiditySoft, a.descriptor.highHumidityHard) = std::minmax(a.descriptor.highHumiditySoft, a.descriptor.highHumidityHard);
-			a.descriptor.lowVccWatch = sqlite3_column_int64(stmt, index++);
-			a.descriptor.lowSignalWatch = sqlite3_column_int64(stmt, index++);
-			a.descriptor.sensorBlackoutWatch = sqlite3_column_int64(stmt, index++);
-			a.descriptor.baseStationDisconnectedWatch = sqlite3_column_int64(stmt, index++);
-			a.descriptor.sendEmailAction = sqlite3_column_int64(stmt, index++);
-            a.descriptor.resendPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, index++));
+			partitionsByBegin[partition.begin] = partitions.size();
+			partitions.push_back(std::move(partition));
+		}
+
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		m_partitions = std::move(partitions);
+		m_partitionsByBegin = std::move(partitionsByBegin);
+		m_removedPartitions.clear();
+	}
+	{
+		//no partitions are added for the periods of the removed ones, their measurements stay in the main file
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, "SELECT MAX(endTimePoint) FROM RemovedMeasurementPartitions;", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the removed measurement partitions: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+		m_removedPartitionsEnd = IClock::time_point::min();
+		if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+			m_removedPartitionsEnd = IClock::from_time_t(sqlite3_column_int64(stmt, 0));
+	}
+	attachMeasurementPartitions(db);
+	{
+		//files from before the incremental auto vacuum reuse their free pages but never give them back, so they don't
+		//shrink after the retention policies. Converted once here: the VACUUM rewrites the whole file, which takes a while
+		//on a large one, and the next loads find them converted
+		std::vector<std::string> schemas = { "main" };
+		{
+			std::lock_guard<std::mutex> lg(m_partitionsMutex);
+			for (MeasurementPartition const& partition: m_partitions)
 			{
-				QString triggers = (char const*)sqlite3_column_text(stmt, index++);
-				QStringList l = triggers.split(QChar(';'), QString::SkipEmptyParts);
-				for (QString str : l)
-				{
-                    QStringList l2 = str.trimmed().split(QChar('/'), QString::SkipEmptyParts);
-                    if (l2.size() == 2)
-					    a.triggersPerSensor.emplace(atoll(l2[0].trimmed().toUtf8().data()), atoi(l2[1].trimmed().toUtf8().data()));
-                    else
-                        Q_ASSERT(false);
-				}
+				if (sqlite3_db_filename(&db, partition.name.c_str()))
+					schemas.push_back(partition.name);
 			}
+		}
+		for (std::string const& schema: schemas)
+		{
+			int64_t autoVacuum = 0;
 			{
-				QString triggers = (char const*)sqlite3_column_text(stmt, index++);
-				QStringList l = triggers.split(QChar(';'), QString::SkipEmptyParts);
-				for (QString str : l)
+				sqlite3_stmt* stmt;
+				if (sqlite3_prepare_v2(&db, ("PRAGMA " + schema + ".auto_vacuum;").c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+					return Error(QString("Cannot read the auto vacuum mode of '%1': %2").arg(schema.c_str()).arg(sqlite3_errmsg(&db)).toUtf8().data());
+				utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+				if (sqlite3_step(stmt) == SQLITE_ROW)
+					autoVacuum = sqlite3_column_int64(stmt, 0);
+			}
+			//2 is INCREMENTAL
+			if (autoVacuum == 2)
+				continue;
+
+			//a file that can't be converted, for example for lack of space for the copy, still works as before
+			IClock::time_point vacuumStart = IClock::rtNow();
+			std::string sql = "PRAGMA " + schema + ".auto_vacuum = INCREMENTAL; VACUUM " + schema + ";";
+			if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+				s_logger.logWarning(QString("Cannot set the incremental auto vacuum mode of '%1': %2").arg(schema.c_str()).arg(sqlite3_errmsg(&db)));
+			else
+				s_logger.logInfo(QString("Set the incremental auto vacuum mode of '%1' in %2s").arg(schema.c_str()).arg(std::chrono::duration<float>(IClock::rtNow() - vacuumStart).count()));
+		}
+	}
+	{
+		//databases from before the sort indexes get them here, in the main file and in the partitions still written.
+		//Not the sealed partitions, they stay as they were backed up and their part of a query is sorted instead
+		std::vector<std::string> statements = getMeasurementSortIndexesSql("");
+		{
+			std::lock_guard<std::mutex> lg(m_partitionsMutex);
+			for (MeasurementPartition const& partition: m_partitions)
+			{
+				if (!partition.sealed && sqlite3_db_filename(&db, partition.name.c_str()))
 				{
-					QStringList l2 = str.trimmed().split(QChar('/'), QString::SkipEmptyParts);
-					if (l2.size() == 2)
-						a.triggersPerBaseStation.emplace(atoll(l2[0].trimmed().toUtf8().data()), atoi(l2[1].trimmed().toUtf8().data()));
-					else
-						Q_ASSERT(false);
+					std::vector<std::string> partitionStatements = getMeasurementSortIndexesSql(partition.name + ".");
+					statements.insert(statements.end(), partitionStatements.begin(), partitionStatements.end());
 				}
 			}
-			a.lastTriggeredTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
-			Q_ASSERT(index == 25);
-			data.alarms.push_back(std::move(a));
+		}
+		for (std::string const& sql: statements)
+		{
+			if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
+				return Error(QString("Cannot create the measurement sort indexes: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 		}
 	}
 	{
-		const char* sql = "SELECT id, name, period, customPeriod, filterSensors, sensors, lastTriggeredTimePoint "
-                          "FROM Reports;";
+		//databases from before the rollups get them here
+		sqlite3_exec(&db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+		Result<void> result = createMeasurementRollups(db, true, getMeasurementSources(db));
+		sqlite3_exec(&db, result == success ? "END TRANSACTION;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+		if (result != success)
+			return result;
+
 		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-			return Error(QString("Cannot load reports: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
-		
+		if (sqlite3_prepare_v2(&db, "SELECT MIN(timePoint) FROM MeasurementRollupsBackfill;", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the rollups backfill: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+		m_rollupsBackfillTimePoint = std::numeric_limits<int64_t>::min();
+		if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+			m_rollupsBackfillTimePoint = sqlite3_column_int64(stmt, 0);
+	}
+	{
+		//before the counts are loaded from the rollups
+		Result<void> result = reconcileMeasurementPartitions(db, partitionCommitIds);
+		if (result != success)
+			return result;
+	}
+	{
+		Result<void> result = loadMeasurementCounts(db);
+		if (result != success)
+			return result;
+	}
 
-		while (sqlite3_step(stmt) == SQLITE_ROW)
-		{
-			Report r;
-            r.id = ReportId(sqlite3_column_int64(stmt, 0));
-			r.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
-			r.descriptor.period = (ReportDescriptor::Period)sqlite3_column_int64(stmt, 2);
-			r.descriptor.customPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 3));
-			r.descriptor.filterSensors = sqlite3_column_int64(stmt, 4) ? true : false;
-			QString sensors = (char const*)sqlite3_column_text(stmt, 5);
-			QStringList l = sensors.split(QChar(';'), QString::SkipEmptyParts);
-			for (QString str : l)
-                r.descriptor.sensors.insert(SensorId(atoll(str.trimmed().toUtf8().data())));
-
-			r.lastTriggeredTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 6));
-			data.reports.push_back(std::move(r));
-		}
-    }
-
-	for (const User& user : data.users)
-		data.lastUserId = std::max(data.lastUserId, user.id);
+    Data data;
 
-	for (const BaseStation& bs: data.baseStations)
-		data.lastBaseStationId = std::max(data.lastBaseStationId, bs.id);
+    {
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, "REPLACE INTO BaseStations (id, name, mac, lastCommsTimePoint) "
+                                    "VALUES (?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-	for (const Sensor& sensor: data.sensors)
+		m_saveBaseStationsStmt.reset(stmt, &sqlite3_finalize);
+    }
 	{
-		data.lastSensorAddress = std::max(data.lastSensorAddress, sensor.address);
-		data.lastSensorId = std::max(data.lastSensorId, sensor.id);
-	}
-	for (const Alarm& alarm: data.alarms)
-		data.lastAlarmId = std::max(data.lastAlarmId, alarm.id);
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, "INSERT INTO SensorTimeConfigs (baselineMeasurementTimePoint, baselineMeasurementIndex, measurementPeriod, commsPeriod) "
+                                    "VALUES (?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-	for (const Report& report: data.reports)
-		data.lastReportId = std::max(data.lastReportId, report.id);
+		m_saveSensorTimeConfigsStmt.reset(stmt, &sqlite3_finalize);
+	}
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, "REPLACE INTO SensorSettings (id, radioPower, retries, alertBatteryLevel, alertSignalStrengthLevel) "
+                               "VALUES (0, ?1, ?2, ?3, ?4);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-	bool needsSave = false;
-    {
-        std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-        m_data = data;
+		m_saveSensorSettingsStmt.reset(stmt, &sqlite3_finalize);
+	}
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, "REPLACE INTO Sensors (id, name, address, sensorType, hardwareVersion, softwareVersion, "
+						                       "temperatureBias, humidityBias, serialNumber, state, shouldSleep, sleepStateTimePoint, statsCommsBlackouts, statsCommsFailures, "
+						                       "statsUnknownReboots, statsPowerOnReboots, statsResetReboots, statsBrownoutReboots, statsWatchdogReboots, statsCommsRetries, statsAsleep, statsAwake, statsCommsRounds, statsMeasurementRounds, "
+											   "lastCommsTimePoint, lastConfirmedMeasurementIndex, lastAlarmProcessesMeasurementIndex, "
+						                       "firstStoredMeasurementIndex, storedMeasurementCount, estimatedStoredMeasurementCount, lastSignalStrengthB2S, averageSignalStrengthB2S, averageSignalStrengthS2B, "
+						                       "isRTMeasurementValid, rtMeasurementTemperature, rtMeasurementHumidity, rtMeasurementVcc) "
+                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25, ?26, ?27, ?28, ?29, ?30, ?31, ?32, ?33, ?34, ?35, ?36, ?37);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		{
-            //remove any unbound sensor
-			int32_t index = findUnboundSensorIndex();
-			if (index >= 0)
-			{
-				if (m_data.sensors[size_t(index)].serialNumber == 0)
-					removeSensor((size_t)index);
-				else
-					m_data.sensors[size_t(index)].state = Sensor::State::Active;
-			}
-		}
+		m_saveSensorsStmt.reset(stmt, &sqlite3_finalize);
+	}
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, "REPLACE INTO Alarms (id, name, filterSensors, sensors, lowTemperatureWatch, lowTemperatureSoft, lowTemperatureHard, highTemperatureWatch, highTemperatureSoft, highTemperatureHard, "
+						                       "lowHumidityWatch, lowHumiditySoft, lowHumidityHard, highHumidityWatch, highHumiditySoft, highHumidityHard, "
+						                       "lowVccWatch, lowSignalWatch, sensorBlackoutWatch, baseStationDisconnectedWatch, sendEmailAction, resendPeriod, triggersPerSensor, triggersPerBaseStation, "
+											   "lastTriggeredTimePoint) "
+                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-        //refresh computed comms period
-        if (m_data.sensorTimeConfigs.empty())
-        {
-            _addSensorTimeConfig(SensorTimeConfigDescriptor()).ignore();
-			needsSave = true;
-        }
+		m_saveAlarmsStmt.reset(stmt, &sqlite3_finalize);
+	}
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, "REPLACE INTO Reports (id, name, period, customPeriod, filterSensors, sensors, lastTriggeredTimePoint) "
+                                    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-        s_logger.logVerbose(QString("Done loading DB. Time: %3s").arg(std::chrono::duration<float>(m_clock->now() - start).count()));
+		m_saveReportsStmt.reset(stmt, &sqlite3_finalize);
     }
 
-	m_sqlite = &db;
 
-	if (needsSave)
-		save(true);
+	{
+		const char* sql = "SELECT dateTimeFormat, showCriticalLogsPopup FROM GeneralSettings;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load general settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-    return success;
-}
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+			return Error(QString("Cannot load general settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+        
+		data.generalSettings.dateTimeFormat = DateTimeFormat(sqlite3_column_int64(stmt, 0));
+		data.generalSettings.showCriticalLogsPopup = sqlite3_column_int(stmt, 1) ? true : false;
+	}
+	{
+		//id INTEGER PRIMARY KEY, dateTimeFormatOverride INTEGER, unitsFormat INTEGER, "
+		//	"exportId BOOLEAN, exportIndex BOOLEAN, exportSensorName BOOLEAN, exportSensorSN BOOLEAN, exportTimePoint BOOLEAN, exportReceivedTimePoint BOOLEAN, "
+		//	"exportTemperature BOOLEAN, exportHumidity BOOLEAN, exportBattery BOOLEAN, exportSignal BOOLEAN, "
+		//	"decimalPlaces INTEGER
+		const char* sql = "SELECT dateTimeFormatOverride, unitsFormat, exportId, exportIndex, exportSensorName, exportSensorSN, exportTimePoint, exportReceivedTimePoint, "
+			"exportTemperature, exportHumidity, exportBattery, exportSignal, "
+            "decimalPlaces, separator FROM CsvSettings;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load csv settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-//////////////////////////////////////////////////////////////////////////
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-void DB::scheduleSave()
-{
-	m_saveScheduled = true;
-}
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+			return Error(QString("Cannot load csv settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-//////////////////////////////////////////////////////////////////////////
+        int v = int(sqlite3_column_int64(stmt, 0));
+		if (v >= 0)
+            data.csvSettings.dateTimeFormatOverride = DateTimeFormat(v);
 
-void DB::save(bool newTransaction)
-{
-	save(m_data, newTransaction);
-	m_saveScheduled = false;
-}
+        data.csvSettings.unitsFormat = CsvSettings::UnitsFormat(sqlite3_column_int(stmt, 1));
+		data.csvSettings.exportId = sqlite3_column_int(stmt, 2) ? true : false;
+		data.csvSettings.exportIndex = sqlite3_column_int(stmt, 3) ? true : false;
+		data.csvSettings.exportSensorName = sqlite3_column_int(stmt, 4) ? true : false;
+		data.csvSettings.exportSensorSN = sqlite3_column_int(stmt, 5) ? true : false;
+		data.csvSettings.exportTimePoint = sqlite3_column_int(stmt, 6) ? true : false;
+		data.csvSettings.exportReceivedTimePoint = sqlite3_column_int(stmt, 7) ? true : false;
+		data.csvSettings.exportTemperature = sqlite3_column_int(stmt, 8) ? true : false;
+		data.csvSettings.exportHumidity = sqlite3_column_int(stmt, 9) ? true : false;
+		data.csvSettings.exportBattery = sqlite3_column_int(stmt, 10) ? true : false;
+		data.csvSettings.exportSignal = sqlite3_column_int(stmt, 11) ? true : false;
+        data.csvSettings.decimalPlaces = uint32_t(sqlite3_column_int(stmt, 12));
+        data.csvSettings.separator = (const char*)sqlite3_column_text(stmt, 13);
+    }
+	{
+		//id INTEGER PRIMARY KEY, host STRING, port INTEGER, connection INTEGER, username STRING, password STRING, sender STRING, recipients STRING
+		const char* sql = "SELECT host, port, connection, username, password, sender, recipients FROM EmailSettings;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load email settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-//////////////////////////////////////////////////////////////////////////
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+			return Error(QString("Cannot load email settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		
+		data.emailSettings.host = (char const*)sqlite3_column_text(stmt, 0);
+        data.emailSettings.port = uint16_t(sqlite3_column_int(stmt, 1));
+		data.emailSettings.connection = (EmailSettings::Connection)sqlite3_column_int(stmt, 2);
+		data.emailSettings.username = (char const*)sqlite3_column_text(stmt, 3);
+		data.emailSettings.password = (char const*)sqlite3_column_text(stmt, 4);
+		data.emailSettings.sender = (char const*)sqlite3_column_text(stmt, 5);
+		QString recipients = (char const*)sqlite3_column_text(stmt, 6);
 
-void DB::save(Data& data, bool newTransaction) const
-{
-	IClock::time_point start = m_clock->now();
+		QStringList l = recipients.split(QChar(';'), QString::SkipEmptyParts);
+		for (QString str : l)
+			data.emailSettings.recipients.push_back(str.trimmed().toUtf8().data());
+	}
+	{
+		//FtpSettings (id INTEGER PRIMARY KEY, host STRING, port INTEGER, username STRING, password STRING, folder STRING, uploadBackups BOOLEAN, uploadPeriod INTEGER);";
+		const char* sql = "SELECT host, port, username, password, folder, uploadBackups, uploadPeriod FROM FtpSettings;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load ftp settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-	if (newTransaction)
-        sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-	utils::epilogue epi([this, newTransaction]
-	{
-		if (newTransaction)
-            sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr);
-	});
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+			return Error(QString("Cannot load ftp settings row: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-	if (data.generalSettingsChanged)
+		data.ftpSettings.host = (char const*)sqlite3_column_text(stmt, 0);
+        data.ftpSettings.port = uint16_t(sqlite3_column_int(stmt, 1));
+		data.ftpSettings.username = (char const*)sqlite3_column_text(stmt, 2);
+		data.ftpSettings.password = (char const*)sqlite3_column_text(stmt, 3);
+		data.ftpSettings.folder = (char const*)sqlite3_column_text(stmt, 4);
+		data.ftpSettings.uploadBackups = sqlite3_column_int(stmt, 5) ? true : false;
+		data.ftpSettings.uploadBackupsPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 6));
+	}
 	{
-		data.generalSettingsChanged = false;
+		//Users (id INTEGER PRIMARY KEY, name STRING, passwordHash STRING, permissions INTEGER, type INTEGER, lastLogin DATETIME);";
+		const char* sql = "SELECT id, name, passwordHash, permissions, type, lastLogin FROM Users;";
 		sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO GeneralSettings (id, dateTimeFormat, showCriticalLogsPopup) VALUES (0, ?1, ?2);", -1, &stmt, nullptr);
-        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load user settings: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		sqlite3_bind_int64(stmt, 1, (int)data.generalSettings.dateTimeFormat);
-		sqlite3_bind_int(stmt, 2, data.generalSettings.showCriticalLogsPopup ? 1 : 0);
-		if (sqlite3_step(stmt) != SQLITE_DONE)
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			s_logger.logCritical(QString("Failed to save general settings: %1").arg(sqlite3_errmsg(m_sqlite)));
-			return;
+			User user;
+            user.id = UserId(sqlite3_column_int64(stmt, 0));
+			user.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
+			user.descriptor.passwordHash = (char const*)sqlite3_column_text(stmt, 2);
+            user.descriptor.permissions = uint32_t(sqlite3_column_int64(stmt, 3));
+			user.descriptor.type = (UserDescriptor::Type)sqlite3_column_int(stmt, 4);
+			user.lastLogin = IClock::from_time_t(sqlite3_column_int64(stmt, 5));
+			data.users.push_back(std::move(user));
 		}
 	}
-
-	if (data.csvSettingsChanged)
 	{
-		data.csvSettingsChanged = false;
+		//const char* sql = "CREATE TABLE BaseStations (id INTEGER PRIMARY KEY, name STRING, mac STRING);";
+		const char* sql = "SELECT id, name, mac, lastCommsTimePoint "
+                          "FROM BaseStations;";
 		sqlite3_stmt* stmt;
-		sqlite3_prepare_v2(m_sqlite, "REPLACE INTO CsvSettings (id, dateTimeFormatOverride, unitsFormat, "
-						   "exportId, exportIndex, exportSensorName, exportSensorSN, exportTimePoint, exportReceivedTimePoint, "
-						   "exportTemperature, exportHumidity, exportBattery, exportSignal, "
-                           "decimalPlaces, separator) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14);", -1, &stmt, nullptr);
-        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		sqlite3_bind_int64(stmt, 1, data.csvSettings.dateTimeFormatOverride.has_value() ? (int)data.csvSettings.dateTimeFormatOverride.value() : -1);
-		sqlite3_bind_int64(stmt, 2, (int)data.csvSettings.unitsFormat);
-		sqlite3_bind_int(stmt, 3, data.csvSettings.exportId ? 1 : 0);
-		sqlite3_bind_int(stmt, 4, data.csvSettings.exportIndex ? 1 : 0);
-		sqlite3_bind_int(stmt, 5, data.csvSettings.exportSensorName ? 1 : 0);
-		sqlite3_bind_int(stmt, 6, data.csvSettings.exportSensorSN ? 1 : 0);
-		sqlite3_bind_int(stmt, 7, data.csvSettings.exportTimePoint ? 1 : 0);
-		sqlite3_bind_int(stmt, 8, data.csvSettings.exportReceivedTimePoint ? 1 : 0);
-		sqlite3_bind_int(stmt, 9, data.csvSettings.exportTemperature ? 1 : 0);
-		sqlite3_bind_int(stmt, 10, data.csvSettings.exportHumidity ? 1 : 0);
-		sqlite3_bind_int(stmt, 11, data.csvSettings.exportBattery ? 1 : 0);
-		sqlite3_bind_int(stmt, 12, data.csvSettings.exportSignal ? 1 : 0);
-		sqlite3_bind_int64(stmt, 13, data.csvSettings.decimalPlaces);
-		sqlite3_bind_text(stmt, 14, data.csvSettings.separator.c_str(), -1, SQLITE_STATIC);
-		if (sqlite3_step(stmt) != SQLITE_DONE)
-		{
-			s_logger.logCritical(QString("Failed to save csv settings: %1").arg(sqlite3_errmsg(m_sqlite)));
-			return;
-		}
-	}
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            BaseStation bs;
+            bs.id = BaseStationId(sqlite3_column_int64(stmt, 0));
+		    bs.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
+			std::string macStr = (char const*)sqlite3_column_text(stmt, 2);
+			int m0, m1, m2, m3, m4, m5;
+            if (sscanf(macStr.c_str(), "%X:%X:%X:%X:%X:%X", &m0, &m1, &m2, &m3, &m4, &m5) != 6)
+                return Error(QString("Bad base station mac: %1").arg(macStr.c_str()).toUtf8().data());
+
+            bs.descriptor.mac = { static_cast<uint8_t>(m0 & 0xFF), static_cast<uint8_t>(m1 & 0xFF), static_cast<uint8_t>(m2 & 0xFF), static_cast<uint8_t>(m3 & 0xFF), static_cast<uint8_t>(m4 & 0xFF), static_cast<uint8_t>(m5 & 0xFF) };
+			bs.lastCommsTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 3));
+            data.baseStations.push_back(std::move(bs));
+        }
+	}
 
-	if (data.emailSettingsChanged)
 	{
-		data.emailSettingsChanged = false;
+		const char* sql = "SELECT baselineMeasurementTimePoint, baselineMeasurementIndex, measurementPeriod, commsPeriod "
+                          "FROM SensorTimeConfigs;";
 		sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO EmailSettings (id, host, port, connection, username, password, sender, recipients) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr);
-        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load sensors configs: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		sqlite3_bind_text(stmt, 1, data.emailSettings.host.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_int64(stmt, 2, data.emailSettings.port);
-		sqlite3_bind_int(stmt, 3, (int)data.emailSettings.connection);
-		sqlite3_bind_text(stmt, 4, data.emailSettings.username.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(stmt, 5, data.emailSettings.password.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(stmt, 6, data.emailSettings.sender.c_str(), -1, SQLITE_STATIC);
-		std::string recipients = std::accumulate(data.emailSettings.recipients.begin(), data.emailSettings.recipients.end(), std::string(";"));
-		sqlite3_bind_text(stmt, 7, recipients.c_str(), -1, SQLITE_TRANSIENT);
-		if (sqlite3_step(stmt) != SQLITE_DONE)
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			s_logger.logCritical(QString("Failed to save email settings: %1").arg(sqlite3_errmsg(m_sqlite)));
-			return;
+            SensorTimeConfig sc;
+			sc.baselineMeasurementTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 0));
+            sc.baselineMeasurementIndex = uint32_t(sqlite3_column_int64(stmt, 1));
+			sc.descriptor.measurementPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 2));
+			sc.descriptor.commsPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 3));
+			data.sensorTimeConfigs.push_back(std::move(sc));
 		}
 	}
 
-	if (data.ftpSettingsChanged)
 	{
-		data.ftpSettingsChanged = false;
+		const char* sql = "SELECT radioPower, retries, alertBatteryLevel, alertSignalStrengthLevel "
+			              "FROM SensorSettings;";
 		sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO FtpSettings (id, host, port, username, password, folder, uploadBackups, uploadPeriod) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr);
-        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load sensors configs: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		sqlite3_bind_text(stmt, 1, data.ftpSettings.host.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_int64(stmt, 2, data.ftpSettings.port);
-		sqlite3_bind_text(stmt, 3, data.ftpSettings.username.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(stmt, 4, data.ftpSettings.password.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(stmt, 5, data.ftpSettings.folder.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(stmt, 6, data.ftpSettings.uploadBackups ? 1 : 0);
-		sqlite3_bind_int64(stmt, 7, std::chrono::duration_cast<std::chrono::seconds>(data.ftpSettings.uploadBackupsPeriod).count());
-		if (sqlite3_step(stmt) != SQLITE_DONE)
-		{
-			s_logger.logCritical(QString("Failed to save ftp settings: %1").arg(sqlite3_errmsg(m_sqlite)));
-			return;
-		}
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+            return Error(QString("Cannot load sensor config: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
+        SensorSettings ss;
+		ss.radioPower = (int8_t)sqlite3_column_int64(stmt, 0);
+		ss.retries = (uint8_t)std::clamp<int64_t>(sqlite3_column_int64(stmt, 1), 1, 10);
+		ss.alertBatteryLevel = std::clamp((float)sqlite3_column_double(stmt, 2), 0.f, 1.f);
+		ss.alertSignalStrengthLevel = std::clamp((float)sqlite3_column_double(stmt, 3), 0.f, 1.f);
+		data.sensorSettings = ss;
 	}
 
-	if (data.usersChanged || data.usersAddedOrRemoved)
 	{
-		if (data.usersAddedOrRemoved)
-		{
-			const char* sql = "DELETE FROM Users;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
-			{
-				s_logger.logCritical(QString("Failed to clear users: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-		}
+		const char* sql = "SELECT id, name, address, sensorType, hardwareVersion, softwareVersion, "
+			 			        "temperatureBias, humidityBias, serialNumber, state, shouldSleep, sleepStateTimePoint, statsCommsBlackouts, statsCommsFailures, "
+			 			        "statsUnknownReboots, statsPowerOnReboots, statsResetReboots, statsBrownoutReboots, statsWatchdogReboots, statsCommsRetries, statsAsleep, statsAwake, statsCommsRounds, statsMeasurementRounds, "
+							    "lastCommsTimePoint, lastConfirmedMeasurementIndex, lastAlarmProcessesMeasurementIndex, "
+			 			        "firstStoredMeasurementIndex, storedMeasurementCount, estimatedStoredMeasurementCount, lastSignalStrengthB2S, averageSignalStrengthB2S, averageSignalStrengthS2B, "
+			 			        "isRTMeasurementValid, rtMeasurementTemperature, rtMeasurementHumidity, rtMeasurementVcc "
+                          "FROM Sensors;";
 		sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO Users (id, name, passwordHash, permissions, type, lastLogin) VALUES(?1, ?2, ?3, ?4, ?5, ?6);", -1, &stmt, nullptr);
-        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load sensors: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-		for (User const& user : data.users)
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			sqlite3_bind_int64(stmt, 1, user.id);
-			sqlite3_bind_text(stmt, 2, user.descriptor.name.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 3, user.descriptor.passwordHash.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_int64(stmt, 4, user.descriptor.permissions);
-			sqlite3_bind_int(stmt, 5, (int)user.descriptor.type);
-			sqlite3_bind_int64(stmt, 6, IClock::to_time_t(user.lastLogin));
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				s_logger.logCritical(QString("Failed to save user: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-			sqlite3_reset(stmt);
+			Sensor s;
+			int index = 0;
+            s.id = SensorId(sqlite3_column_int64(stmt, index++));
+			s.descriptor.name = (char const*)sqlite3_column_text(stmt, index++);
+            s.address = SensorAddress(sqlite3_column_int64(stmt, index++));
+			s.deviceInfo.sensorType = (uint8_t)sqlite3_column_int64(stmt, index++);
+			s.deviceInfo.hardwareVersion = (uint8_t)sqlite3_column_int64(stmt, index++);
+			s.deviceInfo.softwareVersion = (uint8_t)sqlite3_column_int64(stmt, index++);
+			s.calibration.temperatureBias = (float)sqlite3_column_double(stmt, index++);
+			s.calibration.humidityBias = (float)sqlite3_column_double(stmt, index++);
+			s.serialNumber = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.state = (Sensor::State)sqlite3_column_int64(stmt, index++);
+			s.shouldSleep = sqlite3_column_int64(stmt, index++) ? true : false;
+			s.sleepStateTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
+			s.stats.commsBlackouts = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.commsFailures = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.unknownReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.powerOnReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.resetReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.brownoutReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.watchdogReboots = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.commsRetries = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.asleep = std::chrono::milliseconds(sqlite3_column_int64(stmt, index++));
+			s.stats.awake = std::chrono::milliseconds(sqlite3_column_int64(stmt, index++));
+			s.stats.commsRounds = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.stats.measurementRounds = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.lastCommsTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
+			s.lastConfirmedMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.lastAlarmProcessesMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.firstStoredMeasurementIndex = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.storedMeasurementCount = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.estimatedStoredMeasurementCount = (uint32_t)sqlite3_column_int64(stmt, index++);
+			s.lastSignalStrengthB2S = (int16_t)sqlite3_column_int64(stmt, index++);
+			s.averageSignalStrength.b2s = (int16_t)sqlite3_column_int64(stmt, index++);
+			s.averageSignalStrength.s2b = (int16_t)sqlite3_column_int64(stmt, index++);
+			s.isRTMeasurementValid = sqlite3_column_int64(stmt, index++) ? true : false;
+			s.rtMeasurementTemperature = (float)sqlite3_column_double(stmt, index++);
+			s.rtMeasurementHumidity = (float)sqlite3_column_double(stmt, index++);
+			s.rtMeasurementVcc = (float)sqlite3_column_double(stmt, index++);
+            Q_ASSERT(index == 37);
+            s.addedTimePoint = m_clock->now();
+            data.sensors.push_back(std::move(s));
 		}
-		data.usersAddedOrRemoved = false;
-		data.usersChanged = false;
 	}
-	if (data.baseStationsChanged || data.baseStationsAddedOrRemoved)
+
 	{
-		if (data.baseStationsAddedOrRemoved)
+		const char* sql = "SELECT id, name, filterSensors, sensors, lowTemperatureWatch, lowTemperatureSoft, lowTemperatureHard, highTemperatureWatch, highTemperatureSoft, highTemperatureHard, "
+			 			            "lowHumidityWatch, lowHumiditySoft, lowHumidityHard, highHumidityWatch, highHumiditySoft, highHumidityHard, "
+							        "lowVccWatch, lowSignalWatch, sensorBlackoutWatch, baseStationDisconnectedWatch, sendEmailAction, resendPeriod, triggersPerSensor, triggersPerBaseStation, "
+				                    "lastTriggeredTimePoint "
+                          "FROM Alarms;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load alarms: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			const char* sql = "DELETE FROM BaseStations;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
+			Alarm a;
+			int index = 0;
+            a.id = AlarmId(sqlite3_column_int64(stmt, index++));
+			a.descriptor.name = (char const*)sqlite3_column_text(stmt, index++);
+            a.descriptor.filterSensors = sqlite3_column_int64(stmt, index++) ? true : false;
 			{
-				s_logger.logCritical(QString("Failed to clear base stations: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
+				QString sensors = (char const*)sqlite3_column_text(stmt, index++);
+				QStringList l = sensors.split(QChar(';'), QString::SkipEmptyParts);
+				for (QString str : l)
+                    a.descriptor.sensors.insert(SensorId(atoll(str.trimmed().toUtf8().data())));
 			}
-		}
-		sqlite3_stmt* stmt = m_saveBaseStationsStmt.get();
-		for (BaseStation const& bs : data.baseStations)
-		{
-			sqlite3_bind_int64(stmt, 1, bs.id);
-			sqlite3_bind_text(stmt, 2, bs.descriptor.name.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 3, utils::getMacStr(bs.descriptor.mac).c_str(), -1, SQLITE_TRANSIENT);
-			sqlite3_bind_int64(stmt, 4, IClock::to_time_t(bs.lastCommsTimePoint));
-			if (sqlite3_step(stmt) != SQLITE_DONE)
+            a.descriptor.lowTemperatureWatch = sqlite3_column_int64(stmt, index++) ? true : false;
+            a.descriptor.lowTemperatureSoft = (float)sqlite3_column_double(stmt, index++);
+            a.descriptor.lowTemperatureHard = (float)sqlite3_column_double(stmt, index++);
+            std::tie(a.descriptor.lowTemperatureHard, a.descriptor.lowTemperatureSoft) = std::minmax(a.descriptor.lowTemperatureSoft, a.descriptor.lowTemperatureHard);
+			a.descriptor.highTemperatureWatch = sqlite3_column_int64(stmt, index++) ? true : false;
+			a.descriptor.highTemperatureSoft = (float)sqlite3_column_double(stmt, index++);
+			a.descriptor.highTemperatureHard = (float)sqlite3_column_double(stmt, index++);
+			std::tie(a.descriptor.highTemperatureSoft, a.descriptor.highTemperatureHard) = std::minmax(a.descriptor.highTemperatureSoft, a.descriptor.highTemperatureHard);
+			a.descriptor.lowHumidityWatch = sqlite3_column_int64(stmt, index++) ? true : false;
+			a.descriptor.lowHumiditySoft = (float)sqlite3_column_double(stmt, index++);
+			a.descriptor.lowHumidityHard = (float)sqlite3_column_double(stmt, index++);
+			std::tie(a.descriptor.lowHumidityHard, a.descriptor.lowHumiditySoft) = std::minmax(a.descriptor.lowHumiditySoft, a.descriptor.lowHumidityHard);
+			a.descriptor.highHumidityWatch = sqlite3_column_int64(stmt, index++) ? true : false;
+			a.descriptor.highHumiditySoft = (float)sqlite3_column_double(stmt, index++);
+			a.descriptor.highHumidityHard = (float)sqlite3_column_double(stmt, index++);
+			std::tie(a.descriptor.highHumiditySoft, a.descriptor.highHumidityHard) = std::minmax(a.descriptor.highHumiditySoft, a.descriptor.highHumidityHard);
+			a.descriptor.lowVccWatch = sqlite3_column_int64(stmt, index++);
+			a.descriptor.lowSignalWatch = sqlite3_column_int64(stmt, index++);
+			a.descriptor.sensorBlackoutWatch = sqlite3_column_int64(stmt, index++);
+			a.descriptor.baseStationDisconnectedWatch = sqlite3_column_int64(stmt, index++);
+			a.descriptor.sendEmailAction = sqlite3_column_int64(stmt, index++);
+            a.descriptor.resendPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, index++));
 			{
-				s_logger.logCritical(QString("Failed to save base station: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
+				QString triggers = (char const*)sqlite3_column_text(stmt, index++);
+				QStringList l = triggers.split(QChar(';'), QString::SkipEmptyParts);
+				for (QString str : l)
+				{
+                    QStringList l2 = str.trimmed().split(QChar('/'), QString::SkipEmptyParts);
+                    if (l2.size() == 2)
+					    a.triggersPerSensor.emplace(atoll(l2[0].trimmed().toUtf8().data()), atoi(l2[1].trimmed().toUtf8().data()));
+                    else
+                        Q_ASSERT(false);
+				}
 			}
-			sqlite3_reset(stmt);
+			{
+				QString triggers = (char const*)sqlite3_column_text(stmt, index++);
+				QStringList l = triggers.split(QChar(';'), QString::SkipEmptyParts);
+				for (QString str : l)
+				{
+					QStringList l2 = str.trimmed().split(QChar('/'), QString::SkipEmptyParts);
+					if (l2.size() == 2)
+						a.triggersPerBaseStation.emplace(atoll(l2[0].trimmed().toUtf8().data()), atoi(l2[1].trimmed().toUtf8().data()));
+					else
+						Q_ASSERT(false);
+				}
+			}
+			a.lastTriggeredTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, index++));
+			Q_ASSERT(index == 25);
+			data.alarms.push_back(std::move(a));
 		}
-		data.baseStationsAddedOrRemoved = false;
-		data.baseStationsChanged = false;
 	}
-	if (data.sensorTimeConfigsChanged)
 	{
+		const char* sql = "SELECT id, name, period, customPeriod, filterSensors, sensors, lastTriggeredTimePoint "
+                          "FROM Reports;";
+		sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(&db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load reports: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+		
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			const char* sql = "DELETE FROM SensorTimeConfigs;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
-			{
-				s_logger.logCritical(QString("Failed to clear sensor configs: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-		}
-		sqlite3_stmt* stmt = m_saveSensorTimeConfigsStmt.get();
-		for (SensorTimeConfig const& sc : data.sensorTimeConfigs)
-		{
-			sqlite3_bind_int64(stmt, 1, IClock::to_time_t(sc.baselineMeasurementTimePoint));
-			sqlite3_bind_int64(stmt, 2, sc.baselineMeasurementIndex);
-			sqlite3_bind_int64(stmt, 3, std::chrono::duration_cast<std::chrono::seconds>(sc.descriptor.measurementPeriod).count());
-			sqlite3_bind_int64(stmt, 4, std::chrono::duration_cast<std::chrono::seconds>(sc.descriptor.commsPeriod).count());
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				s_logger.logCritical(QString("Failed to save sensor config: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-			sqlite3_reset(stmt);
+			Report r;
+            r.id = ReportId(sqlite3_column_int64(stmt, 0));
+			r.descriptor.name = (char const*)sqlite3_column_text(stmt, 1);
+			r.descriptor.period = (ReportDescriptor::Period)sqlite3_column_int64(stmt, 2);
+			r.descriptor.customPeriod = std::chrono::seconds(sqlite3_column_int64(stmt, 3));
+			r.descriptor.filterSensors = sqlite3_column_int64(stmt, 4) ? true : false;
+			QString sensors = (char const*)sqlite3_column_text(stmt, 5);
+			QStringList l = sensors.split(QChar(';'), QString::SkipEmptyParts);
+			for (QString str : l)
+                r.descriptor.sensors.insert(SensorId(atoll(str.trimmed().toUtf8().data())));
+
+			r.lastTriggeredTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, 6));
+			data.reports.push_back(std::move(r));
 		}
-		data.sensorTimeConfigsChanged = false;
-	}
-	if (data.sensorSettingsChanged)
-	{
-		data.sensorSettingsChanged = false;
-		sqlite3_stmt* stmt = m_saveSensorSettingsStmt.get();
+    }
 
-		sqlite3_bind_int64(stmt, 1, data.sensorSettings.radioPower);
-		sqlite3_bind_int64(stmt, 2, data.sensorSettings.retries);
-		sqlite3_bind_double(stmt, 3, data.sensorSettings.alertBatteryLevel);
-		sqlite3_bind_double(stmt, 4, data.sensorSettings.alertSignalStrengthLevel);
+	for (const User& user : data.users)
+		data.lastUserId = std::max(data.lastUserId, user.id);
 
-//		const char* xx = sqlite3_expanded_sql(stmt);
+	for (const BaseStation& bs: data.baseStations)
+		data.lastBaseStationId = std::max(data.lastBaseStationId, bs.id);
 
-		if (sqlite3_step(stmt) != SQLITE_DONE)
-		{
-			s_logger.logCritical(QString("Failed to save sensor settings: %1").arg(sqlite3_errmsg(m_sqlite)));
-			return;
-		}
-		sqlite3_reset(stmt);
-	}
-	if (data.sensorsChanged || data.sensorsAddedOrRemoved)
+	for (const Sensor& sensor: data.sensors)
 	{
-		if (data.sensorsAddedOrRemoved)
+		data.lastSensorAddress = std::max(data.lastSensorAddress, sensor.address);
+		data.lastSensorId = std::max(data.lastSensorId, sensor.id);
+	}
+	for (const Alarm& alarm: data.alarms)
+		data.lastAlarmId = std::max(data.lastAlarmId, alarm.id);
+
+	for (const Report& report: data.reports)
+		data.lastReportId = std::max(data.lastReportId, report.id);
+
+	bool needsSave = false;
+    {
+        std::lock_guard<DataMutex> lg(m_dataMutex);
+        m_data = data;
+        rebuildIndexes();
+
 		{
-			const char* sql = "DELETE FROM Sensors;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
+            //remove any unbound sensor
+			int32_t index = _findUnboundSensorIndex();
+			if (index >= 0)
 			{
-				s_logger.logCritical(QString("Failed to clear sensors: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
+				if (m_data.sensors[size_t(index)].serialNumber == 0)
+					removeSensor((size_t)index);
+				else
+					m_data.sensors[size_t(index)].state = Sensor::State::Active;
 			}
 		}
-		sqlite3_stmt* stmt = m_saveSensorsStmt.get();
-		for (Sensor const& s : data.sensors)
-		{
-			int index = 1;
-			sqlite3_bind_int64(stmt, index++, s.id);
-			sqlite3_bind_text(stmt, index++, s.descriptor.name.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_int64(stmt, index++, s.address);
-			sqlite3_bind_int64(stmt, index++, s.deviceInfo.sensorType);
-			sqlite3_bind_int64(stmt, index++, s.deviceInfo.hardwareVersion);
-			sqlite3_bind_int64(stmt, index++, s.deviceInfo.softwareVersion);
 
-			sqlite3_bind_double(stmt, index++, s.calibration.temperatureBias);
-			sqlite3_bind_double(stmt, index++, s.calibration.humidityBias);
+        for (Sensor& sensor : m_data.sensors)
+            allocateCommsSlot(sensor);
 
-			sqlite3_bind_int64(stmt, index++, s.serialNumber);
-            sqlite3_bind_int64(stmt, index++, int(s.state));
-			sqlite3_bind_int(stmt, index++, s.shouldSleep ? 1 : 0);
-			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(s.sleepStateTimePoint));
+        //refresh computed comms period
+        if (m_data.sensorTimeConfigs.empty())
+        {
+            _addSensorTimeConfig(SensorTimeConfigDescriptor()).ignore();
+			needsSave = true;
+        }
 
-			sqlite3_bind_int64(stmt, index++, s.stats.commsBlackouts);
-			sqlite3_bind_int64(stmt, index++, s.stats.commsFailures);
-			sqlite3_bind_int64(stmt, index++, s.stats.unknownReboots);
-			sqlite3_bind_int64(stmt, index++, s.stats.powerOnReboots);
-			sqlite3_bind_int64(stmt, index++, s.stats.resetReboots);
-			sqlite3_bind_int64(stmt, index++, s.stats.brownoutReboots);
-			sqlite3_bind_int64(stmt, index++, s.stats.watchdogReboots);
-			sqlite3_bind_int64(stmt, index++, s.stats.commsRetries);
-			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::milliseconds>(s.stats.asleep).count());
-			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::milliseconds>(s.stats.awake).count());
-			sqlite3_bind_int64(stmt, index++, s.stats.commsRounds);
-			sqlite3_bind_int64(stmt, index++, s.stats.measurementRounds);
+        scheduleAllEvents();
 
-			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(s.lastCommsTimePoint));
+        //publish the loaded data right away, so nothing is pending after load
+        markAllChanged();
+        publishSnapshot();
 
-			sqlite3_bind_int64(stmt, index++, s.lastConfirmedMeasurementIndex);
-			sqlite3_bind_int64(stmt, index++, s.lastAlarmProcessesMeasurementIndex);
-			sqlite3_bind_int64(stmt, index++, s.firstStoredMeasurementIndex);
-			sqlite3_bind_int64(stmt, index++, s.storedMeasurementCount);
-			sqlite3_bind_int64(stmt, index++, s.estimatedStoredMeasurementCount);
+        s_logger.logVerbose(QString("Done loading DB. Time: %3s").arg(std::chrono::duration<float>(m_clock->now() - start).count()));
+    }
 
-			sqlite3_bind_int64(stmt, index++, s.lastSignalStrengthB2S);
-			sqlite3_bind_int64(stmt, index++, s.averageSignalStrength.b2s);
-			sqlite3_bind_int64(stmt, index++, s.averageSignalStrength.s2b);
+	{
+		//the ids continue after the largest one in all the files, or the largest one ever given in the main file
+		std::string sql = "SELECT MAX(id) FROM (" + unionSelects(getMeasurementTables(db), [](std::string const& table)
+		{
+			return "SELECT MAX(id) AS id FROM " + table;
+		}) + " UNION ALL SELECT MAX(maxId) FROM MeasurementChunks UNION ALL SELECT seq FROM sqlite_sequence WHERE name = 'Measurements');";
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+			return Error(QString("Cannot load the last measurement id: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
 
-			sqlite3_bind_int(stmt, index++, s.isRTMeasurementValid ? 1 : 0);
-			sqlite3_bind_double(stmt, index++, s.rtMeasurementTemperature);
-			sqlite3_bind_double(stmt, index++, s.rtMeasurementHumidity);
-			sqlite3_bind_double(stmt, index++, s.rtMeasurementVcc);
-			Q_ASSERT(index == 38);
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				s_logger.logCritical(QString("Failed to save sensor: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-			sqlite3_reset(stmt);
-		}
-		data.sensorsAddedOrRemoved = false;
-		data.sensorsChanged = false;
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+		m_lastMeasurementId = sqlite3_step(stmt) == SQLITE_ROW ? MeasurementId(sqlite3_column_int64(stmt, 0)) : 0;
 	}
-	if (data.alarmsChanged || data.alarmsAddedOrRemoved)
+
+	//the measurements are written on a second connection to the same file, from the ingest thread
 	{
-		if (data.alarmsAddedOrRemoved)
+		const char* filename = sqlite3_db_filename(&db, "main");
+		if (!filename || filename[0] == '\0')
+			return Error("Cannot open the ingest connection: the DB has no file");
+
+		sqlite3* ingestSqlite = nullptr;
+		if (sqlite3_open_v2(filename, &ingestSqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
 		{
-			const char* sql = "DELETE FROM Alarms;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
-			{
-				s_logger.logCritical(QString("Failed to clear alarms: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
+			QString msg = QString("Cannot open the ingest connection: %1").arg(sqlite3_errmsg(ingestSqlite));
+			sqlite3_close(ingestSqlite);
+			return Error(msg.toUtf8().data());
 		}
-		sqlite3_stmt* stmt = m_saveAlarmsStmt.get();
-		for (Alarm const& a : data.alarms)
+
+		attachMeasurementPartitions(*ingestSqlite);
+
+		//the duplicates of the ingested measurements are looked for in the chunks too
+		Result<void> result = chunk::registerModule(*ingestSqlite);
+		if (result != success)
 		{
-			int index = 1;
-			sqlite3_bind_int64(stmt, index++, a.id);
-			sqlite3_bind_text(stmt, index++, a.descriptor.name.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_int(stmt, index++, a.descriptor.filterSensors ? 1 : 0);
-			std::string sensors;
-			for (SensorId id : a.descriptor.sensors)
-				sensors += std::to_string(id) + ";";
+			sqlite3_close(ingestSqlite);
+			return result;
+		}
 
-			sqlite3_bind_text(stmt, index++, sensors.c_str(), -1, SQLITE_TRANSIENT);
-			sqlite3_bind_int(stmt, index++, a.descriptor.lowTemperatureWatch ? 1 : 0);
-			sqlite3_bind_double(stmt, index++, a.descriptor.lowTemperatureSoft);
-			sqlite3_bind_double(stmt, index++, a.descriptor.lowTemperatureHard);
-			sqlite3_bind_int(stmt, index++, a.descriptor.highTemperatureWatch ? 1 : 0);
-			sqlite3_bind_double(stmt, index++, a.descriptor.highTemperatureSoft);
-			sqlite3_bind_double(stmt, index++, a.descriptor.highTemperatureHard);
-			sqlite3_bind_int(stmt, index++, a.descriptor.lowHumidityWatch ? 1 : 0);
-			sqlite3_bind_double(stmt, index++, a.descriptor.lowHumiditySoft);
-			sqlite3_bind_double(stmt, index++, a.descriptor.lowHumidityHard);
-			sqlite3_bind_int(stmt, index++, a.descriptor.highHumidityWatch ? 1 : 0);
-			sqlite3_bind_double(stmt, index++, a.descriptor.highHumiditySoft);
-			sqlite3_bind_double(stmt, index++, a.descriptor.highHumidityHard);
-			sqlite3_bind_int(stmt, index++, a.descriptor.lowVccWatch ? 1 : 0);
-			sqlite3_bind_int(stmt, index++, a.descriptor.lowSignalWatch ? 1 : 0);
-			sqlite3_bind_int(stmt, index++, a.descriptor.sensorBlackoutWatch ? 1 : 0);
-			sqlite3_bind_int(stmt, index++, a.descriptor.baseStationDisconnectedWatch ? 1 : 0);
-			sqlite3_bind_int(stmt, index++, a.descriptor.sendEmailAction ? 1 : 0);
-			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::seconds>(a.descriptor.resendPeriod).count());
-			{
-				std::string triggers;
-				for (auto p : a.triggersPerSensor)
-					triggers += std::to_string(p.first) + "/" + std::to_string(p.second) + ";";
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(ingestSqlite, getAddMeasurementSql("Measurements").c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			QString msg = QString("Cannot prepare query: %1").arg(sqlite3_errmsg(ingestSqlite));
+			sqlite3_close(ingestSqlite);
+			return Error(msg.toUtf8().data());
+		}
 
-				sqlite3_bind_text(stmt, index++, triggers.c_str(), -1, SQLITE_TRANSIENT);
-			}
-			{
-				std::string triggers;
-				for (auto p : a.triggersPerBaseStation)
-					triggers += std::to_string(p.first) + "/" + std::to_string(p.second) + ";";
+		m_addMeasurementsStmt.reset(stmt, &sqlite3_finalize);
 
-				sqlite3_bind_text(stmt, index++, triggers.c_str(), -1, SQLITE_TRANSIENT);
-			}
-			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(a.lastTriggeredTimePoint));
-			if (sqlite3_step(stmt) != SQLITE_DONE)
+		for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+		{
+			std::string sql = std::string("INSERT INTO ") + getRollupTable(period) + " VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?3) "
+			                  "ON CONFLICT (sensorId, timePoint) DO UPDATE SET count = count + excluded.count, keptCount = keptCount + excluded.keptCount, "
+			                  "minTemperature = MIN(minTemperature, excluded.minTemperature), maxTemperature = MAX(maxTemperature, excluded.maxTemperature), sumTemperature = sumTemperature + excluded.sumTemperature, "
+			                  "minHumidity = MIN(minHumidity, excluded.minHumidity), maxHumidity = MAX(maxHumidity, excluded.maxHumidity), sumHumidity = sumHumidity + excluded.sumHumidity, "
+			                  "minVcc = MIN(minVcc, excluded.minVcc), maxVcc = MAX(maxVcc, excluded.maxVcc), sumVcc = sumVcc + excluded.sumVcc, "
+			                  "minSignalStrength = MIN(minSignalStrength, excluded.minSignalStrength), maxSignalStrength = MAX(maxSignalStrength, excluded.maxSignalStrength), sumSignalStrength = sumSignalStrength + excluded.sumSignalStrength, "
+			                  "alarmTriggers = alarmTriggers | excluded.alarmTriggers;";
+			if (sqlite3_prepare_v2(ingestSqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
 			{
-				s_logger.logCritical(QString("Failed to save alarms: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
+				QString msg = QString("Cannot prepare query: %1").arg(sqlite3_errmsg(ingestSqlite));
+				m_addMeasurementsStmt = nullptr;
+				m_addHourlyRollupsStmt = nullptr;
+				sqlite3_close(ingestSqlite);
+				return Error(msg.toUtf8().data());
 			}
-			Q_ASSERT(index == 26);
-			sqlite3_reset(stmt);
+			(period == HOURLY_ROLLUP_PERIOD ? m_addHourlyRollupsStmt : m_addDailyRollupsStmt).reset(stmt, &sqlite3_finalize);
 		}
-		data.alarmsAddedOrRemoved = false;
-		data.alarmsChanged = false;
+
+		//the two connections wait for each other's write transactions instead of failing
+		sqlite3_busy_timeout(&db, 10000);
+		sqlite3_busy_timeout(ingestSqlite, 10000);
+
+		m_ingestSqlite = ingestSqlite;
 	}
-	if (data.reportsChanged || data.reportsAddedOrRemoved)
+
+	//the queries get their own read only connections
 	{
-		if (data.reportsAddedOrRemoved)
+		Result<void> result = m_readPool.open(sqlite3_db_filename(&db, "main"), READ_CONNECTION_COUNT, [](sqlite3& sqlite) -> Result<void>
 		{
-			const char* sql = "DELETE FROM Reports;";
-            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
-			{
-				s_logger.logCritical(QString("Failed to clear reports: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-		}
-		sqlite3_stmt* stmt = m_saveReportsStmt.get();
-		for (Report const& r : data.reports)
+			if (sqlite3_create_function(&sqlite, "BIT_OR", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, nullptr, &bitOrStep, &bitOrFinal) != SQLITE_OK)
+				return Error(QString("Cannot create the BIT_OR function: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+			return chunk::registerModule(sqlite);
+		}, [this](sqlite3& sqlite)
 		{
-			sqlite3_bind_int64(stmt, 1, r.id);
-			sqlite3_bind_text(stmt, 2, r.descriptor.name.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_int(stmt, 3, int(r.descriptor.period));
-			sqlite3_bind_int64(stmt, 4, std::chrono::duration_cast<std::chrono::seconds>(r.descriptor.customPeriod).count());
-			sqlite3_bind_int64(stmt, 5, r.descriptor.filterSensors ? 1 : 0);
-			std::string sensors;
-			for (SensorId id : r.descriptor.sensors)
-				sensors += std::to_string(id) + ";";
+			//the partitions added since the connection was last used
+			attachMeasurementPartitions(sqlite);
+		});
+		if (result != success)
+			return result;
+	}
 
-			sqlite3_bind_text(stmt, 6, sensors.c_str(), -1, SQLITE_TRANSIENT);
-			sqlite3_bind_int64(stmt, 7, IClock::to_time_t(r.lastTriggeredTimePoint));
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				s_logger.logCritical(QString("Failed to save report: %1").arg(sqlite3_errmsg(m_sqlite)));
-				return;
-			}
-			sqlite3_reset(stmt);
-		}
-		data.reportsAddedOrRemoved = false;
-		data.reportsChanged = false;
+	m_sqlite = &db;
+
+	m_ingestQueue.reset(new Queue<IngestBatch>(1024));
+	m_ingestThread = std::thread(&DB::ingestThreadProc, this);
+
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		scheduleMeasurementPartitionSeal();
+		m_nextColdCompressionTimePoint = m_clock->now();
+
+		m_retentionPolicies = std::move(retentionPolicies);
+		m_retentionProgress.clear();
+		m_nextRetentionTimePoint = m_clock->now();
 	}
 
-	//    std::cout << QString("Done saving DB. Time: %3s\n").arg(std::chrono::duration<float>(m_clock->now() - start).count()).toUtf8().data();
-	//    std::cout.flush();
+	if (needsSave)
+		save(true);
+
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::scheduleSave()
+{
+	m_saveScheduled = true;
+	requestProcess();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::save(bool newTransaction)
+{
+	//most of the rows are committed before the data mutex is locked, so the comms thread doesn't wait for the whole flush
+	if (newTransaction)
+		flushMeasurements();
+
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	//The alarms are evaluated at ingest, so the alarm state and the processed indices are only saved once the rows they
+	//come from are committed: the rows that were stored have the triggers the saved state was computed with. This only
+	//waits for the batches pushed since the flush above. The rows not committed were never confirmed to the sensors
+	if (newTransaction)
+		flushMeasurements();
+
+	save(m_data, newTransaction);
+	m_saveScheduled = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::deleteRows(const char* table, std::set<uint32_t> const& ids) const
+{
+	sqlite3_stmt*& stmt = m_tableStatementCache[{ table, "delete" }];
+	if (!stmt)
+		stmt = getCachedStatement((std::string("DELETE FROM ") + table + " WHERE id = ?1;").c_str());
+	if (!stmt)
+		return false;
+
+	for (uint32_t id : ids)
+	{
+		sqlite3_bind_int64(stmt, 1, id);
+		int result = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (result != SQLITE_DONE)
+			return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::save(Data& data, bool newTransaction) const
+{
+	IClock::time_point start = m_clock->now();
+
+	std::unique_lock<std::mutex> writeLock(m_writeMutex, std::defer_lock);
+	if (newTransaction)
+	{
+		writeLock.lock();
+        sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	}
+
+	utils::epilogue epi([this, newTransaction]
+	{
+		if (newTransaction)
+            sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr);
+	});
+
+	if (data.generalSettingsChanged)
+	{
+		data.generalSettingsChanged = false;
+		sqlite3_stmt* stmt;
+        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO GeneralSettings (id, dateTimeFormat, showCriticalLogsPopup) VALUES (0, ?1, ?2);", -1, &stmt, nullptr);
+        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, (int)data.generalSettings.dateTimeFormat);
+		sqlite3_bind_int(stmt, 2, data.generalSettings.showCriticalLogsPopup ? 1 : 0);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			s_logger.logCritical(QString("Failed to save general settings: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+	}
+
+	if (data.csvSettingsChanged)
+	{
+		data.csvSettingsChanged = false;
+		sqlite3_stmt* stmt;
+		sqlite3_prepare_v2(m_sqlite, "REPLACE INTO CsvSettings (id, dateTimeFormatOverride, unitsFormat, "
+						   "exportId, exportIndex, exportSensorName, exportSensorSN, exportTimePoint, exportReceivedTimePoint, "
+						   "exportTemperature, exportHumidity, exportBattery, exportSignal, "
+                           "decimalPlaces, separator) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14);", -1, &stmt, nullptr);
+        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, data.csvSettings.dateTimeFormatOverride.has_value() ? (int)data.csvSettings.dateTimeFormatOverride.value() : -1);
+		sqlite3_bind_int64(stmt, 2, (int)data.csvSettings.unitsFormat);
+		sqlite3_bind_int(stmt, 3, data.csvSettings.exportId ? 1 : 0);
+		sqlite3_bind_int(stmt, 4, data.csvSettings.exportIndex ? 1 : 0);
+		sqlite3_bind_int(stmt, 5, data.csvSettings.exportSensorName ? 1 : 0);
+		sqlite3_bind_int(stmt, 6, data.csvSettings.exportSensorSN ? 1 : 0);
+		sqlite3_bind_int(stmt, 7, data.csvSettings.exportTimePoint ? 1 : 0);
+		sqlite3_bind_int(stmt, 8, data.csvSettings.exportReceivedTimePoint ? 1 : 0);
+		sqlite3_bind_int(stmt, 9, data.csvSettings.exportTemperature ? 1 : 0);
+		sqlite3_bind_int(stmt, 10, data.csvSettings.exportHumidity ? 1 : 0);
+		sqlite3_bind_int(stmt, 11, data.csvSettings.exportBattery ? 1 : 0);
+		sqlite3_bind_int(stmt, 12, data.csvSettings.exportSignal ? 1 : 0);
+		sqlite3_bind_int64(stmt, 13, data.csvSettings.decimalPlaces);
+		sqlite3_bind_text(stmt, 14, data.csvSettings.separator.c_str(), -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			s_logger.logCritical(QString("Failed to save csv settings: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+	}
+
+	if (data.emailSettingsChanged)
+	{
+		data.emailSettingsChanged = false;
+		sqlite3_stmt* stmt;
+        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO EmailSettings (id, host, port, connection, username, password, sender, recipients) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr);
+        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+
+		sqlite3_bind_text(stmt, 1, data.emailSettings.host.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, data.emailSettings.port);
+		sqlite3_bind_int(stmt, 3, (int)data.emailSettings.connection);
+		sqlite3_bind_text(stmt, 4, data.emailSettings.username.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 5, data.emailSettings.password.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 6, data.emailSettings.sender.c_str(), -1, SQLITE_STATIC);
+		std::string recipients = std::accumulate(data.emailSettings.recipients.begin(), data.emailSettings.recipients.end(), std::string(";"));
+		sqlite3_bind_text(stmt, 7, recipients.c_str(), -1, SQLITE_TRANSIENT);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			s_logger.logCritical(QString("Failed to save email settings: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+	}
+
+	if (data.ftpSettingsChanged)
+	{
+		data.ftpSettingsChanged = false;
+		sqlite3_stmt* stmt;
+        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO FtpSettings (id, host, port, username, password, folder, uploadBackups, uploadPeriod) VALUES (0, ?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, nullptr);
+        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+
+		sqlite3_bind_text(stmt, 1, data.ftpSettings.host.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, data.ftpSettings.port);
+		sqlite3_bind_text(stmt, 3, data.ftpSettings.username.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, data.ftpSettings.password.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 5, data.ftpSettings.folder.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int(stmt, 6, data.ftpSettings.uploadBackups ? 1 : 0);
+		sqlite3_bind_int64(stmt, 7, std::chrono::duration_cast<std::chrono::seconds>(data.ftpSettings.uploadBackupsPeriod).count());
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			s_logger.logCritical(QString("Failed to save ftp settings: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+	}
+
+	if (data.usersChanged || data.usersAddedOrRemoved)
+	{
+		if (data.usersAddedOrRemoved)
+		{
+			const char* sql = "DELETE FROM Users;";
+            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
+			{
+				s_logger.logCritical(QString("Failed to clear users: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+		}
+		sqlite3_stmt* stmt;
+        sqlite3_prepare_v2(m_sqlite, "REPLACE INTO Users (id, name, passwordHash, permissions, type, lastLogin) VALUES(?1, ?2, ?3, ?4, ?5, ?6);", -1, &stmt, nullptr);
+        utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+
+		for (User const& user : data.users)
+		{
+			sqlite3_bind_int64(stmt, 1, user.id);
+			sqlite3_bind_text(stmt, 2, user.descriptor.name.c_str(), -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 3, user.descriptor.passwordHash.c_str(), -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 4, user.descriptor.permissions);
+			sqlite3_bind_int(stmt, 5, (int)user.descriptor.type);
+			sqlite3_bind_int64(stmt, 6, IClock::to_time_t(user.lastLogin));
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save user: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			sqlite3_reset(stmt);
+		}
+		data.usersAddedOrRemoved = false;
+		data.usersChanged = false;
+	}
+	if (!data.removedBaseStations.empty())
+	{
+		if (!deleteRows("BaseStations", data.removedBaseStations))
+		{
+			s_logger.logCritical(QString("Failed to remove base stations: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		data.removedBaseStations.clear();
+	}
+	if (!data.changedBaseStations.empty())
+	{
+		sqlite3_stmt* stmt = m_saveBaseStationsStmt.get();
+		for (BaseStation const& bs : data.baseStations)
+		{
+			if (data.changedBaseStations.find(bs.id) == data.changedBaseStations.end())
+				continue;
+
+			sqlite3_bind_int64(stmt, 1, bs.id);
+			sqlite3_bind_text(stmt, 2, bs.descriptor.name.c_str(), -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 3, utils::getMacStr(bs.descriptor.mac).c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int64(stmt, 4, IClock::to_time_t(bs.lastCommsTimePoint));
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save base station: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			sqlite3_reset(stmt);
+		}
+		data.changedBaseStations.clear();
+	}
+	if (data.sensorTimeConfigsChanged)
+	{
+		{
+			const char* sql = "DELETE FROM SensorTimeConfigs;";
+            if (sqlite3_exec(m_sqlite, sql, nullptr, nullptr, nullptr))
+			{
+				s_logger.logCritical(QString("Failed to clear sensor configs: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+		}
+		sqlite3_stmt* stmt = m_saveSensorTimeConfigsStmt.get();
+		for (SensorTimeConfig const& sc : data.sensorTimeConfigs)
+		{
+			sqlite3_bind_int64(stmt, 1, IClock::to_time_t(sc.baselineMeasurementTimePoint));
+			sqlite3_bind_int64(stmt, 2, sc.baselineMeasurementIndex);
+			sqlite3_bind_int64(stmt, 3, std::chrono::duration_cast<std::chrono::seconds>(sc.descriptor.measurementPeriod).count());
+			sqlite3_bind_int64(stmt, 4, std::chrono::duration_cast<std::chrono::seconds>(sc.descriptor.commsPeriod).count());
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save sensor config: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			sqlite3_reset(stmt);
+		}
+		data.sensorTimeConfigsChanged = false;
+	}
+	if (data.sensorSettingsChanged)
+	{
+		data.sensorSettingsChanged = false;
+		sqlite3_stmt* stmt = m_saveSensorSettingsStmt.get();
+
+		sqlite3_bind_int64(stmt, 1, data.sensorSettings.radioPower);
+		sqlite3_bind_int64(stmt, 2, data.sensorSettings.retries);
+		sqlite3_bind_double(stmt, 3, data.sensorSettings.alertBatteryLevel);
+		sqlite3_bind_double(stmt, 4, data.sensorSettings.alertSignalStrengthLevel);
+
+//		const char* xx = sqlite3_expanded_sql(stmt);
+
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			s_logger.logCritical(QString("Failed to save sensor settings: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		sqlite3_reset(stmt);
+	}
+	if (!data.removedSensors.empty())
+	{
+		if (!deleteRows("Sensors", data.removedSensors))
+		{
+			s_logger.logCritical(QString("Failed to remove sensors: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		data.removedSensors.clear();
+	}
+	if (!data.changedSensors.empty())
+	{
+		sqlite3_stmt* stmt = m_saveSensorsStmt.get();
+		for (Sensor const& s : data.sensors)
+		{
+			if (data.changedSensors.find(s.id) == data.changedSensors.end())
+				continue;
+
+			int index = 1;
+			sqlite3_bind_int64(stmt, index++, s.id);
+			sqlite3_bind_text(stmt, index++, s.descriptor.name.c_str(), -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, index++, s.address);
+			sqlite3_bind_int64(stmt, index++, s.deviceInfo.sensorType);
+			sqlite3_bind_int64(stmt, index++, s.deviceInfo.hardwareVersion);
+			sqlite3_bind_int64(stmt, index++, s.deviceInfo.softwareVersion);
+
+			sqlite3_bind_double(stmt, index++, s.calibration.temperatureBias);
+			sqlite3_bind_double(stmt, index++, s.calibration.humidityBias);
+
+			sqlite3_bind_int64(stmt, index++, s.serialNumber);
+            sqlite3_bind_int64(stmt, index++, int(s.state));
+			sqlite3_bind_int(stmt, index++, s.shouldSleep ? 1 : 0);
+			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(s.sleepStateTimePoint));
+
+			sqlite3_bind_int64(stmt, index++, s.stats.commsBlackouts);
+			sqlite3_bind_int64(stmt, index++, s.stats.commsFailures);
+			sqlite3_bind_int64(stmt, index++, s.stats.unknownReboots);
+			sqlite3_bind_int64(stmt, index++, s.stats.powerOnReboots);
+			sqlite3_bind_int64(stmt, index++, s.stats.resetReboots);
+			sqlite3_bind_int64(stmt, index++, s.stats.brownoutReboots);
+			sqlite3_bind_int64(stmt, index++, s.stats.watchdogReboots);
+			sqlite3_bind_int64(stmt, index++, s.stats.commsRetries);
+			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::milliseconds>(s.stats.asleep).count());
+			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::milliseconds>(s.stats.awake).count());
+			sqlite3_bind_int64(stmt, index++, s.stats.commsRounds);
+			sqlite3_bind_int64(stmt, index++, s.stats.measurementRounds);
+
+			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(s.lastCommsTimePoint));
+
+			sqlite3_bind_int64(stmt, index++, s.lastConfirmedMeasurementIndex);
+			sqlite3_bind_int64(stmt, index++, s.lastAlarmProcessesMeasurementIndex);
+			sqlite3_bind_int64(stmt, index++, s.firstStoredMeasurementIndex);
+			sqlite3_bind_int64(stmt, index++, s.storedMeasurementCount);
+			sqlite3_bind_int64(stmt, index++, s.estimatedStoredMeasurementCount);
+
+			sqlite3_bind_int64(stmt, index++, s.lastSignalStrengthB2S);
+			sqlite3_bind_int64(stmt, index++, s.averageSignalStrength.b2s);
+			sqlite3_bind_int64(stmt, index++, s.averageSignalStrength.s2b);
+
+			sqlite3_bind_int(stmt, index++, s.isRTMeasurementValid ? 1 : 0);
+			sqlite3_bind_double(stmt, index++, s.rtMeasurementTemperature);
+			sqlite3_bind_double(stmt, index++, s.rtMeasurementHumidity);
+			sqlite3_bind_double(stmt, index++, s.rtMeasurementVcc);
+			Q_ASSERT(index == 38);
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save sensor: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			sqlite3_reset(stmt);
+		}
+		data.changedSensors.clear();
+	}
+	if (!data.removedAlarms.empty())
+	{
+		if (!deleteRows("Alarms", data.removedAlarms))
+		{
+			s_logger.logCritical(QString("Failed to remove alarms: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		data.removedAlarms.clear();
+	}
+	if (!data.changedAlarms.empty())
+	{
+		sqlite3_stmt* stmt = m_saveAlarmsStmt.get();
+		for (Alarm const& a : data.alarms)
+		{
+			if (data.changedAlarms.find(a.id) == data.changedAlarms.end())
+				continue;
+
+			int index = 1;
+			sqlite3_bind_int64(stmt, index++, a.id);
+			sqlite3_bind_text(stmt, index++, a.descriptor.name.c_str(), -1, SQLITE_STATIC);
+			sqlite3_bind_int(stmt, index++, a.descriptor.filterSensors ? 1 : 0);
+			std::string sensors;
+			for (SensorId id : a.descriptor.sensors)
+				sensors += std::to_string(id) + ";";
+
+			sqlite3_bind_text(stmt, index++, sensors.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int(stmt, index++, a.descriptor.lowTemperatureWatch ? 1 : 0);
+			sqlite3_bind_double(stmt, index++, a.descriptor.lowTemperatureSoft);
+			sqlite3_bind_double(stmt, index++, a.descriptor.lowTemperatureHard);
+			sqlite3_bind_int(stmt, index++, a.descriptor.highTemperatureWatch ? 1 : 0);
+			sqlite3_bind_double(stmt, index++, a.descriptor.highTemperatureSoft);
+			sqlite3_bind_double(stmt, index++, a.descriptor.highTemperatureHard);
+			sqlite3_bind_int(stmt, index++, a.descriptor.lowHumidityWatch ? 1 : 0);
+			sqlite3_bind_double(stmt, index++, a.descriptor.lowHumiditySoft);
+			sqlite3_bind_double(stmt, index++, a.descriptor.lowHumidityHard);
+			sqlite3_bind_int(stmt, index++, a.descriptor.highHumidityWatch ? 1 : 0);
+			sqlite3_bind_double(stmt, index++, a.descriptor.highHumiditySoft);
+			sqlite3_bind_double(stmt, index++, a.descriptor.highHumidityHard);
+			sqlite3_bind_int(stmt, index++, a.descriptor.lowVccWatch ? 1 : 0);
+			sqlite3_bind_int(stmt, index++, a.descriptor.lowSignalWatch ? 1 : 0);
+			sqlite3_bind_int(stmt, index++, a.descriptor.sensorBlackoutWatch ? 1 : 0);
+			sqlite3_bind_int(stmt, index++, a.descriptor.baseStationDisconnectedWatch ? 1 : 0);
+			sqlite3_bind_int(stmt, index++, a.descriptor.sendEmailAction ? 1 : 0);
+			sqlite3_bind_int64(stmt, index++, std::chrono::duration_cast<std::chrono::seconds>(a.descriptor.resendPeriod).count());
+			{
+				std::string triggers;
+				for (auto p : a.triggersPerSensor)
+					triggers += std::to_string(p.first) + "/" + std::to_string(p.second) + ";";
+
+				sqlite3_bind_text(stmt, index++, triggers.c_str(), -1, SQLITE_TRANSIENT);
+			}
+			{
+				std::string triggers;
+				for (auto p : a.triggersPerBaseStation)
+					triggers += std::to_string(p.first) + "/" + std::to_string(p.second) + ";";
+
+				sqlite3_bind_text(stmt, index++, triggers.c_str(), -1, SQLITE_TRANSIENT);
+			}
+			sqlite3_bind_int64(stmt, index++, IClock::to_time_t(a.lastTriggeredTimePoint));
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save alarms: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			Q_ASSERT(index == 26);
+			sqlite3_reset(stmt);
+		}
+		data.changedAlarms.clear();
+	}
+	if (!data.removedReports.empty())
+	{
+		if (!deleteRows("Reports", data.removedReports))
+		{
+			s_logger.logCritical(QString("Failed to remove reports: %1").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		data.removedReports.clear();
+	}
+	if (!data.changedReports.empty())
+	{
+		sqlite3_stmt* stmt = m_saveReportsStmt.get();
+		for (Report const& r : data.reports)
+		{
+			if (data.changedReports.find(r.id) == data.changedReports.end())
+				continue;
+
+			sqlite3_bind_int64(stmt, 1, r.id);
+			sqlite3_bind_text(stmt, 2, r.descriptor.name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 3, int(r.descriptor.period));
+			sqlite3_bind_int64(stmt, 4, std::chrono::duration_cast<std::chrono::seconds>(r.descriptor.customPeriod).count());
+			sqlite3_bind_int64(stmt, 5, r.descriptor.filterSensors ? 1 : 0);
+			std::string sensors;
+			for (SensorId id : r.descriptor.sensors)
+				sensors += std::to_string(id) + ";";
+
+			sqlite3_bind_text(stmt, 6, sensors.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int64(stmt, 7, IClock::to_time_t(r.lastTriggeredTimePoint));
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to save report: %1").arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			sqlite3_reset(stmt);
+		}
+		data.changedReports.clear();
+	}
+
+	//    std::cout << QString("Done saving DB. Time: %3s\n").arg(std::chrono::duration<float>(m_clock->now() - start).count()).toUtf8().data();
+	//    std::cout.flush();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::close()
+{
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		if (!m_sqlite)
+			return;
+
+		flushMeasurements();
+		addAsyncMeasurements();
+		if (m_saveScheduled)
+			save(true);
+
+		m_ingestQueue->exit();
+		if (m_ingestThread.joinable())
+			m_ingestThread.join();
+	}
+
+	//the queries in flight can be waiting for the data mutex while holding a snapshot, so the pool is closed without it.
+	//New acquires fail from here on
+	m_readPool.close();
+
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		if (!m_sqlite)
+			return;
+
+		m_saveBaseStationsStmt = nullptr;
+		m_saveSensorTimeConfigsStmt = nullptr;
+		m_saveSensorSettingsStmt = nullptr;
+		m_saveSensorsStmt = nullptr;
+		m_saveAlarmsStmt = nullptr;
+		m_saveReportsStmt = nullptr;
+		m_addMeasurementsStmt = nullptr;
+		m_addHourlyRollupsStmt = nullptr;
+		m_addDailyRollupsStmt = nullptr;
+		m_addPartitionMeasurementsStmts.clear();
+		m_markPartitionCommitStmts.clear();
+		m_markMainPartitionCommitStmt = nullptr;
+		m_findIngestDuplicatesStmt = nullptr;
+		m_findIngestDuplicatesSql.clear();
+		m_ingestStoredIndices.clear();
+		m_tableStatementCache.clear();
+		m_statementCache.clear();
+		sqlite3_close(m_ingestSqlite);
+		m_ingestSqlite = nullptr;
+		{
+			std::lock_guard<std::mutex> lg2(m_ingestPushMutex);
+			m_ingestQueue.reset();
+			m_ingestConfirmations.clear();
+		}
+		{
+			std::lock_guard<std::mutex> lg2(m_ingestCommitMutex);
+			m_ingestFailures.clear();
+		}
+		m_ingestEpochs.clear();
+		m_sqlite = nullptr;
+
+		{
+			std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+			m_recentMeasurements.clear();
+		}
+		{
+			std::lock_guard<std::mutex> lg2(m_measurementCountsMutex);
+			m_measurementCounts.clear();
+		}
+
+		{
+			std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+			m_partitions.clear();
+			m_partitionsByBegin.clear();
+			m_chunksRange = std::nullopt;
+		}
+		m_nextPartitionSealTimePoint = std::nullopt;
+		m_nextColdCompressionTimePoint = std::nullopt;
+		m_retentionPolicies.clear();
+		m_retentionProgress.clear();
+		m_nextRetentionTimePoint = std::nullopt;
+		m_rollupsBackfillTimePoint = std::numeric_limits<int64_t>::min();
+		m_nextRollupsBackfillSliceTimePoint = IClock::time_point(IClock::duration::zero());
+		m_lastMeasurementId = 0;
+
+		m_data = Data();
+		rebuildIndexes();
+		markAllChanged();
+		m_events = decltype(m_events)();
+		m_eventTimePoints.clear();
+		m_measurementTriggersScheduled = false;
+	}
+	m_emailer.reset(new Emailer(*this));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+sqlite3_stmt* DB::getCachedStatement(const char* sql) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	auto it = m_statementCache.find(sql);
+	if (it != m_statementCache.end())
+		return it->second.get();
+
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v3(m_sqlite, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+	{
+		s_logger.logCritical(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(m_sqlite)));
+		return nullptr;
+	}
+
+	m_statementCache[sql].reset(stmt, &sqlite3_finalize);
+	return stmt;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+sqlite3* DB::getSqliteDB()
+{
+	return m_sqlite;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+const Emailer& DB::getEmailer() const
+{
+	return *m_emailer;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Emailer& DB::getEmailer()
+{
+	return *m_emailer;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<IClock::time_point> DB::checkRepetitiveAlarm(Alarm& alarm)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (alarm.triggersPerSensor.empty() && alarm.triggersPerBaseStation.empty())
+		return std::nullopt; //rescheduled when it triggers again
+
+	if (m_clock->now() - alarm.lastTriggeredTimePoint >= alarm.descriptor.resendPeriod)
+	{
+		emit alarmStillTriggered(alarm.id);
+		alarm.lastTriggeredTimePoint = m_clock->now();
+		m_data.changedAlarms.insert(alarm.id);
+		markAlarmChanged(alarm.id);
+		scheduleSave();
+	}
+	return alarm.lastTriggeredTimePoint + alarm.descriptor.resendPeriod;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<IClock::time_point> DB::checkReport(Report& report)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (isReportTriggered(report))
+	{
+		emit reportTriggered(report.id, report.lastTriggeredTimePoint, m_clock->now());
+		report.lastTriggeredTimePoint = m_clock->now();
+		m_data.changedReports.insert(report.id);
+		scheduleSave();
+	}
+	return computeNextReportCheckTimePoint(report);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<IClock::time_point> DB::checkForDisconnectedBaseStation(BaseStation& bs)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (bs.isConnected)
+		return std::nullopt; //rescheduled when it disconnects
+
+	IClock::time_point tp = bs.lastConnectedTimePoint + std::chrono::minutes(1) + IClock::duration(1);
+	if (m_clock->now() < tp)
+		return tp;
+
+	computeBaseStationAlarmTriggers(bs);
+	return std::nullopt;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<IClock::time_point> DB::checkForBlackoutSensor(Sensor& s)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	SensorTimeConfig timeConfig = getLastSensorTimeConfig();
+	IClock::duration actualCommsPeriod = computeActualCommsPeriod(timeConfig.descriptor);
+	IClock::time_point now = m_clock->now();
+
+	//both thresholds are exclusive, hence the extra tick
+	//A sensor that moved its comms slot can be told to come back later than a period, so give it half a period after that as well
+	IClock::time_point blackoutTP = std::max(s.lastCommsTimePoint + std::chrono::duration_cast<IClock::duration>(actualCommsPeriod * 1.5f),
+											 s.nextCommsTimePoint + actualCommsPeriod / 2) + IClock::duration(1);
+	IClock::time_point alarmsTP = s.addedTimePoint + actualCommsPeriod * 2 + IClock::duration(1);
+
+	bool wasBlackout = s.blackout;
+	if (s.state == Sensor::State::Active && now >= blackoutTP)
+		s.blackout = true;
+	else
+		s.blackout = false;
+	if (s.blackout != wasBlackout)
+		markSensorChanged(s.id);
+
+	//only send emails 2 rounds after being added to avoid slamming every time the program is started
+	if (now >= alarmsTP)
+	{
+		if (!wasBlackout && s.blackout)
+		{
+			s.stats.commsBlackouts++;
+			m_data.changedSensors.insert(s.id);
+			markSensorChanged(s.id);
+			scheduleSave();
+		}
+		computeSensorAlarmTriggers(s, std::nullopt);
+	}
+
+	//a blackout sensor (or an inactive one) is rescheduled when it comms again or changes state
+	std::optional<IClock::time_point> next;
+	if (s.state == Sensor::State::Active && !s.blackout)
+		next = blackoutTP;
+	if (now < alarmsTP)
+		next = next.has_value() ? std::min(*next, alarmsTP) : alarmsTP;
+	return next;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::scheduleEvent(EventType type, uint32_t id, IClock::time_point tp)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	auto key = std::make_pair(type, id);
+	auto it = m_eventTimePoints.find(key);
+	if (it != m_eventTimePoints.end())
+	{
+		if (it->second <= tp)
+			return; //the earlier event will reschedule itself if needed
+		it->second = tp;
+	}
+	else
+		m_eventTimePoints.emplace(key, tp);
+
+	m_events.push({ tp, type, id });
+	requestProcess();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::requestProcess()
+{
+	if (m_processingThread.load() == std::this_thread::get_id())
+		return;
+	if (!m_processRequested.exchange(true))
+		emit processRequested();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::scheduleSensorEvents()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::time_point now = m_clock->now();
+	for (Sensor const& sensor : m_data.sensors)
+		scheduleEvent(EventType::Sensor, sensor.id, now);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::scheduleBaseStationEvents()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::time_point now = m_clock->now();
+	for (BaseStation const& bs : m_data.baseStations)
+		scheduleEvent(EventType::BaseStation, bs.id, now);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::scheduleAllEvents()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	m_events = decltype(m_events)();
+	m_eventTimePoints.clear();
+
+	IClock::time_point now = m_clock->now();
+	scheduleSensorEvents();
+	scheduleBaseStationEvents();
+	for (Alarm const& alarm : m_data.alarms)
+		scheduleEvent(EventType::Alarm, alarm.id, now);
+	for (Report const& report : m_data.reports)
+		scheduleEvent(EventType::Report, report.id, now);
+
+	m_measurementTriggersScheduled = true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::processEvents()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::time_point now = m_clock->now();
+	while (!m_events.empty() && m_events.top().timePoint <= now)
+	{
+		Event event = m_events.top();
+		m_events.pop();
+
+		auto it = m_eventTimePoints.find(std::make_pair(event.type, event.id));
+		if (it == m_eventTimePoints.end() || it->second != event.timePoint)
+			continue; //stale entry, the event was rescheduled
+		m_eventTimePoints.erase(it);
+
+		std::optional<IClock::time_point> next;
+		switch (event.type)
+		{
+		case EventType::Sensor:
+		{
+			int32_t index = _findSensorIndexById(event.id);
+			if (index >= 0)
+				next = checkForBlackoutSensor(m_data.sensors[size_t(index)]);
+			break;
+		}
+		case EventType::BaseStation:
+		{
+			int32_t index = _findBaseStationIndexById(event.id);
+			if (index >= 0)
+				next = checkForDisconnectedBaseStation(m_data.baseStations[size_t(index)]);
+			break;
+		}
+		case EventType::Alarm:
+		{
+			int32_t index = _findAlarmIndexById(event.id);
+			if (index >= 0)
+				next = checkRepetitiveAlarm(m_data.alarms[size_t(index)]);
+			break;
+		}
+		case EventType::Report:
+		{
+			int32_t index = findReportIndexById(event.id);
+			if (index >= 0)
+				next = checkReport(m_data.reports[size_t(index)]);
+			break;
+		}
+		}
+
+		//never reschedule in the past, it would spin here
+		if (next.has_value())
+			scheduleEvent(event.type, event.id, std::max(*next, now + IClock::duration(1)));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+IClock::duration DB::computeTimeUntilNextEvent() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	//the work left by the last process. The measurements committed since ask for a process
+	if (m_saveScheduled || m_measurementTriggersScheduled)
+		return IClock::duration::zero();
+
+	std::optional<IClock::time_point> next = m_nextPartitionSealTimePoint;
+	if (m_coldStorageSettings.enabled && m_nextColdCompressionTimePoint.has_value())
+		next = std::min(next.value_or(IClock::time_point::max()), *m_nextColdCompressionTimePoint);
+	if (!m_retentionPolicies.empty() && m_nextRetentionTimePoint.has_value())
+		next = std::min(next.value_or(IClock::time_point::max()), *m_nextRetentionTimePoint);
+	if (m_rollupsBackfillTimePoint != std::numeric_limits<int64_t>::min())
+		next = std::min(next.value_or(IClock::time_point::max()), m_nextRollupsBackfillSliceTimePoint);
+	if (!m_events.empty())
+		next = std::min(next.value_or(IClock::time_point::max()), m_events.top().timePoint);
+	if (!next.has_value())
+		return IClock::duration::max();
+
+	return std::max(*next - m_clock->now(), IClock::duration::zero());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//The alarm triggers of a sensor's measurements while they are evaluated. The changes of the last evaluated
+//measurements are kept until they are published, in measurement order
+struct DB::SensorAlarmTriggers
+{
+	struct Change
+	{
+		size_t position; //of the measurement
+		size_t alarm; //in sensorAlarms
+		uint32_t oldTriggers;
+		uint32_t currentTriggers;
+	};
+
+	size_t sensorSlot = 0;
+	std::vector<alarms::SensorAlarm> sensorAlarms; //with the blackout of the sensor
+	std::vector<uint32_t> alarmTriggers; //after the last evaluated measurement
+	std::vector<Change> changes;
+	size_t nextChange = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::checkMeasurementTriggers()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (!m_measurementTriggersScheduled)
+		return;
+	m_measurementTriggersScheduled = false;
+
+	//the rows stored before they were confirmed keep the triggers computed at ingest, they only need writing
+	std::vector<Measurement> retriggered;
+	{
+		std::lock_guard<std::recursive_mutex> lg2(m_asyncMeasurementsMutex);
+		retriggered.swap(m_asyncRetriggeredMeasurements);
+	}
+
+	if (m_data.sensors.empty() || m_data.alarms.empty())
+		return;
+
+	//the triggers are computed from the committed measurements
+	flushMeasurements();
+	confirmCommittedMeasurements();
+
+	std::vector<Measurement> measurements;
+	if (!retriggered.empty())
+	{
+		std::string sql = unionSelects(getMeasurementSources(*m_sqlite), [](std::string const& table)
+		{
+			return "SELECT * FROM " + table + " WHERE sensorId = ?1 AND idx = ?2";
+		}) + ";";
+		sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+		if (!stmt)
+			Q_ASSERT(false);
+		for (size_t i = 0; stmt && i < retriggered.size(); i++)
+		{
+			sqlite3_bind_int64(stmt, 1, retriggered[i].descriptor.sensorId);
+			sqlite3_bind_int64(stmt, 2, retriggered[i].descriptor.index);
+			if (sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				Measurement m = unpackMeasurement(stmt);
+				m.alarmTriggers = retriggered[i].alarmTriggers;
+				measurements.emplace_back(m);
+			}
+			sqlite3_reset(stmt);
+		}
+	}
+
+	//The measurements of each sensor are read and evaluated a block at a time, and the sensors are merged by the time
+	//of their next measurement. So the triggers are published in the order they happened, not grouped by sensor,
+	//and a long backlog only keeps a block per sensor and a batch of measurements to write
+	struct Pending
+	{
+		uint32_t lastReadIndex = 0;
+		uint32_t lastIndex = 0;
+		SensorAlarmTriggers triggers;
+		std::vector<Measurement> measurements; //the block
+		size_t next = 0;
+	};
+	std::vector<Pending> pendings;
+	for (Sensor const& sensor : m_data.sensors)
+	{
+		if (sensor.lastConfirmedMeasurementIndex <= sensor.lastAlarmProcessesMeasurementIndex)
+		{
+			//nothing new happened
+			continue;
+		}
+		Pending pending;
+		if (!beginSensorAlarmTriggers(sensor, pending.triggers))
+			continue;
+		pending.lastReadIndex = sensor.lastAlarmProcessesMeasurementIndex;
+		pending.lastIndex = sensor.lastConfirmedMeasurementIndex;
+		pendings.push_back(std::move(pending));
+		m_data.changedSensors.insert(sensor.id);
+		markSensorChanged(sensor.id);
+	}
+
+	std::string selectSql = unionSelects(getMeasurementSources(*m_sqlite), [](std::string const& table)
+	{
+		return "SELECT * FROM " + table + " WHERE idx > ?1 AND idx <= ?2 AND sensorId = ?3";
+	}) + " ORDER BY idx LIMIT " + std::to_string(ALARM_TRIGGERS_BLOCK_SIZE) + ";";
+	auto readBlock = [this, &selectSql](Pending& pending)
+	{
+		pending.measurements.clear();
+		pending.next = 0;
+		if (pending.lastReadIndex >= pending.lastIndex)
+			return;
+
+		sqlite3_stmt* stmt = getCachedStatement(selectSql.c_str());
+		if (!stmt)
+		{
+			Q_ASSERT(false);
+			pending.lastReadIndex = pending.lastIndex;
+			return;
+		}
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, pending.lastReadIndex);
+		sqlite3_bind_int64(stmt, 2, pending.lastIndex);
+		sqlite3_bind_int64(stmt, 3, m_data.sensors[pending.triggers.sensorSlot].id);
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+			pending.measurements.push_back(unpackMeasurement(stmt));
+		pending.lastReadIndex = pending.measurements.size() < ALARM_TRIGGERS_BLOCK_SIZE ? pending.lastIndex : pending.measurements.back().descriptor.index;
+		evaluateSensorAlarmTriggers(pending.triggers, pending.measurements);
+	};
+
+	struct Next
+	{
+		IClock::time_point timePoint;
+		size_t pending;
+		bool operator>(Next const& other) const { return timePoint != other.timePoint ? timePoint > other.timePoint : pending > other.pending; }
+	};
+	std::priority_queue<Next, std::vector<Next>, std::greater<Next>> queue;
+	for (size_t i = 0; i < pendings.size(); i++)
+	{
+		readBlock(pendings[i]);
+		if (!pendings[i].measurements.empty())
+			queue.push({ pendings[i].measurements.front().timePoint, i });
+	}
+
+	bool written = false;
+	while (!queue.empty())
+	{
+		size_t i = queue.top().pending;
+		queue.pop();
+
+		Pending& pending = pendings[i];
+		Measurement const& m = pending.measurements[pending.next];
+		publishSensorAlarmTriggers(pending.triggers, pending.measurements, pending.next);
+		//saved with the triggers written so far
+		m_data.sensors[pending.triggers.sensorSlot].lastAlarmProcessesMeasurementIndex = m.descriptor.index;
+		measurements.push_back(m);
+
+		if (++pending.next == pending.measurements.size())
+			readBlock(pending);
+		if (pending.next < pending.measurements.size())
+			queue.push({ pending.measurements[pending.next].timePoint, i });
+
+		if (measurements.size() >= ALARM_TRIGGERS_WRITE_BATCH)
+		{
+			writeMeasurementTriggers(measurements);
+			measurements.clear();
+			written = true;
+		}
+	}
+
+	//also past the missing measurements at the end
+	for (Pending const& pending : pendings)
+		m_data.sensors[pending.triggers.sensorSlot].lastAlarmProcessesMeasurementIndex = pending.lastIndex;
+
+	if (!measurements.empty() || !pendings.empty())
+	{
+		writeMeasurementTriggers(measurements);
+		written |= !measurements.empty();
+	}
+
+	if (written)
+		emit measurementsChanged();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::writeMeasurementTriggers(std::vector<Measurement>& measurements)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	//in the order they are stored, the merged ones jump between the sensors
+	std::sort(measurements.begin(), measurements.end(), [](Measurement const& a, Measurement const& b) { return a.id < b.id; });
+
+	std::lock_guard<std::mutex> wl(m_writeMutex);
+    sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    utils::epilogue epi([this] { sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr); });
+
+	updateMeasurementTriggers(measurements);
+
+	//the rollups of their hours are recomputed, a rewrite can also take triggers away
+	std::vector<RollupTriggers> buckets;
+	std::set<std::pair<SensorId, int64_t>> hours;
+	for (Measurement const& m : measurements)
+	{
+		int64_t tp = IClock::to_time_t(m.timePoint);
+		if (hours.insert({ m.descriptor.sensorId, tp - tp % HOURLY_ROLLUP_PERIOD }).second)
+		{
+			RollupTriggers bucket;
+			bucket.sensorId = m.descriptor.sensorId;
+			bucket.timePoint = tp - tp % HOURLY_ROLLUP_PERIOD;
+			buckets.push_back(bucket);
+		}
+	}
+	Result<void> result = updateRollupTriggers(buckets);
+	if (result != success)
+		s_logger.logCritical(QString("Failed to update the measurement rollups: %1").arg(result.error().what().c_str()));
+
+	save(false);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::updateMeasurementTriggers(std::vector<Measurement> const& measurements)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	std::vector<Measurement> chunked;
+	for (Measurement const& m : measurements)
+	{
+		//in its partition, or in the main table if it came late
+		bool updated = false;
+		for (std::string const& table: getMeasurementTablesFor(m.timePoint))
+		{
+			sqlite3_stmt* stmt = getCachedStatement(("UPDATE " + table + " "
+													 "SET alarmTriggersCurrent = ?1, alarmTriggersAdded = ?2, alarmTriggersRemoved = ?3 "
+													 "WHERE id = ?4;").c_str());
+			if (!stmt)
+			{
+				Q_ASSERT(false);
+				break;
+			}
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+			sqlite3_bind_double(stmt, 1, m.alarmTriggers.current);
+			sqlite3_bind_double(stmt, 2, m.alarmTriggers.added);
+			sqlite3_bind_double(stmt, 3, m.alarmTriggers.removed);
+			sqlite3_bind_int64(stmt, 4, int64_t(m.id));
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				const char* msg = sqlite3_errmsg(m_sqlite);
+				Q_ASSERT(false);
+				break;
+			}
+			if (sqlite3_changes(m_sqlite) > 0)
+			{
+				markMeasurementPartitionChanged(table);
+				updated = true;
+				break;
+			}
+		}
+		if (updated)
+			updateRecentMeasurement(m);
+		else
+			chunked.push_back(m);
+	}
+
+	//or in a chunk, if it was compressed before its triggers were computed
+	if (!chunked.empty())
+	{
+		Result<size_t> result = setChunkedMeasurements(chunked);
+		if (result != success)
+			s_logger.logCritical(QString("Failed to update the measurement triggers: %1").arg(result.error().what().c_str()));
+		for (Measurement const& m : chunked)
+			updateRecentMeasurement(m);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<size_t> DB::backfillAlarmTriggers(Range<IClock::time_point> const& range, AlarmBackfillProgress const& progress, QueryToken const* token)
+{
+	flushMeasurements();
+
+	IClock::time_point start = IClock::rtNow();
+
+	//The alarms as they are now, compiled for each sensor. Only the measurements already evaluated are re-evaluated,
+	//the newer ones are left to checkMeasurementTriggers
+	struct SensorBackfill
+	{
+		SensorId id = 0;
+		uint32_t lastIndex = 0;
+		SensorAlarmTriggers triggers;
+	};
+	std::vector<SensorBackfill> sensors;
+	bool wal = false;
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		for (Sensor const& sensor : m_data.sensors)
+		{
+			SensorBackfill backfill;
+			backfill.id = sensor.id;
+			backfill.lastIndex = sensor.lastAlarmProcessesMeasurementIndex;
+			if (backfill.lastIndex == 0 || !beginSensorAlarmTriggers(sensor, backfill.triggers))
+				continue;
+			//the blackouts of the past are not known, the measurements keep the ones they have
+			for (alarms::SensorAlarm& sa : backfill.triggers.sensorAlarms)
+				sa.plan.sensorTriggers = 0;
+			sensors.push_back(std::move(backfill));
+		}
+		wal = isWalJournal(*m_sqlite);
+	}
+
+	//the block after the index, or the measurement before it, which the alarms start from. False when cancelled
+	auto read = [this, &range, token](sqlite3& sqlite, bool previous, SensorId sensorId, int64_t index, uint32_t lastIndex, std::vector<Measurement>& measurements) -> Result<bool>
+	{
+		measurements.clear();
+
+		if (token)
+			token->attach(&sqlite);
+		utils::epilogue epiToken([token] { if (token) token->detach(); });
+		if (token && token->isCancelled())
+			return false;
+
+		std::string sql;
+		if (previous)
+			sql = unionSelects(getMeasurementSources(sqlite), [](std::string const& table)
+			{
+				return "SELECT * FROM " + table + " WHERE sensorId = ?1 AND idx < ?2";
+			}) + " ORDER BY idx DESC LIMIT 1;";
+		else
+			sql = unionSelects(getMeasurementSources(sqlite, range), [](std::string const& table)
+			{
+				return "SELECT * FROM " + table + " WHERE sensorId = ?1 AND idx > ?2 AND idx <= ?3 AND timePoint >= ?4 AND timePoint <= ?5";
+			}) + " ORDER BY idx LIMIT " + std::to_string(ALARM_BACKFILL_READ_BLOCK) + ";";
+
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			if (token && token->isCancelled())
+				return false;
+			return Error(QString("Cannot read the measurements: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+		}
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, sensorId);
+		sqlite3_bind_int64(stmt, 2, index);
+		if (!previous)
+		{
+			sqlite3_bind_int64(stmt, 3, lastIndex);
+			sqlite3_bind_int64(stmt, 4, IClock::to_time_t(range.min));
+			sqlite3_bind_int64(stmt, 5, IClock::to_time_t(range.max));
+		}
+		int result;
+		while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+			measurements.push_back(unpackMeasurement(stmt));
+		if (result == SQLITE_DONE)
+			return true;
+		if (token && token->isCancelled())
+			return false;
+		return Error(QString("Cannot read the measurements: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+	};
+
+	//only the measurements that are re-evaluated, of the sensors above up to their last evaluated index
+	bool cancelled = false;
+	size_t total = 0;
+	{
+		ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+		if (!snapshot)
+			return Error("Cannot count the measurements");
+		sqlite3& sqlite = *snapshot.get();
+		if (token)
+			token->attach(&sqlite);
+		utils::epilogue epiToken([token] { if (token) token->detach(); });
+
+		std::string sql = "SELECT TOTAL(c) FROM (" + unionSelects(getMeasurementSources(sqlite, range), [](std::string const& table)
+		{
+			return "SELECT COUNT(*) AS c FROM " + table + " WHERE sensorId = ?1 AND idx <= ?2 AND timePoint >= ?3 AND timePoint <= ?4";
+		}) + ");";
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			if (!token || !token->isCancelled())
+				return Error(QString("Cannot count the measurements: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+			cancelled = true;
+		}
+		else
+		{
+			utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+			for (SensorBackfill const& backfill : sensors)
+			{
+				sqlite3_reset(stmt);
+				sqlite3_bind_int64(stmt, 1, backfill.id);
+				sqlite3_bind_int64(stmt, 2, backfill.lastIndex);
+				sqlite3_bind_int64(stmt, 3, IClock::to_time_t(range.min));
+				sqlite3_bind_int64(stmt, 4, IClock::to_time_t(range.max));
+				if (sqlite3_step(stmt) != SQLITE_ROW)
+				{
+					if (!token || !token->isCancelled())
+						return Error(QString("Cannot count the measurements: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+					cancelled = true;
+					break;
+				}
+				total += size_t(sqlite3_column_double(stmt, 0));
+			}
+		}
+	}
+
+	std::vector<Measurement> measurements;
+	std::vector<RollupTriggers> buckets;
+	size_t done = 0;
+	int64_t rangeBegin = IClock::to_time_t(range.min);
+	std::vector<Measurement> block;
+	std::vector<AlarmTriggers> storedTriggers;
+	for (SensorBackfill& backfill : sensors)
+	{
+		if (cancelled)
+			break;
+
+		int64_t lastReadIndex = -1; //the indices start at 0
+		bool started = false;
+		std::optional<int64_t> bucket;
+		uint32_t bucketTriggers = 0;
+		bool bucketSplit = false; //its first measurements were written with the previous block
+		bool last = false;
+		while (!cancelled && !last)
+		{
+			//A block is read and evaluated without the locks, so the ingest and the queries only wait for its write. If a
+			//measurement was edited in between, it's read again with them locked, so no row changes before the write.
+			//A partition file with a rollback journal can't commit while it's read, so there the read is always locked
+			std::unique_lock<DataMutex> lg(m_dataMutex, std::defer_lock);
+			std::unique_lock<std::mutex> wl(m_writeMutex, std::defer_lock);
+			SensorAlarmTriggers triggers;
+			for (bool locked = !wal; ; locked = true)
+			{
+				uint64_t editCount = m_measurementEditCount;
+
+				//A snapshot per block, so the writes of the previous blocks don't pile up in the WAL. It ends before the write
+				ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+				if (!snapshot)
+					return Error("Cannot read the measurements");
+				if (locked)
+				{
+					lg.lock();
+					wl.lock();
+				}
+
+				Result<bool> result = read(*snapshot.get(), false, backfill.id, lastReadIndex, backfill.lastIndex, block);
+				if (result != success)
+					return result.error();
+				if (!result.payload())
+				{
+					cancelled = true;
+					break;
+				}
+				if (block.empty())
+					break;
+
+				triggers = backfill.triggers;
+				if (!started)
+				{
+					//the triggers before the range are not known per alarm, they are the ones of the measurement before it
+					std::vector<Measurement> previous;
+					Result<bool> previousResult = read(*snapshot.get(), true, backfill.id, block.front().descriptor.index, 0, previous);
+					if (previousResult != success)
+						return previousResult.error();
+					if (!previousResult.payload())
+					{
+						cancelled = true;
+						break;
+					}
+					std::fill(triggers.alarmTriggers.begin(), triggers.alarmTriggers.end(), 0);
+					evaluateSensorAlarmTriggers(triggers, previous);
+				}
+				snapshot = ReadConnectionPool::Snapshot();
+
+				storedTriggers.clear();
+				for (Measurement const& m : block)
+					storedTriggers.push_back(m.alarmTriggers);
+				evaluateSensorAlarmTriggers(triggers, block);
+
+				if (locked)
+					break;
+				lg.lock();
+				wl.lock();
+				if (m_measurementEditCount == editCount)
+					break;
+				wl.unlock();
+				lg.unlock();
+			}
+			if (cancelled || block.empty())
+				break;
+			started = true;
+			backfill.triggers = std::move(triggers);
+
+			for (size_t i = 0; i < block.size(); i++)
+			{
+				Measurement& m = block[i];
+				m.alarmTriggers |= storedTriggers[i] & ~uint32_t(AlarmTrigger::MeasurementMask);
+
+				//a bucket gets the triggers of its measurements if they were all evaluated in the same block,
+				//the others are or-ed again from the rows when written
+				int64_t tp = IClock::to_time_t(m.timePoint);
+				int64_t b = tp - tp % HOURLY_ROLLUP_PERIOD;
+				if (bucket.has_value() && *bucket != b)
+				{
+					buckets.push_back({ backfill.id, *bucket, bucketTriggers, *bucket >= rangeBegin && !bucketSplit });
+					bucketTriggers = 0;
+					bucketSplit = false;
+				}
+				bucket = b;
+				bucketTriggers |= m.alarmTriggers.current;
+				measurements.push_back(m);
+			}
+			bucketSplit = true;
+
+			lastReadIndex = block.back().descriptor.index;
+			last = block.size() < ALARM_BACKFILL_READ_BLOCK;
+
+			Result<void> writeResult = writeBackfilledAlarmTriggers(measurements, buckets);
+			if (writeResult != success)
+				return writeResult.error();
+			done += measurements.size();
+			measurements.clear();
+			buckets.clear();
+			wl.unlock();
+			lg.unlock();
+
+			total = std::max(total, done);
+			if (progress)
+				progress(done, total);
+		}
+
+		//the last bucket can have measurements out of the range, or not evaluated yet. Written with the next block
+		if (bucket.has_value())
+			buckets.push_back({ backfill.id, *bucket, bucketTriggers, false });
+	}
+
+	if (!buckets.empty())
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		Result<void> result = writeBackfilledAlarmTriggers(measurements, buckets);
+		if (result != success)
+			return result.error();
+	}
+
+	if (done > 0)
+	{
+		s_logger.logInfo(QString("Re-evaluated the alarm triggers of %1 measurements%2 in %3s")
+		                 .arg(done).arg(cancelled ? " before being cancelled" : "")
+		                 .arg(std::chrono::duration<float>(IClock::rtNow() - start).count()));
+		emit measurementsChanged();
+	}
+	return done;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//With the data and the write mutexes locked by the caller
+Result<void> DB::writeBackfilledAlarmTriggers(std::vector<Measurement>& measurements, std::vector<RollupTriggers> const& buckets)
+{
+	//in the order they are stored
+	std::sort(measurements.begin(), measurements.end(), [](Measurement const& a, Measurement const& b) { return a.id < b.id; });
+
+	sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	bool committed = false;
+	utils::epilogue epiTransaction([this, &committed] { sqlite3_exec(m_sqlite, committed ? "END TRANSACTION;" : "ROLLBACK;", nullptr, nullptr, nullptr); });
+
+	updateMeasurementTriggers(measurements);
+
+	Result<void> result = updateRollupTriggers(buckets);
+	if (result != success)
+		return result;
+
+	committed = true;
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::updateRollupTriggers(std::vector<RollupTriggers> const& buckets)
+{
+	//the triggers that went away have to go from the rollups too, so they are replaced instead of or-ed.
+	//The complete buckets come with their triggers, the others are recomputed from their measurements
+	std::string setSql = std::string("UPDATE ") + getRollupTable(HOURLY_ROLLUP_PERIOD) + " SET alarmTriggers = ?3 WHERE sensorId = ?1 AND timePoint = ?2;";
+	std::string recomputeSql = std::string("UPDATE ") + getRollupTable(HOURLY_ROLLUP_PERIOD) + " SET alarmTriggers = (SELECT IFNULL(BIT_OR(alarmTriggersCurrent), 0) FROM (" +
+	                           unionSelects(getMeasurementSources(*m_sqlite), [](std::string const& table)
+	                           {
+	                               return "SELECT alarmTriggersCurrent FROM " + table + " WHERE sensorId = ?1 AND timePoint >= ?2 AND timePoint < ?2 + " + std::to_string(HOURLY_ROLLUP_PERIOD);
+	                           }) + ")) WHERE sensorId = ?1 AND timePoint = ?2;";
+	std::set<std::pair<SensorId, int64_t>> days;
+	for (RollupTriggers const& bucket : buckets)
+	{
+		sqlite3_stmt* stmt = getCachedStatement(bucket.complete ? setSql.c_str() : recomputeSql.c_str());
+		if (!stmt)
+			return Error(QString("Failed to update the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, bucket.sensorId);
+		sqlite3_bind_int64(stmt, 2, bucket.timePoint);
+		if (bucket.complete)
+			sqlite3_bind_int64(stmt, 3, bucket.triggers);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			return Error(QString("Failed to update the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		days.insert({ bucket.sensorId, bucket.timePoint - bucket.timePoint % DAILY_ROLLUP_PERIOD });
+	}
+
+	//and the days from their hours
+	std::string sql = std::string("UPDATE ") + getRollupTable(DAILY_ROLLUP_PERIOD) + " SET alarmTriggers = (SELECT IFNULL(BIT_OR(alarmTriggers), 0) FROM " +
+	                  getRollupTable(HOURLY_ROLLUP_PERIOD) + " WHERE sensorId = ?1 AND timePoint >= ?2 AND timePoint < ?2 + " + std::to_string(DAILY_ROLLUP_PERIOD) +
+	                  ") WHERE sensorId = ?1 AND timePoint = ?2;";
+	sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+	if (!stmt)
+		return Error(QString("Failed to update the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	for (auto const& day : days)
+	{
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+		sqlite3_bind_int64(stmt, 1, day.first);
+		sqlite3_bind_int64(stmt, 2, day.second);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			return Error(QString("Failed to update the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	}
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::process()
+{
+	m_processRequested = false;
+	m_processingThread = std::this_thread::get_id();
+	utils::epilogue epi([this] { m_processingThread = std::thread::id(); });
+
+	addAsyncMeasurements();
+	processEvents();
+
+	if (m_saveScheduled)
+		save(true);
+
+	checkMeasurementTriggers();
+	sealMeasurementPartitions();
+	removeMeasurementPartitionFiles();
+	compressColdMeasurements();
+	applyRetentionPolicies();
+	backfillMeasurementRollups();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setGeneralSettings(GeneralSettings const& settings)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	m_data.generalSettings = settings;
+	m_data.generalSettingsChanged = true;
+	emit generalSettingsChanged();
+
+	s_logger.logInfo("Changed general settings");
+
+	save(true);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::GeneralSettings const& DB::getGeneralSettings() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.generalSettings;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setCsvSettings(CsvSettings const& settings)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	m_data.csvSettings = settings;
+	m_data.csvSettingsChanged = true;
+	emit csvSettingsChanged();
+
+	s_logger.logInfo("Changed csv settings");
+
+	save(true);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::CsvSettings const& DB::getCsvSettings() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.csvSettings;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setEmailSettings(EmailSettings const& settings)
+{
+	if (settings.sender.empty())
+		return false;
+	if (settings.username.empty())
+		return false;
+	if (settings.password.empty())
+		return false;
+	if (settings.host.empty())
+		return false;
+	if (settings.port == 0)
+		return false;
+
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	m_data.emailSettings = settings;
+	m_data.emailSettingsChanged = true;
+	emit emailSettingsChanged();
+
+	s_logger.logInfo("Changed email settings");
+
+	save(true);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::EmailSettings const& DB::getEmailSettings() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.emailSettings;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setFtpSettings(FtpSettings const& settings)
+{
+	if (settings.username.empty())
+		return false;
+	if (settings.password.empty())
+		return false;
+	if (settings.host.empty())
+		return false;
+	if (settings.port == 0)
+		return false;
+
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	m_data.ftpSettings = settings;
+	m_data.ftpSettingsChanged = true;
+	emit ftpSettingsChanged();
+
+	s_logger.logInfo("Changed ftp settings");
+
+	save(true);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::FtpSettings const& DB::getFtpSettings() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.ftpSettings;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t DB::getUserCount() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.users.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::User DB::getUser(size_t index) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	assert(index < m_data.users.size());
+	return m_data.users[index];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::addUser(UserDescriptor const& descriptor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	if (findUserIndexByName(descriptor.name) >= 0)
+		return false;
+
+	User user;
+	user.descriptor = descriptor;
+	user.id = ++m_data.lastUserId;
+
+	m_data.users.push_back(user);
+	indexUser(m_data.users.size() - 1);
+	m_data.usersAddedOrRemoved = true;
+	emit userAdded(user.id);
+
+	s_logger.logInfo(QString("Added user '%1'").arg(descriptor.name.c_str()));
+
+	save(true);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setUser(UserId id, UserDescriptor const& descriptor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	int32_t index = findUserIndexByName(descriptor.name);
+	if (index >= 0 && getUser(static_cast<size_t>(index)).id != id)
+		return Error(QString("Cannot find user '%1'").arg(descriptor.name.c_str()).toUtf8().data());
+
+	index = findUserIndexById(id);
+	if (index < 0)
+		return Error(QString("Cannot find user '%1' (internal inconsistency)").arg(descriptor.name.c_str()).toUtf8().data());
+
+	User& user = m_data.users[static_cast<size_t>(index)];
+
+    std::optional<DB::User> loggedInUser = findUserById(m_data.loggedInUserId);
+    if (loggedInUser.has_value())
+	{
+        if (loggedInUser->descriptor.type != UserDescriptor::Type::Admin)
+		{
+            if (user.descriptor.permissions != descriptor.permissions &&
+                (loggedInUser->descriptor.permissions & UserDescriptor::PermissionChangeUsers) == 0)
+				return Error(QString("No permission to change permissions").toUtf8().data());
+
+			//check that the user is not adding too many permissions
+            uint32_t diff = loggedInUser->descriptor.permissions ^ descriptor.permissions;
+            if ((diff & loggedInUser->descriptor.permissions) != diff)
+				return Error(QString("Permission escalation between users is not allowed").toUtf8().data());
+
+            if (loggedInUser->descriptor.type != UserDescriptor::Type::Admin && user.descriptor.type == UserDescriptor::Type::Admin)
+				return Error(QString("Cannot change admin user").toUtf8().data());
+		}
+	}
+
+	bool keysChanged = user.descriptor.name != descriptor.name || user.descriptor.passwordHash != descriptor.passwordHash;
+	user.descriptor = descriptor;
+	if (keysChanged)
+		rebuildIndexes();
+	m_data.usersChanged = true;
+	emit userChanged(id);
+
+	s_logger.logInfo(QString("Changed user '%1'").arg(descriptor.name.c_str()));
+
+	save(true);
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeUser(size_t index)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	assert(index < m_data.users.size());
+	UserId id = m_data.users[index].id;
+
+	s_logger.logInfo(QString("Removed user '%1'").arg(m_data.users[index].descriptor.name.c_str()));
+
+	m_data.users.erase(m_data.users.begin() + index);
+	rebuildIndexes();
+	m_data.usersAddedOrRemoved = true;
+	emit userRemoved(id);
+
+	save(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeUserById(UserId id)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [id](User const& user) { return user.id == id; });
+    if (it != m_data.users.end())
+        removeUser(std::distance(m_data.users.begin(), it));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//user names are case insensitive
+static std::string getUserNameKey(std::string const& name)
+{
+	std::string key = name;
+	std::transform(key.begin(), key.end(), key.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+	return key;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findUserIndexByName(std::string const& name) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.usersByName.find(getUserNameKey(name));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findUserIndexById(UserId id) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.usersById.find(id);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findUserIndexByPasswordHash(std::string const& passwordHash) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.usersByPasswordHash.find(passwordHash);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::User> DB::findUserByName(std::string const& name) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    int32_t index = findUserIndexByName(name);
+    if (index < 0)
+        return std::nullopt;
+
+	return m_data.users[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::User> DB::findUserById(UserId id) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    int32_t index = findUserIndexById(id);
+    if (index < 0)
+        return std::nullopt;
+
+	return m_data.users[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::User> DB::findUserByPasswordHash(std::string const& passwordHash) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    int32_t index = findUserIndexByPasswordHash(passwordHash);
+    if (index < 0)
+        return std::nullopt;
+
+	return m_data.users[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::needsAdmin() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [](User const& user) { return user.descriptor.type == UserDescriptor::Type::Admin; });
+	if (it == m_data.users.end())
+		return true;
+	
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::setLoggedInUserId(UserId id)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+    std::optional<DB::User> user = findUserById(id);
+    if (user.has_value())
+	{
+        s_logger.logInfo(QString("User '%1' logged in").arg(user->descriptor.name.c_str()));
+		m_data.loggedInUserId = id;
+		emit userLoggedIn(id);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::UserId DB::getLoggedInUserId() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.loggedInUserId;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::User> DB::getLoggedInUser() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+    std::optional<DB::User> user = findUserById(m_data.loggedInUserId);
+    if (user.has_value())
+        return std::move(*user);
+
+	return std::nullopt;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::isLoggedInAsAdmin() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+    std::optional<DB::User> user = findUserById(m_data.loggedInUserId);
+    if (user.has_value())
+        return user->descriptor.type == UserDescriptor::Type::Admin;
+
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensorSettings(SensorSettings const& settings)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	if (settings.radioPower < -3 || settings.radioPower > 20)
+		return Error("Invalid radio power value");
+	if (settings.retries < 1 || settings.retries > 10)
+		return Error("Invalid number of retries");
+	if (settings.alertBatteryLevel < 0.f || settings.alertBatteryLevel >= 1.f)
+		return Error("Invalid alert battery level");
+	if (settings.alertSignalStrengthLevel < 0.f || settings.alertSignalStrengthLevel >= 1.f)
+		return Error("Invalid alert signal strength level");
+
+	m_data.sensorSettings = settings;
+	m_data.sensorSettingsChanged = true;
+	rebuildSensorAlarmIndex(); //the battery and signal levels
+	emit sensorSettingsChanged();
+
+	s_logger.logInfo("Changed sensor settings");
+
+	save(true);
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::SensorSettings DB::getSensorSettings() const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.sensorSettings;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+IClock::duration DB::computeActualCommsPeriod(SensorTimeConfigDescriptor const& config) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::duration period = std::max(config.commsPeriod, m_data.commsSlotsPeriod);
+    return std::max(period, config.measurementPeriod);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+IClock::time_point DB::computeNextMeasurementTimePoint(Sensor const& sensor) const
+{
+    uint32_t nextMeasurementIndex = computeNextMeasurementIndex(sensor);
+    SensorTimeConfig config = findSensorTimeConfigForMeasurementIndex(nextMeasurementIndex);
+
+    uint32_t index = nextMeasurementIndex >= config.baselineMeasurementIndex ? nextMeasurementIndex - config.baselineMeasurementIndex : 0;
+	IClock::time_point tp = config.baselineMeasurementTimePoint + config.descriptor.measurementPeriod * index;
+    return tp;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+void DB::updateCommsEpoch()
+{
+    SensorTimeConfig config = getLastSensorTimeConfig();
+	IClock::duration period = computeActualCommsPeriod(config.descriptor);
+
+	IClock::time_point now = m_clock->now();
+	if (m_data.commsEpochPeriod == IClock::duration::zero())
+		m_data.commsEpochStart = config.baselineMeasurementTimePoint;
+	else if (m_data.commsEpochPeriod != period && now >= m_data.commsEpochStart)
+	{
+		//The comms time points handed out so far are in the current or the next period of the old epoch,
+		//at the sensors' current slots. The new epoch starts with the next period so they stay valid
+		m_data.commsEpochStart += m_data.commsEpochPeriod * ((now - m_data.commsEpochStart) / m_data.commsEpochPeriod + 1);
+	}
+	m_data.commsEpochPeriod = period;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+IClock::time_point DB::computeNextCommsTimePoint(Sensor const& sensor) const
+{
+    SensorTimeConfig config = getLastSensorTimeConfig();
+	IClock::duration period = computeActualCommsPeriod(config.descriptor);
+
+	//before the first epoch update the periods are counted from the baseline
+	IClock::time_point now = m_clock->now();
+	IClock::time_point start = m_data.commsEpochPeriod == IClock::duration::zero() ? config.baselineMeasurementTimePoint : m_data.commsEpochStart;
+    uint32_t index = now >= start ? static_cast<uint32_t>((now - start) / period) + 1 : 0;
+	return start + period * index + sensor.commsSlotOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+IClock::duration DB::computeCommsSlotDuration(Sensor const& sensor) const
+{
+	IClock::duration airtime = sensor.averageRequestAirtime > IClock::duration::zero() ? sensor.averageRequestAirtime : DEFAULT_REQUEST_AIRTIME;
+
+	//the config request plus the measurement batches for the backlog
+	uint32_t requests = 1 + (sensor.estimatedStoredMeasurementCount + MEASUREMENTS_PER_BATCH - 1) / MEASUREMENTS_PER_BATCH;
+	IClock::duration duration = std::chrono::ceil<std::chrono::seconds>(airtime * requests + COMMS_SLOT_GUARD);
+	return std::clamp<IClock::duration>(duration, std::chrono::seconds(1), COMMS_DURATION);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+void DB::allocateCommsSlot(Sensor& sensor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::duration duration = computeCommsSlotDuration(sensor);
+	freeCommsSlot(sensor);
+
+	//first fit. This moves the sensor to an earlier gap when there is one, compacting the schedule
+	IClock::duration offset = IClock::duration::zero();
+	if (m_data.commsSlotsUsed == m_data.commsSlotsEnd)
+		offset = m_data.commsSlotsEnd; //no gaps, append
+	else
+	{
+		for (auto const& p : m_data.commsSlots)
+		{
+			if (p.first - offset >= duration)
+				break;
+			offset = p.first + p.second.duration;
+		}
+	}
+
+	m_data.commsSlots.emplace(offset, Data::CommsSlot{ sensor.id, duration });
+	m_data.commsSlotsUsed += duration;
+	m_data.commsSlotsEnd = std::max(m_data.commsSlotsEnd, offset + duration);
+	sensor.commsSlotOffset = offset;
+	sensor.commsSlotDuration = duration;
+	markSensorChanged(sensor.id);
+	updateCommsSlotsPeriod();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+void DB::freeCommsSlot(Sensor& sensor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (sensor.commsSlotDuration == IClock::duration::zero())
+		return;
+
+	m_data.commsSlots.erase(sensor.commsSlotOffset);
+	m_data.commsSlotsUsed -= sensor.commsSlotDuration;
+	if (sensor.commsSlotOffset + sensor.commsSlotDuration == m_data.commsSlotsEnd)
+	{
+		m_data.commsSlotsEnd = IClock::duration::zero();
+		if (!m_data.commsSlots.empty())
+			m_data.commsSlotsEnd = m_data.commsSlots.rbegin()->first + m_data.commsSlots.rbegin()->second.duration;
+	}
+	sensor.commsSlotOffset = IClock::duration::zero();
+	sensor.commsSlotDuration = IClock::duration::zero();
+	markSensorChanged(sensor.id);
+	updateCommsSlotsPeriod();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+void DB::updateCommsSlotsPeriod()
+{
+	//Every period change starts a new comms epoch which delays all the sensors, so the period grows with
+	//25% headroom and shrinks only when less than half of it is used
+	IClock::duration end = m_data.commsSlotsEnd;
+	if (end <= m_data.commsSlotsPeriod && end * 2 >= m_data.commsSlotsPeriod)
+		return;
+
+	IClock::duration period = end + end / 4;
+	m_data.commsSlotsPeriod = ((period + COMMS_PERIOD_QUANTUM - IClock::duration(1)) / COMMS_PERIOD_QUANTUM) * COMMS_PERIOD_QUANTUM;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t DB::computeNextMeasurementIndex(Sensor const& sensor) const
+{
+    uint32_t nextSensorMeasurementIndex = sensor.firstStoredMeasurementIndex + sensor.storedMeasurementCount;
+
+    //make sure the next measurement index doesn't fall below the last non-sleeping config
+    //next_sensor_measurement_index = std::max(next_sensor_measurement_index, compute_baseline_measurement_index());
+
+    return nextSensorMeasurementIndex;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t DB::getBaseStationCount() const
+{
+    return getSnapshot()->baseStations.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::BaseStation DB::getBaseStation(size_t index) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+
+    Q_ASSERT(index < snapshot->baseStations.size());
+    return *snapshot->baseStations[index];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::addBaseStation(BaseStationDescriptor const& descriptor)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    if (_findBaseStationIndexByName(descriptor.name) >= 0)
+        return false;
+
+    if (_findBaseStationIndexByMac(descriptor.mac) >= 0)
+        return false;
+
+    BaseStationDescriptor::Mac const& mac = descriptor.mac;
+    char macStr[128];
+    sprintf(macStr, "%X_%X_%X_%X_%X_%X", mac[0]&0xFF, mac[1]&0xFF, mac[2]&0xFF, mac[3]&0xFF, mac[4]&0xFF, mac[5]&0xFF);
+
+    s_logger.logInfo(QString("Adding base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
+
+    BaseStation baseStation;
+	baseStation.lastConnectedTimePoint = m_clock->now();
+    baseStation.descriptor = descriptor;
+    baseStation.id = ++m_data.lastBaseStationId;
+
+    m_data.baseStations.push_back(baseStation);
+    indexBaseStation(m_data.baseStations.size() - 1);
+	m_data.changedBaseStations.insert(baseStation.id);
+	markBaseStationChanged(baseStation.id);
+    emit baseStationAdded(baseStation.id);
+
+	scheduleEvent(EventType::BaseStation, baseStation.id, m_clock->now());
+
+	save(true);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setBaseStation(BaseStationId id, BaseStationDescriptor const& descriptor)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findBaseStationIndexByName(descriptor.name);
+    if (_index >= 0 && m_data.baseStations[static_cast<size_t>(_index)].id != id)
+        return false;
+
+    _index = _findBaseStationIndexByMac(descriptor.mac);
+    if (_index >= 0 && m_data.baseStations[static_cast<size_t>(_index)].id != id)
+        return false;
+
+    _index = _findBaseStationIndexById(id);
+    if (_index < 0)
+        return false;
+
+    size_t index = static_cast<size_t>(_index);
+
+    s_logger.logInfo(QString("Changing base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
+
+    BaseStationDescriptor& oldDescriptor = m_data.baseStations[index].descriptor;
+    bool keysChanged = oldDescriptor.name != descriptor.name || oldDescriptor.mac != descriptor.mac;
+    oldDescriptor = descriptor;
+    if (keysChanged)
+        rebuildIndexes();
+	m_data.changedBaseStations.insert(id);
+	markBaseStationChanged(id);
+    emit baseStationChanged(id);
+
+	save(true);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::setBaseStationConnected(BaseStationId id, bool connected)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	int32_t _index = _findBaseStationIndexById(id);
+	if (_index < 0)
+	{
+		Q_ASSERT(false);
+		return;
+	}
+
+	size_t index = static_cast<size_t>(_index);
+
+	BaseStation& bs = m_data.baseStations[index];
+	if (bs.isConnected == connected)
+		return;
+
+	bs.isConnected = connected;
+	bs.lastConnectedTimePoint = m_clock->now();
+	bs.lastCommsTimePoint = m_clock->now();
+	if (connected)
+		computeBaseStationAlarmTriggers(bs);
+	else
+		scheduleEvent(EventType::BaseStation, bs.id, m_clock->now());
+
+	m_data.changedBaseStations.insert(bs.id);
+	markBaseStationChanged(bs.id);
+	emit baseStationChanged(id);
+
+	save(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeBaseStation(size_t index)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    Q_ASSERT(index < m_data.baseStations.size());
+    BaseStationId id = m_data.baseStations[index].id;
+
+    BaseStationDescriptor const& descriptor = m_data.baseStations[index].descriptor;
+    s_logger.logInfo(QString("Removing base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
+
+    m_data.baseStations.erase(m_data.baseStations.begin() + index);
+    rebuildIndexes();
+	m_data.changedBaseStations.erase(id);
+	m_data.removedBaseStations.insert(id);
+	markAllChanged();
+    emit baseStationRemoved(id);
+
+	save(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeBaseStationById(BaseStationId id)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [id](BaseStation const& bs) { return bs.id == id; });
+    if (it != m_data.baseStations.end())
+        removeBaseStation(std::distance(m_data.baseStations.begin(), it));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findBaseStationIndexByName(std::string const& name) const
+{
+    return getSnapshot()->indexes->baseStationsByName.find(name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findBaseStationIndexByName(std::string const& name) const
+{
+    return m_data.indexes.baseStationsByName.find(name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findBaseStationIndexById(BaseStationId id) const
+{
+    return getSnapshot()->indexes->baseStationsById.find(id);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findBaseStationIndexById(BaseStationId id) const
+{
+    return m_data.indexes.baseStationsById.find(id);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findBaseStationIndexByMac(BaseStationDescriptor::Mac const& mac) const
+{
+    return getSnapshot()->indexes->baseStationsByMac.find(mac);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findBaseStationIndexByMac(BaseStationDescriptor::Mac const& mac) const
+{
+    return m_data.indexes.baseStationsByMac.find(mac);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::BaseStation> DB::findBaseStationByName(std::string const& name) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->baseStationsByName.find(name);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->baseStations[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::BaseStation> DB::findBaseStationById(BaseStationId id) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->baseStationsById.find(id);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->baseStations[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::BaseStation> DB::findBaseStationByMac(BaseStationDescriptor::Mac const& mac) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->baseStationsByMac.find(mac);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->baseStations[size_t(index)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t DB::getSensorCount() const
+{
+    return getSnapshot()->sensors.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::Sensor DB::getSensor(size_t index) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    Q_ASSERT(index < snapshot->sensors.size());
+    return *snapshot->sensors[index];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+DB::SensorOutputDetails DB::computeSensorOutputDetails(SensorId id)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findSensorIndexById(id);
+    if (_index < 0)
+        return {};
+
+    size_t index = static_cast<size_t>(_index);
+    Sensor& sensor = m_data.sensors[index];
+    SensorTimeConfig config = getLastSensorTimeConfig();
+
+    updateCommsEpoch();
+    confirmCommittedMeasurements();
+
+    SensorOutputDetails details;
+    details.commsPeriod = computeActualCommsPeriod(config.descriptor);
+    details.nextCommsTimePoint = computeNextCommsTimePoint(sensor);
+    if (sensor.nextCommsTimePoint != details.nextCommsTimePoint)
+    {
+        sensor.nextCommsTimePoint = details.nextCommsTimePoint;
+        markSensorChanged(sensor.id);
+    }
+    details.measurementPeriod = config.descriptor.measurementPeriod;
+    details.nextMeasurementTimePoint = computeNextMeasurementTimePoint(sensor);
+    details.nextRealTimeMeasurementIndex = computeNextRealTimeMeasurementIndex();
+    details.nextMeasurementIndex = computeNextMeasurementIndex(sensor);
+    details.lastConfirmedMeasurementIndex = sensor.lastConfirmedMeasurementIndex;
+    return details;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t DB::computeNextRealTimeMeasurementIndex() const
+{
+    SensorTimeConfig config = getLastSensorTimeConfig();
+	IClock::time_point now = m_clock->now();
+    uint32_t index = static_cast<uint32_t>(std::ceil((now - config.baselineMeasurementTimePoint) / config.descriptor.measurementPeriod)) + config.baselineMeasurementIndex;
+    return index;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::_addSensorTimeConfig(SensorTimeConfigDescriptor const& descriptor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (descriptor.commsPeriod < std::chrono::seconds(30))
+		return Error("Comms period cannot be lower than 30 seconds");
+	if (descriptor.measurementPeriod < std::chrono::seconds(10))
+		return Error("Measurement period cannot be lower than 10 seconds");
+	if (descriptor.commsPeriod < descriptor.measurementPeriod)
+		return Error("Comms period cannot be lower than the measurement period");
+
+	SensorTimeConfig config;
+	config.descriptor = descriptor;
+
+	if (!m_data.sensorTimeConfigs.empty())
+	{
+		uint32_t nextRealTimeMeasurementIndex = computeNextRealTimeMeasurementIndex();
+
+		SensorTimeConfig c = findSensorTimeConfigForMeasurementIndex(nextRealTimeMeasurementIndex);
+		uint32_t index = nextRealTimeMeasurementIndex >= c.baselineMeasurementIndex ? nextRealTimeMeasurementIndex - c.baselineMeasurementIndex : 0;
+		IClock::time_point nextMeasurementTP = c.baselineMeasurementTimePoint + c.descriptor.measurementPeriod * index;
+
+        m_data.sensorTimeConfigs.erase(std::remove_if(m_data.sensorTimeConfigs.begin(), m_data.sensorTimeConfigs.end(), [&nextRealTimeMeasurementIndex](SensorTimeConfig const& cfg)
+		{
+            return cfg.baselineMeasurementIndex == nextRealTimeMeasurementIndex;
+		}), m_data.sensorTimeConfigs.end());
+		config.baselineMeasurementIndex = nextRealTimeMeasurementIndex;
+		config.baselineMeasurementTimePoint = nextMeasurementTP;
+	}
+	else
+	{
+		config.baselineMeasurementIndex = 0;
+		config.baselineMeasurementTimePoint = m_clock->now();
+	}
+
+	m_data.sensorTimeConfigs.push_back(config);
+	while (m_data.sensorTimeConfigs.size() > 100)
+		m_data.sensorTimeConfigs.erase(m_data.sensorTimeConfigs.begin());
+
+	m_data.sensorTimeConfigsChanged = true;
+
+	//the comms period might have changed, so all the blackout deadlines move
+	scheduleSensorEvents();
+
+	emit sensorTimeConfigAdded();
+
+	s_logger.logInfo("Added sensors config");
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::addSensorTimeConfig(SensorTimeConfigDescriptor const& descriptor)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	Result<void> result = _addSensorTimeConfig(descriptor);
+	if (result != success)
+		return result;
+
+	save(true);
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensorTimeConfigs(std::vector<SensorTimeConfig> const& configs)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	m_data.sensorTimeConfigs = configs;
+	m_data.sensorTimeConfigsChanged = true;
+	scheduleSensorEvents();
+	emit sensorTimeConfigChanged();
+
+    s_logger.logInfo("Changed sensors configs");
+
+	save(true);
+
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::SensorTimeConfig DB::getLastSensorTimeConfig() const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    static SensorTimeConfig s_empty;
+	return m_data.sensorTimeConfigs.empty() ? s_empty : m_data.sensorTimeConfigs.back();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t DB::getSensorTimeConfigCount() const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_data.sensorTimeConfigs.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::SensorTimeConfig DB::getSensorTimeConfig(size_t index) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+	Q_ASSERT(index < m_data.sensorTimeConfigs.size());
+    return m_data.sensorTimeConfigs[index];
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::SensorTimeConfig DB::findSensorTimeConfigForMeasurementIndex(uint32_t index) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	for (auto it = m_data.sensorTimeConfigs.rbegin(); it != m_data.sensorTimeConfigs.rend(); ++it)
+    {
+		SensorTimeConfig const& c = *it;
+        if (index >= c.baselineMeasurementIndex)
+            return c;
+    }
+    return getLastSensorTimeConfig();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//rounds towards +infinity, for any sign of a
+static int64_t ceilDiv(int64_t a, int64_t b)
+{
+	return a / b + ((a % b) > 0 ? 1 : 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::optional<DB::MeasurementIndexRange> DB::computeMeasurementIndexRange(IClock::time_point min, IClock::time_point max) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	//the indices before the first config (when the old ones were dropped) don't follow any of them
+	std::vector<SensorTimeConfig> const& configs = m_data.sensorTimeConfigs;
+	if (configs.empty() || configs.front().baselineMeasurementIndex != 0 || max < min)
+		return std::nullopt;
+
+	//The time points are stored in seconds, so a measurement matches when its time point is in [begin, end).
+	//Each config maps its indices linearly, so the first and last matching indices are computed instead of searched.
+	int64_t begin = std::chrono::duration_cast<IClock::duration>(std::chrono::seconds(IClock::to_time_t(min))).count();
+	int64_t end = std::chrono::duration_cast<IClock::duration>(std::chrono::seconds(IClock::to_time_t(max) + 1)).count();
+
+	std::optional<int64_t> minIndex;
+	std::optional<int64_t> maxIndex;
+	for (size_t i = 0; i < configs.size(); i++)
+	{
+		SensorTimeConfig const& c = configs[i];
+		int64_t firstIndex = c.baselineMeasurementIndex;
+		int64_t lastIndex = i + 1 < configs.size() ? int64_t(configs[i + 1].baselineMeasurementIndex) - 1 : int64_t(std::numeric_limits<uint32_t>::max());
+		if (lastIndex < firstIndex - 1)
+			return std::nullopt; //not in order, the lookup in findSensorTimeConfigForMeasurementIndex doesn't match this
+		if (lastIndex < firstIndex)
+			continue; //replaced by the next one
+
+		int64_t baseline = c.baselineMeasurementTimePoint.time_since_epoch().count();
+		int64_t period = c.descriptor.measurementPeriod.count();
+		if (period <= 0)
+			return std::nullopt;
+
+		int64_t first = firstIndex + std::max<int64_t>(ceilDiv(begin - baseline, period), 0);
+		if (!minIndex.has_value() && first <= lastIndex)
+			minIndex = first;
+
+		int64_t last = firstIndex + ceilDiv(end - baseline, period) - 1;
+		if (last >= firstIndex)
+			maxIndex = std::min(last, lastIndex);
+	}
+
+	MeasurementIndexRange range;
+	if (minIndex.has_value() && maxIndex.has_value() && *minIndex <= *maxIndex)
+	{
+		//one more on each side in case to_time_t rounds instead of truncating
+		range.min = std::max<int64_t>(*minIndex - 1, 0);
+		range.max = *maxIndex + 1;
+	}
+	else
+	{
+		range.min = minIndex.value_or(int64_t(std::numeric_limits<uint32_t>::max()) + 1);
+		range.max = range.min - 1;
+	}
+	return range;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<DB::SensorId> DB::addSensor(SensorDescriptor const& descriptor)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    if (_findSensorIndexByName(descriptor.name) >= 0)
+        return Error("Name '" + descriptor.name + "' already in use");
+
+    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [](Sensor const& sensor) { return sensor.state == Sensor::State::Unbound; });
+    if (it != m_data.sensors.end())
+        return Error("There is already an unbound sensor");
+
+    SensorId id;
+    {
+        Sensor sensor;
+		sensor.addedTimePoint = m_clock->now();
+        sensor.descriptor.name = descriptor.name;
+        id = ++m_data.lastSensorId;
+        sensor.id = id;
+        sensor.state = Sensor::State::Unbound;
+        allocateCommsSlot(sensor);
+
+        m_data.sensors.push_back(sensor);
+        indexSensor(m_data.sensors.size() - 1);
+		m_data.changedSensors.insert(id);
+		markSensorChanged(id);
+        scheduleEvent(EventType::Sensor, sensor.id, m_clock->now());
+        emit sensorAdded(sensor.id);
+
+        s_logger.logInfo(QString("Added sensor '%1'").arg(descriptor.name.c_str()));
+    }
+
+    //refresh computed comms period as new sensors are added
+    emit sensorTimeConfigChanged();
+
+	save(true);
+
+    return id;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensor(SensorId id, SensorDescriptor const& descriptor)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findSensorIndexByName(descriptor.name);
+    if (_index >= 0 && m_data.sensors[static_cast<size_t>(_index)].id != id)
+        return Error("Name '" + descriptor.name + "' already in use");
+
+    _index = _findSensorIndexById(id);
+    if (_index < 0)
+        return Error("Trying to change non-existing sensor");
+
+    size_t index = static_cast<size_t>(_index);
+    bool keysChanged = m_data.sensors[index].descriptor.name != descriptor.name;
+    m_data.sensors[index].descriptor = descriptor;
+    if (keysChanged)
+        rebuildIndexes();
+	m_data.changedSensors.insert(id);
+	markSensorChanged(id);
+    emit sensorChanged(id);
+
+    s_logger.logInfo(QString("Changed sensor '%1'").arg(descriptor.name.c_str()));
+
+	save(true);
+
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<DB::SensorId> DB::bindSensor(uint32_t serialNumber, uint8_t sensorType, uint8_t hardwareVersion, uint8_t softwareVersion, Sensor::Calibration const& calibration)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findUnboundSensorIndex();
+    if (_index < 0)
+        return Error("No unbound sensor");
+
+    size_t index = static_cast<size_t>(_index);
+    Sensor& sensor = m_data.sensors[index];
+    if (sensor.state != Sensor::State::Unbound)
+        return Error("No unbound sensor (inconsistent internal state)");
+
+    sensor.address = ++m_data.lastSensorAddress;
+    sensor.deviceInfo.sensorType = sensorType;
+    sensor.deviceInfo.hardwareVersion = hardwareVersion;
+    sensor.deviceInfo.softwareVersion = softwareVersion;
+    sensor.calibration = calibration;
+    sensor.state = Sensor::State::Active;
+    sensor.serialNumber = serialNumber;
+    rebuildIndexes(); //new address and serial number
+
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+	scheduleEvent(EventType::Sensor, sensor.id, m_clock->now());
+
+    emit sensorBound(sensor.id);
+    emit sensorChanged(sensor.id);
+
+    s_logger.logInfo(QString("Sensor '%1' bound to address %2").arg(sensor.descriptor.name.c_str()).arg(sensor.address));
+
+    //refresh computed comms period as new sensors are added
+    emit sensorTimeConfigChanged();
+
+	save(true);
+
+    return sensor.id;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensorCalibration(SensorId id, Sensor::Calibration const& calibration)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findSensorIndexById(id);
+    if (_index < 0)
+        return Error("Invalid sensor id");
+
+    size_t index = static_cast<size_t>(_index);
+    Sensor& sensor = m_data.sensors[index];
+    if (sensor.state == Sensor::State::Unbound)
+        return Error("Cannot change calibration for unbound sensor");
+
+    sensor.calibration = calibration;
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+
+    emit sensorChanged(sensor.id);
+
+    s_logger.logInfo(QString("Sensor '%1' calibration changed").arg(sensor.descriptor.name.c_str()));
+
+	save(true);
+
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensorSleep(SensorId id, bool sleep)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    int32_t _index = _findSensorIndexById(id);
+    if (_index < 0)
+        return Error("Invalid sensor id");
+
+    size_t index = static_cast<size_t>(_index);
+    Sensor& sensor = m_data.sensors[index];
+    if (sensor.state == Sensor::State::Unbound)
+        return Error("Cannot put unbound sensor to sleep");
+
+    if (sensor.shouldSleep == sleep)
+        return success;
+
+	DB::SensorTimeConfig config = getLastSensorTimeConfig();
+	IClock::duration actualCommsPeriod = computeActualCommsPeriod(config.descriptor);
+
+    bool hasMeasurements = sensor.estimatedStoredMeasurementCount > 0;
+    bool commedRecently = (DB::m_clock->now() - sensor.lastCommsTimePoint) < actualCommsPeriod * 2;
+    bool allowedToSleep = !hasMeasurements && commedRecently;
+    if (sleep && !sensor.shouldSleep && !allowedToSleep)
+    {
+        if (hasMeasurements)
+            return Error("Cannot put sensor to sleep because it has stored measurements");
+
+        return Error("Cannot put sensor to sleep because it didn't communicate recently");
+    }
+
+    sensor.shouldSleep = sleep;
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+
+    emit sensorChanged(sensor.id);
+
+    s_logger.logInfo(QString("Sensor '%1' sleep state changed to %2").arg(sensor.descriptor.name.c_str()).arg(sleep));
+
+	save(true);
+
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::setSensorStats(SensorId id, SensorStats const& stats)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	int32_t _index = _findSensorIndexById(id);
+	if (_index < 0)
+		return Error("Invalid sensor id");
+
+	size_t index = static_cast<size_t>(_index);
+	Sensor& sensor = m_data.sensors[index];
+	sensor.stats = stats;
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+
+	emit sensorChanged(sensor.id);
+
+	s_logger.logInfo(QString("Sensor '%1' error counters cleared").arg(sensor.descriptor.name.c_str()));
+
+	save(true);
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> DB::rebindSensor(SensorId id)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (_findUnboundSensorIndex() >= 0)
+		return Error("Binding already in process");
+
+	int32_t _index = _findSensorIndexById(id);
+	if (_index < 0)
+		return Error("Invalid sensor id");
+
+	size_t index = static_cast<size_t>(_index);
+	Sensor& sensor = m_data.sensors[index];
+	sensor.state = Sensor::State::Unbound;
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+	scheduleEvent(EventType::Sensor, sensor.id, m_clock->now());
+
+	emit sensorChanged(sensor.id);
+
+	s_logger.logInfo(QString("Sensor '%1' marked for rebinding").arg(sensor.descriptor.name.c_str()));
+
+	save(true);
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::cancelSensorBinding()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	int32_t _index = _findUnboundSensorIndex();
+	if (_index < 0)
+		return;
+
+	size_t index = static_cast<size_t>(_index);
+	Sensor& sensor = m_data.sensors[index];
+
+	if (sensor.serialNumber == 0) //never bound? remove
+	{
+		removeSensorById(sensor.id);
+		return;
+	}
+
+	//revert to active
+	sensor.state = Sensor::State::Active;
+	m_data.changedSensors.insert(sensor.id);
+	markSensorChanged(sensor.id);
+	scheduleEvent(EventType::Sensor, sensor.id, m_clock->now());
+
+	emit sensorChanged(sensor.id);
+
+	s_logger.logInfo(QString("Sensor '%1' canceled rebinding").arg(sensor.descriptor.name.c_str()));
+
+	save(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setSensorInputDetails(SensorInputDetails const& details)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    return setSensorsInputDetails({details});
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DB::setSensorsInputDetails(std::vector<SensorInputDetails> const& details)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    bool ok = true;
+    for (SensorInputDetails const& d: details)
+    {
+        int32_t _index = _findSensorIndexById(d.id);
+        if (_index < 0)
+        {
+            ok = false;
+            continue;
+        }
+
+        size_t index = static_cast<size_t>(_index);
+        Sensor& sensor = m_data.sensors[index];
+        if (sensor.state == Sensor::State::Unbound)
+        {
+            ok = false;
+            continue;
+        }
+
+        Sensor::State oldState = sensor.state;
+        uint32_t oldLastConfirmedMeasurementIndex = sensor.lastConfirmedMeasurementIndex;
+
+        if (d.hasDeviceInfo)
+            sensor.deviceInfo = d.deviceInfo;
+
+        //sensor.nextMeasurementTimePoint = d.nextMeasurementTimePoint;
+        if (d.hasLastCommsTimePoint)
+        {
+            if (d.lastCommsTimePoint > sensor.lastCommsTimePoint)
+                sensor.lastCommsTimePoint = d.lastCommsTimePoint;
+        }
+        if (d.hasStoredData)
+        {
+            sensor.firstStoredMeasurementIndex = d.firstStoredMeasurementIndex;
+            sensor.storedMeasurementCount = d.storedMeasurementCount;
+
+            if (sensor.firstStoredMeasurementIndex > 0)
+            {
+                //we'll never receive measurements lower than sensor->first_recorded_measurement_index
+                //so at worst, max_confirmed_measurement_index = sensor->first_recorded_measurement_index - 1 (the one just before the first recorded index)
+                sensor.lastConfirmedMeasurementIndex = std::max(sensor.lastConfirmedMeasurementIndex, sensor.firstStoredMeasurementIndex - 1);
+            }
+
+            {
+                //if storing 1 measurement starting from index 15, the last stored index is 15 (therefore the -1 at the end)
+                int64_t lastStoredIndex = static_cast<int64_t>(sensor.firstStoredMeasurementIndex) +
+                        static_cast<int64_t>(sensor.storedMeasurementCount) - 1;
+                lastStoredIndex = std::max<int64_t>(lastStoredIndex, 0); //make sure we don't get negatives
+                int64_t count = std::max<int64_t>(lastStoredIndex - static_cast<int64_t>(sensor.lastConfirmedMeasurementIndex), 0);
+                sensor.estimatedStoredMeasurementCount = static_cast<uint32_t>(count);
+            }
+        }
+
+        if (d.hasSleepingData)
+        {
+            if (sensor.state != Sensor::State::Unbound)
+            {
+                if (sensor.state == Sensor::State::Sleeping && !d.sleeping)
+                {
+                    //the sensor has slept, now it wakes up and start measuring from the current index
+                    sensor.lastConfirmedMeasurementIndex = computeNextRealTimeMeasurementIndex();
+                }
+                if (sensor.state != Sensor::State::Sleeping && d.sleeping)
+                {
+                    //mark the moment the sensor went to sleep
+                    sensor.sleepStateTimePoint = m_clock->now();
+                }
+                sensor.state = d.sleeping ? Sensor::State::Sleeping : Sensor::State::Active;
+            }
+        }
+
+        if (d.hasSignalStrength)
+        {
+            sensor.lastSignalStrengthB2S = d.signalStrengthB2S;
+
+            //we do this here just in case the sensor doesn't have any measurements. In that case the average signal strength will be calculated from the lastSignalStrengthB2S
+            //this happens the first time a sensor is added
+            if (sensor.averageSignalStrength.b2s >= 0 || sensor.averageSignalStrength.s2b >= 0)
+                sensor.averageSignalStrength = { d.signalStrengthB2S, d.signalStrengthB2S };
+        }
+
+        if (d.hasStatsDelta)
+        {
+            sensor.stats.commsBlackouts += d.statsDelta.commsBlackouts;
+            sensor.stats.commsFailures += d.statsDelta.commsFailures;
+            sensor.stats.resetReboots += d.statsDelta.resetReboots;
+            sensor.stats.unknownReboots += d.statsDelta.unknownReboots;
+            sensor.stats.brownoutReboots += d.statsDelta.brownoutReboots;
+            sensor.stats.powerOnReboots += d.statsDelta.powerOnReboots;
+            sensor.stats.watchdogReboots += d.statsDelta.watchdogReboots;
+            sensor.stats.commsRetries += d.statsDelta.commsRetries;
+            sensor.stats.awake += d.statsDelta.awake;
+            sensor.stats.asleep += d.statsDelta.asleep;
+            sensor.stats.commsRounds += d.statsDelta.commsRounds;
+            sensor.stats.measurementRounds += d.statsDelta.measurementRounds;
+        }
+
+        if (d.hasMeasurement)
+        {
+            sensor.isRTMeasurementValid = true;
+            sensor.rtMeasurementTemperature = d.measurementTemperature;
+            sensor.rtMeasurementHumidity = d.measurementHumidity;
+            sensor.rtMeasurementVcc = d.measurementVcc;
+        }
+
+        if (d.hasRequestAirtime)
+        {
+            //smoothed so a single slow round doesn't move the slot around
+            if (sensor.averageRequestAirtime == IClock::duration::zero())
+                sensor.averageRequestAirtime = d.requestAirtime;
+            else
+                sensor.averageRequestAirtime = (sensor.averageRequestAirtime * 7 + d.requestAirtime) / 8;
+        }
+
+        //sensors only change their slot when they talk, so the slots already handed out to others stay free
+        if (d.hasLastCommsTimePoint)
+            allocateCommsSlot(sensor);
+
+        //a comms ends a blackout and state changes move the deadline, otherwise the pending deadline handles it
+        if (sensor.blackout || sensor.state != oldState)
+            scheduleEvent(EventType::Sensor, sensor.id, m_clock->now());
+        if (sensor.lastConfirmedMeasurementIndex != oldLastConfirmedMeasurementIndex)
+            m_measurementTriggersScheduled = true;
+
+        m_data.changedSensors.insert(sensor.id);
+        markSensorChanged(sensor.id);
+        emit sensorDataChanged(sensor.id);
+    }
+
+    scheduleSave();
+
+    return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeSensor(size_t index)
+
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    //so no pending measurement of this sensor gets written after the delete
+    flushMeasurements();
+
+    Q_ASSERT(index < m_data.sensors.size());
+
+    SensorId sensorId = m_data.sensors[index].id;
+
+    {
+		QString sql;
+		for (std::string const& table: getMeasurementTables(*m_sqlite))
+		{
+			sql = QString("DELETE FROM %1 "
+			              "WHERE sensorId = %2;").arg(table.c_str()).arg(sensorId);
+			if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+			{
+				s_logger.logCritical(QString("Failed to remove measurements for sensor %1: %2").arg(sensorId).arg(sqlite3_errmsg(m_sqlite)));
+				return;
+			}
+			if (sqlite3_changes(m_sqlite) > 0)
+				markMeasurementPartitionChanged(table);
+		}
+		sql = QString("DELETE FROM MeasurementChunks WHERE sensorId = %1;").arg(sensorId);
+		if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+		{
+			s_logger.logCritical(QString("Failed to remove measurements for sensor %1: %2").arg(sensorId).arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+		{
+			sql = QString("DELETE FROM %1 WHERE sensorId = %2;").arg(getRollupTable(period)).arg(sensorId);
+			if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+				s_logger.logCritical(QString("Failed to remove measurement rollups for sensor %1: %2").arg(sensorId).arg(sqlite3_errmsg(m_sqlite)));
+		}
+		{
+			std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+			m_recentMeasurements.erase(sensorId);
+		}
+		{
+			std::lock_guard<std::mutex> lg2(m_measurementCountsMutex);
+			m_measurementCounts.erase(sensorId);
+		}
+        emit measurementsRemoved(sensorId);
+    }
+
+    for (Alarm& alarm: m_data.alarms)
+    {
+        if (alarm.descriptor.sensors.erase(sensorId) > 0)
+        {
+            m_data.changedAlarms.insert(alarm.id);
+            markAlarmChanged(alarm.id);
+        }
+        //alarm.triggersPerSensor.erase(sensorId); //this will dissapear naturally
+    }
+
+    for (Report& report: m_data.reports)
+    {
+        if (report.descriptor.sensors.erase(sensorId) > 0)
+            m_data.changedReports.insert(report.id);
+    }
+
+    s_logger.logInfo(QString("Removing sensor '%1'").arg(m_data.sensors[index].descriptor.name.c_str()));
+
+    freeCommsSlot(m_data.sensors[index]);
+    m_data.sensors.erase(m_data.sensors.begin() + index);
+    rebuildIndexes();
+	m_data.changedSensors.erase(sensorId);
+	m_data.removedSensors.insert(sensorId);
+	markAllChanged();
+    emit sensorRemoved(sensorId);
+
+    //refresh computed comms period as new sensors are removed
+    scheduleSensorEvents();
+    emit sensorTimeConfigChanged();
+
+	save(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void DB::removeSensorById(SensorId id)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [id](Sensor const& sensor) { return sensor.id == id; });
+    if (it != m_data.sensors.end())
+        removeSensor(std::distance(m_data.sensors.begin(), it));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findSensorIndexByName(std::string const& name) const
+{
+    return getSnapshot()->indexes->sensorsByName.find(name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findSensorIndexByName(std::string const& name) const
+{
+    return m_data.indexes.sensorsByName.find(name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findSensorIndexById(SensorId id) const
+{
+    return getSnapshot()->indexes->sensorsById.find(id);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findSensorIndexById(SensorId id) const
+{
+    return m_data.indexes.sensorsById.find(id);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findSensorIndexByAddress(SensorAddress address) const
+{
+    return getSnapshot()->indexes->sensorsByAddress.find(address);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findSensorIndexBySerialNumber(SensorSerialNumber serialNumber) const
+{
+    return getSnapshot()->indexes->sensorsBySerialNumber.find(serialNumber);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::findUnboundSensorIndex() const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    auto it = std::find_if(snapshot->sensors.begin(), snapshot->sensors.end(), [](std::shared_ptr<const Sensor> const& sensor) { return sensor->state == Sensor::State::Unbound; });
+    if (it == snapshot->sensors.end())
+        return -1;
+
+    return int32_t(std::distance(snapshot->sensors.begin(), it));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::close()
+int32_t DB::_findUnboundSensorIndex() const
 {
-	{
-		std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-		if (!m_sqlite)
-			return;
+    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [](Sensor const& sensor) { return sensor.state == Sensor::State::Unbound; });
+    if (it == m_data.sensors.end())
+        return -1;
 
-		addAsyncMeasurements();
-		if (m_saveScheduled)
-			save(true);
+    return int32_t(std::distance(m_data.sensors.begin(), it));
+}
 
-		m_saveBaseStationsStmt = nullptr;
-		m_saveSensorTimeConfigsStmt = nullptr;
-		m_saveSensorSettingsStmt = nullptr;
-		m_saveSensorsStmt = nullptr;
-		m_saveAlarmsStmt = nullptr;
-		m_saveReportsStmt = nullptr;
-		m_addMeasurementsStmt = nullptr;
-		m_sqlite = nullptr;
+//////////////////////////////////////////////////////////////////////////
 
-		m_data = Data();
-	}
-	m_emailer.reset(new Emailer(*this));
+std::optional<DB::Sensor> DB::findSensorByName(std::string const& name) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->sensorsByName.find(name);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->sensors[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-sqlite3* DB::getSqliteDB()
+std::optional<DB::Sensor> DB::findSensorById(SensorId id) const
 {
-	return m_sqlite;
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->sensorsById.find(id);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->sensors[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-const Emailer& DB::getEmailer() const
+std::optional<DB::Sensor> DB::findSensorByAddress(SensorAddress address) const
 {
-	return *m_emailer;
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->sensorsByAddress.find(address);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->sensors[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Emailer& DB::getEmailer()
+std::optional<DB::Sensor> DB::findSensorBySerialNumber(SensorSerialNumber serialNumber) const
 {
-	return *m_emailer;
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->sensorsBySerialNumber.find(serialNumber);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->sensors[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::checkRepetitiveAlarms()
+std::optional<DB::Sensor> DB::findUnboundSensor() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    auto it = std::find_if(snapshot->sensors.begin(), snapshot->sensors.end(), [](std::shared_ptr<const Sensor> const& sensor) { return sensor->state == Sensor::State::Unbound; });
+    if (it == snapshot->sensors.end())
+        return std::nullopt;
 
-	bool triggerSave = false;
-	for (Alarm& alarm : m_data.alarms)
-	{
-        if ((!alarm.triggersPerSensor.empty() || !alarm.triggersPerBaseStation.empty()) && 
-			(m_clock->now() - alarm.lastTriggeredTimePoint >= alarm.descriptor.resendPeriod))
-        {
-            emit alarmStillTriggered(alarm.id);
-            alarm.lastTriggeredTimePoint = m_clock->now();
-			m_data.alarmsChanged = true;
-			triggerSave = true;
-        }
-	}
-	if (triggerSave)
-		save(true);
+    return **it;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::checkReports()
+size_t DB::getAlarmCount() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    return getSnapshot()->alarms.size();
+}
 
-	bool triggerSave = false;
+//////////////////////////////////////////////////////////////////////////
 
-	for (Report& report: m_data.reports)
-	{
-		if (isReportTriggered(report))
-		{
-			emit reportTriggered(report.id, report.lastTriggeredTimePoint, m_clock->now());
-			report.lastTriggeredTimePoint = m_clock->now();
-			m_data.reportsChanged = true;
-			triggerSave = true;
-		}
-	}
+DB::Alarm DB::getAlarm(size_t index) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
 
-	if (triggerSave)
-		save(true);
+    Q_ASSERT(index < snapshot->alarms.size());
+    return *snapshot->alarms[index];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::checkForDisconnectedBaseStations()
+Result<void> DB::checkAlarmDescriptor(AlarmDescriptor const& descriptor) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    if (descriptor.highTemperatureWatch && descriptor.highTemperatureSoft > descriptor.highTemperatureHard)
+        return Error(QString("High temperature soft threshold (%1) is bigger than the hard threshold (%2)").arg(descriptor.highTemperatureSoft).arg(descriptor.highTemperatureHard).toUtf8().data());
+	if (descriptor.lowTemperatureWatch && descriptor.lowTemperatureSoft < descriptor.lowTemperatureHard)
+		return Error(QString("Low temperature soft threshold (%1) is smaller than the hard threshold (%2)").arg(descriptor.lowTemperatureSoft).arg(descriptor.lowTemperatureHard).toUtf8().data());
+    if (descriptor.highTemperatureWatch && descriptor.lowTemperatureWatch && descriptor.highTemperatureHard <= descriptor.lowTemperatureHard)
+		return Error(QString("High temperature threshold (%1) is smaller than the low threshold (%2)").arg(descriptor.highTemperatureHard).arg(descriptor.lowTemperatureHard).toUtf8().data());
 
-	for (BaseStation& bs: m_data.baseStations)
-	{
-		if (!bs.isConnected && m_clock->now() - bs.lastConnectedTimePoint > std::chrono::minutes(1))
-			computeBaseStationAlarmTriggers(bs);
-	}
+	if (descriptor.highHumidityWatch && descriptor.highHumiditySoft > descriptor.highHumidityHard)
+		return Error(QString("High humidity soft threshold (%1) is bigger than the hard threshold (%2)").arg(descriptor.highHumiditySoft).arg(descriptor.highHumidityHard).toUtf8().data());
+	if (descriptor.lowHumidityWatch && descriptor.lowHumiditySoft < descriptor.lowHumidityHard)
+		return Error(QString("Low humidity soft threshold (%1) is smaller than the hard threshold (%2)").arg(descriptor.lowHumiditySoft).arg(descriptor.lowHumidityHard).toUtf8().data());
+	if (descriptor.highHumidityWatch && descriptor.lowHumidityWatch && descriptor.highHumidityHard <= descriptor.lowHumidityHard)
+		return Error(QString("High humidity threshold (%1) is smaller than the low threshold (%2)").arg(descriptor.highHumidityHard).arg(descriptor.lowHumidityHard).toUtf8().data());
+
+	return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::checkForBlackoutSensors()
+Result<void> DB::addAlarm(AlarmDescriptor const& descriptor)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	bool saveSensors = false;
-	SensorTimeConfig timeConfig = getLastSensorTimeConfig();
-	IClock::duration actualCommsPeriod = computeActualCommsPeriod(timeConfig.descriptor);
+    if (_findAlarmIndexByName(descriptor.name) >= 0)
+        return Error("Name '" + descriptor.name + "' already in use");
 
-	for (Sensor& s : m_data.sensors)
-	{
-		bool wasBlackout = s.blackout;
-		if (s.state == Sensor::State::Active && m_clock->now() - s.lastCommsTimePoint > actualCommsPeriod * 1.5f)
-			s.blackout = true;
-		else
-			s.blackout = false;
+    Result<void> result = checkAlarmDescriptor(descriptor);
+    if (result != success)
+        return result;
 
-		//only send emails 2 rounds after being added to avoid slamming every time the program is started
-		if (m_clock->now() - s.addedTimePoint > actualCommsPeriod * 2)
-		{
-			if (!wasBlackout && s.blackout)
-			{
-				s.stats.commsBlackouts++;
-				saveSensors = true;
-			}
-			computeSensorAlarmTriggers(s, std::nullopt);
-		}
-	}
+    Alarm alarm;
+    alarm.descriptor = descriptor;
+    if (!alarm.descriptor.filterSensors)
+        alarm.descriptor.sensors.clear();
 
-	if (saveSensors)
-		scheduleSave();
+    alarm.id = ++m_data.lastAlarmId;
+
+    m_data.alarms.push_back(alarm);
+    indexAlarm(m_data.alarms.size() - 1);
+	m_data.changedAlarms.insert(alarm.id);
+	markAlarmChanged(alarm.id);
+    emit alarmAdded(alarm.id);
+
+    //the new alarm needs to pick up the current state of all sensors and base stations
+    scheduleSensorEvents();
+    scheduleBaseStationEvents();
+    m_measurementTriggersScheduled = true;
+
+    s_logger.logInfo(QString("Added alarm '%1'").arg(descriptor.name.c_str()));
+
+	save(true);
+
+    return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::checkMeasurementTriggers()
+Result<void> DB::setAlarm(AlarmId id, AlarmDescriptor const& descriptor)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	if (m_data.sensors.empty() || m_data.alarms.empty())
-		return;
+    int32_t _index = _findAlarmIndexByName(descriptor.name);
+    if (_index >= 0 && m_data.alarms[static_cast<size_t>(_index)].id != id)
+        return Error("Name to '" + descriptor.name + "' already in use");
 
-	bool dataChanged = false;
-	std::vector<Measurement> measurements;
-	//gathered changed triggers
-	for (Sensor& sensor : m_data.sensors)
-	{
-		if (sensor.lastConfirmedMeasurementIndex <= sensor.lastAlarmProcessesMeasurementIndex)
-		{
-			//nothing new happened
-			continue;
-		}
+    _index = _findAlarmIndexById(id);
+    if (_index < 0)
+        return Error("Trying to change non-existing alarm");
 
-		QString sql = QString("SELECT * "
-								"FROM Measurements "
-								"WHERE idx > %1 AND idx <= %2 AND sensorId = %3;").arg(sensor.lastAlarmProcessesMeasurementIndex).arg(sensor.lastConfirmedMeasurementIndex).arg(sensor.id);
-		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
-		{
-			const char* msg = sqlite3_errmsg(m_sqlite);
-			Q_ASSERT(false);
-			continue;
-		}
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	Result<void> result = checkAlarmDescriptor(descriptor);
+	if (result != success)
+		return result;
 
-		while (sqlite3_step(stmt) == SQLITE_ROW)
+	size_t index = static_cast<size_t>(_index);
+	Alarm& alarm = m_data.alarms[index];
+
+	if (descriptor.filterSensors)
+	{
+		//erase sensor triggers that are not watched
+		for (auto it = alarm.triggersPerSensor.begin(); it != alarm.triggersPerSensor.end();)
 		{
-			Measurement m = unpackMeasurement(stmt);
-			m.alarmTriggers = computeSensorAlarmTriggers(sensor, m);
-			measurements.emplace_back(m);
+			if (descriptor.sensors.find(it->first) == descriptor.sensors.end())
+				it = alarm.triggersPerSensor.erase(it);
+			else
+				++it;
 		}
-		sensor.lastAlarmProcessesMeasurementIndex = sensor.lastConfirmedMeasurementIndex;
-		dataChanged = true;
 	}
 
-	if (!measurements.empty() || dataChanged)
-	{
-        sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
-        utils::epilogue epi([this] { sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr); });
+    bool keysChanged = alarm.descriptor.name != descriptor.name;
+    alarm.descriptor = descriptor;
+    if (keysChanged)
+        rebuildIndexes();
+    else
+        rebuildSensorAlarmIndex();
+	m_data.changedAlarms.insert(alarm.id);
+	markAlarmChanged(alarm.id);
+    emit alarmChanged(id);
 
-		for (Measurement const& m : measurements)
-		{
-			QString sql = QString("UPDATE Measurements "
-								  "SET alarmTriggersCurrent = ?1, alarmTriggersAdded = ?2, alarmTriggersRemoved = ?3 "
-								  "WHERE id = ?4;");
-			sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
-			{
-				const char* msg = sqlite3_errmsg(m_sqlite);
-				Q_ASSERT(false);
-				continue;
-			}
-            utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
+    scheduleSensorEvents();
+    scheduleBaseStationEvents();
+    scheduleEvent(EventType::Alarm, id, m_clock->now());
 
-			sqlite3_bind_double(stmt, 1, m.alarmTriggers.current);
-			sqlite3_bind_double(stmt, 2, m.alarmTriggers.added);
-			sqlite3_bind_double(stmt, 3, m.alarmTriggers.removed);
-            sqlite3_bind_int64(stmt, 4, int64_t(m.id));
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				const char* msg = sqlite3_errmsg(m_sqlite);
-				Q_ASSERT(false);
-				continue;
-			}
-		}
+    s_logger.logInfo(QString("Changed alarm '%1'").arg(descriptor.name.c_str()));
 
-		m_data.sensorsChanged = true;
-		save(false);
-	}
+	save(true);
 
-	if (!measurements.empty())
-		emit measurementsChanged();
+    return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::process()
+void DB::removeAlarm(size_t index)
 {
-	addAsyncMeasurements();
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	if (m_saveScheduled)
-		save(true);
+    Q_ASSERT(index < m_data.alarms.size());
+    AlarmId id = m_data.alarms[index].id;
 
-    checkRepetitiveAlarms();
-	checkReports();
-	checkForDisconnectedBaseStations();
-	checkForBlackoutSensors();
-	checkMeasurementTriggers();
+    s_logger.logInfo(QString("Removed alarm '%1'").arg(m_data.alarms[index].descriptor.name.c_str()));
+
+    m_data.alarms.erase(m_data.alarms.begin() + index);
+    rebuildIndexes();
+	m_data.changedAlarms.erase(id);
+	m_data.removedAlarms.insert(id);
+	markAllChanged();
+    emit alarmRemoved(id);
+
+	save(true);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setGeneralSettings(GeneralSettings const& settings)
+void DB::removeAlarmById(AlarmId id)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	m_data.generalSettings = settings;
-	m_data.generalSettingsChanged = true;
-	emit generalSettingsChanged();
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [id](Alarm const& alarm) { return alarm.id == id; });
+    if (it != m_data.alarms.end())
+        removeAlarm(std::distance(m_data.alarms.begin(), it));
+}
 
-	s_logger.logInfo("Changed general settings");
+//////////////////////////////////////////////////////////////////////////
 
-	save(true);
+int32_t DB::findAlarmIndexByName(std::string const& name) const
+{
+    return getSnapshot()->indexes->alarmsByName.find(name);
+}
 
-	return true;
+//////////////////////////////////////////////////////////////////////////
+
+int32_t DB::_findAlarmIndexByName(std::string const& name) const
+{
+    return m_data.indexes.alarmsByName.find(name);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::GeneralSettings const& DB::getGeneralSettings() const
+int32_t DB::findAlarmIndexById(AlarmId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.generalSettings;
+    return getSnapshot()->indexes->alarmsById.find(id);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setCsvSettings(CsvSettings const& settings)
+int32_t DB::_findAlarmIndexById(AlarmId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	m_data.csvSettings = settings;
-	m_data.csvSettingsChanged = true;
-	emit csvSettingsChanged();
+    return m_data.indexes.alarmsById.find(id);
+}
 
-	s_logger.logInfo("Changed csv settings");
+//////////////////////////////////////////////////////////////////////////
 
-	save(true);
+std::optional<DB::Alarm> DB::findAlarmByName(std::string const& name) const
+{
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->alarmsByName.find(name);
+    if (index < 0)
+        return std::nullopt;
 
-	return true;
+    return *snapshot->alarms[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::CsvSettings const& DB::getCsvSettings() const
+std::optional<DB::Alarm> DB::findAlarmById(AlarmId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.csvSettings;
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    int32_t index = snapshot->indexes->alarmsById.find(id);
+    if (index < 0)
+        return std::nullopt;
+
+    return *snapshot->alarms[size_t(index)];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setEmailSettings(EmailSettings const& settings)
+DB::BaseStation const* DB::Snapshot::findBaseStationById(BaseStationId id) const
 {
-	if (settings.sender.empty())
-		return false;
-	if (settings.username.empty())
-		return false;
-	if (settings.password.empty())
-		return false;
-	if (settings.host.empty())
-		return false;
-	if (settings.port == 0)
-		return false;
+    int32_t index = indexes->baseStationsById.find(id);
+    return index >= 0 ? baseStations[size_t(index)].get() : nullptr;
+}
 
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	m_data.emailSettings = settings;
-	m_data.emailSettingsChanged = true;
-	emit emailSettingsChanged();
+//////////////////////////////////////////////////////////////////////////
 
-	s_logger.logInfo("Changed email settings");
+DB::BaseStation const* DB::Snapshot::findBaseStationByMac(BaseStationDescriptor::Mac const& mac) const
+{
+    int32_t index = indexes->baseStationsByMac.find(mac);
+    return index >= 0 ? baseStations[size_t(index)].get() : nullptr;
+}
 
-	save(true);
+//////////////////////////////////////////////////////////////////////////
 
-	return true;
+DB::Sensor const* DB::Snapshot::findSensorById(SensorId id) const
+{
+    int32_t index = indexes->sensorsById.find(id);
+    return index >= 0 ? sensors[size_t(index)].get() : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::Sensor const* DB::Snapshot::findSensorByAddress(SensorAddress address) const
+{
+    int32_t index = indexes->sensorsByAddress.find(address);
+    return index >= 0 ? sensors[size_t(index)].get() : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::Alarm const* DB::Snapshot::findAlarmById(AlarmId id) const
+{
+    int32_t index = indexes->alarmsById.find(id);
+    return index >= 0 ? alarms[size_t(index)].get() : nullptr;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::EmailSettings const& DB::getEmailSettings() const
+std::shared_ptr<const DB::Snapshot> DB::getSnapshot() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.emailSettings;
+    //The changes are published by the thread making them, before it releases the data. The other threads get the
+    //previous snapshot until then, the thread itself sees them right away (a slot called by an emit)
+    if (m_snapshotPending && m_dataMutex.isLockedByThisThread())
+        publishSnapshot();
+    return std::atomic_load(&m_snapshot);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setFtpSettings(FtpSettings const& settings)
+void DB::DataMutex::lock()
 {
-	if (settings.username.empty())
-		return false;
-	if (settings.password.empty())
-		return false;
-	if (settings.host.empty())
-		return false;
-	if (settings.port == 0)
-		return false;
+    m_mutex.lock();
+    if (m_depth++ == 0)
+        m_owner = std::this_thread::get_id();
+}
 
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	m_data.ftpSettings = settings;
-	m_data.ftpSettingsChanged = true;
-	emit ftpSettingsChanged();
+//////////////////////////////////////////////////////////////////////////
 
-	s_logger.logInfo("Changed ftp settings");
+bool DB::DataMutex::try_lock()
+{
+    if (!m_mutex.try_lock())
+        return false;
+    if (m_depth++ == 0)
+        m_owner = std::this_thread::get_id();
+    return true;
+}
 
-	save(true);
+//////////////////////////////////////////////////////////////////////////
 
-	return true;
+void DB::DataMutex::unlock()
+{
+    //publishing locks it again, the depth is 2 meanwhile
+    if (m_depth == 1 && m_db.m_snapshotPending)
+        m_db.publishSnapshot();
+    if (--m_depth == 0)
+        m_owner = std::thread::id();
+    m_mutex.unlock();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::FtpSettings const& DB::getFtpSettings() const
+void DB::markBaseStationChanged(BaseStationId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.ftpSettings;
+    m_snapshotChanges.baseStations.insert(id);
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getUserCount() const
+void DB::markSensorChanged(SensorId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.users.size();
+    m_snapshotChanges.sensors.insert(id);
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::User DB::getUser(size_t index) const
+void DB::markAlarmChanged(AlarmId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	assert(index < m_data.users.size());
-	return m_data.users[index];
+    m_snapshotChanges.alarms.insert(id);
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::addUser(UserDescriptor const& descriptor)
+void DB::markAllChanged() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	if (findUserIndexByName(descriptor.name) >= 0)
-		return false;
-
-	User user;
-	user.descriptor = descriptor;
-	user.id = ++m_data.lastUserId;
+    m_snapshotChanges.all = true;
+    m_snapshotPending = true;
+}
 
-	m_data.users.push_back(user);
-	m_data.usersAddedOrRemoved = true;
-	emit userAdded(user.id);
+//////////////////////////////////////////////////////////////////////////
 
-	s_logger.logInfo(QString("Added user '%1'").arg(descriptor.name.c_str()));
+void DB::rebuildIndexes()
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	save(true);
+    Indexes& indexes = m_data.indexes;
+    indexes.baseStationsById.rebuild(m_data.baseStations, [](BaseStation const& bs) { return bs.id; });
+    indexes.baseStationsByMac.rebuild(m_data.baseStations, [](BaseStation const& bs) { return bs.descriptor.mac; });
+    indexes.baseStationsByName.rebuild(m_data.baseStations, [](BaseStation const& bs) { return bs.descriptor.name; });
+    indexes.sensorsById.rebuild(m_data.sensors, [](Sensor const& sensor) { return sensor.id; });
+    indexes.sensorsByAddress.rebuild(m_data.sensors, [](Sensor const& sensor) { return sensor.address; });
+    indexes.sensorsBySerialNumber.rebuild(m_data.sensors, [](Sensor const& sensor) { return sensor.serialNumber; });
+    indexes.sensorsByName.rebuild(m_data.sensors, [](Sensor const& sensor) { return sensor.descriptor.name; });
+    indexes.alarmsById.rebuild(m_data.alarms, [](Alarm const& alarm) { return alarm.id; });
+    indexes.alarmsByName.rebuild(m_data.alarms, [](Alarm const& alarm) { return alarm.descriptor.name; });
+    m_data.usersById.rebuild(m_data.users, [](User const& user) { return user.id; });
+    m_data.usersByName.rebuild(m_data.users, [](User const& user) { return getUserNameKey(user.descriptor.name); });
+    m_data.usersByPasswordHash.rebuild(m_data.users, [](User const& user) { return user.descriptor.passwordHash; });
+    rebuildSensorAlarmIndex();
 
-	return true;
+    m_snapshotChanges.indexes = true;
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setUser(UserId id, UserDescriptor const& descriptor)
+void DB::rebuildSensorAlarmIndex()
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	int32_t index = findUserIndexByName(descriptor.name);
-	if (index >= 0 && getUser(static_cast<size_t>(index)).id != id)
-		return Error(QString("Cannot find user '%1'").arg(descriptor.name.c_str()).toUtf8().data());
-
-	index = findUserIndexById(id);
-	if (index < 0)
-		return Error(QString("Cannot find user '%1' (internal inconsistency)").arg(descriptor.name.c_str()).toUtf8().data());
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    m_sensorAlarmIndex->rebuild(m_data.alarms, m_data.sensors, m_data.sensorSettings);
+}
 
-	User& user = m_data.users[static_cast<size_t>(index)];
+//////////////////////////////////////////////////////////////////////////
 
-    std::optional<DB::User> loggedInUser = findUserById(m_data.loggedInUserId);
-    if (loggedInUser.has_value())
-	{
-        if (loggedInUser->descriptor.type != UserDescriptor::Type::Admin)
-		{
-            if (user.descriptor.permissions != descriptor.permissions &&
-                (loggedInUser->descriptor.permissions & UserDescriptor::PermissionChangeUsers) == 0)
-				return Error(QString("No permission to change permissions").toUtf8().data());
+void DB::indexBaseStation(size_t index)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-			//check that the user is not adding too many permissions
-            uint32_t diff = loggedInUser->descriptor.permissions ^ descriptor.permissions;
-            if ((diff & loggedInUser->descriptor.permissions) != diff)
-				return Error(QString("Permission escalation between users is not allowed").toUtf8().data());
+    BaseStation const& bs = m_data.baseStations[index];
+    m_data.indexes.baseStationsById.insert(bs.id, uint32_t(index));
+    m_data.indexes.baseStationsByMac.insert(bs.descriptor.mac, uint32_t(index));
+    m_data.indexes.baseStationsByName.insert(bs.descriptor.name, uint32_t(index));
 
-            if (loggedInUser->descriptor.type != UserDescriptor::Type::Admin && user.descriptor.type == UserDescriptor::Type::Admin)
-				return Error(QString("Cannot change admin user").toUtf8().data());
-		}
-	}
+    m_snapshotChanges.indexes = true;
+    m_snapshotPending = true;
+}
 
-	user.descriptor = descriptor;
-	m_data.usersChanged = true;
-	emit userChanged(id);
+//////////////////////////////////////////////////////////////////////////
 
-	s_logger.logInfo(QString("Changed user '%1'").arg(descriptor.name.c_str()));
+void DB::indexSensor(size_t index)
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	save(true);
+    Sensor const& sensor = m_data.sensors[index];
+    m_data.indexes.sensorsById.insert(sensor.id, uint32_t(index));
+    m_data.indexes.sensorsByAddress.insert(sensor.address, uint32_t(index));
+    m_data.indexes.sensorsBySerialNumber.insert(sensor.serialNumber, uint32_t(index));
+    m_data.indexes.sensorsByName.insert(sensor.descriptor.name, uint32_t(index));
+    if (index + 1 == m_data.sensors.size())
+        m_sensorAlarmIndex->addSensor(m_data.alarms, m_data.sensors, m_data.sensorSettings);
+    else
+        rebuildSensorAlarmIndex();
 
-	return success;
+    m_snapshotChanges.indexes = true;
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeUser(size_t index)
+void DB::indexAlarm(size_t index)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	assert(index < m_data.users.size());
-	UserId id = m_data.users[index].id;
-
-	s_logger.logInfo(QString("Removed user '%1'").arg(m_data.users[index].descriptor.name.c_str()));
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	m_data.users.erase(m_data.users.begin() + index);
-	m_data.usersAddedOrRemoved = true;
-	emit userRemoved(id);
+    Alarm const& alarm = m_data.alarms[index];
+    m_data.indexes.alarmsById.insert(alarm.id, uint32_t(index));
+    m_data.indexes.alarmsByName.insert(alarm.descriptor.name, uint32_t(index));
+    if (index + 1 == m_data.alarms.size())
+        m_sensorAlarmIndex->addAlarm(m_data.alarms, m_data.sensors, m_data.sensorSettings);
+    else
+        rebuildSensorAlarmIndex();
 
-	save(true);
+    m_snapshotChanges.indexes = true;
+    m_snapshotPending = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeUserById(UserId id)
+void DB::indexUser(size_t index)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [id](User const& user) { return user.id == id; });
-    if (it != m_data.users.end())
-        removeUser(std::distance(m_data.users.begin(), it));
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    User const& user = m_data.users[index];
+    m_data.usersById.insert(user.id, uint32_t(index));
+    m_data.usersByName.insert(getUserNameKey(user.descriptor.name), uint32_t(index));
+    m_data.usersByPasswordHash.insert(user.descriptor.passwordHash, uint32_t(index));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findUserIndexByName(std::string const& name) const
+template<typename T> static T const& getIndexedEntry(T const& entry) { return entry; }
+template<typename T> static T const& getIndexedEntry(std::shared_ptr<const T> const& entry) { return *entry; }
+
+//Every entry has to be found at its own position or at an earlier one with the same key,
+//and the index cannot have more keys than the first entries of each key
+template<typename Entries, typename Key, typename Hash, typename KeyFunc>
+static Result<void> checkIndex(char const* name, HashIndex<Key, Hash> const& index, Entries const& entries, KeyFunc keyFunc)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [&name](User const& user)
-	{
-		return strcasecmp(user.descriptor.name.c_str(), name.c_str()) == 0;
-	});
+    size_t firstCount = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Key key = keyFunc(getIndexedEntry(entries[i]));
+        int32_t found = index.find(key);
+        if (found < 0 || size_t(found) > i || !(keyFunc(getIndexedEntry(entries[size_t(found)])) == key))
+            return Error(QString("Index %1 doesn't find entry %2").arg(name).arg(i).toUtf8().data());
+        if (size_t(found) == i)
+            firstCount++;
+    }
+    if (firstCount != index.size())
+        return Error(QString("Index %1 has %2 keys for %3 entries").arg(name).arg(index.size()).arg(firstCount).toUtf8().data());
+    return success;
+}
 
-	if (it == m_data.users.end())
-		return -1;
+//////////////////////////////////////////////////////////////////////////
 
-	return int32_t(std::distance(m_data.users.begin(), it));
+template<typename BaseStations, typename Sensors, typename Alarms>
+static Result<void> checkEntityIndexes(DB::Indexes const& indexes, BaseStations const& baseStations, Sensors const& sensors, Alarms const& alarms)
+{
+    Result<void> result = checkIndex("baseStationsById", indexes.baseStationsById, baseStations, [](DB::BaseStation const& bs) { return bs.id; });
+    if (result == success)
+        result = checkIndex("baseStationsByMac", indexes.baseStationsByMac, baseStations, [](DB::BaseStation const& bs) { return bs.descriptor.mac; });
+    if (result == success)
+        result = checkIndex("baseStationsByName", indexes.baseStationsByName, baseStations, [](DB::BaseStation const& bs) { return bs.descriptor.name; });
+    if (result == success)
+        result = checkIndex("sensorsById", indexes.sensorsById, sensors, [](DB::Sensor const& sensor) { return sensor.id; });
+    if (result == success)
+        result = checkIndex("sensorsByAddress", indexes.sensorsByAddress, sensors, [](DB::Sensor const& sensor) { return sensor.address; });
+    if (result == success)
+        result = checkIndex("sensorsBySerialNumber", indexes.sensorsBySerialNumber, sensors, [](DB::Sensor const& sensor) { return sensor.serialNumber; });
+    if (result == success)
+        result = checkIndex("sensorsByName", indexes.sensorsByName, sensors, [](DB::Sensor const& sensor) { return sensor.descriptor.name; });
+    if (result == success)
+        result = checkIndex("alarmsById", indexes.alarmsById, alarms, [](DB::Alarm const& alarm) { return alarm.id; });
+    if (result == success)
+        result = checkIndex("alarmsByName", indexes.alarmsByName, alarms, [](DB::Alarm const& alarm) { return alarm.descriptor.name; });
+    return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findUserIndexById(UserId id) const
+Result<void> DB::checkIndexes() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [id](User const& user) { return user.id == id; });
-	if (it == m_data.users.end())
-		return -1;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    Result<void> result = checkEntityIndexes(m_data.indexes, m_data.baseStations, m_data.sensors, m_data.alarms);
+    if (result != success)
+        return Error("Data: " + result.error().what());
+
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    result = checkEntityIndexes(*snapshot->indexes, snapshot->baseStations, snapshot->sensors, snapshot->alarms);
+    if (result != success)
+        return Error("Snapshot: " + result.error().what());
 
-	return int32_t(std::distance(m_data.users.begin(), it));
+    result = checkIndex("usersById", m_data.usersById, m_data.users, [](User const& user) { return user.id; });
+    if (result == success)
+        result = checkIndex("usersByName", m_data.usersByName, m_data.users, [](User const& user) { return getUserNameKey(user.descriptor.name); });
+    if (result == success)
+        result = checkIndex("usersByPasswordHash", m_data.usersByPasswordHash, m_data.users, [](User const& user) { return user.descriptor.passwordHash; });
+    return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findUserIndexByPasswordHash(std::string const& passwordHash) const
+void DB::publishSnapshot() const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [&passwordHash](User const& user) { return user.descriptor.passwordHash == passwordHash; });
-	if (it == m_data.users.end())
-		return -1;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	return int32_t(std::distance(m_data.users.begin(), it));
+    std::shared_ptr<const Snapshot> snapshot = buildSnapshot(m_snapshotChanges.all ? nullptr : m_snapshot.get());
+    std::atomic_store(&m_snapshot, std::move(snapshot));
+    m_snapshotChanges = SnapshotChanges();
+    m_snapshotPending = false;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::User> DB::findUserByName(std::string const& name) const
+template<typename T, typename Id, typename Hash>
+static void buildSnapshotEntries(DB::SnapshotEntries<T>& dst, std::vector<T> const& src, HashIndex<Id, Hash> const& byId,
+                                 DB::SnapshotEntries<T> const* previous, std::set<Id> const& changed)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [&name](User const& user)
+    using Page = typename DB::SnapshotEntries<T>::Page;
+    constexpr size_t k_pageSize = DB::SnapshotEntries<T>::k_pageSize;
+
+    //the entries only move when one is removed, and then everything is rebuilt. So the pages without changes are shared as they are
+    std::set<size_t> changedPages;
+    for (Id id : changed)
     {
-        return strcasecmp(user.descriptor.name.c_str(), name.c_str()) == 0;
-    });
-    if (it == m_data.users.end())
-        return std::nullopt;
+        int32_t index = byId.find(id);
+        if (index >= 0)
+            changedPages.insert(size_t(index) / k_pageSize);
+    }
+
+    dst.count = src.size();
+    dst.pages.reserve((src.size() + k_pageSize - 1) / k_pageSize);
+    for (size_t begin = 0; begin < src.size(); begin += k_pageSize)
+    {
+        size_t end = std::min(begin + k_pageSize, src.size());
+        Page const* previousPage = previous && begin / k_pageSize < previous->pages.size() ? previous->pages[begin / k_pageSize].get() : nullptr;
+        if (previousPage && previousPage->size() == end - begin && changedPages.count(begin / k_pageSize) == 0)
+        {
+            dst.pages.push_back(previous->pages[begin / k_pageSize]);
+            continue;
+        }
 
-	return *it;
+        std::shared_ptr<Page> page = std::make_shared<Page>();
+        page->reserve(end - begin);
+        for (size_t i = begin; i < end; i++)
+        {
+            //an unchanged entry is shared while it's at the same position
+            if (previousPage && i - begin < previousPage->size() && (*previousPage)[i - begin]->id == src[i].id && changed.count(src[i].id) == 0)
+                page->push_back((*previousPage)[i - begin]);
+            else
+                page->push_back(std::make_shared<const T>(src[i]));
+        }
+        dst.pages.push_back(std::move(page));
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::User> DB::findUserById(UserId id) const
+std::shared_ptr<const DB::Snapshot> DB::buildSnapshot(Snapshot const* previous) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [id](User const& user) { return user.id == id; });
-    if (it == m_data.users.end())
-        return std::nullopt;
-
-	return *it;
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+    buildSnapshotEntries(snapshot->baseStations, m_data.baseStations, m_data.indexes.baseStationsById, previous ? &previous->baseStations : nullptr, m_snapshotChanges.baseStations);
+    buildSnapshotEntries(snapshot->sensors, m_data.sensors, m_data.indexes.sensorsById, previous ? &previous->sensors : nullptr, m_snapshotChanges.sensors);
+    buildSnapshotEntries(snapshot->alarms, m_data.alarms, m_data.indexes.alarmsById, previous ? &previous->alarms : nullptr, m_snapshotChanges.alarms);
+    snapshot->indexes = previous && !m_snapshotChanges.indexes ? previous->indexes : std::make_shared<const Indexes>(m_data.indexes);
+    return snapshot;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::User> DB::findUserByPasswordHash(std::string const& passwordHash) const
+DB::AlarmTriggers DB::computeSensorAlarmTriggers(Sensor& sensor, std::optional<Measurement> measurement)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [&passwordHash](User const& user) { return user.descriptor.passwordHash == passwordHash; });
-    if (it == m_data.users.end())
-        return std::nullopt;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	return *it;
+	AlarmTriggers allTriggers;
+
+	int32_t sensorSlot = _findSensorIndexById(sensor.id);
+	if (sensorSlot < 0)
+		return allTriggers;
+
+	//only the alarms that apply to the sensor. By position and copied, they can change while their triggers are published
+	for (size_t i = 0; i < m_sensorAlarmIndex->getSensorAlarms(size_t(sensorSlot)).size(); i++)
+    {
+		alarms::SensorAlarm sa = m_sensorAlarmIndex->getSensorAlarms(size_t(sensorSlot))[i];
+		AlarmTriggers triggers = _computeSensorAlarmTriggers(sa, size_t(sensorSlot), measurement);
+        allTriggers |= triggers;
+    }
+
+    return allTriggers;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::needsAdmin() const
+DB::AlarmTriggers DB::_computeSensorAlarmTriggers(alarms::SensorAlarm const& sensorAlarm, size_t sensorSlot, std::optional<Measurement> measurement)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	auto it = std::find_if(m_data.users.begin(), m_data.users.end(), [](User const& user) { return user.descriptor.type == UserDescriptor::Type::Admin; });
-	if (it == m_data.users.end())
-		return true;
-	
-	return false;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	uint32_t oldTriggers = m_sensorAlarmIndex->getTriggers(sensorAlarm.alarmSlot, sensorSlot);
+	uint32_t sensorTriggers = m_data.sensors[sensorSlot].blackout ? sensorAlarm.blackoutTriggers : 0;
+
+	uint32_t currentTriggers = 0;
+	if (measurement.has_value())
+	{
+		alarms::Plan plan = sensorAlarm.plan;
+		plan.sensorTriggers = sensorTriggers;
+		alarms::MeasurementBlock block;
+		block.add(measurement->descriptor);
+		AlarmTriggers triggers;
+		currentTriggers = alarms::evaluate(plan, block, oldTriggers, &triggers);
+	}
+	else if (sensorAlarm.watched) //keep measurement triggers
+		currentTriggers = (oldTriggers & AlarmTrigger::MeasurementMask) | sensorTriggers;
+
+	return setSensorAlarmTriggers(sensorAlarm.alarmSlot, sensorSlot, measurement, oldTriggers, currentTriggers);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::setLoggedInUserId(UserId id)
+void DB::computeSensorAlarmTriggers(Sensor& sensor, std::vector<Measurement>& measurements)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    std::optional<DB::User> user = findUserById(id);
-    if (user.has_value())
-	{
-        s_logger.logInfo(QString("User '%1' logged in").arg(user->descriptor.name.c_str()));
-		m_data.loggedInUserId = id;
-		emit userLoggedIn(id);
-	}
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	for (Measurement& m : measurements)
+		m.alarmTriggers = AlarmTriggers();
+
+	SensorAlarmTriggers sensorTriggers;
+	if (measurements.empty() || !beginSensorAlarmTriggers(sensor, sensorTriggers))
+		return;
+	evaluateSensorAlarmTriggers(sensorTriggers, measurements);
+	publishSensorAlarmTriggers(sensorTriggers, measurements, measurements.size() - 1);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::UserId DB::getLoggedInUserId() const
+bool DB::beginSensorAlarmTriggers(Sensor const& sensor, SensorAlarmTriggers& sensorTriggers)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.loggedInUserId;
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	int32_t sensorSlot = _findSensorIndexById(sensor.id);
+	if (sensorSlot < 0)
+		return false;
+
+	sensorTriggers.sensorSlot = size_t(sensorSlot);
+	sensorTriggers.sensorAlarms = m_sensorAlarmIndex->getSensorAlarms(sensorTriggers.sensorSlot);
+	sensorTriggers.alarmTriggers.clear();
+	for (alarms::SensorAlarm& sa : sensorTriggers.sensorAlarms)
+	{
+		sa.plan.sensorTriggers = sensor.blackout ? sa.blackoutTriggers : 0;
+		sensorTriggers.alarmTriggers.push_back(m_sensorAlarmIndex->getTriggers(sa.alarmSlot, sensorTriggers.sensorSlot));
+	}
+	sensorTriggers.changes.clear();
+	sensorTriggers.nextChange = 0;
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::User> DB::getLoggedInUser() const
+void DB::evaluateSensorAlarmTriggers(SensorAlarmTriggers& sensorTriggers, std::vector<Measurement>& measurements)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    std::optional<DB::User> user = findUserById(m_data.loggedInUserId);
-    if (user.has_value())
-        return std::move(*user);
+	//the changes not published yet are dropped
+	sensorTriggers.changes.clear();
+	sensorTriggers.nextChange = 0;
 
-	return std::nullopt;
+	for (Measurement& m : measurements)
+		m.alarmTriggers = AlarmTriggers();
+
+	size_t alarmCount = sensorTriggers.sensorAlarms.size();
+	if (alarmCount == 0)
+		return;
+
+	//a block at a time, so the triggers of all the alarms stay small
+	alarms::MeasurementBlock block;
+	std::vector<AlarmTriggers> triggers;
+	for (size_t start = 0; start < measurements.size(); start += ALARM_TRIGGERS_BLOCK_SIZE)
+	{
+		size_t count = std::min(ALARM_TRIGGERS_BLOCK_SIZE, measurements.size() - start);
+		block.clear();
+		for (size_t i = 0; i < count; i++)
+			block.add(measurements[start + i].descriptor);
+
+		triggers.resize(count * alarmCount);
+		for (size_t a = 0; a < alarmCount; a++)
+			alarms::evaluate(sensorTriggers.sensorAlarms[a].plan, block, sensorTriggers.alarmTriggers[a], triggers.data() + a * count);
+
+		//the changes are kept in the order of the measurements, like the emails
+		for (size_t i = 0; i < count; i++)
+		{
+			Measurement& m = measurements[start + i];
+			for (size_t a = 0; a < alarmCount; a++)
+			{
+				AlarmTriggers const& t = triggers[a * count + i];
+				m.alarmTriggers |= t;
+				if (t.current != sensorTriggers.alarmTriggers[a])
+				{
+					sensorTriggers.changes.push_back({ start + i, a, sensorTriggers.alarmTriggers[a], t.current });
+					sensorTriggers.alarmTriggers[a] = t.current;
+				}
+			}
+		}
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::isLoggedInAsAdmin() const
+void DB::publishSensorAlarmTriggers(SensorAlarmTriggers& sensorTriggers, std::vector<Measurement> const& measurements, size_t position)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    std::optional<DB::User> user = findUserById(m_data.loggedInUserId);
-    if (user.has_value())
-        return user->descriptor.type == UserDescriptor::Type::Admin;
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	return false;
+	//the changes up to and including the measurement at the position
+	for (; sensorTriggers.nextChange < sensorTriggers.changes.size(); sensorTriggers.nextChange++)
+	{
+		SensorAlarmTriggers::Change const& change = sensorTriggers.changes[sensorTriggers.nextChange];
+		if (change.position > position)
+			break;
+		setSensorAlarmTriggers(sensorTriggers.sensorAlarms[change.alarm].alarmSlot, sensorTriggers.sensorSlot, measurements[change.position],
+							   change.oldTriggers, change.currentTriggers);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensorSettings(SensorSettings const& settings)
+DB::AlarmTriggers DB::setSensorAlarmTriggers(size_t alarmSlot, size_t sensorSlot, std::optional<Measurement> const& measurement, uint32_t oldTriggers, uint32_t currentTriggers)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	if (settings.radioPower < -3 || settings.radioPower > 20)
-		return Error("Invalid radio power value");
-	if (settings.retries < 1 || settings.retries > 10)
-		return Error("Invalid number of retries");
-	if (settings.alertBatteryLevel < 0.f || settings.alertBatteryLevel >= 1.f)
-		return Error("Invalid alert battery level");
-	if (settings.alertSignalStrengthLevel < 0.f || settings.alertSignalStrengthLevel >= 1.f)
-		return Error("Invalid alert signal strength level");
+	Alarm& alarm = m_data.alarms[alarmSlot];
+	Sensor const& sensor = m_data.sensors[sensorSlot];
+    if (currentTriggers != oldTriggers)
+    {
+		m_sensorAlarmIndex->setTriggers(alarmSlot, sensorSlot, currentTriggers);
+        if (currentTriggers == 0)
+            alarm.triggersPerSensor.erase(sensor.id);
+        else
+            alarm.triggersPerSensor[sensor.id] = currentTriggers;
 
-	m_data.sensorSettings = settings;
-	m_data.sensorSettingsChanged = true;
-	emit sensorSettingsChanged();
+		m_data.changedAlarms.insert(alarm.id);
+		markAlarmChanged(alarm.id);
+    }
 
-	s_logger.logInfo("Changed sensor settings");
+	AlarmTriggers triggers;
+	triggers.current = currentTriggers;
 
-	save(true);
+    uint32_t diff = oldTriggers ^ currentTriggers;
+    if (diff != 0)
+    {
+		triggers.removed = diff & oldTriggers;
+		triggers.added = diff & currentTriggers;
 
-	return success;
-}
+        s_logger.logInfo(QString("Alarm '%1' triggers for measurement index %2 have changed: old %3, new %4, added %5, removed %6")
+                         .arg(alarm.descriptor.name.c_str())
+                         .arg(measurement.has_value() ? std::to_string(measurement->descriptor.index).c_str() : "N/A")
+                         .arg(oldTriggers)
+                         .arg(currentTriggers)
+                         .arg(triggers.added)
+                         .arg(triggers.removed));
 
-//////////////////////////////////////////////////////////////////////////
+		alarm.lastTriggeredTimePoint = m_clock->now();
+		scheduleEvent(EventType::Alarm, alarm.id, alarm.lastTriggeredTimePoint + alarm.descriptor.resendPeriod);
+        emit alarmSensorTriggersChanged(alarm.id, sensor.id, measurement, oldTriggers, triggers);
+    }
 
-DB::SensorSettings DB::getSensorSettings() const
-{
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.sensorSettings;
+    return triggers;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
-IClock::duration DB::computeActualCommsPeriod(SensorTimeConfigDescriptor const& config) const
+DB::AlarmTriggers DB::computeBaseStationAlarmTriggers(BaseStation const& bs)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	IClock::duration maxPeriod = m_data.sensors.size() * COMMS_DURATION;
-	IClock::duration period = std::max(config.commsPeriod, maxPeriod);
-    return std::max(period, config.measurementPeriod);
+	AlarmTriggers allTriggers;
+
+	for (Alarm& alarm : m_data.alarms)
+	{
+		AlarmTriggers triggers = _computeBaseStationAlarmTriggers(alarm, bs);
+		allTriggers |= triggers;
+	}
+
+	return allTriggers;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
-IClock::time_point DB::computeNextMeasurementTimePoint(Sensor const& sensor) const
+DB::AlarmTriggers DB::_computeBaseStationAlarmTriggers(Alarm& alarm, BaseStation const& bs)
 {
-    uint32_t nextMeasurementIndex = computeNextMeasurementIndex(sensor);
-    SensorTimeConfig config = findSensorTimeConfigForMeasurementIndex(nextMeasurementIndex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    uint32_t index = nextMeasurementIndex >= config.baselineMeasurementIndex ? nextMeasurementIndex - config.baselineMeasurementIndex : 0;
-	IClock::time_point tp = config.baselineMeasurementTimePoint + config.descriptor.measurementPeriod * index;
-    return tp;
-}
+	uint32_t currentTriggers = 0;
 
-///////////////////////////////////////////////////////////////////////////////////////////
+	AlarmDescriptor const& ad = alarm.descriptor;
+	if (ad.baseStationDisconnectedWatch && !bs.isConnected)
+		currentTriggers |= AlarmTrigger::BaseStationDisconnected;
 
-IClock::time_point DB::computeNextCommsTimePoint(Sensor const& /*sensor*/, size_t sensorIndex) const
-{
-    SensorTimeConfig config = getLastSensorTimeConfig();
-	IClock::duration period = computeActualCommsPeriod(config.descriptor);
+	uint32_t oldTriggers = 0;
+	auto it = alarm.triggersPerBaseStation.find(bs.id);
+	if (it != alarm.triggersPerBaseStation.end())
+		oldTriggers = it->second;
 
-	IClock::time_point now = m_clock->now();
-    uint32_t index = static_cast<uint32_t>(std::ceil(((now - config.baselineMeasurementTimePoint) / period))) + 1;
+	if (currentTriggers != oldTriggers)
+	{
+		if (currentTriggers == 0)
+			alarm.triggersPerBaseStation.erase(bs.id);
+		else
+			alarm.triggersPerBaseStation[bs.id] = currentTriggers;
 
-	IClock::time_point start = config.baselineMeasurementTimePoint + period * index;
-    return start + sensorIndex * COMMS_DURATION;
-}
+		m_data.changedAlarms.insert(alarm.id);
+		markAlarmChanged(alarm.id);
+	}
 
-///////////////////////////////////////////////////////////////////////////////////////////
+	AlarmTriggers triggers;
+	triggers.current = currentTriggers;
 
-uint32_t DB::computeNextMeasurementIndex(Sensor const& sensor) const
-{
-    uint32_t nextSensorMeasurementIndex = sensor.firstStoredMeasurementIndex + sensor.storedMeasurementCount;
+	uint32_t diff = oldTriggers ^ currentTriggers;
+	if (diff != 0)
+	{
+		triggers.removed = diff & oldTriggers;
+		triggers.added = diff & currentTriggers;
 
-    //make sure the next measurement index doesn't fall below the last non-sleeping config
-    //next_sensor_measurement_index = std::max(next_sensor_measurement_index, compute_baseline_measurement_index());
+		s_logger.logInfo(QString("Alarm '%1' triggers for base station %2 have changed: old %3, new %4, added %5, removed %6")
+						 .arg(ad.name.c_str())
+						 .arg(bs.id)
+						 .arg(oldTriggers)
+						 .arg(currentTriggers)
+						 .arg(triggers.added)
+						 .arg(triggers.removed));
 
-    return nextSensorMeasurementIndex;
+		alarm.lastTriggeredTimePoint = m_clock->now();
+		scheduleEvent(EventType::Alarm, alarm.id, alarm.lastTriggeredTimePoint + ad.resendPeriod);
+		emit alarmBaseStationTriggersChanged(alarm.id, bs.id, oldTriggers, triggers);
+	}
+
+	return triggers;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getBaseStationCount() const
+size_t DB::getReportCount() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    return m_data.baseStations.size();
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+    return m_data.reports.size();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::BaseStation DB::getBaseStation(size_t index) const
+DB::Report DB::getReport(size_t index) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    Q_ASSERT(index < m_data.baseStations.size());
-    return m_data.baseStations[index];
+    Q_ASSERT(index < m_data.reports.size());
+    return m_data.reports[index];
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::addBaseStation(BaseStationDescriptor const& descriptor)
+Result<void> DB::addReport(ReportDescriptor const& descriptor)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    if (findBaseStationIndexByName(descriptor.name) >= 0)
-        return false;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    if (findBaseStationIndexByMac(descriptor.mac) >= 0)
-        return false;
+    if (findReportIndexByName(descriptor.name) >= 0)
+        return Error("Name '" + descriptor.name + "' already in use");
 
-    BaseStationDescriptor::Mac const& mac = descriptor.mac;
-    char macStr[128];
-    sprintf(macStr, "%X_%X_%X_%X_%X_%X", mac[0]&0xFF, mac[1]&0xFF, mac[2]&0xFF, mac[3]&0xFF, mac[4]&0xFF, mac[5]&0xFF);
+    Report report;
+    report.descriptor = descriptor;
+    if (!report.descriptor.filterSensors)
+        report.descriptor.sensors.clear();
 
-    s_logger.logInfo(QString("Adding base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
+    report.id = ++m_data.lastReportId;
 
-    BaseStation baseStation;
-	baseStation.lastConnectedTimePoint = m_clock->now();
-    baseStation.descriptor = descriptor;
-    baseStation.id = ++m_data.lastBaseStationId;
+    m_data.reports.push_back(report);
+	m_data.changedReports.insert(report.id);
+    scheduleEvent(EventType::Report, report.id, m_clock->now());
+    emit reportAdded(report.id);
 
-    m_data.baseStations.push_back(baseStation);
-	m_data.baseStationsAddedOrRemoved = true;
-    emit baseStationAdded(baseStation.id);
+    s_logger.logInfo(QString("Added report '%1'").arg(descriptor.name.c_str()));
 
 	save(true);
 
-    return true;
+    return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setBaseStation(BaseStationId id, BaseStationDescriptor const& descriptor)
+Result<void> DB::setReport(ReportId id, ReportDescriptor const& descriptor)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    std::optional<DB::BaseStation> bs = findBaseStationByName(descriptor.name);
-    if (bs.has_value() && bs->id != id)
-        return false;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    bs = findBaseStationByMac(descriptor.mac);
-    if (bs.has_value() && bs->id != id)
-        return false;
+    int32_t _index = findReportIndexByName(descriptor.name);
+    if (_index >= 0 && getReport(static_cast<size_t>(_index)).id != id)
+        return Error("Name to '" + descriptor.name + "' already in use");
 
-    int32_t _index = findBaseStationIndexById(id);
+    _index = findReportIndexById(id);
     if (_index < 0)
-        return false;
+        return Error("Trying to change non-existing report");
 
     size_t index = static_cast<size_t>(_index);
+    m_data.reports[index].descriptor = descriptor;
+	m_data.changedReports.insert(id);
+    scheduleEvent(EventType::Report, id, m_clock->now());
+    emit reportChanged(id);
 
-    s_logger.logInfo(QString("Changing base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
-
-    m_data.baseStations[index].descriptor = descriptor;
-	m_data.baseStationsChanged = true;
-    emit baseStationChanged(id);
+    s_logger.logInfo(QString("Changed report '%1'").arg(descriptor.name.c_str()));
 
-	save(true);
+    save(true);
 
-    return true;
+    return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::setBaseStationConnected(BaseStationId id, bool connected)
+void DB::removeReport(size_t index)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	int32_t _index = findBaseStationIndexById(id);
-	if (_index < 0)
-	{
-		Q_ASSERT(false);
-		return;
-	}
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	size_t index = static_cast<size_t>(_index);
-
-	BaseStation& bs = m_data.baseStations[index];
-	if (bs.isConnected == connected)
-		return;
+    Q_ASSERT(index < m_data.reports.size());
+    ReportId id = m_data.reports[index].id;
 
-	bs.isConnected = connected;
-	bs.lastConnectedTimePoint = m_clock->now();
-	bs.lastCommsTimePoint = m_clock->now();
-	if (connected)
-		computeBaseStationAlarmTriggers(bs);
+    s_logger.logInfo(QString("Removed report '%1'").arg(m_data.reports[index].descriptor.name.c_str()));
 
-	m_data.baseStationsChanged = true;
-	emit baseStationChanged(id);
+    m_data.reports.erase(m_data.reports.begin() + index);
+	m_data.changedReports.erase(id);
+	m_data.removedReports.insert(id);
+    emit reportRemoved(id);
 
 	save(true);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeBaseStation(size_t index)
+void DB::removeReportById(ReportId id)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    Q_ASSERT(index < m_data.baseStations.size());
-    BaseStationId id = m_data.baseStations[index].id;
-
-    BaseStationDescriptor const& descriptor = m_data.baseStations[index].descriptor;
-    s_logger.logInfo(QString("Removing base station '%1' / %2").arg(descriptor.name.c_str()).arg(utils::getMacStr(descriptor.mac).c_str()));
-
-    m_data.baseStations.erase(m_data.baseStations.begin() + index);
-	m_data.baseStationsAddedOrRemoved = true;
-    emit baseStationRemoved(id);
-
-	save(true);
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
+    if (it != m_data.reports.end())
+        removeReport(std::distance(m_data.reports.begin(), it));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeBaseStationById(BaseStationId id)
+int32_t DB::findReportIndexByName(std::string const& name) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [id](BaseStation const& bs) { return bs.id == id; });
-    if (it != m_data.baseStations.end())
-        removeBaseStation(std::distance(m_data.baseStations.begin(), it));
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [&name](Report const& report) { return report.descriptor.name == name; });
+    if (it == m_data.reports.end())
+        return -1;
+
+    return int32_t(std::distance(m_data.reports.begin(), it));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findBaseStationIndexByName(std::string const& name) const
+int32_t DB::findReportIndexById(ReportId id) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [&name](BaseStation const& baseStation) { return baseStation.descriptor.name == name; });
-    if (it == m_data.baseStations.end())
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
+    if (it == m_data.reports.end())
         return -1;
-    
-	return int32_t(std::distance(m_data.baseStations.begin(), it));
+
+    return int32_t(std::distance(m_data.reports.begin(), it));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findBaseStationIndexById(BaseStationId id) const
+std::optional<DB::Report> DB::findReportByName(std::string const& name) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [id](BaseStation const& baseStation) { return baseStation.id == id; });
-    if (it == m_data.baseStations.end())
-        return -1;
-    
-	return int32_t(std::distance(m_data.baseStations.begin(), it));
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [&name](Report const& report) { return report.descriptor.name == name; });
+    if (it == m_data.reports.end())
+        return std::nullopt;
+
+    return *it;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findBaseStationIndexByMac(BaseStationDescriptor::Mac const& mac) const
+std::optional<DB::Report> DB::findReportById(ReportId id) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [&mac](BaseStation const& baseStation) { return baseStation.descriptor.mac == mac; });
-    if (it == m_data.baseStations.end())
-        return -1;
-    
-	return int32_t(std::distance(m_data.baseStations.begin(), it));
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
+    if (it == m_data.reports.end())
+        return std::nullopt;
+
+    return *it;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::BaseStation> DB::findBaseStationByName(std::string const& name) const
+bool DB::isReportTriggered(Report const& report) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [&name](BaseStation const& baseStation) { return baseStation.descriptor.name == name; });
-    if (it == m_data.baseStations.end())
-        return std::nullopt;
-    
-	return *it;
+    if (report.descriptor.period == ReportDescriptor::Period::Daily)
+    {
+        QDateTime dt = QDateTime::fromTime_t(IClock::to_time_t(m_clock->now()));
+        dt.setTime(QTime(9, 0));
+        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
+            return true;
+    }
+    else if (report.descriptor.period == ReportDescriptor::Period::Weekly)
+    {
+        QDateTime dt = QDateTime::fromTime_t(IClock::to_time_t(m_clock->now()));
+        dt.setDate(dt.date().addDays(-dt.date().dayOfWeek()));
+        dt.setTime(QTime(9, 0));
+        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
+            return true;
+    }
+    else if (report.descriptor.period == ReportDescriptor::Period::Weekly)
+    {
+        QDate date = QDateTime::fromTime_t(IClock::to_time_t(m_clock->now())).date();
+        date = QDate(date.year(), date.month(), 1);
+        QDateTime dt(date, QTime(9, 0));
+
+        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
+            return true;
+    }
+    else if (report.descriptor.period == ReportDescriptor::Period::Custom)
+    {
+		IClock::time_point now = m_clock->now();
+		IClock::duration d = now - report.lastTriggeredTimePoint;
+        if (d >= report.descriptor.customPeriod)
+            return true;
+    }
+
+    return false;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::BaseStation> DB::findBaseStationById(BaseStationId id) const
+IClock::time_point DB::computeNextReportCheckTimePoint(Report const& report) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [id](BaseStation const& baseStation) { return baseStation.id == id; });
-    if (it == m_data.baseStations.end())
-        return std::nullopt;
-    
-	return *it;
+    if (report.descriptor.period == ReportDescriptor::Period::Custom)
+        return report.lastTriggeredTimePoint + report.descriptor.customPeriod;
+
+    //the calendar reports can only change their state when the day changes or when crossing 9:00. In the local time of the clock
+    QDateTime now = QDateTime::fromTime_t(IClock::to_time_t(m_clock->now()));
+    QDateTime dt(now.date(), QTime(9, 0));
+    if (dt <= now)
+        dt = QDateTime(now.date().addDays(1), QTime(0, 0));
+
+    return IClock::from_time_t(dt.toTime_t());
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::BaseStation> DB::findBaseStationByMac(BaseStationDescriptor::Mac const& mac) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.baseStations.begin(), m_data.baseStations.end(), [&mac](BaseStation const& baseStation) { return baseStation.descriptor.mac == mac; });
-    if (it == m_data.baseStations.end())
-        return std::nullopt;
+void DB::clearAllMeasurements()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	flushMeasurements();
+
+	QString sql;
+	for (std::string const& table: getMeasurementTables(*m_sqlite))
+	{
+		sql = QString("DELETE FROM %1;").arg(table.c_str());
+		if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+		{
+			s_logger.logCritical(QString("Failed to clear all measurements: %2").arg(sqlite3_errmsg(m_sqlite)));
+			return;
+		}
+		if (sqlite3_changes(m_sqlite) > 0)
+			markMeasurementPartitionChanged(table);
+	}
+	if (sqlite3_exec(m_sqlite, "DELETE FROM MeasurementChunks;", nullptr, nullptr, nullptr))
+	{
+		s_logger.logCritical(QString("Failed to clear all measurements: %2").arg(sqlite3_errmsg(m_sqlite)));
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+		m_chunksRange = std::nullopt;
+	}
+	for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+	{
+		sql = QString("DELETE FROM %1;").arg(getRollupTable(period));
+		if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+			s_logger.logCritical(QString("Failed to clear the measurement rollups: %2").arg(sqlite3_errmsg(m_sqlite)));
+	}
+	{
+		std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+		m_recentMeasurements.clear();
+	}
+	{
+		std::lock_guard<std::mutex> lg2(m_measurementCountsMutex);
+		m_measurementCounts.clear();
+	}
+	for (Sensor const& sensor: m_data.sensors)
+		emit measurementsRemoved(sensor.id);
+
+	for (Alarm& alarm : m_data.alarms)
+		alarm.triggersPerSensor.clear();
+	rebuildSensorAlarmIndex();
 
-    return *it;
-}
+	for (Alarm const& alarm : m_data.alarms)
+	{
+		m_data.changedAlarms.insert(alarm.id);
+		markAlarmChanged(alarm.id);
+	}
 
-//////////////////////////////////////////////////////////////////////////
+	s_logger.logInfo(QString("Cleared all measurements"));
 
-size_t DB::getSensorCount() const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    return m_data.sensors.size();
+	save(true);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::Sensor DB::getSensor(size_t index) const
+bool DB::addMeasurement(MeasurementDescriptor const& descriptor)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    Q_ASSERT(index < m_data.sensors.size());
-    Sensor const& sensor = m_data.sensors[index];
-    return sensor;
+    return addSingleSensorMeasurements(descriptor.sensorId, { descriptor });
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
-DB::SensorOutputDetails DB::computeSensorOutputDetails(SensorId id) const
+bool DB::addMeasurements(std::vector<MeasurementDescriptor> descriptors)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    int32_t _index = findSensorIndexById(id);
-    if (_index < 0)
-        return {};
+    std::map<SensorId, std::vector<MeasurementDescriptor>> mdPerSensor;
+    for (MeasurementDescriptor const& md: descriptors)
+    {
+        mdPerSensor[md.sensorId].push_back(md);
+    }
 
-    size_t index = static_cast<size_t>(_index);
-    Sensor const& sensor = m_data.sensors[index];
-    SensorTimeConfig config = getLastSensorTimeConfig();
+    bool ok = true;
+    for (auto& pair: mdPerSensor)
+        ok &= addSingleSensorMeasurements(pair.first, std::move(pair.second));
 
-    SensorOutputDetails details;
-    details.commsPeriod = computeActualCommsPeriod(config.descriptor);
-    details.nextCommsTimePoint = computeNextCommsTimePoint(sensor, index);
-    details.measurementPeriod = config.descriptor.measurementPeriod;
-    details.nextMeasurementTimePoint = computeNextMeasurementTimePoint(sensor);
-    details.nextRealTimeMeasurementIndex = computeNextRealTimeMeasurementIndex();
-    details.nextMeasurementIndex = computeNextMeasurementIndex(sensor);
-    return details;
+    return ok;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
-uint32_t DB::computeNextRealTimeMeasurementIndex() const
+bool DB::addSingleSensorMeasurements(SensorId sensorId, std::vector<MeasurementDescriptor> mds)
 {
-    SensorTimeConfig config = getLastSensorTimeConfig();
-	IClock::time_point now = m_clock->now();
-    uint32_t index = static_cast<uint32_t>(std::ceil((now - config.baselineMeasurementTimePoint) / config.descriptor.measurementPeriod)) + config.baselineMeasurementIndex;
-    return index;
-}
+	IngestBatch batch;
+	uint32_t receivedIndex = 0;
+	uint32_t epoch = 0;
 
-//////////////////////////////////////////////////////////////////////////
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
 
-Result<void> DB::_addSensorTimeConfig(SensorTimeConfigDescriptor const& descriptor)
-{
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+		int32_t _sensorIndex = _findSensorIndexById(sensorId);
+		if (_sensorIndex < 0)
+			return false;
 
-	if (descriptor.commsPeriod < std::chrono::seconds(30))
-		return Error("Comms period cannot be lower than 30 seconds");
-	if (descriptor.measurementPeriod < std::chrono::seconds(10))
-		return Error("Measurement period cannot be lower than 10 seconds");
-	if (descriptor.commsPeriod < descriptor.measurementPeriod)
-		return Error("Comms period cannot be lower than the measurement period");
+		size_t sensorIndex = static_cast<size_t>(_sensorIndex);
+		Sensor& sensor = m_data.sensors[sensorIndex];
+		epoch = m_ingestEpochs[sensorId];
 
-	SensorTimeConfig config;
-	config.descriptor = descriptor;
+		uint32_t rtIndex = computeNextRealTimeMeasurementIndex();
+		sensor.lastReceivedMeasurementIndex = std::max(sensor.lastReceivedMeasurementIndex, sensor.lastConfirmedMeasurementIndex);
 
-	if (!m_data.sensorTimeConfigs.empty())
-	{
-		uint32_t nextRealTimeMeasurementIndex = computeNextRealTimeMeasurementIndex();
+		//first remove already received measurements or future measurements
+		mds.erase(std::remove_if(mds.begin(), mds.end(), [&sensor, rtIndex](MeasurementDescriptor const& d)
+		{
+			//leave some threshold for the RT check, to account for inaccuracies in time keeping
+			return d.index < sensor.lastReceivedMeasurementIndex || d.index > rtIndex + 5;
+		}), mds.end());
 
-		SensorTimeConfig c = findSensorTimeConfigForMeasurementIndex(nextRealTimeMeasurementIndex);
-		uint32_t index = nextRealTimeMeasurementIndex >= c.baselineMeasurementIndex ? nextRealTimeMeasurementIndex - c.baselineMeasurementIndex : 0;
-		IClock::time_point nextMeasurementTP = c.baselineMeasurementTimePoint + c.descriptor.measurementPeriod * index;
+		if (mds.empty())
+			return true;
 
-        m_data.sensorTimeConfigs.erase(std::remove_if(m_data.sensorTimeConfigs.begin(), m_data.sensorTimeConfigs.end(), [&nextRealTimeMeasurementIndex](SensorTimeConfig const& cfg)
+		batch.reserve(mds.size());
+		std::vector<size_t> evaluated;
+		for (MeasurementDescriptor const& md : mds)
 		{
-            return cfg.baselineMeasurementIndex == nextRealTimeMeasurementIndex;
-		}), m_data.sensorTimeConfigs.end());
-		config.baselineMeasurementIndex = nextRealTimeMeasurementIndex;
-		config.baselineMeasurementTimePoint = nextMeasurementTP;
-	}
-	else
-	{
-		config.baselineMeasurementIndex = 0;
-		config.baselineMeasurementTimePoint = m_clock->now();
-	}
+			//advance the last received index, it's confirmed to the sensor after the writer commits the batch
+			if (md.index == sensor.lastReceivedMeasurementIndex + 1)
+			{
+				sensor.lastReceivedMeasurementIndex = md.index;
+				receivedIndex = md.index;
+				markSensorChanged(sensor.id);
+			}
 
-	m_data.sensorTimeConfigs.push_back(config);
-	while (m_data.sensorTimeConfigs.size() > 100)
-		m_data.sensorTimeConfigs.erase(m_data.sensorTimeConfigs.begin());
+			Measurement m;
+			m.descriptor = md;
+			m.timePoint = computeMeasurementTimepoint(md);
+			m.receivedTimePoint = m_clock->now();
 
-	m_data.sensorTimeConfigsChanged = true;
+			//the triggers depend on the previous ones, so only the next measurement in order is evaluated here.
+			//The index is saved with the alarms, after the writer committed the row
+			if (md.index == sensor.lastAlarmProcessesMeasurementIndex + 1 && md.index <= sensor.lastReceivedMeasurementIndex)
+			{
+				sensor.lastAlarmProcessesMeasurementIndex = md.index;
+				evaluated.push_back(batch.size());
+			}
+			batch.emplace_back(m);
+		}
 
-	emit sensorTimeConfigAdded();
+		if (!evaluated.empty())
+		{
+			std::vector<Measurement> measurements;
+			measurements.reserve(evaluated.size());
+			for (size_t i : evaluated)
+				measurements.push_back(batch[i]);
+			computeSensorAlarmTriggers(sensor, measurements);
+			for (size_t i = 0; i < evaluated.size(); i++)
+				batch[evaluated[i]].alarmTriggers = measurements[i].alarmTriggers;
+		}
 
-	s_logger.logInfo("Added sensors config");
+		//the rest waits for the older measurements, process evaluates them from the database once they are confirmed
 
-	return success;
-}
+		//the partitions are created here, the ingest thread only routes the measurements to them
+		std::pair<IClock::time_point, IClock::time_point> covered;
+		for (Measurement const& m : batch)
+		{
+			if (m.timePoint >= covered.first && m.timePoint < covered.second)
+				continue;
 
-//////////////////////////////////////////////////////////////////////////
+			int32_t partitionIndex;
+			{
+				std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+				partitionIndex = findMeasurementPartitionIndex(m.timePoint);
+				if (partitionIndex >= 0)
+					covered = { m_partitions[static_cast<size_t>(partitionIndex)].begin, m_partitions[static_cast<size_t>(partitionIndex)].end };
+			}
+			if (partitionIndex < 0)
+			{
+				Result<std::pair<IClock::time_point, IClock::time_point>> result = addMeasurementPartition(m.timePoint);
+				if (result != success) //its measurements go to the main file
+					s_logger.logCritical(QString("Failed to add a measurement partition: %1").arg(result.error().what().c_str()));
+				else
+					covered = result.payload();
+			}
+		}
 
-Result<void> DB::addSensorTimeConfig(SensorTimeConfigDescriptor const& descriptor)
-{
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+		//the sensor state is saved with the next process, the measurements by the ingest thread
+		scheduleSave();
+	}
 
-	Result<void> result = _addSensorTimeConfig(descriptor);
-	if (result != success)
-		return result;
+	{
+		//the recent measurements have them right away. Their ids are 0 until the writer commits them
+		std::lock_guard<std::mutex> lg(m_recentMeasurementsMutex);
+		auto it = m_recentMeasurements.find(sensorId);
+		if (it != m_recentMeasurements.end())
+			for (Measurement const& m : batch)
+				it->second.add(m);
+	}
 
-	save(true);
-    return success;
+	//Waits when the writer falls behind, without holding the data mutex. The push lock is only held for a bounded wait
+	//so a flush doesn't get stuck behind a full queue
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lg(m_ingestPushMutex);
+			if (!m_ingestQueue)
+				break;
+			if (m_ingestQueue->push_back_timeout(batch, INGEST_PUSH_WAIT))
+			{
+				m_ingestPushedCount++;
+				if (receivedIndex > 0)
+					m_ingestConfirmations.push_back({ m_ingestPushedCount, sensorId, receivedIndex, epoch });
+				return true;
+			}
+		}
+		std::this_thread::yield(); //close resets the queue after the writer exits
+	}
+
+	s_logger.logCritical(QString("Failed to queue %1 measurements for sensor %2").arg(batch.size()).arg(sensorId));
+	return false;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensorTimeConfigs(std::vector<SensorTimeConfig> const& configs)
+void DB::flushMeasurements() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	m_data.sensorTimeConfigs = configs;
-	m_data.sensorTimeConfigsChanged = true;
-	emit sensorTimeConfigChanged();
+	uint64_t target = 0;
+	{
+		std::lock_guard<std::mutex> lg(m_ingestPushMutex);
+		if (!m_ingestQueue)
+			return;
 
-    s_logger.logInfo("Changed sensors configs");
+		{
+			std::lock_guard<std::mutex> lg2(m_ingestCommitMutex);
+			if (m_ingestCommittedCount >= m_ingestPushedCount)
+				return;
+		}
 
-	save(true);
+		//the empty batch makes the writer commit without waiting for the latency
+		if (!m_ingestQueue->push_back(IngestBatch(), true))
+			return;
+		target = ++m_ingestPushedCount;
+	}
 
-    return success;
+	std::unique_lock<std::mutex> lg(m_ingestCommitMutex);
+	m_ingestCommitCV.wait(lg, [this, target] { return m_ingestCommittedCount >= target; });
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::SensorTimeConfig DB::getLastSensorTimeConfig() const
+void DB::setIngestSettings(IngestSettings const& settings)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    static SensorTimeConfig s_empty;
-	return m_data.sensorTimeConfigs.empty() ? s_empty : m_data.sensorTimeConfigs.back();
+	m_ingestMaxLatency = std::max<std::chrono::milliseconds::rep>(settings.maxLatency.count(), 0);
+	m_ingestMaxBatchSize = std::max<size_t>(settings.maxBatchSize, 1);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getSensorTimeConfigCount() const
+DB::IngestSettings DB::getIngestSettings() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	return m_data.sensorTimeConfigs.size();
+	IngestSettings settings;
+	settings.maxLatency = std::chrono::milliseconds(m_ingestMaxLatency.load());
+	settings.maxBatchSize = m_ingestMaxBatchSize.load();
+	return settings;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::SensorTimeConfig DB::getSensorTimeConfig(size_t index) const
+void DB::setPartitionSettings(PartitionSettings const& settings)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-	Q_ASSERT(index < m_data.sensorTimeConfigs.size());
-    return m_data.sensorTimeConfigs[index];
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	//the existing partitions keep their periods, the new ones are clipped to them
+	m_partitionSettings = settings;
+	scheduleMeasurementPartitionSeal();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::SensorTimeConfig DB::findSensorTimeConfigForMeasurementIndex(uint32_t index) const
+DB::PartitionSettings DB::getPartitionSettings() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	for (auto it = m_data.sensorTimeConfigs.rbegin(); it != m_data.sensorTimeConfigs.rend(); ++it)
-    {
-		SensorTimeConfig const& c = *it;
-        if (index >= c.baselineMeasurementIndex)
-            return c;
-    }
-    return getLastSensorTimeConfig();
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_partitionSettings;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<DB::SensorId> DB::addSensor(SensorDescriptor const& descriptor)
+void DB::setColdStorageSettings(ColdStorageSettings const& settings)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    if (findSensorIndexByName(descriptor.name) >= 0)
-        return Error("Name '" + descriptor.name + "' already in use");
-
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [](Sensor const& sensor) { return sensor.state == Sensor::State::Unbound; });
-    if (it != m_data.sensors.end())
-        return Error("There is already an unbound sensor");
-
-    SensorId id;
-    {
-        Sensor sensor;
-		sensor.addedTimePoint = m_clock->now();
-        sensor.descriptor.name = descriptor.name;
-        id = ++m_data.lastSensorId;
-        sensor.id = id;
-        sensor.state = Sensor::State::Unbound;
-
-        m_data.sensors.push_back(sensor);
-		m_data.sensorsAddedOrRemoved = true;
-        emit sensorAdded(sensor.id);
-
-        s_logger.logInfo(QString("Added sensor '%1'").arg(descriptor.name.c_str()));
-    }
-
-    //refresh computed comms period as new sensors are added
-    emit sensorTimeConfigChanged();
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	save(true);
-
-    return id;
+	//the chunks already compressed stay compressed
+	m_coldStorageSettings = settings;
+	if (m_sqlite)
+		m_nextColdCompressionTimePoint = m_clock->now();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensor(SensorId id, SensorDescriptor const& descriptor)
+DB::ColdStorageSettings DB::getColdStorageSettings() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    int32_t _index = findSensorIndexByName(descriptor.name);
-    if (_index >= 0 && getSensor(static_cast<size_t>(_index)).id != id)
-        return Error("Name '" + descriptor.name + "' already in use");
-
-    _index = findSensorIndexById(id);
-    if (_index < 0)
-        return Error("Trying to change non-existing sensor");
-
-    size_t index = static_cast<size_t>(_index);
-    m_data.sensors[index].descriptor = descriptor;
-	m_data.sensorsChanged = true;
-    emit sensorChanged(id);
-
-    s_logger.logInfo(QString("Changed sensor '%1'").arg(descriptor.name.c_str()));
-
-	save(true);
-
-    return success;
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_coldStorageSettings;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<DB::SensorId> DB::bindSensor(uint32_t serialNumber, uint8_t sensorType, uint8_t hardwareVersion, uint8_t softwareVersion, Sensor::Calibration const& calibration)
+Result<void> DB::setRetentionPolicies(std::vector<RetentionPolicy> const& policies)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    int32_t _index = findUnboundSensorIndex();
-    if (_index < 0)
-        return Error("No unbound sensor");
+	for (RetentionPolicy const& policy: policies)
+	{
+		if (policy.keepRaw < IClock::duration::zero())
+			return Error(QString("The retention policy '%1' keeps the measurements for a negative duration").arg(policy.name.c_str()).toUtf8().data());
+		if (policy.keepDownsampled < policy.keepRaw)
+			return Error(QString("The retention policy '%1' drops the measurements before downsampling them").arg(policy.name.c_str()).toUtf8().data());
+		if (policy.downsampling == RetentionPolicy::Downsampling::Decimate && policy.decimationPeriod < std::chrono::seconds(1))
+			return Error(QString("The retention policy '%1' has a decimation period under a second").arg(policy.name.c_str()).toUtf8().data());
+	}
 
-    size_t index = static_cast<size_t>(_index);
-    Sensor& sensor = m_data.sensors[index];
-    if (sensor.state != Sensor::State::Unbound)
-        return Error("No unbound sensor (inconsistent internal state)");
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	if (!m_sqlite)
+		return Error("Cannot set the retention policies: the DB is not loaded");
 
-    sensor.address = ++m_data.lastSensorAddress;
-    sensor.deviceInfo.sensorType = sensorType;
-    sensor.deviceInfo.hardwareVersion = hardwareVersion;
-    sensor.deviceInfo.softwareVersion = softwareVersion;
-    sensor.calibration = calibration;
-    sensor.state = Sensor::State::Active;
-    sensor.serialNumber = serialNumber;
+	{
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+		bool committed = false;
+		utils::epilogue epi([this, &committed] { sqlite3_exec(m_sqlite, committed ? "END TRANSACTION;" : "ROLLBACK;", nullptr, nullptr, nullptr); });
 
-	m_data.sensorsChanged = true;
+		if (sqlite3_exec(m_sqlite, "DELETE FROM RetentionPolicies;", nullptr, nullptr, nullptr))
+			return Error(QString("Cannot save the retention policies: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 
-    emit sensorBound(sensor.id);
-    emit sensorChanged(sensor.id);
+		sqlite3_stmt* stmt = getCachedStatement("INSERT INTO RetentionPolicies VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);");
+		if (!stmt)
+			return Error(QString("Cannot save the retention policies: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 
-    s_logger.logInfo(QString("Sensor '%1' bound to address %2").arg(sensor.descriptor.name.c_str()).arg(sensor.address));
+		for (size_t i = 0; i < policies.size(); i++)
+		{
+			RetentionPolicy const& policy = policies[i];
+			std::string sensors;
+			for (SensorId id : policy.sensors)
+				sensors += std::to_string(id) + ";";
 
-    //refresh computed comms period as new sensors are added
-    emit sensorTimeConfigChanged();
+			sqlite3_bind_int64(stmt, 1, int64_t(i));
+			sqlite3_bind_text(stmt, 2, policy.name.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int(stmt, 3, policy.filterSensors ? 1 : 0);
+			sqlite3_bind_text(stmt, 4, sensors.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int64(stmt, 5, std::chrono::duration_cast<std::chrono::seconds>(policy.keepRaw).count());
+			sqlite3_bind_int64(stmt, 6, int64_t(policy.downsampling));
+			sqlite3_bind_int64(stmt, 7, std::chrono::duration_cast<std::chrono::seconds>(policy.decimationPeriod).count());
+			sqlite3_bind_int64(stmt, 8, std::chrono::duration_cast<std::chrono::seconds>(policy.keepDownsampled).count());
+			int result = sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+			if (result != SQLITE_DONE)
+				return Error(QString("Cannot save the retention policies: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+		committed = true;
+	}
 
-	save(true);
+	//the sensors might have moved between policies, so they are all applied from the start
+	m_retentionPolicies = policies;
+	m_retentionProgress.clear();
+	m_nextRetentionTimePoint = m_clock->now();
 
-    return sensor.id;
+	s_logger.logInfo(QString("Changed the measurement retention policies"));
+	return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensorCalibration(SensorId id, Sensor::Calibration const& calibration)
+std::vector<DB::RetentionPolicy> DB::getRetentionPolicies() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	return m_retentionPolicies;
+}
 
-    int32_t _index = findSensorIndexById(id);
-    if (_index < 0)
-        return Error("Invalid sensor id");
+//////////////////////////////////////////////////////////////////////////
 
-    size_t index = static_cast<size_t>(_index);
-    Sensor& sensor = m_data.sensors[index];
-    if (sensor.state == Sensor::State::Unbound)
-        return Error("Cannot change calibration for unbound sensor");
+std::vector<DB::MeasurementPartition> DB::getMeasurementPartitions() const
+{
+	std::lock_guard<std::mutex> lg(m_partitionsMutex);
+	return m_partitions;
+}
 
-    sensor.calibration = calibration;
-	m_data.sensorsChanged = true;
+//////////////////////////////////////////////////////////////////////////
 
-    emit sensorChanged(sensor.id);
+void DB::setMeasurementPartitionBackedUp(std::string const& name)
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	std::lock_guard<std::mutex> wl(m_writeMutex);
 
-    s_logger.logInfo(QString("Sensor '%1' calibration changed").arg(sensor.descriptor.name.c_str()));
+	sqlite3_stmt* stmt = getCachedStatement("UPDATE MeasurementPartitions SET backedUp = 1 WHERE name = ?1;");
+	if (!stmt)
+		return;
 
-	save(true);
+	sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+	int result = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (result != SQLITE_DONE)
+	{
+		s_logger.logCritical(QString("Failed to mark the measurement partition '%1' as backed up: %2").arg(name.c_str()).arg(sqlite3_errmsg(m_sqlite)));
+		return;
+	}
 
-    return success;
+	std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+	for (MeasurementPartition& partition: m_partitions)
+	{
+		if (partition.name == name)
+			partition.backedUp = true;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensorSleep(SensorId id, bool sleep)
+Result<std::pair<IClock::time_point, IClock::time_point>> DB::addMeasurementPartition(IClock::time_point timePoint)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    int32_t _index = findSensorIndexById(id);
-    if (_index < 0)
-        return Error("Invalid sensor id");
+	//the periods of the removed partitions stay in the main file, so no partition name is used twice
+	if (timePoint < m_removedPartitionsEnd)
+		return std::make_pair(IClock::time_point::min(), m_removedPartitionsEnd);
 
-    size_t index = static_cast<size_t>(_index);
-    Sensor& sensor = m_data.sensors[index];
-    if (sensor.state == Sensor::State::Unbound)
-        return Error("Cannot put unbound sensor to sleep");
+	//each partition is attached on every connection, the main one has the lowest limit
+	size_t maxPartitions = static_cast<size_t>(std::max(sqlite3_limit(m_sqlite, SQLITE_LIMIT_ATTACHED, -1), 1));
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+			if (m_partitions.size() < maxPartitions)
+				break;
+			//the oldest ones are merged, not the ones older than them
+			if (timePoint < m_partitionsByBegin.begin()->first)
+				return std::make_pair(IClock::time_point::min(), m_partitionsByBegin.begin()->first);
+		}
+		Result<void> result = mergeOldestMeasurementPartition();
+		if (result != success)
+			return result.error();
+	}
 
-    if (sensor.shouldSleep == sleep)
-        return success;
+	MeasurementPartition partition;
+	std::tie(partition.begin, partition.end) = computeMeasurementPartitionPeriod(timePoint, m_partitionSettings.period);
+	partition.begin = std::max(partition.begin, m_removedPartitionsEnd);
+	{
+		//after a period change the new partition can overlap the existing ones
+		std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+		auto it = m_partitionsByBegin.upper_bound(timePoint);
+		if (it != m_partitionsByBegin.end())
+			partition.end = std::min(partition.end, it->first);
+		if (it != m_partitionsByBegin.begin())
+			partition.begin = std::max(partition.begin, m_partitions[std::prev(it)->second].end);
+	}
 
-	DB::SensorTimeConfig config = getLastSensorTimeConfig();
-	IClock::duration actualCommsPeriod = computeActualCommsPeriod(config.descriptor);
+	//the periods start at midnight, so do the clipped ones
+	partition.name = std::string("measurements_") + QDateTime::fromSecsSinceEpoch(IClock::to_time_t(partition.begin), Qt::UTC).toString("yyyyMMdd").toUtf8().data();
+	const char* mainFilename = sqlite3_db_filename(m_sqlite, "main");
+	partition.filename = getMeasurementPartitionFilename(mainFilename ? mainFilename : "", partition.name);
 
-    bool hasMeasurements = sensor.estimatedStoredMeasurementCount > 0;
-    bool commedRecently = (DB::m_clock->now() - sensor.lastCommsTimePoint) < actualCommsPeriod * 2;
-    bool allowedToSleep = !hasMeasurements && commedRecently;
-    if (sleep && !sensor.shouldSleep && !allowedToSleep)
-    {
-        if (hasMeasurements)
-            return Error("Cannot put sensor to sleep because it has stored measurements");
+	Result<void> result = createMeasurementPartitionFile(partition.filename, isWalJournal(*m_sqlite));
+	if (result != success)
+		return result.error();
 
-        return Error("Cannot put sensor to sleep because it didn't communicate recently");
-    }
+	{
+		std::lock_guard<std::mutex> wl(m_writeMutex);
 
-    sensor.shouldSleep = sleep;
-	m_data.sensorsChanged = true;
+		sqlite3_stmt* stmt = getCachedStatement("INSERT INTO MeasurementPartitions VALUES(?1, ?2, ?3, 0, 0, 0);");
+		if (!stmt)
+			return Error("Cannot add the measurement partition");
 
-    emit sensorChanged(sensor.id);
+		sqlite3_bind_text(stmt, 1, partition.name.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 2, IClock::to_time_t(partition.begin));
+		sqlite3_bind_int64(stmt, 3, IClock::to_time_t(partition.end));
+		int stepResult = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (stepResult != SQLITE_DONE)
+			return Error(QString("Cannot add the measurement partition '%1': %2").arg(partition.name.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 
-    s_logger.logInfo(QString("Sensor '%1' sleep state changed to %2").arg(sensor.descriptor.name.c_str()).arg(sleep));
+		{
+			std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+			m_partitionsByBegin[partition.begin] = m_partitions.size();
+			m_partitions.push_back(partition);
+		}
 
-	save(true);
+		//no transaction is open on the main connection while the write mutex is locked
+		attachMeasurementPartitions(*m_sqlite);
+	}
 
-    return success;
+	scheduleMeasurementPartitionSeal();
+
+	s_logger.logInfo(QString("Added the measurement partition '%1'").arg(partition.name.c_str()));
+	return std::make_pair(partition.begin, partition.end);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setSensorStats(SensorId id, SensorStats const& stats)
+//the statements removing a partition, in the transaction that also moves or drops its measurements
+static std::string getRemoveMeasurementPartitionSql(DB::MeasurementPartition const& partition)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	return "DELETE FROM MeasurementPartitions WHERE name = '" + partition.name + "';"
+	       "INSERT OR REPLACE INTO RemovedMeasurementPartitions VALUES('" + partition.name + "', " +
+	       std::to_string(IClock::to_time_t(partition.begin)) + ", " + std::to_string(IClock::to_time_t(partition.end)) + ");";
+}
 
-	int32_t _index = findSensorIndexById(id);
-	if (_index < 0)
-		return Error("Invalid sensor id");
+//////////////////////////////////////////////////////////////////////////
 
-	size_t index = static_cast<size_t>(_index);
-	Sensor& sensor = m_data.sensors[index];
-	sensor.stats = stats;
-	m_data.sensorsChanged = true;
+Result<void> DB::mergeOldestMeasurementPartition()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	emit sensorChanged(sensor.id);
+	MeasurementPartition partition;
+	{
+		std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+		if (m_partitionsByBegin.empty())
+			return success;
+		partition = m_partitions[m_partitionsByBegin.begin()->second];
+	}
 
-	s_logger.logInfo(QString("Sensor '%1' error counters cleared").arg(sensor.descriptor.name.c_str()));
+	flushMeasurements();
 
-	save(true);
+	{
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+		bool committed = false;
+		utils::epilogue epiTransaction([this, &committed] { if (!committed) sqlite3_exec(m_sqlite, "ROLLBACK;", nullptr, nullptr, nullptr); });
+
+		//with their ids, which are unique in all the files. The rollups count them already
+		const char* columns = "id, timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, "
+		                      "sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved";
+		std::string sql = std::string("INSERT OR IGNORE INTO Measurements (") + columns + ") SELECT " + columns + " FROM " + partition.name + ".Measurements;" +
+		                  getRemoveMeasurementPartitionSql(partition);
+		if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+			return Error(QString("Cannot merge the measurement partition '%1': %2").arg(partition.name.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		if (sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr))
+			return Error(QString("Cannot merge the measurement partition '%1': %2").arg(partition.name.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		committed = true;
+	}
+
+	removeMeasurementPartitions({ partition.name });
 
+	s_logger.logInfo(QString("Merged the measurement partition '%1' into the main file, to stay within the attached databases limit").arg(partition.name.c_str()));
 	return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::rebindSensor(SensorId id)
+void DB::removeMeasurementPartitions(std::vector<std::string> const& names)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	if (findUnboundSensorIndex() >= 0)
-		return Error("Binding already in process");
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	int32_t _index = findSensorIndexById(id);
-	if (_index < 0)
-		return Error("Invalid sensor id");
+	{
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		{
+			std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+			for (std::string const& name: names)
+			{
+				auto it = std::find_if(m_partitions.begin(), m_partitions.end(), [&name](MeasurementPartition const& partition) { return partition.name == name; });
+				if (it == m_partitions.end())
+					continue;
+				m_removedPartitionsEnd = std::max(m_removedPartitionsEnd, it->end);
+				m_removedPartitionFiles.push_back(it->filename);
+				m_removedPartitions.push_back(name);
+				m_partitions.erase(it);
+			}
+			m_partitionsByBegin.clear();
+			for (size_t i = 0; i < m_partitions.size(); i++)
+				m_partitionsByBegin[m_partitions[i].begin] = i;
+
+			//the ingest statements are by partition index, and they would keep the removed ones from being detached
+			m_addPartitionMeasurementsStmts.clear();
+			m_markPartitionCommitStmts.clear();
+			m_findIngestDuplicatesStmt = nullptr;
+			m_findIngestDuplicatesSql.clear();
+		}
 
-	size_t index = static_cast<size_t>(_index);
-	Sensor& sensor = m_data.sensors[index];
-	sensor.state = Sensor::State::Unbound;
-	m_data.sensorsChanged = true;
+		//no transaction is open on either connection while the write mutex is locked
+		attachMeasurementPartitions(*m_sqlite);
+		if (m_ingestSqlite)
+			attachMeasurementPartitions(*m_ingestSqlite);
+	}
 
-	emit sensorChanged(sensor.id);
+	//the read connections in use detach them when acquired next
+	m_readPool.prepareAvailable();
+	removeMeasurementPartitionFiles();
+	scheduleMeasurementPartitionSeal();
+}
 
-	s_logger.logInfo(QString("Sensor '%1' marked for rebinding").arg(sensor.descriptor.name.c_str()));
+//////////////////////////////////////////////////////////////////////////
 
-	save(true);
+//A file still attached on a read connection can't be deleted on every platform, it's retried on the next process
+void DB::removeMeasurementPartitionFiles()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	return success;
+	for (auto it = m_removedPartitionFiles.begin(); it != m_removedPartitionFiles.end();)
+	{
+		bool removed = true;
+		for (char const* suffix: { "", "-wal", "-shm" })
+		{
+			QString filename = QString(it->c_str()) + suffix;
+			if (QFileInfo::exists(filename) && !QFile::remove(filename))
+				removed = false;
+		}
+		if (removed)
+		{
+			s_logger.logInfo(QString("Deleted the measurement partition file '%1'").arg(it->c_str()));
+			it = m_removedPartitionFiles.erase(it);
+		}
+		else
+			++it;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::cancelSensorBinding()
+int32_t DB::findMeasurementPartitionIndex(IClock::time_point timePoint) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	auto it = m_partitionsByBegin.upper_bound(timePoint);
+	if (it == m_partitionsByBegin.begin())
+		return -1;
+	--it;
+	return timePoint < m_partitions[it->second].end ? static_cast<int32_t>(it->second) : -1;
+}
 
-	int32_t _index = findUnboundSensorIndex();
-	if (_index < 0)
-		return;
+//////////////////////////////////////////////////////////////////////////
 
-	size_t index = static_cast<size_t>(_index);
-	Sensor& sensor = m_data.sensors[index];
+void DB::attachMeasurementPartitions(sqlite3& sqlite) const
+{
+	std::vector<std::string> removed;
+	std::vector<MeasurementPartition> partitions;
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		for (std::string const& name: m_removedPartitions)
+		{
+			if (sqlite3_db_filename(&sqlite, name.c_str()))
+				removed.push_back(name);
+		}
+		//they are attached in order, so the ones missing are at the end
+		for (size_t i = m_partitions.size(); i > 0 && !sqlite3_db_filename(&sqlite, m_partitions[i - 1].name.c_str()); i--)
+			partitions.push_back(m_partitions[i - 1]);
+	}
 
-	if (sensor.serialNumber == 0) //never bound? remove
+	for (std::string const& name: removed)
 	{
-		removeSensorById(sensor.id);
-		return;
+		std::string sql = "DETACH DATABASE " + name + ";";
+		if (sqlite3_exec(&sqlite, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+			s_logger.logWarning(QString("Cannot detach the measurement partition '%1': %2").arg(name.c_str()).arg(sqlite3_errmsg(&sqlite)));
 	}
 
-	//revert to active
-	sensor.state = Sensor::State::Active;
-	m_data.sensorsChanged = true;
+	for (auto it = partitions.rbegin(); it != partitions.rend(); ++it)
+	{
+		std::string sql = "ATTACH DATABASE ?1 AS " + it->name + ";";
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			s_logger.logCritical(QString("Cannot attach the measurement partition '%1': %2").arg(it->name.c_str()).arg(sqlite3_errmsg(&sqlite)));
+			return;
+		}
+		sqlite3_bind_text(stmt, 1, it->filename.c_str(), -1, SQLITE_TRANSIENT);
+		int result = sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+		if (result != SQLITE_DONE)
+		{
+			//addMeasurementPartition keeps them within the attached databases limit, so this is an I/O error.
+			//The measurements in it won't show up in the queries on this connection
+			s_logger.logCritical(QString("Cannot attach the measurement partition '%1': %2").arg(it->name.c_str()).arg(sqlite3_errmsg(&sqlite)));
+			return;
+		}
+	}
+}
 
-	emit sensorChanged(sensor.id);
+//////////////////////////////////////////////////////////////////////////
 
-	s_logger.logInfo(QString("Sensor '%1' canceled rebinding").arg(sensor.descriptor.name.c_str()));
+std::vector<std::string> DB::getMeasurementTables(sqlite3& sqlite, std::optional<Range<IClock::time_point>> const& range) const
+{
+	std::vector<std::string> tables = { "Measurements" };
 
-	save(true);
+	std::lock_guard<std::mutex> lg(m_partitionsMutex);
+	for (MeasurementPartition const& partition: m_partitions)
+	{
+		if (range.has_value() && (partition.begin > range->max || partition.end <= range->min))
+			continue;
+		if (!sqlite3_db_filename(&sqlite, partition.name.c_str()))
+			continue;
+		tables.push_back(partition.name + ".Measurements");
+	}
+	return tables;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setSensorInputDetails(SensorInputDetails const& details)
+std::vector<std::string> DB::getMeasurementTables(sqlite3& sqlite, Filter const& filter) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    return setSensorsInputDetails({details});
+	if (filter.useTimePointFilter)
+		return getMeasurementTables(sqlite, filter.timePointFilter);
+	return getMeasurementTables(sqlite);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::setSensorsInputDetails(std::vector<SensorInputDetails> const& details)
+std::vector<std::string> DB::getMeasurementSources(sqlite3& sqlite, std::optional<Range<IClock::time_point>> const& range) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    bool ok = true;
-    for (SensorInputDetails const& d: details)
-    {
-        int32_t _index = findSensorIndexById(d.id);
-        if (_index < 0)
-        {
-            ok = false;
-            continue;
-        }
+	std::vector<std::string> tables = getMeasurementTables(sqlite, range);
 
-        size_t index = static_cast<size_t>(_index);
-        Sensor& sensor = m_data.sensors[index];
-        if (sensor.state == Sensor::State::Unbound)
-        {
-            ok = false;
-            continue;
-        }
+	std::lock_guard<std::mutex> lg(m_partitionsMutex);
+	if (m_chunksRange.has_value() && (!range.has_value() || (m_chunksRange->min <= range->max && m_chunksRange->max >= range->min)))
+		tables.push_back("ChunkedMeasurements");
+	return tables;
+}
 
-        if (d.hasDeviceInfo)
-            sensor.deviceInfo = d.deviceInfo;
+//////////////////////////////////////////////////////////////////////////
 
-        //sensor.nextMeasurementTimePoint = d.nextMeasurementTimePoint;
-        if (d.hasLastCommsTimePoint)
-        {
-            if (d.lastCommsTimePoint > sensor.lastCommsTimePoint)
-                sensor.lastCommsTimePoint = d.lastCommsTimePoint;
-        }
-        if (d.hasStoredData)
-        {
-            sensor.firstStoredMeasurementIndex = d.firstStoredMeasurementIndex;
-            sensor.storedMeasurementCount = d.storedMeasurementCount;
+std::vector<std::string> DB::getMeasurementSources(sqlite3& sqlite, Filter const& filter) const
+{
+	if (filter.useTimePointFilter)
+		return getMeasurementSources(sqlite, filter.timePointFilter);
+	return getMeasurementSources(sqlite);
+}
 
-            if (sensor.firstStoredMeasurementIndex > 0)
-            {
-                //we'll never receive measurements lower than sensor->first_recorded_measurement_index
-                //so at worst, max_confirmed_measurement_index = sensor->first_recorded_measurement_index - 1 (the one just before the first recorded index)
-                sensor.lastConfirmedMeasurementIndex = std::max(sensor.lastConfirmedMeasurementIndex, sensor.firstStoredMeasurementIndex - 1);
-            }
+//////////////////////////////////////////////////////////////////////////
 
-            {
-                //if storing 1 measurement starting from index 15, the last stored index is 15 (therefore the -1 at the end)
-                int64_t lastStoredIndex = static_cast<int64_t>(sensor.firstStoredMeasurementIndex) +
-                        static_cast<int64_t>(sensor.storedMeasurementCount) - 1;
-                lastStoredIndex = std::max<int64_t>(lastStoredIndex, 0); //make sure we don't get negatives
-                int64_t count = std::max<int64_t>(lastStoredIndex - static_cast<int64_t>(sensor.lastConfirmedMeasurementIndex), 0);
-                sensor.estimatedStoredMeasurementCount = static_cast<uint32_t>(count);
-            }
-        }
+double DB::getMeasurementPartitionsShare(Range<IClock::time_point> const& range) const
+{
+	IClock::duration overlapped = IClock::duration::zero();
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		for (MeasurementPartition const& partition: m_partitions)
+		{
+			if (partition.begin <= range.max && partition.end > range.min)
+				overlapped += partition.end - partition.begin;
+		}
+	}
+	if (overlapped <= IClock::duration::zero())
+		return 1.0;
+	return std::min(std::chrono::duration<double>(range.max - range.min) / std::chrono::duration<double>(overlapped), 1.0);
+}
 
-        if (d.hasSleepingData)
-        {
-            if (sensor.state != Sensor::State::Unbound)
-            {
-                if (sensor.state == Sensor::State::Sleeping && !d.sleeping)
-                {
-                    //the sensor has slept, now it wakes up and start measuring from the current index
-                    sensor.lastConfirmedMeasurementIndex = computeNextRealTimeMeasurementIndex();
-                }
-                if (sensor.state != Sensor::State::Sleeping && d.sleeping)
-                {
-                    //mark the moment the sensor went to sleep
-                    sensor.sleepStateTimePoint = m_clock->now();
-                }
-                sensor.state = d.sleeping ? Sensor::State::Sleeping : Sensor::State::Active;
-            }
-        }
+//////////////////////////////////////////////////////////////////////////
 
-        if (d.hasSignalStrength)
-        {
-            sensor.lastSignalStrengthB2S = d.signalStrengthB2S;
+std::vector<std::string> DB::getMeasurementTablesFor(IClock::time_point timePoint) const
+{
+	std::vector<std::string> tables;
 
-            //we do this here just in case the sensor doesn't have any measurements. In that case the average signal strength will be calculated from the lastSignalStrengthB2S
-            //this happens the first time a sensor is added
-            if (sensor.averageSignalStrength.b2s >= 0 || sensor.averageSignalStrength.s2b >= 0)
-                sensor.averageSignalStrength = { d.signalStrengthB2S, d.signalStrengthB2S };
-        }
+	std::lock_guard<std::mutex> lg(m_partitionsMutex);
+	int32_t index = findMeasurementPartitionIndex(timePoint);
+	if (index >= 0 && sqlite3_db_filename(m_sqlite, m_partitions[static_cast<size_t>(index)].name.c_str()))
+		tables.push_back(m_partitions[static_cast<size_t>(index)].name + ".Measurements");
+	tables.push_back("Measurements");
+	return tables;
+}
 
-        if (d.hasStatsDelta)
-        {
-            sensor.stats.commsBlackouts += d.statsDelta.commsBlackouts;
-            sensor.stats.commsFailures += d.statsDelta.commsFailures;
-            sensor.stats.resetReboots += d.statsDelta.resetReboots;
-            sensor.stats.unknownReboots += d.statsDelta.unknownReboots;
-            sensor.stats.brownoutReboots += d.statsDelta.brownoutReboots;
-            sensor.stats.powerOnReboots += d.statsDelta.powerOnReboots;
-            sensor.stats.watchdogReboots += d.statsDelta.watchdogReboots;
-            sensor.stats.commsRetries += d.statsDelta.commsRetries;
-            sensor.stats.awake += d.statsDelta.awake;
-            sensor.stats.asleep += d.statsDelta.asleep;
-            sensor.stats.commsRounds += d.statsDelta.commsRounds;
-            sensor.stats.measurementRounds += d.statsDelta.measurementRounds;
-        }
+//////////////////////////////////////////////////////////////////////////
 
-        if (d.hasMeasurement)
-        {
-            sensor.isRTMeasurementValid = true;
-            sensor.rtMeasurementTemperature = d.measurementTemperature;
-            sensor.rtMeasurementHumidity = d.measurementHumidity;
-            sensor.rtMeasurementVcc = d.measurementVcc;
-        }
+//Called in the write transaction that changed the table, so the backup flag changes with it
+void DB::markMeasurementPartitionChanged(std::string const& table)
+{
+	size_t dot = table.find('.');
+	if (dot == std::string::npos)
+		return;
+	std::string name = table.substr(0, dot);
 
-        emit sensorDataChanged(sensor.id);
-    }
-	m_data.sensorsChanged = true;
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		if (std::none_of(m_partitions.begin(), m_partitions.end(), [&name](MeasurementPartition const& partition) { return partition.name == name; }))
+			return;
+	}
+	markMeasurementPartitionCommit(*m_sqlite, name);
 
-    scheduleSave();
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		auto it = std::find_if(m_partitions.begin(), m_partitions.end(), [&name](MeasurementPartition const& partition) { return partition.name == name; });
+		if (it == m_partitions.end() || !it->backedUp)
+			return;
+		it->backedUp = false;
+	}
 
-    return ok;
+	sqlite3_stmt* stmt = getCachedStatement("UPDATE MeasurementPartitions SET backedUp = 0 WHERE name = ?1;");
+	if (!stmt)
+		return;
+	sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+		s_logger.logCritical(QString("Failed to mark the measurement partition '%1' as changed: %2").arg(name.c_str()).arg(sqlite3_errmsg(m_sqlite)));
+	sqlite3_reset(stmt);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeSensor(size_t index)
+void DB::markMeasurementPartitionCommit(sqlite3& sqlite, std::string const& name)
+{
+	std::string id = std::to_string(++m_lastPartitionCommitId);
+	std::string sql = "UPDATE " + name + ".PartitionCommit SET id = " + id + ";"
+	                  "UPDATE MeasurementPartitions SET commitId = " + id + " WHERE name = '" + name + "';";
+	if (sqlite3_exec(&sqlite, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+		s_logger.logCritical(QString("Failed to mark the commit of the measurement partition '%1': %2").arg(name.c_str()).arg(sqlite3_errmsg(&sqlite)));
+}
+
+//////////////////////////////////////////////////////////////////////////
 
+//In WAL mode the main file commits first, so what's left is mostly the rollups counting measurements that didn't commit
+//in the partition, or chunks with measurements that weren't deleted from it. The ones in the chunks are deleted and
+//the rollups of the partition's period are recomputed
+Result<void> DB::reconcileMeasurementPartitions(sqlite3& db, std::map<std::string, int64_t> const& commitIds)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::vector<MeasurementPartition> partitions;
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		partitions = m_partitions;
+	}
 
-    Q_ASSERT(index < m_data.sensors.size());
+	for (MeasurementPartition const& partition: partitions)
+	{
+		auto it = commitIds.find(partition.name);
+		if (it == commitIds.end() || !sqlite3_db_filename(&db, partition.name.c_str()))
+			continue;
 
-    SensorId sensorId = m_data.sensors[index].id;
+		{
+			std::string sql = "SELECT id FROM " + partition.name + ".PartitionCommit;";
+			sqlite3_stmt* stmt;
+			if (sqlite3_prepare_v2(&db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+				return Error(QString("Cannot load the commit of the measurement partition '%1': %2").arg(partition.name.c_str()).arg(sqlite3_errmsg(&db)).toUtf8().data());
+			utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+			if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) == it->second)
+				continue;
+		}
 
-    {
-		QString sql = QString("DELETE FROM Measurements "
-                              "WHERE sensorId = %1;").arg(sensorId);
-        if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+		s_logger.logWarning(QString("The last write to the measurement partition '%1' didn't commit in all the files, recomputing its rollups").arg(partition.name.c_str()));
+
+		int64_t begin = IClock::to_time_t(partition.begin);
+		int64_t end = IClock::to_time_t(partition.end);
+		std::vector<std::string> sources = getMeasurementSources(db, Range<IClock::time_point>{ partition.begin, partition.end - std::chrono::seconds(1) });
+		std::string sql = "BEGIN TRANSACTION;";
+		if (std::find(sources.begin(), sources.end(), "ChunkedMeasurements") != sources.end())
+			sql += "DELETE FROM " + partition.name + ".Measurements WHERE id IN (SELECT id FROM ChunkedMeasurements WHERE timePoint >= " + std::to_string(begin) +
+			       " AND timePoint < " + std::to_string(end) + ");";
+		sql += getRebuildMeasurementRollupsSql(sources, begin, end) +
+		       "UPDATE " + partition.name + ".PartitionCommit SET id = " + std::to_string(it->second) + ";"
+		       "END TRANSACTION;";
+		if (sqlite3_exec(&db, sql.c_str(), nullptr, nullptr, nullptr))
 		{
-			s_logger.logCritical(QString("Failed to remove measurements for sensor %1: %2").arg(sensorId).arg(sqlite3_errmsg(m_sqlite)));
-			return;
+			Error error(QString("Cannot reconcile the measurement partition '%1': %2").arg(partition.name.c_str()).arg(sqlite3_errmsg(&db)).toUtf8().data());
+			sqlite3_exec(&db, "ROLLBACK;", nullptr, nullptr, nullptr);
+			return error;
 		}
-        emit measurementsRemoved(sensorId);
-    }
+	}
+	return success;
+}
 
-    for (Alarm& alarm: m_data.alarms)
-    {
-        alarm.descriptor.sensors.erase(sensorId);
-        //alarm.triggersPerSensor.erase(sensorId); //this will dissapear naturally
-    }
-	m_data.alarmsChanged = true;
+//////////////////////////////////////////////////////////////////////////
 
-    for (Report& report: m_data.reports)
-        report.descriptor.sensors.erase(sensorId);
+void DB::scheduleMeasurementPartitionSeal()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	m_data.reportsChanged = true;
+	std::optional<IClock::time_point> next;
+	{
+		std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+		for (MeasurementPartition const& partition: m_partitions)
+		{
+			if (!partition.sealed)
+				next = std::min(next.value_or(IClock::time_point::max()), partition.end + m_partitionSettings.sealDelay);
+		}
+	}
+	m_nextPartitionSealTimePoint = next;
+}
 
-	m_data.approximativeMeasurementCount = std::nullopt;
+//////////////////////////////////////////////////////////////////////////
 
-    s_logger.logInfo(QString("Removing sensor '%1'").arg(m_data.sensors[index].descriptor.name.c_str()));
+void DB::sealMeasurementPartitions()
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    m_data.sensors.erase(m_data.sensors.begin() + index);
-	m_data.sensorsAddedOrRemoved = true;
-    emit sensorRemoved(sensorId);
+	IClock::time_point now = m_clock->now();
+	if (!m_nextPartitionSealTimePoint.has_value() || now < *m_nextPartitionSealTimePoint)
+		return;
 
-    //refresh computed comms period as new sensors are removed
-    emit sensorTimeConfigChanged();
+	flushMeasurements();
 
-	save(true);
+	std::vector<std::string> names;
+	{
+		//the ingest thread routes its rows with the write mutex locked, so it sees the partitions either sealed or not
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+		utils::epilogue epi([this] { sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr); });
+
+		sqlite3_stmt* stmt = getCachedStatement("UPDATE MeasurementPartitions SET sealed = 1 WHERE name = ?1;");
+		if (!stmt)
+			return;
+
+		std::vector<std::pair<size_t, std::string>> candidates;
+		{
+			std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+			for (size_t i = 0; i < m_partitions.size(); i++)
+			{
+				if (!m_partitions[i].sealed && now >= m_partitions[i].end + m_partitionSettings.sealDelay)
+					candidates.emplace_back(i, m_partitions[i].name);
+			}
+		}
+
+		for (auto const& candidate: candidates)
+		{
+			std::string const& name = candidate.second;
+			sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+			int result = sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+			if (result != SQLITE_DONE)
+			{
+				s_logger.logCritical(QString("Failed to seal the measurement partition '%1': %2").arg(name.c_str()).arg(sqlite3_errmsg(m_sqlite)));
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+				m_partitions[candidate.first].sealed = true;
+			}
+			names.push_back(name);
+		}
+	}
+
+	//the sealed files are self contained from now on, ready to be backed up
+	for (std::string const& name: names)
+	{
+		std::string sql = "PRAGMA " + name + ".wal_checkpoint(TRUNCATE);";
+		if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+			s_logger.logWarning(QString("Cannot checkpoint the measurement partition '%1': %2").arg(name.c_str()).arg(sqlite3_errmsg(m_sqlite)));
+		s_logger.logInfo(QString("Sealed the measurement partition '%1'").arg(name.c_str()));
+	}
+
+	scheduleMeasurementPartitionSeal();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeSensorById(SensorId id)
+//Moves the measurements older than compressAfter from all the tables into chunks, oldest first. A batch of a table per
+//transaction until COLD_COMPRESSION_TIME_BUDGET is used, and the rest on the next calls
+void DB::compressColdMeasurements()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [id](Sensor const& sensor) { return sensor.id == id; });
-    if (it != m_data.sensors.end())
-        removeSensor(std::distance(m_data.sensors.begin(), it));
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	IClock::time_point now = m_clock->now();
+	if (!m_coldStorageSettings.enabled || !m_nextColdCompressionTimePoint.has_value() || now < *m_nextColdCompressionTimePoint)
+		return;
+	m_nextColdCompressionTimePoint = now + COLD_COMPRESSION_PERIOD;
+
+	flushMeasurements();
+
+	IClock::time_point start = IClock::rtNow();
+	IClock::time_point cutoff = now - m_coldStorageSettings.compressAfter;
+	Range<IClock::time_point> range = { IClock::time_point::min(), cutoff - std::chrono::seconds(1) };
+
+	size_t compressed = 0;
+	size_t chunkCount = 0;
+	size_t chunkBytes = 0;
+	bool done = true;
+	IClock::duration longestBatch = IClock::duration::zero();
+	for (std::string const& table: getMeasurementTables(*m_sqlite, range))
+	{
+		while (done)
+		{
+			IClock::time_point batchStart = IClock::rtNow();
+			Result<size_t> result = compressColdMeasurementBatch(table, cutoff, chunkCount, chunkBytes);
+			if (result != success)
+			{
+				s_logger.logCritical(QString("Failed to compress the measurements in %1: %2").arg(table.c_str()).arg(result.error().what().c_str()));
+				return;
+			}
+			if (result.payload() == 0)
+				break;
+			compressed += result.payload();
+
+			//no batch is started that would likely go over the budget
+			longestBatch = std::max(longestBatch, IClock::rtNow() - batchStart);
+			done = IClock::rtNow() - start + longestBatch < COLD_COMPRESSION_TIME_BUDGET;
+		}
+		if (!done)
+			break;
+	}
+	if (!done)
+		m_nextColdCompressionTimePoint = now;
+
+	if (compressed == 0)
+		return;
+
+	s_logger.logInfo(QString("Compressed %1 measurements in %2 chunks, %3 bytes each on average, in %4s")
+	                 .arg(compressed).arg(chunkCount).arg(double(chunkBytes) / double(compressed), 0, 'f', 2)
+	                 .arg(std::chrono::duration<float>(IClock::rtNow() - start).count()));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findSensorIndexByName(std::string const& name) const
+//About COLD_COMPRESSION_BATCH measurements, up to a whole second so they are deleted with one time range. A chunk per
+//sensor, split when too large
+Result<size_t> DB::compressColdMeasurementBatch(std::string const& table, IClock::time_point cutoff, size_t& chunkCount, size_t& chunkBytes)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&name](Sensor const& sensor) { return sensor.descriptor.name == name; });
-    if (it == m_data.sensors.end())
-        return -1;
+	std::lock_guard<std::mutex> wl(m_writeMutex);
+	sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	bool committed = false;
+	utils::epilogue epiTransaction([this, &committed] { if (!committed) sqlite3_exec(m_sqlite, "ROLLBACK;", nullptr, nullptr, nullptr); });
 
-    return int32_t(std::distance(m_data.sensors.begin(), it));
+	//the batch ends before the time point of the measurement after it, or a second after the first one if they share it
+	int64_t end = IClock::to_time_t(cutoff);
+	{
+		sqlite3_stmt* stmt = getCachedStatement(("SELECT MIN(timePoint), (SELECT timePoint FROM " + table + " WHERE timePoint < ?1 ORDER BY timePoint LIMIT 1 OFFSET ?2) "
+		                                         "FROM " + table + " WHERE timePoint < ?1;").c_str());
+		if (!stmt)
+			return Error(QString("Cannot select the cold measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, end);
+		sqlite3_bind_int64(stmt, 2, int64_t(COLD_COMPRESSION_BATCH));
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+			return Error(QString("Cannot select the cold measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+			return size_t(0);
+		if (sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+			end = std::max(sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 0) + 1);
+	}
+
+	std::vector<Measurement> measurements;
+	{
+		sqlite3_stmt* stmt = getCachedStatement(("SELECT * FROM " + table + " WHERE timePoint < ?1;").c_str());
+		if (!stmt)
+			return Error(QString("Cannot select the cold measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, end);
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+			measurements.push_back(unpackMeasurement(stmt));
+	}
+	if (measurements.empty())
+		return size_t(0);
+
+	std::sort(measurements.begin(), measurements.end(), [](Measurement const& a, Measurement const& b)
+	{
+		return std::make_pair(a.descriptor.sensorId, a.descriptor.index) < std::make_pair(b.descriptor.sensorId, b.descriptor.index);
+	});
+
+	sqlite3_stmt* insertStmt = getCachedStatement("INSERT INTO MeasurementChunks (sensorId, firstIdx, lastIdx, beginTimePoint, endTimePoint, minId, maxId, count, data) "
+	                                              "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);");
+	if (!insertStmt)
+		return Error(QString("Cannot insert the measurement chunks: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+	std::optional<Range<IClock::time_point>> chunksRange;
+	std::vector<Measurement> chunk;
+	for (size_t i = 0; i < measurements.size();)
+	{
+		chunk.clear();
+		SensorId sensorId = measurements[i].descriptor.sensorId;
+		for (; i < measurements.size() && measurements[i].descriptor.sensorId == sensorId && chunk.size() < MAX_MEASUREMENT_CHUNK_SIZE; i++)
+			chunk.push_back(measurements[i]);
+
+		Range<IClock::time_point> timePoints = { chunk.front().timePoint, chunk.front().timePoint };
+		Range<MeasurementId> ids = { chunk.front().id, chunk.front().id };
+		for (Measurement const& m: chunk)
+		{
+			timePoints.min = std::min(timePoints.min, m.timePoint);
+			timePoints.max = std::max(timePoints.max, m.timePoint);
+			ids.min = std::min(ids.min, m.id);
+			ids.max = std::max(ids.max, m.id);
+		}
+		std::vector<uint8_t> data = chunk::encode(chunk);
+
+		utils::epilogue epi([insertStmt] { sqlite3_reset(insertStmt); });
+		sqlite3_bind_int64(insertStmt, 1, sensorId);
+		sqlite3_bind_int64(insertStmt, 2, chunk.front().descriptor.index);
+		sqlite3_bind_int64(insertStmt, 3, chunk.back().descriptor.index);
+		sqlite3_bind_int64(insertStmt, 4, IClock::to_time_t(timePoints.min));
+		sqlite3_bind_int64(insertStmt, 5, IClock::to_time_t(timePoints.max));
+		sqlite3_bind_int64(insertStmt, 6, int64_t(ids.min));
+		sqlite3_bind_int64(insertStmt, 7, int64_t(ids.max));
+		sqlite3_bind_int64(insertStmt, 8, int64_t(chunk.size()));
+		sqlite3_bind_blob(insertStmt, 9, data.data(), int(data.size()), SQLITE_STATIC);
+		if (sqlite3_step(insertStmt) != SQLITE_DONE)
+			return Error(QString("Cannot insert the measurement chunk of sensor %1: %2").arg(sensorId).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+		chunkCount++;
+		chunkBytes += data.size();
+		chunksRange = Range<IClock::time_point>{ std::min(timePoints.min, chunksRange.value_or(timePoints).min), std::max(timePoints.max, chunksRange.value_or(timePoints).max) };
+	}
+
+	{
+		//the same range they were selected with, in the timePoint index
+		sqlite3_stmt* stmt = getCachedStatement(("DELETE FROM " + table + " WHERE timePoint < ?1;").c_str());
+		if (!stmt)
+			return Error(QString("Cannot delete the compressed measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_int64(stmt, 1, end);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			return Error(QString("Cannot delete the compressed measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	}
+	markMeasurementPartitionChanged(table);
+
+	{
+		//before the commit, so the readers that see the chunks also read them
+		std::lock_guard<std::mutex> lg2(m_partitionsMutex);
+		if (m_chunksRange.has_value())
+			m_chunksRange = Range<IClock::time_point>{ std::min(m_chunksRange->min, chunksRange->min), std::max(m_chunksRange->max, chunksRange->max) };
+		else
+			m_chunksRange = chunksRange;
+	}
+	if (sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot commit the measurement chunks: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	committed = true;
+
+	return measurements.size();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findSensorIndexById(SensorId id) const
+Result<bool> DB::setChunkedMeasurement(Measurement const& measurement)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&id](Sensor const& sensor) { return sensor.id == id; });
-    if (it == m_data.sensors.end())
-        return -1;
-
-    return int32_t(std::distance(m_data.sensors.begin(), it));
+	Result<size_t> result = setChunkedMeasurements({ measurement });
+	if (result != success)
+		return result.error();
+	return result.payload() > 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findSensorIndexByAddress(SensorAddress address) const
+Result<size_t> DB::setChunkedMeasurements(std::vector<Measurement> const& measurements)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&address](Sensor const& sensor) { return sensor.address == address; });
-    if (it == m_data.sensors.end())
-        return -1;
+	//by sensor and index, so the ones in the same chunk are next to each other
+	std::vector<Measurement const*> sorted;
+	sorted.reserve(measurements.size());
+	for (Measurement const& m : measurements)
+		sorted.push_back(&m);
+	std::sort(sorted.begin(), sorted.end(), [](Measurement const* a, Measurement const* b)
+	{
+		return a->descriptor.sensorId != b->descriptor.sensorId ? a->descriptor.sensorId < b->descriptor.sensorId : a->descriptor.index < b->descriptor.index;
+	});
 
-    return int32_t(std::distance(m_data.sensors.begin(), it));
+	sqlite3_stmt* stmt = getCachedStatement("SELECT id, data, firstIdx, lastIdx FROM MeasurementChunks WHERE sensorId = ?1 AND lastIdx >= ?2 AND firstIdx <= ?2 AND maxId >= ?3 AND minId <= ?3;");
+	if (!stmt)
+		return Error(QString("Failed to get the measurement chunk: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	sqlite3_stmt* updateStmt = getCachedStatement("UPDATE MeasurementChunks SET data = ?1 WHERE id = ?2;");
+	if (!updateStmt)
+		return Error(QString("Failed to update the measurement chunk: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+	size_t found = 0;
+	std::vector<bool> done(sorted.size(), false);
+	std::vector<Measurement> chunkMeasurements;
+	std::unordered_map<MeasurementId, size_t> positions;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		if (done[i])
+			continue;
+
+		Measurement const& measurement = *sorted[i];
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+		sqlite3_bind_int64(stmt, 1, measurement.descriptor.sensorId);
+		sqlite3_bind_int64(stmt, 2, measurement.descriptor.index);
+		sqlite3_bind_int64(stmt, 3, int64_t(measurement.id));
+
+		//the chunks overlapping it, usually one
+		while (!done[i] && sqlite3_step(stmt) == SQLITE_ROW)
+		{
+			int64_t chunkId = sqlite3_column_int64(stmt, 0);
+			if (!chunk::decode(sqlite3_column_blob(stmt, 1), size_t(sqlite3_column_bytes(stmt, 1)), chunkMeasurements))
+				return Error(QString("Corrupted measurement chunk %1").arg(chunkId).toUtf8().data());
+			uint32_t firstIndex = uint32_t(sqlite3_column_int64(stmt, 2));
+			uint32_t lastIndex = uint32_t(sqlite3_column_int64(stmt, 3));
+
+			positions.clear();
+			for (size_t p = 0; p < chunkMeasurements.size(); p++)
+				positions[chunkMeasurements[p].id] = p;
+
+			//this one and the ones after it in the chunk
+			bool changed = false;
+			for (size_t j = i; j < sorted.size() && sorted[j]->descriptor.sensorId == measurement.descriptor.sensorId && sorted[j]->descriptor.index <= lastIndex; j++)
+			{
+				if (done[j] || sorted[j]->descriptor.index < firstIndex)
+					continue;
+				auto it = positions.find(sorted[j]->id);
+				if (it == positions.end())
+					continue;
+				chunkMeasurements[it->second] = *sorted[j];
+				done[j] = true;
+				changed = true;
+				found++;
+			}
+			if (!changed)
+				continue;
+
+			std::vector<uint8_t> data = chunk::encode(chunkMeasurements);
+			utils::epilogue epi2([updateStmt] { sqlite3_reset(updateStmt); });
+			sqlite3_bind_blob(updateStmt, 1, data.data(), int(data.size()), SQLITE_STATIC);
+			sqlite3_bind_int64(updateStmt, 2, chunkId);
+			if (sqlite3_step(updateStmt) != SQLITE_DONE)
+				return Error(QString("Failed to update the measurement chunk: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+		done[i] = true;
+	}
+	return found;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findSensorIndexBySerialNumber(SensorSerialNumber serialNumber) const
+//Drops and downsamples the measurements as the retention policies say. A slice of time of the sensors of a policy
+//per transaction, oldest first, until RETENTION_TIME_BUDGET is used, and the rest on the next calls
+void DB::applyRetentionPolicies()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&serialNumber](Sensor const& sensor) { return sensor.serialNumber == serialNumber; });
-    if (it == m_data.sensors.end())
-        return -1;
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    return int32_t(std::distance(m_data.sensors.begin(), it));
+	IClock::time_point now = m_clock->now();
+	if (m_retentionPolicies.empty() || !m_nextRetentionTimePoint.has_value() || now < *m_nextRetentionTimePoint)
+		return;
+	m_nextRetentionTimePoint = now + RETENTION_PERIOD;
+
+	flushMeasurements();
+
+	//each sensor goes by the first policy matching it
+	std::vector<std::string> sensorIds(m_retentionPolicies.size());
+	std::string allSensorIds;
+	bool allSensorsCovered = true;
+	for (Sensor const& sensor: m_data.sensors)
+	{
+		auto it = std::find_if(m_retentionPolicies.begin(), m_retentionPolicies.end(), [&sensor](RetentionPolicy const& policy)
+		{
+			return !policy.filterSensors || policy.sensors.find(sensor.id) != policy.sensors.end();
+		});
+		if (it == m_retentionPolicies.end())
+		{
+			allSensorsCovered = false;
+			continue;
+		}
+		std::string& ids = sensorIds[size_t(it - m_retentionPolicies.begin())];
+		ids += (ids.empty() ? "" : ", ") + std::to_string(sensor.id);
+		allSensorIds += (allSensorIds.empty() ? "" : ", ") + std::to_string(sensor.id);
+	}
+
+	IClock::time_point start = IClock::rtNow();
+	std::optional<IClock::time_point> oldest;
+	size_t removed = 0;
+	bool done = true;
+	IClock::duration longestSlice = IClock::duration::zero();
+
+	//the partitions that expired for all the sensors are detached and deleted whole, instead of having their rows deleted
+	if (allSensorsCovered && !allSensorIds.empty())
+	{
+		IClock::time_point expiredEnd = IClock::time_point::max();
+		for (size_t i = 0; i < m_retentionPolicies.size(); i++)
+		{
+			if (!sensorIds[i].empty())
+				expiredEnd = std::min(expiredEnd, now - m_retentionPolicies[i].keepDownsampled);
+		}
+
+		std::vector<MeasurementPartition> partitions = getMeasurementPartitions();
+		std::sort(partitions.begin(), partitions.end(), [](MeasurementPartition const& a, MeasurementPartition const& b) { return a.begin < b.begin; });
+		for (MeasurementPartition const& partition: partitions)
+		{
+			if (!done || partition.end > expiredEnd)
+				break;
+			if (!sqlite3_db_filename(m_sqlite, partition.name.c_str()))
+				continue;
+
+			//the policy only matters for the downsampling, and nothing is kept
+			Result<size_t> result = applyRetentionPolicy(m_retentionPolicies.front(), allSensorIds, partition.begin, partition.end, true, &partition);
+			if (result != success)
+			{
+				s_logger.logCritical(QString("Failed to drop the expired measurement partition '%1': %2").arg(partition.name.c_str()).arg(result.error().what().c_str()));
+				return;
+			}
+			removeMeasurementPartitions({ partition.name });
+			s_logger.logInfo(QString("Dropped the expired measurement partition '%1'").arg(partition.name.c_str()));
+
+			removed += result.payload();
+			for (auto& p: m_retentionProgress)
+			{
+				p.second.dropped = std::max(p.second.dropped, partition.end);
+				p.second.downsampled = std::max(p.second.downsampled, partition.end);
+			}
+			done = IClock::rtNow() - start < RETENTION_TIME_BUDGET;
+		}
+	}
+
+	for (size_t i = 0; i < m_retentionPolicies.size() && done; i++)
+	{
+		RetentionPolicy const& policy = m_retentionPolicies[i];
+		if (sensorIds[i].empty())
+			continue;
+
+		//whole slice periods, or whole decimation periods when they are longer, so no period is split between two slices
+		int64_t period = policy.downsampling == RetentionPolicy::Downsampling::Decimate ? std::max<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(policy.decimationPeriod).count(), 1) : RETENTION_SLICE_PERIOD;
+		int64_t slice = (RETENTION_SLICE_PERIOD + period - 1) / period * period;
+		auto alignDown = [slice](IClock::time_point tp)
+		{
+			int64_t t = IClock::to_time_t(tp);
+			return IClock::from_time_t(t - ((t % slice) + slice) % slice);
+		};
+		IClock::time_point dropCutoff = alignDown(now - policy.keepDownsampled);
+		IClock::time_point rawCutoff = alignDown(now - policy.keepRaw);
+
+		auto it = m_retentionProgress.find(i);
+		if (it == m_retentionProgress.end())
+		{
+			if (!oldest.has_value())
+			{
+				//from all the tables, the chunks and the rollups
+				std::string sql = "SELECT MIN(t) FROM (" + unionSelects(getMeasurementTables(*m_sqlite), [](std::string const& table)
+				{
+					return "SELECT MIN(timePoint) AS t FROM " + table;
+				}) + " UNION ALL SELECT MIN(beginTimePoint) FROM MeasurementChunks UNION ALL SELECT MIN(timePoint) FROM " + getRollupTable(HOURLY_ROLLUP_PERIOD) +
+				     " UNION ALL SELECT MIN(timePoint) FROM " + getRollupTable(DAILY_ROLLUP_PERIOD) + ");";
+				sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+				if (!stmt)
+					return;
+				utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+				//nothing to apply the policies to yet
+				oldest = now;
+				if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+					oldest = IClock::from_time_t(sqlite3_column_int64(stmt, 0));
+			}
+			IClock::time_point begin = std::min(alignDown(*oldest), rawCutoff);
+			it = m_retentionProgress.emplace(i, RetentionProgress{ begin, begin }).first;
+		}
+		RetentionProgress& progress = it->second;
+
+		for (bool drop: { true, false })
+		{
+			IClock::time_point& from = drop ? progress.dropped : progress.downsampled;
+			IClock::time_point cutoff = drop ? dropCutoff : rawCutoff;
+			if (!drop)
+				progress.downsampled = std::max(progress.downsampled, progress.dropped);
+
+			while (done && from < cutoff)
+			{
+				IClock::time_point to = std::min(cutoff, alignDown(from) + std::chrono::seconds(slice));
+				IClock::time_point sliceStart = IClock::rtNow();
+				Result<size_t> result = applyRetentionPolicy(policy, sensorIds[i], from, to, drop);
+				if (result != success)
+				{
+					s_logger.logCritical(QString("Failed to apply the retention policy '%1': %2").arg(policy.name.c_str()).arg(result.error().what().c_str()));
+					return;
+				}
+				removed += result.payload();
+				from = to;
+
+				//no slice is started that would likely go over the budget
+				longestSlice = std::max(longestSlice, IClock::rtNow() - sliceStart);
+				done = IClock::rtNow() - start + longestSlice < RETENTION_TIME_BUDGET;
+			}
+		}
+	}
+
+	if (removed > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+			m_recentMeasurements.clear();
+		}
+		s_logger.logInfo(QString("Removed %1 measurements by the retention policies in %2s").arg(removed).arg(std::chrono::duration<float>(IClock::rtNow() - start).count()));
+		emit measurementsChanged();
+	}
+
+	if (!reclaimFreePages())
+		done = false;
+	if (!done)
+		m_nextRetentionTimePoint = now;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findUnboundSensorIndex() const
+//The rows of an expired partition are only counted, the caller removes the partition once this commits
+Result<size_t> DB::applyRetentionPolicy(RetentionPolicy const& policy, std::string const& sensorIds, IClock::time_point begin, IClock::time_point end, bool drop,
+                                        MeasurementPartition const* expiredPartition)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [](Sensor const& sensor) { return sensor.state == Sensor::State::Unbound; });
-    if (it == m_data.sensors.end())
-        return -1;
+	std::lock_guard<std::mutex> wl(m_writeMutex);
+	sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	bool committed = false;
+	utils::epilogue epiTransaction([this, &committed] { if (!committed) sqlite3_exec(m_sqlite, "ROLLBACK;", nullptr, nullptr, nullptr); });
+
+	Range<IClock::time_point> range = { begin, end - std::chrono::seconds(1) };
+	std::string where = " WHERE timePoint >= " + std::to_string(IClock::to_time_t(begin)) + " AND timePoint < " + std::to_string(IClock::to_time_t(end)) +
+	                    " AND +sensorId IN (" + sensorIds + ")"; //the + keeps sqlite from scanning each sensor with the (sensorId, idx) index
+	std::vector<std::string> sources = getMeasurementSources(*m_sqlite, range);
+	bool chunked = sources.back() == "ChunkedMeasurements";
+
+	//the first measurement of each sensor in every period is kept, from all the tables and chunks together
+	bool decimate = !drop && policy.downsampling == RetentionPolicy::Downsampling::Decimate;
+	std::unordered_set<MeasurementId> samples;
+	if (decimate)
+	{
+		int64_t period = std::max<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(policy.decimationPeriod).count(), 1);
+		std::string sql = "CREATE TEMP TABLE IF NOT EXISTS RetentionSamples (id INTEGER PRIMARY KEY); DELETE FROM temp.RetentionSamples; "
+		                  "INSERT INTO temp.RetentionSamples SELECT id FROM (SELECT id, MIN(timePoint) FROM (" + unionSelects(sources, [&where](std::string const& table)
+		{
+			return "SELECT id, sensorId, timePoint FROM " + table + where;
+		}) + ") GROUP BY sensorId, timePoint / " + std::to_string(period) + ");";
+		if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+			return Error(QString("Cannot decimate the measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+		if (chunked)
+		{
+			sqlite3_stmt* stmt = getCachedStatement("SELECT id FROM temp.RetentionSamples;");
+			if (!stmt)
+				return Error(QString("Cannot decimate the measurements: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			while (sqlite3_step(stmt) == SQLITE_ROW)
+				samples.insert(MeasurementId(sqlite3_column_int64(stmt, 0)));
+		}
+	}
+
+	//what's removed from every hour, for the kept counts of the rollups
+	std::map<std::pair<SensorId, int64_t>, int64_t> removedCounts;
+	std::string removedWhere = where + (decimate ? " AND id NOT IN temp.RetentionSamples" : "");
+
+	size_t removed = 0;
+	for (std::string const& table: getMeasurementTables(*m_sqlite, range))
+	{
+		{
+			std::string sql = "SELECT sensorId, timePoint - timePoint % " + std::to_string(HOURLY_ROLLUP_PERIOD) + ", COUNT(*) FROM " + table + removedWhere +
+			                  " GROUP BY sensorId, timePoint / " + std::to_string(HOURLY_ROLLUP_PERIOD) + ";";
+			sqlite3_stmt* stmt;
+			if (sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+				return Error(QString("Cannot count the measurements to remove from %1: %2").arg(table.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+			utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+			while (sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				removedCounts[{ SensorId(sqlite3_column_int64(stmt, 0)), sqlite3_column_int64(stmt, 1) }] += sqlite3_column_int64(stmt, 2);
+				if (expiredPartition && table == expiredPartition->name + ".Measurements")
+					removed += size_t(sqlite3_column_int64(stmt, 2));
+			}
+		}
+		if (expiredPartition && table == expiredPartition->name + ".Measurements")
+			continue;
+
+		std::string sql = "DELETE FROM " + table + removedWhere + ";";
+		if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+			return Error(QString("Cannot remove the measurements from %1: %2").arg(table.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		if (sqlite3_changes(m_sqlite) > 0)
+		{
+			removed += size_t(sqlite3_changes(m_sqlite));
+			markMeasurementPartitionChanged(table);
+		}
+	}
+
+	if (chunked)
+	{
+		std::vector<std::pair<int64_t, std::vector<Measurement>>> chunks;
+		{
+			std::string sql = "SELECT id, data FROM MeasurementChunks WHERE endTimePoint >= " + std::to_string(IClock::to_time_t(begin)) +
+			                  " AND beginTimePoint < " + std::to_string(IClock::to_time_t(end)) + " AND +sensorId IN (" + sensorIds + ");";
+			sqlite3_stmt* stmt;
+			if (sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+				return Error(QString("Cannot get the measurement chunks: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+			utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+			while (sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				chunks.emplace_back(sqlite3_column_int64(stmt, 0), std::vector<Measurement>());
+				if (!chunk::decode(sqlite3_column_blob(stmt, 1), size_t(sqlite3_column_bytes(stmt, 1)), chunks.back().second))
+					return Error(QString("Corrupted measurement chunk %1").arg(chunks.back().first).toUtf8().data());
+			}
+		}
+
+		//the chunks left empty are deleted, the others get the ranges of what remains in them
+		sqlite3_stmt* deleteStmt = getCachedStatement("DELETE FROM MeasurementChunks WHERE id = ?1;");
+		sqlite3_stmt* updateStmt = getCachedStatement("UPDATE MeasurementChunks SET firstIdx = ?2, lastIdx = ?3, beginTimePoint = ?4, endTimePoint = ?5, minId = ?6, maxId = ?7, count = ?8, data = ?9 WHERE id = ?1;");
+		if (!deleteStmt || !updateStmt)
+			return Error(QString("Cannot change the measurement chunks: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+		for (auto& c: chunks)
+		{
+			std::vector<Measurement>& measurements = c.second;
+			size_t count = measurements.size();
+			measurements.erase(std::remove_if(measurements.begin(), measurements.end(), [&](Measurement const& m)
+			{
+				if (m.timePoint < begin || m.timePoint >= end || (decimate && samples.find(m.id) != samples.end()))
+					return false;
+				int64_t tp = IClock::to_time_t(m.timePoint);
+				removedCounts[{ m.descriptor.sensorId, tp - tp % HOURLY_ROLLUP_PERIOD }]++;
+				return true;
+			}), measurements.end());
+			if (measurements.size() == count)
+				continue;
+			removed += count - measurements.size();
+
+			std::vector<uint8_t> data;
+			sqlite3_stmt* stmt = measurements.empty() ? deleteStmt : updateStmt;
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			sqlite3_bind_int64(stmt, 1, c.first);
+			if (!measurements.empty())
+			{
+				Range<IClock::time_point> timePoints = { measurements.front().timePoint, measurements.front().timePoint };
+				Range<MeasurementId> ids = { measurements.front().id, measurements.front().id };
+				for (Measurement const& m: measurements)
+				{
+					timePoints.min = std::min(timePoints.min, m.timePoint);
+					timePoints.max = std::max(timePoints.max, m.timePoint);
+					ids.min = std::min(ids.min, m.id);
+					ids.max = std::max(ids.max, m.id);
+				}
+				data = chunk::encode(measurements);
+				sqlite3_bind_int64(stmt, 2, measurements.front().descriptor.index);
+				sqlite3_bind_int64(stmt, 3, measurements.back().descriptor.index);
+				sqlite3_bind_int64(stmt, 4, IClock::to_time_t(timePoints.min));
+				sqlite3_bind_int64(stmt, 5, IClock::to_time_t(timePoints.max));
+				sqlite3_bind_int64(stmt, 6, int64_t(ids.min));
+				sqlite3_bind_int64(stmt, 7, int64_t(ids.max));
+				sqlite3_bind_int64(stmt, 8, int64_t(measurements.size()));
+				sqlite3_bind_blob(stmt, 9, data.data(), int(data.size()), SQLITE_STATIC);
+			}
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+				return Error(QString("Cannot change the measurement chunk %1: %2").arg(c.first).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+		//m_chunksRange stays as it was, it only has to cover the chunks
+	}
+
+	//the buckets keep their aggregates, only the kept counts go down
+	std::map<std::pair<SensorId, int64_t>, int64_t> removedDailyCounts;
+	for (auto const& p: removedCounts)
+		removedDailyCounts[{ p.first.first, p.first.second - p.first.second % DAILY_ROLLUP_PERIOD }] += p.second;
+	for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+	{
+		sqlite3_stmt* stmt = getCachedStatement((std::string("UPDATE ") + getRollupTable(period) + " SET keptCount = keptCount - ?3 WHERE sensorId = ?1 AND timePoint = ?2;").c_str());
+		if (!stmt)
+			return Error(QString("Cannot change the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		for (auto const& p: period == HOURLY_ROLLUP_PERIOD ? removedCounts : removedDailyCounts)
+		{
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			sqlite3_bind_int64(stmt, 1, p.first.first);
+			sqlite3_bind_int64(stmt, 2, p.first.second);
+			sqlite3_bind_int64(stmt, 3, p.second);
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+				return Error(QString("Cannot change the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+	}
 
-    return int32_t(std::distance(m_data.sensors.begin(), it));
-}
+	//the rollup buckets that end before the slice, including the ones started in the previous slices
+	if (drop)
+	{
+		for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+		{
+			std::string sql = std::string("DELETE FROM ") + getRollupTable(period) + " WHERE sensorId IN (" + sensorIds + ") AND timePoint <= " + std::to_string(IClock::to_time_t(end) - period) + ";";
+			if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+				return Error(QString("Cannot remove the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+	}
 
-//////////////////////////////////////////////////////////////////////////
+	if (expiredPartition && sqlite3_exec(m_sqlite, getRemoveMeasurementPartitionSql(*expiredPartition).c_str(), nullptr, nullptr, nullptr))
+		return Error(QString("Cannot remove the measurement partition '%1': %2").arg(expiredPartition->name.c_str()).arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 
-std::optional<DB::Sensor> DB::findSensorByName(std::string const& name) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&name](Sensor const& sensor) { return sensor.descriptor.name == name; });
-    if (it == m_data.sensors.end())
-        return std::nullopt;
+	if (sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot commit the retention: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	committed = true;
 
-    return *it;
+	//the counts only change with what was committed
+	for (auto& p: removedCounts)
+		p.second = -p.second;
+	addMeasurementCounts(removedCounts);
+	return removed;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Sensor> DB::findSensorById(SensorId id) const
+//Only the files in auto_vacuum = INCREMENTAL give their free pages back, load converts the older ones. A file that failed to
+//convert reuses them for the new measurements
+bool DB::reclaimFreePages()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&id](Sensor const& sensor) { return sensor.id == id; });
-    if (it == m_data.sensors.end())
-        return std::nullopt;
+	std::vector<std::string> schemas = { "main" };
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		for (MeasurementPartition const& partition: m_partitions)
+		{
+			if (sqlite3_db_filename(m_sqlite, partition.name.c_str()))
+				schemas.push_back(partition.name);
+		}
+	}
 
-    return *it;
+	bool done = true;
+	for (std::string const& schema: schemas)
+	{
+		auto getPragma = [this, &schema](const char* pragma) -> int64_t
+		{
+			sqlite3_stmt* stmt = getCachedStatement(("PRAGMA " + schema + "." + pragma + ";").c_str());
+			if (!stmt)
+				return 0;
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			return sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+		};
+		//2 is INCREMENTAL
+		int64_t freePages = getPragma("auto_vacuum") == 2 ? getPragma("freelist_count") : 0;
+		if (freePages == 0)
+			continue;
+
+		//a bounded step in its own transaction, so the ingest doesn't wait for all of them
+		std::lock_guard<std::mutex> wl(m_writeMutex);
+		std::string sql = "PRAGMA " + schema + ".incremental_vacuum(" + std::to_string(MAX_INCREMENTAL_VACUUM_PAGES) + ");";
+		if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+		{
+			s_logger.logWarning(QString("Cannot reclaim the free pages of '%1': %2").arg(schema.c_str()).arg(sqlite3_errmsg(m_sqlite)));
+			continue;
+		}
+		if (freePages > MAX_INCREMENTAL_VACUUM_PAGES)
+			done = false;
+	}
+	return done;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Sensor> DB::findSensorByAddress(SensorAddress address) const
+void DB::ingestThreadProc()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&address](Sensor const& sensor) { return sensor.address == address; });
-    if (it == m_data.sensors.end())
-        return std::nullopt;
+	std::vector<IngestBatch> batches;
+	while (true)
+	{
+		batches.clear();
+		if (!m_ingestQueue->pop_front(batches, std::numeric_limits<size_t>::max(), true))
+			break; //exit
+
+		//keep gathering until the oldest batch is too old, there are enough rows or somebody wants to read them
+		std::chrono::high_resolution_clock::time_point deadline = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(m_ingestMaxLatency.load());
+		size_t maxBatchSize = m_ingestMaxBatchSize.load();
+		size_t rowCount = 0;
+		bool flush = false;
+		size_t counted = 0;
+		while (true)
+		{
+			for (; counted < batches.size(); counted++)
+			{
+				rowCount += batches[counted].size();
+				flush |= batches[counted].empty();
+			}
+			if (flush || rowCount >= maxBatchSize)
+				break;
+
+			std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+			if (now >= deadline)
+				break;
+			if (!m_ingestQueue->pop_front_timeout(batches, std::numeric_limits<size_t>::max(), deadline - now) &&
+			        std::chrono::high_resolution_clock::now() < deadline)
+				break; //exiting, commit what we have
+		}
 
-    return *it;
+		commitIngestBatches(batches);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Sensor> DB::findSensorBySerialNumber(SensorSerialNumber serialNumber) const
+void DB::commitIngestBatches(std::vector<IngestBatch> const& batches)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [&serialNumber](Sensor const& sensor) { return sensor.serialNumber == serialNumber; });
-    if (it == m_data.sensors.end())
-        return std::nullopt;
+	//outside the transaction, ATTACH can't run in one
+	attachMeasurementPartitions(*m_ingestSqlite);
 
-    return *it;
-}
+	std::vector<Measurement> committed;
+	std::vector<Measurement> retriggered;
+	std::unique_lock<std::mutex> writeLock(m_writeMutex);
 
-//////////////////////////////////////////////////////////////////////////
+	//a statement per row: its partition if there is one and it's not sealed, the main table otherwise
+	std::vector<sqlite3_stmt*> stmts;
+	std::vector<int32_t> stmtPartitions;
+	{
+		std::lock_guard<std::mutex> lg(m_partitionsMutex);
+		for (IngestBatch const& batch : batches)
+		{
+			for (Measurement const& m : batch)
+			{
+				sqlite3_stmt* stmt = m_addMeasurementsStmt.get();
+				int32_t partitionIndex = findMeasurementPartitionIndex(m.timePoint);
+				MeasurementPartition const* partition = partitionIndex >= 0 ? &m_partitions[static_cast<size_t>(partitionIndex)] : nullptr;
+				if (partition && !partition->sealed && sqlite3_db_filename(m_ingestSqlite, partition->name.c_str()))
+				{
+					m_addPartitionMeasurementsStmts.resize(m_partitions.size());
+					std::shared_ptr<sqlite3_stmt>& partitionStmt = m_addPartitionMeasurementsStmts[static_cast<size_t>(partitionIndex)];
+					if (!partitionStmt)
+					{
+						sqlite3_stmt* newStmt;
+						if (sqlite3_prepare_v2(m_ingestSqlite, getAddMeasurementSql(partition->name + ".Measurements").c_str(), -1, &newStmt, nullptr) == SQLITE_OK)
+							partitionStmt.reset(newStmt, &sqlite3_finalize);
+						else
+							s_logger.logCritical(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+					}
+					if (partitionStmt)
+						stmt = partitionStmt.get();
+				}
+				stmts.push_back(stmt);
+				stmtPartitions.push_back(stmt == m_addMeasurementsStmt.get() ? -1 : partitionIndex);
+			}
+		}
+	}
 
-std::optional<DB::Sensor> DB::findUnboundSensor() const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.sensors.begin(), m_data.sensors.end(), [](Sensor const& sensor) { return sensor.state == Sensor::State::Unbound; });
-    if (it == m_data.sensors.end())
-        return std::nullopt;
+	//the batches are numbered in the order they were pushed
+	uint64_t firstBatch = 0;
+	{
+		std::lock_guard<std::mutex> lg(m_ingestCommitMutex);
+		firstBatch = m_ingestCommittedCount + 1;
+	}
+	std::vector<bool> failedBatches(batches.size(), false);
+	QStringList errors; //logged after the transaction, the log is written to the same file
 
-    return *it;
-}
+	//immediate, as the id read below must not be upgraded to a write later, after another connection wrote.
+	//Without a transaction, or once a failure rolled it back, nothing more is written: the rows would commit one by one
+	bool aborted = false;
+	if (sqlite3_exec(m_ingestSqlite, "BEGIN IMMEDIATE TRANSACTION;", nullptr, nullptr, nullptr) != SQLITE_OK)
+	{
+		s_logger.logCritical(QString("Failed to begin the measurements transaction: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+		aborted = true;
+	}
 
-//////////////////////////////////////////////////////////////////////////
+	//rows can also be added to the main table directly, with its autoincrement
+	{
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(m_ingestSqlite, "SELECT seq FROM sqlite_sequence WHERE name = 'Measurements';", -1, &stmt, nullptr) == SQLITE_OK)
+		{
+			if (sqlite3_step(stmt) == SQLITE_ROW)
+				m_lastMeasurementId = std::max(m_lastMeasurementId, MeasurementId(sqlite3_column_int64(stmt, 0)));
+			sqlite3_finalize(stmt);
+		}
+	}
 
-size_t DB::getAlarmCount() const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	//A resent measurement can be in another file than the one it goes to now: in the main file from before its partition
+	//was added, in a partition sealed since, or in a chunk. The unique index of a table only catches the ones in it
+	std::vector<uint32_t> stored;
+	{
+		std::string sql = "SELECT idx FROM (" + unionSelects(getMeasurementSources(*m_ingestSqlite), [](std::string const& table)
+		{
+			return "SELECT idx FROM " + table + " WHERE sensorId = ?1 AND idx >= ?2 AND idx <= ?3";
+		}) + ");";
+		if (sql != m_findIngestDuplicatesSql)
+		{
+			sqlite3_stmt* stmt;
+			m_findIngestDuplicatesStmt = nullptr;
+			m_findIngestDuplicatesSql.clear();
+			if (sqlite3_prepare_v2(m_ingestSqlite, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK)
+			{
+				m_findIngestDuplicatesStmt.reset(stmt, &sqlite3_finalize);
+				m_findIngestDuplicatesSql = sql;
+			}
+			else
+				errors.push_back(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+		}
+	}
 
-    return m_data.alarms.size();
-}
+	std::set<int32_t> changedPartitions;
+	size_t stmtIndex = 0;
+	for (size_t batchIndex = 0; batchIndex < batches.size() && !aborted; batchIndex++)
+	{
+		IngestBatch const& batch = batches[batchIndex];
 
-//////////////////////////////////////////////////////////////////////////
+		//a batch has the measurements of one sensor. Only the ones not newer than all the stored ones are looked for
+		stored.clear();
+		if (!batch.empty() && m_findIngestDuplicatesStmt)
+		{
+			SensorId sensorId = batch.front().descriptor.sensorId;
+			auto minmax = std::minmax_element(batch.begin(), batch.end(), [](Measurement const& a, Measurement const& b) { return a.descriptor.index < b.descriptor.index; });
+			auto it = m_ingestStoredIndices.find(sensorId);
+			if (it == m_ingestStoredIndices.end() || minmax.first->descriptor.index <= it->second)
+			{
+				sqlite3_stmt* stmt = m_findIngestDuplicatesStmt.get();
+				sqlite3_bind_int64(stmt, 1, sensorId);
+				sqlite3_bind_int64(stmt, 2, minmax.first->descriptor.index);
+				sqlite3_bind_int64(stmt, 3, it == m_ingestStoredIndices.end() ? std::numeric_limits<uint32_t>::max() : minmax.second->descriptor.index);
+				while (sqlite3_step(stmt) == SQLITE_ROW)
+					stored.push_back(uint32_t(sqlite3_column_int64(stmt, 0)));
+				sqlite3_reset(stmt);
+				std::sort(stored.begin(), stored.end());
+			}
+			uint32_t& storedIndex = m_ingestStoredIndices[sensorId];
+			storedIndex = std::max(storedIndex, minmax.second->descriptor.index);
+			if (!stored.empty())
+				storedIndex = std::max(storedIndex, stored.back());
+		}
 
-DB::Alarm DB::getAlarm(size_t index) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+		for (Measurement const& m : batch)
+		{
+			int32_t partitionIndex = stmtPartitions[stmtIndex];
+			sqlite3_stmt* stmt = stmts[stmtIndex++];
+			MeasurementDescriptor const& md = m.descriptor;
+			if (std::binary_search(stored.begin(), stored.end(), md.index))
+			{
+				if (m.alarmTriggers != AlarmTriggers())
+					retriggered.push_back(m); //stored before it was confirmed, and evaluated now that it is
+				continue;
+			}
 
-    Q_ASSERT(index < m_data.alarms.size());
-    return m_data.alarms[index];
-}
+			sqlite3_bind_int64(stmt, 1, IClock::to_time_t(m.timePoint));
+			sqlite3_bind_int64(stmt, 2, IClock::to_time_t(m.receivedTimePoint));
+			sqlite3_bind_int64(stmt, 3, md.index);
+			sqlite3_bind_int64(stmt, 4, md.sensorId);
+			sqlite3_bind_double(stmt, 5, md.temperature);
+			sqlite3_bind_double(stmt, 6, md.humidity);
+			sqlite3_bind_double(stmt, 7, md.vcc);
+			sqlite3_bind_int64(stmt, 8, md.signalStrength.s2b);
+			sqlite3_bind_int64(stmt, 9, md.signalStrength.b2s);
+			sqlite3_bind_int64(stmt, 10, md.sensorErrors);
+			sqlite3_bind_int64(stmt, 11, m.alarmTriggers.current);
+			sqlite3_bind_int64(stmt, 12, m.alarmTriggers.added);
+			sqlite3_bind_int64(stmt, 13, m.alarmTriggers.removed);
+			sqlite3_bind_int64(stmt, 14, m_lastMeasurementId + 1);
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				errors.push_back(QString("Failed to save measurement: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+				failedBatches[batchIndex] = true;
+				aborted = sqlite3_get_autocommit(m_ingestSqlite) != 0;
+				sqlite3_reset(stmt);
+				if (aborted)
+					break;
+				continue;
+			}
+			else if (sqlite3_changes(m_ingestSqlite) > 0) //not a duplicate in the batch
+			{
+				committed.push_back(m);
+				committed.back().id = ++m_lastMeasurementId;
+				if (partitionIndex >= 0)
+					changedPartitions.insert(partitionIndex);
+			}
+			else if (m.alarmTriggers != AlarmTriggers())
+				retriggered.push_back(m); //stored before it was confirmed, and evaluated now that it is
 
-//////////////////////////////////////////////////////////////////////////
+			sqlite3_reset(stmt);
+		}
+	}
 
-Result<void> DB::checkAlarmDescriptor(AlarmDescriptor const& descriptor) const
-{
-    if (descriptor.highTemperatureWatch && descriptor.highTemperatureSoft > descriptor.highTemperatureHard)
-        return Error(QString("High temperature soft threshold (%1) is bigger than the hard threshold (%2)").arg(descriptor.highTemperatureSoft).arg(descriptor.highTemperatureHard).toUtf8().data());
-	if (descriptor.lowTemperatureWatch && descriptor.lowTemperatureSoft < descriptor.lowTemperatureHard)
-		return Error(QString("Low temperature soft threshold (%1) is smaller than the hard threshold (%2)").arg(descriptor.lowTemperatureSoft).arg(descriptor.lowTemperatureHard).toUtf8().data());
-    if (descriptor.highTemperatureWatch && descriptor.lowTemperatureWatch && descriptor.highTemperatureHard <= descriptor.lowTemperatureHard)
-		return Error(QString("High temperature threshold (%1) is smaller than the low threshold (%2)").arg(descriptor.highTemperatureHard).arg(descriptor.lowTemperatureHard).toUtf8().data());
+	//the rollups are updated in the same transaction, so they always match the measurements
+	for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+	{
+		if (aborted)
+			break;
 
-	if (descriptor.highHumidityWatch && descriptor.highHumiditySoft > descriptor.highHumidityHard)
-		return Error(QString("High humidity soft threshold (%1) is bigger than the hard threshold (%2)").arg(descriptor.highHumiditySoft).arg(descriptor.highHumidityHard).toUtf8().data());
-	if (descriptor.lowHumidityWatch && descriptor.lowHumiditySoft < descriptor.lowHumidityHard)
-		return Error(QString("Low humidity soft threshold (%1) is smaller than the hard threshold (%2)").arg(descriptor.lowHumiditySoft).arg(descriptor.lowHumidityHard).toUtf8().data());
-	if (descriptor.highHumidityWatch && descriptor.lowHumidityWatch && descriptor.highHumidityHard <= descriptor.lowHumidityHard)
-		return Error(QString("High humidity threshold (%1) is smaller than the low threshold (%2)").arg(descriptor.highHumidityHard).arg(descriptor.lowHumidityHard).toUtf8().data());
+		std::map<std::pair<SensorId, int64_t>, MeasurementAggregate> aggregates;
+		for (Measurement const& m : committed)
+		{
+			int64_t tp = IClock::to_time_t(m.timePoint);
+			MeasurementAggregate& a = aggregates[{ m.descriptor.sensorId, tp - tp % period }];
+			addToMeasurementAggregate(a, m);
+			a.timePoint = IClock::from_time_t(tp - tp % period);
+		}
 
-	return success;
-}
+		sqlite3_stmt* rollupStmt = period == HOURLY_ROLLUP_PERIOD ? m_addHourlyRollupsStmt.get() : m_addDailyRollupsStmt.get();
+		for (auto const& p : aggregates)
+		{
+			bindMeasurementAggregate(rollupStmt, p.second);
+			if (sqlite3_step(rollupStmt) != SQLITE_DONE)
+				errors.push_back(QString("Failed to update the measurement rollups: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+			sqlite3_reset(rollupStmt);
+		}
+	}
 
-//////////////////////////////////////////////////////////////////////////
+	//as markMeasurementPartitionCommit, with the statements prepared once
+	for (int32_t partitionIndex: changedPartitions)
+	{
+		if (aborted)
+			break;
 
-Result<void> DB::addAlarm(AlarmDescriptor const& descriptor)
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+		std::string name;
+		{
+			std::lock_guard<std::mutex> lg(m_partitionsMutex);
+			name = m_partitions[static_cast<size_t>(partitionIndex)].name;
+			m_markPartitionCommitStmts.resize(m_partitions.size());
+		}
+		std::shared_ptr<sqlite3_stmt>& partitionStmt = m_markPartitionCommitStmts[static_cast<size_t>(partitionIndex)];
+		for (std::shared_ptr<sqlite3_stmt>* stmt: { &partitionStmt, &m_markMainPartitionCommitStmt })
+		{
+			if (*stmt)
+				continue;
+			std::string sql = stmt == &partitionStmt ? "UPDATE " + name + ".PartitionCommit SET id = ?1;" : "UPDATE MeasurementPartitions SET commitId = ?1 WHERE name = ?2;";
+			sqlite3_stmt* newStmt;
+			if (sqlite3_prepare_v2(m_ingestSqlite, sql.c_str(), -1, &newStmt, nullptr) == SQLITE_OK)
+				stmt->reset(newStmt, &sqlite3_finalize);
+			else
+				errors.push_back(QString("Cannot prepare query: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+		}
+		if (!partitionStmt || !m_markMainPartitionCommitStmt)
+			continue;
 
-    if (findAlarmIndexByName(descriptor.name) >= 0)
-        return Error("Name '" + descriptor.name + "' already in use");
+		int64_t id = ++m_lastPartitionCommitId;
+		sqlite3_bind_int64(partitionStmt.get(), 1, id);
+		sqlite3_bind_int64(m_markMainPartitionCommitStmt.get(), 1, id);
+		sqlite3_bind_text(m_markMainPartitionCommitStmt.get(), 2, name.c_str(), -1, SQLITE_TRANSIENT);
+		if (sqlite3_step(partitionStmt.get()) != SQLITE_DONE || sqlite3_step(m_markMainPartitionCommitStmt.get()) != SQLITE_DONE)
+			errors.push_back(QString("Failed to mark the commit of the measurement partition '%1': %2").arg(name.c_str()).arg(sqlite3_errmsg(m_ingestSqlite)));
+		sqlite3_reset(partitionStmt.get());
+		sqlite3_reset(m_markMainPartitionCommitStmt.get());
+	}
 
-    Result<void> result = checkAlarmDescriptor(descriptor);
-    if (result != success)
-        return result;
+	//so the autoincrement of the main table doesn't give out the ids used in the partitions
+	if (!aborted && !committed.empty())
+	{
+		std::string sql = QString("UPDATE sqlite_sequence SET seq = %1 WHERE name = 'Measurements' AND seq < %1;"
+		                          "INSERT INTO sqlite_sequence (name, seq) SELECT 'Measurements', %1 WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'Measurements');")
+		                  .arg(m_lastMeasurementId).toUtf8().data();
+		if (sqlite3_exec(m_ingestSqlite, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+			errors.push_back(QString("Failed to update the measurement ids: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+	}
 
-    Alarm alarm;
-    alarm.descriptor = descriptor;
-    if (!alarm.descriptor.filterSensors)
-        alarm.descriptor.sensors.clear();
+	if (aborted || sqlite3_exec(m_ingestSqlite, "END TRANSACTION;", nullptr, nullptr, nullptr) != SQLITE_OK)
+	{
+		errors.push_back(QString("Failed to commit measurements: %1").arg(sqlite3_errmsg(m_ingestSqlite)));
+		sqlite3_exec(m_ingestSqlite, "ROLLBACK;", nullptr, nullptr, nullptr);
+		committed.clear();
+		retriggered.clear();
+		std::fill(failedBatches.begin(), failedBatches.end(), true);
+	}
+	writeLock.unlock();
 
-    alarm.id = ++m_data.lastAlarmId;
+	for (QString const& error: errors)
+		s_logger.logCritical(error);
 
-    m_data.alarms.push_back(alarm);
-	m_data.alarmsAddedOrRemoved = true;
-    emit alarmAdded(alarm.id);
+	if (!committed.empty())
+	{
+		std::map<std::pair<SensorId, int64_t>, int64_t> counts;
+		for (Measurement const& m : committed)
+		{
+			int64_t tp = IClock::to_time_t(m.timePoint);
+			counts[{ m.descriptor.sensorId, tp - tp % HOURLY_ROLLUP_PERIOD }]++;
+		}
+		addMeasurementCounts(counts);
+	}
 
-    s_logger.logInfo(QString("Added alarm '%1'").arg(descriptor.name.c_str()));
+	if (!committed.empty())
+	{
+		//already in the rings since ingest, this sets their ids
+		std::lock_guard<std::mutex> lg(m_recentMeasurementsMutex);
+		for (Measurement const& m : committed)
+		{
+			auto it = m_recentMeasurements.find(m.descriptor.sensorId);
+			if (it != m_recentMeasurements.end())
+				it->second.add(m);
+		}
+	}
 
-	save(true);
+	if (!committed.empty() || !retriggered.empty())
+	{
+		std::lock_guard<std::recursive_mutex> lg(m_asyncMeasurementsMutex);
+		std::copy(committed.begin(), committed.end(), std::back_inserter(m_asyncMeasurements));
+		std::copy(retriggered.begin(), retriggered.end(), std::back_inserter(m_asyncRetriggeredMeasurements));
+	}
 
-    return success;
+	{
+		std::lock_guard<std::mutex> lg(m_ingestCommitMutex);
+		for (size_t i = 0; i < batches.size(); i++)
+			if (failedBatches[i] && !batches[i].empty())
+				m_ingestFailures.push_back({ firstBatch + i, batches[i].front().descriptor.sensorId });
+		m_ingestCommittedCount += batches.size();
+	}
+	m_ingestCommitCV.notify_all();
+
+	//the measurements are published and confirmed by process. Not for a flush alone, the flushing thread has what it waited for
+	if (std::any_of(batches.begin(), batches.end(), [](IngestBatch const& batch) { return !batch.empty(); }))
+		requestProcess();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setAlarm(AlarmId id, AlarmDescriptor const& descriptor)
+void DB::confirmCommittedMeasurements()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    int32_t _index = findAlarmIndexByName(descriptor.name);
-    if (_index >= 0 && getAlarm(static_cast<size_t>(_index)).id != id)
-        return Error("Name to '" + descriptor.name + "' already in use");
+	std::vector<IngestConfirmation> confirmations;
+	std::deque<IngestFailure> failures;
+	{
+		std::lock_guard<std::mutex> lg2(m_ingestPushMutex);
+		uint64_t committedCount = 0;
+		{
+			std::lock_guard<std::mutex> lg3(m_ingestCommitMutex);
+			committedCount = m_ingestCommittedCount;
+			failures.swap(m_ingestFailures);
+		}
+		while (!m_ingestConfirmations.empty() && m_ingestConfirmations.front().batch <= committedCount)
+		{
+			confirmations.push_back(m_ingestConfirmations.front());
+			m_ingestConfirmations.pop_front();
+		}
+	}
 
-    _index = findAlarmIndexById(id);
-    if (_index < 0)
-        return Error("Trying to change non-existing alarm");
+	//A failure drops the confirmations of its sensor from its batch on, pushed before the failure was seen here. The sensor
+	//is received again from the confirmed index, so the measurements it resends are stored and confirmed
+	auto applyFailure = [this](IngestFailure const& failure)
+	{
+		m_ingestEpochs[failure.sensorId]++;
 
-	Result<void> result = checkAlarmDescriptor(descriptor);
-	if (result != success)
-		return result;
+		int32_t _sensorIndex = _findSensorIndexById(failure.sensorId);
+		if (_sensorIndex < 0)
+			return;
 
-	size_t index = static_cast<size_t>(_index);
-	Alarm& alarm = m_data.alarms[index];
+		Sensor& sensor = m_data.sensors[static_cast<size_t>(_sensorIndex)];
+		s_logger.logWarning(QString("Failed to store the measurements of sensor '%1', waiting for them to be resent from index %2")
+		                    .arg(sensor.descriptor.name.c_str()).arg(sensor.lastConfirmedMeasurementIndex + 1));
+		sensor.lastReceivedMeasurementIndex = sensor.lastConfirmedMeasurementIndex;
+		sensor.lastAlarmProcessesMeasurementIndex = std::min(sensor.lastAlarmProcessesMeasurementIndex, sensor.lastConfirmedMeasurementIndex);
+		m_data.changedSensors.insert(sensor.id);
+		markSensorChanged(sensor.id);
+		scheduleSave();
+	};
 
-	if (descriptor.filterSensors)
+	for (IngestConfirmation const& confirmation : confirmations)
 	{
-		//erase sensor triggers that are not watched
-		for (auto it = alarm.triggersPerSensor.begin(); it != alarm.triggersPerSensor.end();)
+		while (!failures.empty() && failures.front().batch <= confirmation.batch)
 		{
-			if (descriptor.sensors.find(it->first) == descriptor.sensors.end())
-				it = alarm.triggersPerSensor.erase(it);
-			else
-				++it;
+			applyFailure(failures.front());
+			failures.pop_front();
 		}
-	}
+		if (confirmation.epoch != m_ingestEpochs[confirmation.sensorId])
+			continue;
 
-    alarm.descriptor = descriptor;
-	m_data.alarmsChanged = true;
-    emit alarmChanged(id);
+		int32_t _sensorIndex = _findSensorIndexById(confirmation.sensorId);
+		if (_sensorIndex < 0)
+			continue;
 
-    s_logger.logInfo(QString("Changed alarm '%1'").arg(descriptor.name.c_str()));
+		Sensor& sensor = m_data.sensors[static_cast<size_t>(_sensorIndex)];
+		if (confirmation.index <= sensor.lastConfirmedMeasurementIndex)
+			continue;
 
-	save(true);
+		sensor.lastConfirmedMeasurementIndex = confirmation.index;
+		m_data.changedSensors.insert(sensor.id);
+		markSensorChanged(sensor.id);
+		scheduleSave();
 
-    return success;
+		//the rest of the triggers are evaluated from the committed measurements
+		if (sensor.lastConfirmedMeasurementIndex > sensor.lastAlarmProcessesMeasurementIndex)
+			m_measurementTriggersScheduled = true;
+	}
+	for (IngestFailure const& failure: failures)
+		applyFailure(failure);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeAlarm(size_t index)
+void DB::addAsyncMeasurements()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    Q_ASSERT(index < m_data.alarms.size());
-    AlarmId id = m_data.alarms[index].id;
-
-    s_logger.logInfo(QString("Removed alarm '%1'").arg(m_data.alarms[index].descriptor.name.c_str()));
-
-    m_data.alarms.erase(m_data.alarms.begin() + index);
-	m_data.alarmsAddedOrRemoved = true;
-    emit alarmRemoved(id);
-
-	save(true);
-}
+    struct SensorData
+    {
+		uint32_t minIndex = std::numeric_limits<uint32_t>::max();
+		uint32_t maxIndex = std::numeric_limits<uint32_t>::lowest();
+		MeasurementDescriptor lastMeasurementDescriptor;
+    };
+    std::map<SensorId, SensorData> sensorDatas;
+	bool retriggered = false;
 
-//////////////////////////////////////////////////////////////////////////
+	{
+		std::lock_guard<std::recursive_mutex> lg(m_asyncMeasurementsMutex);
+		for (Measurement const& m : m_asyncMeasurements)
+		{
+			MeasurementDescriptor const& md = m.descriptor;
+            SensorData& sd = sensorDatas[md.sensorId];
+			sd.minIndex = std::min(sd.minIndex, md.index);
+			sd.maxIndex = std::max(sd.maxIndex, md.index);
+			sd.lastMeasurementDescriptor = md;
+		}
+		m_asyncMeasurements.clear();
+		retriggered = !m_asyncRetriggeredMeasurements.empty();
+	}
 
-void DB::removeAlarmById(AlarmId id)
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [id](Alarm const& alarm) { return alarm.id == id; });
-    if (it != m_data.alarms.end())
-        removeAlarm(std::distance(m_data.alarms.begin(), it));
-}
+	{
+		std::lock_guard<DataMutex> lg(m_dataMutex);
+		confirmCommittedMeasurements();
 
-//////////////////////////////////////////////////////////////////////////
+		//the others were evaluated when they were added
+		if (retriggered)
+			m_measurementTriggersScheduled = true;
 
-int32_t DB::findAlarmIndexByName(std::string const& name) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [&name](Alarm const& alarm) { return alarm.descriptor.name == name; });
-    if (it == m_data.alarms.end())
-        return -1;
+		for (auto const& p : sensorDatas)
+		{
+			int32_t _sensorIndex = _findSensorIndexById(p.first);
+			if (_sensorIndex >= 0)
+			{
+				size_t sensorIndex = static_cast<size_t>(_sensorIndex);
+				Sensor& sensor = m_data.sensors[sensorIndex];
+				//this is also set in the setSensorInputDetails
+				if (!sensor.isRTMeasurementValid)
+				{
+					sensor.isRTMeasurementValid = true;
+					sensor.rtMeasurementTemperature = p.second.lastMeasurementDescriptor.temperature;
+					sensor.rtMeasurementHumidity = p.second.lastMeasurementDescriptor.humidity;
+					sensor.rtMeasurementVcc = p.second.lastMeasurementDescriptor.vcc;
+				}
+				sensor.averageSignalStrength = computeAverageSignalStrength(sensor.id, m_data);
+				m_data.changedSensors.insert(sensor.id);
+				markSensorChanged(sensor.id);
+				emit sensorDataChanged(sensor.id);
+				s_logger.logVerbose(QString("Added measurement indices %1 to %2, sensor '%3'").arg(p.second.minIndex).arg(p.second.maxIndex).arg(sensor.descriptor.name.c_str()));
+			}
+			emit measurementsAdded(p.first);
+		}
 
-    return int32_t(std::distance(m_data.alarms.begin(), it));
+		if (!sensorDatas.empty())
+			scheduleSave();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findAlarmIndexById(AlarmId id) const
+IClock::time_point DB::computeMeasurementTimepoint(MeasurementDescriptor const& md) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [id](Alarm const& alarm) { return alarm.id == id; });
-    if (it == m_data.alarms.end())
-        return -1;
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-    return int32_t(std::distance(m_data.alarms.begin(), it));
+	SensorTimeConfig config = findSensorTimeConfigForMeasurementIndex(md.index);
+    uint32_t index = md.index >= config.baselineMeasurementIndex ? md.index - config.baselineMeasurementIndex : 0;
+	IClock::time_point tp = config.baselineMeasurementTimePoint + config.descriptor.measurementPeriod * index;
+    return tp;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Alarm> DB::findAlarmByName(std::string const& name) const
+size_t DB::getAllMeasurementCount() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [&name](Alarm const& alarm) { return alarm.descriptor.name == name; });
-    if (it == m_data.alarms.end())
-        return std::nullopt;
+    flushMeasurements();
 
-    return *it;
+	std::lock_guard<std::mutex> lg(m_measurementCountsMutex);
+	int64_t count = 0;
+	for (auto const& p: m_measurementCounts)
+		count += p.second.totals.back();
+	return size_t(std::max<int64_t>(count, 0));
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Alarm> DB::findAlarmById(AlarmId id) const
+static const char* getQuerySortExpression(DB::Filter::SortBy sortBy)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.alarms.begin(), m_data.alarms.end(), [id](Alarm const& alarm) { return alarm.id == id; });
-    if (it == m_data.alarms.end())
-        return std::nullopt;
-
-    return *it;
+	switch (sortBy)
+	{
+	case DB::Filter::SortBy::Id: return "id";
+	case DB::Filter::SortBy::SensorId: return "sensorId";
+	case DB::Filter::SortBy::Index: return "idx";
+	case DB::Filter::SortBy::Timestamp: return "timePoint";
+	case DB::Filter::SortBy::ReceivedTimestamp: return "receivedTimePoint";
+	case DB::Filter::SortBy::Temperature: return "temperature";
+	case DB::Filter::SortBy::Humidity: return "humidity";
+	case DB::Filter::SortBy::Battery: return "vcc";
+	case DB::Filter::SortBy::Signal: return "MIN(signalStrengthS2B, signalStrengthB2S)";
+	case DB::Filter::SortBy::Alarms: return "alarmTriggersCurrent";
+	default: return "idx";
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::AlarmTriggers DB::computeSensorAlarmTriggers(Sensor& sensor, std::optional<Measurement> measurement)
+//the id breaks the ties so the order is the same between queries, which the cursors rely on
+static std::string getQueryOrderPart(DB::Filter const& filter, std::string const& sortColumn)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	AlarmTriggers allTriggers;
-
-    for (Alarm& alarm: m_data.alarms)
-    {
-		AlarmTriggers triggers = _computeSensorAlarmTriggers(alarm, sensor, measurement);
-        allTriggers |= triggers;
-    }
-
-    return allTriggers;
+	const char* direction = filter.sortOrder == DB::Filter::SortOrder::Ascending ? " ASC" : " DESC";
+	std::string sql = " ORDER BY " + sortColumn + direction;
+	if (filter.sortBy != DB::Filter::SortBy::Id)
+		sql += std::string(", id") + direction;
+	return sql;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::AlarmTriggers DB::_computeSensorAlarmTriggers(Alarm& alarm, Sensor& sensor, std::optional<Measurement> measurement)
+static std::string getQueryWherePart(DB::Filter const& filter, bool order, std::string const& extraCondition = std::string(), bool sensorFilterUsesIndex = true,
+                                     std::optional<DB::MeasurementIndexRange> const& indexRange = std::nullopt, bool timeFilterUsesIndex = true)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    uint32_t currentTriggers = 0;
-
-	bool sensorWatched = true;
-    AlarmDescriptor const& ad = alarm.descriptor;
-    if (ad.filterSensors && ad.sensors.find(sensor.id) == ad.sensors.end())
-		sensorWatched = false;
-
-	uint32_t oldTriggers = 0;
-	auto it = alarm.triggersPerSensor.find(sensor.id);
-	if (it != alarm.triggersPerSensor.end())
-		oldTriggers = it->second;
+	std::string sql;
 
-	if (sensorWatched)
-	{
-		if (measurement.has_value())
-		{
-			Measurement const& m = *measurement;
-			if (ad.highTemperatureWatch && m.descriptor.temperature >= ad.highTemperatureSoft)
-				currentTriggers |= AlarmTrigger::MeasurementHighTemperatureSoft;
-			if (ad.highTemperatureWatch && m.descriptor.temperature >= ad.highTemperatureHard)
-				currentTriggers |= AlarmTrigger::MeasurementHighTemperatureHard;
-			if (ad.lowTemperatureWatch && m.descriptor.temperature <= ad.lowTemperatureSoft)
-				currentTriggers |= AlarmTrigger::MeasurementLowTemperatureSoft;
-			if (ad.lowTemperatureWatch && m.descriptor.temperature <= ad.lowTemperatureHard)
-				currentTriggers |= AlarmTrigger::MeasurementLowTemperatureHard;
-
-			if (ad.highHumidityWatch && m.descriptor.humidity >= ad.highHumiditySoft)
-				currentTriggers |= AlarmTrigger::MeasurementHighHumiditySoft;
-			if (ad.highHumidityWatch && m.descriptor.humidity >= ad.highHumidityHard)
-				currentTriggers |= AlarmTrigger::MeasurementHighHumidityHard;
-			if (ad.lowHumidityWatch && m.descriptor.humidity <= ad.lowHumiditySoft)
-				currentTriggers |= AlarmTrigger::MeasurementLowHumiditySoft;
-			if (ad.lowHumidityWatch && m.descriptor.humidity <= ad.lowHumidityHard)
-				currentTriggers |= AlarmTrigger::MeasurementLowHumidityHard;
-
-			if (ad.lowVccWatch)
-			{
-				float histeresis = ((oldTriggers & AlarmTrigger::MeasurementLowVcc) ? 0.4f : -0.4f) / 100.f; //+- 0.4% histeresis
-				if (utils::getBatteryLevel(m.descriptor.vcc) <= m_data.sensorSettings.alertBatteryLevel + histeresis)
-					currentTriggers |= AlarmTrigger::MeasurementLowVcc;
-			}
+	std::vector<std::string> conditions;
 
-			if (ad.lowSignalWatch)
-			{
-				float histeresis = ((oldTriggers & AlarmTrigger::MeasurementLowSignal) ? 0.4f : -0.4f) / 100.f; //+- 0.4% histeresis
-				if (utils::getSignalLevel(std::min(m.descriptor.signalStrength.b2s, m.descriptor.signalStrength.s2b)) <= m_data.sensorSettings.alertSignalStrengthLevel + histeresis)
-					currentTriggers |= AlarmTrigger::MeasurementLowSignal;
-			}
+	if (filter.useTimePointFilter)
+	{
+		//with an index range the (sensorId, idx) index seeks each sensor's range, and the time points are only checked
+		const char* column = indexRange.has_value() || !timeFilterUsesIndex ? "+timePoint" : "timePoint";
+		std::string str = " ";
+		if (indexRange.has_value())
+			str += "idx >= " + std::to_string(indexRange->min) + " AND idx <= " + std::to_string(indexRange->max) + " AND ";
+		str += column;
+		str += " >= ";
+		str += std::to_string(IClock::to_time_t(filter.timePointFilter.min));
+		str += " AND ";
+		str += column;
+		str += " <= ";
+		str += std::to_string(IClock::to_time_t(filter.timePointFilter.max));
+		conditions.push_back(str);
+	}
+	if (filter.useSensorFilter && !filter.sensorIds.empty())
+	{
+		std::string str;
+		for (DB::SensorId sensorId : filter.sensorIds)
+		{
+			if (!str.empty()) 
+				str += ", ";
+			str += std::to_string(sensorId);
 		}
-		else //keep measurement triggers
-			currentTriggers = oldTriggers & AlarmTrigger::MeasurementMask;
-
-		if (ad.sensorBlackoutWatch && sensor.blackout)
-			currentTriggers |= AlarmTrigger::SensorBlackout;
+		//the unary + keeps sqlite from picking the sensorId index for this term
+		str = (sensorFilterUsesIndex ? " sensorId IN (" : " +sensorId IN (") + str + ")";
+		conditions.push_back(str);
+	}
+	if (filter.useTemperatureFilter)
+	{
+		std::string str = " temperature >= ";
+		str += std::to_string(filter.temperatureFilter.min);
+		str += " AND temperature <= ";
+		str += std::to_string(filter.temperatureFilter.max);
+		conditions.push_back(str);
+	}
+	if (filter.useHumidityFilter)
+	{
+		std::string str = " humidity >= ";
+		str += std::to_string(filter.humidityFilter.min);
+		str += " AND humidity <= ";
+		str += std::to_string(filter.humidityFilter.max);
+		conditions.push_back(str);
+	}
+	if (filter.useVccFilter)
+	{
+		std::string str = " vcc >= ";
+		str += std::to_string(filter.vccFilter.min);
+		str += " AND vcc <= ";
+		str += std::to_string(filter.vccFilter.max);
+		conditions.push_back(str);
+	}
+	if (filter.useSignalStrengthFilter)
+	{
+		std::string str = " MIN(signalStrengthS2B, signalStrengthB2S) >= ";
+		str += std::to_string(filter.signalStrengthFilter.min);
+		str += " AND MIN(signalStrengthS2B, signalStrengthB2S) <= ";
+		str += std::to_string(filter.signalStrengthFilter.max);
+		conditions.push_back(str);
 	}
 
-    if (currentTriggers != oldTriggers)
-    {
-        if (currentTriggers == 0)
-            alarm.triggersPerSensor.erase(sensor.id);
-        else
-            alarm.triggersPerSensor[sensor.id] = currentTriggers;
-
-		m_data.alarmsChanged = true;
-    }
-
-	AlarmTriggers triggers;
-	triggers.current = currentTriggers;
-
-    uint32_t diff = oldTriggers ^ currentTriggers;
-    if (diff != 0)
-    {
-		triggers.removed = diff & oldTriggers;
-		triggers.added = diff & currentTriggers;
-
-        s_logger.logInfo(QString("Alarm '%1' triggers for measurement index %2 have changed: old %3, new %4, added %5, removed %6")
-                         .arg(ad.name.c_str())
-                         .arg(measurement.has_value() ? std::to_string(measurement->descriptor.index).c_str() : "N/A")
-                         .arg(oldTriggers)
-                         .arg(currentTriggers)
-                         .arg(triggers.added)
-                         .arg(triggers.removed));
-
-		alarm.lastTriggeredTimePoint = m_clock->now();
-        emit alarmSensorTriggersChanged(alarm.id, sensor.id, measurement, oldTriggers, triggers);
-    }
-
-    return triggers;
-}
-
-//////////////////////////////////////////////////////////////////////////
+	if (!extraCondition.empty())
+		conditions.push_back(extraCondition);
 
-DB::AlarmTriggers DB::computeBaseStationAlarmTriggers(BaseStation const& bs)
-{
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	if (!conditions.empty())
+	{
+		sql += " WHERE";
 
-	AlarmTriggers allTriggers;
+		bool first = true;
+		for (std::string const& str : conditions)
+		{
+			if (!first)
+				sql += " AND ";
 
-	for (Alarm& alarm : m_data.alarms)
-	{
-		AlarmTriggers triggers = _computeBaseStationAlarmTriggers(alarm, bs);
-		allTriggers |= triggers;
+			first = false;
+			sql += " (";
+			sql += str;
+			sql += ")";
+		}
 	}
-
-	return allTriggers;
+	if (order)
+		sql += getQueryOrderPart(filter, getQuerySortExpression(filter.sortBy));
+	return sql;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::AlarmTriggers DB::_computeBaseStationAlarmTriggers(Alarm& alarm, BaseStation const& bs)
+std::optional<DB::MeasurementIndexRange> DB::planMeasurementIndexRange(sqlite3& sqlite, Filter const& filter) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	uint32_t currentTriggers = 0;
+	//With most of the sensors selected the timePoint index reads few extra rows, and it can give them in time order.
+	//Same threshold as in fetchFilteredMeasurements.
+	if (!filter.useTimePointFilter || !filter.useSensorFilter || filter.sensorIds.empty() || filter.sensorIds.size() * 16 >= getSensorCount())
+		return std::nullopt;
 
-	AlarmDescriptor const& ad = alarm.descriptor;
-	if (ad.baseStationDisconnectedWatch && !bs.isConnected)
-		currentTriggers |= AlarmTrigger::BaseStationDisconnected;
+	std::optional<MeasurementIndexRange> range = computeMeasurementIndexRange(filter.timePointFilter.min, filter.timePointFilter.max);
+	if (!range.has_value())
+		return std::nullopt;
 
-	uint32_t oldTriggers = 0;
-	auto it = alarm.triggersPerBaseStation.find(bs.id);
-	if (it != alarm.triggersPerBaseStation.end())
-		oldTriggers = it->second;
+	//The measurements of a sensor are in time order when sorted by index, so the range is exact if the measurements
+	//right outside it are outside the window as well. They are not when the time configs were changed after they were
+	//stored, and then the query falls back to the timePoint index.
+	//Checked in every table the query reads. The chunks are not kept by index, so with some in the window it uses the timePoint index
+	std::vector<std::string> tables = getMeasurementSources(sqlite, filter);
+	if (std::find(tables.begin(), tables.end(), "ChunkedMeasurements") != tables.end())
+		return std::nullopt;
 
-	if (currentTriggers != oldTriggers)
+	int64_t minTime = IClock::to_time_t(filter.timePointFilter.min);
+	int64_t maxTime = IClock::to_time_t(filter.timePointFilter.max);
+	for (std::string const& table: tables)
 	{
-		if (currentTriggers == 0)
-			alarm.triggersPerBaseStation.erase(bs.id);
-		else
-			alarm.triggersPerBaseStation[bs.id] = currentTriggers;
+		std::string sql = "SELECT (SELECT timePoint FROM " + table + " WHERE sensorId = ?1 AND idx < ?2 ORDER BY idx DESC LIMIT 1), "
+		                  "(SELECT timePoint FROM " + table + " WHERE sensorId = ?1 AND idx > ?3 ORDER BY idx ASC LIMIT 1);";
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(&sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			const char* msg = sqlite3_errmsg(&sqlite);
+			Q_ASSERT(false);
+			return std::nullopt;
+		}
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-		m_data.alarmsChanged = true;
+		for (SensorId sensorId: filter.sensorIds)
+		{
+			sqlite3_reset(stmt);
+			sqlite3_bind_int64(stmt, 1, sensorId);
+			sqlite3_bind_int64(stmt, 2, range->min);
+			sqlite3_bind_int64(stmt, 3, range->max);
+			if (sqlite3_step(stmt) != SQLITE_ROW)
+				return std::nullopt;
+			if (sqlite3_column_type(stmt, 0) != SQLITE_NULL && sqlite3_column_int64(stmt, 0) >= minTime)
+				return std::nullopt;
+			if (sqlite3_column_type(stmt, 1) != SQLITE_NULL && sqlite3_column_int64(stmt, 1) <= maxTime)
+				return std::nullopt;
+		}
 	}
+	return range;
+}
 
-	AlarmTriggers triggers;
-	triggers.current = currentTriggers;
-
-	uint32_t diff = oldTriggers ^ currentTriggers;
-	if (diff != 0)
-	{
-		triggers.removed = diff & oldTriggers;
-		triggers.added = diff & currentTriggers;
-
-		s_logger.logInfo(QString("Alarm '%1' triggers for base station %2 have changed: old %3, new %4, added %5, removed %6")
-						 .arg(ad.name.c_str())
-						 .arg(bs.id)
-						 .arg(oldTriggers)
-						 .arg(currentTriggers)
-						 .arg(triggers.added)
-						 .arg(triggers.removed));
+//////////////////////////////////////////////////////////////////////////
 
-		alarm.lastTriggeredTimePoint = m_clock->now();
-		emit alarmBaseStationTriggersChanged(alarm.id, bs.id, oldTriggers, triggers);
-	}
+void DB::QueryToken::cancel()
+{
+	m_isCancelled = true;
 
-	return triggers;
+	//a query that attaches after this sees the flag before it starts stepping
+	std::lock_guard<std::mutex> lg(m_mutex);
+	if (m_sqlite)
+		sqlite3_interrupt(m_sqlite);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getReportCount() const
+void DB::QueryToken::attach(sqlite3* sqlite) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    return m_data.reports.size();
+	std::lock_guard<std::mutex> lg(m_mutex);
+	m_sqlite = sqlite;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::Report DB::getReport(size_t index) const
+void DB::QueryToken::detach() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    Q_ASSERT(index < m_data.reports.size());
-    return m_data.reports[index];
+	//the connection goes back to the pool after this, a late cancel must not interrupt its next user
+	std::lock_guard<std::mutex> lg(m_mutex);
+	m_sqlite = nullptr;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::addReport(ReportDescriptor const& descriptor)
+std::vector<DB::Measurement> DB::getFilteredMeasurements(Filter filter, size_t start, size_t count) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    flushMeasurements();
 
-    if (findReportIndexByName(descriptor.name) >= 0)
-        return Error("Name '" + descriptor.name + "' already in use");
+	//using all the sensors? disable the filter to speed up the query
+	if (filter.useSensorFilter && filter.sensorIds.size() == getSensorCount())
+		filter.useSensorFilter = false;
 
-    Report report;
-    report.descriptor = descriptor;
-    if (!report.descriptor.filterSensors)
-        report.descriptor.sensors.clear();
+	//runs on a read connection, so the writers are not blocked while this runs
+	ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+	if (!snapshot)
+		return {};
+	sqlite3* sqlite = snapshot.get();
 
-    report.id = ++m_data.lastReportId;
+    std::vector<DB::Measurement> result;
+    if (count != 0)
+        result.reserve(std::min<size_t>(count, 100000));
 
-    m_data.reports.push_back(report);
-	m_data.reportsAddedOrRemoved = true;
-    emit reportAdded(report.id);
+	IClock::time_point startTp = m_clock->now();
+	utils::epilogue epi([startTp, start, count, this]
+	{
+		std::cout << (QString("Computed filtered measurements %1:%2: %3ms\n").arg(start).arg(count).arg(std::chrono::duration_cast<std::chrono::milliseconds>(DB::m_clock->now() - startTp).count())).toStdString();
+	});
 
-    s_logger.logInfo(QString("Added report '%1'").arg(descriptor.name.c_str()));
+	//one select per partition overlapping the time filter, merged by the sort key
+	std::string wherePart = getQueryWherePart(filter, false, std::string(), true, planMeasurementIndexRange(*sqlite, filter));
+	std::string sortExpression = getQuerySortExpression(filter.sortBy);
+	std::string sql = unionSelects(getMeasurementSources(*sqlite, filter), [&](std::string const& table)
+	{
+		return "SELECT *, " + sortExpression + " AS sortKey FROM " + table + wherePart;
+	}) + getQueryOrderPart(filter, "sortKey");
+	if (start != 0 || count != 0)
+	{
+		sql += " LIMIT " + std::to_string(count == 0 ? 1000000000ULL : count);
+		if (start != 0)
+			sql += " OFFSET " + std::to_string(start);
+	}
+	sql += ";";
+
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+	{
+		const char* msg = sqlite3_errmsg(sqlite);
+		Q_ASSERT(false);
+		return {};
+	}
+	utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
 
-	save(true);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		result.emplace_back(unpackMeasurement(stmt));
 
-    return success;
+    return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<void> DB::setReport(ReportId id, ReportDescriptor const& descriptor)
+std::vector<DB::Measurement> DB::getFilteredMeasurements(Filter filter, MeasurementCursor& cursor, size_t count, QueryToken const* token) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	//once per query, the next pages continue in what it saw
+	if (!cursor.isValid)
+		flushMeasurements();
 
-    int32_t _index = findReportIndexByName(descriptor.name);
-    if (_index >= 0 && getReport(static_cast<size_t>(_index)).id != id)
-        return Error("Name to '" + descriptor.name + "' already in use");
-
-    _index = findReportIndexById(id);
-    if (_index < 0)
-        return Error("Trying to change non-existing report");
+	std::vector<DB::Measurement> result;
+	result.reserve(std::min<size_t>(count == 0 ? 100000 : count, 100000));
+	fetchFilteredMeasurements(std::move(filter), cursor, count, MeasurementColumn::All, result, token);
+	if (token && token->isCancelled())
+		return {};
+	return result;
+}
 
-    size_t index = static_cast<size_t>(_index);
-    m_data.reports[index].descriptor = descriptor;
-	m_data.reportsChanged = true;
-    emit reportChanged(id);
+//////////////////////////////////////////////////////////////////////////
 
-    s_logger.logInfo(QString("Changed report '%1'").arg(descriptor.name.c_str()));
+bool DB::visitFilteredMeasurements(Filter const& filter, uint32_t columns, MeasurementVisitor const& visitor, QueryToken const* token) const
+{
+	//each page is fetched in its own snapshot, so the visitor doesn't keep a read transaction open
+	constexpr size_t k_pageSize = 4096;
 
-    save(true);
+	flushMeasurements();
 
-    return success;
+	std::vector<DB::Measurement> page;
+	page.reserve(k_pageSize);
+	MeasurementCursor cursor;
+	while (true)
+	{
+		page.clear();
+		fetchFilteredMeasurements(filter, cursor, k_pageSize, columns, page, token);
+		if (token && token->isCancelled())
+			return false;
+		for (Measurement const& m: page)
+		{
+			if (!visitor(m))
+				return false;
+		}
+		if (page.size() < k_pageSize)
+			return true;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::removeReport(size_t index)
+std::string DB::getFilteredMeasurementsSql(sqlite3& sqlite, Filter filter, bool seekCursor, size_t count, uint32_t columns) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    Q_ASSERT(index < m_data.reports.size());
-    ReportId id = m_data.reports[index].id;
+	//using all the sensors? disable the filter to speed up the query
+	size_t sensorCount = getSensorCount();
+	if (filter.useSensorFilter && filter.sensorIds.size() == sensorCount)
+		filter.useSensorFilter = false;
 
-    s_logger.logInfo(QString("Removed report '%1'").arg(m_data.reports[index].descriptor.name.c_str()));
+	//seek past the last row returned instead of skipping with OFFSET, which has to step over all the skipped rows.
+	//The first term is a plain range so the sort index can still be used.
+	std::string sortExpression = getQuerySortExpression(filter.sortBy);
+	std::string seek;
+	if (seekCursor)
+	{
+		bool ascending = filter.sortOrder == Filter::SortOrder::Ascending;
+		if (filter.sortBy == Filter::SortBy::Id)
+			seek = ascending ? "id > ?2" : "id < ?2";
+		else if (ascending)
+			seek = sortExpression + " >= ?1 AND (" + sortExpression + " > ?1 OR id > ?2)";
+		else
+			seek = sortExpression + " <= ?1 AND (" + sortExpression + " < ?1 OR id < ?2)";
+	}
 
-    m_data.reports.erase(m_data.reports.begin() + index);
-	m_data.reportsAddedOrRemoved = true;
-    emit reportRemoved(id);
+	//Every sort column is indexed, so the scan can walk that index from the cursor and stop after count rows.
+	//Sqlite prefers the sensorId index though, which means reading and sorting all the remaining rows of
+	//those sensors for every page, so only let it do that when few sensors are selected.
+	bool sensorFilterUsesIndex = filter.sensorIds.size() * 16 < sensorCount;
 
-	save(true);
-}
+	//Same with the timePoint index: fine for a short time filter, a long one is better walked in the sort index,
+	//which has the time points too so the rows out of the filter are skipped without reading them
+	bool timeFilterUsesIndex = filter.sortBy == Filter::SortBy::Timestamp ||
+	                           (filter.useTimePointFilter && getMeasurementPartitionsShare(filter.timePointFilter) * 16 < 1.0);
 
-//////////////////////////////////////////////////////////////////////////
+	//only planned for few sensors, when the sensorId index is used anyway
+	std::optional<MeasurementIndexRange> indexRange = planMeasurementIndexRange(sqlite, filter);
 
-void DB::removeReportById(ReportId id)
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
-    if (it != m_data.reports.end())
-        removeReport(std::distance(m_data.reports.begin(), it));
+	std::string wherePart = getQueryWherePart(filter, false, seek, sensorFilterUsesIndex, indexRange, timeFilterUsesIndex);
+	std::string sql = unionSelects(getMeasurementSources(sqlite, filter), [&](std::string const& table)
+	{
+		return "SELECT " + getMeasurementColumnsSql(columns) + ", " + sortExpression + " AS sortKey FROM " + table + wherePart;
+	}) + getQueryOrderPart(filter, "sortKey");
+	if (count != 0)
+		sql += " LIMIT " + std::to_string(count);
+	sql += ";";
+	return sql;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-int32_t DB::findReportIndexByName(std::string const& name) const
+std::vector<std::string> DB::getFilteredMeasurementsQueryPlan(Filter const& filter, bool seekCursor) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [&name](Report const& report) { return report.descriptor.name == name; });
-    if (it == m_data.reports.end())
-        return -1;
-
-    return int32_t(std::distance(m_data.reports.begin(), it));
-}
+	flushMeasurements();
 
-//////////////////////////////////////////////////////////////////////////
+	ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+	if (!snapshot)
+		return {};
+	sqlite3* sqlite = snapshot.get();
 
-int32_t DB::findReportIndexById(ReportId id) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
-    if (it == m_data.reports.end())
-        return -1;
+	std::string sql = "EXPLAIN QUERY PLAN " + getFilteredMeasurementsSql(*sqlite, filter, seekCursor, 100, MeasurementColumn::All);
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+	{
+		Q_ASSERT(false);
+		return {};
+	}
+	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-    return int32_t(std::distance(m_data.reports.begin(), it));
+	std::vector<std::string> plan;
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		plan.push_back((char const*)sqlite3_column_text(stmt, 3));
+	return plan;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<DB::Report> DB::findReportByName(std::string const& name) const
+void DB::fetchFilteredMeasurements(Filter filter, MeasurementCursor& cursor, size_t count, uint32_t columns, std::vector<Measurement>& result, QueryToken const* token) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [&name](Report const& report) { return report.descriptor.name == name; });
-    if (it == m_data.reports.end())
-        return std::nullopt;
+	ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+	if (!snapshot)
+		return;
+	sqlite3* sqlite = snapshot.get();
 
-    return *it;
-}
+	if (token)
+		token->attach(sqlite);
+	utils::epilogue epiToken([token] { if (token) token->detach(); });
+	if (token && token->isCancelled())
+		return;
 
-//////////////////////////////////////////////////////////////////////////
+	std::string sql = getFilteredMeasurementsSql(*sqlite, filter, cursor.isValid, count, columns);
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+	{
+		const char* msg = sqlite3_errmsg(sqlite);
+		Q_ASSERT(token && token->isCancelled());
+		return;
+	}
+	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-std::optional<DB::Report> DB::findReportById(ReportId id) const
-{
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-    auto it = std::find_if(m_data.reports.begin(), m_data.reports.end(), [id](Report const& report) { return report.id == id; });
-    if (it == m_data.reports.end())
-        return std::nullopt;
+	if (cursor.isValid)
+	{
+		sqlite3_bind_double(stmt, 1, cursor.sortKey);
+		sqlite3_bind_int64(stmt, 2, int64_t(cursor.id));
+	}
 
-    return *it;
+	//the sort key is the last column
+	int sortKeyColumn = sqlite3_column_count(stmt) - 1;
+	size_t firstIndex = result.size();
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		result.emplace_back(unpackMeasurementColumns(stmt, columns));
+		cursor.sortKey = sqlite3_column_double(stmt, sortKeyColumn);
+	}
+
+	if (result.size() > firstIndex)
+	{
+		cursor.isValid = true;
+		cursor.id = result.back().id;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::isReportTriggered(Report const& report) const
+void DB::MeasurementCounts::add(int64_t timePoint, int64_t count)
 {
-    if (report.descriptor.period == ReportDescriptor::Period::Daily)
-    {
-        QDateTime dt = QDateTime::currentDateTime();
-        dt.setTime(QTime(9, 0));
-        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
-            return true;
-    }
-    else if (report.descriptor.period == ReportDescriptor::Period::Weekly)
-    {
-        QDateTime dt = QDateTime::currentDateTime();
-        dt.setDate(dt.date().addDays(-dt.date().dayOfWeek()));
-        dt.setTime(QTime(9, 0));
-        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
-            return true;
-    }
-    else if (report.descriptor.period == ReportDescriptor::Period::Weekly)
-    {
-        QDate date = QDate::currentDate();
-        date = QDate(date.year(), date.month(), 1);
-        QDateTime dt(date, QTime(9, 0));
+	int64_t hour = timePoint / HOURLY_ROLLUP_PERIOD - (timePoint % HOURLY_ROLLUP_PERIOD < 0 ? 1 : 0);
+	int64_t day = hour / 24 - (hour % 24 < 0 ? 1 : 0);
 
-        if (IClock::to_time_t(report.lastTriggeredTimePoint) < dt.toTime_t() && IClock::to_time_t(m_clock->now()) >= dt.toTime_t())
-            return true;
-    }
-    else if (report.descriptor.period == ReportDescriptor::Period::Custom)
-    {
-		IClock::time_point now = m_clock->now();
-		IClock::duration d = now - report.lastTriggeredTimePoint;
-        if (d >= report.descriptor.customPeriod)
-            return true;
-    }
+	//the new days are usually the last ones, so only the last totals change
+	size_t i = size_t(std::lower_bound(days.begin(), days.end(), day * DAILY_ROLLUP_PERIOD, [](Day const& d, int64_t tp) { return d.timePoint < tp; }) - days.begin());
+	if (i == days.size() || days[i].timePoint != day * DAILY_ROLLUP_PERIOD)
+	{
+		Day d;
+		d.timePoint = day * DAILY_ROLLUP_PERIOD;
+		days.insert(days.begin() + i, d);
+		totals.insert(totals.begin() + i + 1, totals[i]);
+	}
+	uint16_t& hourCount = days[i].hours[size_t(hour - day * 24)];
+	hourCount = uint16_t(std::max<int64_t>(int64_t(hourCount) + count, 0));
+	for (size_t j = i + 1; j < totals.size(); j++)
+		totals[j] += count;
 
-    return false;
+	if (totals[i + 1] == totals[i])
+	{
+		days.erase(days.begin() + i);
+		totals.erase(totals.begin() + i + 1);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::clearAllMeasurements()
+int64_t DB::MeasurementCounts::countBefore(int64_t timePoint) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	int64_t hour = timePoint / HOURLY_ROLLUP_PERIOD - (timePoint % HOURLY_ROLLUP_PERIOD < 0 ? 1 : 0);
+	int64_t day = hour / 24 - (hour % 24 < 0 ? 1 : 0);
 
-	QString sql = QString("DELETE FROM Measurements;");
-	if (sqlite3_exec(m_sqlite, sql.toUtf8().data(), nullptr, nullptr, nullptr))
+	size_t i = size_t(std::lower_bound(days.begin(), days.end(), day * DAILY_ROLLUP_PERIOD, [](Day const& d, int64_t tp) { return d.timePoint < tp; }) - days.begin());
+	int64_t count = totals[i];
+	if (i < days.size() && days[i].timePoint == day * DAILY_ROLLUP_PERIOD)
 	{
-		s_logger.logCritical(QString("Failed to clear all measurements: %2").arg(sqlite3_errmsg(m_sqlite)));
-		return;
+		for (size_t h = 0; h < size_t(hour - day * 24); h++)
+			count += days[i].hours[h];
 	}
-	for (Sensor const& sensor: m_data.sensors)
-		emit measurementsRemoved(sensor.id);
-
-	for (Alarm& alarm : m_data.alarms)
-		alarm.triggersPerSensor.clear();
-
-	m_data.alarmsChanged = true;
-
-	s_logger.logInfo(QString("Cleared all measurements"));
-
-	save(true);
+	return count;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::addMeasurement(MeasurementDescriptor const& descriptor)
+Result<void> DB::loadMeasurementCounts(sqlite3& db)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	IClock::time_point start = IClock::rtNow();
+	std::string sql = std::string("SELECT sensorId, timePoint, keptCount FROM ") + getRollupTable(HOURLY_ROLLUP_PERIOD) + " WHERE keptCount > 0;";
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(&db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		return Error(QString("Cannot load the measurement counts: %1").arg(sqlite3_errmsg(&db)).toUtf8().data());
+	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-    return addSingleSensorMeasurements(descriptor.sensorId, { descriptor });
+	//in the primary key order, so every hour is appended
+	std::lock_guard<std::mutex> lg(m_measurementCountsMutex);
+	m_measurementCounts.clear();
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		m_measurementCounts[SensorId(sqlite3_column_int64(stmt, 0))].add(sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 2));
+
+	s_logger.logInfo(QString("Loaded the measurement counts in %1s").arg(std::chrono::duration<float>(IClock::rtNow() - start).count()));
+	return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::addMeasurements(std::vector<MeasurementDescriptor> descriptors)
+void DB::addMeasurementCounts(std::map<std::pair<SensorId, int64_t>, int64_t> const& counts)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-    std::map<SensorId, std::vector<MeasurementDescriptor>> mdPerSensor;
-    for (MeasurementDescriptor const& md: descriptors)
-    {
-        mdPerSensor[md.sensorId].push_back(md);
-    }
-
-    bool ok = true;
-    for (auto& pair: mdPerSensor)
-        ok &= addSingleSensorMeasurements(pair.first, std::move(pair.second));
-
-    return ok;
+	std::lock_guard<std::mutex> lg(m_measurementCountsMutex);
+	for (auto const& p: counts)
+		m_measurementCounts[p.first.first].add(p.first.second, p.second);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-bool DB::addSingleSensorMeasurements(SensorId sensorId, std::vector<MeasurementDescriptor> mds)
+size_t DB::getFilteredMeasurementCount(Filter const& filter, QueryToken const* token) const
 {
-    std::vector<Measurement> asyncMeasurements;
-	asyncMeasurements.reserve(mds.size());
+    flushMeasurements();
 
+	IClock::time_point start = m_clock->now();
+	utils::epilogue epi([start, this] 
 	{
-		std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-		int32_t _sensorIndex = findSensorIndexById(sensorId);
-		if (_sensorIndex < 0)
-			return false;
+		std::cout << (QString("Computed filtered measurement counts: %3ms\n").arg(std::chrono::duration_cast<std::chrono::milliseconds>(DB::m_clock->now() - start).count())).toStdString();
+	});
 
-		size_t sensorIndex = static_cast<size_t>(_sensorIndex);
-		Sensor& sensor = m_data.sensors[sensorIndex];
+	//whole hours are counted from the counts in memory, only what's left at the ends of the time range is counted
+	//from the measurements, in the index ranges of planMeasurementIndexRange
+	std::vector<std::pair<int64_t, Filter>> parts;
+	planRollupQuery(filter, HOURLY_ROLLUP_PERIOD, m_rollupsBackfillTimePoint, parts);
 
-		uint32_t rtIndex = computeNextRealTimeMeasurementIndex();
+	if (token && token->isCancelled())
+		return 0;
 
-		//first remove already confirmed measurements or future measurements
-		mds.erase(std::remove_if(mds.begin(), mds.end(), [&sensor, rtIndex](MeasurementDescriptor const& d)
+	size_t count = 0;
+	{
+		std::lock_guard<std::mutex> lg(m_measurementCountsMutex);
+		auto countSensor = [](MeasurementCounts const& counts, Filter const& f) -> size_t
 		{
-			//leave some threshold for the RT check, to account for inaccuracies in time keeping
-			return d.index < sensor.lastConfirmedMeasurementIndex || d.index > rtIndex + 5;
-		}), mds.end());
-
-		if (mds.empty())
-			return true;
-
-		if (!mds.empty())
+			if (!f.useTimePointFilter)
+				return size_t(counts.totals.back());
+			return size_t(counts.countBefore(IClock::to_time_t(f.timePointFilter.max) + 1) - counts.countBefore(IClock::to_time_t(f.timePointFilter.min)));
+		};
+		for (auto const& part : parts)
 		{
-			//update the total approx count
-			if (m_data.approximativeMeasurementCount.has_value())
-				m_data.approximativeMeasurementCount = *m_data.approximativeMeasurementCount + mds.size();
-
-            sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
-            utils::epilogue epi1([this] { sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr); });
+			if (part.first != HOURLY_ROLLUP_PERIOD)
+				continue;
 
-			sqlite3_stmt* stmt = m_addMeasurementsStmt.get();
-			for (MeasurementDescriptor const& md : mds)
+			if (part.second.useSensorFilter)
 			{
-				//advance the last confirmed index
-				if (md.index == sensor.lastConfirmedMeasurementIndex + 1)
+				for (SensorId sensorId: part.second.sensorIds)
 				{
-					sensor.lastConfirmedMeasurementIndex = md.index;
-					m_data.sensorsChanged = true;
+					auto it = m_measurementCounts.find(sensorId);
+					if (it != m_measurementCounts.end())
+						count += countSensor(it->second, part.second);
 				}
-
-				Measurement m;
-				//measurement.id = id;
-				m.descriptor = md;
-				m.timePoint = computeMeasurementTimepoint(md);
-                m.receivedTimePoint = m_clock->now();
-				//m.alarmTriggers = computeAlarmTriggersForMeasurement(m);
-                asyncMeasurements.emplace_back(m);
-
-				sensor.mostRecentMeasurementId = std::nullopt;
-
-				sqlite3_bind_int64(stmt, 1, IClock::to_time_t(m.timePoint));
-				sqlite3_bind_int64(stmt, 2, IClock::to_time_t(m.receivedTimePoint));
-				sqlite3_bind_int64(stmt, 3, md.index);
-				sqlite3_bind_int64(stmt, 4, md.sensorId);
-				sqlite3_bind_double(stmt, 5, md.temperature);
-				sqlite3_bind_double(stmt, 6, md.humidity);
-				sqlite3_bind_double(stmt, 7, md.vcc);
-				sqlite3_bind_int64(stmt, 8, md.signalStrength.s2b);
-				sqlite3_bind_int64(stmt, 9, md.signalStrength.b2s);
-				sqlite3_bind_int64(stmt, 10, md.sensorErrors);
-				sqlite3_bind_int64(stmt, 11, m.alarmTriggers.current);
-				sqlite3_bind_int64(stmt, 12, m.alarmTriggers.added);
-				sqlite3_bind_int64(stmt, 13, m.alarmTriggers.removed);
-				if (sqlite3_step(stmt) != SQLITE_DONE)
-					s_logger.logCritical(QString("Failed to save measurement: %1").arg(sqlite3_errmsg(m_sqlite)));
-
-				sqlite3_reset(stmt);
 			}
-
-			save(false);
+			else
+			{
+				for (auto const& p: m_measurementCounts)
+					count += countSensor(p.second, part.second);
+			}
 		}
 	}
+	parts.erase(std::remove_if(parts.begin(), parts.end(), [](std::pair<int64_t, Filter> const& part) { return part.first == HOURLY_ROLLUP_PERIOD; }), parts.end());
+
+	//all the parts are counted in the same snapshot
+	ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+	if (!snapshot)
+		return 0;
+	sqlite3* sqlite = snapshot.get();
+
+	if (token)
+		token->attach(sqlite);
+	utils::epilogue epiToken([token] { if (token) token->detach(); });
 
+	for (auto const& part : parts)
 	{
-		std::lock_guard<std::recursive_mutex> lg(m_asyncMeasurementsMutex);
-		std::copy(asyncMeasurements.begin(), asyncMeasurements.end(), std::back_inserter(m_asyncMeasurements));
+		if (token && token->isCancelled())
+			return 0;
+
+		std::string wherePart = getQueryWherePart(part.second, false, std::string(), true, planMeasurementIndexRange(*sqlite, part.second));
+		std::string sql = "SELECT SUM(c) FROM (" + unionSelects(getMeasurementSources(*sqlite, part.second), [&wherePart](std::string const& table)
+		{
+			return "SELECT COUNT(*) AS c FROM " + table + wherePart;
+		}) + ");";
+
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			const char* msg = sqlite3_errmsg(sqlite);
+			Q_ASSERT(token && token->isCancelled());
+			return {};
+		}
+		utils::epilogue epi1([stmt] { sqlite3_finalize(stmt); });
+
+		if (sqlite3_step(stmt) != SQLITE_ROW)
+		{
+			//interrupted by a cancel
+			const char* msg = sqlite3_errmsg(sqlite);
+			Q_ASSERT(token && token->isCancelled());
+			return 0;
+		}
+		count += size_t(sqlite3_column_int64(stmt, 0));
 	}
 
-    return true;
+	return count;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void DB::addAsyncMeasurements()
+std::vector<DB::MeasurementAggregate> DB::getMeasurementAggregates(Filter filter, IClock::duration bucketDuration, QueryToken const* token) const
 {
-    struct SensorData
-    {
-		uint32_t minIndex = std::numeric_limits<uint32_t>::max();
-		uint32_t maxIndex = std::numeric_limits<uint32_t>::lowest();
-		MeasurementDescriptor lastMeasurementDescriptor;
-    };
-    std::map<SensorId, SensorData> sensorDatas;
+    flushMeasurements();
 
-	{
-		std::lock_guard<std::recursive_mutex> lg(m_asyncMeasurementsMutex);
-		for (Measurement const& m : m_asyncMeasurements)
-		{
-			MeasurementDescriptor const& md = m.descriptor;
-            SensorData& sd = sensorDatas[md.sensorId];
-			sd.minIndex = std::min(sd.minIndex, md.index);
-			sd.maxIndex = std::max(sd.maxIndex, md.index);
-			sd.lastMeasurementDescriptor = md;
-		}
-		m_asyncMeasurements.clear();
-	}
+	//using all the sensors? disable the filter to speed up the query
+	if (filter.useSensorFilter && filter.sensorIds.size() == getSensorCount())
+		filter.useSensorFilter = false;
 
-	{
-		std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-		for (auto const& p : sensorDatas)
-		{
-			int32_t _sensorIndex = findSensorIndexById(p.first);
-			if (_sensorIndex >= 0)
-			{
-				size_t sensorIndex = static_cast<size_t>(_sensorIndex);
-				Sensor& sensor = m_data.sensors[sensorIndex];
-				//this is also set in the setSensorInputDetails
-				if (!sensor.isRTMeasurementValid)
-				{
-					sensor.isRTMeasurementValid = true;
-					sensor.rtMeasurementTemperature = p.second.lastMeasurementDescriptor.temperature;
-					sensor.rtMeasurementHumidity = p.second.lastMeasurementDescriptor.humidity;
-					sensor.rtMeasurementVcc = p.second.lastMeasurementDescriptor.vcc;
-				}
-				sensor.averageSignalStrength = computeAverageSignalStrength(sensor.id, m_data);
-				m_data.sensorsChanged = true;
-				emit sensorDataChanged(sensor.id);
-				s_logger.logVerbose(QString("Added measurement indices %1 to %2, sensor '%3'").arg(p.second.minIndex).arg(p.second.maxIndex).arg(sensor.descriptor.name.c_str()));
-			}
-			emit measurementsAdded(p.first);
+	int64_t bucket = std::chrono::duration_cast<std::chrono::seconds>(bucketDuration).count();
+	if (bucket > 0)
+		bucket = (bucket + HOURLY_ROLLUP_PERIOD - 1) / HOURLY_ROLLUP_PERIOD * HOURLY_ROLLUP_PERIOD;
+
+	//the daily rollups only fit buckets of whole days
+	std::vector<std::pair<int64_t, Filter>> parts;
+	planRollupQuery(filter, (bucket % DAILY_ROLLUP_PERIOD) == 0 ? DAILY_ROLLUP_PERIOD : HOURLY_ROLLUP_PERIOD, m_rollupsBackfillTimePoint, parts);
+
+	ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+	if (!snapshot)
+		return {};
+	sqlite3* sqlite = snapshot.get();
+
+	if (token)
+		token->attach(sqlite);
+	utils::epilogue epiToken([token] { if (token) token->detach(); });
+
+	std::map<std::pair<SensorId, int64_t>, MeasurementAggregate> aggregates;
+	for (auto const& part : parts)
+	{
+		if (token && token->isCancelled())
+			return {};
+
+		std::string sql;
+		if (part.first == 0)
+		{
+			//grouped in each partition, the groups split between them are merged below
+			std::string wherePart = getQueryWherePart(part.second, false, std::string(), true, planMeasurementIndexRange(*sqlite, part.second));
+			sql = unionSelects(getMeasurementSources(*sqlite, part.second), [&wherePart](std::string const& table)
+			{
+				return "SELECT " + getRollupColumnsSql(HOURLY_ROLLUP_PERIOD) + " FROM " + table + wherePart + " GROUP BY sensorId, timePoint / " + std::to_string(HOURLY_ROLLUP_PERIOD);
+			}) + ";";
 		}
+		else
+			sql = std::string("SELECT * FROM ") + getRollupTable(part.first) + " " + getQueryWherePart(part.second, false) + ";";
 
-		if (!sensorDatas.empty())
-			save(true);
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		{
+			const char* msg = sqlite3_errmsg(sqlite);
+			Q_ASSERT(token && token->isCancelled());
+			return {};
+		}
+		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+		{
+			MeasurementAggregate a = unpackMeasurementAggregate(stmt);
+			int64_t tp = IClock::to_time_t(a.timePoint);
+			int64_t key = bucket > 0 ? tp - tp % bucket : 0;
+			MeasurementAggregate& dst = aggregates[{ a.sensorId, key }];
+			mergeMeasurementAggregate(dst, a);
+			if (bucket > 0)
+				dst.timePoint = IClock::from_time_t(key);
+		}
 	}
+	if (token && token->isCancelled())
+		return {};
+
+	std::vector<MeasurementAggregate> result;
+	result.reserve(aggregates.size());
+	for (auto const& p : aggregates)
+		result.push_back(p.second);
+	return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-IClock::time_point DB::computeMeasurementTimepoint(MeasurementDescriptor const& md) const
+Result<void> DB::recomputeMeasurementRollups(SensorId sensorId, IClock::time_point timePoint)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	SensorTimeConfig config = findSensorTimeConfigForMeasurementIndex(md.index);
-    uint32_t index = md.index >= config.baselineMeasurementIndex ? md.index - config.baselineMeasurementIndex : 0;
-	IClock::time_point tp = config.baselineMeasurementTimePoint + config.descriptor.measurementPeriod * index;
-    return tp;
+	int64_t tp = IClock::to_time_t(timePoint);
+	for (int64_t period: { HOURLY_ROLLUP_PERIOD, DAILY_ROLLUP_PERIOD })
+	{
+		std::string sql = std::string("DELETE FROM ") + getRollupTable(period) + " WHERE sensorId = ?1 AND timePoint = ?2;";
+		sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+		if (!stmt)
+			return Error(QString("Failed to recompute the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		{
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			sqlite3_bind_int64(stmt, 1, sensorId);
+			sqlite3_bind_int64(stmt, 2, tp - tp % period);
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+				return Error(QString("Failed to recompute the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+
+		Range<IClock::time_point> bucket = { IClock::from_time_t(tp - tp % period), IClock::from_time_t(tp - tp % period + period - 1) };
+		sql = std::string("INSERT INTO ") + getRollupTable(period) + " SELECT " + getRollupColumnsSql(period) + " FROM (" +
+		      unionSelects(getMeasurementSources(*m_sqlite, bucket), [](std::string const& table)
+		      {
+		          return "SELECT * FROM " + table + " WHERE sensorId = ?1 AND timePoint >= ?2 AND timePoint < ?3";
+		      }) + ") GROUP BY sensorId;";
+		stmt = getCachedStatement(sql.c_str());
+		if (!stmt)
+			return Error(QString("Failed to recompute the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		{
+			utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+			sqlite3_bind_int64(stmt, 1, sensorId);
+			sqlite3_bind_int64(stmt, 2, tp - tp % period);
+			sqlite3_bind_int64(stmt, 3, tp - tp % period + period);
+			if (sqlite3_step(stmt) != SQLITE_DONE)
+				return Error(QString("Failed to recompute the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+	}
+	return success;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getAllMeasurementApproximativeCount() const
+//A day per transaction from the newest, until ROLLUP_BACKFILL_TIME_BUDGET is used, and the rest ROLLUP_BACKFILL_PAUSE later
+void DB::backfillMeasurementRollups()
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
-
-	if (m_data.approximativeMeasurementCount.has_value() && IClock::rtNow() - m_data.lastRefreshedApproximativeMeasurementCount < std::chrono::hours(24))
-		return *m_data.approximativeMeasurementCount;
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	const char* sql = "SELECT COUNT(*) FROM Measurements;";
-	sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_sqlite, sql, -1, &stmt, nullptr) != SQLITE_OK)
-	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
-		return 0;
-	}
-	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	IClock::time_point now = m_clock->now();
+	if (m_rollupsBackfillTimePoint == std::numeric_limits<int64_t>::min() || now < m_nextRollupsBackfillSliceTimePoint)
+		return;
+	m_nextRollupsBackfillSliceTimePoint = now + ROLLUP_BACKFILL_PAUSE;
 
-    if (sqlite3_step(stmt) != SQLITE_ROW)
-    {
-        const char* msg = sqlite3_errmsg(m_sqlite);
-        Q_ASSERT(false);
-        return 0;
-    }
+	flushMeasurements();
 
-	m_data.lastRefreshedApproximativeMeasurementCount = IClock::rtNow();
-	m_data.approximativeMeasurementCount = size_t(sqlite3_column_int64(stmt, 0));
-	return *m_data.approximativeMeasurementCount;
+	IClock::time_point start = IClock::rtNow();
+	do
+	{
+		Result<bool> result = backfillMeasurementRollups(m_rollupsBackfillTimePoint);
+		if (result != success)
+		{
+			s_logger.logCritical(QString("Failed to backfill the measurement rollups: %1").arg(result.error().what().c_str()));
+			return;
+		}
+		if (!result.payload())
+		{
+			s_logger.logInfo("Backfilled the measurement rollups");
+			return;
+		}
+	} while (IClock::rtNow() - start < ROLLUP_BACKFILL_TIME_BUDGET);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-static std::string getQueryWherePart(DB::Filter const& filter, bool order)
+Result<bool> DB::backfillMeasurementRollups(int64_t end)
 {
-	std::string sql;
+	std::lock_guard<std::mutex> wl(m_writeMutex);
+	sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	bool committed = false;
+	utils::epilogue epiTransaction([this, &committed] { if (!committed) sqlite3_exec(m_sqlite, "ROLLBACK;", nullptr, nullptr, nullptr); });
 
-	std::vector<std::string> conditions;
+	int64_t begin = end - DAILY_ROLLUP_PERIOD;
+	std::string hourly = getRollupTable(HOURLY_ROLLUP_PERIOD);
 
-	if (filter.useTimePointFilter)
+	//The measurements added since the rollups exist have rows here already, and they are counted in memory.
+	//The rows are replaced with the ones of all the measurements, and the counts get the difference
+	std::map<std::pair<SensorId, int64_t>, int64_t> counts;
+	auto readCounts = [this, &counts, &hourly, begin, end](int64_t sign) -> bool
 	{
-		std::string str = " timePoint >= ";
-		str += std::to_string(IClock::to_time_t(filter.timePointFilter.min));
-		str += " AND timePoint <= ";
-		str += std::to_string(IClock::to_time_t(filter.timePointFilter.max));
-		conditions.push_back(str);
-	}
-	if (filter.useSensorFilter && !filter.sensorIds.empty())
+		sqlite3_stmt* stmt = getCachedStatement(("SELECT sensorId, timePoint, keptCount FROM " + hourly + " WHERE timePoint >= ?1 AND timePoint < ?2;").c_str());
+		if (!stmt)
+			return false;
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+		sqlite3_bind_int64(stmt, 1, begin);
+		sqlite3_bind_int64(stmt, 2, end);
+		int result;
+		while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+			counts[{ SensorId(sqlite3_column_int64(stmt, 0)), sqlite3_column_int64(stmt, 1) }] += sign * sqlite3_column_int64(stmt, 2);
+		return result == SQLITE_DONE;
+	};
+	if (!readCounts(-1))
+		return Error(QString("Cannot read the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+	Range<IClock::time_point> range = { IClock::from_time_t(begin), IClock::from_time_t(end - 1) };
+	std::string sql = getRebuildMeasurementRollupsSql(getMeasurementSources(*m_sqlite, range), begin, end);
+	if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+		return Error(QString("Cannot backfill the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+	if (!readCounts(1))
+		return Error(QString("Cannot read the measurement rollups: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+
+	//done when nothing older is left, in the tables or the chunks
+	bool left = false;
 	{
-		std::string str;
-		for (DB::SensorId sensorId : filter.sensorIds)
+		sqlite3_stmt* stmt = getCachedStatement(("SELECT MIN(t) FROM (" + unionSelects(getMeasurementTables(*m_sqlite), [](std::string const& table)
 		{
-			if (!str.empty()) 
-				str += ", ";
-			str += std::to_string(sensorId);
-		}
-		str = " sensorId IN (" + str + ")";
-		conditions.push_back(str);
-	}
-	if (filter.useTemperatureFilter)
-	{
-		std::string str = " temperature >= ";
-		str += std::to_string(filter.temperatureFilter.min);
-		str += " AND temperature <= ";
-		str += std::to_string(filter.temperatureFilter.max);
-		conditions.push_back(str);
-	}
-	if (filter.useHumidityFilter)
-	{
-		std::string str = " humidity >= ";
-		str += std::to_string(filter.humidityFilter.min);
-		str += " AND humidity <= ";
-		str += std::to_string(filter.humidityFilter.max);
-		conditions.push_back(str);
-	}
-	if (filter.useVccFilter)
-	{
-		std::string str = " vcc >= ";
-		str += std::to_string(filter.vccFilter.min);
-		str += " AND vcc <= ";
-		str += std::to_string(filter.vccFilter.max);
-		conditions.push_back(str);
-	}
-	if (filter.useSignalStrengthFilter)
-	{
-		std::string str = " MIN(signalStrengthS2B, signalStrengthB2S) >= ";
-		str += std::to_string(filter.signalStrengthFilter.min);
-		str += " AND MIN(signalStrengthS2B, signalStrengthB2S) <= ";
-		str += std::to_string(filter.signalStrengthFilter.max);
-		conditions.push_back(str);
+			return "SELECT MIN(timePoint) AS t FROM " + table;
+		}) + " UNION ALL SELECT MIN(beginTimePoint) FROM MeasurementChunks);").c_str());
+		if (!stmt)
+			return Error(QString("Cannot read the oldest measurement: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+		if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+			left = sqlite3_column_int64(stmt, 0) < begin;
 	}
 
-	if (!conditions.empty())
-	{
-		sql += " WHERE";
+	sql = left ? "UPDATE MeasurementRollupsBackfill SET timePoint = " + std::to_string(begin) + ";" : "DELETE FROM MeasurementRollupsBackfill;";
+	if (sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, nullptr))
+		return Error(QString("Cannot save the rollups backfill: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 
-		bool first = true;
-		for (std::string const& str : conditions)
-		{
-			if (!first)
-				sql += " AND ";
+	if (sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr))
+		return Error(QString("Cannot commit the rollups backfill: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	committed = true;
 
-			first = false;
-			sql += " (";
-			sql += str;
-			sql += ")";
-		}
-	}
-	if (order)
-	{
-		sql += " ORDER BY ";
-		switch (filter.sortBy)
-		{
-		case DB::Filter::SortBy::Id: sql += "id"; break;
-		case DB::Filter::SortBy::SensorId: sql += "sensorId"; break;
-		case DB::Filter::SortBy::Index: sql += "idx"; break;
-		case DB::Filter::SortBy::Timestamp: sql += "timePoint"; break;
-		case DB::Filter::SortBy::ReceivedTimestamp: sql += "receivedTimePoint"; break;
-		case DB::Filter::SortBy::Temperature: sql += "temperature"; break;
-		case DB::Filter::SortBy::Humidity: sql += "humidity"; break;
-		case DB::Filter::SortBy::Battery: sql += "vcc"; break;
-		case DB::Filter::SortBy::Signal: sql += "MIN(signalStrengthS2B, signalStrengthB2S)"; break;
-		case DB::Filter::SortBy::Alarms: sql += "alarmTriggersCurrent"; break;
-		default: sql += "idx"; break;
-		}
-		sql += filter.sortOrder == DB::Filter::SortOrder::Ascending ? " ASC" : " DESC";
-	}
-	return sql;
+	addMeasurementCounts(counts);
+	m_rollupsBackfillTimePoint = left ? begin : std::numeric_limits<int64_t>::min();
+	return left;
 }
 
-std::vector<DB::Measurement> DB::getFilteredMeasurements(Filter filter, size_t start, size_t count) const
+//////////////////////////////////////////////////////////////////////////
+
+Result<DB::Measurement> DB::getMostRecentMeasurementForSensor(SensorId sensorId) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+    std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	//using all the sensors? disable the filter to speed up the query
-	if (filter.useSensorFilter && filter.sensorIds.size() == m_data.sensors.size())
-		filter.useSensorFilter = false;
+	//the ring gets the measurements at ingest, it doesn't wait for the writer
+	if (_findSensorIndexById(sensorId) < 0)
+		return Error("Invalid sensor id");
 
-    std::vector<DB::Measurement> result;
-    result.reserve(100000);
+	std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+	RecentMeasurements const& recent = getRecentMeasurements(sensorId);
+	if (recent.count > 0)
+		return recent.at(recent.count - 1);
 
-	IClock::time_point startTp = m_clock->now();
-	utils::epilogue epi([startTp, start, count, this]
-	{
-		std::cout << (QString("Computed filtered measurements %1:%2: %3ms\n").arg(start).arg(count).arg(std::chrono::duration_cast<std::chrono::milliseconds>(DB::m_clock->now() - startTp).count())).toStdString();
-	});
+	return Error("No data");
+}
 
-	std::string sql = "SELECT * FROM Measurements " + getQueryWherePart(filter, true);
-	if (start != 0 || count != 0)
-	{
-		sql += " LIMIT " + std::to_string(count == 0 ? 1000000000ULL : count);
-		if (start != 0)
-			sql += " OFFSET " + std::to_string(start);
-	}
-	sql += ";";
+//////////////////////////////////////////////////////////////////////////
 
-	sqlite3_stmt* stmt;
-	if (sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
+std::vector<DB::Measurement> DB::getRecentMeasurementsForSensor(SensorId sensorId, size_t count) const
+{
+    std::lock_guard<DataMutex> lg(m_dataMutex);
+
+	if (_findSensorIndexById(sensorId) < 0)
 		return {};
-	}
-	utils::epilogue epi2([stmt] { sqlite3_finalize(stmt); });
 
-	while (sqlite3_step(stmt) == SQLITE_ROW)
-		result.emplace_back(unpackMeasurement(stmt));
+	std::vector<Measurement> result;
+	if (count > k_recentMeasurementCount)
+	{
+		{
+			std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+			m_recentMeasurementsMisses++;
+		}
 
-    return result;
+		Filter filter;
+		filter.useSensorFilter = true;
+		filter.sensorIds.insert(sensorId);
+		filter.sortBy = Filter::SortBy::Index;
+		filter.sortOrder = Filter::SortOrder::Descending;
+		MeasurementCursor cursor;
+		result = getFilteredMeasurements(filter, cursor, count);
+		std::reverse(result.begin(), result.end());
+		return result;
+	}
+
+	std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+	RecentMeasurements const& recent = getRecentMeasurements(sensorId);
+	size_t first = recent.count - std::min(count, recent.count);
+	result.reserve(recent.count - first);
+	for (size_t i = first; i < recent.count; i++)
+		result.push_back(recent.at(i));
+	return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-size_t DB::getFilteredMeasurementCount(Filter const& filter) const
+DB::RecentMeasurementsStats DB::getRecentMeasurementsStats() const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<std::mutex> lg(m_recentMeasurementsMutex);
 
-	IClock::time_point start = m_clock->now();
-	utils::epilogue epi([start, this] 
-	{
-		std::cout << (QString("Computed filtered measurement counts: %3ms\n").arg(std::chrono::duration_cast<std::chrono::milliseconds>(DB::m_clock->now() - start).count())).toStdString();
-	});
+	RecentMeasurementsStats stats;
+	stats.sensorCount = m_recentMeasurements.size();
+	stats.memoryUsage = m_recentMeasurements.size() * (sizeof(RecentMeasurements) + sizeof(SensorId) + sizeof(void*) * 2) +
+	        m_recentMeasurements.bucket_count() * sizeof(void*);
+	stats.hits = m_recentMeasurementsHits;
+	stats.misses = m_recentMeasurementsMisses;
+	return stats;
+}
 
-	std::string sql = "SELECT COUNT(*) FROM Measurements " + getQueryWherePart(filter, false) + ";";
+//////////////////////////////////////////////////////////////////////////
 
-	sqlite3_stmt* stmt;
-	if (sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+DB::RecentMeasurements const& DB::getRecentMeasurements(SensorId sensorId) const
+{
+	auto it = m_recentMeasurements.find(sensorId);
+	if (it != m_recentMeasurements.end())
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
-		return {};
+		m_recentMeasurementsHits++;
+		return it->second;
 	}
-	utils::epilogue epi1([stmt] { sqlite3_finalize(stmt); });
 
-	if (sqlite3_step(stmt) != SQLITE_ROW)
+	m_recentMeasurementsMisses++;
+	RecentMeasurements& recent = m_recentMeasurements[sensorId];
+
+	//merged from the newest rows of each partition
+	std::string sql = unionSelects(getMeasurementSources(*m_sqlite), [](std::string const& table)
+	{
+		return "SELECT * FROM " + table + " WHERE sensorId = ?1";
+	}) + " ORDER BY idx DESC LIMIT ?2;";
+	sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+	if (!stmt)
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
 		Q_ASSERT(false);
-		return 0;
+		m_recentMeasurements.erase(sensorId);
+		static const RecentMeasurements s_empty;
+		return s_empty;
 	}
+	utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
 
-	return size_t(sqlite3_column_int64(stmt, 0));
+	sqlite3_bind_int64(stmt, 1, sensorId);
+	sqlite3_bind_int64(stmt, 2, int64_t(k_recentMeasurementCount));
+
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		recent.add(unpackMeasurement(stmt));
+
+	return recent;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-Result<DB::Measurement> DB::getMostRecentMeasurementForSensor(SensorId sensorId) const
+void DB::updateRecentMeasurement(Measurement const& m)
 {
-    std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<std::mutex> lg(m_recentMeasurementsMutex);
 
-	int32_t _index = findSensorIndexById(sensorId);
-	if (_index < 0)
-		return Error("Invalid sensor id");
-
-	size_t index = static_cast<size_t>(_index);
-	const Sensor& sensor = m_data.sensors[index];
+	auto it = m_recentMeasurements.find(m.descriptor.sensorId);
+	if (it == m_recentMeasurements.end())
+		return;
 
-	//fast path, ID search
-	if (sensor.mostRecentMeasurementId.has_value())
+	//older than all of them, like most of the ones re-evaluated
+	RecentMeasurements& recent = it->second;
+	if (recent.count == 0 || m.descriptor.index < recent.at(0).descriptor.index)
+		return;
+	for (size_t i = 0; i < recent.count; i++)
 	{
-		QString sql = QString("SELECT * "
-							  "FROM Measurements "
-							  "WHERE id = %1 ").arg(*sensor.mostRecentMeasurementId);
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
-		{
-			const char* msg = sqlite3_errmsg(m_sqlite);
-			Q_ASSERT(false);
-			return Error(QString("Failed to get last measurement from the db: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
-		}
-		utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
-
-		if (sqlite3_step(stmt) == SQLITE_ROW)
+		if (recent.at(i).id == m.id)
 		{
-			Measurement m = unpackMeasurement(stmt);
-			Q_ASSERT(sensor.mostRecentMeasurementId == m.id);
-			return m;
+			recent.at(i) = m;
+			break;
 		}
 	}
+}
 
-	//////////////////////////////////////////////////////////////////////////
-	//fallback - full search!
-	QString sql = QString("SELECT * "
-							"FROM Measurements "
-							"WHERE sensorId = %1 "
-							"ORDER BY idx DESC LIMIT 1;").arg(sensorId);
-	sqlite3_stmt* stmt;
-	if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
+//////////////////////////////////////////////////////////////////////////
+
+void DB::RecentMeasurements::add(Measurement const& m)
+{
+	//usually the newest one, but measurements missed earlier can be filled in later
+	size_t pos = count;
+	while (pos > 0 && at(pos - 1).descriptor.index > m.descriptor.index)
+		pos--;
+
+	if (pos > 0 && at(pos - 1).descriptor.index == m.descriptor.index)
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
-		return Error(QString("Failed to get last measurement from the db: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		at(pos - 1) = m;
+		return;
 	}
-	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-	if (sqlite3_step(stmt) == SQLITE_ROW)
+	if (count == k_recentMeasurementCount)
 	{
-		Measurement m = unpackMeasurement(stmt);
-		sensor.mostRecentMeasurementId = m.id;
-		return m;
+		if (pos == 0)
+			return; //older than all of them
+
+		//drop the oldest
+		start = (start + 1) % k_recentMeasurementCount;
+		count--;
+		pos--;
 	}
 
-	return Error("No data");
+	for (size_t i = count; i > pos; i--)
+		at(i) = at(i - 1);
+	at(pos) = m;
+	count++;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
 Result<DB::Measurement> DB::findMeasurementById(MeasurementId id) const
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
-	QString sql = QString("SELECT * "
-                          "FROM Measurements "
-                          "WHERE id = %1;").arg(id);
-	sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
+	flushMeasurements();
+
+	std::string sql = unionSelects(getMeasurementSources(*m_sqlite), [](std::string const& table)
+	{
+		return "SELECT * FROM " + table + " WHERE id = ?1";
+	}) + ";";
+	sqlite3_stmt* stmt = getCachedStatement(sql.c_str());
+	if (!stmt)
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
 		Q_ASSERT(false);
 		return Error(QString("Failed to get measurement from the db: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
 	}
-	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+	sqlite3_bind_int64(stmt, 1, int64_t(id));
 
 	if (sqlite3_step(stmt) == SQLITE_ROW)
 		return unpackMeasurement(stmt);
@@ -3791,26 +8848,73 @@ Result<DB::Measurement> DB::findMeasurementById(MeasurementId id) const
 
 Result<void> DB::setMeasurement(MeasurementId id, MeasurementDescriptor const& measurement)
 {
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+	std::lock_guard<DataMutex> lg(m_dataMutex);
+	//after the transaction ends, see backfillAlarmTriggers
+	utils::epilogue epiEdit([this] { m_measurementEditCount++; });
 
-	QString sql = QString("UPDATE Measurements "
-                          "SET temperature = ?1, humidity = ?2, vcc = ?3 "
-                          "WHERE id = ?4;").arg(id);
-	sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
+	flushMeasurements();
+
+	//the rollups of its hour and day are recomputed in the same transaction
+	Result<Measurement> oldMeasurement = findMeasurementById(id);
+	if (oldMeasurement != success)
+		return oldMeasurement.error();
+
+	std::lock_guard<std::mutex> wl(m_writeMutex);
+	sqlite3_exec(m_sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+	bool committed = false;
+	utils::epilogue epiTransaction([this, &committed] { sqlite3_exec(m_sqlite, committed ? "END TRANSACTION;" : "ROLLBACK;", nullptr, nullptr, nullptr); });
+
+	//in its partition, or in the main table if it came late, or in a chunk
+	bool updated = false;
+	for (std::string const& table: getMeasurementTablesFor(oldMeasurement.payload().timePoint))
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
-		return Error(QString("Failed to get measurement from the db: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		sqlite3_stmt* stmt = getCachedStatement(("UPDATE " + table + " "
+												 "SET temperature = ?1, humidity = ?2, vcc = ?3 "
+												 "WHERE id = ?4;").c_str());
+		if (!stmt)
+		{
+			Q_ASSERT(false);
+			return Error(QString("Failed to get measurement from the db: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		}
+		utils::epilogue epi([stmt] { sqlite3_reset(stmt); });
+
+		sqlite3_bind_double(stmt, 1, measurement.temperature);
+		sqlite3_bind_double(stmt, 2, measurement.humidity);
+		sqlite3_bind_double(stmt, 3, measurement.vcc);
+		sqlite3_bind_int64(stmt, 4, int64_t(id));
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			return Error(QString("Failed to set measurement: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+		if (sqlite3_changes(m_sqlite) > 0)
+		{
+			markMeasurementPartitionChanged(table);
+			updated = true;
+			break;
+		}
+	}
+	if (!updated)
+	{
+		Measurement m = oldMeasurement.payload();
+		m.descriptor.temperature = measurement.temperature;
+		m.descriptor.humidity = measurement.humidity;
+		m.descriptor.vcc = measurement.vcc;
+		Result<bool> chunkResult = setChunkedMeasurement(m);
+		if (chunkResult != success)
+			return chunkResult.error();
 	}
-	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
 
-	sqlite3_bind_double(stmt, 1, measurement.temperature);
-	sqlite3_bind_double(stmt, 2, measurement.humidity);
-	sqlite3_bind_double(stmt, 3, measurement.vcc);
-    sqlite3_bind_int64(stmt, 4, int64_t(id));
-	if (sqlite3_step(stmt) != SQLITE_DONE)
-		return Error(QString("Failed to set measurement: %1").arg(sqlite3_errmsg(m_sqlite)).toUtf8().data());
+	Result<void> result = recomputeMeasurementRollups(oldMeasurement.payload().descriptor.sensorId, oldMeasurement.payload().timePoint);
+	if (result != success)
+		return result;
+	committed = true;
+
+	{
+		//only the ring of its sensor can have it
+		Measurement m = oldMeasurement.payload();
+		m.descriptor.temperature = measurement.temperature;
+		m.descriptor.humidity = measurement.humidity;
+		m.descriptor.vcc = measurement.vcc;
+		updateRecentMeasurement(m);
+	}
 
     emit measurementsChanged();
     return success;
@@ -3840,33 +8944,94 @@ DB::Measurement DB::unpackMeasurement(sqlite3_stmt* stmt)
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::SignalStrength DB::computeAverageSignalStrength(SensorId sensorId, Data const& data) const
-{
-	std::lock_guard<std::recursive_mutex> lg(m_dataMutex);
+std::string DB::getMeasurementColumnsSql(uint32_t columns)
+{
+	//in the order unpackMeasurementColumns reads them
+	std::string sql = "id";
+	if (columns & MeasurementColumn::TimePoint)
+		sql += ", timePoint";
+	if (columns & MeasurementColumn::ReceivedTimePoint)
+		sql += ", receivedTimePoint";
+	if (columns & MeasurementColumn::Index)
+		sql += ", idx";
+	if (columns & MeasurementColumn::SensorId)
+		sql += ", sensorId";
+	if (columns & MeasurementColumn::Temperature)
+		sql += ", temperature";
+	if (columns & MeasurementColumn::Humidity)
+		sql += ", humidity";
+	if (columns & MeasurementColumn::Vcc)
+		sql += ", vcc";
+	if (columns & MeasurementColumn::SignalStrength)
+		sql += ", signalStrengthS2B, signalStrengthB2S";
+	if (columns & MeasurementColumn::SensorErrors)
+		sql += ", sensorErrors";
+	if (columns & MeasurementColumn::AlarmTriggers)
+		sql += ", alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved";
+	return sql;
+}
 
-	QString sql = QString("SELECT * "
-                          "FROM Measurements "
-                          "WHERE sensorId = %1 AND signalStrengthS2B != 0 AND signalStrengthB2S != 0 "
-                          "ORDER BY idx DESC LIMIT 10;").arg(sensorId);
-	sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_sqlite, sql.toUtf8().data(), -1, &stmt, nullptr) != SQLITE_OK)
+//////////////////////////////////////////////////////////////////////////
+
+DB::Measurement DB::unpackMeasurementColumns(sqlite3_stmt* stmt, uint32_t columns)
+{
+	Measurement m;
+	int c = 0;
+	m.id = MeasurementId(sqlite3_column_int64(stmt, c++));
+	if (columns & MeasurementColumn::TimePoint)
+		m.timePoint = IClock::from_time_t(sqlite3_column_int64(stmt, c++));
+	if (columns & MeasurementColumn::ReceivedTimePoint)
+		m.receivedTimePoint = IClock::from_time_t(sqlite3_column_int64(stmt, c++));
+	if (columns & MeasurementColumn::Index)
+		m.descriptor.index = uint32_t(sqlite3_column_int64(stmt, c++));
+	if (columns & MeasurementColumn::SensorId)
+		m.descriptor.sensorId = uint32_t(sqlite3_column_int64(stmt, c++));
+	if (columns & MeasurementColumn::Temperature)
+		m.descriptor.temperature = float(sqlite3_column_double(stmt, c++));
+	if (columns & MeasurementColumn::Humidity)
+		m.descriptor.humidity = float(sqlite3_column_double(stmt, c++));
+	if (columns & MeasurementColumn::Vcc)
+		m.descriptor.vcc = float(sqlite3_column_double(stmt, c++));
+	if (columns & MeasurementColumn::SignalStrength)
 	{
-		const char* msg = sqlite3_errmsg(m_sqlite);
-		Q_ASSERT(false);
-        return {};
+		m.descriptor.signalStrength.s2b = int16_t(sqlite3_column_int(stmt, c++));
+		m.descriptor.signalStrength.b2s = int16_t(sqlite3_column_int(stmt, c++));
 	}
-	utils::epilogue epi([stmt] { sqlite3_finalize(stmt); });
+	if (columns & MeasurementColumn::SensorErrors)
+		m.descriptor.sensorErrors = uint32_t(sqlite3_column_int(stmt, c++));
+	if (columns & MeasurementColumn::AlarmTriggers)
+	{
+		m.alarmTriggers.current = uint32_t(sqlite3_column_int(stmt, c++));
+		m.alarmTriggers.added = uint32_t(sqlite3_column_int(stmt, c++));
+		m.alarmTriggers.removed = uint32_t(sqlite3_column_int(stmt, c++));
+	}
+	return m;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DB::SignalStrength DB::computeAverageSignalStrength(SensorId sensorId, Data const& data) const
+{
+	std::lock_guard<DataMutex> lg(m_dataMutex);
 
     int64_t avgs2b = 0;
     int64_t avgb2s = 0;
     int64_t count = 0;
 
-	while (sqlite3_step(stmt) == SQLITE_ROW)
 	{
-		Measurement m = unpackMeasurement(stmt);
-        avgb2s += m.descriptor.signalStrength.b2s;
-        avgs2b += m.descriptor.signalStrength.s2b;
-        count++;
+		//the last 10 with a signal strength
+		std::lock_guard<std::mutex> lg2(m_recentMeasurementsMutex);
+		RecentMeasurements const& recent = getRecentMeasurements(sensorId);
+		for (size_t i = recent.count; i > 0 && count < 10; i--)
+		{
+			Measurement const& m = recent.at(i - 1);
+			if (m.descriptor.signalStrength.s2b != 0 && m.descriptor.signalStrength.b2s != 0)
+			{
+				avgb2s += m.descriptor.signalStrength.b2s;
+				avgs2b += m.descriptor.signalStrength.s2b;
+				count++;
+			}
+		}
 	}
 
     if (count > 0)
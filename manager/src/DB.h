@@ -8,19 +8,32 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <mutex>
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <queue>
+#include <functional>
+#include <iterator>
+#include <limits>
 #ifdef _MSC_VER
 #include <compare>
 #endif
 #include "Result.h"
 #include "Radio.h"
+#include "Queue.h"
+#include "ReadConnectionPool.h"
+#include "HashIndex.h"
 
 struct sqlite3;
 struct sqlite3_stmt;
 class Emailer;
+namespace alarms
+{
+    struct SensorAlarm;
+    class SensorAlarmIndex;
+}
 
 class IClock : public std::chrono::system_clock
 {
@@ -51,7 +64,9 @@ public:
     DB(std::shared_ptr<IClock> clock);
     ~DB();
 
+    //Call again after computeTimeUntilNextEvent, or sooner when processRequested is emitted
     void process();
+    IClock::duration computeTimeUntilNextEvent() const;
 
 	static Result<void> create(sqlite3& db);
     Result<void> load(sqlite3& db);
@@ -290,6 +305,15 @@ public:
     IClock::duration computeActualCommsPeriod(SensorTimeConfigDescriptor const& descriptor) const;
 	SensorTimeConfig findSensorTimeConfigForMeasurementIndex(uint32_t index) const;
 
+    //The measurement indices with the time points in [min, max] according to the time configs, the same for all the sensors.
+    //max < min when no index falls in the window.
+    struct MeasurementIndexRange
+    {
+        int64_t min = 0;
+        int64_t max = -1;
+    };
+    std::optional<MeasurementIndexRange> computeMeasurementIndexRange(IClock::time_point min, IClock::time_point max) const;
+
     //////////////////////////////////////////////////////////////////////////
 
     struct SensorErrors
@@ -428,8 +452,10 @@ public:
         IClock::time_point lastCommsTimePoint = IClock::time_point(IClock::duration::zero());
         bool blackout = false; //not saved
 
-        //which is the last confirmed measurement for this sensor
+        //which is the last confirmed measurement for this sensor. Only committed measurements are confirmed
         uint32_t lastConfirmedMeasurementIndex = 0;
+        //the last measurement received in order, it's confirmed when the writer commits it. Not saved
+        uint32_t lastReceivedMeasurementIndex = 0;
         //up to which index did alarms process measurements for this sensor
         uint32_t lastAlarmProcessesMeasurementIndex = 0;
 
@@ -454,9 +480,14 @@ public:
         float rtMeasurementHumidity = 0;
         float rtMeasurementVcc = 0;
 
-        mutable std::optional<MeasurementId> mostRecentMeasurementId; //not saved, computed and cached here
-
         IClock::time_point addedTimePoint = IClock::time_point(IClock::duration::zero()); //not saved
+
+        //the comms slot, relative to the start of each comms period. Not saved, allocated when loading
+        IClock::duration commsSlotOffset = IClock::duration::zero();
+        IClock::duration commsSlotDuration = IClock::duration::zero();
+        //measured average airtime of a request from this sensor, zero if not measured yet. Not saved
+        IClock::duration averageRequestAirtime = IClock::duration::zero();
+        IClock::time_point nextCommsTimePoint = IClock::time_point(IClock::duration::zero()); //not saved, last one given to the sensor
     };
 
     size_t getSensorCount() const;
@@ -497,6 +528,9 @@ public:
 
         bool hasStatsDelta = false;
         SensorStats statsDelta;
+
+        bool hasRequestAirtime = false;
+        IClock::duration requestAirtime = IClock::duration::zero(); //average per request, for the last comms round
     };
 
     bool setSensorInputDetails(SensorInputDetails const& details);
@@ -510,10 +544,12 @@ public:
         IClock::time_point nextMeasurementTimePoint = IClock::time_point(IClock::duration::zero());
         uint32_t nextRealTimeMeasurementIndex = 0; //the next measurement index for the crt date/time
         uint32_t nextMeasurementIndex = 0; //the next measurement index for this sensor
+        uint32_t lastConfirmedMeasurementIndex = 0; //the last committed measurement of this sensor
         //uint32_t baselineMeasurementIndex = 0; //this sensor will measure starting from this index only
     };
 
-    SensorOutputDetails computeSensorOutputDetails(SensorId id) const;
+    //hands out the next comms time point to the sensor, so it also records it
+    SensorOutputDetails computeSensorOutputDetails(SensorId id);
 
 	void removeSensor(size_t index);
     void removeSensorById(SensorId id);
@@ -587,6 +623,84 @@ public:
 
     ////////////////////////////////////////////////////////////////////////////
 
+    //The positions of the base stations, sensors and alarms by their keys
+    struct Indexes
+    {
+        HashIndex<BaseStationId> baseStationsById;
+        HashIndex<BaseStationDescriptor::Mac, ByteArrayHash<BaseStationDescriptor::Mac>> baseStationsByMac;
+        HashIndex<std::string> baseStationsByName;
+        HashIndex<SensorId> sensorsById;
+        HashIndex<SensorAddress> sensorsByAddress;
+        HashIndex<SensorSerialNumber> sensorsBySerialNumber;
+        HashIndex<std::string> sensorsByName;
+        HashIndex<AlarmId> alarmsById;
+        HashIndex<std::string> alarmsByName;
+    };
+
+    //The entries of a snapshot in fixed size pages. The pages without changes are shared with the previous snapshot too,
+    //so publishing a change copies its page and the page pointers instead of every entry
+    template<typename T>
+    struct SnapshotEntries
+    {
+        static constexpr size_t k_pageSize = 64;
+        using Page = std::vector<std::shared_ptr<const T>>;
+
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::shared_ptr<const T>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type const*;
+            using reference = value_type const&;
+
+            const_iterator() = default;
+            const_iterator(SnapshotEntries const* entries, size_t index) : m_entries(entries), m_index(index) {}
+            reference operator*() const { return (*m_entries)[m_index]; }
+            pointer operator->() const { return &(*m_entries)[m_index]; }
+            const_iterator& operator++() { m_index++; return *this; }
+            const_iterator operator++(int) { const_iterator it = *this; m_index++; return it; }
+            bool operator==(const_iterator const& other) const { return m_index == other.m_index; }
+            bool operator!=(const_iterator const& other) const { return m_index != other.m_index; }
+
+        private:
+            SnapshotEntries const* m_entries = nullptr;
+            size_t m_index = 0;
+        };
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        std::shared_ptr<const T> const& operator[](size_t index) const { return (*pages[index / k_pageSize])[index % k_pageSize]; }
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, count); }
+
+        std::vector<std::shared_ptr<const Page>> pages; //all full except the last one
+        size_t count = 0;
+    };
+
+    //Immutable copy of the base stations, sensors and alarms. A new one is published after the changes,
+    //sharing the entries that didn't change with the previous one.
+    //Readers get it without locking and can keep it as long as they need, it doesn't change under them.
+    struct Snapshot
+    {
+        SnapshotEntries<BaseStation> baseStations;
+        SnapshotEntries<Sensor> sensors;
+        SnapshotEntries<Alarm> alarms;
+        std::shared_ptr<const Indexes> indexes = std::make_shared<const Indexes>(); //shared as well while no key changes
+
+        BaseStation const* findBaseStationById(BaseStationId id) const;
+        BaseStation const* findBaseStationByMac(BaseStationDescriptor::Mac const& mac) const;
+        Sensor const* findSensorById(SensorId id) const;
+        Sensor const* findSensorByAddress(SensorAddress address) const;
+        Alarm const* findAlarmById(AlarmId id) const;
+    };
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+
+    //checks that the indexes of the data and of the snapshot match the entries, for the tests
+    Result<void> checkIndexes() const;
+
+    ////////////////////////////////////////////////////////////////////////////
+
     struct AlarmTrigger
     {
         enum
@@ -668,6 +782,85 @@ public:
     bool addMeasurements(std::vector<MeasurementDescriptor> descriptors);
 	bool addSingleSensorMeasurements(SensorId sensorId, std::vector<MeasurementDescriptor> descriptors);
 
+    //The alarms are evaluated when a measurement is added, in index order, so it's written once with its triggers.
+    //The ones left behind older measurements not evaluated yet are evaluated later, by process.
+    //Added measurements are written by a background thread, in one transaction for all the sensors.
+    //A batch is committed when its oldest measurement is maxLatency old or when it has maxBatchSize rows.
+    struct IngestSettings
+    {
+        std::chrono::milliseconds maxLatency = std::chrono::milliseconds(100);
+        size_t maxBatchSize = 1000;
+    };
+    void setIngestSettings(IngestSettings const& settings);
+    IngestSettings getIngestSettings() const;
+
+    //The measurements are stored in a file per period, next to the main file and attached to all its connections.
+    //The partitions are created as measurements come in. Once sealed a partition doesn't get new measurements, so
+    //its file only changes if measurements are edited or removed.
+    //The measurements from before the partitions stay in the Measurements table of the main file.
+    struct PartitionSettings
+    {
+        enum class Period : uint8_t
+        {
+            Week,
+            Month,
+            Year
+        };
+        Period period = Period::Month; //UTC weeks starting on monday, months or years
+        IClock::duration sealDelay = std::chrono::hours(24 * 7); //after the end of the partition, for the late measurements
+    };
+    void setPartitionSettings(PartitionSettings const& settings);
+    PartitionSettings getPartitionSettings() const;
+
+    struct MeasurementPartition
+    {
+        std::string name; //the schema it's attached as
+        std::string filename;
+        IClock::time_point begin = IClock::time_point(IClock::duration::zero()); //its measurements are in [begin, end)
+        IClock::time_point end = IClock::time_point(IClock::duration::zero());
+        bool sealed = false;
+        bool backedUp = false; //sealed and its file was backed up, until it changes again
+    };
+    std::vector<MeasurementPartition> getMeasurementPartitions() const;
+    void setMeasurementPartitionBackedUp(std::string const& name);
+
+    //The measurements older than compressAfter are moved out of the Measurements tables, into compressed chunks per sensor
+    //in the main file. The queries read them like the other measurements, they only take less space and decode faster than
+    //the rows scan. The measurements that come late for a compressed period stay uncompressed.
+    struct ColdStorageSettings
+    {
+        bool enabled = true;
+        IClock::duration compressAfter = std::chrono::hours(24 * 90);
+    };
+    void setColdStorageSettings(ColdStorageSettings const& settings);
+    ColdStorageSettings getColdStorageSettings() const;
+
+    //How long the measurements of some sensors are kept. They stay as they are for keepRaw, then only the rollups (or one
+    //measurement every decimationPeriod) are kept until keepDownsampled, then they are dropped. A sensor gets the first
+    //policy that matches it, the sensors without one keep all their measurements.
+    //The policies are applied in the background, a bit on each process call, and the freed space is returned to the OS.
+    struct RetentionPolicy
+    {
+        enum class Downsampling : uint8_t
+        {
+            Rollups,    //the hourly and daily rollups remain
+            Decimate    //the first measurement of every decimationPeriod remains, and the rollups
+        };
+
+        std::string name;
+        bool filterSensors = false;
+        std::set<SensorId> sensors;
+        IClock::duration keepRaw = std::chrono::hours(24 * 365);
+        Downsampling downsampling = Downsampling::Rollups;
+        IClock::duration decimationPeriod = std::chrono::hours(1);
+        IClock::duration keepDownsampled = std::chrono::hours(24 * 365 * 5);
+    };
+    Result<void> setRetentionPolicies(std::vector<RetentionPolicy> const& policies);
+    std::vector<RetentionPolicy> getRetentionPolicies() const;
+
+    //blocks until all the measurements added so far are committed
+    void flushMeasurements() const;
+
     template <typename T>
     struct Range
     {
@@ -721,19 +914,133 @@ public:
         SortOrder sortOrder = SortOrder::Ascending;
     };
 
-    size_t getAllMeasurementApproximativeCount() const;
+    //Exact, from the counts kept in memory
+    size_t getAllMeasurementCount() const;
 
     std::vector<Measurement> getFilteredMeasurements(Filter filter, size_t start = 0, size_t count = 0) const;
-    size_t getFilteredMeasurementCount(Filter const& filter) const;
+
+    //Lets another thread cancel a running query. Cancelling interrupts the statement the query is stepping and the
+    //query returns early with an incomplete result, which the caller is expected to drop.
+    class QueryToken
+    {
+    public:
+        void cancel();
+        bool isCancelled() const { return m_isCancelled; }
+
+    private:
+        friend class DB;
+        //the connection the query runs on, so cancel can interrupt it
+        void attach(sqlite3* sqlite) const;
+        void detach() const;
+
+        std::atomic_bool m_isCancelled = { false };
+        mutable std::mutex m_mutex;
+        mutable sqlite3* m_sqlite = nullptr;
+    };
+
+    //Where the previous page of a query ended. Pass the same filter and an invalid cursor to get the first page,
+    //then keep passing the cursor to get the next ones. A page shorter than count is the last one.
+    struct MeasurementCursor
+    {
+        bool isValid = false;
+        double sortKey = 0; //the sort column of the last row returned
+        MeasurementId id = 0;
+    };
+    std::vector<Measurement> getFilteredMeasurements(Filter filter, MeasurementCursor& cursor, size_t count, QueryToken const* token = nullptr) const;
+    //Exact. The whole hours are counted from the counts in memory, only the partial hours at the ends of the time filter
+    //and the filters on values read the measurements
+    size_t getFilteredMeasurementCount(Filter const& filter, QueryToken const* token = nullptr) const;
+
+    //The EXPLAIN QUERY PLAN lines of a page of getFilteredMeasurements, for the first page or the ones after a cursor
+    std::vector<std::string> getFilteredMeasurementsQueryPlan(Filter const& filter, bool seekCursor) const;
+
+    //The columns a streamed query reads. The id is always read, the others are left default if not asked for.
+    struct MeasurementColumn
+    {
+        enum
+        {
+            TimePoint           = 1 << 0,
+            ReceivedTimePoint   = 1 << 1,
+            Index               = 1 << 2,
+            SensorId            = 1 << 3,
+            Temperature         = 1 << 4,
+            Humidity            = 1 << 5,
+            Vcc                 = 1 << 6,
+            SignalStrength      = 1 << 7,
+            SensorErrors        = 1 << 8,
+            AlarmTriggers       = 1 << 9,
+            All                 = (1 << 10) - 1
+        };
+    };
+
+    //Calls the visitor for every measurement matching the filter, in the filter's order. Only a page of rows is
+    //in memory at any time and the DB is not locked while the visitor runs, so it can take its time.
+    //Return false from the visitor to stop. Returns false if stopped, true if all the rows were visited.
+    typedef std::function<bool(Measurement const&)> MeasurementVisitor;
+    //A cancelled token stops it as if the visitor returned false.
+    bool visitFilteredMeasurements(Filter const& filter, uint32_t columns, MeasurementVisitor const& visitor, QueryToken const* token = nullptr) const;
+
+    //Count, min, max and sum of the measurements of a sensor in a time bucket
+    struct MeasurementAggregate
+    {
+        SensorId sensorId = 0;
+        IClock::time_point timePoint = IClock::time_point(IClock::duration::zero()); //start of the bucket
+        size_t count = 0;
+        Range<float> temperature;
+        double temperatureSum = 0;
+        Range<float> humidity;
+        double humiditySum = 0;
+        Range<float> vcc;
+        double vccSum = 0;
+        Range<int16_t> signalStrength; //the weaker direction
+        int64_t signalStrengthSum = 0;
+        uint32_t alarmTriggers = 0; //the current triggers of all the measurements, or-ed
+    };
+
+    //Aggregates per sensor and bucket, rounded up to whole hours. A zero bucket duration gives one aggregate per sensor.
+    //Served from the hourly and daily rollups when the filter allows, only the partial buckets at the ends of the
+    //time range are read from the measurements.
+    std::vector<MeasurementAggregate> getMeasurementAggregates(Filter filter, IClock::duration bucketDuration, QueryToken const* token = nullptr) const;
 
     Result<Measurement> getMostRecentMeasurementForSensor(SensorId sensorId) const;
 
+    //The most recent measurements of each sensor are kept in memory, updated as they are added.
+    //Returns up to count of them, oldest first. Asking for more than k_recentMeasurementCount goes to the database.
+    static constexpr size_t k_recentMeasurementCount = 64;
+    std::vector<Measurement> getRecentMeasurementsForSensor(SensorId sensorId, size_t count) const;
+
+    struct RecentMeasurementsStats
+    {
+        size_t sensorCount = 0;
+        size_t memoryUsage = 0; //bytes
+        uint64_t hits = 0;
+        uint64_t misses = 0; //reads that had to go to the database
+    };
+    RecentMeasurementsStats getRecentMeasurementsStats() const;
+
     Result<Measurement> findMeasurementById(MeasurementId id) const;
     Result<void> setMeasurement(MeasurementId id, MeasurementDescriptor const& measurement);
 
+    //Re-evaluates the alarm triggers stored with the measurements in the time range against the alarms as they are now,
+    //after their thresholds changed. The alarms' current triggers and the emails are left alone.
+    //Meant for a worker thread: the measurements are read a sensor at a time in index order, a few thousand at once.
+    //Each block is read from a snapshot and evaluated without the locks, they are only held while its triggers are
+    //written. If a measurement was edited in between, the block is read again with them held. A cancelled token stops
+    //it after the blocks read so far are written.
+    //The progress is called after every block with the measurements done and the total, which counts only the
+    //measurements that are re-evaluated.
+    //Returns how many measurements were re-evaluated.
+    typedef std::function<void(size_t done, size_t total)> AlarmBackfillProgress;
+    Result<size_t> backfillAlarmTriggers(Range<IClock::time_point> const& range, AlarmBackfillProgress const& progress = nullptr,
+                                         QueryToken const* token = nullptr);
+
     ////////////////////////////////////////////////////////////////////////////
 
 signals:
+    //From any thread, when something needs processing before the deadline computed after the last process.
+    //Emitted once until process runs again
+    void processRequested();
+
 	void generalSettingsChanged();
 	void csvSettingsChanged();
 	void emailSettingsChanged();
@@ -778,29 +1085,94 @@ signals:
 
 private:
     Result<void> checkAlarmDescriptor(AlarmDescriptor const& descriptor) const;
-    void checkRepetitiveAlarms();
 	bool isReportTriggered(Report const& report) const;
-    void checkReports();
-    void checkForDisconnectedBaseStations();
-    void checkForBlackoutSensors();
+    IClock::time_point computeNextReportCheckTimePoint(Report const& report) const;
+
+    //these return the next time point they need to be checked at, if any
+    std::optional<IClock::time_point> checkRepetitiveAlarm(Alarm& alarm);
+    std::optional<IClock::time_point> checkReport(Report& report);
+    std::optional<IClock::time_point> checkForDisconnectedBaseStation(BaseStation& bs);
+    std::optional<IClock::time_point> checkForBlackoutSensor(Sensor& sensor);
+    //evaluates the measurements left behind, the ones of all the sensors merged in time order, and writes their triggers
     void checkMeasurementTriggers();
+    void writeMeasurementTriggers(std::vector<Measurement>& measurements);
+    //the triggers of the measurements in their tables or chunks, and in the recent ones. In a transaction
+    void updateMeasurementTriggers(std::vector<Measurement> const& measurements);
+    //The current triggers of an hourly rollup bucket whose measurements got new triggers. A complete bucket has all its
+    //measurements in the rewrite, the others are or-ed again from their measurements
+    struct RollupTriggers
+    {
+        SensorId sensorId = 0;
+        int64_t timePoint = 0;
+        uint32_t triggers = 0;
+        bool complete = false;
+    };
+    Result<void> writeBackfilledAlarmTriggers(std::vector<Measurement>& measurements, std::vector<RollupTriggers> const& buckets);
+    //bumped after the transaction of every measurement edit, so the backfill knows if what it read without the locks is still there
+    std::atomic<uint64_t> m_measurementEditCount = { 0 };
+    //the hourly buckets and their days, in the transaction of the measurement triggers
+    Result<void> updateRollupTriggers(std::vector<RollupTriggers> const& buckets);
     Result<void> _addSensorTimeConfig(SensorTimeConfigDescriptor const& descriptor);
 
     //static inline MeasurementId computeMeasurementId(MeasurementDescriptor const& md);
     //static inline SensorId getSensorIdFromMeasurementId(MeasurementId id);
     static Measurement unpackMeasurement(sqlite3_stmt* stmt);
-
-    IClock::time_point computeNextCommsTimePoint(Sensor const& sensor, size_t sensorIndex) const;
+    static std::string getMeasurementColumnsSql(uint32_t columns);
+    static Measurement unpackMeasurementColumns(sqlite3_stmt* stmt, uint32_t columns);
+    std::string getFilteredMeasurementsSql(sqlite3& sqlite, Filter filter, bool seekCursor, size_t count, uint32_t columns) const;
+    //one page, the caller flushes the measurements once at the start of the query
+    void fetchFilteredMeasurements(Filter filter, MeasurementCursor& cursor, size_t count, uint32_t columns, std::vector<Measurement>& result, QueryToken const* token = nullptr) const;
+    //The time window of a sensor filtered query as an index range, checked against the stored measurements of those sensors
+    std::optional<MeasurementIndexRange> planMeasurementIndexRange(sqlite3& sqlite, Filter const& filter) const;
+
+    void updateCommsEpoch();
+    IClock::time_point computeNextCommsTimePoint(Sensor const& sensor) const;
+    IClock::duration computeCommsSlotDuration(Sensor const& sensor) const;
+    void allocateCommsSlot(Sensor& sensor);
+    void freeCommsSlot(Sensor& sensor);
+    void updateCommsSlotsPeriod();
     IClock::time_point computeNextMeasurementTimePoint(Sensor const& sensor) const;
     uint32_t computeNextMeasurementIndex(Sensor const& sensor) const;
     uint32_t computeNextRealTimeMeasurementIndex() const;
     IClock::time_point computeMeasurementTimepoint(MeasurementDescriptor const& md) const;
 
     AlarmTriggers computeSensorAlarmTriggers(Sensor& sensor, std::optional<Measurement> measurement);
-    AlarmTriggers _computeSensorAlarmTriggers(Alarm& alarm, Sensor& sensor, std::optional<Measurement> measurement);
+    AlarmTriggers _computeSensorAlarmTriggers(alarms::SensorAlarm const& sensorAlarm, size_t sensorSlot, std::optional<Measurement> measurement);
+    //sets the triggers of measurements of a sensor, in index order, evaluated a block at a time
+    void computeSensorAlarmTriggers(Sensor& sensor, std::vector<Measurement>& measurements);
+    //the same, with the changes of the triggers published separately, so they can be merged with the other sensors'
+    struct SensorAlarmTriggers;
+    bool beginSensorAlarmTriggers(Sensor const& sensor, SensorAlarmTriggers& sensorTriggers);
+    void evaluateSensorAlarmTriggers(SensorAlarmTriggers& sensorTriggers, std::vector<Measurement>& measurements);
+    void publishSensorAlarmTriggers(SensorAlarmTriggers& sensorTriggers, std::vector<Measurement> const& measurements, size_t position);
+    AlarmTriggers setSensorAlarmTriggers(size_t alarmSlot, size_t sensorSlot, std::optional<Measurement> const& measurement, uint32_t oldTriggers, uint32_t currentTriggers);
     AlarmTriggers computeBaseStationAlarmTriggers(BaseStation const& bs);
     AlarmTriggers _computeBaseStationAlarmTriggers(Alarm& alarm, BaseStation const& ba);
 
+    //the same as the public ones, but on m_data so they see the changes not published yet
+    int32_t _findBaseStationIndexByName(std::string const& name) const;
+    int32_t _findBaseStationIndexById(BaseStationId id) const;
+    int32_t _findBaseStationIndexByMac(BaseStationDescriptor::Mac const& mac) const;
+    int32_t _findSensorIndexByName(std::string const& name) const;
+    int32_t _findSensorIndexById(SensorId id) const;
+    int32_t _findUnboundSensorIndex() const;
+    int32_t _findAlarmIndexByName(std::string const& name) const;
+    int32_t _findAlarmIndexById(AlarmId id) const;
+
+    //The changed entries are marked while holding the data mutex, and published when it's released
+    void markBaseStationChanged(BaseStationId id) const;
+    void markSensorChanged(SensorId id) const;
+    void markAlarmChanged(AlarmId id) const;
+    void markAllChanged() const; //also when entries are removed
+    void rebuildIndexes();
+    void rebuildSensorAlarmIndex();
+    void indexBaseStation(size_t index);
+    void indexSensor(size_t index);
+    void indexAlarm(size_t index);
+    void indexUser(size_t index);
+    void publishSnapshot() const;
+    std::shared_ptr<const Snapshot> buildSnapshot(Snapshot const* previous) const;
+
     struct Data
     {
         bool generalSettingsChanged = false;
@@ -821,26 +1193,33 @@ private:
         bool usersChanged = false;
 		bool usersAddedOrRemoved = false;
 		std::vector<User> users;
+		HashIndex<UserId> usersById;
+		HashIndex<std::string> usersByName;
+		HashIndex<std::string> usersByPasswordHash;
 		
-        bool baseStationsChanged = false;
-		bool baseStationsAddedOrRemoved = false;
+        //the rows to write or delete on the next save
+        std::set<BaseStationId> changedBaseStations;
+		std::set<BaseStationId> removedBaseStations;
         std::vector<BaseStation> baseStations;
 		
         bool sensorTimeConfigsChanged = false;
         std::vector<SensorTimeConfig> sensorTimeConfigs;
 		
-        bool sensorsChanged = false;
-		bool sensorsAddedOrRemoved = false;
+        std::set<SensorId> changedSensors;
+		std::set<SensorId> removedSensors;
         std::vector<Sensor> sensors;
 		
-        bool alarmsChanged = false;
-		bool alarmsAddedOrRemoved = false;
+        std::set<AlarmId> changedAlarms;
+		std::set<AlarmId> removedAlarms;
         std::vector<Alarm> alarms;
 		
-        bool reportsChanged = false;
-		bool reportsAddedOrRemoved = false;
+        std::set<ReportId> changedReports;
+		std::set<ReportId> removedReports;
         std::vector<Report> reports;
 
+        //rebuilt when an entry is removed or its key changes, only added to when entries are added
+        Indexes indexes;
+
 		UserId loggedInUserId = UserId(-1);
 		UserId lastUserId = 0;
         BaseStationId lastBaseStationId = 0;
@@ -850,8 +1229,22 @@ private:
         MeasurementId lastMeasurementId = 0;
         uint32_t lastSensorAddress = Radio::SLAVE_ADDRESS_BEGIN;
 
-        mutable std::optional<size_t> approximativeMeasurementCount;
-        mutable IClock::time_point lastRefreshedApproximativeMeasurementCount = IClock::time_point(IClock::duration::zero());
+        //Comms slots by their offset in the comms period. The sensors keep their slot between periods
+        //and only move when they talk, so slots handed out for a period never overlap.
+        struct CommsSlot
+        {
+            SensorId sensorId = 0;
+            IClock::duration duration = IClock::duration::zero();
+        };
+        std::map<IClock::duration, CommsSlot> commsSlots;
+        IClock::duration commsSlotsUsed = IClock::duration::zero();
+        IClock::duration commsSlotsEnd = IClock::duration::zero();
+        IClock::duration commsSlotsPeriod = IClock::duration::zero(); //with some headroom, so it doesn't change often
+
+        //the comms periods are counted from the epoch start. A new epoch starts when the period changes,
+        //at the next period boundary of the old epoch so the old and new slots don't overlap
+        IClock::time_point commsEpochStart = IClock::time_point(IClock::duration::zero());
+        IClock::duration commsEpochPeriod = IClock::duration::zero();
     };
 
 	sqlite3* m_sqlite = nullptr;
@@ -862,21 +1255,264 @@ private:
 	std::shared_ptr<sqlite3_stmt> m_saveAlarmsStmt;
 	std::shared_ptr<sqlite3_stmt> m_saveReportsStmt;
 	std::shared_ptr<sqlite3_stmt> m_addMeasurementsStmt;
+	std::shared_ptr<sqlite3_stmt> m_addHourlyRollupsStmt;
+	std::shared_ptr<sqlite3_stmt> m_addDailyRollupsStmt;
+
+	//Per sensor hourly and daily aggregates of the measurements, updated in the same transactions as the measurements.
+	//Databases from before the rollups get them backfilled by process, a day at a time from the newest. The
+	//MeasurementRollupsBackfill row is where it continues, the rollups before it are not complete yet
+	static Result<void> createMeasurementRollups(sqlite3& db, bool backfill, std::vector<std::string> const& measurementTables = { "Measurements" });
+	Result<void> recomputeMeasurementRollups(SensorId sensorId, IClock::time_point timePoint);
+	void backfillMeasurementRollups();
+	//one transaction, the rollups of [end - a day, end). Returns if there are older measurements left
+	Result<bool> backfillMeasurementRollups(int64_t end);
+	std::atomic<int64_t> m_rollupsBackfillTimePoint = { std::numeric_limits<int64_t>::min() }; //min when they are complete
+	IClock::time_point m_nextRollupsBackfillSliceTimePoint = IClock::time_point(IClock::duration::zero());
+
+	//The partitions in the order they were created, which is also the order they are attached in on every connection.
+	//Their indices change only when some are removed, with the write mutex locked.
+	static Result<void> createMeasurementPartitions(sqlite3& db);
+	//The period the measurements at the time point go to: the one of their partition, added if needed, or one left
+	//to the main file. The oldest partitions are merged into the main file to stay within the attached databases limit
+	Result<std::pair<IClock::time_point, IClock::time_point>> addMeasurementPartition(IClock::time_point timePoint);
+	//one transaction, the oldest partition's measurements are moved to the main file and the partition is removed
+	Result<void> mergeOldestMeasurementPartition();
+	//after the transaction removing them from MeasurementPartitions, they are detached and their files deleted
+	void removeMeasurementPartitions(std::vector<std::string> const& names);
+	void removeMeasurementPartitionFiles();
+	int32_t findMeasurementPartitionIndex(IClock::time_point timePoint) const;
+	//attaches the partitions the connection is missing and detaches the removed ones
+	void attachMeasurementPartitions(sqlite3& sqlite) const;
+	//A write transaction on a partition and the main file is not atomic in WAL mode, each file commits on its own.
+	//Both get the same commit id in the transaction, and load reconciles the partitions where they differ
+	void markMeasurementPartitionCommit(sqlite3& sqlite, std::string const& name);
+	Result<void> reconcileMeasurementPartitions(sqlite3& db, std::map<std::string, int64_t> const& commitIds);
+	//the Measurements table of the main file first, then the ones of the partitions overlapping the range
+	std::vector<std::string> getMeasurementTables(sqlite3& sqlite, std::optional<Range<IClock::time_point>> const& range = std::nullopt) const;
+	std::vector<std::string> getMeasurementTables(sqlite3& sqlite, Filter const& filter) const;
+	//the partition a measurement should be in by its time point, then the main table
+	std::vector<std::string> getMeasurementTablesFor(IClock::time_point timePoint) const;
+	//The share of the time of the partitions overlapping the range that the range covers, 1 when there are none
+	double getMeasurementPartitionsShare(Range<IClock::time_point> const& range) const;
+	void markMeasurementPartitionChanged(std::string const& table);
+	void scheduleMeasurementPartitionSeal();
+	void sealMeasurementPartitions();
+
+	//The cold measurements, compressed by chunk::encode. The MeasurementChunks rows have the index, time and id ranges
+	//of their measurements, so the ChunkedMeasurements virtual table decodes only the chunks a query can match
+	static Result<void> createMeasurementChunks(sqlite3& db);
+	//the measurement tables overlapping the range, then ChunkedMeasurements if some chunks overlap it. For reading only
+	std::vector<std::string> getMeasurementSources(sqlite3& sqlite, std::optional<Range<IClock::time_point>> const& range = std::nullopt) const;
+	std::vector<std::string> getMeasurementSources(sqlite3& sqlite, Filter const& filter) const;
+	//replaces the measurement with the same id in its chunk. False if it's not in a chunk
+	Result<bool> setChunkedMeasurement(Measurement const& measurement);
+	//the same for many, each chunk is decoded and encoded once. Returns how many were in a chunk
+	Result<size_t> setChunkedMeasurements(std::vector<Measurement> const& measurements);
+	void compressColdMeasurements();
+	//one transaction, the oldest measurements of the table before the cutoff into chunks. Returns how many, none when there are no more
+	Result<size_t> compressColdMeasurementBatch(std::string const& table, IClock::time_point cutoff, size_t& chunkCount, size_t& chunkBytes);
+
+	static Result<void> createRetentionPolicies(sqlite3& db);
+	void applyRetentionPolicies();
+	//one transaction, the measurements of the sensors (a list of ids) in [begin, end) are dropped or downsampled. Returns how many were removed
+	Result<size_t> applyRetentionPolicy(RetentionPolicy const& policy, std::string const& sensorIds, IClock::time_point begin, IClock::time_point end, bool drop,
+	                                    MeasurementPartition const* expiredPartition = nullptr);
+	//a few free pages of each file, false if some are left for the next call
+	bool reclaimFreePages();
+
+	mutable std::mutex m_partitionsMutex; //nothing else is locked after it
+	std::vector<MeasurementPartition> m_partitions;
+	std::map<IClock::time_point, size_t> m_partitionsByBegin;
+	PartitionSettings m_partitionSettings;
+	std::optional<IClock::time_point> m_nextPartitionSealTimePoint;
+	std::vector<std::string> m_removedPartitions; //still attached on some read connections maybe
+	std::vector<std::string> m_removedPartitionFiles; //the ones that couldn't be deleted yet
+	IClock::time_point m_removedPartitionsEnd = IClock::time_point::min(); //no partitions are added before it
+	int64_t m_lastPartitionCommitId = 0; //in the write mutex
+	std::vector<std::shared_ptr<sqlite3_stmt>> m_addPartitionMeasurementsStmts; //by partition, on the ingest connection
+	std::vector<std::shared_ptr<sqlite3_stmt>> m_markPartitionCommitStmts; //the same
+	std::shared_ptr<sqlite3_stmt> m_markMainPartitionCommitStmt;
+	std::shared_ptr<sqlite3_stmt> m_findIngestDuplicatesStmt; //for the sources in m_findIngestDuplicatesSql
+	std::string m_findIngestDuplicatesSql;
+	std::unordered_map<SensorId, uint32_t> m_ingestStoredIndices; //the newest index stored of each sensor, as far as the ingest thread knows
+	MeasurementId m_lastMeasurementId = 0; //the ids are given by the ingest thread, unique in all the partitions
+	std::optional<Range<IClock::time_point>> m_chunksRange; //the time points of all the chunks, in m_partitionsMutex
+	ColdStorageSettings m_coldStorageSettings;
+	std::optional<IClock::time_point> m_nextColdCompressionTimePoint;
+	std::vector<RetentionPolicy> m_retentionPolicies;
+	struct RetentionProgress
+	{
+		IClock::time_point downsampled; //everything before them is done
+		IClock::time_point dropped;
+	};
+	std::map<size_t, RetentionProgress> m_retentionProgress; //by policy, from the oldest measurement when the DB is loaded
+	std::optional<IClock::time_point> m_nextRetentionTimePoint;
+
+	mutable std::shared_ptr<const Snapshot> m_snapshot = std::make_shared<const Snapshot>(); //accessed with std::atomic_load/store
+	mutable std::atomic_bool m_snapshotPending = { false }; //changes were marked but not published yet
+	struct SnapshotChanges
+	{
+		bool all = false;
+		bool indexes = false;
+		std::set<BaseStationId> baseStations;
+		std::set<SensorId> sensors;
+		std::set<AlarmId> alarms;
+	};
+	mutable SnapshotChanges m_snapshotChanges;
+
+	//The measurement queries run here instead of on m_sqlite, so they don't wait for (or block) the writes
+	ReadConnectionPool m_readPool;
+
+	//Statements for the queries that run often, prepared once on first use and kept until close.
+	//Reset the statement when done with it, otherwise it keeps the read transaction open
+	sqlite3_stmt* getCachedStatement(const char* sql) const;
+	mutable std::unordered_map<std::string, std::shared_ptr<sqlite3_stmt>> m_statementCache;
+	//the statements of the generic table operations by table and operation, so their sql is built only once
+	mutable std::map<std::pair<std::string, std::string>, sqlite3_stmt*> m_tableStatementCache;
 
 	std::unique_ptr<Emailer> m_emailer;
     std::shared_ptr<IClock> m_clock;
 
-    mutable std::recursive_mutex m_dataMutex;
+    //A recursive mutex that publishes the marked changes when its outermost lock is released, while still holding it
+    class DataMutex
+    {
+    public:
+        explicit DataMutex(DB const& db) : m_db(db) {}
+        void lock();
+        bool try_lock();
+        void unlock();
+        bool isLockedByThisThread() const { return m_owner == std::this_thread::get_id(); }
+
+    private:
+        DB const& m_db;
+        std::recursive_mutex m_mutex;
+        std::atomic<std::thread::id> m_owner;
+        size_t m_depth = 0; //only changed by the owner
+    };
+    mutable DataMutex m_dataMutex { *this };
     Data m_data;
+    //the alarms that apply to each sensor, compiled, with their triggers. Kept with the indexes and when the alarms or the sensor settings change
+    std::unique_ptr<alarms::SensorAlarmIndex> m_sensorAlarmIndex;
 
 	mutable std::recursive_mutex m_asyncMeasurementsMutex;
-    std::vector<Measurement> m_asyncMeasurements;
+    std::vector<Measurement> m_asyncMeasurements; //committed by the ingest thread, not yet processed
+    std::vector<Measurement> m_asyncRetriggeredMeasurements; //already stored when they were evaluated at ingest, their triggers are written by checkMeasurementTriggers
     void addAsyncMeasurements();
+    void confirmCommittedMeasurements();
+
+    //Measurement ingest. The writer has its own connection so it doesn't need the data mutex.
+    //An empty batch asks the writer to commit what it has right away.
+    typedef std::vector<Measurement> IngestBatch;
+    std::unique_ptr<Queue<IngestBatch>> m_ingestQueue;
+    std::thread m_ingestThread;
+    sqlite3* m_ingestSqlite = nullptr;
+    std::atomic<std::chrono::milliseconds::rep> m_ingestMaxLatency = { IngestSettings().maxLatency.count() };
+    std::atomic<size_t> m_ingestMaxBatchSize = { IngestSettings().maxBatchSize };
+    //the write transactions of the two connections take turns here instead of polling in the busy handler
+    mutable std::mutex m_writeMutex;
+    mutable std::mutex m_ingestPushMutex; //after the data mutex, before the commit mutex
+    mutable uint64_t m_ingestPushedCount = 0; //batches pushed, including the flush requests
+    //the in order measurements of a batch are confirmed to the sensor after the writer commits the batch
+    struct IngestConfirmation
+    {
+        uint64_t batch = 0; //the pushed count of the batch
+        SensorId sensorId = 0;
+        uint32_t index = 0;
+        uint32_t epoch = 0; //of the sensor when it was pushed
+    };
+    std::deque<IngestConfirmation> m_ingestConfirmations; //by batch, under the push mutex
+    //A batch the writer could not store all of. The confirmations of its sensor pushed until the failure is seen are dropped,
+    //and the sensor resends what was not confirmed
+    struct IngestFailure
+    {
+        uint64_t batch = 0;
+        SensorId sensorId = 0;
+    };
+    std::unordered_map<SensorId, uint32_t> m_ingestEpochs; //under the data mutex, changed with every failure of the sensor
+    mutable std::mutex m_ingestCommitMutex;
+    mutable std::condition_variable m_ingestCommitCV;
+    uint64_t m_ingestCommittedCount = 0; //batches the writer is done with, including the failed ones
+    std::deque<IngestFailure> m_ingestFailures; //by batch, under the commit mutex
+    void ingestThreadProc();
+    void commitIngestBatches(std::vector<IngestBatch> const& batches);
 
     SignalStrength computeAverageSignalStrength(SensorId sensorId, Data const& data) const;
 
+    //Per sensor ring of the most recent measurements, sorted by index. The writer adds what it commits,
+    //a sensor not in the map yet is loaded from the database on the first read
+    struct RecentMeasurements
+    {
+        std::array<Measurement, k_recentMeasurementCount> measurements;
+        size_t start = 0;
+        size_t count = 0;
+
+        Measurement& at(size_t i) { return measurements[(start + i) % k_recentMeasurementCount]; } //0 is the oldest
+        Measurement const& at(size_t i) const { return measurements[(start + i) % k_recentMeasurementCount]; }
+        void add(Measurement const& m);
+    };
+    mutable std::mutex m_recentMeasurementsMutex; //after the data mutex
+    mutable std::unordered_map<SensorId, RecentMeasurements> m_recentMeasurements;
+    mutable uint64_t m_recentMeasurementsHits = 0;
+    mutable uint64_t m_recentMeasurementsMisses = 0;
+    //with the data mutex and the recent measurements mutex locked
+    RecentMeasurements const& getRecentMeasurements(SensorId sensorId) const;
+    void updateRecentMeasurement(Measurement const& m);
+
+    //Per sensor count of the stored measurements of every hour, the keptCount of the hourly rollups, by day with the running
+    //totals of the days so a range of hours is counted with two binary searches. Changed after the transactions that change the rollups.
+    struct MeasurementCounts
+    {
+        struct Day
+        {
+            int64_t timePoint = 0;
+            std::array<uint16_t, 24> hours = {}; //a sensor measures at most every 10 seconds
+        };
+        std::vector<Day> days; //sorted, only the ones with measurements
+        std::vector<int64_t> totals = { 0 }; //totals[i] counts the days before days[i], totals.back() all of them
+
+        void add(int64_t timePoint, int64_t count);
+        int64_t countBefore(int64_t timePoint) const; //timePoint on an hour
+    };
+    mutable std::mutex m_measurementCountsMutex; //after the data mutex
+    std::unordered_map<SensorId, MeasurementCounts> m_measurementCounts;
+    Result<void> loadMeasurementCounts(sqlite3& db);
+    void addMeasurementCounts(std::map<std::pair<SensorId, int64_t>, int64_t> const& counts); //by sensor and hour, negative when removed
+
+    //Deadline scheduler. Sensor blackouts, disconnected base stations, alarm resends and reports are
+    //kept in a min-heap keyed by their next deadline so process() only touches what is due.
+    enum class EventType : uint8_t
+    {
+        Sensor,
+        BaseStation,
+        Alarm,
+        Report
+    };
+    struct Event
+    {
+        IClock::time_point timePoint;
+        EventType type;
+        uint32_t id;
+        bool operator>(Event const& other) const { return timePoint > other.timePoint; }
+    };
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+    //the active deadline of every scheduled entity. Heap entries that don't match it are stale and get skipped
+    std::map<std::pair<EventType, uint32_t>, IClock::time_point> m_eventTimePoints;
+    void scheduleEvent(EventType type, uint32_t id, IClock::time_point tp);
+    void scheduleSensorEvents();
+    void scheduleBaseStationEvents();
+    void scheduleAllEvents();
+    void processEvents();
+
+    //what the processing thread schedules during process is in the deadline computed after it, the rest asks for a process
+    std::atomic<bool> m_processRequested = { false };
+    std::atomic<std::thread::id> m_processingThread;
+    void requestProcess();
+
+    bool m_measurementTriggersScheduled = false;
+
     bool m_saveScheduled = false;
     void scheduleSave();
 	void save(bool newTransaction);
 	void save(Data& data, bool newTransaction) const;
+	bool deleteRows(const char* table, std::set<uint32_t> const& ids) const;
 };
@@ -390,19 +390,6 @@ void Emailer::sendAlarmRetriggerEmail(DB::Alarm const& alarm)
 
 //////////////////////////////////////////////////////////////////////////
 
-std::optional<utils::CsvData> Emailer::getCsvData(std::vector<DB::Measurement> const& measurements, size_t index) const
-{
-	utils::CsvData data;
-    data.measurement = measurements[index];
-    std::optional<DB::Sensor> sensor = m_db.findSensorById(data.measurement.descriptor.sensorId);
-    if (sensor.has_value())
-        data.sensor = *sensor;
-
-    return data;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
 void Emailer::sendReportEmail(DB::Report const& report, IClock::time_point from, IClock::time_point to)
 {
     QString dateTimeFormatStr = utils::getQDateTimeFormatString(m_db.getGeneralSettings().dateTimeFormat);
@@ -437,8 +424,65 @@ void Emailer::sendReportEmail(DB::Report const& report, IClock::time_point from,
     filter.timePointFilter.max = to;
     filter.useSensorFilter = report.descriptor.filterSensors;
     filter.sensorIds = report.descriptor.sensors;
-    std::vector<DB::Measurement> measurements = m_db.getFilteredMeasurements(filter);
-    std::sort(measurements.begin(), measurements.end(), [](DB::Measurement const& a, DB::Measurement const& b) { return a.timePoint > b.timePoint; });
+    filter.sortBy = DB::Filter::SortBy::Timestamp;
+    filter.sortOrder = DB::Filter::SortOrder::Descending;
+
+    struct SensorData
+    {
+        bool hasData = false;
+        std::string name;
+        float minTemperature = std::numeric_limits<float>::max();
+        float maxTemperature = std::numeric_limits<float>::lowest();
+        float minHumidity = std::numeric_limits<float>::max();
+        float maxHumidity = std::numeric_limits<float>::lowest();
+        uint32_t alarmTriggers = 0;
+    };
+
+    std::vector<DB::Sensor> sensors;
+    std::unordered_map<DB::SensorId, size_t> sensorIndices;
+    for (size_t i = 0; i < m_db.getSensorCount(); i++)
+    {
+        sensors.push_back(m_db.getSensor(i));
+        sensorIndices.emplace(sensors.back().id, i);
+    }
+
+    //the summary comes from the rollups, only the csv needs the measurements
+    std::vector<SensorData> sensorDatas;
+    for (DB::MeasurementAggregate const& aggregate: m_db.getMeasurementAggregates(filter, IClock::duration::zero()))
+    {
+        auto it = sensorIndices.find(aggregate.sensorId);
+        if (it == sensorIndices.end() || aggregate.count == 0)
+        {
+            continue;
+        }
+
+        size_t sensorIndex = it->second;
+        if (sensorIndex >= sensorDatas.size())
+            sensorDatas.resize(sensorIndex + 1);
+
+        SensorData& sd = sensorDatas[sensorIndex];
+        sd.hasData = true;
+        sd.name = sensors[sensorIndex].descriptor.name;
+        sd.minTemperature = aggregate.temperature.min;
+        sd.maxTemperature = aggregate.temperature.max;
+        sd.minHumidity = aggregate.humidity.min;
+        sd.maxHumidity = aggregate.humidity.max;
+        sd.alarmTriggers = aggregate.alarmTriggers;
+    }
+
+    DB::GeneralSettings generalSettings = m_db.getGeneralSettings();
+    DB::CsvSettings csvSettings = m_db.getCsvSettings();
+    std::stringstream stream;
+    utils::exportCsvHeaderTo(stream, csvSettings);
+
+    //the csv is streamed, so large reports don't load all the measurements
+    uint32_t columns = utils::getCsvMeasurementColumns(csvSettings) | DB::MeasurementColumn::SensorId;
+    m_db.visitFilteredMeasurements(filter, columns, [&](DB::Measurement const& m)
+    {
+        auto it = sensorIndices.find(m.descriptor.sensorId);
+        utils::exportCsvRowTo(stream, generalSettings, csvSettings, m, it != sensorIndices.end() ? sensors[it->second] : DB::Sensor(), true);
+        return true;
+    });
 
     email.body += QString(R"X(
                           <html>
@@ -500,41 +544,6 @@ void Emailer::sendReportEmail(DB::Report const& report, IClock::time_point from,
                                       <th style="width: 81.3333px; text-align: center; white-space: nowrap;"><strong>Alerts</strong></th>
                                   </tr>)X").toUtf8().data();
 
-        struct SensorData
-        {
-            bool hasData = false;
-            std::string name;
-            float minTemperature = std::numeric_limits<float>::max();
-            float maxTemperature = std::numeric_limits<float>::lowest();
-            float minHumidity = std::numeric_limits<float>::max();
-            float maxHumidity = std::numeric_limits<float>::lowest();
-            DB::AlarmTriggers alarmTriggers;
-        };
-
-        std::vector<SensorData> sensorDatas;
-        for (DB::Measurement const& m: measurements)
-        {
-            QDateTime dt;
-            dt.setTime_t(IClock::to_time_t(m.timePoint));
-            std::string sensorName = "N/A";
-            int32_t _sensorIndex = m_db.findSensorIndexById(m.descriptor.sensorId);
-            if (_sensorIndex < 0)
-                continue;
-
-            size_t sensorIndex = static_cast<size_t>(_sensorIndex);
-            if (sensorIndex >= sensorDatas.size())
-                sensorDatas.resize(sensorIndex + 1);
-
-            SensorData& sd = sensorDatas[sensorIndex];
-            sd.hasData = true;
-            sd.name = m_db.getSensor(sensorIndex).descriptor.name;
-            sd.maxTemperature = std::max(sd.maxTemperature, m.descriptor.temperature);
-            sd.minTemperature = std::min(sd.minTemperature, m.descriptor.temperature);
-            sd.maxHumidity = std::max(sd.maxHumidity, m.descriptor.humidity);
-            sd.minHumidity = std::min(sd.minHumidity, m.descriptor.humidity);
-            sd.alarmTriggers |= m.alarmTriggers;
-        }
-
         for (SensorData const& sd: sensorDatas)
         {
             if (sd.hasData)
@@ -554,7 +563,7 @@ void Emailer::sendReportEmail(DB::Report const& report, IClock::time_point from,
                         .arg(sd.maxTemperature, 0, 'f', 1)
                         .arg(sd.minHumidity, 0, 'f', 1)
                         .arg(sd.maxHumidity, 0, 'f', 1)
-                        .arg(sd.alarmTriggers.current == 0 ? "no" : "yes")
+                        .arg(sd.alarmTriggers == 0 ? "no" : "yes")
                         .toUtf8().data();
             }
             else
@@ -578,9 +587,6 @@ void Emailer::sendReportEmail(DB::Report const& report, IClock::time_point from,
                       "</table>";
     }
 
-    std::stringstream stream;
-    utils::exportCsvTo(stream, m_db.getGeneralSettings(), m_db.getCsvSettings(), [&measurements, this](size_t index) { return getCsvData(measurements, index); }, measurements.size(), true);
-
     email.attachments.push_back({ std::string("report.csv"), stream.str() });
 
     sendEmail(email);
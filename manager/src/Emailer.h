@@ -63,8 +63,6 @@ private:
     void sendBaseStationAlarmEmail(DB::Alarm const& alarm, DB::BaseStation const& bs, uint32_t oldTriggers, uint32_t newTriggers, uint32_t triggers, Action action);
     void sendAlarmRetriggerEmail(DB::Alarm const& alarm);
 
-	std::optional<utils::CsvData> getCsvData(std::vector<DB::Measurement> const& measurements, size_t index) const;
-
 
     void sendEmail(Email const& email);
     void emailThreadProc();
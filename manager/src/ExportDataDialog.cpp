@@ -124,24 +124,33 @@ void ExportDataDialog::accept()
             return;
         }
 
-        auto allMeasurements = m_model.getAllMeasurements();
-
-		finished = utils::exportCsvTo(file, m_db.getGeneralSettings(), m_ui.overrideSettings->isChecked() ? m_ui.csvSettings->getCsvSettings() : m_db.getCsvSettings(),
-                                      [this, &allMeasurements, &progressDialog](size_t index) -> std::optional<utils::CsvData>
-        { 
-			utils::CsvData data;
-			data.measurement = allMeasurements[index];
-			std::optional<DB::Sensor> sensor = m_db.findSensorById(data.measurement.descriptor.sensorId);
-			if (sensor.has_value())
-				data.sensor = *sensor;
-			if (progressDialog && (index & 63) == 0)
-			{
-				progressDialog->setValue((int)index / 64);
-				if (progressDialog->wasCanceled())
-					return std::nullopt;
-			}
-			return std::move(data);
-        }, allMeasurements.size(), false);
+        //streamed straight from the DB to the file, only the columns exported are read
+        DB::GeneralSettings generalSettings = m_db.getGeneralSettings();
+        DB::CsvSettings csvSettings = m_ui.overrideSettings->isChecked() ? m_ui.csvSettings->getCsvSettings() : m_db.getCsvSettings();
+        utils::exportCsvHeaderTo(file, csvSettings);
+
+        std::unordered_map<DB::SensorId, DB::Sensor> sensors;
+        for (size_t i = 0; i < m_db.getSensorCount(); i++)
+        {
+            DB::Sensor sensor = m_db.getSensor(i);
+            sensors.emplace(sensor.id, std::move(sensor));
+        }
+        const DB::Sensor noSensor;
+
+        size_t index = 0;
+        finished = m_db.visitFilteredMeasurements(m_model.getFilter(), utils::getCsvMeasurementColumns(csvSettings), [&](DB::Measurement const& m)
+        {
+            auto it = sensors.find(m.descriptor.sensorId);
+            utils::exportCsvRowTo(file, generalSettings, csvSettings, m, it != sensors.end() ? it->second : noSensor, false);
+            if (progressDialog && (index & 63) == 0)
+            {
+                progressDialog->setValue((int)index / 64);
+                if (progressDialog->wasCanceled())
+                    return false;
+            }
+            index++;
+            return true;
+        });
 
         file.close();
 
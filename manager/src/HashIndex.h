@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+//Maps keys to positions in a vector, open addressing with linear probing.
+//When several entries have the same key the first one is kept, like a linear search from the front would find.
+//Removing entries moves the ones after them, so the index is rebuilt then.
+template<typename Key, typename Hash = std::hash<Key>> class HashIndex
+{
+public:
+    void clear();
+    void reserve(size_t count);
+
+    //returns false if the key is already in the index
+    bool insert(Key const& key, uint32_t position);
+    //returns -1 if the key is not in the index
+    int32_t find(Key const& key) const;
+    size_t size() const { return m_size; }
+
+    template<typename T, typename KeyFunc>
+    void rebuild(std::vector<T> const& entries, KeyFunc keyFunc);
+
+private:
+    size_t findSlot(Key const& key) const;
+
+    struct Slot
+    {
+        Key key = Key();
+        int32_t position = -1; //-1 is an empty slot
+    };
+    std::vector<Slot> m_slots; //a power of 2, at most half full
+    size_t m_size = 0;
+};
+
+//hashes a fixed size array of bytes, like a mac address
+template<typename Array> struct ByteArrayHash
+{
+    size_t operator()(Array const& array) const
+    {
+        uint64_t hash = 14695981039346656037ULL; //FNV-1a
+        for (uint8_t byte: array)
+            hash = (hash ^ byte) * 1099511628211ULL;
+        return size_t(hash);
+    }
+};
+
+
+template<typename Key, typename Hash>
+void HashIndex<Key, Hash>::clear()
+{
+    m_slots.clear();
+    m_size = 0;
+}
+
+template<typename Key, typename Hash>
+void HashIndex<Key, Hash>::reserve(size_t count)
+{
+    size_t capacity = 16;
+    while (capacity < count * 2)
+        capacity *= 2;
+    if (capacity <= m_slots.size())
+        return;
+
+    std::vector<Slot> oldSlots(capacity);
+    std::swap(oldSlots, m_slots);
+    for (Slot& slot: oldSlots)
+    {
+        if (slot.position >= 0)
+            m_slots[findSlot(slot.key)] = std::move(slot);
+    }
+}
+
+template<typename Key, typename Hash>
+bool HashIndex<Key, Hash>::insert(Key const& key, uint32_t position)
+{
+    reserve(m_size + 1);
+    Slot& slot = m_slots[findSlot(key)];
+    if (slot.position >= 0)
+        return false;
+
+    slot.key = key;
+    slot.position = int32_t(position);
+    m_size++;
+    return true;
+}
+
+template<typename Key, typename Hash>
+int32_t HashIndex<Key, Hash>::find(Key const& key) const
+{
+    if (m_slots.empty())
+        return -1;
+    return m_slots[findSlot(key)].position;
+}
+
+template<typename Key, typename Hash>
+template<typename T, typename KeyFunc>
+void HashIndex<Key, Hash>::rebuild(std::vector<T> const& entries, KeyFunc keyFunc)
+{
+    clear();
+    reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        insert(keyFunc(entries[i]), uint32_t(i));
+}
+
+template<typename Key, typename Hash>
+size_t HashIndex<Key, Hash>::findSlot(Key const& key) const
+{
+    //std::hash of an integer is usually the integer itself, so it is mixed before taking the low bits
+    size_t mask = m_slots.size() - 1;
+    size_t i = size_t((uint64_t(Hash()(key)) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (m_slots[i].position >= 0 && !(m_slots[i].key == key))
+        i = (i + 1) & mask;
+    return i;
+}
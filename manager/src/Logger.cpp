@@ -85,6 +85,13 @@ bool Logger::load(sqlite3& db)
 
     m_insertStmt.reset(stmt, &sqlite3_finalize);
 
+    const char* filename = sqlite3_db_filename(m_sqlite, "main");
+    if (m_readPool.open(filename ? filename : "", 2) != success)
+    {
+        Q_ASSERT(false);
+        return false;
+    }
+
     return true;
 }
 
@@ -95,6 +102,7 @@ void Logger::close()
     if (!m_sqlite)
         return;
     
+    m_readPool.close();
     m_insertStmt = nullptr;
     m_sqlite = nullptr;
 }
@@ -267,7 +275,9 @@ void Logger::addToDB(std::string const& message, Type type)
 
 std::vector<Logger::LogLine> Logger::getFilteredLogLines(Filter const& filter) const
 {
-    std::lock_guard<std::recursive_mutex> lg(m_mutex);
+    ReadConnectionPool::Snapshot snapshot = m_readPool.acquire();
+    if (!snapshot)
+        return {};
 
     std::vector<LogLine> result;
     result.reserve(16384);
@@ -304,7 +314,7 @@ std::vector<Logger::LogLine> Logger::getFilteredLogLines(Filter const& filter) c
         sql += ";";
 
 		sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        if (sqlite3_prepare_v2(snapshot.get(), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
 		{
             Q_ASSERT(false);
             return {};
@@ -9,6 +9,7 @@
 #include <QObject>
 #include <QTimer>
 #include "Result.h"
+#include "ReadConnectionPool.h"
 
 struct sqlite3;
 struct sqlite3_stmt;
@@ -86,6 +87,7 @@ private:
 	mutable std::recursive_mutex m_mutex;
     sqlite3* m_sqlite = nullptr;
 	std::shared_ptr<sqlite3_stmt> m_insertStmt;
+    ReadConnectionPool m_readPool; //so the log queries don't block the logging
     std::vector<LogLine> m_logLinesForSignaling;
 };
 
@@ -2,6 +2,7 @@
 
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QFileInfo>
 #include "ConfigureUserDialog.h"
 
 #include "ui_LoginDialog.h"
@@ -115,10 +116,12 @@ Manager::Manager(QWidget *parent)
 
     //m_ui.baseStationsWidget->init(m_comms);
 
-    auto* timer = new QTimer(this);
-    timer->setSingleShot(false);
-    timer->start(1);
-    connect(timer, &QTimer::timeout, this, &Manager::process, Qt::QueuedConnection);
+    //re-armed in process() with the time until the next deadline, and sooner when the comms or the ingest thread have work for it
+    m_processTimer = new QTimer(this);
+    m_processTimer->setSingleShot(true);
+    m_processTimer->start(0);
+    connect(m_processTimer, &QTimer::timeout, this, &Manager::process, Qt::QueuedConnection);
+    connect(&m_db, &DB::processRequested, this, [this] { m_processTimer->start(0); }, Qt::QueuedConnection);
 
     connect(m_ui.actionSettings, &QAction::triggered, this, &Manager::showSettingsDialog);
     connect(m_ui.actionBaseStations, &QAction::triggered, this, &Manager::showBaseStationsDialog);
@@ -545,21 +548,40 @@ void Manager::readSettings()
 
 void Manager::processBackups()
 {
+	//the open measurement partitions are backed up with the main file, the sealed ones only once as they don't change
+	std::vector<DB::MeasurementPartition> partitions = m_db.getMeasurementPartitions();
+	auto copyAllToBackup = [&partitions](std::string const& folder, size_t maxBackups)
+	{
+		utils::copyToBackup("sense.db", s_dataFolder + "/sense.db", folder, maxBackups);
+		for (DB::MeasurementPartition const& partition: partitions)
+		{
+			if (!partition.sealed)
+				utils::copyToBackup(QFileInfo(partition.filename.c_str()).fileName().toUtf8().data(), partition.filename, folder, maxBackups);
+		}
+	};
+
 	IClock::time_point now = IClock::rtNow();
     if (now - m_lastHourlyBackupTP >= std::chrono::hours(1))
     {
         m_lastHourlyBackupTP = now;
-        utils::copyToBackup("sense.db", s_dataFolder + "/sense.db", s_dataFolder + "/backups/hourly", 24);
+        copyAllToBackup(s_dataFolder + "/backups/hourly", 24);
+
+		for (DB::MeasurementPartition const& partition: partitions)
+		{
+			if (partition.sealed && !partition.backedUp &&
+			        utils::copyToBackup(QFileInfo(partition.filename.c_str()).fileName().toUtf8().data(), partition.filename, s_dataFolder + "/backups/partitions", 1))
+				m_db.setMeasurementPartitionBackedUp(partition.name);
+		}
     }
 	if (now - m_lastDailyBackupTP >= std::chrono::hours(24))
 	{
 		m_lastDailyBackupTP = now;
-		utils::copyToBackup("sense.db", s_dataFolder + "/sense.db", s_dataFolder + "/backups/daily", 7);
+		copyAllToBackup(s_dataFolder + "/backups/daily", 7);
 	}
 	if (now - m_lastWeeklyBackupTP >= std::chrono::hours(24 * 7))
 	{
 		m_lastWeeklyBackupTP = now;
-		utils::copyToBackup("sense.db", s_dataFolder + "/sense.db", s_dataFolder + "/backups/weekly", 30);
+		copyAllToBackup(s_dataFolder + "/backups/weekly", 30);
 	}
 }
 
@@ -581,6 +603,22 @@ void Manager::process()
 	m_db.process();
 
     processBackups();
+
+    //sleep until the next deadline, what comes from the other threads wakes it up with processRequested.
+    //Rounded up, a timer that fires a bit early would only find nothing due
+    IClock::duration wait = std::min(m_db.computeTimeUntilNextEvent(), computeTimeUntilNextBackup());
+    wait = std::min<IClock::duration>(wait, std::chrono::milliseconds(std::numeric_limits<int>::max()));
+    m_processTimer->start(static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(wait).count()));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+IClock::duration Manager::computeTimeUntilNextBackup() const
+{
+	IClock::time_point next = std::min({ m_lastHourlyBackupTP + std::chrono::hours(1),
+	                                     m_lastDailyBackupTP + std::chrono::hours(24),
+	                                     m_lastWeeklyBackupTP + std::chrono::hours(24 * 7) });
+	return std::max(next - IClock::rtNow(), IClock::duration::zero());
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -9,6 +9,7 @@
 #include "ui_CriticalLogsDialog.h"
 
 struct sqlite3;
+class QTimer;
 
 class Manager : public QMainWindow
 {
@@ -31,6 +32,7 @@ private slots:
 
 private:
     void processBackups();
+    IClock::duration computeTimeUntilNextBackup() const;
     void process();
 	void userLoggedIn(DB::UserId id);
     void checkIfAdminExists();
@@ -43,6 +45,7 @@ private:
     void tabChanged();
 
     QMetaObject::Connection m_tabChangedConnection;
+    QTimer* m_processTimer = nullptr;
 
 	std::unique_ptr<sqlite3, int(*)(sqlite3*)> m_sqlite;
 
@@ -0,0 +1,759 @@
+#include "MeasurementChunk.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <QString>
+#include "sqlite3.h"
+
+namespace chunk
+{
+
+static constexpr uint8_t VERSION = 1;
+static constexpr double QUANTIZATION_SCALE = 100.0; //0.01 steps
+static constexpr uint8_t s_unsignedWidths[] = { 0, 4, 8, 16, 32, 64 }; //selected by a prefix of 0 to 5 set bits
+
+//////////////////////////////////////////////////////////////////////////
+
+//LSB first, like the Bitstream of the sensors but growing as needed
+class BitWriter
+{
+public:
+    void write(uint64_t value, uint8_t bits)
+    {
+        if (bits > 32)
+        {
+            write(value & 0xFFFFFFFFULL, 32);
+            write(value >> 32, bits - 32);
+            return;
+        }
+        if (bits < 64)
+            value &= (uint64_t(1) << bits) - 1;
+        while (bits > 0)
+        {
+            uint8_t offset = uint8_t(m_bitSize & 7);
+            if (offset == 0)
+                m_data.push_back(0);
+            uint8_t count = std::min<uint8_t>(bits, 8 - offset);
+            m_data.back() |= uint8_t((value & ((1u << count) - 1)) << offset);
+            value >>= count;
+            bits -= count;
+            m_bitSize += count;
+        }
+    }
+    void writeUnsigned(uint64_t value)
+    {
+        size_t i = 0;
+        while (i + 1 < sizeof(s_unsignedWidths) && (value >> s_unsignedWidths[i]) != 0)
+            i++;
+        if (i + 1 < sizeof(s_unsignedWidths))
+            write((uint64_t(1) << i) - 1, uint8_t(i + 1));
+        else
+            write((uint64_t(1) << i) - 1, uint8_t(i));
+        write(value, s_unsignedWidths[i]);
+    }
+    void writeSigned(int64_t value)
+    {
+        writeUnsigned((uint64_t(value) << 1) ^ uint64_t(value >> 63)); //zig-zag, small magnitudes get small codes
+    }
+    std::vector<uint8_t>& data() { return m_data; }
+
+private:
+    std::vector<uint8_t> m_data;
+    size_t m_bitSize = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+class BitReader
+{
+public:
+    BitReader(uint8_t const* data, size_t size)
+        : m_data(data)
+        , m_end(data + size)
+    {
+    }
+
+    bool read(uint64_t& value, uint8_t bits)
+    {
+        if (bits > 32)
+        {
+            uint64_t low = 0;
+            uint64_t high = 0;
+            if (!read(low, 32) || !read(high, bits - 32))
+                return false;
+            value = low | (high << 32);
+            return true;
+        }
+        if (m_bufferBits < bits && (refill(), m_bufferBits < bits))
+            return false;
+        value = m_buffer & ((uint64_t(1) << bits) - 1);
+        m_buffer >>= bits;
+        m_bufferBits -= bits;
+        return true;
+    }
+    bool readUnsigned(uint64_t& value)
+    {
+        //the prefix is read at once, the set bits up to the first clear one
+        if (m_bufferBits < sizeof(s_unsignedWidths))
+            refill();
+        size_t i = 0;
+        while (i + 1 < sizeof(s_unsignedWidths) && i < m_bufferBits && (m_buffer >> i) & 1)
+            i++;
+        size_t prefixBits = i + 1 < sizeof(s_unsignedWidths) ? i + 1 : i;
+        if (prefixBits > m_bufferBits)
+            return false;
+        m_buffer >>= prefixBits;
+        m_bufferBits -= uint8_t(prefixBits);
+        value = 0;
+        return s_unsignedWidths[i] == 0 || read(value, s_unsignedWidths[i]);
+    }
+    bool readSigned(int64_t& value)
+    {
+        uint64_t u = 0;
+        if (!readUnsigned(u))
+            return false;
+        value = int64_t(u >> 1) ^ -int64_t(u & 1);
+        return true;
+    }
+
+private:
+    //whole bytes into the buffer, while they fit
+    void refill()
+    {
+        while (m_bufferBits <= 56 && m_data < m_end)
+        {
+            m_buffer |= uint64_t(*m_data++) << m_bufferBits;
+            m_bufferBits += 8;
+        }
+    }
+
+    uint8_t const* m_data = nullptr;
+    uint8_t const* m_end = nullptr;
+    uint64_t m_buffer = 0; //the next bits to read, from the LSB
+    uint8_t m_bufferBits = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+static uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint8_t countLeadingZeros(uint32_t value)
+{
+    uint8_t count = 0;
+    for (uint32_t mask = 0x80000000u; mask && !(value & mask); mask >>= 1)
+        count++;
+    return count;
+}
+
+static uint8_t countTrailingZeros(uint32_t value)
+{
+    uint8_t count = 0;
+    for (uint32_t mask = 1; mask && !(value & mask); mask <<= 1)
+        count++;
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//the quantized values if all of them decode back to the same floats, bit for bit
+static bool quantize(std::vector<float> const& values, std::vector<int64_t>& quantized)
+{
+    quantized.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        float value = values[i];
+        if (!std::isfinite(value) || std::fabs(value) > 1e9f)
+            return false;
+        int64_t q = std::llround(double(value) * QUANTIZATION_SCALE);
+        if (floatBits(float(double(q) / QUANTIZATION_SCALE)) != floatBits(value))
+            return false;
+        quantized[i] = q;
+    }
+    return true;
+}
+
+//A flag for the coding, then either the quantized deltas or the XOR with the previous value:
+//0 for the same value, 10 and the meaningful bits if they fit in the previous window,
+//11, 5 bits of leading zeros, 5 bits of length and the meaningful bits otherwise
+static void encodeFloats(BitWriter& writer, std::vector<float> const& values)
+{
+    std::vector<int64_t> quantized;
+    if (quantize(values, quantized))
+    {
+        writer.write(0, 1);
+        int64_t previous = 0;
+        for (int64_t q: quantized)
+        {
+            writer.writeSigned(q - previous);
+            previous = q;
+        }
+        return;
+    }
+
+    writer.write(1, 1);
+    uint32_t previous = 0;
+    uint8_t leading = 0xFF;
+    uint8_t trailing = 0;
+    for (float value: values)
+    {
+        uint32_t bits = floatBits(value);
+        uint32_t x = bits ^ previous;
+        previous = bits;
+        if (x == 0)
+        {
+            writer.write(0, 1);
+            continue;
+        }
+        uint8_t newLeading = std::min<uint8_t>(countLeadingZeros(x), 31);
+        uint8_t newTrailing = countTrailingZeros(x);
+        if (leading != 0xFF && newLeading >= leading && newTrailing >= trailing)
+        {
+            writer.write(1, 2);
+            writer.write(x >> trailing, uint8_t(32 - leading - trailing));
+            continue;
+        }
+        leading = newLeading;
+        trailing = newTrailing;
+        uint8_t length = uint8_t(32 - leading - trailing);
+        writer.write(3, 2);
+        writer.write(leading, 5);
+        writer.write(length - 1, 5);
+        writer.write(x >> trailing, length);
+    }
+}
+
+static bool decodeFloats(BitReader& reader, std::vector<DB::Measurement>& measurements, float DB::MeasurementDescriptor::* member)
+{
+    uint64_t mode = 0;
+    if (!reader.read(mode, 1))
+        return false;
+
+    if (mode == 0)
+    {
+        int64_t q = 0;
+        for (DB::Measurement& m: measurements)
+        {
+            int64_t delta = 0;
+            if (!reader.readSigned(delta))
+                return false;
+            q += delta;
+            m.descriptor.*member = float(double(q) / QUANTIZATION_SCALE);
+        }
+        return true;
+    }
+
+    uint32_t previous = 0;
+    uint8_t leading = 0;
+    uint8_t trailing = 0;
+    for (DB::Measurement& m: measurements)
+    {
+        uint64_t bit = 0;
+        if (!reader.read(bit, 1))
+            return false;
+        if (bit != 0)
+        {
+            if (!reader.read(bit, 1))
+                return false;
+            if (bit != 0)
+            {
+                uint64_t l = 0;
+                uint64_t length = 0;
+                if (!reader.read(l, 5) || !reader.read(length, 5))
+                    return false;
+                leading = uint8_t(l);
+                if (leading + length + 1 > 32)
+                    return false;
+                trailing = uint8_t(32 - leading - length - 1);
+            }
+            uint64_t x = 0;
+            if (!reader.read(x, uint8_t(32 - leading - trailing)))
+                return false;
+            previous ^= uint32_t(x << trailing);
+        }
+        m.descriptor.*member = bitsFloat(previous);
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//a bit for unchanged, otherwise a set bit and the value
+static void encodeFlags(BitWriter& writer, std::vector<DB::Measurement> const& measurements, uint32_t (*get)(DB::Measurement const&))
+{
+    uint32_t previous = 0;
+    for (DB::Measurement const& m: measurements)
+    {
+        uint32_t value = get(m);
+        if (value == previous)
+            writer.write(0, 1);
+        else
+        {
+            writer.write(1, 1);
+            writer.writeUnsigned(value);
+        }
+        previous = value;
+    }
+}
+
+static bool decodeFlags(BitReader& reader, std::vector<DB::Measurement>& measurements, uint32_t& (*get)(DB::Measurement&))
+{
+    uint32_t previous = 0;
+    for (DB::Measurement& m: measurements)
+    {
+        uint64_t bit = 0;
+        if (!reader.read(bit, 1))
+            return false;
+        if (bit != 0)
+        {
+            uint64_t value = 0;
+            if (!reader.readUnsigned(value))
+                return false;
+            previous = uint32_t(value);
+        }
+        get(m) = previous;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//the second differences, zero for values that change at a steady rate
+static void encodeDeltasOfDeltas(BitWriter& writer, std::vector<DB::Measurement> const& measurements, int64_t (*get)(DB::Measurement const&))
+{
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    for (size_t i = 0; i < measurements.size(); i++)
+    {
+        int64_t value = get(measurements[i]);
+        int64_t delta = value - previous;
+        writer.writeSigned(delta - previousDelta);
+        previous = value;
+        previousDelta = i > 0 ? delta : 0; //the first value is not a delta
+    }
+}
+
+static bool decodeDeltasOfDeltas(BitReader& reader, std::vector<int64_t>& values)
+{
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        int64_t dd = 0;
+        if (!reader.readSigned(dd))
+            return false;
+        int64_t delta = previousDelta + dd;
+        previous += delta;
+        previousDelta = i > 0 ? delta : 0;
+        values[i] = previous;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+std::vector<uint8_t> encode(std::vector<DB::Measurement> const& measurements)
+{
+    BitWriter writer;
+    writer.write(VERSION, 8);
+    writer.writeUnsigned(measurements.size());
+    writer.writeUnsigned(measurements.empty() ? 0 : measurements.front().descriptor.sensorId);
+
+    //column by column, so each column's deltas stay small
+    encodeDeltasOfDeltas(writer, measurements, [](DB::Measurement const& m) { return int64_t(m.descriptor.index); });
+    encodeDeltasOfDeltas(writer, measurements, [](DB::Measurement const& m) { return int64_t(m.id); });
+    encodeDeltasOfDeltas(writer, measurements, [](DB::Measurement const& m) { return int64_t(IClock::to_time_t(m.timePoint)); });
+    encodeDeltasOfDeltas(writer, measurements, [](DB::Measurement const& m) { return int64_t(IClock::to_time_t(m.receivedTimePoint) - IClock::to_time_t(m.timePoint)); });
+
+    std::vector<float> values(measurements.size());
+    for (float DB::MeasurementDescriptor::* member: { &DB::MeasurementDescriptor::temperature, &DB::MeasurementDescriptor::humidity, &DB::MeasurementDescriptor::vcc })
+    {
+        for (size_t i = 0; i < measurements.size(); i++)
+            values[i] = measurements[i].descriptor.*member;
+        encodeFloats(writer, values);
+    }
+
+    int16_t previousS2B = 0;
+    int16_t previousB2S = 0;
+    for (DB::Measurement const& m: measurements)
+    {
+        writer.writeSigned(int64_t(m.descriptor.signalStrength.s2b) - previousS2B);
+        previousS2B = m.descriptor.signalStrength.s2b;
+    }
+    for (DB::Measurement const& m: measurements)
+    {
+        writer.writeSigned(int64_t(m.descriptor.signalStrength.b2s) - previousB2S);
+        previousB2S = m.descriptor.signalStrength.b2s;
+    }
+
+    encodeFlags(writer, measurements, [](DB::Measurement const& m) { return m.descriptor.sensorErrors; });
+    encodeFlags(writer, measurements, [](DB::Measurement const& m) { return m.alarmTriggers.current; });
+    encodeFlags(writer, measurements, [](DB::Measurement const& m) { return m.alarmTriggers.added; });
+    encodeFlags(writer, measurements, [](DB::Measurement const& m) { return m.alarmTriggers.removed; });
+
+    return std::move(writer.data());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool decode(void const* data, size_t size, std::vector<DB::Measurement>& measurements)
+{
+    measurements.clear();
+
+    BitReader reader(reinterpret_cast<uint8_t const*>(data), size);
+    uint64_t version = 0;
+    uint64_t count = 0;
+    uint64_t sensorId = 0;
+    if (!reader.read(version, 8) || version != VERSION || !reader.readUnsigned(count) || !reader.readUnsigned(sensorId))
+        return false;
+    if (count > size * 8) //every measurement takes at least a bit
+        return false;
+
+    measurements.resize(static_cast<size_t>(count));
+    std::vector<int64_t> values(static_cast<size_t>(count));
+
+    if (!decodeDeltasOfDeltas(reader, values))
+        return false;
+    for (size_t i = 0; i < measurements.size(); i++)
+    {
+        measurements[i].descriptor.sensorId = DB::SensorId(sensorId);
+        measurements[i].descriptor.index = uint32_t(values[i]);
+    }
+    if (!decodeDeltasOfDeltas(reader, values))
+        return false;
+    for (size_t i = 0; i < measurements.size(); i++)
+        measurements[i].id = DB::MeasurementId(values[i]);
+    if (!decodeDeltasOfDeltas(reader, values))
+        return false;
+    for (size_t i = 0; i < measurements.size(); i++)
+        measurements[i].timePoint = IClock::from_time_t(values[i]);
+    if (!decodeDeltasOfDeltas(reader, values))
+        return false;
+    for (size_t i = 0; i < measurements.size(); i++)
+        measurements[i].receivedTimePoint = IClock::from_time_t(IClock::to_time_t(measurements[i].timePoint) + values[i]);
+
+    if (!decodeFloats(reader, measurements, &DB::MeasurementDescriptor::temperature) ||
+        !decodeFloats(reader, measurements, &DB::MeasurementDescriptor::humidity) ||
+        !decodeFloats(reader, measurements, &DB::MeasurementDescriptor::vcc))
+        return false;
+
+    int64_t s2b = 0;
+    for (DB::Measurement& m: measurements)
+    {
+        int64_t delta = 0;
+        if (!reader.readSigned(delta))
+            return false;
+        s2b += delta;
+        m.descriptor.signalStrength.s2b = int16_t(s2b);
+    }
+    int64_t b2s = 0;
+    for (DB::Measurement& m: measurements)
+    {
+        int64_t delta = 0;
+        if (!reader.readSigned(delta))
+            return false;
+        b2s += delta;
+        m.descriptor.signalStrength.b2s = int16_t(b2s);
+    }
+
+    return decodeFlags(reader, measurements, [](DB::Measurement& m) -> uint32_t& { return m.descriptor.sensorErrors; }) &&
+           decodeFlags(reader, measurements, [](DB::Measurement& m) -> uint32_t& { return m.alarmTriggers.current; }) &&
+           decodeFlags(reader, measurements, [](DB::Measurement& m) -> uint32_t& { return m.alarmTriggers.added; }) &&
+           decodeFlags(reader, measurements, [](DB::Measurement& m) -> uint32_t& { return m.alarmTriggers.removed; });
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//The ChunkedMeasurements virtual table
+
+enum Column
+{
+    ColumnId = 0,
+    ColumnTimePoint,
+    ColumnReceivedTimePoint,
+    ColumnIndex,
+    ColumnSensorId,
+    ColumnTemperature,
+    ColumnHumidity,
+    ColumnVcc,
+    ColumnSignalStrengthS2B,
+    ColumnSignalStrengthB2S,
+    ColumnSensorErrors,
+    ColumnAlarmTriggersCurrent,
+    ColumnAlarmTriggersAdded,
+    ColumnAlarmTriggersRemoved
+};
+
+struct Table
+{
+    sqlite3_vtab base; //first, sqlite sees only this
+    sqlite3* sqlite = nullptr;
+};
+
+struct Cursor
+{
+    sqlite3_vtab_cursor base; //first, sqlite sees only this
+    sqlite3_stmt* chunksStmt = nullptr;
+    std::vector<DB::Measurement> measurements; //of the current chunk
+    size_t position = 0;
+    bool eof = true;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+static int xConnect(sqlite3* sqlite, void*, int, const char* const*, sqlite3_vtab** vtab, char**)
+{
+    //same columns, in the same order as the Measurements table, so the queries can select * from either
+    int result = sqlite3_declare_vtab(sqlite, "CREATE TABLE x (id INTEGER, timePoint DATETIME, receivedTimePoint DATETIME, idx INTEGER, sensorId INTEGER, temperature REAL, humidity REAL, vcc REAL, "
+                                              "signalStrengthS2B INTEGER, signalStrengthB2S INTEGER, sensorErrors INTEGER, alarmTriggersCurrent INTEGER, alarmTriggersAdded INTEGER, alarmTriggersRemoved INTEGER);");
+    if (result != SQLITE_OK)
+        return result;
+
+    Table* table = new Table();
+    table->sqlite = sqlite;
+    *vtab = &table->base;
+    return SQLITE_OK;
+}
+
+static int xDisconnect(sqlite3_vtab* vtab)
+{
+    delete reinterpret_cast<Table*>(vtab);
+    return SQLITE_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//The constraints used to find the chunks are passed in idxStr as a column letter and a bound per argument:
+//'=' for equal, '>' for a lower bound and '<' for an upper one. They are not omitted, sqlite checks them again per row
+static int xBestIndex(sqlite3_vtab*, sqlite3_index_info* info)
+{
+    std::string plan;
+    double cost = 1e9;
+    int argument = 0;
+    for (int i = 0; i < info->nConstraint; i++)
+    {
+        sqlite3_index_info::sqlite3_index_constraint const& constraint = info->aConstraint[i];
+        if (!constraint.usable)
+            continue;
+
+        char column = 0;
+        switch (constraint.iColumn)
+        {
+        case ColumnId: column = 'i'; break;
+        case ColumnTimePoint: column = 't'; break;
+        case ColumnIndex: column = 'x'; break;
+        case ColumnSensorId: column = 's'; break;
+        default: continue;
+        }
+
+        char bound = 0;
+        switch (constraint.op)
+        {
+        case SQLITE_INDEX_CONSTRAINT_EQ: bound = '='; break;
+        case SQLITE_INDEX_CONSTRAINT_GT: case SQLITE_INDEX_CONSTRAINT_GE: bound = '>'; break;
+        case SQLITE_INDEX_CONSTRAINT_LT: case SQLITE_INDEX_CONSTRAINT_LE: bound = '<'; break;
+        default: continue;
+        }
+
+        plan += column;
+        plan += bound;
+        info->aConstraintUsage[i].argvIndex = ++argument;
+        info->aConstraintUsage[i].omit = 0;
+        cost /= (bound == '=') ? 100.0 : 4.0;
+    }
+
+    info->idxStr = sqlite3_mprintf("%s", plan.c_str());
+    info->needToFreeIdxStr = 1;
+    info->estimatedCost = std::max(cost, 10.0);
+    return SQLITE_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static int xOpen(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+{
+    Cursor* c = new Cursor();
+    *cursor = &c->base;
+    return SQLITE_OK;
+}
+
+static int xClose(sqlite3_vtab_cursor* cursor)
+{
+    Cursor* c = reinterpret_cast<Cursor*>(cursor);
+    sqlite3_finalize(c->chunksStmt);
+    delete c;
+    return SQLITE_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//steps to the next chunk with measurements in it
+static int nextChunk(Cursor* c)
+{
+    c->position = 0;
+    c->measurements.clear();
+    while (c->measurements.empty())
+    {
+        int result = sqlite3_step(c->chunksStmt);
+        if (result == SQLITE_DONE)
+        {
+            c->eof = true;
+            return SQLITE_OK;
+        }
+        if (result != SQLITE_ROW)
+            return result;
+
+        if (!decode(sqlite3_column_blob(c->chunksStmt, 0), size_t(sqlite3_column_bytes(c->chunksStmt, 0)), c->measurements))
+        {
+            Table* table = reinterpret_cast<Table*>(c->base.pVtab);
+            sqlite3_free(table->base.zErrMsg);
+            table->base.zErrMsg = sqlite3_mprintf("Corrupted measurement chunk");
+            return SQLITE_CORRUPT;
+        }
+    }
+    c->eof = false;
+    return SQLITE_OK;
+}
+
+static int xFilter(sqlite3_vtab_cursor* cursor, int, const char* idxStr, int argc, sqlite3_value** argv)
+{
+    Cursor* c = reinterpret_cast<Cursor*>(cursor);
+    Table* table = reinterpret_cast<Table*>(cursor->pVtab);
+
+    std::string sql = "SELECT data FROM MeasurementChunks WHERE 1";
+    std::string plan = idxStr ? idxStr : "";
+    for (size_t i = 0; i + 1 < plan.size(); i += 2)
+    {
+        std::string argument = "?" + std::to_string(i / 2 + 1);
+        char bound = plan[i + 1];
+        const char* low = nullptr;
+        const char* high = nullptr;
+        switch (plan[i])
+        {
+        case 'i': low = "minId"; high = "maxId"; break;
+        case 't': low = "beginTimePoint"; high = "endTimePoint"; break;
+        case 'x': low = "firstIdx"; high = "lastIdx"; break;
+        default: low = "sensorId"; high = "sensorId"; break;
+        }
+        //the chunks with their [low, high] range overlapping the constraint
+        if (bound == '=' || bound == '<')
+            sql += std::string(" AND ") + low + " <= " + argument;
+        if (bound == '=' || bound == '>')
+            sql += std::string(" AND ") + high + " >= " + argument;
+    }
+    sql += ";";
+
+    sqlite3_finalize(c->chunksStmt);
+    c->chunksStmt = nullptr;
+    c->eof = true;
+    if (sqlite3_prepare_v2(table->sqlite, sql.c_str(), -1, &c->chunksStmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_free(table->base.zErrMsg);
+        table->base.zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(table->sqlite));
+        return SQLITE_ERROR;
+    }
+    for (int i = 0; i < argc; i++)
+        sqlite3_bind_value(c->chunksStmt, i + 1, argv[i]);
+
+    return nextChunk(c);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static int xNext(sqlite3_vtab_cursor* cursor)
+{
+    Cursor* c = reinterpret_cast<Cursor*>(cursor);
+    if (++c->position < c->measurements.size())
+        return SQLITE_OK;
+    return nextChunk(c);
+}
+
+static int xEof(sqlite3_vtab_cursor* cursor)
+{
+    return reinterpret_cast<Cursor*>(cursor)->eof ? 1 : 0;
+}
+
+static int xColumn(sqlite3_vtab_cursor* cursor, sqlite3_context* context, int column)
+{
+    Cursor* c = reinterpret_cast<Cursor*>(cursor);
+    DB::Measurement const& m = c->measurements[c->position];
+    switch (column)
+    {
+    case ColumnId: sqlite3_result_int64(context, int64_t(m.id)); break;
+    case ColumnTimePoint: sqlite3_result_int64(context, IClock::to_time_t(m.timePoint)); break;
+    case ColumnReceivedTimePoint: sqlite3_result_int64(context, IClock::to_time_t(m.receivedTimePoint)); break;
+    case ColumnIndex: sqlite3_result_int64(context, m.descriptor.index); break;
+    case ColumnSensorId: sqlite3_result_int64(context, m.descriptor.sensorId); break;
+    case ColumnTemperature: sqlite3_result_double(context, m.descriptor.temperature); break;
+    case ColumnHumidity: sqlite3_result_double(context, m.descriptor.humidity); break;
+    case ColumnVcc: sqlite3_result_double(context, m.descriptor.vcc); break;
+    case ColumnSignalStrengthS2B: sqlite3_result_int(context, m.descriptor.signalStrength.s2b); break;
+    case ColumnSignalStrengthB2S: sqlite3_result_int(context, m.descriptor.signalStrength.b2s); break;
+    case ColumnSensorErrors: sqlite3_result_int64(context, m.descriptor.sensorErrors); break;
+    case ColumnAlarmTriggersCurrent: sqlite3_result_int64(context, m.alarmTriggers.current); break;
+    case ColumnAlarmTriggersAdded: sqlite3_result_int64(context, m.alarmTriggers.added); break;
+    case ColumnAlarmTriggersRemoved: sqlite3_result_int64(context, m.alarmTriggers.removed); break;
+    default: sqlite3_result_null(context); break;
+    }
+    return SQLITE_OK;
+}
+
+static int xRowid(sqlite3_vtab_cursor* cursor, sqlite3_int64* rowid)
+{
+    Cursor* c = reinterpret_cast<Cursor*>(cursor);
+    *rowid = int64_t(c->measurements[c->position].id);
+    return SQLITE_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static sqlite3_module s_module =
+{
+    0,              //iVersion
+    nullptr,        //xCreate, null for an eponymous only table: it exists in every schema without a CREATE VIRTUAL TABLE
+    &xConnect,
+    &xBestIndex,
+    &xDisconnect,
+    nullptr,        //xDestroy
+    &xOpen,
+    &xClose,
+    &xFilter,
+    &xNext,
+    &xEof,
+    &xColumn,
+    &xRowid,
+    nullptr,        //xUpdate, read only
+    nullptr,        //xBegin
+    nullptr,        //xSync
+    nullptr,        //xCommit
+    nullptr,        //xRollback
+    nullptr,        //xFindFunction
+    nullptr,        //xRename
+    nullptr,        //xSavepoint
+    nullptr,        //xRelease
+    nullptr,        //xRollbackTo
+    nullptr,        //xShadowName
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> registerModule(sqlite3& sqlite)
+{
+    if (sqlite3_create_module(&sqlite, "ChunkedMeasurements", &s_module, nullptr) != SQLITE_OK)
+        return Error(QString("Cannot create the ChunkedMeasurements table: %1").arg(sqlite3_errmsg(&sqlite)).toUtf8().data());
+    return success;
+}
+
+}
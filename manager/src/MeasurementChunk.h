@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "DB.h"
+
+struct sqlite3;
+
+//The cold measurements of a sensor are kept packed in blobs, a few hundred per blob, in the order of their indices.
+//The indices, ids and time points are delta coded, the temperature, humidity and vcc are coded as quantized deltas
+//when they are on a 0.01 grid and as the XOR with the previous value otherwise, the signal strengths as deltas and
+//the errors and alarm triggers as flags with a single bit when they don't change. All of it is lossless.
+namespace chunk
+{
+    std::vector<uint8_t> encode(std::vector<DB::Measurement> const& measurements);
+    //returns false if the data is not a valid chunk
+    bool decode(void const* data, size_t size, std::vector<DB::Measurement>& measurements);
+
+    //Registers the ChunkedMeasurements virtual table on the connection. It has the columns of the Measurements table
+    //and decodes the chunks from the MeasurementChunks table that overlap the sensorId, idx, timePoint and id constraints.
+    //It's read only, the chunks are changed directly in the MeasurementChunks table.
+    Result<void> registerModule(sqlite3& sqlite);
+}
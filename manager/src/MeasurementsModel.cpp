@@ -7,13 +7,15 @@
 #include <cmath>
 #include <bitset>
 #include <array>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include "Utils.h"
 
 static std::array<const char*, 10> s_headerNames = {"Id", "Sensor", "Index", "Timestamp", "Received Timestamp", "Temperature", "Humidity", "Battery", "Signal", "Alarms"};
 
-constexpr size_t k_chunkSize = 10000;
+constexpr size_t k_pageSize = 10000;
+constexpr size_t k_maxLoadedPages = 8;
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -39,6 +41,13 @@ void MeasurementsModel::setActive(bool active)
 
     m_connections.clear();
 
+    if (active)
+    {
+        m_connections.push_back(connect(&m_db, &DB::measurementsAdded, this, &MeasurementsModel::checkMeasurementCount));
+        m_connections.push_back(connect(&m_db, &DB::measurementsChanged, this, &MeasurementsModel::checkMeasurementCount));
+        checkMeasurementCount();
+    }
+
 // 	m_connections.push_back(connect(&m_db, &DB::measurementsAdded, this, &MeasurementsModel::startSlowAutoRefresh));
 // 	m_connections.push_back(connect(&m_db, &DB::measurementsChanged, this, &MeasurementsModel::startFastAutoRefresh));
 //	m_connections.push_back(connect(m_refreshTimer, &QTimer::timeout, this, &MeasurementsModel::refresh));
@@ -69,7 +78,7 @@ QModelIndex MeasurementsModel::parent(QModelIndex const& /*index*/) const
 int MeasurementsModel::rowCount(QModelIndex const& index) const
 {
     if (!index.isValid())
-        return static_cast<int>(m_measurements.size());
+        return static_cast<int>(m_rowCount);
 
     return 0;
 }
@@ -101,11 +110,13 @@ QVariant MeasurementsModel::data(QModelIndex const& index, int role) const
     if (!index.isValid())
         return QVariant();
 
-    size_t indexRow = static_cast<size_t>(index.row());
-    if (indexRow >= m_measurements.size())
+    //empty until its page is read again
+    size_t pageRow = 0;
+    Page* page = findRowPage(static_cast<size_t>(index.row()), pageRow, false);
+    if (!page)
         return QVariant();
 
-    DB::Measurement const& measurement = m_measurements[indexRow];
+    DB::Measurement const& measurement = page->measurements[pageRow];
 
     //code to skip over disabled columns
     Column column = static_cast<Column>(index.column());
@@ -136,30 +147,12 @@ QVariant MeasurementsModel::data(QModelIndex const& index, int role) const
     {
         if (column == Column::Id)
             return static_cast<qulonglong>(measurement.id);
-        else if (column == Column::Sensor)
-        {
-            std::optional<DB::Sensor> sensor = m_db.findSensorById(measurement.descriptor.sensorId);
-            if (sensor.has_value())
-                return sensor->descriptor.name.c_str();
-            else
-                return "N/A";
-        }
         else if (column == Column::Index)
             return measurement.descriptor.index;
-        else if (column == Column::Timestamp)
-			return utils::toString<IClock>(measurement.timePoint, m_db.getGeneralSettings().dateTimeFormat);
-		else if (column == Column::ReceivedTimestamp)
-			return utils::toString<IClock>(measurement.receivedTimePoint, m_db.getGeneralSettings().dateTimeFormat);
-        else if (column == Column::Temperature)
-            return QString("%1°C").arg(measurement.descriptor.temperature, 0, 'f', 1);
-        else if (column == Column::Humidity)
-            return QString("%1 %RH").arg(measurement.descriptor.humidity, 0, 'f', 1);
-        else if (column == Column::Battery)
-            return QString("%1%").arg(static_cast<int>(utils::getBatteryLevel(measurement.descriptor.vcc) * 100.f));
-        else if (column == Column::Signal)
-            return QString("%1%").arg(static_cast<int>(utils::getSignalLevel(std::min(measurement.descriptor.signalStrength.s2b, measurement.descriptor.signalStrength.b2s)) * 100.f));
         else if (column == Column::Alarms)
             return measurement.alarmTriggers.current;
+        else
+            return getDisplayString(*page, pageRow, column);
     }
 	else if (role == Qt::ToolTipRole)
 	{
@@ -172,6 +165,182 @@ QVariant MeasurementsModel::data(QModelIndex const& index, int role) const
 
 //////////////////////////////////////////////////////////////////////////
 
+QString const& MeasurementsModel::getDisplayString(Page& page, size_t pageRow, Column column) const
+{
+    //formatted once, the views ask for them on every paint
+    QString& str = page.displayStrings[pageRow * s_headerNames.size() + static_cast<size_t>(column)];
+    if (!str.isNull())
+        return str;
+
+    DB::Measurement const& measurement = page.measurements[pageRow];
+    if (column == Column::Sensor)
+    {
+        std::shared_ptr<const DB::Snapshot> snapshot = m_db.getSnapshot();
+        DB::Sensor const* sensor = snapshot->findSensorById(measurement.descriptor.sensorId);
+        if (sensor)
+            str = sensor->descriptor.name.c_str();
+        else
+            str = "N/A";
+    }
+    else if (column == Column::Timestamp)
+        str = utils::toString<IClock>(measurement.timePoint, m_db.getGeneralSettings().dateTimeFormat);
+    else if (column == Column::ReceivedTimestamp)
+        str = utils::toString<IClock>(measurement.receivedTimePoint, m_db.getGeneralSettings().dateTimeFormat);
+    else if (column == Column::Temperature)
+        str = QString("%1°C").arg(measurement.descriptor.temperature, 0, 'f', 1);
+    else if (column == Column::Humidity)
+        str = QString("%1 %RH").arg(measurement.descriptor.humidity, 0, 'f', 1);
+    else if (column == Column::Battery)
+        str = QString("%1%").arg(static_cast<int>(utils::getBatteryLevel(measurement.descriptor.vcc) * 100.f));
+    else if (column == Column::Signal)
+        str = QString("%1%").arg(static_cast<int>(utils::getSignalLevel(std::min(measurement.descriptor.signalStrength.s2b, measurement.descriptor.signalStrength.b2s)) * 100.f));
+    else
+        str = "";
+    return str;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+MeasurementsModel::Page* MeasurementsModel::findRowPage(size_t row, size_t& pageRow, bool wait) const
+{
+    if (row >= m_rowCount)
+        return nullptr;
+
+    size_t pageIndex = row / k_pageSize;
+    Page& page = m_pages[pageIndex];
+    pageRow = row % k_pageSize;
+    if (!page.isLoaded)
+    {
+        //the views read through the const data(), loading the pages doesn't change what the model shows
+        if (!wait)
+        {
+            const_cast<MeasurementsModel*>(this)->requestPage(pageIndex);
+            return nullptr;
+        }
+
+        //read again from its cursor, one seek and a page of rows for the indexed sorts
+        DB::MeasurementCursor cursor = page.cursor;
+        setPageMeasurements(pageIndex, m_db.getFilteredMeasurements(m_filter, cursor, page.rowCount));
+    }
+    page.lastUsed = ++m_pageUseCounter;
+
+    //some can be gone since the page was first fetched
+    if (pageRow >= page.measurements.size())
+        return nullptr;
+    return &page;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::evictPage() const
+{
+    //the least recently used one
+    auto it = std::min_element(m_loadedPages.begin(), m_loadedPages.end(), [this](size_t a, size_t b)
+    {
+        return m_pages[a].lastUsed < m_pages[b].lastUsed;
+    });
+    if (it == m_loadedPages.end())
+        return;
+
+    Page& page = m_pages[*it];
+    page.isLoaded = false;
+    page.measurements = std::vector<DB::Measurement>();
+    page.displayStrings = std::vector<QString>();
+    m_loadedPages.erase(it);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::setPageMeasurements(size_t pageIndex, std::vector<DB::Measurement> measurements) const
+{
+    if (m_loadedPages.size() >= k_maxLoadedPages)
+        evictPage();
+
+    Page& page = m_pages[pageIndex];
+    page.measurements = std::move(measurements);
+    page.displayStrings = std::vector<QString>(page.measurements.size() * s_headerNames.size());
+    page.isLoaded = true;
+    page.lastUsed = ++m_pageUseCounter;
+    m_loadedPages.push_back(pageIndex);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::requestPage(size_t pageIndex)
+{
+    if (std::find(m_pagesToLoad.begin(), m_pagesToLoad.end(), pageIndex) == m_pagesToLoad.end())
+        m_pagesToLoad.push_back(pageIndex);
+    loadNextPage();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::loadNextPage()
+{
+    //the worker runs one query at a time, the fetches go first
+    if (m_isLoadingPage || m_isFetching)
+        return;
+
+    while (!m_pagesToLoad.empty() && (m_pagesToLoad.front() >= m_pages.size() || m_pages[m_pagesToLoad.front()].isLoaded))
+        m_pagesToLoad.erase(m_pagesToLoad.begin());
+    if (m_pagesToLoad.empty())
+        return;
+
+    //it stays first until it's loaded, so a cancelled read is started again
+    size_t pageIndex = m_pagesToLoad.front();
+    m_isLoadingPage = true;
+
+    DB& db = m_db;
+    DB::Filter filter = m_filter;
+    DB::MeasurementCursor cursor = m_pages[pageIndex].cursor;
+    size_t rowCount = m_pages[pageIndex].rowCount;
+    uint64_t generation = m_generation;
+    uint64_t loadGeneration = m_pageLoadGeneration;
+    m_queryWorker.run<bool>([this, &db, filter, cursor, rowCount, generation, loadGeneration, pageIndex](DB::QueryToken const& token) mutable
+    {
+        std::vector<DB::Measurement> measurements = db.getFilteredMeasurements(filter, cursor, rowCount, &token);
+        if (token.isCancelled())
+            return false;
+        QMetaObject::invokeMethod(this, [this, generation, loadGeneration, pageIndex, measurements = std::move(measurements)]() mutable
+        {
+            if (generation != m_generation || loadGeneration != m_pageLoadGeneration)
+                return;
+            m_isLoadingPage = false;
+            if (!m_pages[pageIndex].isLoaded)
+            {
+                setPageMeasurements(pageIndex, std::move(measurements));
+
+                //the placeholders are shown again, now with the rows
+                int first = int(pageIndex * k_pageSize);
+                emit dataChanged(index(first, 0), index(first + int(m_pages[pageIndex].rowCount) - 1, columnCount() - 1));
+            }
+            loadNextPage();
+        }, Qt::QueuedConnection);
+        return true;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::checkMeasurementCount()
+{
+    //the total is cheap to get and changes with most of what the rows would. They are read again from their cursors when shown
+    size_t count = m_db.getAllMeasurementCount();
+    if (count == m_allMeasurementCount)
+        return;
+    m_allMeasurementCount = count;
+
+    while (!m_loadedPages.empty())
+        evictPage();
+    m_pageLoadGeneration++;
+    m_isLoadingPage = false;
+    m_pagesToLoad.clear();
+    if (m_rowCount > 0)
+        emit dataChanged(index(0, 0), index(int(m_rowCount) - 1, columnCount() - 1));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 Qt::ItemFlags MeasurementsModel::flags(QModelIndex const& /*index*/) const
 {
     return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
@@ -199,11 +368,7 @@ void MeasurementsModel::setFilter(DB::Filter const& filter)
 		break;
 	}
     m_filter.sortOrder = m_sortOrder;
-    //auto start = IClock::now();
-    //m_measurementsStartIndex = 0;
-    //m_measurementsTotalCount = m_db.getFilteredMeasurementCount(m_filter);
-    m_measurements = m_db.getFilteredMeasurements(m_filter);//, m_measurementsStartIndex, k_chunkSize);
-    //std::cout << "XXX: " << std::chrono::duration_cast<std::chrono::microseconds>(IClock::now() - start).count() << "\n";
+    fetchFirst();
     endResetModel();
 
     Q_EMIT layoutChanged();
@@ -221,9 +386,7 @@ DB::Filter const& MeasurementsModel::getFilter() const
 void MeasurementsModel::refresh()
 {
     beginResetModel();
-    //m_measurementsStartIndex = 0;
-    //m_measurementsTotalCount = m_db.getFilteredMeasurementCount(m_filter);
-    m_measurements = m_db.getFilteredMeasurements(m_filter);//, m_measurementsStartIndex, k_chunkSize);
+    fetchFirst();
     endResetModel();
 
     Q_EMIT layoutChanged();
@@ -254,17 +417,28 @@ void MeasurementsModel::refresh()
 
 size_t MeasurementsModel::getMeasurementCount() const
 {
-    return m_measurements.size();// m_measurementsTotalCount;
+    return m_measurementsTotalCount;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-DB::Measurement const& MeasurementsModel::getMeasurement(size_t index)
+DB::Measurement MeasurementsModel::getMeasurement(size_t index)
 {
-//     while (index >= m_measurements.size())
-//         fetchMore(QModelIndex());
+    //a fetch in progress sees the rows added here and drops its own when they arrive
+    while (index >= m_rowCount && m_canFetchMore)
+    {
+        Page page;
+        page.cursor = m_cursor;
+        DB::MeasurementCursor cursor = m_cursor;
+        page.measurements = m_db.getFilteredMeasurements(m_filter, cursor, k_pageSize);
+        appendPage(std::move(page), cursor);
+    }
 
-    return m_measurements[index];
+    size_t pageRow = 0;
+    Page* page = findRowPage(index, pageRow, true);
+    if (!page)
+        return DB::Measurement();
+    return page->measurements[pageRow];
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -274,18 +448,12 @@ Result<DB::Measurement> MeasurementsModel::getMeasurement(QModelIndex index) con
 	if (!index.isValid())
 		return Error("Invalid Index");
 
-	size_t indexRow = static_cast<size_t>(index.row());
-	if (indexRow >= m_measurements.size())
+	size_t pageRow = 0;
+	Page* page = findRowPage(static_cast<size_t>(index.row()), pageRow, true);
+	if (!page)
         return Error("Invalid Index");
 
-	return m_measurements[indexRow];
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-std::vector<DB::Measurement> MeasurementsModel::getAllMeasurements() const
-{
-	return m_db.getFilteredMeasurements(m_filter);
+	return page->measurements[pageRow];
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -347,23 +515,120 @@ void MeasurementsModel::sort(int column, Qt::SortOrder order)
 
 //////////////////////////////////////////////////////////////////////////
 
-// void MeasurementsModel::fetchMore(const QModelIndex& parent)
-// {
-// 	beginInsertRows(QModelIndex(), int(m_measurementsStartIndex), int(m_measurementsStartIndex) + k_chunkSize);
-// 
-//     m_measurementsStartIndex = m_measurements.size();
-//     std::vector<DB::Measurement> measurements = m_db.getFilteredMeasurements(m_filter, m_measurementsStartIndex, k_chunkSize);
-//     m_measurements.resize(m_measurementsStartIndex + measurements.size());
-//     std::move(measurements.begin(), measurements.end(), m_measurements.begin() + m_measurementsStartIndex);
-// 
-// 	endInsertRows();
-// }
+void MeasurementsModel::fetchFirst()
+{
+    //starts empty, the rows are inserted as they arrive. A query of the previous filter still running is cancelled
+    m_generation++;
+    m_cursor = DB::MeasurementCursor();
+    m_pages.clear();
+    m_loadedPages.clear();
+    m_pagesToLoad.clear();
+    m_isLoadingPage = false;
+    m_allMeasurementCount = m_db.getAllMeasurementCount();
+    m_rowCount = 0;
+    m_measurementsTotalCount = 0;
+    m_canFetchMore = false;
+    m_isFetching = true;
+    emit measurementCountChanged();
+
+    DB& db = m_db;
+    DB::Filter filter = m_filter;
+    uint64_t generation = m_generation;
+    m_queryWorker.run<bool>([this, &db, filter, generation](DB::QueryToken const& token)
+    {
+        //the first rows before the count, they are quicker to get
+        Page page;
+        DB::MeasurementCursor cursor;
+        page.measurements = db.getFilteredMeasurements(filter, cursor, k_pageSize, &token);
+        if (token.isCancelled())
+            return false;
+        QMetaObject::invokeMethod(this, [this, generation, cursor, page = std::move(page)]() mutable
+        {
+            if (generation == m_generation)
+                appendPage(std::move(page), cursor);
+        }, Qt::QueuedConnection);
+
+        size_t count = db.getFilteredMeasurementCount(filter, &token);
+        if (token.isCancelled())
+            return false;
+        QMetaObject::invokeMethod(this, [this, generation, count]
+        {
+            if (generation != m_generation)
+                return;
+            m_measurementsTotalCount = count;
+            m_isFetching = false;
+            emit measurementCountChanged();
+            loadNextPage();
+        }, Qt::QueuedConnection);
+        return true;
+    });
+}
 
 //////////////////////////////////////////////////////////////////////////
 
-// bool MeasurementsModel::canFetchMore(const QModelIndex& parent) const
-// {
-//     return m_measurements.size() < m_measurementsTotalCount;
-// }
+void MeasurementsModel::appendPage(Page page, DB::MeasurementCursor const& cursor)
+{
+    //resumes from the cursor, so fetching the last page costs the same as the first one
+    m_cursor = cursor;
+    page.rowCount = page.measurements.size();
+    m_canFetchMore = page.rowCount == k_pageSize;
+    if (page.rowCount == 0)
+        return;
+
+    int first = int(m_rowCount);
+	beginInsertRows(QModelIndex(), first, first + int(page.rowCount) - 1);
+    m_rowCount += page.rowCount;
+    std::vector<DB::Measurement> measurements = std::move(page.measurements);
+    m_pages.push_back(std::move(page));
+    setPageMeasurements(m_pages.size() - 1, std::move(measurements));
+	endInsertRows();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MeasurementsModel::fetchMore(const QModelIndex& /*parent*/)
+{
+    if (m_isFetching || !m_canFetchMore)
+        return;
+
+    //the page being read is cancelled by the fetch, and read again after it
+    if (m_isLoadingPage)
+    {
+        m_pageLoadGeneration++;
+        m_isLoadingPage = false;
+    }
+    m_isFetching = true;
+    DB& db = m_db;
+    DB::Filter filter = m_filter;
+    DB::MeasurementCursor cursor = m_cursor;
+    uint64_t generation = m_generation;
+    size_t rowCount = m_rowCount;
+    m_queryWorker.run<bool>([this, &db, filter, cursor, generation, rowCount](DB::QueryToken const& token) mutable
+    {
+        Page page;
+        page.cursor = cursor;
+        page.measurements = db.getFilteredMeasurements(filter, cursor, k_pageSize, &token);
+        if (token.isCancelled())
+            return false;
+        QMetaObject::invokeMethod(this, [this, generation, rowCount, cursor, page = std::move(page)]() mutable
+        {
+            if (generation != m_generation)
+                return;
+            m_isFetching = false;
+            //getMeasurement fetched these already
+            if (rowCount == m_rowCount)
+                appendPage(std::move(page), cursor);
+            loadNextPage();
+        }, Qt::QueuedConnection);
+        return true;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool MeasurementsModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && m_canFetchMore && !m_isFetching;
+}
 
 
@@ -8,11 +8,13 @@
 #include <QTimer>
 
 #include "DB.h"
+#include "QueryWorker.h"
 
 class MeasurementsWidget;
 
 class MeasurementsModel : public QAbstractItemModel
 {
+    Q_OBJECT
     friend class MeasurementsWidget;
 public:
 
@@ -24,9 +26,11 @@ public:
     void setFilter(DB::Filter const& filter);
     DB::Filter const& getFilter() const;
 
+    //The rows and the count are queried in the background after a filter change, the count after the first rows.
+    //Zero until it arrives.
     size_t getMeasurementCount() const;
-    DB::Measurement const& getMeasurement(size_t index);
-    std::vector<DB::Measurement> getAllMeasurements() const;
+    //Waits for the rows up to index if they are not fetched yet
+    DB::Measurement getMeasurement(size_t index);
 
     Result<DB::Measurement> getMeasurement(QModelIndex index) const;
 
@@ -44,6 +48,9 @@ public:
         Alarms
     };
 
+signals:
+    void measurementCountChanged();
+
 public slots:
     void refresh();
 
@@ -66,14 +73,15 @@ private:
     bool insertRows(int position, int rows, QModelIndex const& parent = QModelIndex()) override;
     bool removeRows(int position, int rows, QModelIndex const& parent = QModelIndex()) override;
     void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
-// 	void fetchMore(const QModelIndex& parent) override;
-// 	bool canFetchMore(const QModelIndex& parent) const override;
+	void fetchMore(const QModelIndex& parent) override;
+	bool canFetchMore(const QModelIndex& parent) const override;
 
 //	void startAutoRefresh(IClock::duration timer);
 
 private slots:
 // 	void startSlowAutoRefresh();
 // 	void startFastAutoRefresh();
+    void checkMeasurementCount();
 
 private:
 	std::vector<QMetaObject::Connection> m_connections;
@@ -81,8 +89,46 @@ private:
     DB::Filter m_filter;
     Column m_sortColumn = Column::Timestamp;
     DB::Filter::SortOrder m_sortOrder = DB::Filter::SortOrder::Descending;
-//    size_t m_measurementsStartIndex = 0;
-//    size_t m_measurementsTotalCount = 0;
-    std::vector<DB::Measurement> m_measurements;
+    size_t m_measurementsTotalCount = 0;
+
+    //The rows fetched so far, in pages. All of them keep the cursor they start from but only the most recently
+    //used ones keep their rows, the others are read again in the background when shown, and are empty until then.
+    //So the memory stays the same however far it's scrolled.
+    struct Page
+    {
+        DB::MeasurementCursor cursor; //the rows after this one
+        size_t rowCount = 0;
+        bool isLoaded = false;
+        std::vector<DB::Measurement> measurements;
+        std::vector<QString> displayStrings; //by row and column, formatted the first time they are shown
+        uint64_t lastUsed = 0;
+    };
+    mutable std::vector<Page> m_pages;
+    mutable std::vector<size_t> m_loadedPages;
+    mutable uint64_t m_pageUseCounter = 0;
+    size_t m_rowCount = 0;
+    //with wait the page is read before returning, otherwise it's null until the page arrives
+    Page* findRowPage(size_t row, size_t& pageRow, bool wait) const;
+    void evictPage() const;
+    void setPageMeasurements(size_t pageIndex, std::vector<DB::Measurement> measurements) const;
+
+    //one page read at a time, after the fetches. The ones shown meanwhile wait in order
+    std::vector<size_t> m_pagesToLoad;
+    bool m_isLoadingPage = false;
+    uint64_t m_pageLoadGeneration = 0; //the pages read before a fetch or a change of the measurements are dropped
+    void requestPage(size_t pageIndex);
+    void loadNextPage();
+    size_t m_allMeasurementCount = 0; //when it changes the loaded rows can be stale
+    QString const& getDisplayString(Page& page, size_t pageRow, Column column) const;
+
+    DB::MeasurementCursor m_cursor; //where the next page starts
+    bool m_canFetchMore = false;
+    bool m_isFetching = false;
+    uint64_t m_generation = 0; //of the filter, the results of older ones are dropped when they arrive
+    void fetchFirst();
+    void appendPage(Page page, DB::MeasurementCursor const& cursor);
 //    QTimer* m_refreshTimer = nullptr;
+
+    //last, so it's stopped before the rest of the model is destroyed
+    QueryWorker m_queryWorker;
 };
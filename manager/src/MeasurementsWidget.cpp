@@ -53,6 +53,7 @@ void MeasurementsWidget::init(DB& db)
 
     //connect(m_model.get(), &MeasurementsModel::rowsAboutToBeInserted, this, &MeasurementsWidget::refreshCounter);
     //connect(m_model.get(), &MeasurementsModel::modelReset, this, &MeasurementsWidget::refreshCounter);
+    m_uiConnections.push_back(connect(m_model.get(), &MeasurementsModel::measurementCountChanged, this, &MeasurementsWidget::refreshCounter));
     m_uiConnections.push_back(connect(m_db, &DB::measurementsAdded, this, &MeasurementsWidget::scheduleSlowRefresh));
     m_uiConnections.push_back(connect(m_db, &DB::measurementsChanged, this, &MeasurementsWidget::scheduleFastRefresh));
 
@@ -323,13 +324,10 @@ void MeasurementsWidget::refresh()
     m_ui.list->header()->setSectionHidden((int)MeasurementsModel::Column::Battery, !m_ui.showBattery->isChecked());
     m_ui.list->header()->setSectionHidden((int)MeasurementsModel::Column::Signal, !m_ui.showSignal->isChecked());
 
+    //the model queries in the background and updates the counter when done
     DB::Filter filter = createFilter();
     m_model->setFilter(filter);
 
-    refreshCounter();
-
-    m_ui.exportData->setEnabled(m_model->getMeasurementCount() > 0);
-
 	std::cout << (QString("Refreshed measurements: %3ms\n")
 				  .arg(std::chrono::duration_cast<std::chrono::milliseconds>(IClock::rtNow() - start).count())).toStdString();
 }
@@ -338,7 +336,8 @@ void MeasurementsWidget::refresh()
 
 void MeasurementsWidget::refreshCounter()
 {
-	m_ui.resultCount->setText(QString("%1 out of ~%2 results.").arg(m_model->getMeasurementCount()).arg(m_db->getAllMeasurementApproximativeCount()));
+	m_ui.resultCount->setText(QString("%1 out of %2 results.").arg(m_model->getMeasurementCount()).arg(m_db->getAllMeasurementCount()));
+    m_ui.exportData->setEnabled(m_model->getMeasurementCount() > 0);
 }
 
 //////////////////////////////////////////////////////////////////////////
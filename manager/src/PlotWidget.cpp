@@ -1,6 +1,7 @@
 #include "PlotWidget.h"
 #include <QSettings>
 #include <array>
+#include <algorithm>
 
 #include "ExportPicDialog.h"
 #include "ExportDataDialog.h"
@@ -35,6 +36,7 @@ std::array<float, (size_t)PlotWidget::PlotType::Count> k_plotPenWidths = { 2.f,
 std::array<Qt::PenStyle, (size_t)PlotWidget::PlotType::Count> k_plotPenStyles = { Qt::SolidLine, Qt::DashLine, Qt::DotLine, Qt::DashDotDotLine };
 std::array<const char*, (size_t)PlotWidget::PlotType::Count> k_plotNames = { "Temperature", "Humidity", "Battery", "Signal" };
 std::array<double, (size_t)PlotWidget::PlotType::Count> k_plotMinRange = { 5.0, 10.0, 0.1, 0.1 };
+constexpr size_t k_maxRawPlotCount = 500000;
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -68,6 +70,10 @@ void PlotWidget::init(DB& db)
 
 void PlotWidget::shutdown()
 {
+    //the plot of a query still running is not shown
+    m_queryWorker.cancel();
+    m_generation++;
+
     saveSettings();
 
     setEnabled(false);
@@ -525,119 +531,209 @@ void PlotWidget::createPlotWidgets()
 
 void PlotWidget::applyFilter(DB::Filter const& filter)
 {
-    if (!m_db || m_isApplyingFilter)
+    if (!m_db)
         return;
 
-    m_isApplyingFilter = true;
-    utils::epilogue epi([this] { m_isApplyingFilter = false; });
-
     m_filter = filter;
 
-    createPlotWidgets();
-
-    m_graphs.clear();
-    while (m_plot->graphCount() > 0)
-        m_plot->removeGraph(m_plot->graph(0));
-
-    for (QCPAbstractItem* item: m_indicatorItems)
-        m_plot->removeItem(item);
-
-    m_indicatorItems.clear();
-
-    uint64_t minTS = std::numeric_limits<uint64_t>::max();
-    uint64_t maxTS = std::numeric_limits<uint64_t>::lowest();
-
-    std::array<std::pair<double, double>, (size_t)PlotType::Count> plotMinMax;
-    for (size_t plotIndex = 0; plotIndex < plotMinMax.size(); plotIndex++)
-    {
-		plotMinMax[plotIndex].first = std::numeric_limits<double>::max();
-		plotMinMax[plotIndex].second = std::numeric_limits<double>::lowest();
-    }
-
-    size_t totalCount = m_db->getFilteredMeasurementCount(m_filter);
-
-    m_ui.resultCount->setText(QString("%1 out of ~%2 results.").arg(totalCount).arg(m_db->getAllMeasurementApproximativeCount()));
-    m_ui.exportData->setEnabled(totalCount > 0);
-
+    std::map<DB::SensorId, GraphData> graphs;
     for (size_t i = 0; i < m_db->getSensorCount(); i++)
     {
         DB::Sensor sensor = m_db->getSensor(i);
         if (m_selectedSensorIds.find(sensor.id) != m_selectedSensorIds.end())
         {
-            GraphData& graphData = m_graphs[sensor.id];
+            GraphData& graphData = graphs[sensor.id];
             graphData.sensor = sensor;
 			for (size_t plotIndex = 0; plotIndex < graphData.plots.size(); plotIndex++)
 			{
 				Plot& plot = graphData.plots[plotIndex];
 				plot.keys.reserve(8192);
 				plot.values.reserve(8192);
-                plot.alarmIndicators.clear();
 			}
-            graphData.lastIndex = -1;
         }
     }
 
-    size_t chunkSize = 50000;
+    //queried in the background and the previous graphs stay until it's done. A newer filter cancels it
+    m_generation++;
+    uint64_t generation = m_generation;
+    DB const* db = m_db;
+    bool useSmoothing = m_ui.useSmoothing->isChecked();
+    m_queryWorker.run<bool>([this, db, filter, graphs = std::move(graphs), useSmoothing, generation](DB::QueryToken const& token) mutable
+    {
+        std::optional<PlotData> data = queryPlotData(*db, filter, std::move(graphs), useSmoothing, generation, token);
+        if (!data.has_value())
+            return false;
 
-    QProgressDialog progressDialog(QProgressDialog("Plotting...", "Abort", 0, (int)(totalCount / chunkSize), this));
-	progressDialog.setWindowModality(Qt::WindowModal);
-	progressDialog.setMinimumDuration(200);
+        QMetaObject::invokeMethod(this, [this, generation, data = std::move(*data)]() mutable
+        {
+            if (generation == m_generation)
+                showPlotData(std::move(data));
+        }, Qt::QueuedConnection);
+        return true;
+    });
+}
 
-    for (size_t measurementsIndex = 0; measurementsIndex < totalCount; measurementsIndex += chunkSize)
-	{
-        std::vector<DB::Measurement> measurements = m_db->getFilteredMeasurements(filter, measurementsIndex, chunkSize);
-		std::sort(measurements.begin(), measurements.end(), [](DB::Measurement const& a, DB::Measurement const& b) { return a.timePoint < b.timePoint; });
+//////////////////////////////////////////////////////////////////////////
 
-        progressDialog.setValue(int(measurementsIndex / chunkSize));
-        if (progressDialog.wasCanceled())
-            break;
+std::optional<PlotWidget::PlotData> PlotWidget::queryPlotData(DB const& db, DB::Filter const& filter, std::map<DB::SensorId, GraphData> graphs, bool useSmoothing,
+                                                              uint64_t generation, DB::QueryToken const& token)
+{
+    PlotData data;
+    data.graphs = std::move(graphs);
 
-		for (DB::Measurement const& m : measurements)
-		{
-			time_t time = IClock::to_time_t(m.timePoint);
-			minTS = std::min(minTS, static_cast<uint64_t>(time));
-			maxTS = std::max(maxTS, static_cast<uint64_t>(time));
+    uint64_t& minTS = data.minTS;
+    uint64_t& maxTS = data.maxTS;
+    minTS = std::numeric_limits<uint64_t>::max();
+    maxTS = std::numeric_limits<uint64_t>::lowest();
+
+    auto& plotMinMax = data.plotMinMax;
+    for (size_t plotIndex = 0; plotIndex < plotMinMax.size(); plotIndex++)
+    {
+		plotMinMax[plotIndex].first = std::numeric_limits<double>::max();
+		plotMinMax[plotIndex].second = std::numeric_limits<double>::lowest();
+    }
 
-			auto it = m_graphs.find(m.descriptor.sensorId);
-			if (it == m_graphs.end())
-				continue;
+    size_t totalCount = db.getFilteredMeasurementCount(filter, &token);
+    if (token.isCancelled())
+        return std::nullopt;
+    data.totalCount = totalCount;
+    data.allCount = db.getAllMeasurementCount();
 
-            GraphData& graphData = it->second;
+    //the progress goes in the counter, replaced by the count when the graphs are shown
+    auto showProgress = [this, generation, totalCount](size_t visitedCount)
+    {
+        QMetaObject::invokeMethod(this, [this, generation, totalCount, visitedCount]
+        {
+            if (generation == m_generation)
+                m_ui.resultCount->setText(QString("Plotting %1 out of %2 results...").arg(visitedCount).arg(totalCount));
+        }, Qt::QueuedConnection);
+    };
+    showProgress(0);
 
-			bool gap = graphData.lastIndex >= 0 && graphData.lastIndex + 1 != m.descriptor.index;
-			graphData.lastIndex = m.descriptor.index;
+    size_t chunkSize = 50000;
 
-			for (size_t plotIndex = 0; plotIndex < graphData.plots.size(); plotIndex++)
+    DB::Filter chunkFilter = filter;
+    chunkFilter.sortBy = DB::Filter::SortBy::Timestamp;
+    chunkFilter.sortOrder = DB::Filter::SortOrder::Ascending;
+
+    auto plotMeasurement = [&](DB::Measurement const& m)
+	{
+		time_t time = IClock::to_time_t(m.timePoint);
+		minTS = std::min(minTS, static_cast<uint64_t>(time));
+		maxTS = std::max(maxTS, static_cast<uint64_t>(time));
+
+		auto it = data.graphs.find(m.descriptor.sensorId);
+		if (it == data.graphs.end())
+			return;
+
+        GraphData& graphData = it->second;
+
+		bool gap = graphData.lastIndex >= 0 && graphData.lastIndex + 1 != m.descriptor.index;
+		graphData.lastIndex = m.descriptor.index;
+
+		for (size_t plotIndex = 0; plotIndex < graphData.plots.size(); plotIndex++)
+		{
+			Plot& plot = graphData.plots[plotIndex];
+			uint32_t alarmTriggerMask = 0;
+			double value = 0;
+			switch ((PlotType)plotIndex)
 			{
-				Plot& plot = graphData.plots[plotIndex];
-				uint32_t alarmTriggerMask = 0;
-				double value = 0;
-				switch ((PlotType)plotIndex)
-				{
-				case PlotType::Temperature: value = m.descriptor.temperature; alarmTriggerMask = DB::AlarmTrigger::MeasurementTemperatureMask; break;
-				case PlotType::Humidity: value = m.descriptor.humidity; alarmTriggerMask = DB::AlarmTrigger::MeasurementHumidityMask; break;
-				case PlotType::Battery: value = utils::getBatteryLevel(m.descriptor.vcc) * 100.0; alarmTriggerMask = DB::AlarmTrigger::MeasurementLowVcc; break;
-				case PlotType::Signal: value = utils::getSignalLevel(std::min(m.descriptor.signalStrength.b2s, m.descriptor.signalStrength.s2b)) * 100.0; alarmTriggerMask = DB::AlarmTrigger::MeasurementLowSignal; break;
-				}
-				if (m_ui.useSmoothing->isChecked())
-				{
-					if (!plot.oldValue.has_value() || gap)
-						plot.oldValue = value;
-
-                    value = *plot.oldValue * 0.8 + value * 0.2;
+			case PlotType::Temperature: value = m.descriptor.temperature; alarmTriggerMask = DB::AlarmTrigger::MeasurementTemperatureMask; break;
+			case PlotType::Humidity: value = m.descriptor.humidity; alarmTriggerMask = DB::AlarmTrigger::MeasurementHumidityMask; break;
+			case PlotType::Battery: value = utils::getBatteryLevel(m.descriptor.vcc) * 100.0; alarmTriggerMask = DB::AlarmTrigger::MeasurementLowVcc; break;
+			case PlotType::Signal: value = utils::getSignalLevel(std::min(m.descriptor.signalStrength.b2s, m.descriptor.signalStrength.s2b)) * 100.0; alarmTriggerMask = DB::AlarmTrigger::MeasurementLowSignal; break;
+			}
+			if (useSmoothing)
+			{
+				if (!plot.oldValue.has_value() || gap)
 					plot.oldValue = value;
-				}
-				plot.keys.push_back(time);
-				plot.values.push_back(gap ? qQNaN() : value);
-				if ((m.alarmTriggers.added & alarmTriggerMask) || (m.alarmTriggers.removed & alarmTriggerMask))
-					plot.alarmIndicators.push_back({ double(time), value, m.alarmTriggers & alarmTriggerMask });
-
-                auto& minMax = plotMinMax[plotIndex];
-				minMax.first = std::min(minMax.first, value);
-				minMax.second = std::max(minMax.second, value);
+
+                value = *plot.oldValue * 0.8 + value * 0.2;
+				plot.oldValue = value;
 			}
+			plot.keys.push_back(time);
+			plot.values.push_back(gap ? qQNaN() : value);
+			if ((m.alarmTriggers.added & alarmTriggerMask) || (m.alarmTriggers.removed & alarmTriggerMask))
+				plot.alarmIndicators.push_back({ double(time), value, m.alarmTriggers & alarmTriggerMask });
+
+            auto& minMax = plotMinMax[plotIndex];
+			minMax.first = std::min(minMax.first, value);
+			minMax.second = std::max(minMax.second, value);
 		}
-	}
+	};
+
+    if (totalCount > k_maxRawPlotCount)
+    {
+        //too many to plot one by one, plot the hourly or daily means from the rollups instead
+        IClock::duration range = filter.timePointFilter.max - filter.timePointFilter.min;
+        IClock::duration bucket = filter.useTimePointFilter && range < std::chrono::hours(24 * 90) ? IClock::duration(std::chrono::hours(1)) : IClock::duration(std::chrono::hours(24));
+        int64_t bucketSeconds = std::chrono::duration_cast<std::chrono::seconds>(bucket).count();
+
+        std::vector<DB::MeasurementAggregate> aggregates = db.getMeasurementAggregates(chunkFilter, bucket, &token);
+        std::sort(aggregates.begin(), aggregates.end(), [](DB::MeasurementAggregate const& a, DB::MeasurementAggregate const& b)
+        {
+            return a.timePoint < b.timePoint;
+        });
+        for (DB::MeasurementAggregate const& aggregate: aggregates)
+        {
+            if (aggregate.count == 0)
+                continue;
+
+            //consecutive buckets get consecutive indices so the missing ones show as gaps
+            DB::Measurement m;
+            m.timePoint = aggregate.timePoint + bucket / 2;
+            m.descriptor.sensorId = aggregate.sensorId;
+            m.descriptor.index = uint32_t(IClock::to_time_t(aggregate.timePoint) / bucketSeconds);
+            m.descriptor.temperature = float(aggregate.temperatureSum / aggregate.count);
+            m.descriptor.humidity = float(aggregate.humiditySum / aggregate.count);
+            m.descriptor.vcc = float(aggregate.vccSum / aggregate.count);
+            m.descriptor.signalStrength.s2b = int16_t(aggregate.signalStrengthSum / int64_t(aggregate.count));
+            m.descriptor.signalStrength.b2s = m.descriptor.signalStrength.s2b;
+            plotMeasurement(m);
+        }
+    }
+    else
+    {
+        //only the columns plotted are read
+        uint32_t columns = DB::MeasurementColumn::TimePoint | DB::MeasurementColumn::Index | DB::MeasurementColumn::SensorId |
+                DB::MeasurementColumn::Temperature | DB::MeasurementColumn::Humidity | DB::MeasurementColumn::Vcc |
+                DB::MeasurementColumn::SignalStrength | DB::MeasurementColumn::AlarmTriggers;
+        size_t visitedCount = 0;
+        db.visitFilteredMeasurements(chunkFilter, columns, [&](DB::Measurement const& m)
+        {
+            if ((++visitedCount % chunkSize) == 0)
+                showProgress(visitedCount);
+            plotMeasurement(m);
+            return true;
+        }, &token);
+    }
+
+    if (token.isCancelled())
+        return std::nullopt;
+    return data;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void PlotWidget::showPlotData(PlotData data)
+{
+    createPlotWidgets();
+
+    while (m_plot->graphCount() > 0)
+        m_plot->removeGraph(m_plot->graph(0));
+
+    for (QCPAbstractItem* item: m_indicatorItems)
+        m_plot->removeItem(item);
+
+    m_indicatorItems.clear();
+
+    m_graphs = std::move(data.graphs);
+    uint64_t minTS = data.minTS;
+    uint64_t maxTS = data.maxTS;
+    auto& plotMinMax = data.plotMinMax;
+
+    m_ui.resultCount->setText(QString("%1 out of %2 results.").arg(data.totalCount).arg(data.allCount));
+    m_ui.exportData->setEnabled(data.totalCount > 0);
 
 	if (m_ui.fitHorizontally->isChecked())
     {
@@ -3,12 +3,14 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <optional>
 #include <QWidget>
 
 #include "qcustomplot.h"
 
 #include "PlotToolTip.h"
 #include "DB.h"
+#include "QueryWorker.h"
 #include "Butterworth.h"
 #include "ui_PlotWidget.h"
 
@@ -99,6 +101,21 @@ private:
         int64_t lastIndex = -1;
     };
 
+    //What the query of a filter collects, made into graphs on the UI thread
+    struct PlotData
+    {
+        std::map<DB::SensorId, GraphData> graphs;
+        uint64_t minTS = 0;
+        uint64_t maxTS = 0;
+        std::array<std::pair<double, double>, (size_t)PlotType::Count> plotMinMax;
+        size_t totalCount = 0;
+        size_t allCount = 0;
+    };
+    //runs on the query worker, only posts the progress to the widget. Empty if cancelled
+    std::optional<PlotData> queryPlotData(DB const& db, DB::Filter const& filter, std::map<DB::SensorId, GraphData> graphs, bool useSmoothing,
+                                          uint64_t generation, DB::QueryToken const& token);
+    void showPlotData(PlotData data);
+
     void createPlotWidgets();
 
     struct Annotation
@@ -136,7 +153,10 @@ private:
     std::vector<QMetaObject::Connection> m_uiConnections;
 
     int32_t m_draggedAnnotationIndex = -1;
-    bool m_isApplyingFilter = false;
+    uint64_t m_generation = 0; //of the filter, the results of older ones are dropped when they arrive
     //bool m_isDragging = false;
+
+    //last, so it's stopped before the rest of the widget is destroyed
+    QueryWorker m_queryWorker;
 };
 
@@ -0,0 +1,84 @@
+#include "QueryWorker.h"
+
+//////////////////////////////////////////////////////////////////////////
+
+QueryWorker::QueryWorker()
+{
+    m_thread = std::thread(&QueryWorker::threadProc, this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QueryWorker::~QueryWorker()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_exit = true;
+    }
+    cancel();
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void QueryWorker::cancel()
+{
+    std::unique_lock<std::mutex> lg(m_mutex);
+    if (m_pending.has_value())
+    {
+        m_pending->drop();
+        m_pending.reset();
+    }
+    if (m_runningToken)
+        m_runningToken->cancel();
+
+    //returns soon after the interrupt. Waited for so the query doesn't outlive what it reads
+    m_cv.wait(lg, [this] { return !m_runningToken; });
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void QueryWorker::post(Job job)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    if (m_exit)
+    {
+        job.drop();
+        return;
+    }
+
+    if (m_pending.has_value())
+        m_pending->drop();
+    if (m_runningToken)
+        m_runningToken->cancel();
+
+    m_pending = std::move(job);
+    m_cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void QueryWorker::threadProc()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lg(m_mutex);
+            m_cv.wait(lg, [this] { return m_exit || m_pending.has_value(); });
+            if (m_exit)
+                return;
+
+            job = std::move(*m_pending);
+            m_pending.reset();
+            m_runningToken = job.token;
+        }
+
+        job.run(*job.token);
+
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_runningToken.reset();
+        m_cv.notify_all();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include "DB.h"
+
+//Runs the queries of a view on a thread of its own, so the UI doesn't wait for them.
+//Only the latest query of a view matters: running a new one drops the one waiting to run and cancels the one in progress.
+//The dropped and cancelled queries resolve their futures with an empty value.
+class QueryWorker
+{
+public:
+    QueryWorker();
+    ~QueryWorker();
+
+    QueryWorker(QueryWorker const&) = delete;
+    QueryWorker& operator=(QueryWorker const&) = delete;
+
+    //The query gets the token to pass to the DB, and is called on the worker thread.
+    //Results meant for a QObject are posted to it from the query, the future is for the callers that can wait.
+    template<typename T>
+    std::future<std::optional<T>> run(std::function<T(DB::QueryToken const&)> query);
+
+    //drops the waiting query, cancels the one in progress and waits for it to return
+    void cancel();
+
+private:
+    struct Job
+    {
+        std::function<void(DB::QueryToken const&)> run;
+        std::function<void()> drop;
+        std::shared_ptr<DB::QueryToken> token;
+    };
+    void post(Job job);
+    void threadProc();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_exit = false;
+    std::optional<Job> m_pending;
+    std::shared_ptr<DB::QueryToken> m_runningToken;
+    std::thread m_thread;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+std::future<std::optional<T>> QueryWorker::run(std::function<T(DB::QueryToken const&)> query)
+{
+    //shared, the job's functions have to be copyable
+    std::shared_ptr<std::promise<std::optional<T>>> promise = std::make_shared<std::promise<std::optional<T>>>();
+    std::future<std::optional<T>> future = promise->get_future();
+
+    Job job;
+    job.token = std::make_shared<DB::QueryToken>();
+    job.run = [promise, query = std::move(query)](DB::QueryToken const& token)
+    {
+        T result = query(token);
+        if (token.isCancelled())
+            promise->set_value(std::nullopt);
+        else
+            promise->set_value(std::move(result));
+    };
+    job.drop = [promise]
+    {
+        promise->set_value(std::nullopt);
+    };
+    post(std::move(job));
+    return future;
+}
@@ -0,0 +1,184 @@
+#include "ReadConnectionPool.h"
+#include <QString>
+#include <algorithm>
+#include "Logger.h"
+#include "sqlite3.h"
+
+extern Logger s_logger;
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::~ReadConnectionPool()
+{
+    close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result<void> ReadConnectionPool::open(std::string const& filename, size_t maxConnections, std::function<Result<void>(sqlite3&)> setup,
+                                      std::function<void(sqlite3&)> prepare)
+{
+    close();
+
+    if (filename.empty())
+        return Error("Cannot open the read connections: the DB has no file");
+
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_filename = filename;
+    m_maxConnections = std::max<size_t>(maxConnections, 1);
+    m_setup = std::move(setup);
+    m_prepare = std::move(prepare);
+    m_isOpen = true;
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ReadConnectionPool::close()
+{
+    std::unique_lock<std::mutex> lg(m_mutex);
+    if (!m_isOpen)
+        return;
+
+    //new acquires fail from now on, the ones in use are waited for
+    m_isOpen = false;
+    m_cv.notify_all();
+    m_cv.wait(lg, [this] { return m_available.size() == m_connections.size(); });
+
+    for (sqlite3* sqlite: m_connections)
+        sqlite3_close(sqlite);
+    m_connections.clear();
+    m_available.clear();
+    m_setup = nullptr;
+    m_prepare = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::Snapshot ReadConnectionPool::acquire() const
+{
+    sqlite3* sqlite = nullptr;
+    {
+        std::unique_lock<std::mutex> lg(m_mutex);
+        m_cv.wait(lg, [this] { return !m_isOpen || !m_available.empty() || m_connections.size() < m_maxConnections; });
+        if (!m_isOpen)
+            return Snapshot();
+
+        if (!m_available.empty())
+        {
+            sqlite = m_available.back();
+            m_available.pop_back();
+        }
+        else
+        {
+            if (sqlite3_open_v2(m_filename.c_str(), &sqlite, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+            {
+                s_logger.logCritical(QString("Cannot open read connection: %1").arg(sqlite3_errmsg(sqlite)));
+                sqlite3_close(sqlite);
+                return Snapshot();
+            }
+            //with a rollback journal the readers still have to wait for the writer to commit
+            sqlite3_busy_timeout(sqlite, 10000);
+            if (m_setup)
+            {
+                Result<void> result = m_setup(*sqlite);
+                if (result != success)
+                {
+                    s_logger.logCritical(QString("Cannot set up read connection: %1").arg(result.error().what().c_str()));
+                    sqlite3_close(sqlite);
+                    return Snapshot();
+                }
+            }
+            m_connections.push_back(sqlite);
+        }
+    }
+
+    //the pool can't close while the connection is out, so m_prepare stays valid
+    if (m_prepare)
+        m_prepare(*sqlite);
+
+    if (sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        s_logger.logCritical(QString("Cannot begin read transaction: %1").arg(sqlite3_errmsg(sqlite)));
+        release(sqlite);
+        return Snapshot();
+    }
+    return Snapshot(*this, sqlite);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ReadConnectionPool::prepareAvailable() const
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    if (!m_isOpen || !m_prepare)
+        return;
+
+    for (sqlite3* sqlite: m_available)
+        m_prepare(*sqlite);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ReadConnectionPool::release(sqlite3* sqlite) const
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_available.push_back(sqlite);
+    }
+    m_cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::Snapshot::Snapshot(ReadConnectionPool const& pool, sqlite3* sqlite)
+    : m_pool(&pool)
+    , m_sqlite(sqlite)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::Snapshot::Snapshot(Snapshot&& other)
+    : m_pool(other.m_pool)
+    , m_sqlite(other.m_sqlite)
+{
+    other.m_pool = nullptr;
+    other.m_sqlite = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::Snapshot& ReadConnectionPool::Snapshot::operator=(Snapshot&& other)
+{
+    if (this != &other)
+    {
+        release();
+        m_pool = other.m_pool;
+        m_sqlite = other.m_sqlite;
+        other.m_pool = nullptr;
+        other.m_sqlite = nullptr;
+    }
+    return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ReadConnectionPool::Snapshot::~Snapshot()
+{
+    release();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ReadConnectionPool::Snapshot::release()
+{
+    if (!m_sqlite)
+        return;
+
+    //ends the read transaction, nothing was written so there is nothing to commit
+    sqlite3_exec(m_sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr);
+    m_pool->release(m_sqlite);
+    m_pool = nullptr;
+    m_sqlite = nullptr;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include "Result.h"
+
+struct sqlite3;
+
+//Read only connections to a database file, for the queries that would otherwise wait for (and block) the
+//connection used for writing. Works best with the database in WAL mode, where readers and the writer don't block each other.
+class ReadConnectionPool
+{
+public:
+    ReadConnectionPool() = default;
+    ~ReadConnectionPool();
+
+    ReadConnectionPool(ReadConnectionPool const&) = delete;
+    ReadConnectionPool& operator=(ReadConnectionPool const&) = delete;
+
+    //the connections are opened as needed, up to maxConnections. setup is called for each new connection,
+    //prepare every time a connection is acquired, before its read transaction starts
+    Result<void> open(std::string const& filename, size_t maxConnections, std::function<Result<void>(sqlite3&)> setup = nullptr,
+                      std::function<void(sqlite3&)> prepare = nullptr);
+    void close();
+
+    //A connection with a read transaction open, so all its queries see the same snapshot of the database.
+    //Keep it only for the duration of a query, while open it keeps the WAL from being checkpointed past it.
+    class Snapshot
+    {
+    public:
+        Snapshot() = default;
+        Snapshot(Snapshot&& other);
+        Snapshot& operator=(Snapshot&& other);
+        ~Snapshot();
+
+        Snapshot(Snapshot const&) = delete;
+        Snapshot& operator=(Snapshot const&) = delete;
+
+        sqlite3* get() const { return m_sqlite; }
+        explicit operator bool() const { return m_sqlite != nullptr; }
+
+    private:
+        friend class ReadConnectionPool;
+        Snapshot(ReadConnectionPool const& pool, sqlite3* sqlite);
+        void release();
+
+        ReadConnectionPool const* m_pool = nullptr;
+        sqlite3* m_sqlite = nullptr;
+    };
+
+    //waits if all the connections are in use. Returns an empty snapshot if the pool is closed or a connection cannot be opened
+    Snapshot acquire() const;
+
+    //calls prepare on the connections not in use now, the others get it when next acquired
+    void prepareAvailable() const;
+
+private:
+    void release(sqlite3* sqlite) const;
+
+    std::string m_filename;
+    bool m_isOpen = false;
+    size_t m_maxConnections = 0;
+    std::function<Result<void>(sqlite3&)> m_setup;
+    std::function<void(sqlite3&)> m_prepare;
+
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cv;
+    mutable std::vector<sqlite3*> m_connections; //all of them
+    mutable std::vector<sqlite3*> m_available;
+};
@@ -12,6 +12,7 @@
 
 constexpr QSize k_iconMargin(4, 2);
 constexpr QSize k_miniPlotSize(64, 32);
+static_assert(size_t(k_miniPlotSize.width()) <= DB::k_recentMeasurementCount, "The mini plots are drawn from the recent measurements kept in memory");
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -31,16 +32,10 @@ SensorsDelegate::~SensorsDelegate()
 
 void SensorsDelegate::refreshMiniPlot(QPixmap& temperature, QPixmap& humidity, DB& db, DB::Sensor const& sensor) const
 {
-	DB::Filter filter;
-	filter.useSensorFilter = true;
-	filter.sensorIds.insert(sensor.id);
-	filter.sortBy = DB::Filter::SortBy::Timestamp;
-	filter.sortOrder = DB::Filter::SortOrder::Descending;
-	std::vector<DB::Measurement> measurements = db.getFilteredMeasurements(filter, 0, size_t(k_miniPlotSize.width()));
+	//oldest first, from memory
+	std::vector<DB::Measurement> measurements = db.getRecentMeasurementsForSensor(sensor.id, size_t(k_miniPlotSize.width()));
 	if (!measurements.empty())
 	{
-		std::sort(measurements.begin(), measurements.end(), [](DB::Measurement const& a, DB::Measurement const& b) { return a.timePoint < b.timePoint; });
-
 		{
 			temperature = QPixmap(k_miniPlotSize);
 			temperature.fill(QColor(200, 200, 200, 100));
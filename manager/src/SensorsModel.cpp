@@ -248,8 +248,9 @@ QVariant SensorsModel::data(QModelIndex const& index, int role) const
         return QVariant();
 
     SensorData const& sensorData = m_sensors[indexRow];
-    std::optional<DB::Sensor> sensor = m_db.findSensorById(sensorData.sensorId);
-    if (!sensor.has_value())
+    std::shared_ptr<const DB::Snapshot> snapshot = m_db.getSnapshot();
+    DB::Sensor const* sensor = snapshot->findSensorById(sensorData.sensorId);
+    if (!sensor)
         return QVariant();
 
     Column column = static_cast<Column>(index.column());
@@ -104,7 +104,7 @@ std::pair<std::string, time_t> getMostRecentBackup(std::string const& filename,
     return bkFiles.front();
 }
 
-void copyToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups)
+bool copyToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups)
 {
     QString nowStr = QDateTime::currentDateTime().toString("yyyy-MM-dd-HH-mm-ss");
     std::string newFilepath = folder + "/" + nowStr.toUtf8().data() + filename + "_backup";
@@ -113,15 +113,16 @@ void copyToBackup(std::string const& filename, std::string const& srcFilepath, s
 
     if (!QFile::exists(srcFilepath.c_str()))
     {
-        return;
+        return false;
     }
 
     if (!QFile::copy(srcFilepath.c_str(), newFilepath.c_str()))
     {
-        return;
+        return false;
     }
 
     clipBackups(filename, folder, maxBackups);
+    return true;
 }
 
 void moveToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups)
@@ -347,9 +348,32 @@ std::string baseStationTriggersToString(uint32_t triggers)
 
 //////////////////////////////////////////////////////////////////////////
 
-bool exportCsvTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::CsvSettings const& csvSettings, CsvDataProvider provider, size_t count, bool unicode)
+uint32_t getCsvMeasurementColumns(DB::CsvSettings const& csvSettings)
+{
+	uint32_t columns = 0;
+	if (csvSettings.exportSensorName || csvSettings.exportSensorSN)
+		columns |= DB::MeasurementColumn::SensorId;
+	if (csvSettings.exportIndex)
+		columns |= DB::MeasurementColumn::Index;
+	if (csvSettings.exportTimePoint)
+		columns |= DB::MeasurementColumn::TimePoint;
+	if (csvSettings.exportReceivedTimePoint)
+		columns |= DB::MeasurementColumn::ReceivedTimePoint;
+	if (csvSettings.exportTemperature)
+		columns |= DB::MeasurementColumn::Temperature;
+	if (csvSettings.exportHumidity)
+		columns |= DB::MeasurementColumn::Humidity;
+	if (csvSettings.exportBattery)
+		columns |= DB::MeasurementColumn::Vcc;
+	if (csvSettings.exportSignal)
+		columns |= DB::MeasurementColumn::SignalStrength;
+	return columns;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void exportCsvHeaderTo(std::ostream& stream, DB::CsvSettings const& csvSettings)
 {
-	//header
 	if (csvSettings.exportId)
 	{
 		stream << "Id";
@@ -421,107 +445,119 @@ bool exportCsvTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::
 		}
 	}
 	stream << std::endl;
+}
 
-	for (size_t i = 0; i < count; i++)
+//////////////////////////////////////////////////////////////////////////
+
+void exportCsvRowTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::CsvSettings const& csvSettings, DB::Measurement const& m, DB::Sensor const& s, bool unicode)
+{
+	if (csvSettings.exportId)
 	{
-		std::optional<CsvData> data = provider(i);
-		if (!data.has_value())
-		{
-			return false;
-		}
-		DB::Measurement const& m = data->measurement;
-		DB::Sensor const& s = data->sensor;
-		if (csvSettings.exportId)
-		{
-			stream << m.id;
-			stream << csvSettings.separator;
-		}
-		if (csvSettings.exportSensorName)
+		stream << m.id;
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportSensorName)
+	{
+		stream << s.descriptor.name;
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportSensorSN)
+	{
+		stream << QString("%1").arg(s.serialNumber, 8, 16, QChar('0')).toUtf8().data();
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportIndex)
+	{
+		stream << m.descriptor.index;
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportTimePoint)
+	{
+		DB::DateTimeFormat dateTimeFormat = csvSettings.dateTimeFormatOverride.has_value() ? *csvSettings.dateTimeFormatOverride : settings.dateTimeFormat;
+		QString str = toString<IClock>(m.timePoint, dateTimeFormat);
+		stream << str.toUtf8().data();
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportReceivedTimePoint)
+	{
+		DB::DateTimeFormat dateTimeFormat = csvSettings.dateTimeFormatOverride.has_value() ? *csvSettings.dateTimeFormatOverride : settings.dateTimeFormat;
+		QString str = toString<IClock>(m.receivedTimePoint, dateTimeFormat);
+		stream << str.toUtf8().data();
+		stream << csvSettings.separator;
+	}
+	if (csvSettings.exportTemperature)
+	{
+		stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << m.descriptor.temperature;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
 		{
-			stream << s.descriptor.name;
-			stream << csvSettings.separator;
+			stream << (const char*)(unicode ? u8"C" : u8"\xB0""C");
 		}
-		if (csvSettings.exportSensorSN)
+		stream << csvSettings.separator;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
 		{
-			stream << QString("%1").arg(s.serialNumber, 8, 16, QChar('0')).toUtf8().data();
+			stream << (const char*)(unicode ? u8"C" : u8"\xB0""C");
 			stream << csvSettings.separator;
 		}
-		if (csvSettings.exportIndex)
+	}
+	if (csvSettings.exportHumidity)
+	{
+		stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << m.descriptor.humidity;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
 		{
-			stream << m.descriptor.index;
-			stream << csvSettings.separator;
+			stream << " %RH";
 		}
-		if (csvSettings.exportTimePoint)
+		stream << csvSettings.separator;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
 		{
-			DB::DateTimeFormat dateTimeFormat = csvSettings.dateTimeFormatOverride.has_value() ? *csvSettings.dateTimeFormatOverride : settings.dateTimeFormat;
-			QString str = toString<IClock>(m.timePoint, dateTimeFormat);
-			stream << str.toUtf8().data();
+			stream << "%RH";
 			stream << csvSettings.separator;
 		}
-		if (csvSettings.exportReceivedTimePoint)
+	}
+	if (csvSettings.exportBattery)
+	{
+		stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << utils::getBatteryLevel(m.descriptor.vcc) * 100.f;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
 		{
-			DB::DateTimeFormat dateTimeFormat = csvSettings.dateTimeFormatOverride.has_value() ? *csvSettings.dateTimeFormatOverride : settings.dateTimeFormat;
-			QString str = toString<IClock>(m.receivedTimePoint, dateTimeFormat);
-			stream << str.toUtf8().data();
-			stream << csvSettings.separator;
+			stream << "%";
 		}
-		if (csvSettings.exportTemperature)
+		stream << csvSettings.separator;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
 		{
-			stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << m.descriptor.temperature;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
-			{
-				stream << (const char*)(unicode ? u8"C" : u8"\xB0""C");
-			}
+			stream << "%";
 			stream << csvSettings.separator;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
-			{
-				stream << (const char*)(unicode ? u8"C" : u8"\xB0""C");
-				stream << csvSettings.separator;
-			}
 		}
-		if (csvSettings.exportHumidity)
+	}
+	if (csvSettings.exportSignal)
+	{
+		stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << utils::getSignalLevel(std::min(m.descriptor.signalStrength.s2b, m.descriptor.signalStrength.b2s)) * 100.f;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
 		{
-			stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << m.descriptor.humidity;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
-			{
-				stream << " %RH";
-			}
-			stream << csvSettings.separator;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
-			{
-				stream << "%RH";
-				stream << csvSettings.separator;
-			}
+			stream << "%";
 		}
-		if (csvSettings.exportBattery)
+		stream << csvSettings.separator;
+		if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
 		{
-			stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << utils::getBatteryLevel(m.descriptor.vcc) * 100.f;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
-			{
-				stream << "%";
-			}
+			stream << "%";
 			stream << csvSettings.separator;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
-			{
-				stream << "%";
-				stream << csvSettings.separator;
-			}
 		}
-		if (csvSettings.exportSignal)
+	}
+	stream << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool exportCsvTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::CsvSettings const& csvSettings, CsvDataProvider provider, size_t count, bool unicode)
+{
+	exportCsvHeaderTo(stream, csvSettings);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		std::optional<CsvData> data = provider(i);
+		if (!data.has_value())
 		{
-			stream << std::fixed << std::setprecision(csvSettings.decimalPlaces) << utils::getSignalLevel(std::min(m.descriptor.signalStrength.s2b, m.descriptor.signalStrength.b2s)) * 100.f;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::Embedded)
-			{
-				stream << "%";
-			}
-			stream << csvSettings.separator;
-			if (csvSettings.unitsFormat == DB::CsvSettings::UnitsFormat::SeparateColumn)
-			{
-				stream << "%";
-				stream << csvSettings.separator;
-			}
+			return false;
 		}
-		stream << std::endl;
+		exportCsvRowTo(stream, settings, csvSettings, data->measurement, data->sensor, unicode);
 	}
 
 	return true;
@@ -10,7 +10,7 @@ namespace utils
 {
 
 std::pair<std::string, time_t> getMostRecentBackup(std::string const& filename, std::string const& folder);
-void copyToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups);
+bool copyToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups);
 void moveToBackup(std::string const& filename, std::string const& srcFilepath, std::string const& folder, size_t maxBackups);
 bool renameFile(std::string const& oldFilepath, std::string const& newFilepath);
 std::string getLastErrorAsString();
@@ -40,6 +40,11 @@ struct CsvData
 using CsvDataProvider = std::function<std::optional<CsvData>(size_t index)>;
 bool exportCsvTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::CsvSettings const& csvSettings, CsvDataProvider provider, size_t count, bool unicode);
 
+//For streaming the rows: the measurement columns the settings export, the header and one row at a time
+uint32_t getCsvMeasurementColumns(DB::CsvSettings const& csvSettings);
+void exportCsvHeaderTo(std::ostream& stream, DB::CsvSettings const& csvSettings);
+void exportCsvRowTo(std::ostream& stream, DB::GeneralSettings const& settings, DB::CsvSettings const& csvSettings, DB::Measurement const& m, DB::Sensor const& s, bool unicode);
+
 
 static constexpr float k_maxBatteryLevel = 2.95f;
 static constexpr float k_minBatteryLevel = 2.0f;
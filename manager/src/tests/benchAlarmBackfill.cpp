@@ -0,0 +1,84 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the re-evaluation of the alarm triggers of the stored measurements after the alarms changed,
+//with the older half of them compressed like on a long running install
+void benchAlarmBackfill()
+{
+    std::cout << "Benchmarking alarm backfill\n";
+
+    const size_t sensorCount = 100;
+    const uint32_t measurementCount = 5000; //per sensor
+    const size_t alarmCount = 20;
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+    createDBWithSensors(db, sensorCount, clock->now());
+    //like the manager does
+    CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+    clock->advance(std::chrono::hours(24 * 30));
+
+    for (size_t a = 0; a < alarmCount; a++)
+    {
+        DB::AlarmDescriptor alarm;
+        alarm.name = "alarm " + std::to_string(a);
+        alarm.highTemperatureWatch = true;
+        alarm.highTemperatureSoft = 20.f + float(a) * 0.5f;
+        alarm.highTemperatureHard = 100.f;
+        alarm.lowVccWatch = a % 2 == 0;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+    }
+    db.process();
+
+    for (size_t i = 0; i < sensorCount; i++)
+    {
+        DB::SensorId sensorId = db.getSensor(i).id;
+        std::vector<DB::MeasurementDescriptor> mds(measurementCount);
+        for (uint32_t index = 0; index < measurementCount; index++)
+        {
+            mds[index].sensorId = sensorId;
+            mds[index].index = index;
+            mds[index].temperature = 15.f + float((index + sensorId * 7) % 2000) * 0.01f; //rises across the alarm levels, and drops back once
+            mds[index].humidity = 50.f;
+            mds[index].vcc = 3.f;
+        }
+        CHECK_TRUE(db.addSingleSensorMeasurements(sensorId, mds));
+    }
+    db.process();
+    DB::ColdStorageSettings settings;
+    settings.compressAfter = std::chrono::hours(24 * 20);
+    db.setColdStorageSettings(settings);
+    do //it's done in budgeted batches
+    {
+        db.process();
+    } while (db.computeTimeUntilNextEvent() == IClock::duration::zero());
+
+    //every threshold moved up
+    for (size_t a = 0; a < alarmCount; a++)
+    {
+        DB::AlarmDescriptor alarm = db.getAlarm(a).descriptor;
+        alarm.highTemperatureSoft += 1.f;
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(a).id, alarm));
+    }
+    db.process();
+
+    size_t transactions = 0;
+    DB::Range<IClock::time_point> range = { IClock::time_point(IClock::duration::zero()), clock->now() };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Result<size_t> result = db.backfillAlarmTriggers(range, [&transactions](size_t, size_t) { transactions++; });
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK_TRUE(result == success);
+    CHECK_EQUALS(result.payload(), sensorCount * measurementCount);
+
+    double rate = double(result.payload()) / duration;
+    std::cout << "\t" << sensorCount << " sensors x " << measurementCount << " measurements, " << alarmCount << " alarms: "
+              << duration * 1000.0 << " ms in " << transactions << " transactions (" << rate << " measurements/s, "
+              << 100e6 / rate / 3600.0 << " h for 100M)\n";
+
+    closeDB(db);
+}
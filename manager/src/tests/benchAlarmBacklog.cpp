@@ -0,0 +1,78 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the processing of the alarm triggers of the measurement backlogs many sensors send after a base station outage.
+//The sensors lost their oldest measurements, so the ones they send can't be evaluated when added and are left to process
+void benchAlarmBacklog()
+{
+    std::cout << "Benchmarking alarm backlog\n";
+
+    const size_t sensorCount = 200;
+    const uint32_t backlog = 2000; //measurements per sensor
+    const uint32_t lost = 12;
+    const size_t alarmCount = 20;
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+    createDBWithSensors(db, sensorCount, clock->now());
+    //like the manager does
+    CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+    clock->advance(std::chrono::hours(24 * 30));
+
+    for (size_t a = 0; a < alarmCount; a++)
+    {
+        DB::AlarmDescriptor alarm;
+        alarm.name = "alarm " + std::to_string(a);
+        alarm.highTemperatureWatch = true;
+        alarm.highTemperatureSoft = 20.f + float(a) * 0.5f;
+        alarm.highTemperatureHard = 100.f;
+        alarm.lowVccWatch = a % 2 == 0;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+    }
+    db.process();
+
+    auto makeMeasurements = [](DB::SensorId sensorId, uint32_t first, uint32_t count)
+    {
+        std::vector<DB::MeasurementDescriptor> mds(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t index = first + i;
+            mds[i].sensorId = sensorId;
+            mds[i].index = index;
+            mds[i].temperature = 15.f + float((index + sensorId * 7) % 2000) * 0.01f; //rises across the alarm levels, and drops back once
+            mds[i].humidity = 50.f;
+            mds[i].vcc = 3.f;
+        }
+        return mds;
+    };
+
+    for (size_t i = 0; i < sensorCount; i++)
+    {
+        DB::SensorInputDetails details;
+        details.id = db.getSensor(i).id;
+        details.hasStoredData = true;
+        details.firstStoredMeasurementIndex = lost + 1;
+        details.storedMeasurementCount = backlog;
+        CHECK_TRUE(db.setSensorInputDetails(details));
+        CHECK_TRUE(db.addSingleSensorMeasurements(details.id, makeMeasurements(details.id, lost + 1, backlog)));
+    }
+    db.flushMeasurements();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    db.process();
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < sensorCount; i++)
+        CHECK_EQUALS(db.getSensor(i).lastAlarmProcessesMeasurementIndex, lost + backlog);
+
+    double measurements = double(sensorCount * backlog);
+    std::cout << "\t" << sensorCount << " sensors x " << backlog << " measurements, " << alarmCount << " alarms: "
+              << duration * 1000.0 << " ms (" << measurements / duration << " measurements/s)\n";
+
+    closeDB(db);
+}
@@ -0,0 +1,177 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <random>
+#include "DB.h"
+#include "AlarmEvaluator.h"
+#include "Utils.h"
+#include "testUtils.h"
+
+//The per measurement and per alarm evaluation the batch one replaced, without the logging
+static uint32_t evaluateScalar(DB::AlarmDescriptor const& ad, DB::SensorSettings const& settings, DB::Sensor const& sensor,
+                               std::map<DB::SensorId, uint32_t>& triggersPerSensor, DB::MeasurementDescriptor const& md, DB::AlarmTriggers& triggers)
+{
+    uint32_t currentTriggers = 0;
+    bool sensorWatched = !ad.filterSensors || ad.sensors.find(sensor.id) != ad.sensors.end();
+
+    uint32_t oldTriggers = 0;
+    auto it = triggersPerSensor.find(sensor.id);
+    if (it != triggersPerSensor.end())
+        oldTriggers = it->second;
+
+    if (sensorWatched)
+    {
+        if (ad.highTemperatureWatch && md.temperature >= ad.highTemperatureSoft)
+            currentTriggers |= DB::AlarmTrigger::MeasurementHighTemperatureSoft;
+        if (ad.highTemperatureWatch && md.temperature >= ad.highTemperatureHard)
+            currentTriggers |= DB::AlarmTrigger::MeasurementHighTemperatureHard;
+        if (ad.lowTemperatureWatch && md.temperature <= ad.lowTemperatureSoft)
+            currentTriggers |= DB::AlarmTrigger::MeasurementLowTemperatureSoft;
+        if (ad.lowTemperatureWatch && md.temperature <= ad.lowTemperatureHard)
+            currentTriggers |= DB::AlarmTrigger::MeasurementLowTemperatureHard;
+        if (ad.highHumidityWatch && md.humidity >= ad.highHumiditySoft)
+            currentTriggers |= DB::AlarmTrigger::MeasurementHighHumiditySoft;
+        if (ad.highHumidityWatch && md.humidity >= ad.highHumidityHard)
+            currentTriggers |= DB::AlarmTrigger::MeasurementHighHumidityHard;
+        if (ad.lowHumidityWatch && md.humidity <= ad.lowHumiditySoft)
+            currentTriggers |= DB::AlarmTrigger::MeasurementLowHumiditySoft;
+        if (ad.lowHumidityWatch && md.humidity <= ad.lowHumidityHard)
+            currentTriggers |= DB::AlarmTrigger::MeasurementLowHumidityHard;
+        if (ad.lowVccWatch)
+        {
+            float histeresis = ((oldTriggers & DB::AlarmTrigger::MeasurementLowVcc) ? 0.4f : -0.4f) / 100.f;
+            if (utils::getBatteryLevel(md.vcc) <= settings.alertBatteryLevel + histeresis)
+                currentTriggers |= DB::AlarmTrigger::MeasurementLowVcc;
+        }
+        if (ad.lowSignalWatch)
+        {
+            float histeresis = ((oldTriggers & DB::AlarmTrigger::MeasurementLowSignal) ? 0.4f : -0.4f) / 100.f;
+            if (utils::getSignalLevel(std::min(md.signalStrength.b2s, md.signalStrength.s2b)) <= settings.alertSignalStrengthLevel + histeresis)
+                currentTriggers |= DB::AlarmTrigger::MeasurementLowSignal;
+        }
+    }
+
+    if (currentTriggers != oldTriggers)
+    {
+        if (currentTriggers == 0)
+            triggersPerSensor.erase(sensor.id);
+        else
+            triggersPerSensor[sensor.id] = currentTriggers;
+    }
+
+    uint32_t diff = oldTriggers ^ currentTriggers;
+    triggers.current = currentTriggers;
+    triggers.added = diff & currentTriggers;
+    triggers.removed = diff & oldTriggers;
+    return currentTriggers;
+}
+
+//Evaluates 1M measurements of a sensor against 200 alarms, one at a time like before and a block at a time
+void benchAlarmEvaluation()
+{
+    std::cout << "Benchmarking alarm evaluation\n";
+
+    const size_t measurementCount = 1000000;
+    const size_t alarmCount = 200;
+    const size_t blockSize = 256; //like the db
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    DB::Sensor sensor;
+    sensor.id = 3;
+    DB::SensorSettings settings;
+
+    std::vector<DB::AlarmDescriptor> descriptors(alarmCount);
+    for (DB::AlarmDescriptor& ad: descriptors)
+    {
+        ad.lowTemperatureWatch = unit(rng) < 0.5f;
+        ad.lowTemperatureSoft = 5.f + unit(rng) * 10.f;
+        ad.lowTemperatureHard = ad.lowTemperatureSoft - 5.f;
+        ad.highTemperatureWatch = unit(rng) < 0.5f;
+        ad.highTemperatureSoft = 20.f + unit(rng) * 10.f;
+        ad.highTemperatureHard = ad.highTemperatureSoft + 5.f;
+        ad.lowHumidityWatch = unit(rng) < 0.5f;
+        ad.lowHumiditySoft = 20.f + unit(rng) * 20.f;
+        ad.lowHumidityHard = ad.lowHumiditySoft - 10.f;
+        ad.highHumidityWatch = unit(rng) < 0.5f;
+        ad.highHumiditySoft = 60.f + unit(rng) * 20.f;
+        ad.highHumidityHard = ad.highHumiditySoft + 10.f;
+        ad.lowVccWatch = unit(rng) < 0.5f;
+        ad.lowSignalWatch = unit(rng) < 0.5f;
+        ad.filterSensors = unit(rng) < 0.2f;
+        for (DB::SensorId id = 0; id < 50; id++)
+            if (unit(rng) < 0.5f)
+                ad.sensors.insert(id);
+    }
+
+    //slow random walks, so the triggers change now and then, and the vcc and signal hover around their alert levels
+    std::vector<DB::MeasurementDescriptor> mds(measurementCount);
+    float temperature = 20.f, humidity = 50.f, vcc = 2.4f, signal = -90.f;
+    for (DB::MeasurementDescriptor& md: mds)
+    {
+        temperature = std::min(std::max(temperature + (unit(rng) - 0.5f), -10.f), 40.f);
+        humidity = std::min(std::max(humidity + (unit(rng) - 0.5f) * 2.f, 0.f), 100.f);
+        vcc = std::min(std::max(vcc + (unit(rng) - 0.5f) * 0.01f, 2.f), 3.f);
+        signal = std::min(std::max(signal + (unit(rng) - 0.5f) * 2.f, -110.f), -40.f);
+        md.sensorId = sensor.id;
+        md.temperature = temperature;
+        md.humidity = humidity;
+        md.vcc = vcc;
+        md.signalStrength = { int16_t(signal), int16_t(signal) };
+    }
+
+    //the sums of all the triggers, cheap enough not to hide the evaluation
+    auto hash = [](uint64_t h, DB::AlarmTriggers const& t)
+    {
+        return h + (uint64_t(t.current) | (uint64_t(t.added) << 12) | (uint64_t(t.removed) << 24));
+    };
+
+    uint64_t scalarHash = 0;
+    std::vector<std::map<DB::SensorId, uint32_t>> triggersPerSensor(alarmCount);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (DB::MeasurementDescriptor const& md: mds)
+    {
+        for (size_t a = 0; a < alarmCount; a++)
+        {
+            DB::AlarmTriggers triggers;
+            evaluateScalar(descriptors[a], settings, sensor, triggersPerSensor[a], md, triggers);
+            scalarHash = hash(scalarHash, triggers);
+        }
+    }
+    double scalarDuration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t batchHash = 0;
+    start = std::chrono::steady_clock::now();
+    std::vector<alarms::Plan> plans;
+    for (DB::AlarmDescriptor const& ad: descriptors)
+        plans.push_back(alarms::compile(ad, settings, sensor));
+    std::vector<uint32_t> states(alarmCount, 0);
+    alarms::MeasurementBlock block;
+    std::vector<DB::AlarmTriggers> triggers;
+    for (size_t b = 0; b < measurementCount; b += blockSize)
+    {
+        size_t count = std::min(blockSize, measurementCount - b);
+        block.clear();
+        for (size_t i = 0; i < count; i++)
+            block.add(mds[b + i]);
+        triggers.resize(count * alarmCount);
+        for (size_t a = 0; a < alarmCount; a++)
+            states[a] = alarms::evaluate(plans[a], block, states[a], triggers.data() + a * count);
+        for (DB::AlarmTriggers const& t: triggers)
+            batchHash = hash(batchHash, t);
+    }
+    double batchDuration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK_EQUALS(batchHash, scalarHash);
+    for (size_t a = 0; a < alarmCount; a++)
+    {
+        auto it = triggersPerSensor[a].find(sensor.id);
+        CHECK_EQUALS(states[a], it != triggersPerSensor[a].end() ? it->second : 0u);
+    }
+
+    double evaluations = double(measurementCount * alarmCount);
+    std::cout << "\t" << measurementCount << " measurements x " << alarmCount << " alarms: one at a time " << scalarDuration * 1000.0 << " ms ("
+              << evaluations / scalarDuration / 1e6 << " M/s), a block at a time " << batchDuration * 1000.0 << " ms ("
+              << evaluations / batchDuration / 1e6 << " M/s)\n";
+}
@@ -0,0 +1,102 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the time from a sensor packet reaching the db to its alarm being emailed, with the main thread processing
+//like the manager does. The email is queued when the sensor triggers change, so this waits for the new triggers
+void benchAlarmLatency()
+{
+    std::cout << "Benchmarking alarm latency\n";
+
+    const size_t sensorCount = 20;
+    const size_t rounds = 10;
+    const uint32_t measurementsPerBatch = 12;
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+    createDBWithSensors(db, sensorCount, clock->now());
+    //like the manager does
+    CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+    clock->advance(std::chrono::hours(24 * 30));
+
+    DB::AlarmDescriptor alarm;
+    alarm.name = "high temperature";
+    alarm.highTemperatureWatch = true;
+    alarm.highTemperatureSoft = 25.f;
+    alarm.highTemperatureHard = 100.f;
+    CHECK_SUCCESS(db.addAlarm(alarm));
+    db.process();
+
+    std::vector<DB::SensorId> sensorIds;
+    for (size_t i = 0; i < sensorCount; i++)
+        sensorIds.push_back(db.getSensor(i).id);
+
+    std::atomic_bool done = { false };
+    std::vector<std::chrono::steady_clock::duration> latencies;
+    std::thread comms([&]
+    {
+        for (size_t r = 0; r < rounds; r++)
+        {
+            //every packet flips the alarm of its sensor
+            bool high = r % 2 == 0;
+            for (DB::SensorId sensorId: sensorIds)
+            {
+                std::vector<DB::MeasurementDescriptor> mds(measurementsPerBatch);
+                for (uint32_t i = 0; i < measurementsPerBatch; i++)
+                {
+                    mds[i].sensorId = sensorId;
+                    mds[i].index = uint32_t(r) * measurementsPerBatch + i + 1;
+                    mds[i].temperature = high ? 30.f : 20.f;
+                    mds[i].humidity = 50.f;
+                    mds[i].vcc = 3.f;
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                CHECK_TRUE(db.addSingleSensorMeasurements(sensorId, std::move(mds)));
+                while ((db.getAlarm(0).triggersPerSensor.count(sensorId) > 0) != high)
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                latencies.push_back(std::chrono::steady_clock::now() - start);
+            }
+        }
+        done = true;
+    });
+    //like the manager, sleep until the next deadline or until the ingest thread asks for processing
+    std::mutex wakeMutex;
+    std::condition_variable wakeCV;
+    bool wake = false;
+    QObject::connect(&db, &DB::processRequested, &db, [&]
+    {
+        std::lock_guard<std::mutex> lg(wakeMutex);
+        wake = true;
+        wakeCV.notify_one();
+    }, Qt::DirectConnection);
+    while (!done)
+    {
+        db.process();
+        IClock::duration wait = db.computeTimeUntilNextEvent();
+        std::unique_lock<std::mutex> lg(wakeMutex);
+        //the cap only bounds how late the loop notices that the comms thread is done
+        wakeCV.wait_for(lg, std::min<IClock::duration>(wait, std::chrono::seconds(1)), [&] { return wake || done; });
+        wake = false;
+    }
+    comms.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::chrono::steady_clock::duration total = std::chrono::steady_clock::duration::zero();
+    for (std::chrono::steady_clock::duration d: latencies)
+        total += d;
+    std::cout << "\t" << latencies.size() << " alarms: "
+              << std::chrono::duration<double, std::milli>(total).count() / double(latencies.size()) << " ms average, "
+              << std::chrono::duration<double, std::milli>(latencies[latencies.size() * 99 / 100]).count() << " ms p99, "
+              << std::chrono::duration<double, std::milli>(latencies.back()).count() << " ms max\n";
+
+    closeDB(db);
+}
@@ -0,0 +1,53 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <ctime>
+#include "DB.h"
+#include "testUtils.h"
+
+//Measures how much CPU DB::process() burns while nothing happens, driving it the way the Manager does:
+//sleep until the next DB deadline (at most 100ms) then process
+void benchIdleProcess()
+{
+    std::cout << "Benchmarking idle processing\n";
+    for (size_t sensorCount: { 100, 1000, 10000 })
+    {
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, sensorCount, clock->now());
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "blackout";
+        alarm.sensorBlackoutWatch = true;
+        alarm.baseStationDisconnectedWatch = true;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+
+        DB::ReportDescriptor report;
+        report.name = "report";
+        report.period = DB::ReportDescriptor::Period::Custom;
+        report.customPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addReport(report));
+
+        //the first round after loading evaluates everything
+        db.process();
+
+        const size_t seconds = 60;
+        size_t wakeups = 0;
+        IClock::time_point end = clock->now() + std::chrono::seconds(seconds);
+        std::clock_t start = std::clock();
+        while (clock->now() < end)
+        {
+            IClock::duration wait = std::min<IClock::duration>(db.computeTimeUntilNextEvent(), end - clock->now());
+            clock->advance(std::max<IClock::duration>(wait, std::chrono::milliseconds(1)));
+            db.process();
+            wakeups++;
+        }
+        double cpuMs = double(std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+        std::cout << "\t" << sensorCount << " sensors: " << cpuMs / seconds << " ms CPU per idle second, "
+                  << double(wakeups) / seconds << " wakeups per second\n";
+
+        closeDB(db);
+    }
+}
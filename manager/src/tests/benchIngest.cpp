@@ -0,0 +1,83 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the measurement ingest throughput with the comms thread adding sensor batches while the main thread processes,
+//and how long the comms thread is blocked per batch
+void benchIngest()
+{
+    std::cout << "Benchmarking ingest\n";
+
+    const size_t sensorCount = 1000;
+    const size_t rounds = 20;
+    const uint32_t measurementsPerBatch = 12;
+
+    for (size_t maxBatchSize: { 1, 1000, 10000 })
+    {
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, sensorCount, clock->now());
+        //like the manager does
+        CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+        clock->advance(std::chrono::hours(24 * 30));
+        db.process();
+
+        DB::IngestSettings settings;
+        settings.maxBatchSize = maxBatchSize;
+        db.setIngestSettings(settings);
+
+        std::vector<DB::SensorId> sensorIds;
+        for (size_t i = 0; i < sensorCount; i++)
+            sensorIds.push_back(db.getSensor(i).id);
+
+        std::atomic_bool done = { false };
+        std::chrono::steady_clock::duration maxCallDuration = std::chrono::steady_clock::duration::zero();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::thread comms([&]
+        {
+            for (size_t r = 0; r < rounds; r++)
+            {
+                for (DB::SensorId sensorId: sensorIds)
+                {
+                    std::vector<DB::MeasurementDescriptor> mds(measurementsPerBatch);
+                    for (uint32_t i = 0; i < measurementsPerBatch; i++)
+                    {
+                        mds[i].sensorId = sensorId;
+                        mds[i].index = uint32_t(r) * measurementsPerBatch + i + 1;
+                        mds[i].temperature = 20.f;
+                        mds[i].humidity = 50.f;
+                        mds[i].vcc = 3.f;
+                    }
+                    std::chrono::steady_clock::time_point callStart = std::chrono::steady_clock::now();
+                    CHECK_TRUE(db.addSingleSensorMeasurements(sensorId, std::move(mds)));
+                    maxCallDuration = std::max(maxCallDuration, std::chrono::steady_clock::now() - callStart);
+                }
+            }
+            done = true;
+        });
+        while (!done)
+        {
+            db.process();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        comms.join();
+        std::chrono::steady_clock::duration commsDuration = std::chrono::steady_clock::now() - start;
+        db.flushMeasurements();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const size_t rows = sensorCount * rounds * measurementsPerBatch;
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), rows);
+
+        std::cout << "\tmax batch size " << maxBatchSize << ": " << size_t(rows / seconds) << " rows/s, "
+                  << std::chrono::duration<double, std::micro>(commsDuration).count() / (sensorCount * rounds) << " us per sensor batch, "
+                  << std::chrono::duration<double, std::micro>(maxCallDuration).count() << " us max\n";
+
+        closeDB(db);
+    }
+}
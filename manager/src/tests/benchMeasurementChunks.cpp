@@ -0,0 +1,153 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <cmath>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the size of the measurements and the time to scan them, as rows and compressed in chunks
+void benchMeasurementChunks()
+{
+    std::cout << "Benchmarking measurement chunks\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 50;
+    const size_t measurementsPerSensor = 20000; //about 70 days, every 5 minutes
+    createDBWithSensors(db, sensorCount, clock->now());
+    IClock::time_point start = clock->now();
+
+    //values like the sensors send: slow changes on the resolution of their ADCs, the signal strength jittering a bit
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, 0, ?10, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            int64_t timePoint = IClock::to_time_t(start) + int64_t(i) * 300;
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                double phase = double(i) * 0.01 + double(s);
+                float temperature = std::round(float(20.0 + 5.0 * std::sin(phase)) * 16.f) / 16.f;
+                float humidity = std::round(float(50.0 + 10.0 * std::cos(phase * 0.7)) * 8.f) / 8.f;
+                float vcc = std::round(float(3.0 - double(i) * 0.00001) * 256.f) / 256.f;
+                sqlite3_bind_int64(stmt, 1, timePoint);
+                sqlite3_bind_int64(stmt, 2, timePoint + int64_t(i % 12) * 300); //received in batches, once an hour
+                sqlite3_bind_int64(stmt, 3, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 4, int64_t(s + 1));
+                sqlite3_bind_double(stmt, 5, temperature);
+                sqlite3_bind_double(stmt, 6, humidity);
+                sqlite3_bind_double(stmt, 7, vcc);
+                sqlite3_bind_int(stmt, 8, -60 - int((i * 7 + s) % 5));
+                sqlite3_bind_int(stmt, 9, -62 - int((i * 3 + s) % 4));
+                sqlite3_bind_int(stmt, 10, temperature > 24.5f ? 1 : 0);
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+    const size_t total = sensorCount * measurementsPerSensor;
+
+    auto getFileSize = [sqlite]()
+    {
+        CHECK_EQUALS(sqlite3_exec(sqlite, "VACUUM;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+        int64_t size = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+        return size;
+    };
+
+    //all of them, then a week of a sensor
+    DB::Filter weekFilter;
+    weekFilter.useSensorFilter = true;
+    weekFilter.sensorIds.insert(DB::SensorId(sensorCount / 2));
+    weekFilter.useTimePointFilter = true;
+    weekFilter.timePointFilter.min = start + std::chrono::hours(24 * 30);
+    weekFilter.timePointFilter.max = weekFilter.timePointFilter.min + std::chrono::hours(24 * 7) - std::chrono::seconds(1);
+    auto scan = [&](const char* name, std::vector<DB::Measurement>& all, std::vector<DB::Measurement>& week)
+    {
+        //the raw scan, without the sort and the copies
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        {
+            sqlite3_stmt* stmt;
+            std::string sql = std::string("SELECT COUNT(*), SUM(temperature) FROM ") + (std::string(name) == "rows" ? "Measurements" : "ChunkedMeasurements") + ";";
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            CHECK_EQUALS(size_t(sqlite3_column_int64(stmt, 0)), total);
+            sqlite3_finalize(stmt);
+        }
+        double scanDuration = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+
+        t = std::chrono::steady_clock::now();
+        all = db.getFilteredMeasurements(DB::Filter());
+        double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+        CHECK_EQUALS(all.size(), total);
+
+        const size_t weekCount = 20;
+        t = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < weekCount; i++)
+            week = db.getFilteredMeasurements(weekFilter);
+        double weekDuration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count() / double(weekCount);
+        CHECK_EQUALS(week.size(), size_t(7 * 24 * 12));
+
+        std::cout << "\t" << name << ": scan " << double(total) / scanDuration / 1000000.0 << " M rows/s, all " << duration << " s (" << double(total) / duration / 1000000.0 << " M rows/s), a week of a sensor " << weekDuration << " ms\n";
+    };
+
+    int64_t rowsSize = getFileSize();
+    std::vector<DB::Measurement> rowsAll;
+    std::vector<DB::Measurement> rowsWeek;
+    scan("rows", rowsAll, rowsWeek);
+
+    {
+        DB::ColdStorageSettings settings;
+        settings.compressAfter = std::chrono::hours(24);
+        db.setColdStorageSettings(settings);
+        clock->advance(std::chrono::hours(24 * 80));
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        //in budgeted batches, until nothing is left for now
+        do
+        {
+            db.process();
+        } while (db.computeTimeUntilNextEvent() == IClock::duration::zero());
+        std::cout << "\tcompressed " << total << " measurements in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count() << " s\n";
+    }
+
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT COUNT(*), SUM(count), SUM(LENGTH(data)) FROM MeasurementChunks;", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+        CHECK_EQUALS(size_t(sqlite3_column_int64(stmt, 1)), total);
+        std::cout << "\t" << sqlite3_column_int64(stmt, 0) << " chunks, " << double(sqlite3_column_int64(stmt, 2)) / double(total) << " bytes per measurement in the chunks\n";
+        sqlite3_finalize(stmt);
+    }
+
+    int64_t chunksSize = getFileSize();
+    std::cout << "\tfile size: rows " << rowsSize / 1024 << " KB, chunks " << chunksSize / 1024 << " KB, ratio " << double(rowsSize) / double(chunksSize) << "\n";
+
+    std::vector<DB::Measurement> chunksAll;
+    std::vector<DB::Measurement> chunksWeek;
+    scan("chunks", chunksAll, chunksWeek);
+
+    //same measurements, bit for bit
+    auto byId = [](DB::Measurement const& a, DB::Measurement const& b) { return a.id < b.id; };
+    std::sort(rowsAll.begin(), rowsAll.end(), byId);
+    std::sort(chunksAll.begin(), chunksAll.end(), byId);
+    for (size_t i = 0; i < total; i++)
+    {
+        CHECK_EQUALS(chunksAll[i].id, rowsAll[i].id);
+        CHECK_EQUALS(chunksAll[i].descriptor.temperature, rowsAll[i].descriptor.temperature);
+        CHECK_EQUALS(chunksAll[i].descriptor.humidity, rowsAll[i].descriptor.humidity);
+        CHECK_TRUE(chunksAll[i].receivedTimePoint == rowsAll[i].receivedTimePoint);
+    }
+
+    closeDB(db);
+}
@@ -0,0 +1,96 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures fetching a whole table in plot sized chunks, skipping with OFFSET against resuming from a cursor
+void benchPagination()
+{
+    std::cout << "Benchmarking pagination\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 200;
+    const size_t measurementsPerSensor = 50000;
+    const size_t measurementCount = sensorCount * measurementsPerSensor;
+    const size_t chunkSize = 50000;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?1, ?2, ?3, 20, 50, 3, -60, -60, 0, 0, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                sqlite3_bind_int64(stmt, 1, IClock::to_time_t(clock->now()) + int64_t(i) * 60);
+                sqlite3_bind_int64(stmt, 2, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 3, int64_t(s + 1));
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+
+    //how the plot asks for them
+    DB::Filter filter;
+    filter.sortBy = DB::Filter::SortBy::Timestamp;
+    filter.sortOrder = DB::Filter::SortOrder::Ascending;
+
+    auto report = [](const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::duration slowestChunk)
+    {
+        std::cout << "\t" << name << ": " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s total, "
+                  << std::chrono::duration<double, std::milli>(slowestChunk).count() << " ms slowest chunk\n";
+    };
+
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration slowestChunk = std::chrono::steady_clock::duration::zero();
+        size_t fetched = 0;
+        for (size_t index = 0; index < measurementCount; index += chunkSize)
+        {
+            std::chrono::steady_clock::time_point chunkStart = std::chrono::steady_clock::now();
+            fetched += db.getFilteredMeasurements(filter, index, chunkSize).size();
+            slowestChunk = std::max(slowestChunk, std::chrono::steady_clock::now() - chunkStart);
+        }
+        CHECK_EQUALS(fetched, measurementCount);
+        report("offset", start, slowestChunk);
+    }
+    auto fetchWithCursor = [&db, chunkSize, &report](const char* name, DB::Filter const& filter, size_t expectedCount)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration slowestChunk = std::chrono::steady_clock::duration::zero();
+        size_t fetched = 0;
+        DB::MeasurementCursor cursor;
+        while (true)
+        {
+            std::chrono::steady_clock::time_point chunkStart = std::chrono::steady_clock::now();
+            size_t count = db.getFilteredMeasurements(filter, cursor, chunkSize).size();
+            slowestChunk = std::max(slowestChunk, std::chrono::steady_clock::now() - chunkStart);
+            fetched += count;
+            if (count < chunkSize)
+                break;
+        }
+        CHECK_EQUALS(fetched, expectedCount);
+        report(name, start, slowestChunk);
+    };
+    fetchWithCursor("cursor", filter, measurementCount);
+
+    //most of the sensors selected, this should still walk the timePoint index
+    DB::Filter sensorFilter = filter;
+    sensorFilter.useSensorFilter = true;
+    for (size_t i = 0; i < sensorCount * 3 / 4; i++)
+        sensorFilter.sensorIds.insert(db.getSensor(i).id);
+    fetchWithCursor("cursor, 3/4 of the sensors", sensorFilter, measurementCount * 3 / 4);
+
+    closeDB(db);
+}
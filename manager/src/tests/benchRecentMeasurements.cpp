@@ -0,0 +1,95 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the sensor list repaints: the mini plot and alarm column reads, from the db against the in memory rings
+void benchRecentMeasurements()
+{
+    std::cout << "Benchmarking recent measurements\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 1000;
+    const size_t measurementsPerSensor = 1000;
+    const size_t repaints = 10;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?1, ?2, ?3, 20, 50, 3, -60, -60, 0, 0, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                sqlite3_bind_int64(stmt, 1, IClock::to_time_t(clock->now()) + int64_t(i) * 60);
+                sqlite3_bind_int64(stmt, 2, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 3, int64_t(s + 1));
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+
+    std::vector<DB::SensorId> sensorIds;
+    for (size_t i = 0; i < sensorCount; i++)
+        sensorIds.push_back(db.getSensor(i).id);
+
+    auto report = [sensorCount](const char* name, std::chrono::steady_clock::time_point start, size_t repaints)
+    {
+        std::cout << "\t" << name << ": " << std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (sensorCount * repaints)
+                  << " us per sensor row\n";
+    };
+
+    {
+        //how the mini plot used to read them
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repaints; r++)
+        {
+            for (DB::SensorId sensorId: sensorIds)
+            {
+                DB::Filter filter;
+                filter.useSensorFilter = true;
+                filter.sensorIds.insert(sensorId);
+                filter.sortBy = DB::Filter::SortBy::Timestamp;
+                filter.sortOrder = DB::Filter::SortOrder::Descending;
+                CHECK_EQUALS(db.getFilteredMeasurements(filter, 0, 64).size(), 64u);
+            }
+        }
+        report("mini plot from the db", start, repaints);
+    }
+    auto repaint = [&db, &sensorIds]
+    {
+        for (DB::SensorId sensorId: sensorIds)
+        {
+            CHECK_EQUALS(db.getRecentMeasurementsForSensor(sensorId, 64).size(), 64u);
+            CHECK_TRUE(db.getMostRecentMeasurementForSensor(sensorId) == success);
+        }
+    };
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        repaint();
+        report("mini plot and most recent, loading the rings", start, 1);
+    }
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t r = 1; r < repaints; r++)
+            repaint();
+        report("mini plot and most recent from the rings", start, repaints - 1);
+    }
+
+    DB::RecentMeasurementsStats stats = db.getRecentMeasurementsStats();
+    std::cout << "\t" << stats.sensorCount << " rings, " << stats.memoryUsage / 1024 << " KB, hit rate "
+              << double(stats.hits) * 100.0 / double(stats.hits + stats.misses) << "%\n";
+
+    closeDB(db);
+}
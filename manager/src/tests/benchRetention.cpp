@@ -0,0 +1,100 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Ingests a day at a time for months with a retention policy, and measures the size of the files and the longest process call
+void benchRetention()
+{
+    std::cout << "Benchmarking retention\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 50;
+    const size_t days = 150;
+    const uint32_t measurementsPerDay = 144; //every 10 minutes
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    DB::SensorTimeConfigDescriptor config;
+    config.measurementPeriod = std::chrono::minutes(10);
+    config.commsPeriod = std::chrono::minutes(10);
+    CHECK_SUCCESS(db.addSensorTimeConfig(config));
+    uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+
+    //only the retention changes the size
+    DB::ColdStorageSettings coldSettings;
+    coldSettings.enabled = false;
+    db.setColdStorageSettings(coldSettings);
+
+    std::vector<DB::RetentionPolicy> policies(1);
+    policies[0].name = "all";
+    policies[0].keepRaw = std::chrono::hours(24 * 30);
+    policies[0].downsampling = DB::RetentionPolicy::Downsampling::Decimate;
+    policies[0].decimationPeriod = std::chrono::hours(1);
+    policies[0].keepDownsampled = std::chrono::hours(24 * 90);
+    CHECK_SUCCESS(db.setRetentionPolicies(policies));
+
+    sqlite3* sqlite = db.getSqliteDB();
+    auto getFileSize = [sqlite]()
+    {
+        std::vector<std::string> schemas;
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT name FROM pragma_database_list WHERE name != 'temp';", -1, &stmt, nullptr), SQLITE_OK);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            schemas.push_back((char const*)sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        int64_t size = 0;
+        for (std::string const& schema: schemas)
+        {
+            std::string sql = "SELECT page_count * page_size FROM pragma_page_count('" + schema + "'), pragma_page_size('" + schema + "');";
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            size += sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+        }
+        return size;
+    };
+
+    double longestProcess = 0;
+    double totalProcess = 0;
+    for (size_t day = 0; day < days; day++)
+    {
+        clock->advance(std::chrono::hours(24));
+        for (size_t s = 0; s < sensorCount; s++)
+        {
+            std::vector<DB::MeasurementDescriptor> mds;
+            for (uint32_t i = 0; i < measurementsPerDay; i++)
+            {
+                DB::MeasurementDescriptor md;
+                md.sensorId = db.getSensor(s).id;
+                md.index = firstIndex + uint32_t(day) * measurementsPerDay + i;
+                md.temperature = 20.f + float(i % 10);
+                md.humidity = 50.f;
+                md.vcc = 3.f;
+                mds.push_back(md);
+            }
+            CHECK_TRUE(db.addMeasurements(mds));
+        }
+        db.flushMeasurements();
+
+        do
+        {
+            std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+            db.process();
+            double duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+            longestProcess = std::max(longestProcess, duration);
+            totalProcess += duration;
+        } while (db.computeTimeUntilNextEvent() == IClock::duration::zero());
+
+        if ((day + 1) % 15 == 0)
+            std::cout << "\tday " << day + 1 << ": " << db.getFilteredMeasurementCount(DB::Filter()) << " measurements, " << getFileSize() / 1024 << " KB\n";
+    }
+    std::cout << "\tprocess: " << totalProcess / double(days) << " ms per day, the longest call " << longestProcess << " ms\n";
+
+    closeDB(db);
+}
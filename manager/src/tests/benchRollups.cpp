@@ -0,0 +1,132 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the report summary and the result count over a month, scanning the measurements against reading the rollups
+void benchRollups()
+{
+    std::cout << "Benchmarking rollups\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 200;
+    const size_t measurementsPerSensor = 30 * 24 * 12; //a month, every 5 minutes
+    createDBWithSensors(db, sensorCount, clock->now());
+    IClock::time_point start = clock->now();
+
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?1, ?2, ?3, ?4, 50, 3, -60, -60, 0, 0, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                sqlite3_bind_int64(stmt, 1, IClock::to_time_t(start) + int64_t(i) * 300);
+                sqlite3_bind_int64(stmt, 2, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 3, int64_t(s + 1));
+                sqlite3_bind_double(stmt, 4, 20.0 + double(i % 100) / 10.0);
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+    clock->advance(std::chrono::hours(24 * 31));
+
+    //the rows were inserted behind the db's back, have them backfilled like an old database
+    CHECK_EQUALS(sqlite3_exec(sqlite, "DROP TABLE MeasurementRollupsHourly; DROP TABLE MeasurementRollupsDaily;", nullptr, nullptr, nullptr), SQLITE_OK);
+    closeDB(db);
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        loadDB(db);
+        std::cout << "\tload: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count() << " ms\n";
+
+        //process backfills a slice at a time, until the marker is gone
+        sqlite = db.getSqliteDB();
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT COUNT(*) FROM MeasurementRollupsBackfill;", -1, &stmt, nullptr), SQLITE_OK);
+        size_t calls = 0;
+        while (true)
+        {
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            bool left = sqlite3_column_int64(stmt, 0) > 0;
+            sqlite3_reset(stmt);
+            if (!left)
+                break;
+            db.process();
+            calls++;
+        }
+        sqlite3_finalize(stmt);
+        std::cout << "\tbackfill of " << sensorCount * measurementsPerSensor << " rows: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count() << " s in " << calls << " process calls\n";
+    }
+
+    //a report over most of the month, not on bucket boundaries
+    DB::Filter filter;
+    filter.useTimePointFilter = true;
+    filter.timePointFilter.min = start + std::chrono::hours(13) + std::chrono::minutes(20);
+    filter.timePointFilter.max = start + std::chrono::hours(24 * 28) + std::chrono::minutes(50);
+
+    auto report = [](const char* name, std::chrono::steady_clock::time_point start)
+    {
+        std::cout << "\t" << name << ": " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+    };
+
+    size_t expectedCount = 0;
+    std::string where = "WHERE timePoint >= " + std::to_string(IClock::to_time_t(filter.timePointFilter.min)) +
+                        " AND timePoint <= " + std::to_string(IClock::to_time_t(filter.timePointFilter.max));
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, ("SELECT COUNT(*) FROM Measurements " + where + ";").c_str(), -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+        expectedCount = size_t(sqlite3_column_int64(stmt, 0));
+        sqlite3_finalize(stmt);
+        report("count, scanning", t);
+    }
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), expectedCount);
+        report("count, rollups", t);
+    }
+
+    float expectedMax = 0;
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, ("SELECT sensorId, MIN(temperature), MAX(temperature), MIN(humidity), MAX(humidity), COUNT(*) FROM Measurements " + where +
+                                                 " GROUP BY sensorId;").c_str(), -1, &stmt, nullptr), SQLITE_OK);
+        size_t rows = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            expectedMax = std::max(expectedMax, float(sqlite3_column_double(stmt, 2)));
+            rows++;
+        }
+        sqlite3_finalize(stmt);
+        CHECK_EQUALS(rows, sensorCount);
+        report("report summary, scanning", t);
+    }
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        std::vector<DB::MeasurementAggregate> aggregates = db.getMeasurementAggregates(filter, IClock::duration::zero());
+        CHECK_EQUALS(aggregates.size(), sensorCount);
+        CHECK_EQUALS(aggregates.front().temperature.max, expectedMax);
+        report("report summary, rollups", t);
+    }
+    {
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        std::vector<DB::MeasurementAggregate> aggregates = db.getMeasurementAggregates(filter, std::chrono::hours(1));
+        CHECK_TRUE(aggregates.size() >= sensorCount * 27 * 24);
+        report("hourly plot, rollups", t);
+    }
+
+    closeDB(db);
+}
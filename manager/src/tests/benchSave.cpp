@@ -0,0 +1,42 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <ctime>
+#include "DB.h"
+#include "testUtils.h"
+
+//Measures what a single sensor comms costs to persist, as the fleet grows
+void benchSave()
+{
+    std::cout << "Benchmarking save\n";
+    for (size_t sensorCount: { 100, 1000, 10000 })
+    {
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, sensorCount, clock->now());
+        db.process();
+
+        std::vector<DB::SensorId> sensorIds;
+        for (size_t i = 0; i < sensorCount; i++)
+            sensorIds.push_back(db.getSensor(i).id);
+
+        const size_t comms = 1000;
+        std::clock_t start = std::clock();
+        for (size_t i = 0; i < comms; i++)
+        {
+            clock->advance(std::chrono::seconds(1));
+
+            DB::SensorInputDetails details;
+            details.id = sensorIds[i % sensorCount];
+            details.hasLastCommsTimePoint = true;
+            details.lastCommsTimePoint = clock->now();
+            CHECK_TRUE(db.setSensorInputDetails(details));
+            db.process();
+        }
+        double us = double(std::clock() - start) * 1000000.0 / CLOCKS_PER_SEC / comms;
+        std::cout << "\t" << sensorCount << " sensors: " << us << " us per sensor comms\n";
+
+        closeDB(db);
+    }
+}
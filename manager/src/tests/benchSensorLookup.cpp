@@ -0,0 +1,76 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <algorithm>
+#include "DB.h"
+#include "testUtils.h"
+
+//Measures the sensor lookups by key with many sensors, the indexes against a linear search of the snapshot
+void benchSensorLookup()
+{
+    std::cout << "Benchmarking sensor lookups\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 10000;
+    const size_t lookupCount = 1000000;
+    const size_t linearLookupCount = 10000; //the linear search is too slow for all the lookups
+    createDBWithSensors(db, sensorCount, clock->now());
+    CHECK_SUCCESS(db.checkIndexes());
+
+    std::shared_ptr<const DB::Snapshot> snapshot = db.getSnapshot();
+    std::vector<DB::Sensor> sensors;
+    for (std::shared_ptr<const DB::Sensor> const& sensor: snapshot->sensors)
+        sensors.push_back(*sensor);
+
+    auto run = [&](const char* name, size_t count, std::function<DB::Sensor const*(DB::Sensor const&)> const& lookup)
+    {
+        size_t found = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++)
+        {
+            DB::Sensor const& sensor = sensors[(i * 7919) % sensorCount];
+            DB::Sensor const* result = lookup(sensor);
+            found += (result && result->id == sensor.id) ? 1 : 0;
+        }
+        double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        CHECK_EQUALS(found, count);
+        std::cout << "\t" << name << ": " << duration * 1000000000.0 / double(count) << " ns per lookup\n";
+    };
+
+    run("by id, linear", linearLookupCount, [&snapshot](DB::Sensor const& sensor)
+    {
+        auto it = std::find_if(snapshot->sensors.begin(), snapshot->sensors.end(), [&sensor](std::shared_ptr<const DB::Sensor> const& s) { return s->id == sensor.id; });
+        return it != snapshot->sensors.end() ? it->get() : nullptr;
+    });
+    run("by id", lookupCount, [&snapshot](DB::Sensor const& sensor)
+    {
+        return snapshot->findSensorById(sensor.id);
+    });
+    run("by address", lookupCount, [&snapshot](DB::Sensor const& sensor)
+    {
+        return snapshot->findSensorByAddress(sensor.address);
+    });
+    run("by serial number", lookupCount, [&snapshot](DB::Sensor const& sensor)
+    {
+        int32_t index = snapshot->indexes->sensorsBySerialNumber.find(sensor.serialNumber);
+        return index >= 0 ? snapshot->sensors[size_t(index)].get() : nullptr;
+    });
+    run("by name", lookupCount, [&snapshot](DB::Sensor const& sensor)
+    {
+        int32_t index = snapshot->indexes->sensorsByName.find(sensor.descriptor.name);
+        return index >= 0 ? snapshot->sensors[size_t(index)].get() : nullptr;
+    });
+
+    //through the db, which gets the snapshot for every lookup
+    run("by address, db", lookupCount, [&db, &snapshot](DB::Sensor const& sensor)
+    {
+        int32_t index = db.findSensorIndexByAddress(sensor.address);
+        return index >= 0 ? snapshot->sensors[size_t(index)].get() : nullptr;
+    });
+
+    closeDB(db);
+}
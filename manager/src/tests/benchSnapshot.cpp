@@ -0,0 +1,99 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include "DB.h"
+#include "testUtils.h"
+
+//Measures the sensor lookups done by the comms and the GUI while the sensors are being updated,
+//copying the sensor out of the db against reading it in the published snapshot
+void benchSnapshot()
+{
+    std::cout << "Benchmarking snapshots\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 200;
+    const size_t readerCount = 3;
+    const size_t lookupsPerReader = 200000;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    std::vector<DB::SensorAddress> addresses;
+    for (size_t i = 0; i < sensorCount; i++)
+        addresses.push_back(db.getSensor(i).address);
+
+    auto run = [&](const char* name, std::function<bool(size_t, DB::SensorAddress)> const& lookup)
+    {
+        std::atomic_bool done = { false };
+        size_t writes = 0;
+        std::thread writer([&]
+        {
+            //what the comms do after each sensor request, a lot more often than they would
+            while (!done)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                DB::SensorInputDetails details;
+                details.id = DB::SensorId(writes % sensorCount + 1);
+                details.hasStatsDelta = true;
+                details.statsDelta.commsRounds = 1;
+                db.setSensorInputDetails(details);
+                writes++;
+            }
+        });
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> readers;
+        std::atomic<size_t> found = { 0 };
+        for (size_t r = 0; r < readerCount; r++)
+        {
+            readers.emplace_back([&, r]
+            {
+                size_t count = 0;
+                for (size_t i = 0; i < lookupsPerReader; i++)
+                {
+                    size_t index = (i * 7 + r) % sensorCount;
+                    count += lookup(index, addresses[index]) ? 1 : 0;
+                }
+                found += count;
+            });
+        }
+        for (std::thread& t: readers)
+            t.join();
+        double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        done = true;
+        writer.join();
+
+        CHECK_EQUALS(found.load(), readerCount * lookupsPerReader);
+        std::cout << "\t" << name << ": " << duration * 1000000000.0 / double(readerCount * lookupsPerReader) << " ns per lookup, "
+                  << double(writes) / duration << " writes/s\n";
+    };
+
+    //by address, like the comms
+    run("find, copy", [&db](size_t i, DB::SensorAddress address)
+    {
+        std::optional<DB::Sensor> sensor = db.findSensorByAddress(address);
+        return sensor.has_value() && sensor->state == DB::Sensor::State::Active;
+    });
+    run("find, snapshot", [&db](size_t i, DB::SensorAddress address)
+    {
+        std::shared_ptr<const DB::Snapshot> snapshot = db.getSnapshot();
+        DB::Sensor const* sensor = snapshot->findSensorByAddress(address);
+        return sensor && sensor->state == DB::Sensor::State::Active;
+    });
+
+    //by index, like the sensor list repaints
+    run("index, copy", [&db](size_t i, DB::SensorAddress address)
+    {
+        return db.getSensor(i).state == DB::Sensor::State::Active;
+    });
+    run("index, snapshot", [&db](size_t i, DB::SensorAddress address)
+    {
+        std::shared_ptr<const DB::Snapshot> snapshot = db.getSnapshot();
+        return snapshot->sensors[i]->state == DB::Sensor::State::Active;
+    });
+
+    closeDB(db);
+}
@@ -0,0 +1,107 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <ctime>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures the per call latency of the measurement lookups, against preparing the same query for every call
+void benchStatementCache()
+{
+    std::cout << "Benchmarking statement cache\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    const size_t sensorCount = 100;
+    const size_t measurementsPerSensor = 1000;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?1, ?2, ?3, 20, 50, 3, -60, -60, 0, 0, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                sqlite3_bind_int64(stmt, 1, IClock::to_time_t(clock->now()) + int64_t(i) * 60);
+                sqlite3_bind_int64(stmt, 2, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 3, int64_t(s + 1));
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+
+    const size_t calls = 100000;
+    const size_t measurementCount = sensorCount * measurementsPerSensor;
+
+    auto report = [calls](const char* name, std::clock_t start)
+    {
+        double us = double(std::clock() - start) * 1000000.0 / CLOCKS_PER_SEC / calls;
+        std::cout << "\t" << name << ": " << us << " us per call\n";
+    };
+
+    {
+        std::clock_t start = std::clock();
+        for (size_t i = 0; i < calls; i++)
+        {
+            QString sql = QString("SELECT * "
+                                  "FROM Measurements "
+                                  "WHERE id = %1;").arg(i % measurementCount + 1);
+            sqlite3_stmt* stmt;
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, sql.toUtf8().data(), -1, &stmt, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            sqlite3_finalize(stmt);
+        }
+        report("find by id, prepared per call", start);
+    }
+    {
+        std::clock_t start = std::clock();
+        for (size_t i = 0; i < calls; i++)
+            CHECK_SUCCESS(db.findMeasurementById(i % measurementCount + 1));
+        report("find by id, cached", start);
+    }
+    {
+        std::clock_t start = std::clock();
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < calls; i++)
+        {
+            QString sql = QString("UPDATE Measurements "
+                                  "SET temperature = ?1, humidity = ?2, vcc = ?3 "
+                                  "WHERE id = ?4;");
+            sqlite3_stmt* stmt;
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, sql.toUtf8().data(), -1, &stmt, nullptr), SQLITE_OK);
+            sqlite3_bind_double(stmt, 1, 21.0);
+            sqlite3_bind_double(stmt, 2, 51.0);
+            sqlite3_bind_double(stmt, 3, 3.1);
+            sqlite3_bind_int64(stmt, 4, int64_t(i % measurementCount + 1));
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+            sqlite3_finalize(stmt);
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        report("set measurement, prepared per call", start);
+    }
+    {
+        DB::MeasurementDescriptor descriptor;
+        descriptor.temperature = 22.f;
+        descriptor.humidity = 52.f;
+        descriptor.vcc = 3.2f;
+
+        std::clock_t start = std::clock();
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < calls; i++)
+            CHECK_SUCCESS(db.setMeasurement(i % measurementCount + 1, descriptor));
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        report("set measurement, cached", start);
+    }
+
+    closeDB(db);
+}
@@ -0,0 +1,83 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+
+//Measures a report sized query: materializing all the rows against streaming them, with all the columns and with a few
+void benchStreaming()
+{
+    std::cout << "Benchmarking streaming\n";
+
+    std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+    clock->advance(std::chrono::hours(24 * 365 * 30));
+    DB db(clock);
+
+    //a month of measurements every minute for 50 sensors
+    const size_t sensorCount = 50;
+    const size_t measurementsPerSensor = 31 * 24 * 60;
+    const size_t measurementCount = sensorCount * measurementsPerSensor;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    sqlite3* sqlite = db.getSqliteDB();
+    {
+        sqlite3_stmt* stmt;
+        CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+                                                "VALUES (?1, ?1, ?2, ?3, ?4, 50, 3, -60, -60, 0, 0, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+        CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        for (size_t i = 0; i < measurementsPerSensor; i++)
+        {
+            for (size_t s = 0; s < sensorCount; s++)
+            {
+                sqlite3_bind_int64(stmt, 1, IClock::to_time_t(clock->now()) + int64_t(i) * 60);
+                sqlite3_bind_int64(stmt, 2, int64_t(i + 1));
+                sqlite3_bind_int64(stmt, 3, int64_t(s + 1));
+                sqlite3_bind_double(stmt, 4, 20.0 + double(i % 100) / 10.0);
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+                sqlite3_reset(stmt);
+            }
+        }
+        CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_finalize(stmt);
+    }
+
+    //how the report asks for them
+    DB::Filter filter;
+    filter.sortBy = DB::Filter::SortBy::Timestamp;
+    filter.sortOrder = DB::Filter::SortOrder::Descending;
+
+    auto report = [](const char* name, std::chrono::steady_clock::time_point start, size_t rowsInMemory, float maxTemperature)
+    {
+        std::cout << "\t" << name << ": " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s, "
+                  << rowsInMemory * sizeof(DB::Measurement) / 1024 << " KB of rows in memory, max temperature " << maxTemperature << "\n";
+    };
+
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<DB::Measurement> measurements = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(measurements.size(), measurementCount);
+        float maxTemperature = 0;
+        for (DB::Measurement const& m: measurements)
+            maxTemperature = std::max(maxTemperature, m.descriptor.temperature);
+        report("materialized", start, measurements.capacity(), maxTemperature);
+    }
+    auto stream = [&db, &filter, &report, measurementCount](const char* name, uint32_t columns)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        float maxTemperature = 0;
+        CHECK_TRUE(db.visitFilteredMeasurements(filter, columns, [&count, &maxTemperature](DB::Measurement const& m)
+        {
+            maxTemperature = std::max(maxTemperature, m.descriptor.temperature);
+            count++;
+            return true;
+        }));
+        CHECK_EQUALS(count, measurementCount);
+        report(name, start, 4096, maxTemperature);
+    };
+    stream("streamed, all columns", DB::MeasurementColumn::All);
+    stream("streamed, summary columns", DB::MeasurementColumn::SensorId | DB::MeasurementColumn::Temperature | DB::MeasurementColumn::Humidity | DB::MeasurementColumn::AlarmTriggers);
+
+    closeDB(db);
+}
@@ -0,0 +1,74 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+
+//Measures time window queries of a few sensors in a large table, with the window as an index range per sensor
+//against the timePoint index
+void benchTimeWindows()
+{
+    std::cout << "Benchmarking time windows\n";
+
+    std::shared_ptr<ManualClock> clock = createTestClock();
+    DB db(clock);
+
+    const size_t sensorCount = 500;
+    const size_t measurementsPerSensor = 100000; //almost a year, every 5 minutes
+    const size_t windowCount = 20;
+    createDBWithSensors(db, sensorCount, clock->now());
+
+    //the time points follow the time config, like the ones added by the comms
+    DB::SensorTimeConfig config = db.getLastSensorTimeConfig();
+    auto getTimePoint = [&config](size_t index)
+    {
+        return config.baselineMeasurementTimePoint + config.descriptor.measurementPeriod * int64_t(index - config.baselineMeasurementIndex);
+    };
+
+    Stopwatch fillStart;
+    insertMeasurements(db, sensorCount, measurementsPerSensor, getTimePoint(1), config.descriptor.measurementPeriod, [](size_t i, size_t s, RawMeasurement& m)
+    {
+        m.temperature = 20.f + float((i + 1 + s) % 100) / 10.f;
+    });
+    std::cout << "\tfilled " << sensorCount * measurementsPerSensor << " measurements in "
+              << fillStart.seconds() << " s\n";
+
+    //a day of a few sensors, spread over the year
+    auto run = [&](const char* name, size_t selectedSensors, DB::Filter::SortBy sortBy)
+    {
+        size_t fetched = 0;
+        Stopwatch start;
+        for (size_t w = 0; w < windowCount; w++)
+        {
+            DB::Filter filter;
+            filter.sortBy = sortBy;
+            filter.useSensorFilter = true;
+            for (size_t s = 0; s < selectedSensors; s++)
+                filter.sensorIds.insert(DB::SensorId((w * 37 + s * 101) % sensorCount + 1));
+            filter.useTimePointFilter = true;
+            filter.timePointFilter.min = getTimePoint((w * 4999) % (measurementsPerSensor - 300) + 1);
+            filter.timePointFilter.max = filter.timePointFilter.min + std::chrono::hours(24) - std::chrono::seconds(1);
+            fetched += db.getFilteredMeasurements(filter).size();
+        }
+        double duration = start.ms();
+        CHECK_EQUALS(fetched, windowCount * selectedSensors * 288);
+        std::cout << "\t" << name << ", " << selectedSensors << " sensors: " << duration / double(windowCount) << " ms per query\n";
+    };
+    auto runAll = [&](const char* name)
+    {
+        run(name, 1, DB::Filter::SortBy::Timestamp);
+        run(name, 5, DB::Filter::SortBy::Timestamp);
+        run(name, 20, DB::Filter::SortBy::Timestamp);
+        run(name, 20, DB::Filter::SortBy::Temperature);
+    };
+
+    runAll("index ranges");
+
+    //with a different measurement period the ranges don't match the stored time points, so the queries fall back to the timePoint index
+    std::vector<DB::SensorTimeConfig> configs = { config };
+    configs.back().descriptor.measurementPeriod += std::chrono::seconds(1);
+    CHECK_SUCCESS(db.setSensorTimeConfigs(configs));
+    runAll("timePoint index");
+
+    closeDB(db);
+}
@@ -0,0 +1,154 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "AlarmEvaluator.h"
+#include "testUtils.h"
+
+void testAlarms()
+{
+    std::cout << "Testing alarms\n";
+    {
+        std::cout << "\tTesting the alarm evaluation\n";
+        DB::Sensor sensor;
+        sensor.id = 7;
+        DB::SensorSettings settings;
+        settings.alertBatteryLevel = 0.1f;
+        settings.alertSignalStrengthLevel = 0.1f;
+
+        DB::AlarmDescriptor descriptor;
+        descriptor.lowTemperatureWatch = true;
+        descriptor.lowTemperatureSoft = 5.f;
+        descriptor.lowTemperatureHard = 0.f;
+        descriptor.highTemperatureWatch = true;
+        descriptor.highTemperatureSoft = 25.f;
+        descriptor.highTemperatureHard = 30.f;
+        descriptor.lowVccWatch = true;
+
+        //more than the 4 compared at once, and not a multiple of 4. The thresholds themselves trigger
+        std::vector<float> temperatures = { 10.f, 25.f, 26.f, 30.f, 31.f, 20.f, 5.f, 0.f, -1.f, 6.f, 24.9f };
+        std::vector<uint32_t> expected =
+        {
+            0,
+            DB::AlarmTrigger::MeasurementHighTemperatureSoft,
+            DB::AlarmTrigger::MeasurementHighTemperatureSoft,
+            DB::AlarmTrigger::MeasurementHighTemperatureSoft | DB::AlarmTrigger::MeasurementHighTemperatureHard,
+            DB::AlarmTrigger::MeasurementHighTemperatureSoft | DB::AlarmTrigger::MeasurementHighTemperatureHard,
+            0,
+            DB::AlarmTrigger::MeasurementLowTemperatureSoft,
+            DB::AlarmTrigger::MeasurementLowTemperatureSoft | DB::AlarmTrigger::MeasurementLowTemperatureHard,
+            DB::AlarmTrigger::MeasurementLowTemperatureSoft | DB::AlarmTrigger::MeasurementLowTemperatureHard,
+            0,
+            0,
+        };
+        alarms::MeasurementBlock block;
+        for (float temperature: temperatures)
+        {
+            DB::MeasurementDescriptor md;
+            md.temperature = temperature;
+            md.humidity = 50.f;
+            md.vcc = 3.f;
+            md.signalStrength = { -50, -50 };
+            block.add(md);
+        }
+
+        alarms::Plan plan = alarms::compile(descriptor, settings, sensor);
+        std::vector<DB::AlarmTriggers> triggers(block.size());
+        CHECK_EQUALS(alarms::evaluate(plan, block, 0, triggers.data()), 0u);
+        uint32_t previous = 0;
+        for (size_t i = 0; i < triggers.size(); i++)
+        {
+            CHECK_EQUALS(triggers[i].current, expected[i]);
+            CHECK_EQUALS(triggers[i].added, expected[i] & ~previous);
+            CHECK_EQUALS(triggers[i].removed, previous & ~expected[i]);
+            previous = expected[i];
+        }
+
+        //low vcc triggers under the alert level minus 0.4%, and stays triggered until over the alert level plus 0.4%
+        block.batteryLevels = { 0.2f, 0.097f, 0.095f, 0.103f, 0.097f, 0.105f, 0.097f, 0.2f, 0.095f, 0.2f, 0.2f };
+        CHECK_EQUALS(alarms::evaluate(plan, block, 0, triggers.data()), 0u);
+        std::vector<bool> lowVcc = { false, false, true, true, true, false, false, false, true, false, false };
+        for (size_t i = 0; i < triggers.size(); i++)
+            CHECK_EQUALS((triggers[i].current & DB::AlarmTrigger::MeasurementLowVcc) != 0, lowVcc[i]);
+
+        //and the state it starts from counts
+        CHECK_EQUALS(alarms::evaluate(plan, block, DB::AlarmTrigger::MeasurementLowVcc, triggers.data()), 0u);
+        CHECK_EQUALS(triggers[0].removed, uint32_t(DB::AlarmTrigger::MeasurementLowVcc));
+        CHECK_EQUALS(triggers[1].current & DB::AlarmTrigger::MeasurementLowVcc, 0u);
+
+        //an alarm that doesn't watch the sensor never triggers, not even the watches that are on
+        descriptor.filterSensors = true;
+        descriptor.sensors = { sensor.id + 1 };
+        plan = alarms::compile(descriptor, settings, sensor);
+        CHECK_EQUALS(alarms::evaluate(plan, block, DB::AlarmTrigger::MeasurementHighTemperatureSoft, triggers.data()), 0u);
+        CHECK_EQUALS(triggers[0].removed, uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft));
+        for (DB::AlarmTriggers const& t: triggers)
+            CHECK_EQUALS(t.current, 0u);
+
+        //the blackout is on all the measurements of a sensor in blackout
+        descriptor.sensors = { sensor.id };
+        descriptor.sensorBlackoutWatch = true;
+        sensor.blackout = true;
+        plan = alarms::compile(descriptor, settings, sensor);
+        alarms::evaluate(plan, block, 0, triggers.data());
+        for (DB::AlarmTriggers const& t: triggers)
+            CHECK_TRUE((t.current & DB::AlarmTrigger::SensorBlackout) != 0);
+        CHECK_EQUALS(triggers[0].added & DB::AlarmTrigger::SensorBlackout, uint32_t(DB::AlarmTrigger::SensorBlackout));
+        CHECK_EQUALS(triggers[1].added & DB::AlarmTrigger::SensorBlackout, 0u);
+    }
+    {
+        std::cout << "\tTesting the sensor alarm index\n";
+        std::vector<DB::Sensor> sensors(3);
+        for (size_t i = 0; i < sensors.size(); i++)
+            sensors[i].id = DB::SensorId(i + 1);
+        DB::SensorSettings settings;
+
+        std::vector<DB::Alarm> dbAlarms(4);
+        dbAlarms[0].descriptor.highTemperatureWatch = true; //only sensor 1
+        dbAlarms[0].descriptor.filterSensors = true;
+        dbAlarms[0].descriptor.sensors = { 1 };
+        dbAlarms[1].descriptor.baseStationDisconnectedWatch = true; //no sensor
+        dbAlarms[2].descriptor.sensorBlackoutWatch = true; //all sensors
+        dbAlarms[3].descriptor.lowHumidityWatch = true; //only sensor 2, but still triggered for sensor 3
+        dbAlarms[3].descriptor.filterSensors = true;
+        dbAlarms[3].descriptor.sensors = { 2 };
+        dbAlarms[3].triggersPerSensor[3] = DB::AlarmTrigger::MeasurementLowHumiditySoft;
+
+        auto getAlarmSlots = [](alarms::SensorAlarmIndex const& index, size_t sensorSlot)
+        {
+            std::vector<size_t> alarmSlots;
+            for (alarms::SensorAlarm const& sa: index.getSensorAlarms(sensorSlot))
+                alarmSlots.push_back(sa.alarmSlot);
+            return alarmSlots;
+        };
+
+        alarms::SensorAlarmIndex index;
+        index.rebuild(dbAlarms, sensors, settings);
+        CHECK_TRUE(getAlarmSlots(index, 0) == std::vector<size_t>({ 0, 2 }));
+        CHECK_TRUE(getAlarmSlots(index, 1) == std::vector<size_t>({ 2, 3 }));
+        CHECK_TRUE(getAlarmSlots(index, 2) == std::vector<size_t>({ 2, 3 }));
+        CHECK_TRUE(index.getSensorAlarms(1)[1].watched);
+        CHECK_TRUE(!index.getSensorAlarms(2)[1].watched); //only there to clear its triggers
+        CHECK_EQUALS(index.getTriggers(3, 2), uint32_t(DB::AlarmTrigger::MeasurementLowHumiditySoft));
+        CHECK_EQUALS(index.getTriggers(3, 1), 0u);
+        CHECK_EQUALS(index.getSensorAlarms(0)[1].blackoutTriggers, uint32_t(DB::AlarmTrigger::SensorBlackout));
+
+        sensors.emplace_back();
+        sensors.back().id = 4;
+        index.addSensor(dbAlarms, sensors, settings);
+        CHECK_TRUE(getAlarmSlots(index, 3) == std::vector<size_t>({ 2 }));
+
+        dbAlarms.emplace_back();
+        dbAlarms.back().descriptor.lowVccWatch = true;
+        index.addAlarm(dbAlarms, sensors, settings);
+        CHECK_TRUE(getAlarmSlots(index, 3) == std::vector<size_t>({ 2, 4 }));
+        CHECK_EQUALS(index.getSensorAlarms(3)[1].plan.lowBatteryLevel, settings.alertBatteryLevel - 0.4f / 100.f);
+        index.setTriggers(4, 3, DB::AlarmTrigger::MeasurementLowVcc);
+        CHECK_EQUALS(index.getTriggers(4, 3), uint32_t(DB::AlarmTrigger::MeasurementLowVcc));
+
+        //once cleared the alarm doesn't apply to the sensor anymore
+        dbAlarms[3].triggersPerSensor.clear();
+        index.rebuild(dbAlarms, sensors, settings);
+        CHECK_TRUE(getAlarmSlots(index, 2) == std::vector<size_t>({ 2, 4 }));
+    }
+}
@@ -0,0 +1,168 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <random>
+#include <queue>
+#include <map>
+#include <algorithm>
+#include "DB.h"
+#include "testUtils.h"
+
+//Simulates a large network talking in the slots the DB gives out and checks that no two sensors ever get overlapping slots,
+//that the slots are packed and that they stay put when sensors are added
+void testCommsSchedule()
+{
+    std::cout << "Testing comms schedule\n";
+    {
+        std::cout << "\tTesting 5000 sensors\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+
+        const size_t sensorCount = 5000;
+        createDBWithSensors(db, sensorCount, clock->now());
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "blackout";
+        alarm.sensorBlackoutWatch = true;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+
+        std::mt19937 rnd(1234);
+        std::vector<IClock::duration> airtimes(sensorCount);
+        std::uniform_int_distribution<int> airtimeDist(100, 900);
+        std::uniform_int_distribution<uint32_t> backlogDist(0, 20);
+
+        typedef std::pair<IClock::time_point, size_t> Comms;
+        std::priority_queue<Comms, std::vector<Comms>, std::greater<Comms>> comms;
+
+        //the first contact is not scheduled, it happens sometime in the first period
+        IClock::time_point start = clock->now();
+        IClock::duration period = db.computeActualCommsPeriod(db.getLastSensorTimeConfig().descriptor);
+        std::uniform_int_distribution<int64_t> firstContactDist(0, std::chrono::duration_cast<std::chrono::seconds>(period).count());
+        for (size_t i = 0; i < sensorCount; i++)
+        {
+            airtimes[i] = std::chrono::milliseconds(airtimeDist(rnd));
+            comms.emplace(start + std::chrono::seconds(firstContactDist(rnd)), i);
+        }
+
+        std::map<IClock::time_point, IClock::time_point> assignedSlots;
+        size_t collisions = 0;
+        size_t longWaits = 0;
+        IClock::time_point lastProcessTP = start;
+
+        const size_t rounds = 5;
+        size_t commsCount = 0;
+        while (!comms.empty() && commsCount < sensorCount * rounds)
+        {
+            auto [tp, index] = comms.top();
+            comms.pop();
+            commsCount++;
+
+            clock->set(tp);
+            if (tp - lastProcessTP >= std::chrono::minutes(1)) //saving all the sensors every time is too slow
+            {
+                db.process();
+                lastProcessTP = tp;
+            }
+
+            DB::Sensor const& sensor = db.getSensor(index);
+            DB::SensorInputDetails details;
+            details.id = sensor.id;
+            details.hasLastCommsTimePoint = true;
+            details.lastCommsTimePoint = tp;
+            details.hasRequestAirtime = true;
+            details.requestAirtime = airtimes[index];
+            details.hasStoredData = true;
+            details.firstStoredMeasurementIndex = 1;
+            details.storedMeasurementCount = backlogDist(rnd);
+            CHECK_TRUE(db.setSensorInputDetails(details));
+
+            DB::SensorOutputDetails output = db.computeSensorOutputDetails(sensor.id);
+            IClock::time_point begin = output.nextCommsTimePoint;
+            IClock::time_point end = begin + db.getSensor(index).commsSlotDuration;
+            CHECK_TRUE(begin > tp);
+            CHECK_TRUE(end > begin);
+            if (begin - tp > output.commsPeriod * 2)
+                longWaits++;
+
+            //check the neighbours
+            auto it = assignedSlots.lower_bound(begin);
+            if (it != assignedSlots.end() && it->first < end)
+                collisions++;
+            if (it != assignedSlots.begin() && std::prev(it)->second > begin)
+                collisions++;
+            assignedSlots.emplace(begin, end);
+
+            comms.emplace(begin, index);
+        }
+
+        period = db.computeActualCommsPeriod(db.getLastSensorTimeConfig().descriptor);
+        std::cout << "\t\tperiod: " << std::chrono::duration_cast<std::chrono::seconds>(period).count() << "s\n";
+
+        CHECK_EQUALS(collisions, 0u);
+        CHECK_EQUALS(longWaits, 0u);
+
+        //every slot is the whole seconds its requests need: the config request plus a batch per 12 stored measurements,
+        //at the sensor's airtime and with the 500ms guard, between 1s and 10s
+        IClock::duration used = IClock::duration::zero();
+        IClock::duration end = IClock::duration::zero();
+        std::map<IClock::duration, IClock::duration> commsSlots;
+        for (size_t i = 0; i < sensorCount; i++)
+        {
+            DB::Sensor const& sensor = db.getSensor(i);
+            CHECK_TRUE(sensor.averageRequestAirtime == airtimes[i]);
+            uint32_t requests = 1 + (sensor.estimatedStoredMeasurementCount + 11) / 12;
+            IClock::duration expected = std::chrono::ceil<std::chrono::seconds>(airtimes[i] * requests + std::chrono::milliseconds(500));
+            expected = std::clamp<IClock::duration>(expected, std::chrono::seconds(1), std::chrono::seconds(10));
+            CHECK_TRUE(sensor.commsSlotDuration == expected);
+
+            used += sensor.commsSlotDuration;
+            end = std::max(end, sensor.commsSlotOffset + sensor.commsSlotDuration);
+            commsSlots.emplace(sensor.commsSlotOffset, sensor.commsSlotOffset + sensor.commsSlotDuration);
+        }
+        CHECK_EQUALS(commsSlots.size(), sensorCount);
+        for (auto it = commsSlots.begin(); std::next(it) != commsSlots.end(); ++it)
+            CHECK_TRUE(it->second <= std::next(it)->first);
+
+        //one channel: the commsSlots are packed first fit, so the gaps left by the sensors that moved stay within 1%,
+        //and the period has the 25% headroom on top, rounded to the minute, and shrinks only below half used
+        std::cout << "\t\tslots: " << std::chrono::duration_cast<std::chrono::seconds>(used).count() << "s used, "
+                  << std::chrono::duration_cast<std::chrono::seconds>(end).count() << "s end\n";
+        CHECK_TRUE(end <= used + used / 100);
+        CHECK_TRUE(period >= end);
+        CHECK_TRUE(period <= std::max<IClock::duration>(end * 2, std::chrono::ceil<std::chrono::minutes>(end + end / 4)));
+
+        //new sensors go in the gaps or at the end, the commsSlots already handed out don't move
+        for (size_t i = 0; i < 50; i++)
+        {
+            DB::SensorDescriptor descriptor;
+            descriptor.name = "new" + std::to_string(i);
+            CHECK_SUCCESS(db.addSensor(descriptor));
+            CHECK_SUCCESS(db.bindSensor(uint32_t(sensorCount + i + 1), 0, 0, 0, {}));
+        }
+        CHECK_EQUALS(db.getSensorCount(), sensorCount + 50);
+        for (size_t i = 0; i < sensorCount; i++)
+        {
+            DB::Sensor const& sensor = db.getSensor(i);
+            auto it = commsSlots.find(sensor.commsSlotOffset);
+            CHECK_TRUE(it != commsSlots.end());
+            CHECK_TRUE(it != commsSlots.end() && it->second == sensor.commsSlotOffset + sensor.commsSlotDuration);
+        }
+        for (size_t i = sensorCount; i < db.getSensorCount(); i++)
+        {
+            DB::Sensor const& sensor = db.getSensor(i);
+            IClock::duration begin = sensor.commsSlotOffset;
+            IClock::duration slotEnd = begin + sensor.commsSlotDuration;
+            auto it = commsSlots.lower_bound(begin);
+            CHECK_TRUE(it == commsSlots.end() || it->first >= slotEnd);
+            CHECK_TRUE(it == commsSlots.begin() || std::prev(it)->second <= begin);
+            commsSlots.emplace(begin, slotEnd);
+        }
+
+        db.process();
+        for (size_t i = 0; i < sensorCount; i++)
+            CHECK_FALSE(db.getSensor(i).blackout);
+
+        closeDB(db);
+    }
+}
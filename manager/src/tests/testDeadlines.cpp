@@ -0,0 +1,98 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include "DB.h"
+#include "testUtils.h"
+
+void testDeadlines()
+{
+    std::cout << "Testing deadlines\n";
+    {
+        std::cout << "\tTesting sensor blackout\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 10, clock->now());
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "blackout";
+        alarm.sensorBlackoutWatch = true;
+        alarm.resendPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addAlarm(alarm));
+
+        IClock::duration period = db.computeActualCommsPeriod(db.getLastSensorTimeConfig().descriptor);
+
+        db.process();
+        CHECK_TRUE(db.computeTimeUntilNextEvent() > IClock::duration::zero());
+        CHECK_TRUE(db.computeTimeUntilNextEvent() <= period * 2 + std::chrono::seconds(1));
+        for (size_t i = 0; i < db.getSensorCount(); i++)
+            CHECK_FALSE(db.getSensor(i).blackout);
+
+        //nothing is reported in the first 2 rounds, even if blacked out
+        clock->advance(period * 2);
+        db.process();
+        CHECK_TRUE(db.getAlarm(0).triggersPerSensor.empty());
+
+        clock->advance(std::chrono::seconds(1));
+        db.process();
+        for (size_t i = 0; i < db.getSensorCount(); i++)
+            CHECK_TRUE(db.getSensor(i).blackout);
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.size(), db.getSensorCount());
+
+        //the alarm is resent once per resend period
+        IClock::time_point triggeredTP = db.getAlarm(0).lastTriggeredTimePoint;
+        clock->advance(std::chrono::minutes(59));
+        db.process();
+        CHECK_TRUE(db.getAlarm(0).lastTriggeredTimePoint == triggeredTP);
+        clock->advance(std::chrono::minutes(1));
+        db.process();
+        CHECK_TRUE(db.getAlarm(0).lastTriggeredTimePoint == clock->now());
+
+        //comms ends the blackout
+        DB::SensorInputDetails details;
+        details.id = db.getSensor(0).id;
+        details.hasLastCommsTimePoint = true;
+        details.lastCommsTimePoint = clock->now();
+        CHECK_TRUE(db.setSensorInputDetails(details));
+        db.process();
+        CHECK_FALSE(db.getSensor(0).blackout);
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.size(), db.getSensorCount() - 1);
+
+        //and the sensor blacks out again one and a half comms period after its last comms
+        clock->set(details.lastCommsTimePoint + std::chrono::duration_cast<IClock::duration>(period * 1.5f));
+        db.process();
+        CHECK_FALSE(db.getSensor(0).blackout);
+        clock->advance(std::chrono::seconds(1));
+        db.process();
+        CHECK_TRUE(db.getSensor(0).blackout);
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.size(), db.getSensorCount());
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting custom reports\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDB(db);
+
+        DB::ReportDescriptor report;
+        report.name = "report";
+        report.period = DB::ReportDescriptor::Period::Custom;
+        report.customPeriod = std::chrono::hours(2);
+        CHECK_SUCCESS(db.addReport(report));
+
+        db.process();
+        IClock::time_point triggeredTP = db.getReport(0).lastTriggeredTimePoint;
+        CHECK_TRUE(triggeredTP == clock->now());
+
+        clock->advance(std::chrono::hours(2) - std::chrono::seconds(1));
+        db.process();
+        CHECK_TRUE(db.getReport(0).lastTriggeredTimePoint == triggeredTP);
+        clock->advance(std::chrono::seconds(1));
+        db.process();
+        CHECK_TRUE(db.getReport(0).lastTriggeredTimePoint == clock->now());
+
+        closeDB(db);
+    }
+}
@@ -1,4 +1,5 @@
 #include "cstdio"
+#include <string>
 
 void testBitstream();
 void testStorage();
@@ -7,9 +8,53 @@ void testCsvSettings();
 void testSensorSettings();
 void testSensorTimeConfig();
 void testSensorBasicOperations();
+void testDeadlines();
+void testCommsSchedule();
+void testMeasurements();
+void testAlarms();
 
-int main(int, const char*[])
+void benchIdleProcess();
+void benchStatementCache();
+void benchSave();
+void benchIngest();
+void benchPagination();
+void benchStreaming();
+void benchRecentMeasurements();
+void benchRollups();
+void benchSnapshot();
+void benchSensorLookup();
+void benchTimeWindows();
+void benchMeasurementChunks();
+void benchRetention();
+void benchAlarmLatency();
+void benchAlarmEvaluation();
+void benchAlarmBacklog();
+void benchAlarmBackfill();
+
+int main(int argc, const char* argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+    {
+        benchIdleProcess();
+        benchStatementCache();
+        benchSave();
+        benchIngest();
+        benchPagination();
+        benchStreaming();
+        benchRecentMeasurements();
+        benchRollups();
+        benchSnapshot();
+        benchSensorLookup();
+        benchTimeWindows();
+        benchMeasurementChunks();
+        benchRetention();
+        benchAlarmLatency();
+        benchAlarmEvaluation();
+        benchAlarmBacklog();
+        benchAlarmBackfill();
+        return 0;
+    }
+
 	testBitstream();
 	testStorage();
     testGeneralSettings();
@@ -17,6 +62,10 @@ int main(int, const char*[])
     testSensorSettings();
     testSensorTimeConfig();
     testSensorBasicOperations();
+    testDeadlines();
+    testCommsSchedule();
+    testMeasurements();
+    testAlarms();
 
     return 0;
 }
@@ -0,0 +1,1659 @@
+#include "cstdio"
+#include "Logger.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include "DB.h"
+#include "QueryWorker.h"
+#include "testUtils.h"
+#include "sqlite3.h"
+#include "MeasurementChunk.h"
+#include <QFileInfo>
+#include <QDir>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+extern Logger s_logger;
+
+void testMeasurements()
+{
+    std::cout << "Testing measurements\n";
+    {
+        std::cout << "\tTesting add/load\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+        clock->advance(std::chrono::hours(24));
+
+        for (size_t i = 0; i < db.getSensorCount(); i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, 50)));
+
+        //the reads see the measurements right away, even if the writer didn't commit them yet
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 150u);
+        CHECK_EQUALS(db.getSensor(0).lastReceivedMeasurementIndex, 50u);
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 0u);
+        Result<DB::Measurement> mostRecent = db.getMostRecentMeasurementForSensor(db.getSensor(1).id);
+        CHECK_TRUE(mostRecent == success);
+        CHECK_EQUALS(mostRecent.payload().descriptor.index, 50u);
+
+        //already received measurements are ignored
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(0).id, 1, 10)));
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 150u);
+
+        //they are confirmed to the sensors only after the writer committed them
+        db.flushMeasurements();
+        db.process();
+        CHECK_TRUE(db.getSensor(0).isRTMeasurementValid);
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 50u);
+        CHECK_EQUALS(db.computeSensorOutputDetails(db.getSensor(1).id).lastConfirmedMeasurementIndex, 50u);
+
+        closeDB(db);
+        loadDB(db);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 150u);
+        CHECK_EQUALS(db.getSensor(2).lastConfirmedMeasurementIndex, 50u);
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting failed ingest commits\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 1, clock->now());
+        clock->advance(std::chrono::hours(24));
+        DB::SensorId sensorId = db.getSensor(0).id;
+
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, 1, 10)));
+        db.flushMeasurements();
+        db.process();
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 10u);
+
+        //the failures are injected with a trigger in every file the measurements can go to
+        auto setFailure = [&db](std::string const& sql)
+        {
+            std::vector<std::string> filenames = { "test.db" };
+            for (DB::MeasurementPartition const& partition: db.getMeasurementPartitions())
+                filenames.push_back(partition.filename);
+            for (std::string const& filename: filenames)
+            {
+                sqlite3* sqlite;
+                CHECK_EQUALS(sqlite3_open_v2(filename.c_str(), &sqlite, SQLITE_OPEN_READWRITE, nullptr), SQLITE_OK);
+                sqlite3_busy_timeout(sqlite, 10000);
+                CHECK_EQUALS(sqlite3_exec(sqlite, ("DROP TRIGGER IF EXISTS failIngest;" + sql).c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+                CHECK_EQUALS(sqlite3_close(sqlite), SQLITE_OK);
+            }
+        };
+
+        //a transaction that doesn't commit: none of it is confirmed, and the sensor is received again from the confirmed index
+        setFailure("CREATE TRIGGER failIngest BEFORE INSERT ON Measurements WHEN NEW.idx = 15 BEGIN SELECT RAISE(ROLLBACK, 'injected'); END;");
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, 11, 10)));
+        db.flushMeasurements();
+        db.process();
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 10u);
+        CHECK_EQUALS(db.getSensor(0).lastReceivedMeasurementIndex, 10u);
+        CHECK_EQUALS(db.computeSensorOutputDetails(sensorId).lastConfirmedMeasurementIndex, 10u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 10u);
+
+        //a row that isn't stored holds back the confirmation of its batch, the other rows are kept
+        setFailure("CREATE TRIGGER failIngest BEFORE INSERT ON Measurements WHEN NEW.idx = 15 BEGIN SELECT RAISE(ABORT, 'injected'); END;");
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, 11, 10)));
+        db.flushMeasurements();
+        db.process();
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 10u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 19u);
+
+        //the resent measurements are stored and confirmed
+        setFailure("");
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, 11, 10)));
+        db.flushMeasurements();
+        db.process();
+        CHECK_EQUALS(db.getSensor(0).lastConfirmedMeasurementIndex, 20u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 20u);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting ingest latency\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24));
+
+        //with a long latency the batch is committed when it's full
+        DB::IngestSettings settings;
+        settings.maxLatency = std::chrono::hours(1);
+        settings.maxBatchSize = 20;
+        db.setIngestSettings(settings);
+        CHECK_TRUE(db.getIngestSettings().maxBatchSize == 20);
+
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(0).id, 1, 10)));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(1).id, 1, 10)));
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (!db.getSensor(1).isRTMeasurementValid && std::chrono::steady_clock::now() - start < std::chrono::seconds(10))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            db.process();
+        }
+        CHECK_TRUE(db.getSensor(0).isRTMeasurementValid);
+        CHECK_TRUE(db.getSensor(1).isRTMeasurementValid);
+
+        //and a read doesn't wait for the latency either
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(0).id, 11, 1)));
+        start = std::chrono::steady_clock::now();
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 21u);
+        CHECK_TRUE(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting cursors\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+        clock->advance(std::chrono::hours(24));
+
+        //few distinct temperatures, so the pages have to break ties by id
+        for (size_t i = 0; i < db.getSensorCount(); i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, 100)));
+
+        for (DB::Filter::SortBy sortBy: { DB::Filter::SortBy::Id, DB::Filter::SortBy::Timestamp, DB::Filter::SortBy::Temperature, DB::Filter::SortBy::Signal })
+        {
+            for (DB::Filter::SortOrder sortOrder: { DB::Filter::SortOrder::Ascending, DB::Filter::SortOrder::Descending })
+            {
+                DB::Filter filter;
+                filter.sortBy = sortBy;
+                filter.sortOrder = sortOrder;
+                filter.useSensorFilter = true;
+                filter.sensorIds = { db.getSensor(0).id, db.getSensor(2).id };
+                std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+                CHECK_EQUALS(all.size(), 200u);
+
+                std::vector<DB::Measurement> paged;
+                DB::MeasurementCursor cursor;
+                while (true)
+                {
+                    std::vector<DB::Measurement> page = db.getFilteredMeasurements(filter, cursor, 7);
+                    paged.insert(paged.end(), page.begin(), page.end());
+                    if (page.size() < 7)
+                        break;
+                }
+                CHECK_EQUALS(paged.size(), all.size());
+                for (size_t i = 0; i < all.size(); i++)
+                    CHECK_EQUALS(paged[i].id, all[i].id);
+            }
+        }
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting streaming\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24 * 30));
+
+        //more than a page
+        for (size_t i = 0; i < db.getSensorCount(); i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, 5000)));
+
+        DB::Filter filter;
+        filter.sortBy = DB::Filter::SortBy::Temperature;
+        filter.sortOrder = DB::Filter::SortOrder::Descending;
+        std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(all.size(), 10000u);
+
+        std::vector<DB::Measurement> visited;
+        CHECK_TRUE(db.visitFilteredMeasurements(filter, DB::MeasurementColumn::All, [&visited](DB::Measurement const& m)
+        {
+            visited.push_back(m);
+            return true;
+        }));
+        CHECK_EQUALS(visited.size(), all.size());
+        for (size_t i = 0; i < all.size(); i++)
+        {
+            CHECK_EQUALS(visited[i].id, all[i].id);
+            CHECK_EQUALS(visited[i].descriptor.index, all[i].descriptor.index);
+            CHECK_EQUALS(visited[i].descriptor.temperature, all[i].descriptor.temperature);
+            CHECK_TRUE(visited[i].timePoint == all[i].timePoint);
+        }
+
+        //only the columns asked for are read
+        size_t count = 0;
+        CHECK_TRUE(db.visitFilteredMeasurements(filter, DB::MeasurementColumn::SensorId | DB::MeasurementColumn::Humidity, [&](DB::Measurement const& m)
+        {
+            CHECK_EQUALS(m.id, all[count].id);
+            CHECK_EQUALS(m.descriptor.sensorId, all[count].descriptor.sensorId);
+            CHECK_EQUALS(m.descriptor.humidity, 50.f);
+            CHECK_EQUALS(m.descriptor.index, 0u);
+            CHECK_EQUALS(m.descriptor.temperature, 0.f);
+            count++;
+            return true;
+        }));
+        CHECK_EQUALS(count, all.size());
+
+        //stopping early
+        count = 0;
+        CHECK_FALSE(db.visitFilteredMeasurements(filter, DB::MeasurementColumn::All, [&count](DB::Measurement const&)
+        {
+            return ++count < 5000;
+        }));
+        CHECK_EQUALS(count, 5000u);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting recent measurements\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24 * 30));
+        DB::SensorId sensorId0 = db.getSensor(0).id;
+        DB::SensorId sensorId1 = db.getSensor(1).id;
+
+        //the first reads load the (empty) rings from the db
+        CHECK_TRUE(db.getMostRecentMeasurementForSensor(sensorId0) != success);
+        CHECK_TRUE(db.getRecentMeasurementsForSensor(sensorId1, 10).empty());
+        CHECK_EQUALS(db.getRecentMeasurementsStats().misses, 2u);
+
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, 1, 50)));
+        std::vector<DB::Measurement> recent = db.getRecentMeasurementsForSensor(sensorId0, DB::k_recentMeasurementCount);
+        CHECK_EQUALS(recent.size(), 50u);
+        CHECK_EQUALS(recent.front().descriptor.index, 1u);
+        CHECK_EQUALS(recent.back().descriptor.index, 50u);
+
+        //only the most recent are kept, and they match the db
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, 51, 50)));
+        recent = db.getRecentMeasurementsForSensor(sensorId0, DB::k_recentMeasurementCount);
+        CHECK_EQUALS(recent.back().descriptor.index, 100u);
+
+        //their ids are set when the writer commits them
+        DB::Filter filter;
+        filter.useSensorFilter = true;
+        filter.sensorIds = { sensorId0 };
+        filter.sortBy = DB::Filter::SortBy::Index;
+        std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+        recent = db.getRecentMeasurementsForSensor(sensorId0, DB::k_recentMeasurementCount);
+        CHECK_EQUALS(recent.size(), DB::k_recentMeasurementCount);
+        for (size_t i = 0; i < recent.size(); i++)
+        {
+            DB::Measurement const& m = all[all.size() - recent.size() + i];
+            CHECK_EQUALS(recent[i].id, m.id);
+            CHECK_EQUALS(recent[i].descriptor.index, m.descriptor.index);
+            CHECK_EQUALS(recent[i].descriptor.temperature, m.descriptor.temperature);
+            CHECK_TRUE(recent[i].timePoint == m.timePoint);
+        }
+        Result<DB::Measurement> mostRecent = db.getMostRecentMeasurementForSensor(sensorId0);
+        CHECK_TRUE(mostRecent == success);
+        CHECK_EQUALS(mostRecent.payload().id, all.back().id);
+
+        //more than kept goes to the db
+        recent = db.getRecentMeasurementsForSensor(sensorId0, 80);
+        CHECK_EQUALS(recent.size(), 80u);
+        CHECK_EQUALS(recent.front().descriptor.index, 21u);
+        CHECK_EQUALS(recent.back().descriptor.index, 100u);
+
+        //missing measurements filled in later end up in order
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId1, 1, 10)));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId1, 20, 11)));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId1, 11, 9)));
+        recent = db.getRecentMeasurementsForSensor(sensorId1, 100);
+        CHECK_EQUALS(recent.size(), 30u);
+        recent = db.getRecentMeasurementsForSensor(sensorId1, DB::k_recentMeasurementCount);
+        CHECK_EQUALS(recent.size(), 30u);
+        for (size_t i = 0; i < recent.size(); i++)
+            CHECK_EQUALS(recent[i].descriptor.index, uint32_t(i + 1));
+
+        //edits are seen
+        DB::MeasurementDescriptor md = recent.back().descriptor;
+        md.temperature = 35.f;
+        CHECK_TRUE(db.setMeasurement(recent.back().id, md) == success);
+        mostRecent = db.getMostRecentMeasurementForSensor(sensorId1);
+        CHECK_TRUE(mostRecent == success);
+        CHECK_EQUALS(mostRecent.payload().descriptor.temperature, 35.f);
+
+        DB::RecentMeasurementsStats stats = db.getRecentMeasurementsStats();
+        CHECK_EQUALS(stats.sensorCount, 2u);
+        CHECK_TRUE(stats.memoryUsage >= 2 * DB::k_recentMeasurementCount * sizeof(DB::Measurement));
+        CHECK_EQUALS(stats.misses, 4u); //the 2 loads and the 2 reads of more than kept
+        CHECK_EQUALS(stats.hits, 6u);
+
+        db.clearAllMeasurements();
+        CHECK_TRUE(db.getMostRecentMeasurementForSensor(sensorId0) != success);
+        CHECK_TRUE(db.getRecentMeasurementsForSensor(sensorId1, 10).empty());
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting rollups\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24 * 30));
+        DB::SensorId sensorId0 = db.getSensor(0).id;
+        DB::SensorId sensorId1 = db.getSensor(1).id;
+
+        //a few days worth, added through the writer so the rollups are maintained
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, 1, 3000)));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId1, 1, 2000)));
+
+        //compares against the aggregates computed from the measurements
+        auto checkAggregates = [&db](DB::Filter const& filter, IClock::duration bucket)
+        {
+            int64_t bucketSeconds = std::chrono::duration_cast<std::chrono::seconds>(bucket).count();
+            std::map<std::pair<DB::SensorId, int64_t>, DB::MeasurementAggregate> expected;
+            std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+            for (DB::Measurement const& m: all)
+            {
+                int64_t tp = IClock::to_time_t(m.timePoint);
+                DB::MeasurementAggregate& a = expected[{ m.descriptor.sensorId, bucketSeconds > 0 ? tp - tp % bucketSeconds : 0 }];
+                if (a.count == 0)
+                {
+                    a.temperature.min = a.temperature.max = m.descriptor.temperature;
+                }
+                a.count++;
+                a.temperature.min = std::min(a.temperature.min, m.descriptor.temperature);
+                a.temperature.max = std::max(a.temperature.max, m.descriptor.temperature);
+                a.temperatureSum += m.descriptor.temperature;
+            }
+            CHECK_EQUALS(db.getFilteredMeasurementCount(filter), all.size());
+
+            std::vector<DB::MeasurementAggregate> aggregates = db.getMeasurementAggregates(filter, bucket);
+            CHECK_EQUALS(aggregates.size(), expected.size());
+            for (DB::MeasurementAggregate const& a: aggregates)
+            {
+                int64_t key = bucketSeconds > 0 ? IClock::to_time_t(a.timePoint) : 0;
+                auto it = expected.find({ a.sensorId, key });
+                CHECK_TRUE(it != expected.end());
+                CHECK_EQUALS(a.count, it->second.count);
+                CHECK_EQUALS(a.temperature.min, it->second.temperature.min);
+                CHECK_EQUALS(a.temperature.max, it->second.temperature.max);
+                CHECK_EQUALS(a.temperatureSum, it->second.temperatureSum);
+            }
+        };
+
+        std::vector<DB::Measurement> all = db.getFilteredMeasurements(DB::Filter());
+        CHECK_EQUALS(all.size(), 5000u);
+        IClock::time_point first = all.front().timePoint;
+        IClock::time_point last = all.front().timePoint;
+        for (DB::Measurement const& m: all)
+        {
+            first = std::min(first, m.timePoint);
+            last = std::max(last, m.timePoint);
+        }
+        CHECK_TRUE(last - first > std::chrono::hours(24 * 3));
+
+        DB::Filter filter;
+        checkAggregates(filter, IClock::duration::zero());
+        checkAggregates(filter, std::chrono::hours(1));
+        checkAggregates(filter, std::chrono::hours(24));
+
+        //the ends of the range are not on bucket boundaries
+        filter.useTimePointFilter = true;
+        filter.timePointFilter.min = first + std::chrono::minutes(90) + std::chrono::seconds(17);
+        filter.timePointFilter.max = last - std::chrono::hours(5) - std::chrono::seconds(3);
+        checkAggregates(filter, IClock::duration::zero());
+        checkAggregates(filter, std::chrono::hours(1));
+        checkAggregates(filter, std::chrono::hours(6));
+        checkAggregates(filter, std::chrono::hours(24));
+
+        filter.useSensorFilter = true;
+        filter.sensorIds = { sensorId1 };
+        checkAggregates(filter, std::chrono::hours(24));
+
+        //value filters go to the measurements
+        filter.useTemperatureFilter = true;
+        filter.temperatureFilter.min = 22.f;
+        filter.temperatureFilter.max = 25.f;
+        checkAggregates(filter, std::chrono::hours(24));
+
+        //edits update the rollups
+        DB::MeasurementDescriptor md = all[1000].descriptor;
+        md.temperature = 99.f;
+        CHECK_TRUE(db.setMeasurement(all[1000].id, md) == success);
+        checkAggregates(DB::Filter(), IClock::duration::zero());
+        checkAggregates(DB::Filter(), std::chrono::hours(24));
+
+        //existing databases without rollups get them on load
+        CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "DROP TABLE MeasurementRollupsHourly; DROP TABLE MeasurementRollupsDaily;", nullptr, nullptr, nullptr), SQLITE_OK);
+        closeDB(db);
+        loadDB(db);
+        //the days not backfilled yet are served from the measurements
+        checkAggregates(DB::Filter(), std::chrono::hours(24));
+        auto backfillLeft = [&db]
+        {
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db.getSqliteDB(), "SELECT COUNT(*) FROM MeasurementRollupsBackfill;", -1, &stmt, nullptr);
+            sqlite3_step(stmt);
+            int64_t left = sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+            return left;
+        };
+        CHECK_EQUALS(backfillLeft(), 1);
+        //a slice at a time, with a pause in between that is a deadline like the others
+        for (size_t i = 0; i < 100 && backfillLeft() > 0; i++)
+        {
+            db.process();
+            if (backfillLeft() > 0)
+            {
+                CHECK_TRUE(db.computeTimeUntilNextEvent() > IClock::duration::zero());
+                clock->advance(db.computeTimeUntilNextEvent());
+            }
+        }
+        CHECK_EQUALS(backfillLeft(), 0);
+        checkAggregates(DB::Filter(), std::chrono::hours(1));
+        checkAggregates(DB::Filter(), std::chrono::hours(24));
+        CHECK_EQUALS(db.getAllMeasurementCount(), 5000u);
+
+        db.clearAllMeasurements();
+        CHECK_TRUE(db.getMeasurementAggregates(DB::Filter(), std::chrono::hours(24)).empty());
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting measurement partitions\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+        DB::PartitionSettings settings;
+        settings.period = DB::PartitionSettings::Period::Week;
+        settings.sealDelay = std::chrono::hours(24 * 2);
+        db.setPartitionSettings(settings);
+
+        //hourly measurements over almost 4 weeks, for the first 2 sensors
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::hours(1);
+        config.commsPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(24 * 7 * 4));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(0).id, firstIndex, 600)));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(1).id, firstIndex, 600)));
+
+        std::vector<DB::Measurement> all = db.getFilteredMeasurements(DB::Filter());
+        CHECK_EQUALS(all.size(), 1200u);
+        std::set<DB::MeasurementId> ids;
+        for (DB::Measurement const& m: all)
+            ids.insert(m.id);
+        CHECK_EQUALS(ids.size(), all.size());
+
+        //each partition has the measurements of its week, none are left in the main file
+        std::vector<DB::MeasurementPartition> partitions = db.getMeasurementPartitions();
+        CHECK_TRUE(partitions.size() >= 4);
+        sqlite3* sqlite = db.getSqliteDB();
+        auto countRows = [sqlite](std::string const& table, IClock::time_point min, IClock::time_point max)
+        {
+            sqlite3_stmt* stmt;
+            std::string sql = "SELECT COUNT(*), COUNT(CASE WHEN timePoint >= ?1 AND timePoint < ?2 THEN 1 END) FROM " + table + ";";
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, sql.c_str(), -1, &stmt, nullptr), SQLITE_OK);
+            sqlite3_bind_int64(stmt, 1, IClock::to_time_t(min));
+            sqlite3_bind_int64(stmt, 2, IClock::to_time_t(max));
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            CHECK_EQUALS(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+            size_t count = size_t(sqlite3_column_int64(stmt, 0));
+            sqlite3_finalize(stmt);
+            return count;
+        };
+        size_t partitionedCount = 0;
+        for (size_t i = 0; i < partitions.size(); i++)
+        {
+            CHECK_TRUE(QFileInfo::exists(partitions[i].filename.c_str()));
+            CHECK_TRUE(partitions[i].begin < partitions[i].end);
+            if (i > 0)
+                CHECK_TRUE(partitions[i - 1].end <= partitions[i].begin);
+            partitionedCount += countRows(partitions[i].name + ".Measurements", partitions[i].begin, partitions[i].end);
+        }
+        CHECK_EQUALS(partitionedCount, all.size());
+        CHECK_EQUALS(countRows("main.Measurements", IClock::time_point(), IClock::time_point::max()), 0u);
+
+        //the queries merge the partitions in order
+        DB::Filter filter;
+        filter.sortBy = DB::Filter::SortBy::Timestamp;
+        filter.sortOrder = DB::Filter::SortOrder::Descending;
+        std::vector<DB::Measurement> sorted = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(sorted.size(), all.size());
+        for (size_t i = 1; i < sorted.size(); i++)
+            CHECK_TRUE(sorted[i - 1].timePoint >= sorted[i].timePoint);
+        DB::MeasurementCursor cursor;
+        std::vector<DB::Measurement> paged;
+        while (true)
+        {
+            std::vector<DB::Measurement> page = db.getFilteredMeasurements(filter, cursor, 77);
+            paged.insert(paged.end(), page.begin(), page.end());
+            if (page.size() < 77)
+                break;
+        }
+        CHECK_EQUALS(paged.size(), sorted.size());
+        for (size_t i = 0; i < paged.size(); i++)
+            CHECK_EQUALS(paged[i].id, sorted[i].id);
+
+        //a window across the boundary of two partitions
+        filter.useTimePointFilter = true;
+        filter.timePointFilter.min = partitions[1].end - std::chrono::hours(30) + std::chrono::minutes(20);
+        filter.timePointFilter.max = partitions[1].end + std::chrono::hours(30);
+        size_t expected = 0;
+        for (DB::Measurement const& m: all)
+        {
+            if (m.timePoint >= filter.timePointFilter.min && m.timePoint <= filter.timePointFilter.max)
+                expected++;
+        }
+        CHECK_TRUE(expected > 0);
+        CHECK_EQUALS(db.getFilteredMeasurements(filter).size(), expected);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), expected);
+        size_t aggregated = 0;
+        for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(24)))
+            aggregated += a.count;
+        CHECK_EQUALS(aggregated, expected);
+
+        //the sensor 2 misses its first measurements, the ones after are in the first partition
+        DB::SensorId sensorId2 = db.getSensor(2).id;
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId2, firstIndex + 5, 5)));
+        db.flushMeasurements();
+
+        //the weeks that ended more than the delay ago get sealed
+        db.process();
+        partitions = db.getMeasurementPartitions();
+        for (DB::MeasurementPartition const& partition: partitions)
+            CHECK_EQUALS(partition.sealed, partition.end + settings.sealDelay <= clock->now());
+        CHECK_TRUE(partitions.front().sealed);
+        CHECK_FALSE(partitions.back().sealed);
+
+        //late measurements of a sealed week go to the main file, the resent ones stay in the partition
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId2, firstIndex, 10)));
+        filter = DB::Filter();
+        filter.useSensorFilter = true;
+        filter.sensorIds = { sensorId2 };
+        std::vector<DB::Measurement> late = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(late.size(), 10u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), 10u);
+        CHECK_EQUALS(countRows("main.Measurements", IClock::time_point(), IClock::time_point::max()), 5u);
+        for (DB::Measurement const& m: late)
+            CHECK_TRUE(ids.insert(m.id).second);
+
+        //sealed partitions are backed up once, until they change
+        db.setMeasurementPartitionBackedUp(partitions.front().name);
+        CHECK_TRUE(db.getMeasurementPartitions().front().backedUp);
+        DB::Measurement first = db.getFilteredMeasurements(DB::Filter(), 0, 1).front();
+        CHECK_TRUE(first.timePoint < partitions.front().end);
+        DB::MeasurementDescriptor md = first.descriptor;
+        md.temperature = 99.f;
+        CHECK_TRUE(db.setMeasurement(first.id, md) == success);
+        Result<DB::Measurement> edited = db.findMeasurementById(first.id);
+        CHECK_TRUE(edited == success);
+        CHECK_EQUALS(edited.payload().descriptor.temperature, 99.f);
+        CHECK_FALSE(db.getMeasurementPartitions().front().backedUp);
+
+        //the partitions and the ids survive a reload
+        closeDB(db);
+        loadDB(db);
+        CHECK_EQUALS(db.getMeasurementPartitions().size(), partitions.size());
+        CHECK_TRUE(db.getMeasurementPartitions().front().sealed);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 1210u);
+
+        //a write that committed in the main file but not in the partition: its rollups are recomputed on load
+        closeDB(db);
+        {
+            sqlite3* sqlite;
+            CHECK_EQUALS(sqlite3_open_v2("test.db", &sqlite, SQLITE_OPEN_READWRITE, nullptr), SQLITE_OK);
+            std::string sql = "UPDATE MeasurementPartitions SET commitId = commitId + 1 WHERE name = '" + partitions[1].name + "';"
+                              "UPDATE MeasurementRollupsHourly SET count = count + 7, keptCount = keptCount + 7 WHERE timePoint >= " + std::to_string(IClock::to_time_t(partitions[1].begin)) +
+                              " AND timePoint < " + std::to_string(IClock::to_time_t(partitions[1].end)) + ";";
+            CHECK_EQUALS(sqlite3_exec(sqlite, sql.c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_close(sqlite), SQLITE_OK);
+        }
+        loadDB(db);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 1210u);
+        size_t aggregatedAll = 0;
+        for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(DB::Filter(), std::chrono::hours(24)))
+            aggregatedAll += a.count;
+        CHECK_EQUALS(aggregatedAll, 1210u);
+        clock->advance(std::chrono::hours(2));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId2, firstIndex + 10, 1)));
+        late = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(late.size(), 11u);
+        CHECK_TRUE(*ids.rbegin() < std::max_element(late.begin(), late.end(), [](DB::Measurement const& a, DB::Measurement const& b) { return a.id < b.id; })->id);
+
+        db.removeSensor(0);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 611u);
+        db.clearAllMeasurements();
+        CHECK_TRUE(db.getFilteredMeasurements(DB::Filter()).empty());
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting the measurement partitions limit\n";
+        std::shared_ptr<ManualClock> clock = createTestClock();
+        DB db(clock);
+        createDBWithSensors(db, 1, clock->now());
+        DB::PartitionSettings settings;
+        settings.period = DB::PartitionSettings::Period::Week;
+        db.setPartitionSettings(settings);
+        //instead of the hundreds of weeks it takes with the default
+        sqlite3_limit(db.getSqliteDB(), SQLITE_LIMIT_ATTACHED, 2);
+
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::hours(1);
+        config.commsPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(24 * 7 * 5));
+        DB::SensorId sensorId = db.getSensor(0).id;
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, firstIndex + 5, 800)));
+        db.flushMeasurements();
+
+        //the oldest weeks were merged into the main file
+        std::vector<DB::MeasurementPartition> partitions = db.getMeasurementPartitions();
+        CHECK_EQUALS(partitions.size(), 2u);
+        CHECK_EQUALS(db.getFilteredMeasurements(DB::Filter()).size(), 800u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 800u);
+        CHECK_TRUE(QFileInfo::exists(partitions[0].filename.c_str()));
+        CHECK_EQUALS(QDir(".").entryList(QStringList() << "test_measurements_*.db", QDir::Files).size(), 2);
+
+        //the measurements of the merged weeks stay in the main file, after a reload too
+        closeDB(db);
+        loadDB(db);
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, firstIndex, 5)));
+        CHECK_EQUALS(db.getMeasurementPartitions().size(), 2u);
+        CHECK_EQUALS(db.getFilteredMeasurements(DB::Filter()).size(), 805u);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 805u);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting measurement chunks\n";
+        {
+            //the odd values round trip bit for bit
+            std::vector<DB::Measurement> measurements;
+            for (uint32_t i = 0; i < 300; i++)
+            {
+                DB::Measurement m;
+                m.id = DB::MeasurementId(1000000000000ULL + i * 37 + (i % 3));
+                m.descriptor.sensorId = 7;
+                m.descriptor.index = 4000000000u - 1000 + i * (i % 5 == 0 ? 3 : 1);
+                m.descriptor.temperature = i == 10 ? std::numeric_limits<float>::quiet_NaN() : i == 11 ? -0.f : -40.f + float(i) / 7.f;
+                m.descriptor.humidity = float(i % 100) * 0.01f;
+                m.descriptor.vcc = i == 12 ? std::numeric_limits<float>::infinity() : 3.3f;
+                m.descriptor.signalStrength = { int16_t(-100 + int(i % 7)), int16_t(i == 13 ? 32767 : -90) };
+                m.descriptor.sensorErrors = i == 14 ? 0xFFFFFFFFu : 0;
+                m.timePoint = IClock::from_time_t(1600000000 + int64_t(i) * 300 - (i == 50 ? 100000 : 0));
+                m.receivedTimePoint = m.timePoint + std::chrono::seconds(i % 12 * 300);
+                m.alarmTriggers = { i % 20 < 5 ? 3u : 0u, i % 20 == 0 ? 3u : 0u, i % 20 == 5 ? 3u : 0u };
+                measurements.push_back(m);
+            }
+            std::vector<uint8_t> data = chunk::encode(measurements);
+            CHECK_TRUE(data.size() < measurements.size() * 16);
+            std::vector<DB::Measurement> decoded;
+            CHECK_TRUE(chunk::decode(data.data(), data.size(), decoded));
+            CHECK_EQUALS(decoded.size(), measurements.size());
+            for (size_t i = 0; i < decoded.size(); i++)
+            {
+                DB::Measurement const& a = measurements[i];
+                DB::Measurement const& b = decoded[i];
+                CHECK_EQUALS(b.id, a.id);
+                CHECK_EQUALS(b.descriptor.sensorId, a.descriptor.sensorId);
+                CHECK_EQUALS(b.descriptor.index, a.descriptor.index);
+                CHECK_EQUALS(memcmp(&b.descriptor.temperature, &a.descriptor.temperature, sizeof(float)), 0);
+                CHECK_EQUALS(memcmp(&b.descriptor.humidity, &a.descriptor.humidity, sizeof(float)), 0);
+                CHECK_EQUALS(memcmp(&b.descriptor.vcc, &a.descriptor.vcc, sizeof(float)), 0);
+                CHECK_EQUALS(b.descriptor.signalStrength.s2b, a.descriptor.signalStrength.s2b);
+                CHECK_EQUALS(b.descriptor.signalStrength.b2s, a.descriptor.signalStrength.b2s);
+                CHECK_EQUALS(b.descriptor.sensorErrors, a.descriptor.sensorErrors);
+                CHECK_TRUE(b.timePoint == a.timePoint);
+                CHECK_TRUE(b.receivedTimePoint == a.receivedTimePoint);
+                CHECK_TRUE(b.alarmTriggers == a.alarmTriggers);
+            }
+            CHECK_FALSE(chunk::decode(data.data(), data.size() / 2, decoded));
+        }
+
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+
+        //hourly measurements over 20 days, the second sensor's off the 0.01 grid
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::hours(1);
+        config.commsPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(24 * 20));
+        DB::SensorId sensorId0 = db.getSensor(0).id;
+        DB::SensorId sensorId1 = db.getSensor(1).id;
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, firstIndex, 470)));
+        std::vector<DB::MeasurementDescriptor> mds = makeMeasurements(sensorId1, firstIndex, 470);
+        for (size_t i = 0; i < mds.size(); i++)
+            mds[i].temperature = 20.f + float(i) / 7.f;
+        CHECK_TRUE(db.addMeasurements(mds));
+
+        auto byId = [](DB::Measurement const& a, DB::Measurement const& b) { return a.id < b.id; };
+        std::vector<DB::Measurement> before = db.getFilteredMeasurements(DB::Filter());
+        std::sort(before.begin(), before.end(), byId);
+        CHECK_EQUALS(before.size(), 940u);
+
+        //the last 10 days stay rows
+        DB::ColdStorageSettings settings;
+        settings.compressAfter = std::chrono::hours(24 * 10);
+        db.setColdStorageSettings(settings);
+        db.process();
+
+        sqlite3* sqlite = db.getSqliteDB();
+        auto countChunked = [&sqlite]()
+        {
+            sqlite3_stmt* stmt;
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT TOTAL(count) FROM MeasurementChunks;", -1, &stmt, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            size_t count = size_t(sqlite3_column_int64(stmt, 0));
+            sqlite3_finalize(stmt);
+            return count;
+        };
+        IClock::time_point cutoff = clock->now() - settings.compressAfter;
+        size_t cold = 0;
+        for (DB::Measurement const& m: before)
+            cold += m.timePoint < cutoff ? 1 : 0;
+        CHECK_TRUE(cold > 0 && cold < before.size());
+        CHECK_EQUALS(countChunked(), cold);
+
+        //read back like before
+        std::vector<DB::Measurement> after = db.getFilteredMeasurements(DB::Filter());
+        std::sort(after.begin(), after.end(), byId);
+        CHECK_EQUALS(after.size(), before.size());
+        for (size_t i = 0; i < after.size(); i++)
+        {
+            CHECK_EQUALS(after[i].id, before[i].id);
+            CHECK_EQUALS(after[i].descriptor.sensorId, before[i].descriptor.sensorId);
+            CHECK_EQUALS(after[i].descriptor.index, before[i].descriptor.index);
+            CHECK_EQUALS(after[i].descriptor.temperature, before[i].descriptor.temperature);
+            CHECK_EQUALS(after[i].descriptor.humidity, before[i].descriptor.humidity);
+            CHECK_TRUE(after[i].timePoint == before[i].timePoint);
+            CHECK_TRUE(after[i].receivedTimePoint == before[i].receivedTimePoint);
+            CHECK_TRUE(after[i].alarmTriggers == before[i].alarmTriggers);
+        }
+
+        //a window of a sensor across the cutoff, sorted and paged
+        DB::Filter filter;
+        filter.sortBy = DB::Filter::SortBy::Temperature;
+        filter.useSensorFilter = true;
+        filter.sensorIds = { sensorId1 };
+        filter.useTimePointFilter = true;
+        filter.timePointFilter.min = cutoff - std::chrono::hours(50) + std::chrono::minutes(20);
+        filter.timePointFilter.max = cutoff + std::chrono::hours(30);
+        size_t expected = 0;
+        for (DB::Measurement const& m: before)
+        {
+            if (m.descriptor.sensorId == sensorId1 && m.timePoint >= filter.timePointFilter.min && m.timePoint <= filter.timePointFilter.max)
+                expected++;
+        }
+        CHECK_EQUALS(expected, 80u);
+        std::vector<DB::Measurement> sorted = db.getFilteredMeasurements(filter);
+        CHECK_EQUALS(sorted.size(), expected);
+        for (size_t i = 1; i < sorted.size(); i++)
+            CHECK_TRUE(sorted[i - 1].descriptor.temperature <= sorted[i].descriptor.temperature);
+        DB::MeasurementCursor cursor;
+        std::vector<DB::Measurement> paged;
+        while (true)
+        {
+            std::vector<DB::Measurement> page = db.getFilteredMeasurements(filter, cursor, 7);
+            paged.insert(paged.end(), page.begin(), page.end());
+            if (page.size() < 7)
+                break;
+        }
+        CHECK_EQUALS(paged.size(), sorted.size());
+        for (size_t i = 0; i < paged.size(); i++)
+            CHECK_EQUALS(paged[i].id, sorted[i].id);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), expected);
+        size_t aggregated = 0;
+        for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(24)))
+            aggregated += a.count;
+        CHECK_EQUALS(aggregated, expected);
+
+        //editing a compressed measurement rewrites its chunk
+        DB::Measurement first = before.front();
+        CHECK_TRUE(first.timePoint < cutoff);
+        DB::MeasurementDescriptor md = first.descriptor;
+        md.temperature = 99.f;
+        CHECK_TRUE(db.setMeasurement(first.id, md) == success);
+        Result<DB::Measurement> edited = db.findMeasurementById(first.id);
+        CHECK_TRUE(edited == success);
+        CHECK_EQUALS(edited.payload().descriptor.temperature, 99.f);
+        CHECK_EQUALS(edited.payload().descriptor.index, first.descriptor.index);
+        CHECK_EQUALS(countChunked(), cold);
+
+        //the chunks and the ids survive a reload
+        closeDB(db);
+        loadDB(db);
+        sqlite = db.getSqliteDB();
+        CHECK_EQUALS(db.getFilteredMeasurements(DB::Filter()).size(), before.size());
+        edited = db.findMeasurementById(first.id);
+        CHECK_TRUE(edited == success);
+        CHECK_EQUALS(edited.payload().descriptor.temperature, 99.f);
+        clock->advance(std::chrono::hours(2));
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, firstIndex + 470, 1)));
+        filter = DB::Filter();
+        filter.sortBy = DB::Filter::SortBy::Id;
+        filter.sortOrder = DB::Filter::SortOrder::Descending;
+        CHECK_TRUE(db.getFilteredMeasurements(filter, 0, 1).front().id > before.back().id);
+
+        db.removeSensor(0);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), 470u);
+        CHECK_TRUE(countChunked() < cold);
+        db.clearAllMeasurements();
+        CHECK_TRUE(db.getFilteredMeasurements(DB::Filter()).empty());
+        CHECK_EQUALS(countChunked(), 0u);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting retention policies\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+
+        //every 10 minutes over 30 days
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::minutes(10);
+        config.commsPeriod = std::chrono::minutes(10);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(24 * 30));
+        DB::SensorId sensorId0 = db.getSensor(0).id;
+        DB::SensorId sensorId1 = db.getSensor(1).id;
+        DB::SensorId sensorId2 = db.getSensor(2).id;
+        for (DB::SensorId sensorId: { sensorId0, sensorId1, sensorId2 })
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId, firstIndex, 30 * 144)));
+        std::vector<DB::Measurement> before = db.getFilteredMeasurements(DB::Filter());
+        CHECK_EQUALS(before.size(), 3u * 30 * 144);
+
+        //the oldest are in chunks, so both kinds of storage are trimmed
+        DB::ColdStorageSettings coldSettings;
+        coldSettings.compressAfter = std::chrono::hours(24 * 15);
+        db.setColdStorageSettings(coldSettings);
+        db.process();
+
+        sqlite3* sqlite = db.getSqliteDB();
+        auto getPages = [&sqlite](const char* pragma)
+        {
+            int64_t pages = 0;
+            std::vector<std::string> schemas;
+            sqlite3_stmt* stmt;
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "SELECT name FROM pragma_database_list WHERE name != 'temp';", -1, &stmt, nullptr), SQLITE_OK);
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+                schemas.push_back((char const*)sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+            for (std::string const& schema: schemas)
+            {
+                CHECK_EQUALS(sqlite3_prepare_v2(sqlite, ("PRAGMA " + schema + "." + pragma + ";").c_str(), -1, &stmt, nullptr), SQLITE_OK);
+                CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+                pages += sqlite3_column_int64(stmt, 0);
+                sqlite3_finalize(stmt);
+            }
+            return pages;
+        };
+        CHECK_EQUALS(getPages("auto_vacuum"), 2 * int64_t(1 + db.getMeasurementPartitions().size()));
+
+        //the files from before the incremental auto vacuum are converted when loaded
+        {
+            std::vector<std::string> schemas = { "main" };
+            for (DB::MeasurementPartition const& partition: db.getMeasurementPartitions())
+                schemas.push_back(partition.name);
+            for (std::string const& schema: schemas)
+                CHECK_EQUALS(sqlite3_exec(sqlite, ("PRAGMA " + schema + ".auto_vacuum = NONE; VACUUM " + schema + ";").c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+            CHECK_EQUALS(getPages("auto_vacuum"), 0);
+            closeDB(db);
+            loadDB(db);
+            sqlite = db.getSqliteDB();
+            CHECK_EQUALS(getPages("auto_vacuum"), 2 * int64_t(1 + db.getMeasurementPartitions().size()));
+        }
+        int64_t pagesBefore = getPages("page_count");
+
+        std::vector<DB::RetentionPolicy> policies(2);
+        policies[0].name = "decimated";
+        policies[0].filterSensors = true;
+        policies[0].sensors = { sensorId0 };
+        policies[0].keepRaw = std::chrono::hours(24 * 10);
+        policies[0].downsampling = DB::RetentionPolicy::Downsampling::Decimate;
+        policies[0].decimationPeriod = std::chrono::hours(1);
+        policies[0].keepDownsampled = std::chrono::hours(24 * 20);
+        policies[1] = policies[0];
+        policies[1].name = "rollups";
+        policies[1].sensors = { sensorId0, sensorId1 }; //the first policy wins for sensor 0
+        policies[1].downsampling = DB::RetentionPolicy::Downsampling::Rollups;
+        {
+            std::vector<DB::RetentionPolicy> invalid = policies;
+            invalid[1].keepDownsampled = std::chrono::hours(24);
+            CHECK_FAILURE(db.setRetentionPolicies(invalid));
+            CHECK_TRUE(db.getRetentionPolicies().empty());
+        }
+        CHECK_SUCCESS(db.setRetentionPolicies(policies));
+        for (size_t i = 0; i < 100 && db.computeTimeUntilNextEvent() == IClock::duration::zero(); i++)
+            db.process();
+        CHECK_TRUE(db.computeTimeUntilNextEvent() > IClock::duration::zero());
+
+        //the cutoffs are at the start of the UTC days
+        auto alignDown = [](IClock::time_point tp)
+        {
+            int64_t t = IClock::to_time_t(tp);
+            return IClock::from_time_t(t - t % (24 * 3600));
+        };
+        IClock::time_point dropCutoff = alignDown(clock->now() - policies[0].keepDownsampled);
+        IClock::time_point rawCutoff = alignDown(clock->now() - policies[0].keepRaw);
+        std::vector<DB::Measurement> expected;
+        std::set<std::pair<DB::SensorId, int64_t>> hours;
+        std::sort(before.begin(), before.end(), [](DB::Measurement const& a, DB::Measurement const& b) { return a.timePoint < b.timePoint; });
+        for (DB::Measurement const& m: before)
+        {
+            bool keep = m.descriptor.sensorId == sensorId2 || m.timePoint >= rawCutoff;
+            if (m.descriptor.sensorId == sensorId0 && m.timePoint >= dropCutoff && m.timePoint < rawCutoff)
+                keep = hours.insert(std::make_pair(m.descriptor.sensorId, IClock::to_time_t(m.timePoint) / 3600)).second;
+            if (keep)
+                expected.push_back(m);
+        }
+        auto byId = [](DB::Measurement const& a, DB::Measurement const& b) { return a.id < b.id; };
+        std::sort(expected.begin(), expected.end(), byId);
+        std::vector<DB::Measurement> after = db.getFilteredMeasurements(DB::Filter());
+        std::sort(after.begin(), after.end(), byId);
+        CHECK_EQUALS(after.size(), expected.size());
+        for (size_t i = 0; i < std::min(after.size(), expected.size()); i++)
+        {
+            CHECK_EQUALS(after[i].id, expected[i].id);
+            CHECK_EQUALS(after[i].descriptor.temperature, expected[i].descriptor.temperature);
+        }
+        CHECK_EQUALS(hours.size(), 10u * 24);
+
+        //the counts see the downsampling, the aggregates are still of all the raw measurements until they are dropped
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), expected.size());
+        DB::Filter filter;
+        filter.useSensorFilter = true;
+        filter.sensorIds = { sensorId1 };
+        filter.useTimePointFilter = true;
+        filter.timePointFilter.min = dropCutoff - std::chrono::hours(24 * 2);
+        filter.timePointFilter.max = rawCutoff + std::chrono::hours(24) - std::chrono::seconds(1);
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), 144u);
+        size_t aggregated = 0;
+        for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(24)))
+        {
+            CHECK_TRUE(a.timePoint >= dropCutoff);
+            aggregated += a.count;
+        }
+        CHECK_EQUALS(aggregated, 11u * 144);
+
+        //any sensors and time range, with partial days and hours at its ends
+        auto checkCount = [&db, &expected](DB::Filter const& f)
+        {
+            size_t count = size_t(std::count_if(expected.begin(), expected.end(), [&f](DB::Measurement const& m)
+            {
+                return (!f.useSensorFilter || f.sensorIds.count(m.descriptor.sensorId) > 0) &&
+                       (!f.useTimePointFilter || (m.timePoint >= f.timePointFilter.min && m.timePoint <= f.timePointFilter.max));
+            }));
+            CHECK_EQUALS(db.getFilteredMeasurementCount(f), count);
+        };
+        CHECK_EQUALS(db.getAllMeasurementCount(), expected.size());
+        for (std::set<DB::SensorId> sensorIds: { std::set<DB::SensorId>{ sensorId0 }, std::set<DB::SensorId>{ sensorId1, sensorId2 } })
+        {
+            for (int64_t minutes: { 0, 35, 24 * 60 + 5, 5 * 24 * 60 + 125 })
+            {
+                DB::Filter f;
+                f.useSensorFilter = true;
+                f.sensorIds = sensorIds;
+                f.useTimePointFilter = true;
+                f.timePointFilter.min = dropCutoff - std::chrono::hours(24) + std::chrono::minutes(minutes);
+                f.timePointFilter.max = rawCutoff + std::chrono::hours(24 * 3) + std::chrono::minutes(minutes * 3);
+                checkCount(f);
+                f.useSensorFilter = false;
+                checkCount(f);
+            }
+        }
+
+        //the freed pages are returned
+        CHECK_EQUALS(getPages("freelist_count"), 0);
+        CHECK_TRUE(getPages("page_count") < pagesBefore);
+
+        //rollups from before the kept counts get them on load, from the measurements left
+        for (std::string table: { "MeasurementRollupsHourly", "MeasurementRollupsDaily" })
+        {
+            std::string columns = "sensorId, timePoint, count, minTemperature, maxTemperature, sumTemperature, minHumidity, maxHumidity, sumHumidity, "
+                                  "minVcc, maxVcc, sumVcc, minSignalStrength, maxSignalStrength, sumSignalStrength, alarmTriggers";
+            std::string sql = "ALTER TABLE " + table + " RENAME TO OldRollups;"
+                              "CREATE TABLE " + table + " (" + columns + ", PRIMARY KEY (sensorId, timePoint)) WITHOUT ROWID;"
+                              "INSERT INTO " + table + " SELECT " + columns + " FROM OldRollups;"
+                              "DROP TABLE OldRollups;"
+                              "CREATE INDEX " + table + "TimePoint ON " + table + "(timePoint);";
+            CHECK_EQUALS(sqlite3_exec(sqlite, sql.c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+        }
+
+        //the new measurements are kept, the policies are kept over a reload
+        closeDB(db);
+        loadDB(db);
+        sqlite = db.getSqliteDB();
+        CHECK_EQUALS(db.getAllMeasurementCount(), expected.size());
+        CHECK_EQUALS(db.getFilteredMeasurementCount(filter), 144u);
+        std::vector<DB::RetentionPolicy> loaded = db.getRetentionPolicies();
+        CHECK_EQUALS(loaded.size(), 2u);
+        CHECK_TRUE(loaded[0].name == "decimated" && loaded[1].name == "rollups");
+        CHECK_TRUE(loaded[0].sensors == policies[0].sensors && loaded[1].sensors == policies[1].sensors);
+        CHECK_TRUE(loaded[0].downsampling == DB::RetentionPolicy::Downsampling::Decimate && loaded[0].decimationPeriod == policies[0].decimationPeriod);
+        CHECK_TRUE(loaded[1].keepRaw == policies[1].keepRaw && loaded[1].keepDownsampled == policies[1].keepDownsampled);
+        for (size_t i = 0; i < 100 && db.computeTimeUntilNextEvent() == IClock::duration::zero(); i++)
+            db.process();
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), expected.size());
+
+        //a day later, another day of each stage
+        clock->advance(std::chrono::hours(24));
+        for (size_t i = 0; i < 100 && db.computeTimeUntilNextEvent() == IClock::duration::zero(); i++)
+            db.process();
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), expected.size() - 24 - (144 - 24) - 144);
+
+        //once every sensor has a policy, the partitions that expired for all of them are detached and their files deleted
+        std::vector<DB::MeasurementPartition> partitions = db.getMeasurementPartitions();
+        std::vector<DB::RetentionPolicy> all(1);
+        all[0].name = "all";
+        all[0].keepRaw = std::chrono::hours(24 * 2);
+        all[0].keepDownsampled = std::chrono::hours(24 * 3);
+        CHECK_SUCCESS(db.setRetentionPolicies(all));
+        for (size_t i = 0; i < 100 && db.computeTimeUntilNextEvent() == IClock::duration::zero(); i++)
+            db.process();
+        size_t expired = 0;
+        for (DB::MeasurementPartition const& partition: partitions)
+        {
+            bool kept = partition.end > clock->now() - all[0].keepDownsampled;
+            std::vector<DB::MeasurementPartition> left = db.getMeasurementPartitions();
+            CHECK_EQUALS(std::any_of(left.begin(), left.end(), [&partition](DB::MeasurementPartition const& p) { return p.name == partition.name; }), kept);
+            CHECK_EQUALS(QFileInfo::exists(partition.filename.c_str()), kept);
+            expired += kept ? 0 : 1;
+        }
+        CHECK_TRUE(expired > 0);
+        std::vector<DB::Measurement> left = db.getFilteredMeasurements(DB::Filter());
+        CHECK_TRUE(!left.empty());
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), left.size());
+        CHECK_EQUALS(db.getAllMeasurementCount(), left.size());
+        for (DB::Measurement const& m: left)
+            CHECK_TRUE(m.timePoint >= alignDown(clock->now() - all[0].keepRaw));
+
+        CHECK_SUCCESS(db.setRetentionPolicies({}));
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting time windows as index ranges\n";
+        std::shared_ptr<ManualClock> clock = createTestClock();
+        DB db(clock);
+        const size_t sensorCount = 40;
+        createDBWithSensors(db, sensorCount, clock->now());
+
+        //the measurement period changes half way, so the window spans two time configs
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::minutes(5);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        clock->advance(std::chrono::hours(24 * 2));
+        for (size_t i = 0; i < sensorCount; i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, 500)));
+        config.measurementPeriod = std::chrono::seconds(70);
+        config.commsPeriod = std::chrono::minutes(5);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(12));
+        for (size_t i = 0; i < sensorCount; i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, firstIndex, 500)));
+
+        std::vector<DB::Measurement> all = db.getFilteredMeasurements(DB::Filter());
+        CHECK_EQUALS(all.size(), sensorCount * 1000);
+        IClock::time_point first = all.front().timePoint;
+        for (DB::Measurement const& m: all)
+            first = std::min(first, m.timePoint);
+
+        //compares the queries against filtering all the measurements
+        auto checkWindow = [&db, &all](DB::Filter filter, bool planned)
+        {
+            std::set<DB::MeasurementId> expected;
+            for (DB::Measurement const& m: all)
+            {
+                if (m.timePoint >= filter.timePointFilter.min && m.timePoint <= filter.timePointFilter.max &&
+                    filter.sensorIds.count(m.descriptor.sensorId) > 0)
+                    expected.insert(m.id);
+            }
+
+            std::optional<DB::MeasurementIndexRange> range = db.computeMeasurementIndexRange(filter.timePointFilter.min, filter.timePointFilter.max);
+            CHECK_TRUE(range.has_value());
+            for (DB::Measurement const& m: all)
+            {
+                if (expected.count(m.id) > 0 && planned)
+                    CHECK_TRUE(m.descriptor.index >= range->min && m.descriptor.index <= range->max);
+            }
+
+            std::vector<DB::Measurement> result = db.getFilteredMeasurements(filter);
+            CHECK_EQUALS(result.size(), expected.size());
+            for (DB::Measurement const& m: result)
+                CHECK_TRUE(expected.count(m.id) > 0);
+            CHECK_EQUALS(db.getFilteredMeasurementCount(filter), expected.size());
+
+            size_t aggregated = 0;
+            for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(1)))
+                aggregated += a.count;
+            CHECK_EQUALS(aggregated, expected.size());
+
+            filter.sortBy = DB::Filter::SortBy::Temperature;
+            size_t visited = 0;
+            CHECK_TRUE(db.visitFilteredMeasurements(filter, DB::MeasurementColumn::All, [&](DB::Measurement const& m)
+            {
+                CHECK_TRUE(expected.count(m.id) > 0);
+                visited++;
+                return true;
+            }));
+            CHECK_EQUALS(visited, expected.size());
+        };
+
+        DB::Filter filter;
+        filter.useSensorFilter = true;
+        filter.sensorIds = { db.getSensor(1).id, db.getSensor(7).id };
+        filter.useTimePointFilter = true;
+        filter.timePointFilter.min = first + std::chrono::hours(20) + std::chrono::seconds(13);
+        filter.timePointFilter.max = first + std::chrono::hours(24 * 2 + 3) + std::chrono::seconds(29);
+        checkWindow(filter, true);
+
+        //windows on the ends, before all the measurements and after them
+        filter.timePointFilter.min = first;
+        filter.timePointFilter.max = first;
+        checkWindow(filter, true);
+        filter.timePointFilter.min = first - std::chrono::hours(24);
+        filter.timePointFilter.max = first - std::chrono::hours(1);
+        checkWindow(filter, true);
+        filter.timePointFilter.min = clock->now() + std::chrono::hours(24 * 365);
+        filter.timePointFilter.max = clock->now() + std::chrono::hours(24 * 366);
+        checkWindow(filter, true);
+
+        //the stored time points don't follow changed time configs, the queries fall back to them
+        std::vector<DB::SensorTimeConfig> configs;
+        for (size_t i = 0; i < db.getSensorTimeConfigCount(); i++)
+            configs.push_back(db.getSensorTimeConfig(i));
+        configs.back().descriptor.measurementPeriod = std::chrono::seconds(10);
+        CHECK_SUCCESS(db.setSensorTimeConfigs(configs));
+        filter.timePointFilter.min = first + std::chrono::hours(24 * 2 + 1);
+        filter.timePointFilter.max = first + std::chrono::hours(24 * 2 + 5);
+        checkWindow(filter, false);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting queries during ingest\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        const size_t sensorCount = 100;
+        const uint32_t rounds = 20;
+        createDBWithSensors(db, sensorCount, clock->now());
+        //like the manager does
+        CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+        clock->advance(std::chrono::hours(24 * 30));
+
+        std::vector<DB::SensorId> sensorIds;
+        for (size_t i = 0; i < sensorCount; i++)
+            sensorIds.push_back(db.getSensor(i).id);
+
+        std::atomic_bool done = { false };
+        std::thread comms([&]
+        {
+            for (uint32_t r = 0; r < rounds; r++)
+            {
+                for (DB::SensorId sensorId: sensorIds)
+                    CHECK_TRUE(db.addSingleSensorMeasurements(sensorId, makeMeasurements(sensorId, r * 12 + 1, 12)));
+            }
+            done = true;
+        });
+
+        //the queries see a growing, consistent view of the measurements
+        std::atomic<size_t> queryCount = { 0 };
+        auto query = [&]
+        {
+            size_t lastCount = 0;
+            while (!done)
+            {
+                DB::Filter filter;
+                filter.sortBy = DB::Filter::SortBy::Id;
+                size_t count = db.getFilteredMeasurementCount(filter);
+                CHECK_TRUE(count >= lastCount);
+                lastCount = count;
+
+                std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+                CHECK_TRUE(all.size() >= count);
+
+                DB::MeasurementId lastId = 0;
+                size_t visited = 0;
+                CHECK_TRUE(db.visitFilteredMeasurements(filter, DB::MeasurementColumn::Index, [&](DB::Measurement const& m)
+                {
+                    CHECK_TRUE(m.id > lastId);
+                    lastId = m.id;
+                    visited++;
+                    return true;
+                }));
+                CHECK_TRUE(visited >= all.size());
+
+                size_t aggregated = 0;
+                for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(DB::Filter(), std::chrono::hours(24)))
+                    aggregated += a.count;
+                CHECK_TRUE(aggregated >= visited);
+
+                s_logger.getFilteredLogLines(Logger::Filter());
+                queryCount++;
+            }
+        };
+        std::thread query0(query);
+        std::thread query1(query);
+        while (!done)
+        {
+            db.process();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        comms.join();
+        query0.join();
+        query1.join();
+        CHECK_TRUE(queryCount > 0);
+
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), sensorCount * rounds * 12);
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting cancelled queries\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        const size_t sensorCount = 10;
+        const uint32_t measurementsPerSensor = 10000;
+        createDBWithSensors(db, sensorCount, clock->now());
+        CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+        clock->advance(std::chrono::hours(24 * 60));
+        for (size_t i = 0; i < sensorCount; i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, measurementsPerSensor)));
+        db.flushMeasurements();
+        const size_t total = sensorCount * measurementsPerSensor;
+        CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter()), total);
+
+        //cancelled before it starts, nothing is read
+        {
+            DB::QueryToken token;
+            token.cancel();
+            DB::MeasurementCursor cursor;
+            CHECK_TRUE(db.getFilteredMeasurements(DB::Filter(), cursor, 100, &token).empty());
+            CHECK_FALSE(cursor.isValid);
+            CHECK_EQUALS(db.getFilteredMeasurementCount(DB::Filter(), &token), size_t(0));
+            CHECK_TRUE(db.getMeasurementAggregates(DB::Filter(), std::chrono::hours(1), &token).empty());
+            CHECK_FALSE(db.visitFilteredMeasurements(DB::Filter(), DB::MeasurementColumn::All, [](DB::Measurement const&) { return true; }, &token));
+        }
+
+        //a newer query cancels the one running, only the newer one gives a result
+        {
+            QueryWorker worker;
+            std::future<std::optional<int>> older = worker.run<int>([](DB::QueryToken const& token)
+            {
+                while (!token.isCancelled())
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return 0;
+            });
+            std::future<std::optional<size_t>> newer = worker.run<size_t>([&db](DB::QueryToken const& token)
+            {
+                return db.getFilteredMeasurementCount(DB::Filter(), &token);
+            });
+            CHECK_FALSE(older.get().has_value());
+            std::optional<size_t> count = newer.get();
+            CHECK_TRUE(count.has_value());
+            CHECK_EQUALS(*count, total);
+        }
+
+        //interrupted while sqlite reads all of them, before the first row
+        {
+            DB::Filter filter;
+            filter.sortBy = DB::Filter::SortBy::Temperature;
+            QueryWorker worker;
+            std::atomic_bool started = { false };
+            std::future<std::optional<size_t>> future = worker.run<size_t>([&](DB::QueryToken const& token)
+            {
+                started = true;
+                DB::MeasurementCursor cursor;
+                return db.getFilteredMeasurements(filter, cursor, 0, &token).size();
+            });
+            while (!started)
+                std::this_thread::yield();
+            worker.cancel();
+            CHECK_FALSE(future.get().has_value());
+
+            //the connection is fine for the next query
+            DB::MeasurementCursor cursor;
+            CHECK_EQUALS(db.getFilteredMeasurements(filter, cursor, 0).size(), total);
+        }
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting the alarm triggers at ingest\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24));
+        DB::SensorId sensorId0 = db.getSensor(0).id;
+        DB::SensorId sensorId1 = db.getSensor(1).id;
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "high temperature";
+        alarm.highTemperatureWatch = true;
+        alarm.highTemperatureSoft = 25.f;
+        alarm.highTemperatureHard = 100.f;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+        db.process();
+
+        //the alarm triggers before any process, and the rows are written with their triggers
+        CHECK_TRUE(db.addMeasurements(makeMeasurements(sensorId0, 1, 20)));
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.count(sensorId0), 1u);
+        CHECK_EQUALS(db.getSensor(0).lastAlarmProcessesMeasurementIndex, 20u);
+        db.flushMeasurements();
+
+        auto checkTriggers = [&db](DB::SensorId sensorId, uint32_t count)
+        {
+            DB::Filter filter;
+            filter.useSensorFilter = true;
+            filter.sensorIds = { sensorId };
+            std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+            CHECK_EQUALS(all.size(), count);
+            for (DB::Measurement const& m: all)
+            {
+                //the temperature goes from 20 to 29, from the 6th measurement on it's high
+                bool high = m.descriptor.temperature >= 25.f;
+                bool wasHigh = m.descriptor.index > 1 && (m.descriptor.index - 2) % 10 >= 5;
+                CHECK_EQUALS(m.alarmTriggers.current, high ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.added, high && !wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.removed, !high && wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+            }
+
+            //and the rollups get them in the same transaction
+            uint32_t rollupTriggers = 0;
+            for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(1)))
+                rollupTriggers |= a.alarmTriggers;
+            CHECK_EQUALS(rollupTriggers, uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft));
+        };
+        checkTriggers(sensorId0, 20);
+
+        //measurements stored before they are confirmed get their triggers when the resent ones confirm them
+        std::vector<DB::MeasurementDescriptor> mds = makeMeasurements(sensorId1, 1, 10);
+        CHECK_TRUE(db.addMeasurements(std::vector<DB::MeasurementDescriptor>(mds.begin() + 6, mds.end())));
+        CHECK_EQUALS(db.getSensor(1).lastConfirmedMeasurementIndex, 0u);
+        CHECK_TRUE(db.addMeasurements(mds));
+        CHECK_EQUALS(db.getSensor(1).lastAlarmProcessesMeasurementIndex, 10u);
+        db.flushMeasurements();
+        db.process();
+        checkTriggers(sensorId1, 10);
+
+        //the processed indices are saved with the alarm state
+        closeDB(db);
+        loadDB(db);
+        CHECK_EQUALS(db.getSensor(0).lastAlarmProcessesMeasurementIndex, 20u);
+        CHECK_EQUALS(db.getSensor(1).lastAlarmProcessesMeasurementIndex, 10u);
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.size(), 2u);
+        checkTriggers(sensorId0, 20);
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting the alarm triggers of backlogs\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        clock->advance(std::chrono::hours(24 * 3));
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "high temperature";
+        alarm.highTemperatureWatch = true;
+        alarm.highTemperatureSoft = 25.f;
+        alarm.highTemperatureHard = 100.f;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+        db.process();
+
+        //the sensors lost their first measurements, the ones they send are left to process. More than a block of each
+        const uint32_t lost = 10;
+        const uint32_t backlog = 600;
+        for (size_t i = 0; i < 2; i++)
+        {
+            DB::SensorInputDetails details;
+            details.id = db.getSensor(i).id;
+            details.hasStoredData = true;
+            details.firstStoredMeasurementIndex = lost + 1;
+            details.storedMeasurementCount = backlog;
+            CHECK_TRUE(db.setSensorInputDetails(details));
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(details.id, lost + 1, backlog)));
+            CHECK_EQUALS(db.getSensor(i).lastReceivedMeasurementIndex, lost + backlog);
+            CHECK_EQUALS(db.getSensor(i).lastAlarmProcessesMeasurementIndex, 0u);
+        }
+        db.process();
+
+        auto checkTriggers = [&db, lost, backlog](size_t sensorIndex)
+        {
+            DB::Filter filter;
+            filter.useSensorFilter = true;
+            filter.sensorIds = { db.getSensor(sensorIndex).id };
+            std::vector<DB::Measurement> all = db.getFilteredMeasurements(filter);
+            CHECK_EQUALS(all.size(), size_t(backlog));
+            for (DB::Measurement const& m: all)
+            {
+                uint32_t i = m.descriptor.index - lost - 1;
+                bool high = i % 10 >= 5;
+                bool wasHigh = i > 0 && (i - 1) % 10 >= 5;
+                CHECK_EQUALS(m.alarmTriggers.current, high ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.added, high && !wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.removed, !high && wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+            }
+        };
+        for (size_t i = 0; i < 2; i++)
+        {
+            CHECK_EQUALS(db.getSensor(i).lastAlarmProcessesMeasurementIndex, lost + backlog);
+            checkTriggers(i);
+        }
+        CHECK_EQUALS(db.getAlarm(0).triggersPerSensor.size(), 2u);
+
+        closeDB(db);
+        loadDB(db);
+        for (size_t i = 0; i < 2; i++)
+            CHECK_EQUALS(db.getSensor(i).lastAlarmProcessesMeasurementIndex, lost + backlog);
+        checkTriggers(1);
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting the alarm triggers backfill\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        createDBWithSensors(db, 2, clock->now());
+        //like the manager does, the blocks are read without the locks
+        CHECK_EQUALS(sqlite3_exec(db.getSqliteDB(), "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr), SQLITE_OK);
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "high temperature";
+        alarm.highTemperatureWatch = true;
+        alarm.highTemperatureSoft = 25.f;
+        alarm.highTemperatureHard = 100.f;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+
+        //hourly measurements over 20 days, the older half compressed
+        DB::SensorTimeConfigDescriptor config;
+        config.measurementPeriod = std::chrono::hours(1);
+        config.commsPeriod = std::chrono::hours(1);
+        CHECK_SUCCESS(db.addSensorTimeConfig(config));
+        uint32_t firstIndex = db.getLastSensorTimeConfig().baselineMeasurementIndex;
+        clock->advance(std::chrono::hours(24 * 20));
+        const uint32_t count = 470;
+        for (size_t i = 0; i < 2; i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, firstIndex, count)));
+        db.process();
+        DB::ColdStorageSettings settings;
+        settings.compressAfter = std::chrono::hours(24 * 10);
+        db.setColdStorageSettings(settings);
+        db.process();
+        for (size_t i = 0; i < 2; i++)
+            CHECK_EQUALS(db.getSensor(i).lastAlarmProcessesMeasurementIndex, firstIndex + count - 1);
+
+        //the measurements at or over the threshold, the ones out of the range keep the triggers of the old one
+        auto checkTriggers = [&db, firstIndex, count](uint32_t threshold, DB::Range<IClock::time_point> const& range, uint32_t oldThreshold)
+        {
+            std::vector<DB::Measurement> all = db.getFilteredMeasurements(DB::Filter());
+            CHECK_EQUALS(all.size(), size_t(2 * count));
+            for (DB::Measurement const& m: all)
+            {
+                uint32_t t = m.timePoint >= range.min && m.timePoint <= range.max ? threshold : oldThreshold;
+                uint32_t i = m.descriptor.index - firstIndex;
+                bool high = i % 10 >= t;
+                bool wasHigh = i > 0 && (i - 1) % 10 >= t;
+                CHECK_EQUALS(m.alarmTriggers.current, high ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.added, high && !wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+                CHECK_EQUALS(m.alarmTriggers.removed, !high && wasHigh ? uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft) : 0u);
+            }
+        };
+        DB::Range<IClock::time_point> everything = { IClock::time_point(IClock::duration::zero()), clock->now() };
+        checkTriggers(5, everything, 5);
+
+        //changing the alarm doesn't change the stored triggers, the backfill does
+        alarm.highTemperatureSoft = 27.f;
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(0).id, alarm));
+        db.process();
+        checkTriggers(5, everything, 5);
+        size_t lastDone = 0, lastTotal = 0;
+        Result<size_t> result = db.backfillAlarmTriggers(everything, [&](size_t done, size_t total)
+        {
+            CHECK_TRUE(done > lastDone);
+            lastDone = done;
+            lastTotal = total;
+        });
+        CHECK_TRUE(result == success);
+        CHECK_EQUALS(result.payload(), size_t(2 * count));
+        CHECK_EQUALS(lastDone, size_t(2 * count));
+        CHECK_EQUALS(lastTotal, size_t(2 * count));
+        checkTriggers(7, everything, 7);
+
+        //a window starting in the middle of the day, across the compressed measurements. The alarm starts from the measurement before it
+        alarm.highTemperatureSoft = 28.f;
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(0).id, alarm));
+        DB::Range<IClock::time_point> window = { clock->now() - std::chrono::hours(24 * 12 + 5) + std::chrono::minutes(30), clock->now() - std::chrono::hours(24 * 5) };
+        lastDone = 0;
+        result = db.backfillAlarmTriggers(window, [&](size_t done, size_t total)
+        {
+            CHECK_TRUE(done > lastDone);
+            lastDone = done;
+            lastTotal = total;
+        });
+        CHECK_TRUE(result == success);
+        CHECK_TRUE(result.payload() > 0 && result.payload() < size_t(2 * count));
+        CHECK_EQUALS(lastTotal, result.payload());
+        checkTriggers(8, window, 7);
+
+        //the rollups lose the triggers that went away. The alarm's own triggers are left alone
+        alarm.highTemperatureSoft = 35.f;
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(0).id, alarm));
+        std::map<DB::SensorId, uint32_t> triggersPerSensor = db.getAlarm(0).triggersPerSensor;
+        CHECK_SUCCESS(db.backfillAlarmTriggers(window));
+        checkTriggers(15, window, 7);
+        CHECK_TRUE(db.getAlarm(0).triggersPerSensor == triggersPerSensor);
+        DB::Filter filter;
+        filter.useTimePointFilter = true;
+        filter.timePointFilter = { IClock::from_time_t(IClock::to_time_t(window.min) / 86400 * 86400 + 86400), IClock::from_time_t(IClock::to_time_t(window.max) / 86400 * 86400 - 1) };
+        std::vector<DB::MeasurementAggregate> aggregates = db.getMeasurementAggregates(filter, std::chrono::hours(24));
+        CHECK_TRUE(!aggregates.empty());
+        for (DB::MeasurementAggregate const& a: aggregates)
+            CHECK_EQUALS(a.alarmTriggers, 0u);
+        for (DB::MeasurementAggregate const& a: db.getMeasurementAggregates(filter, std::chrono::hours(1)))
+            CHECK_EQUALS(a.alarmTriggers, 0u);
+        filter.timePointFilter = { everything.min, IClock::from_time_t(IClock::to_time_t(window.min) / 3600 * 3600 - 1) };
+        aggregates = db.getMeasurementAggregates(filter, std::chrono::hours(0));
+        CHECK_EQUALS(aggregates.size(), 2u);
+        for (DB::MeasurementAggregate const& a: aggregates)
+            CHECK_EQUALS(a.alarmTriggers, uint32_t(DB::AlarmTrigger::MeasurementHighTemperatureSoft));
+
+        //cancelled, nothing changes
+        alarm.highTemperatureSoft = 25.f;
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(0).id, alarm));
+        DB::QueryToken token;
+        token.cancel();
+        result = db.backfillAlarmTriggers(everything, nullptr, &token);
+        CHECK_TRUE(result == success);
+        CHECK_EQUALS(result.payload(), size_t(0));
+        checkTriggers(15, window, 7);
+
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting the sort indexes\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::hours(24 * 365 * 30));
+        DB db(clock);
+        const size_t sensorCount = 10;
+        createDBWithSensors(db, sensorCount, clock->now());
+        clock->advance(std::chrono::hours(24));
+        for (size_t i = 0; i < sensorCount; i++)
+            CHECK_TRUE(db.addMeasurements(makeMeasurements(db.getSensor(i).id, 1, 100)));
+        db.flushMeasurements();
+
+        //a time filter longer than the partitions it overlaps, and one of an hour
+        DB::Range<IClock::time_point> longRange = { clock->now() - std::chrono::hours(24 * 90), clock->now() + std::chrono::hours(24 * 90) };
+        DB::Range<IClock::time_point> shortRange = { clock->now() - std::chrono::hours(1), clock->now() };
+
+        //every file has them, the partition still written included
+        sqlite3* sqlite = db.getSqliteDB();
+        auto getSortIndexCount = [&sqlite](std::string const& schema)
+        {
+            sqlite3_stmt* stmt;
+            CHECK_EQUALS(sqlite3_prepare_v2(sqlite, ("SELECT COUNT(*) FROM " + schema + ".sqlite_master WHERE name LIKE 'measurementsSort%';").c_str(), -1, &stmt, nullptr), SQLITE_OK);
+            CHECK_EQUALS(sqlite3_step(stmt), SQLITE_ROW);
+            int64_t count = sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+            return count;
+        };
+        std::vector<DB::MeasurementPartition> partitions = db.getMeasurementPartitions();
+        CHECK_FALSE(partitions.empty());
+        CHECK_EQUALS(getSortIndexCount("main"), 7);
+        for (DB::MeasurementPartition const& partition: partitions)
+        {
+            CHECK_FALSE(partition.sealed);
+            CHECK_EQUALS(getSortIndexCount(partition.name), 7);
+        }
+
+        for (size_t sortBy = 0; sortBy <= size_t(DB::Filter::SortBy::Alarms); sortBy++)
+        {
+            for (DB::Filter::SortOrder sortOrder: { DB::Filter::SortOrder::Ascending, DB::Filter::SortOrder::Descending })
+            {
+                for (bool seekCursor: { false, true })
+                {
+                    DB::Filter filter;
+                    filter.sortBy = DB::Filter::SortBy(sortBy);
+                    filter.sortOrder = sortOrder;
+
+                    //every page walks the sort index, none sorts the rows
+                    for (bool useTimePointFilter: { false, true })
+                    {
+                        filter.useTimePointFilter = useTimePointFilter;
+                        filter.timePointFilter = longRange;
+                        std::vector<std::string> plan = db.getFilteredMeasurementsQueryPlan(filter, seekCursor);
+                        CHECK_FALSE(plan.empty());
+                        for (std::string const& line: plan)
+                        {
+                            CHECK_TRUE(line.find("TEMP B-TREE") == std::string::npos);
+                            //the id is the rowid, its scan is already in order
+                            if (filter.sortBy != DB::Filter::SortBy::Id)
+                                CHECK_TRUE(line.find("SCAN") == std::string::npos || line.find("INDEX") != std::string::npos);
+                        }
+                    }
+
+                    //the few rows of a short time filter are searched in an index, the timePoint one unless the cursor's range is shorter
+                    filter.useTimePointFilter = true;
+                    filter.timePointFilter = shortRange;
+                    std::vector<std::string> plan = db.getFilteredMeasurementsQueryPlan(filter, seekCursor);
+                    for (std::string const& line: plan)
+                        CHECK_TRUE(line.find("SCAN") == std::string::npos);
+                    if (!seekCursor)
+                        CHECK_TRUE(std::any_of(plan.begin(), plan.end(), [](std::string const& line) { return line.find("USING INDEX measurementsTimePoint") != std::string::npos; }));
+                }
+            }
+        }
+
+        closeDB(db);
+    }
+}
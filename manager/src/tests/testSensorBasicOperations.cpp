@@ -111,6 +111,29 @@ void testSensorBasicOperations()
 
         closeDB(db);
         loadDB(db);
+        CHECK_TRUE(db.getSensorCount() == 0);
+        closeDB(db);
+    }
+    {
+        std::cout << "\tTesting save/load\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::seconds(5));
+        DB db(clock);
+        createDBWithSensors(db, 5, clock->now());
+
+        //only the changed and removed rows are written
+        DB::SensorDescriptor descriptor = db.getSensor(3).descriptor;
+        descriptor.name = "changed";
+        CHECK_SUCCESS(db.setSensor(db.getSensor(3).id, descriptor));
+        DB::SensorId removedId = db.getSensor(1).id;
+        db.removeSensor(1);
+
+        closeDB(db);
+        loadDB(db);
+        CHECK_EQUALS(db.getSensorCount(), 4u);
+        CHECK_TRUE(db.findSensorById(removedId) == std::nullopt);
+        CHECK_TRUE(db.findSensorIndexByName("changed") == 2);
+        CHECK_TRUE(db.findSensorIndexByName("s0") == 0);
         closeDB(db);
     }
     {
@@ -193,5 +216,122 @@ void testSensorBasicOperations()
         testBoundSensor(descriptor);
         closeDB(db);
     }
+    {
+        std::cout << "\tTesting snapshots\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::seconds(5));
+        DB db(clock);
+        createDBWithSensors(db, 3, clock->now());
+
+        std::shared_ptr<const DB::Snapshot> snapshot = db.getSnapshot();
+        CHECK_EQUALS(snapshot->sensors.size(), 3u);
+        DB::Sensor sensor0 = *snapshot->sensors[0];
+        DB::Sensor sensor1 = *snapshot->sensors[1];
+        CHECK_TRUE(snapshot->findSensorById(sensor1.id) == snapshot->sensors[1].get());
+        CHECK_TRUE(snapshot->findSensorByAddress(sensor1.address) == snapshot->sensors[1].get());
+        CHECK_TRUE(db.getSnapshot() == snapshot); //nothing changed
+
+        //the changed sensor is copied, the others are shared and the old snapshot stays as it was
+        DB::SensorDescriptor descriptor;
+        descriptor.name = "renamed";
+        CHECK_SUCCESS(db.setSensor(sensor1.id, descriptor));
+        std::shared_ptr<const DB::Snapshot> snapshot2 = db.getSnapshot();
+        CHECK_TRUE(snapshot2->findSensorById(sensor1.id)->descriptor == descriptor);
+        CHECK_TRUE(snapshot->findSensorById(sensor1.id)->descriptor == sensor1.descriptor);
+        CHECK_TRUE(snapshot2->sensors[0] == snapshot->sensors[0]);
+        CHECK_TRUE(snapshot2->sensors[2] == snapshot->sensors[2]);
+        CHECK_TRUE(db.findSensorById(sensor1.id)->descriptor == descriptor);
+
+        db.removeSensorById(sensor0.id);
+        std::shared_ptr<const DB::Snapshot> snapshot3 = db.getSnapshot();
+        CHECK_EQUALS(snapshot3->sensors.size(), 2u);
+        CHECK_TRUE(snapshot3->findSensorById(sensor0.id) == nullptr);
+        CHECK_EQUALS(snapshot2->sensors.size(), 3u);
+        CHECK_TRUE(snapshot2->findSensorById(sensor0.id)->descriptor == sensor0.descriptor);
+
+        closeDB(db);
+        CHECK_TRUE(db.getSnapshot()->sensors.empty());
+        CHECK_EQUALS(snapshot3->sensors.size(), 2u);
+    }
+    {
+        std::cout << "\tTesting indexes\n";
+        std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+        clock->advance(std::chrono::seconds(5));
+        DB db(clock);
+        createDBWithSensors(db, 100, clock->now());
+        CHECK_SUCCESS(db.checkIndexes());
+
+        //removing from the middle moves all the entries after it
+        DB::Sensor removed = db.getSensor(10);
+        DB::Sensor moved = db.getSensor(50);
+        db.removeSensor(10);
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_EQUALS(db.findSensorIndexById(moved.id), 49);
+        CHECK_EQUALS(db.findSensorIndexByAddress(moved.address), 49);
+        CHECK_EQUALS(db.findSensorIndexBySerialNumber(moved.serialNumber), 49);
+        CHECK_EQUALS(db.findSensorIndexByName(moved.descriptor.name), 49);
+        CHECK_EQUALS(db.findSensorIndexById(removed.id), -1);
+        CHECK_EQUALS(db.findSensorIndexByAddress(removed.address), -1);
+        CHECK_TRUE(db.getSnapshot()->findSensorByAddress(removed.address) == nullptr);
+
+        //renaming and binding change the keys in place
+        DB::SensorDescriptor descriptor;
+        descriptor.name = "renamed";
+        CHECK_SUCCESS(db.setSensor(moved.id, descriptor));
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_EQUALS(db.findSensorIndexByName(moved.descriptor.name), -1);
+        CHECK_EQUALS(db.findSensorIndexByName("renamed"), 49);
+
+        descriptor.name = "unbound";
+        Result<DB::SensorId> added = db.addSensor(descriptor);
+        CHECK_TRUE(added == success);
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_SUCCESS(db.bindSensor(12345, 1, 2, 3, {}));
+        CHECK_SUCCESS(db.checkIndexes());
+        DB::Sensor bound = *db.findSensorById(added.payload());
+        CHECK_EQUALS(db.findSensorIndexBySerialNumber(12345), int32_t(db.getSensorCount() - 1));
+        CHECK_TRUE(db.getSnapshot()->findSensorByAddress(bound.address)->id == bound.id);
+
+        DB::BaseStationDescriptor bsDescriptor;
+        bsDescriptor.name = "bs";
+        bsDescriptor.mac = { 1, 2, 3, 4, 5, 6 };
+        CHECK_TRUE(db.addBaseStation(bsDescriptor));
+        bsDescriptor.name = "bs2";
+        bsDescriptor.mac = { 1, 2, 3, 4, 5, 7 };
+        CHECK_TRUE(db.addBaseStation(bsDescriptor));
+        CHECK_FALSE(db.addBaseStation(bsDescriptor)); //same name and mac
+        CHECK_SUCCESS(db.checkIndexes());
+        db.removeBaseStation(0);
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_EQUALS(db.findBaseStationIndexByMac({ 1, 2, 3, 4, 5, 7 }), 0);
+        CHECK_EQUALS(db.findBaseStationIndexByMac({ 1, 2, 3, 4, 5, 6 }), -1);
+
+        DB::AlarmDescriptor alarm;
+        alarm.name = "alarm";
+        alarm.sensorBlackoutWatch = true;
+        CHECK_SUCCESS(db.addAlarm(alarm));
+        alarm.name = "alarm2";
+        CHECK_SUCCESS(db.setAlarm(db.getAlarm(0).id, alarm));
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_EQUALS(db.findAlarmIndexByName("alarm"), -1);
+        CHECK_EQUALS(db.findAlarmIndexByName("alarm2"), 0);
+
+        DB::UserDescriptor user;
+        user.name = "User";
+        user.passwordHash = "hash";
+        CHECK_TRUE(db.addUser(user));
+        user.name = "USER"; //names are case insensitive
+        CHECK_FALSE(db.addUser(user));
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_TRUE(db.findUserByName("user") != std::nullopt);
+        CHECK_TRUE(db.findUserByPasswordHash("hash") != std::nullopt);
+
+        closeDB(db);
+        loadDB(db);
+        CHECK_SUCCESS(db.checkIndexes());
+        CHECK_EQUALS(db.findSensorIndexByName("renamed"), 49);
+        CHECK_TRUE(db.findUserByName("USER") != std::nullopt);
+        closeDB(db);
+    }
 }
 
@@ -146,8 +146,10 @@ void testSensorTimeConfig()
         {
             DB::SensorTimeConfig config = db.getLastSensorTimeConfig();
             IClock::duration d = db.computeActualCommsPeriod(config.descriptor);
-            CHECK_TRUE(d >= std::chrono::seconds(10) * count);
-            CHECK_TRUE(d < std::chrono::seconds(10) * (count + 1));
+            //each sensor gets a comms slot between 1 and 10 seconds, and the period is rounded up to the minute
+            CHECK_TRUE(d >= config.descriptor.commsPeriod);
+            CHECK_TRUE(d >= std::chrono::seconds(1) * count);
+            CHECK_TRUE(d < std::chrono::seconds(10) * count + std::chrono::minutes(1));
         };
 
 		createDB(db);
@@ -3,6 +3,8 @@
 #include "sqlite3.h"
 #include <iostream>
 #include <QFileInfo>
+#include <QDir>
+#include <QFile>
 
 Logger s_logger;
 
@@ -19,6 +21,9 @@ void createDB(DB& db)
 	std::string filename = "test.db";
 	remove(filename.c_str());
 	CHECK_FALSE(QFileInfo::exists(filename.c_str()));
+	//and the measurement partitions next to it
+	for (QString const& partitionFilename: QDir(".").entryList(QStringList() << "test_measurements_*", QDir::Files))
+		QFile::remove(partitionFilename);
 	sqlite3* sqlite;
 	CHECK_EQUALS(sqlite3_open_v2(filename.c_str(), &sqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr), SQLITE_OK);
 	s_logger.setStdOutput(Logger::Type::WARNING);
@@ -36,3 +41,86 @@ void loadDB(DB& db)
 	CHECK_TRUE(s_logger.load(*sqlite));
 	CHECK_SUCCESS(db.load(*sqlite));
 }
+void createDBWithSensors(DB& db, size_t sensorCount, IClock::time_point lastCommsTimePoint)
+{
+	createDB(db);
+	sqlite3* sqlite = db.getSqliteDB();
+	{
+		sqlite3_stmt* stmt;
+		CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Sensors (id, name, address, serialNumber, state, lastCommsTimePoint) "
+		                                        "VALUES (?1, ?2, ?3, ?4, 0, ?5);", -1, &stmt, nullptr), SQLITE_OK);
+		CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+		for (size_t i = 0; i < sensorCount; i++)
+		{
+			std::string name = "s" + std::to_string(i);
+			sqlite3_bind_int64(stmt, 1, int64_t(i + 1));
+			sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int64(stmt, 3, int64_t(Radio::SLAVE_ADDRESS_BEGIN + i + 1));
+			sqlite3_bind_int64(stmt, 4, int64_t(i + 1));
+			sqlite3_bind_int64(stmt, 5, IClock::to_time_t(lastCommsTimePoint));
+			CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+			sqlite3_reset(stmt);
+		}
+		CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+		sqlite3_finalize(stmt);
+	}
+	closeDB(db);
+	loadDB(db);
+	CHECK_EQUALS(db.getSensorCount(), sensorCount);
+}
+std::vector<DB::MeasurementDescriptor> makeMeasurements(DB::SensorId sensorId, uint32_t firstIndex, uint32_t count,
+                                                       std::function<float(uint32_t index)> const& temperature)
+{
+	std::vector<DB::MeasurementDescriptor> mds(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		DB::MeasurementDescriptor& md = mds[i];
+		md.sensorId = sensorId;
+		md.index = firstIndex + i;
+		md.temperature = temperature ? temperature(md.index) : 20.f + float(i % 10);
+		md.humidity = 50.f;
+		md.vcc = 3.f;
+	}
+	return mds;
+}
+void insertMeasurements(DB& db, size_t sensorCount, size_t measurementsPerSensor, IClock::time_point start, IClock::duration period,
+                        std::function<void(size_t i, size_t s, RawMeasurement& m)> const& fill)
+{
+	sqlite3* sqlite = db.getSqliteDB();
+	sqlite3_stmt* stmt;
+	CHECK_EQUALS(sqlite3_prepare_v2(sqlite, "INSERT INTO Measurements (timePoint, receivedTimePoint, idx, sensorId, temperature, humidity, vcc, signalStrengthS2B, signalStrengthB2S, sensorErrors, alarmTriggersCurrent, alarmTriggersAdded, alarmTriggersRemoved) "
+	                                        "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, 0, ?10, 0, 0);", -1, &stmt, nullptr), SQLITE_OK);
+	CHECK_EQUALS(sqlite3_exec(sqlite, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+	for (size_t i = 0; i < measurementsPerSensor; i++)
+	{
+		for (size_t s = 0; s < sensorCount; s++)
+		{
+			RawMeasurement m;
+			m.timePoint = start + period * int64_t(i);
+			m.index = uint32_t(i + 1);
+			m.sensorId = DB::SensorId(s + 1);
+			if (fill)
+				fill(i, s, m);
+			sqlite3_bind_int64(stmt, 1, IClock::to_time_t(m.timePoint));
+			sqlite3_bind_int64(stmt, 2, IClock::to_time_t(m.receivedTimePoint.value_or(m.timePoint)));
+			sqlite3_bind_int64(stmt, 3, m.index);
+			sqlite3_bind_int64(stmt, 4, m.sensorId);
+			sqlite3_bind_double(stmt, 5, m.temperature);
+			sqlite3_bind_double(stmt, 6, m.humidity);
+			sqlite3_bind_double(stmt, 7, m.vcc);
+			sqlite3_bind_int(stmt, 8, m.signalStrengthS2B);
+			sqlite3_bind_int(stmt, 9, m.signalStrengthB2S);
+			sqlite3_bind_int64(stmt, 10, m.alarmTriggers);
+			CHECK_EQUALS(sqlite3_step(stmt), SQLITE_DONE);
+			sqlite3_reset(stmt);
+		}
+	}
+	CHECK_EQUALS(sqlite3_exec(sqlite, "END TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+	sqlite3_finalize(stmt);
+}
+std::shared_ptr<ManualClock> createTestClock()
+{
+	std::shared_ptr<ManualClock> clock = std::make_shared<ManualClock>();
+	clock->advance(std::chrono::hours(24 * 365 * 30));
+	return clock;
+}
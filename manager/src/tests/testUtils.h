@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+#include <ctime>
+#include <functional>
 #include "DB.h"
 
 #define CHECK_SUCCESS(x) \
@@ -68,6 +71,31 @@ do {\
 void closeDB(DB& db);
 void createDB(DB& db);
 void loadDB(DB& db);
+//creates a DB with sensorCount bound sensors, inserted directly to skip the per-sensor saves
+void createDBWithSensors(DB& db, size_t sensorCount, IClock::time_point lastCommsTimePoint);
+
+//count measurements of a sensor from firstIndex. The temperature cycles through 10 values unless temperature gives it, by index
+std::vector<DB::MeasurementDescriptor> makeMeasurements(DB::SensorId sensorId, uint32_t firstIndex, uint32_t count,
+                                                       std::function<float(uint32_t index)> const& temperature = nullptr);
+
+//A measurement row inserted directly, for the tests that need a large table quickly
+struct RawMeasurement
+{
+    IClock::time_point timePoint;
+    std::optional<IClock::time_point> receivedTimePoint; //the time point if not set
+    uint32_t index = 0;
+    DB::SensorId sensorId = 0;
+    float temperature = 20.f;
+    float humidity = 50.f;
+    float vcc = 3.f;
+    int8_t signalStrengthS2B = -60;
+    int8_t signalStrengthB2S = -60;
+    uint32_t alarmTriggers = 0;
+};
+//Inserts measurementsPerSensor rows for each of the first sensorCount sensors of createDBWithSensors, in one transaction and
+//interleaved like they are received. Measurement i of sensor s is at start + i * period, with index i + 1, and fill can change it
+void insertMeasurements(DB& db, size_t sensorCount, size_t measurementsPerSensor, IClock::time_point start, IClock::duration period,
+                        std::function<void(size_t i, size_t s, RawMeasurement& m)> const& fill = nullptr);
 
 class ManualClock : public IClock
 {
@@ -79,3 +107,23 @@ public:
 private:
     time_point m_timePoint = time_point(duration::zero());
 };
+//30 years after the epoch, so the sensor time configs and the measurement indices have room before now
+std::shared_ptr<ManualClock> createTestClock();
+
+//The wall time, and the CPU time of the process with all its threads, since it was created or restarted
+class Stopwatch
+{
+public:
+    Stopwatch() { restart(); }
+    void restart() { m_start = std::chrono::steady_clock::now(); m_cpuStart = std::clock(); }
+
+    std::chrono::steady_clock::duration elapsed() const { return std::chrono::steady_clock::now() - m_start; }
+    double seconds() const { return std::chrono::duration<double>(elapsed()).count(); }
+    double ms() const { return std::chrono::duration<double, std::milli>(elapsed()).count(); }
+    double us() const { return std::chrono::duration<double, std::micro>(elapsed()).count(); }
+    double cpuMs() const { return double(std::clock() - m_cpuStart) * 1000.0 / CLOCKS_PER_SEC; }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    std::clock_t m_cpuStart = 0;
+};